@@ -7,13 +7,19 @@
 
 Array *performRandomMutation(state *pda, Array *input) {
 
+  return performMutationAt(pda, input, rand_below(global_afl, input->used));
+
+}
+
+// Regenerates the walk from offset `idx` on
+Array *performMutationAt(state *pda, Array *input, int idx) {
+
   terminal *term_ptr;
   // terminal *prev_ptr;
   Array *mutated;
   Array *sliced;
 
-  // Get offset at which to generate new input and slice it
-  int idx = rand_below(global_afl, input->used);
+  // Slice the input at the offset at which to generate new input
   sliced = slice(input, idx);
   // print_repr(sliced, "Slice");
 
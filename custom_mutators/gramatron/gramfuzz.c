@@ -31,6 +31,11 @@ typedef struct my_mutator {
   int mut_idx;  // Signals the current mutator being used, used to cycle through
                 // each mutator
 
+  // AFLRun feedback per automaton state, see pick_mutation_idx
+  u32 *state_uses;   // Random mutations at the state
+  u32 *state_finds;  // Credit of seeds they found, by their fringes
+  int  mut_state;    // State of the last random mutation, -1 if none
+
   unsigned int seed;
 
 } my_mutator_t;
@@ -163,6 +168,9 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
   if (automaton_file) {
 
     pda = create_pda(automaton_file);
+    data->state_uses = calloc(numstates, sizeof(u32));
+    data->state_finds = calloc(numstates, sizeof(u32));
+    data->mut_state = -1;
 
   } else {
 
@@ -177,6 +185,46 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
 }
 
+/* Targets of AFLRun are only known once the forkserver is up */
+static int is_directed(my_mutator_t *data) {
+
+  return data->afl->fsrv.num_reachables != 0;
+
+}
+
+/* With AFLRun, pick the offset of a random mutation by the state there: the
+   offsets of each state in the walk share its weight, the credit of seeds
+   found by mutating it per mutation, both plus one, so that states whose
+   expansion reaches fringes of the targets are expanded more often, and
+   unused ones still get their chance. Uniform otherwise. */
+static int pick_mutation_idx(my_mutator_t *data) {
+
+  Array *walk = data->orig_walk;
+  if (!is_directed(data)) return rand_below(global_afl, walk->used);
+
+  double total = 0;
+  for (int s = 0; s < numstates; s++) {
+
+    total += utarray_len(data->statemap[s].nums) *
+             (data->state_finds[s] + 1.0) / (data->state_uses[s] + 1.0);
+
+  }
+
+  double r = rand_next_percent(global_afl) * total;
+  for (int s = 0; s < numstates; s++) {
+
+    UT_array *nums = data->statemap[s].nums;
+    int       n = utarray_len(nums);
+    if (!n) continue;
+    r -= n * (data->state_finds[s] + 1.0) / (data->state_uses[s] + 1.0);
+    if (r < 0) return *(int *)utarray_eltptr(nums, rand_below(global_afl, n));
+
+  }
+
+  return rand_below(global_afl, walk->used);
+
+}
+
 size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
                        u8 **out_buf, uint8_t *add_buf, size_t add_buf_size,
                        size_t max_size) {
@@ -197,8 +245,13 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
 
   // printf("\nChoice:%d", choice);
 
+  data->mut_state = -1;
+
   if (data->mut_idx == 0) {  // Perform random mutation
-    data->mutated_walk = performRandomMutation(pda, data->orig_walk);
+    int idx = pick_mutation_idx(data);
+    data->mut_state = data->orig_walk->start[idx].state;
+    data->state_uses[data->mut_state] += 1;
+    data->mutated_walk = performMutationAt(pda, data->orig_walk, idx);
     data->mut_alloced = 1;
 
   } else if (data->mut_idx == 1 &&
@@ -284,6 +337,16 @@ u8 afl_custom_queue_new_entry(my_mutator_t * data,
 
     write_input(data->mutated_walk, automaton_fn);
 
+    // Credit the state of the mutation by the fringes the new seed covers
+    if (data->mut_state >= 0 && is_directed(data)) {
+
+      aflrun_seed_info_t info;
+      data->afl->aflrun_seed_info(data->afl, data->afl->queue_top->id, &info);
+      data->state_finds[data->mut_state] +=
+          info.focus ? 2 : info.num_fringes != 0;
+
+    }
+
   } else {
 
     new_input = gen_input(pda, NULL);
@@ -422,6 +485,8 @@ uint8_t afl_custom_queue_get(my_mutator_t *data, const uint8_t *filename) {
 
 void afl_custom_deinit(my_mutator_t *data) {
 
+  free(data->state_uses);
+  free(data->state_finds);
   free(data->mutator_buf);
   free(data);
 
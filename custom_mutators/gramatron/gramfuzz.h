@@ -156,6 +156,7 @@ Array *spliceGF(Array *, Array *, int);
 Array *performSpliceOne(Array *, IdxMap_new *, Array *);
 /* Mutation Methods*/
 Array *    performRandomMutation(state *, Array *);
+Array *    performMutationAt(state *, Array *, int);
 Array *    performRandomMutationCount(state *, Array *, int *);
 Array *    performSpliceMutationBench(state *, Array *, Candidate **);
 UT_array **get_dupes(Array *, int *);
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 #include "config.h"
 #include "debug.h"
 #include "afl-fuzz.h"
@@ -19,6 +20,20 @@ afl_state_t *afl_struct;
     {}
 #endif
 
+#define SYMCC_MAX_WORKERS 64
+
+/* A symcc process running in the background on its own copy of a test case,
+   writing the test cases it generates to its own directory. */
+
+typedef struct symcc_worker {
+
+  pid_t pid;                            /* 0 if idle                        */
+  u32   seed;                           /* Queue entry it runs on           */
+  u8 *  dir;                            /* Its SYMCC_OUTPUT_DIR             */
+  u8 *  input;                          /* Copy of the test case            */
+
+} symcc_worker_t;
+
 typedef struct my_mutator {
 
   afl_state_t *afl;
@@ -28,6 +43,12 @@ typedef struct my_mutator {
   u8 *         target;
   uint32_t     seed;
 
+  u8             undirected;            /* SYMCC_UNDIRECTED is set          */
+  u32            num_workers;
+  symcc_worker_t workers[SYMCC_MAX_WORKERS];
+  u8 *           given;                 /* Queue entries given to a worker  */
+  u32            given_size;
+
 } my_mutator_t;
 
 my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
@@ -62,8 +83,18 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
 
   }
 
+  data->num_workers = 1;
+  if (getenv("SYMCC_WORKERS")) {
+
+    data->num_workers = atoi(getenv("SYMCC_WORKERS"));
+    if (data->num_workers < 1 || data->num_workers > SYMCC_MAX_WORKERS)
+      FATAL("SYMCC_WORKERS must be between 1 and %u", SYMCC_MAX_WORKERS);
+
+  }
+
+  data->undirected = !!getenv("SYMCC_UNDIRECTED");
+
   data->tmp_dir = alloc_printf("%s/tmp", data->out_dir);
-  setenv("SYMCC_OUTPUT_DIR", data->tmp_dir, 1);
   int pid = fork();
 
   if (pid == -1) return NULL;
@@ -93,146 +124,231 @@ my_mutator_t *afl_custom_init(afl_state_t *afl, unsigned int seed) {
   if (mkdir(data->tmp_dir, 0755))
     PFATAL("Could not create directory %s", data->tmp_dir);
 
+  for (u32 i = 0; i < data->num_workers; ++i) {
+
+    data->workers[i].dir = alloc_printf("%s/%u", data->tmp_dir, i);
+    data->workers[i].input = alloc_printf("%s/%u.input", data->tmp_dir, i);
+    if (mkdir(data->workers[i].dir, 0755))
+      PFATAL("Could not create directory %s", data->workers[i].dir);
+
+  }
+
   DBG("out_dir=%s, target=%s\n", data->out_dir, data->target);
 
   return data;
 
 }
 
-/* When a new queue entry is added we run this input with the symcc
-   instrumented binary */
-uint8_t afl_custom_queue_new_entry(my_mutator_t * data,
-                                   const uint8_t *filename_new_queue,
-                                   const uint8_t *filename_orig_queue) {
+/* Seeds are picked by AFLRun unless SYMCC_UNDIRECTED is set or the target is
+   not instrumented for it. */
 
-  int         pipefd[2];
-  struct stat st;
-  ACTF("Queueing to symcc: %s", filename_new_queue);
-  u8 *fn = alloc_printf("%s", filename_new_queue);
-  if (!(stat(fn, &st) == 0 && S_ISREG(st.st_mode) && st.st_size)) {
+static u8 is_directed(my_mutator_t *data) {
 
-    ck_free(fn);
-    PFATAL("Couldn't find enqueued file: %s", fn);
+  return !data->undirected && data->afl->fsrv.num_reachables;
+
+}
+
+/* Move test cases generated by a worker to the output dir. Their names collide
+   between runs, since symcc just numbers them, so they are prefixed with the
+   name of the seed. */
+
+static void collect_worker(my_mutator_t *data, symcc_worker_t *w) {
+
+  struct dirent **nl;
+  int32_t         items = scandir(w->dir, &nl, NULL, NULL);
+  u8 *            origin_name = basename(data->afl->queue_buf[w->seed]->fname);
+  int32_t         i;
+
+  if (items <= 0) return;
+
+  for (i = 0; i < items; ++i) {
+
+    struct stat st;
+    u8 *        source_name = alloc_printf("%s/%s", w->dir, nl[i]->d_name);
+    if (stat(source_name, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+
+      u8 *destination_name =
+          alloc_printf("%s/%s.%s", data->out_dir, origin_name, nl[i]->d_name);
+      rename(source_name, destination_name);
+      ck_free(destination_name);
+      DBG("found=%s\n", source_name);
+
+    }
+
+    ck_free(source_name);
+    free(nl[i]);
 
   }
 
-  if (afl_struct->fsrv.use_stdin) {
+  free(nl);
 
-    if (pipe(pipefd) == -1) {
+}
 
-      ck_free(fn);
-      PFATAL("Couldn't create a pipe for interacting with symcc child process");
+/* Collect the results of workers that are done, and return an idle worker,
+   waiting for the first busy one if `wait` is set and none is idle, or NULL
+   otherwise. */
+
+static symcc_worker_t *idle_worker(my_mutator_t *data, u8 wait) {
+
+  symcc_worker_t *idle = NULL;
+
+  for (u32 i = 0; i < data->num_workers; ++i) {
+
+    symcc_worker_t *w = data->workers + i;
+    if (w->pid && waitpid(w->pid, NULL, WNOHANG) == w->pid) {
+
+      w->pid = 0;
+      collect_worker(data, w);
 
     }
 
+    if (!w->pid && !idle) idle = w;
+
   }
 
+  if (!idle && wait) {
+
+    idle = data->workers;
+    waitpid(idle->pid, NULL, 0);
+    idle->pid = 0;
+    collect_worker(data, idle);
+
+  }
+
+  return idle;
+
+}
+
+/* Run symcc on a copy of `buf` in the background with worker `w`. */
+
+static void start_worker(my_mutator_t *data, symcc_worker_t *w, u32 seed,
+                         const u8 *buf, size_t len) {
+
+  int fd = open(w->input, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (fd < 0) PFATAL("Unable to create '%s'", w->input);
+  ck_write(fd, buf, len, w->input);
+  close(fd);
+
   int pid = fork();
 
-  if (pid == -1) return 0;
+  if (pid == -1) return;
 
   if (pid) {
 
-    if (afl_struct->fsrv.use_stdin) {
+    w->pid = pid;
+    w->seed = seed;
+    return;
 
-      close(pipefd[0]);
-      int fd = open(fn, O_RDONLY);
+  }
 
-      if (fd >= 0) {
+  setenv("SYMCC_OUTPUT_DIR", w->dir, 1);
 
-        ssize_t r = read(fd, data->mutator_buf, MAX_FILE);
-        DBG("fn=%s, fd=%d, size=%ld\n", fn, fd, r);
-        ck_free(fn);
-        close(fd);
-        if (r <= 0) {
+  if (afl_struct->fsrv.use_stdin) {
 
-          close(pipefd[1]);
-          return 0;
+    unsetenv("SYMCC_INPUT_FILE");
+    fd = open(w->input, O_RDONLY);
+    dup2(fd, 0);
+    close(fd);
 
-        }
+  } else {
 
-        if (r > fcntl(pipefd[1], F_GETPIPE_SZ))
-          fcntl(pipefd[1], F_SETPIPE_SZ, MAX_FILE);
-        ck_write(pipefd[1], data->mutator_buf, r, filename_new_queue);
+    /* Read the copy instead of the current input of afl-fuzz, which keeps
+       changing while symcc runs. */
+    setenv("SYMCC_INPUT_FILE", w->input, 1);
+    for (char **arg = afl_struct->argv; *arg; ++arg)
+      if (!strcmp(*arg, afl_struct->fsrv.out_file)) *arg = w->input;
 
-      } else {
+  }
 
-        ck_free(fn);
-        close(pipefd[1]);
-        PFATAL(
-            "Something happened to the enqueued file before sending its "
-            "contents to symcc binary");
+  DBG("exec=%s\n", data->target);
+  close(1);
+  close(2);
+  dup2(afl_struct->fsrv.dev_null_fd, 1);
+  dup2(afl_struct->fsrv.dev_null_fd, 2);
 
-      }
+  execvp(data->target, afl_struct->argv);
+  DBG("exec=FAIL\n");
+  exit(-1);
 
-      close(pipefd[1]);
+}
 
-    }
+/* Without AFLRun, when a new queue entry is added we run this input with the
+   symcc instrumented binary, waiting for a worker if all are busy. */
+uint8_t afl_custom_queue_new_entry(my_mutator_t * data,
+                                   const uint8_t *filename_new_queue,
+                                   const uint8_t *filename_orig_queue) {
 
-    pid = waitpid(pid, NULL, 0);
+  struct stat st;
 
-    // At this point we need to transfer files to output dir, since their names
-    // collide and symcc will just overwrite them
+  if (is_directed(data)) return 0;
 
-    struct dirent **nl;
-    int32_t         items = scandir(data->tmp_dir, &nl, NULL, NULL);
-    u8 *            origin_name = basename(filename_new_queue);
-    int32_t         i;
-    if (items > 0) {
+  ACTF("Queueing to symcc: %s", filename_new_queue);
+  u8 *fn = alloc_printf("%s", filename_new_queue);
+  if (!(stat(fn, &st) == 0 && S_ISREG(st.st_mode) && st.st_size)) {
 
-      for (i = 0; i < (u32)items; ++i) {
+    ck_free(fn);
+    PFATAL("Couldn't find enqueued file: %s", fn);
 
-        struct stat st;
-        u8 *source_name = alloc_printf("%s/%s", data->tmp_dir, nl[i]->d_name);
-        DBG("test=%s\n", fn);
-        if (stat(source_name, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+  }
 
-          u8 *destination_name =
-              alloc_printf("%s/%s.%s", data->out_dir, origin_name, nl[i]->d_name);
-          rename(source_name, destination_name);
-          ck_free(destination_name);
-          DBG("found=%s\n", source_name);
+  int fd = open(fn, O_RDONLY);
 
-        }
+  if (fd < 0) {
 
-        ck_free(source_name);
-        free(nl[i]);
+    ck_free(fn);
+    PFATAL(
+        "Something happened to the enqueued file before sending its "
+        "contents to symcc binary");
 
-      }
+  }
 
-      free(nl);
+  ssize_t r = read(fd, data->mutator_buf, MAX_FILE);
+  DBG("fn=%s, fd=%d, size=%ld\n", fn, fd, r);
+  ck_free(fn);
+  close(fd);
+  if (r <= 0) return 0;
 
-    }
+  start_worker(data, idle_worker(data, 1), afl_struct->queue_top->id,
+               data->mutator_buf, r);
 
-  }
+  return 0;
 
-  if (pid == 0) {
+}
 
-    if (afl_struct->fsrv.use_stdin) {
+/* With AFLRun, give the seed being fuzzed to an idle worker if it covers a
+   progressive fringe or a target, has decisive blocks whose branches lead to
+   its fringes, and energy in this cycle. Seeds with more energy are fuzzed
+   more often, so they get a worker first. Each seed is given only once, as
+   symcc negates all branches along its path in one run. */
 
-      unsetenv("SYMCC_INPUT_FILE");
-      close(pipefd[1]);
-      dup2(pipefd[0], 0);
+static void pick_seed(my_mutator_t *data, const u8 *buf, size_t buf_size) {
 
-    } else {
+  afl_state_t *afl = data->afl;
+  if (!afl->queue_cur) return;
 
-      setenv("SYMCC_INPUT_FILE", afl_struct->fsrv.out_file, 1);
+  u32 id = afl->queue_cur->id;
+  if (id < data->given_size && data->given[id]) return;
 
-    }
+  aflrun_seed_info_t info;
+  afl->aflrun_seed_info(afl, id, &info);
+  if (!info.focus || !info.num_decisives || info.quant_score <= 0) return;
 
-    DBG("exec=%s\n", data->target);
-    close(1);
-    close(2);
-    dup2(afl_struct->fsrv.dev_null_fd, 1);
-    dup2(afl_struct->fsrv.dev_null_fd, 2);
+  symcc_worker_t *w = idle_worker(data, 0);
+  if (!w) return;
 
-    execvp(data->target, afl_struct->argv);
-    DBG("exec=FAIL\n");
-    exit(-1);
+  if (id >= data->given_size) {
+
+    u32 size = MAX(id + 1, data->given_size * 2);
+    data->given = realloc(data->given, size);
+    if (!data->given) PFATAL("given alloc");
+    memset(data->given + data->given_size, 0, size - data->given_size);
+    data->given_size = size;
 
   }
 
-  return 0;
+  data->given[id] = 1;
+  DBG("pick=%u, energy=%f\n", id, info.quant_score);
+  start_worker(data, w, id, buf, buf_size);
 
 }
 
@@ -241,7 +357,11 @@ uint32_t afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
 
   uint32_t        count = 0, i;
   struct dirent **nl;
-  int32_t         items = scandir(data->out_dir, &nl, NULL, NULL);
+
+  if (is_directed(data)) pick_seed(data, buf, buf_size);
+  idle_worker(data, 0);
+
+  int32_t items = scandir(data->out_dir, &nl, NULL, NULL);
 
   if (items > 0) {
 
@@ -280,6 +400,9 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
   int32_t         i, done = 0, items = scandir(data->out_dir, &nl, NULL, NULL);
   ssize_t         size = 0;
 
+  /* afl-fuzz keeps calling us with AFLRun even when there is nothing left */
+  *out_buf = data->mutator_buf;
+
   if (items <= 0) return 0;
 
   for (i = 0; i < (u32)items; ++i) {
@@ -296,7 +419,6 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
         if (fd >= 0) {
 
           size = read(fd, data->mutator_buf, max_size);
-          *out_buf = data->mutator_buf;
 
           close(fd);
           done = 1;
@@ -316,7 +438,7 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
 
   free(nl);
   DBG("FUZZ size=%lu\n", size);
-  return (uint32_t)size;
+  return size > 0 ? (uint32_t)size : 0;
 
 }
 
@@ -327,6 +449,18 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
  */
 void afl_custom_deinit(my_mutator_t *data) {
 
+  for (u32 i = 0; i < data->num_workers; ++i) {
+
+    if (data->workers[i].pid) {
+
+      kill(data->workers[i].pid, SIGKILL);
+      waitpid(data->workers[i].pid, NULL, 0);
+
+    }
+
+  }
+
+  free(data->given);
   free(data->mutator_buf);
   free(data);
 
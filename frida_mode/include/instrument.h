@@ -15,6 +15,7 @@ extern guint64  instrument_hash_zero;
 extern char    *instrument_coverage_unstable_filename;
 extern gboolean instrument_coverage_insn;
 extern char    *instrument_regs_filename;
+extern char    *instrument_aflrun_dir;
 
 extern gboolean instrument_use_fixed_seed;
 extern guint64  instrument_fixed_seed;
@@ -68,6 +69,11 @@ void instrument_cache_config(void);
 void instrument_cache_init(void);
 void instrument_cache_insert(gpointer real_address, gpointer code_address);
 void instrument_cache(const cs_insn *instr, GumStalkerOutput *output);
+void instrument_aflrun_config(void);
+void instrument_aflrun_init(void);
+void instrument_aflrun(GumStalkerIterator *iterator, GumStalkerOutput *output,
+                       const cs_insn *instr);
+
 void instrument_write_regs(GumCpuContext *cpu_context, gpointer user_data);
 void instrument_regs_format(int fd, char *format, ...);
 
@@ -235,6 +235,8 @@ static void instrument_basic_block(GumStalkerIterator *iterator,
 
         }
 
+        instrument_aflrun(iterator, output, instr);
+
         if (unlikely(instrument_regs_filename != NULL)) {
 
           gum_stalker_iterator_put_callout(iterator, instrument_write_regs,
@@ -296,6 +298,7 @@ void instrument_config(void) {
   asan_config();
   cmplog_config();
   instrument_cache_config();
+  instrument_aflrun_config();
 
 }
 
@@ -406,6 +409,7 @@ void instrument_init(void) {
   instrument_coverage_optimize_init();
   instrument_debug_init();
   instrument_cache_init();
+  instrument_aflrun_init();
 
 }
 
@@ -0,0 +1,359 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "frida-gumjs.h"
+
+#include "config.h"
+
+#include "instrument.h"
+#include "util.h"
+
+/*
+ * AFLRun instrumentation of binary-only targets: AFL_FRIDA_AFLRUN_DIR names
+ * an AFLRun temporary directory, as given to afl-fuzz with --dir, which holds
+ * BBreachable.txt and Freachable.txt of the target plus BBaddrs.txt, written
+ * by the offline CFG/distance tool, with one line per reachable block or
+ * function:
+ *
+ *   b <index> <module> 0x<offset>
+ *   f <index> <module> 0x<offset>
+ *
+ * where <index> is the line of the block in BBreachable.txt (or of the
+ * function in Freachable.txt) and <offset> is its address in <module>, which
+ * is matched against the end of the module paths like AFL_FRIDA_INST_RANGES.
+ *
+ * Blocks are then instrumented like aflrun-pass does: the bit of the block in
+ * the context-sensitive map is tested inline and aflrun_inst() of the runtime
+ * updates the rbb/tr/vir/tt maps only when it is not set yet in this run.
+ * There are no call contexts in FRIDA mode, so `__afl_call_ctx` stays 0.
+ */
+
+#define AFLRUN_BLOCKS_FILE "BBaddrs.txt"
+
+/* Compiled in by aflrun-pass otherwise, and read by __afl_manual_init() */
+reach_t   __aflrun_num_targets, __aflrun_num_reachables, __aflrun_num_freachables;
+const u32 __aflrun_ctx_size_pow2 = CTX_SIZE_POW2;
+
+extern uint8_t *__afl_tr_ptr;
+extern uint8_t *__afl_rf_ptr;
+
+#if defined(__x86_64__)
+bool aflrun_inst(u64 block);
+void aflrun_f_inst(u64 func);
+#else
+bool aflrun_inst(u32 block);
+void aflrun_f_inst(u32 func);
+#endif
+
+char *instrument_aflrun_dir = NULL;
+
+static GHashTable *aflrun_blocks = NULL;   /* address -> 1 + block index    */
+static GHashTable *aflrun_funcs = NULL;    /* address -> 1 + function index */
+
+typedef struct {
+
+  gchar     *suffix;
+  GumAddress base;
+
+} aflrun_module_ctx_t;
+
+static gboolean instrument_aflrun_find_module(const GumModuleDetails *details,
+                                              gpointer user_data) {
+
+  aflrun_module_ctx_t *ctx = (aflrun_module_ctx_t *)user_data;
+  if (details->path == NULL) { return true; }
+  if (!g_str_has_suffix(details->path, ctx->suffix)) { return true; }
+
+  ctx->base = details->range->base_address;
+  return false;
+
+}
+
+static GumAddress instrument_aflrun_module_base(GHashTable *modules,
+                                                gchar      *name) {
+
+  gpointer base;
+  if (g_hash_table_lookup_extended(modules, name, NULL, &base)) {
+
+    return GUM_ADDRESS(base);
+
+  }
+
+  aflrun_module_ctx_t ctx = {.suffix = g_strconcat("/", name, NULL),
+                             .base = 0};
+  gum_process_enumerate_modules(instrument_aflrun_find_module, &ctx);
+  g_free(ctx.suffix);
+
+  if (ctx.base == 0) { FFATAL("AFLRun module not found: %s", name); }
+
+  g_hash_table_insert(modules, g_strdup(name), GSIZE_TO_POINTER(ctx.base));
+  return ctx.base;
+
+}
+
+static void instrument_aflrun_header(char *name, reach_t *num_targets,
+                                     reach_t *num_reachables) {
+
+  gchar *path = g_build_filename(instrument_aflrun_dir, name, NULL);
+  gchar *contents = NULL;
+
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+
+    FFATAL("Failed to read '%s'", path);
+
+  }
+
+  if (sscanf(contents, "%u,%u", num_targets, num_reachables) != 2 ||
+      *num_targets == 0 || *num_targets > *num_reachables) {
+
+    FFATAL("Wrong format for '%s'", path);
+
+  }
+
+  g_free(contents);
+  g_free(path);
+
+}
+
+static void instrument_aflrun_load(void) {
+
+  gchar      *path = g_build_filename(instrument_aflrun_dir, AFLRUN_BLOCKS_FILE,
+                                      NULL);
+  gchar      *contents = NULL;
+  GHashTable *modules =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  guint       num_blocks = 0, num_funcs = 0;
+
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+
+    FFATAL("Failed to read '%s'", path);
+
+  }
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for (guint i = 0; lines[i] != NULL; i++) {
+
+    char    kind, module[PATH_MAX];
+    guint   index;
+    guint64 offset;
+
+    if (lines[i][0] == '\0' || lines[i][0] == '#') { continue; }
+
+    if (sscanf(lines[i], "%c %u %4095s 0x%" G_GINT64_MODIFIER "x", &kind,
+               &index, module, &offset) != 4 ||
+        (kind != 'b' && kind != 'f')) {
+
+      FFATAL("Invalid line %u of '%s': %s", i + 1, path, lines[i]);
+
+    }
+
+    gpointer address = GSIZE_TO_POINTER(
+        instrument_aflrun_module_base(modules, module) + offset);
+
+    if (kind == 'b') {
+
+      if (index >= __aflrun_num_reachables) {
+
+        FFATAL("Invalid block index on line %u of '%s'", i + 1, path);
+
+      }
+
+      g_hash_table_insert(aflrun_blocks, address, GSIZE_TO_POINTER(index + 1));
+      num_blocks++;
+
+    } else {
+
+      if (index >= __aflrun_num_freachables) {
+
+        FFATAL("Invalid function index on line %u of '%s'", i + 1, path);
+
+      }
+
+      g_hash_table_insert(aflrun_funcs, address, GSIZE_TO_POINTER(index + 1));
+      num_funcs++;
+
+    }
+
+  }
+
+  FOKF(cBLU "Instrumentation" cRST " - " cGRN "aflrun blocks:" cYEL
+            " [%u/%u], " cGRN "functions:" cYEL " [%u/%u]",
+       num_blocks, __aflrun_num_reachables, num_funcs,
+       __aflrun_num_freachables);
+
+  g_strfreev(lines);
+  g_hash_table_destroy(modules);
+  g_free(contents);
+  g_free(path);
+
+}
+
+void instrument_aflrun_config(void) {
+
+  instrument_aflrun_dir = getenv("AFL_FRIDA_AFLRUN_DIR");
+
+}
+
+void instrument_aflrun_init(void) {
+
+  FOKF(cBLU "Instrumentation" cRST " - " cGRN "aflrun:" cYEL " [%s]",
+       instrument_aflrun_dir == NULL ? " " : instrument_aflrun_dir);
+
+  if (instrument_aflrun_dir == NULL) { return; }
+
+  instrument_aflrun_header("BBreachable.txt", &__aflrun_num_targets,
+                           &__aflrun_num_reachables);
+  reach_t num_ftargets;
+  instrument_aflrun_header("Freachable.txt", &num_ftargets,
+                           &__aflrun_num_freachables);
+
+  aflrun_blocks = g_hash_table_new(g_direct_hash, g_direct_equal);
+  aflrun_funcs = g_hash_table_new(g_direct_hash, g_direct_equal);
+  instrument_aflrun_load();
+
+}
+
+/* Slow paths, also testing the bit themselves where it is not inlined. */
+
+static void instrument_aflrun_block(GumCpuContext *context,
+                                    gpointer       user_data) {
+
+  UNUSED_PARAMETER(context);
+
+  reach_t block = GPOINTER_TO_SIZE(user_data);
+  if (__afl_tr_ptr != NULL && (__afl_tr_ptr[CTX_NUM_BYTES * block] & 1)) {
+
+    return;
+
+  }
+
+  aflrun_inst(block);
+
+}
+
+static void instrument_aflrun_func(GumCpuContext *context,
+                                   gpointer       user_data) {
+
+  UNUSED_PARAMETER(context);
+
+  reach_t func = GPOINTER_TO_SIZE(user_data);
+  if (__afl_rf_ptr != NULL && IS_SET(__afl_rf_ptr, func)) { return; }
+
+  aflrun_f_inst(func);
+
+}
+
+#if defined(__x86_64__)
+
+/* Put the callout only if bit `bit` at `offset` of the map `*map` is not set
+   (or `*map` is NULL as the runtime is not initialized), saving rax and the
+   flags below the red zone:
+
+     lea    rsp,[rsp-0x80]
+     pushf
+     push   rax
+     movabs rax,<map>
+     mov    rax,QWORD PTR [rax]
+     test   rax,rax
+     je     done
+     test   BYTE PTR [rax+<offset>],<bit>
+     jne    done
+     <callout>
+   done:
+     pop    rax
+     popf
+     lea    rsp,[rsp+0x80]
+ */
+
+static void instrument_aflrun_write(GumStalkerIterator *iterator,
+                                    GumStalkerOutput *output, uint8_t **map,
+                                    guint32 offset, guint8 bit,
+                                    GumStalkerCallout callout,
+                                    gpointer          user_data) {
+
+  GumX86Writer *cw = output->writer.x86;
+  gconstpointer done = cw->code + 1;
+  guint8 test_byte[7] = {0xf6, 0x80};
+
+  *((guint32 *)&test_byte[2]) = offset;
+  test_byte[6] = bit;
+
+  gum_x86_writer_put_lea_reg_reg_offset(cw, GUM_X86_RSP, GUM_X86_RSP,
+                                        -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_pushfx(cw);
+  gum_x86_writer_put_push_reg(cw, GUM_X86_RAX);
+
+  gum_x86_writer_put_mov_reg_address(cw, GUM_X86_RAX, GUM_ADDRESS(map));
+  gum_x86_writer_put_mov_reg_reg_offset_ptr(cw, GUM_X86_RAX, GUM_X86_RAX, 0);
+  gum_x86_writer_put_test_reg_reg(cw, GUM_X86_RAX, GUM_X86_RAX);
+  gum_x86_writer_put_jcc_near_label(cw, X86_INS_JE, done, GUM_NO_HINT);
+  gum_x86_writer_put_bytes(cw, test_byte, sizeof(test_byte));
+  gum_x86_writer_put_jcc_near_label(cw, X86_INS_JNE, done, GUM_NO_HINT);
+
+  gum_stalker_iterator_put_callout(iterator, callout, user_data, NULL);
+
+  gum_x86_writer_put_label(cw, done);
+  gum_x86_writer_put_pop_reg(cw, GUM_X86_RAX);
+  gum_x86_writer_put_popfx(cw);
+  gum_x86_writer_put_lea_reg_reg_offset(cw, GUM_X86_RSP, GUM_X86_RSP,
+                                        GUM_RED_ZONE_SIZE);
+
+}
+
+#endif
+
+void instrument_aflrun(GumStalkerIterator *iterator, GumStalkerOutput *output,
+                       const cs_insn *instr) {
+
+  if (instrument_aflrun_dir == NULL) { return; }
+
+  gpointer address = GSIZE_TO_POINTER(instr->address);
+  gsize    func = GPOINTER_TO_SIZE(g_hash_table_lookup(aflrun_funcs, address));
+  gsize    block = GPOINTER_TO_SIZE(g_hash_table_lookup(aflrun_blocks, address));
+
+  /* aflrun-pass instruments the function before its entry block */
+
+  if (func != 0) {
+
+    func--;
+#if defined(__x86_64__)
+    if (instrument_optimize) {
+
+      instrument_aflrun_write(iterator, output, &__afl_rf_ptr, func / 8,
+                              1 << (func % 8), instrument_aflrun_func,
+                              GSIZE_TO_POINTER(func));
+
+    } else
+#endif
+    {
+
+      gum_stalker_iterator_put_callout(iterator, instrument_aflrun_func,
+                                       GSIZE_TO_POINTER(func), NULL);
+
+    }
+
+  }
+
+  if (block != 0) {
+
+    block--;
+#if defined(__x86_64__)
+    if (instrument_optimize) {
+
+      instrument_aflrun_write(iterator, output, &__afl_tr_ptr,
+                              CTX_NUM_BYTES * block, 1, instrument_aflrun_block,
+                              GSIZE_TO_POINTER(block));
+
+    } else
+#endif
+    {
+
+      gum_stalker_iterator_put_callout(iterator, instrument_aflrun_block,
+                                       GSIZE_TO_POINTER(block), NULL);
+
+    }
+
+  }
+
+}
@@ -150,6 +150,18 @@ struct tainted {
 
 };
 
+/* Trace bits kept for a top-rated entry, one per byte of the map, in runs of
+   64-bit words: a header word with the index of the first word of the run in
+   its high half and the number of words in its low half, then these words.
+   Runs are cut where two or more zero words would be stored. */
+
+typedef struct trace_mini {
+
+  u32 size;                             /* Number of words in `data`        */
+  u64 data[];
+
+} trace_mini_t;
+
 struct queue_entry {
 
   u8 *fname;                            /* File name for the test case      */
@@ -189,7 +201,7 @@ struct queue_entry {
       fuzzed_times,                     /* Number of times being tested     */
       stats_mutated;                    /* stats: # of mutations performed  */
 
-  u8 *trace_mini;                       /* Trace bytes, if kept             */
+  trace_mini_t *trace_mini;             /* Trace bits, if kept              */
   u32 tc_ref;                           /* Trace bytes ref count            */
 
 #ifdef INTROSPECTION
@@ -200,6 +212,9 @@ struct queue_entry {
       weight;
 
   u8 *testcase_buf;                     /* The testcase buffer, if loaded.  */
+  u32  testcase_mmap_len;               /* Length of its mapping, if mapped */
+  struct queue_entry *mmap_prev,        /* Neighbours in the list of mapped */
+      *mmap_next;                       /* testcases, by last use           */
 
   u8             *cmplog_colorinput;    /* the result buf of colorization   */
   struct tainted *taint;                /* Taint information from CmpLog    */
@@ -213,8 +228,25 @@ struct queue_entry {
 
   /* --- Used only in multiple-path mode --- */
   u64 path_cksum;
+  u64 sched_spent;                      /* shared quanta at start of cycle  */
 
   u8 aflrun_extra;
+  u8 aflrun_fuzzed;                     /* Fuzzed in current AFLRun cycle   */
+
+  /* Regions of `infl_size` bytes whose change alters the path, by index,
+     found by influence_stage() once `infl_done` is set */
+  u8   infl_done;
+  u32 *infl_regions;
+  u32  infl_cnt, infl_size;
+
+  /* 1: data is in our segment store at `seg_off` of data file `seg`;
+     2: it comes from the segment store of the dir resumed from, and
+        `seg_off` is its record there, until pivot_inputs() copies it */
+  u8  seg_stored;
+  u32 seg;
+  u64 seg_off;
+
+  u64 write_seq;                        /* asyncw_write() of its file       */
 
 };
 
@@ -405,20 +437,25 @@ extern char *power_names[POWER_SCHEDULES_NUM];
 typedef struct afl_env_vars {
 
   u8 afl_skip_cpufreq, afl_exit_when_done, afl_no_affinity, afl_skip_bin_check,
-      afl_dumb_forksrv, afl_import_first, afl_custom_mutator_only, afl_no_ui,
-      afl_force_ui, afl_i_dont_care_about_missing_crashes, afl_bench_just_one,
+      afl_dumb_forksrv, afl_import_first, afl_import_triage,
+      afl_custom_mutator_only, afl_no_ui, afl_force_ui,
+      afl_i_dont_care_about_missing_crashes, afl_bench_just_one,
       afl_bench_until_crash, afl_debug_child, afl_autoresume, afl_cal_fast,
       afl_cycle_schedules, afl_expand_havoc, afl_statsd, afl_cmplog_only_new,
       afl_exit_on_seed_issues, afl_try_affinity, afl_ignore_problems,
       afl_keep_timeouts, afl_pizza_mode, afl_no_crash_readme,
-      afl_no_startup_calibration;
+      afl_no_startup_calibration, afl_sync_inotify, afl_cal_defer,
+      afl_cal_adaptive, afl_no_ui_log_json, afl_async_write;
 
   u8 *afl_tmpdir, *afl_custom_mutator_library, *afl_python_module, *afl_path,
       *afl_hang_tmout, *afl_forksrv_init_tmout, *afl_preload,
       *afl_max_det_extras, *afl_statsd_host, *afl_statsd_port,
       *afl_crash_exitcode, *afl_statsd_tags_flavor, *afl_testcache_size,
       *afl_testcache_entries, *afl_child_kill_signal, *afl_fsrv_kill_signal,
-      *afl_target_env, *afl_persistent_record, *afl_exit_on_time;
+      *afl_target_env, *afl_persistent_record, *afl_exit_on_time,
+      *afl_fsrv_pool, *afl_record_traces, *afl_prometheus_port,
+      *afl_queue_segments, *afl_shmem_delta, *afl_seed_tmout,
+      *afl_no_ui_log_interval, *afl_san_binary, *afl_testcache_mmap;
 
 } afl_env_vars_t;
 
@@ -436,6 +473,70 @@ struct foreign_sync {
 
 };
 
+/* another fuzzer in sync dir, for AFL_SYNC_INOTIFY */
+struct sync_peer {
+
+  u8  *name;                            /* Directory name in sync dir       */
+  s32  wd;                              /* Watch of its queue/, or -1       */
+  u8   full;                            /* Scan its queue/ at next sync     */
+  u8 **pending;                         /* New queue entries from events    */
+  u32  pending_cnt;
+
+};
+
+/* extra forkserver of the pool, for AFL_FSRV_POOL */
+/* Fuzzer-side AFLRun bookkeeping timed with AFLRUN_PROFILE */
+enum {
+
+  /* 00 */ AFLRUN_PROF_NEW_PATH,    /* aflrun_has_new_path and virgin maps */
+  /* 01 */ AFLRUN_PROF_ENERGY,      /* aflrun_assign_energy                */
+  /* 02 */ AFLRUN_PROF_CULL,        /* aflrun_cull_queue, favored seeds    */
+  /* 03 */ AFLRUN_PROF_NUM
+
+};
+
+struct fsrv_pool_entry {
+
+  afl_forkserver_t fsrv;
+  sharedmem_t      shm, shm_fuzz;
+  aflrun_shm_t     shm_run;
+  u8              *buf;                 /* Testcase being run               */
+  u32              len;
+  u64              start_us;            /* Start of calibration run         */
+
+};
+
+/* forkserver of the sanitizer build, for AFL_SAN_BINARY */
+struct san_input {
+
+  u8 *buf;
+  u32 len;
+  u32 src;                              /* Queue entry it was mutated from  */
+
+};
+
+struct san_fsrv {
+
+  afl_forkserver_t fsrv;
+  sharedmem_t      shm, shm_fuzz;
+  struct san_input queue[SAN_QUEUE_MAX];
+  u32              head, cnt;           /* Oldest input and number queued   */
+  u8               busy;                /* Oldest input is running          */
+  u64              start_ms;
+  u32              tmout;
+  u8              *virgin_crash;        /* Edges of it no crash has hit     */
+
+};
+
+/* new queue entry whose calibration is deferred, for AFL_CAL_DEFER */
+struct cal_pending_entry {
+
+  struct queue_entry *q;
+  u8                 *trace;            /* trace_bits when it was queued    */
+  u32                 handicap;
+
+};
+
 // Hashmap
 struct key_value_pair {
   u32 key;
@@ -464,6 +565,25 @@ void hashmap_remove(struct hashmap *map, u32 key);
 struct key_value_pair *hashmap_get(struct hashmap *map, u32 key);
 void hashmap_free(struct hashmap *map);
 
+/* AFLRun view of a seed for custom mutators, filled by
+   `afl->aflrun_seed_info(afl, id, &info)` since they cannot call into
+   afl-fuzz; the arrays belong to AFLRun and are valid until the next call. */
+
+typedef struct aflrun_seed_info {
+
+  const reach_t *fringes;         /* Fringe blocks covered in current mode  */
+  size_t         num_fringes;
+  const double  *target_dists;    /* Nearest distance from them per target, */
+  reach_t        num_targets;     /* ... INFINITY if they lead to none      */
+  const reach_t *decisives;       /* Fringe blocks above and the decisive   */
+  size_t         num_decisives;   /* ... blocks leading to them, sorted     */
+  u8             focus;           /* Covers a pro fringe or a target        */
+  double         quant_score;     /* Energy in current AFLRun cycle         */
+  double         perf_score;
+  u8             mode;            /* 0 coverage, 1 fringe, 2 pro fringe,    */
+                                  /* 3 target, 4 unite                      */
+
+} aflrun_seed_info_t;
 
 typedef struct afl_state {
 
@@ -534,6 +654,9 @@ typedef struct afl_state {
 
   u32 hang_tmout;                       /* Timeout used for hang det (ms)   */
 
+  u32 seed_tmout_mult,                  /* AFL_SEED_TMOUT                   */
+      seed_tmout;                       /* Timeout of queue_cur, or 0       */
+
   u8 havoc_stack_pow2,                  /* HAVOC_STACK_POW2                 */
       no_unlink,                        /* do not unlink cur_input          */
       debug,                            /* Debug mode                       */
@@ -567,6 +690,7 @@ typedef struct afl_state {
       unicorn_mode,                     /* Running in Unicorn mode?         */
       use_wine,                         /* Use WINE with QEMU mode          */
       skip_requested,                   /* Skip request, via SIGUSR1        */
+      mem_report_requested,             /* Memory report, via SIGUSR2       */
       run_over10m,                      /* Run time over 10 minutes?        */
       persistent_mode,                  /* Running in persistent mode?      */
       deferred_mode,                    /* Deferred forkserver mode?        */
@@ -587,6 +711,10 @@ typedef struct afl_state {
       *virgin_freachables,              /* Same as above but for functions  */
       *virgin_ctx;                      /* Virgin bits for context-sensitive */
 
+  const ctx_t *new_paths;               /* Virgin paths reached in last run */
+  size_t       num_new_paths;
+  void        *new_paths_buf;           /* Used if the runtime log is full  */
+
   double *alias_probability;            /* alias weighted probabilities     */
   u32    *alias_table;                /* alias weighted random lookup table */
   u32     active_items;                 /* enabled entries in the queue     */
@@ -604,10 +732,12 @@ typedef struct afl_state {
       queued_at_start,                  /* Total number of initial inputs   */
       queued_discovered,                /* Items discovered during this run */
       queued_imported,                  /* Items imported via -S            */
+      queued_sync_skipped,              /* Skipped by AFLRun sync metadata  */
       queued_favored,                   /* Paths deemed favorable           */
       queued_with_cov,                  /* Paths with new coverage bytes    */
       queued_extra,                     /* Number of extra seeds of aflrun  */
       queued_extra_disabled,            /* Number of extra seeds disabled   */
+      queued_retired,                   /* ... and dropped by retire_extra  */
       queued_aflrun,                    /* Number of seeds in aflrun queue  */
       pending_not_fuzzed,               /* Queued but not done yet          */
       pending_favored,                  /* Pending favored paths            */
@@ -709,6 +839,40 @@ typedef struct afl_state {
   char            *cmplog_binary;
   afl_forkserver_t cmplog_fsrv;     /* cmplog has its own little forkserver */
 
+  /* Forkserver pool running havoc testcases, processed in starting order */
+
+  struct fsrv_pool_entry *fsrv_pool;
+  u32 fsrv_pool_cnt,                    /* Number of extra forkservers      */
+      fsrv_pool_next,                   /* Entry to start next testcase on  */
+      fsrv_pool_busy;                   /* Testcases still running          */
+
+  /* Sanitizer build re-running inputs that reach targets, for AFL_SAN_BINARY */
+
+  struct san_fsrv *san;
+  u64 san_execs,                        /* Inputs run on the sanitizer build */
+      san_crashes,                      /* Crashes of it kept                */
+      san_dropped;                      /* Inputs dropped, queue being full  */
+
+  /* New queue entries calibrated at the end of fuzz_one, for AFL_CAL_DEFER */
+
+  struct cal_pending_entry *cal_pending;
+  u32 cal_pending_cnt,                  /* Entries waiting for calibration  */
+      cal_pending_alloc;                /* Entries with a trace buffer      */
+  u8  cal_deferring;                    /* Defer calibration of new entries */
+
+  /* Recording of AFLRun maps of each execution, for AFL_RECORD_TRACES */
+
+  FILE *record_file;
+  u8   *record_buf;
+
+  /* Summary of the entry being calibrated, for --config seed_summary=1 */
+
+  u8 *summary_buf;
+  u32 summary_len;                      /* Length of body, 0 if none loaded */
+  u64 summary_exec_us;
+  u64 target_mtime, target_size;        /* Of the target binary             */
+  u32 summary_replayed;                 /* Dry runs replayed from summaries */
+
   /* Custom mutators */
   struct custom_mutator *mutator;
 
@@ -734,6 +898,16 @@ typedef struct afl_state {
 #define FOREIGN_SYNCS_MAX 32U
   u8                  foreign_sync_cnt;
   struct foreign_sync foreign_syncs[FOREIGN_SYNCS_MAX];
+  u8                  import_triage;    /* Triaging -F test cases, see
+                                           AFL_IMPORT_TRIAGE               */
+  u32                 import_dropped;   /* -F test cases dropped by triage  */
+  u32                 cmp_closer;       /* Kept for closer target compares  */
+  u64                 crash_bucket_full; /* Crashes of full crash buckets   */
+
+  /* event-driven sync */
+  s32               sync_inotify_fd, sync_dir_wd;
+  u32               sync_peers_cnt;
+  struct sync_peer *sync_peers;
 
 #ifdef _AFL_DOCUMENT_MUTATIONS
   u8  do_document;
@@ -759,6 +933,20 @@ typedef struct afl_state {
   char              *statsd_metric_format;
   int                statsd_metric_format_type;
 
+  /* Prometheus exporter, see afl-fuzz-prometheus.c */
+  struct afl_prometheus *prometheus;
+
+  /* Rate-limited log when not on a tty, see afl-fuzz-nottylog.c */
+  struct afl_nottylog *nottylog;
+
+  /* Writer thread of AFL_ASYNC_WRITE, see afl-fuzz-asyncw.c */
+  struct afl_asyncw *asyncw;
+
+  /* Segment store of the queue with AFL_QUEUE_SEGMENTS, and the one of the
+     input directory while it is read, see afl-fuzz-segments.c */
+  struct afl_segments  *segments;
+  struct segments_view *segments_in;
+
   double stats_avg_exec;
 
   u8 *clean_trace;
@@ -787,6 +975,9 @@ typedef struct afl_state {
 
   list_t custom_mutator_list;
 
+  void (*aflrun_seed_info)(struct afl_state *afl, u32 id,
+                           aflrun_seed_info_t *info);
+
   /* this is a fixed buffer of size map_size that can be used by any function if
    * they do not call another function */
   u8 *map_tmp_buf;
@@ -818,6 +1009,13 @@ typedef struct afl_state {
   /* How often did we evict from the cache (for statistics only) */
   u32 q_testcase_evictions;
 
+  /* Testcases of at least this many bytes are mapped from their files
+     instead of being cached (AFL_TESTCACHE_MMAP), 0 if none are, how many
+     are mapped, and the least and most recently used of them */
+  u32 q_testcase_mmap_min;
+  u32 q_testcase_mmap_count;
+  struct queue_entry *q_testcase_mmap_lru, *q_testcase_mmap_mru;
+
   /* Refs to each queue entry with cached testcase (for eviction, if cache_count
    * is too large) */
   struct queue_entry **q_testcase_cache;
@@ -831,6 +1029,13 @@ typedef struct afl_state {
 
   u64 exec_time, fuzz_time, exec_time_short, fuzz_time_short, last_exec_time;
 
+  /* AFLRun profiling enabled by AFLRUN_PROFILE, in `aflrun_ticks` */
+
+  u8  aflrun_profile;
+  u8  aflrun_timed;                     /* Also for auto_tune of AFLRun     */
+  u64 aflrun_prof[AFLRUN_PROF_NUM];
+  u64 aflrun_prof_ticks0, aflrun_prof_us0;  /* To convert ticks to time   */
+
   u32 fuzzed_times;          /* Number of times common_fuzz_stuff is called */
 
   reach_t** reachable_to_targets;/* Map from reachable index to array
@@ -843,15 +1048,51 @@ typedef struct afl_state {
 
   struct queue_entry** aflrun_queue; /* Queue for fuzzing in order */
   u32 aflrun_idx; /* `current_entry` for aflrun queue */
+  struct aflrun_sched* aflrun_sched; /* Shared scheduler, if used */
   u32* aflrun_seeds; /* Map seed to its `fuzz_level` value */
+  u32* aflrun_active;     /* seeds walked each cycle, not retired        */
+  u32 num_active;         /* ... their number                            */
+  u32 active_upto;        /* seeds below this id are in `aflrun_active`  */
   double* perf_scores;
 
   u8 force_cycle_end, is_aflrun;
   double quantum_ratio;   /* actual quantum / planned quantum*/
-
-  u8** virgins; size_t* clusters;
+  u8 cpu_quantum;         /* quantum measured by `aflrun_cpu_us` */
+  double aflrun_slice;    /* quanta of each draw in `aflrun_queue`, or 0 */
+  u8 splice_fringe;       /* splice with `splice_partners` if there are any */
+  u8 op_sched;            /* havoc operators drawn by aflrun_op_weights() */
+  u64 aflrun_finds;       /* executions advancing fringes, for `op_sched` */
+  u32 influence_execs;    /* budget of influence_stage(), 0 if disabled  */
+  u8 focus_det;           /* deterministic stages by aflrun_seed_focus() */
+  u8 dist_stack;          /* havoc stacking by aflrun_get_seed_dist()    */
+  u8 retire_extra;        /* drop spent extra seeds from `aflrun_active` */
+  u32 crash_buckets;      /* crashes kept per crash_bucket(), or 0       */
+  u32 crash_bucket_depth; /* ... keyed by this many last reached blocks  */
+  struct hashmap *crash_bucket_map; /* bucket to number of crashes kept  */
+  FILE *crash_index;      /* crashes/index.csv, with `crash_buckets`     */
+  u32 havoc_lo, havoc_hi; /* span of out_buf changed by havoc operators  */
+  u64 havoc_gen;          /* generation of in_buf of the havoc stage     */
+  u64 delta_gen;          /* havoc_gen for next write, with AFL_SHMEM_DELTA */
+  reach_t aflrun_goals[AFLRUN_MAX_GOALS]; /* of queue_cur, for `early_exit` */
+  u32 aflrun_num_goals;   /* ... armed during its havoc stage, or 0      */
+  u8 learn_edges;         /* learn indirect call edges at each cycle end */
+  u8 rare_fringes;        /* sample runs reaching fringes for energy     */
+  u8 lean_cov;            /* lower runtime level in coverage mode        */
+  u8 paths_deferred;      /* virgin paths of last run not collected yet  */
+  u8 mute_blocks;         /* mute blocks of no more use at cycle ends    */
+  size_t aflrun_muted;    /* ... number of blocks muted at the last one  */
+  u8 journal;             /* journal changes of logs instead of them     */
+  u32 freq_execs;         /* executions since runs were last sampled     */
+  u8 directed_cmplog;     /* input-to-state by `cmp_map->blocks`       */
+  u64 cmplog_exec_limit;  /* total_execs ending input-to-state, or 0   */
+  const u32* splice_partners; size_t splice_partners_cnt;
+
+  u8** virgins; size_t* clusters; size_t virgin_stride;
+  u32 edge_lo, edge_hi;   /* window of maps of clusters, see aflrun.h      */
   struct queue_entry*** tops;
+  u32* score_edges;       /* non-zero bytes of trace, for all of `tops` */
   u8* new_bits;
+  u32* touched_words; u32 num_touched_words; /* non-zero words of trace */
   size_t num_maps;
   u8 div_score_changed;
 
@@ -867,6 +1108,8 @@ typedef struct afl_state {
   double trim_thr, queue_quant_thr;
 
   char* temp_dir;
+  u64   aflrun_image_off;         /* offset of image embedded in binary, or 0 */
+  u8    aflrun_no_div;            /* binary compiled with AFLRUN_NO_DIVERSITY */
 
   struct hashmap *value_map;
   u64 total_saved_crashes, total_saved_positives;
@@ -1120,9 +1363,16 @@ void afl_states_stop(void);
 void afl_states_clear_screen(void);
 /* Sets the skip flag on all states */
 void afl_states_request_skip(void);
+void afl_states_request_mem_report(void);
 
 /* Setup shmem for testcase delivery */
 void setup_testcase_shmem(afl_state_t *afl);
+void setup_fsrv_pool(afl_state_t *afl);
+void destroy_fsrv_pool(afl_state_t *afl);
+
+void setup_san_fsrv(afl_state_t *afl);
+void san_fsrv_queue(afl_state_t *afl, u8 *buf, u32 len, u8 fault);
+void destroy_san_fsrv(afl_state_t *afl);
 
 void read_afl_environment(afl_state_t *, char **);
 
@@ -1163,6 +1413,7 @@ void mark_as_det_done(afl_state_t *, struct queue_entry *);
 void mark_as_variable(afl_state_t *, struct queue_entry *);
 void mark_as_redundant(afl_state_t *, struct queue_entry *, u8);
 void add_to_queue(afl_state_t *, u8 *, u32, u8);
+u8   check_if_text(afl_state_t *, struct queue_entry *);
 void destroy_queue(afl_state_t *);
 void update_bitmap_score(afl_state_t *, struct queue_entry *);
 void cull_queue(afl_state_t *);
@@ -1182,7 +1433,7 @@ void discover_word(u8 *ret, u64 *current, u64 *virgin);
 void discover_word(u8 *ret, u32 *current, u32 *virgin);
 #endif
 void init_count_class16(void);
-void minimize_bits(afl_state_t *, u8 *, u8 *);
+trace_mini_t *minimize_trace(const u32 *, u32);
 #ifndef SIMPLE_FILES
 u8 *describe_op(afl_state_t *, u8, u8, size_t);
 #endif
@@ -1214,6 +1465,15 @@ void show_stats_normal(afl_state_t *);
 void show_stats_pizza(afl_state_t *);
 void show_init_stats(afl_state_t *);
 void aflrun_write_to_log(afl_state_t *);
+u64    aflrun_prof_us(afl_state_t *, u64);
+double aflrun_runtime_ratio(afl_state_t *);
+u64    aflrun_cpu_us(afl_state_t *);
+struct aflrun_phase;
+extern const char *aflrun_phase_names[];
+void   write_aflrun_memory(afl_state_t *);
+u64    aflrun_phase_quantile_ns(afl_state_t *, const struct aflrun_phase *,
+                                double);
+void   start_detached_thread(void *(*)(void *), void *, const char *);
 
 /* StatsD */
 
@@ -1222,15 +1482,56 @@ int  statsd_socket_init(afl_state_t *afl);
 int  statsd_send_metric(afl_state_t *afl);
 int  statsd_format_metric(afl_state_t *afl, char *buff, size_t bufflen);
 
+/* Prometheus */
+
+void prometheus_init(afl_state_t *afl);
+void prometheus_update(afl_state_t *afl);
+
+/* Log when not on a tty */
+
+void nottylog_init(afl_state_t *afl);
+void nottylog_seed(afl_state_t *afl);
+
+/* Asynchronous writes */
+
+void asyncw_init(afl_state_t *afl);
+u64  asyncw_write(afl_state_t *afl, u8 *fn, u8 *mem, u32 len, u8 replace);
+void asyncw_wait(afl_state_t *afl, u64 seq);
+void asyncw_flush(afl_state_t *afl);
+
+/* Segment store */
+
+void    segments_init(afl_state_t *afl);
+void    segments_add(afl_state_t *afl, struct queue_entry *q, const u8 *mem,
+                     u32 len);
+void    segments_get(afl_state_t *afl, struct queue_entry *q, u8 *buf, u32 len);
+void    segments_prefetch(afl_state_t *afl, struct queue_entry *q);
+ssize_t queue_read_case(afl_state_t *afl, struct queue_entry *q, u8 *buf,
+                        u32 len);
+
 /* Run */
 
 void sync_fuzzers(afl_state_t *);
 u32  write_to_testcase(afl_state_t *, void **, u32, u32);
 u8   calibrate_case(afl_state_t *, struct queue_entry *, u8 *, u32, u8);
+void defer_calibration(afl_state_t *, struct queue_entry *, u32);
+void calibrate_deferred(afl_state_t *);
 u8   trim_case(afl_state_t *, struct queue_entry *, u8 *);
 u8   common_fuzz_stuff(afl_state_t *, u8 *, u32);
+u8   pool_fuzz_stuff(afl_state_t *, u8 *, u32);
+u8   pool_flush(afl_state_t *);
 fsrv_run_result_t fuzz_run_target(afl_state_t *, afl_forkserver_t *fsrv, u32);
 void aflrun_recover_virgin(afl_state_t* afl);
+u64  aflrun_path_cksum(afl_forkserver_t *);
+void aflrun_write_sync_meta(afl_state_t* afl, struct queue_entry* q);
+void aflrun_record_exec(afl_state_t *, u8, u32, u32, u8, u8);
+u8   aflrun_load_summary(afl_state_t *, struct queue_entry *, u8 *);
+void aflrun_write_summary(afl_state_t *, struct queue_entry *, u8 *);
+void aflrun_arm_goals(afl_state_t *, u32);
+void aflrun_sample_hits(afl_state_t *);
+void aflrun_set_level(afl_state_t *, u8);
+void aflrun_update_mute(afl_state_t *);
+void aflrun_collect_deferred_paths(afl_state_t *);
 
 /* Fuzz one */
 
@@ -1273,6 +1574,9 @@ void   write_crash_readme(afl_state_t *afl);
 u8     check_if_text_buf(u8 *buf, u32 len);
 char* aflrun_find_temp(char* temp_dir);
 void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir);
+void aflrun_binary_image_init(afl_state_t* afl);
+void aflrun_setup_registry(afl_state_t* afl);
+void aflrun_setup_sched(afl_state_t* afl);
 
 /* CmpLog */
 
@@ -1358,9 +1662,31 @@ static inline s64 rand_get_seed(afl_state_t *afl) {
 /* initialize randomness with a given seed. Can be called again at any time. */
 void rand_set_seed(afl_state_t *afl, s64 init_seed);
 
+/* Start and end timing of AFLRun bookkeeping `what` if profiling or tuning. */
+
+static inline u64 aflrun_prof_begin(afl_state_t *afl) {
+
+  return unlikely(afl->aflrun_timed) ? aflrun_ticks() : 0;
+
+}
+
+static inline void aflrun_prof_end(afl_state_t *afl, u32 what, u64 t0) {
+
+  if (unlikely(t0)) { afl->aflrun_prof[what] += aflrun_ticks() - t0; }
+
+}
+
 /* Find first power of two greater or equal to val (assuming val under
    2^63). */
 
+/* Timeout of executions of mutants of queue_cur (ms), see AFL_SEED_TMOUT. */
+
+static inline u32 fuzz_tmout(afl_state_t *afl) {
+
+  return afl->seed_tmout ? afl->seed_tmout : afl->fsrv.exec_tmout;
+
+}
+
 static inline u64 next_p2(u64 val) {
 
   u64 ret = 1;
@@ -1389,8 +1715,24 @@ void queue_testcase_retake_mem(afl_state_t *afl, struct queue_entry *q, u8 *in,
 /* Add a new queue entry directly to the cache */
 
 void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q, u8 *mem);
+
+/* Ask the kernel to read ahead the next uncached seeds of the AFLRun cycle */
+void queue_testcase_prefetch(afl_state_t *afl);
+
+/* Quanta to fuzz `q` for when it is drawn in this AFLRun cycle */
+static inline double aflrun_visit_quant(afl_state_t *afl,
+                                        struct queue_entry *q) {
+
+  return afl->aflrun_slice ? afl->aflrun_slice : q->quant_score;
+
+}
+
 u32 select_aflrun_seeds(afl_state_t *afl);
 int cmp_quant_score(const void* a, const void* b);
+u32 aflrun_alias_queue(afl_state_t *afl, u32 n);
+void aflrun_sched_begin_cycle(afl_state_t *afl);
+struct queue_entry *aflrun_sched_next(afl_state_t *afl);
+void aflrun_sched_done(afl_state_t *afl, struct queue_entry *q, double quant);
 
 enum {
   /* 00 */ FAULT_NONE,
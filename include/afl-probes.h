@@ -0,0 +1,54 @@
+/*
+   american fuzzy lop++ - USDT probes
+   ----------------------------------
+
+   Static probe points of afl-fuzz and AFLRun, for tracing tools that
+   attach to USDT probes (bpftrace, perf, SystemTap), e.g.
+
+     bpftrace -e 'usdt:./afl-fuzz:afl:fuzz_one_begin { @t[tid] = nsecs; }
+                  usdt:./afl-fuzz:afl:fuzz_one_end /@t[tid]/ {
+                    @us = hist((nsecs - @t[tid]) / 1000); delete(@t[tid]); }'
+
+   Probes are listed by `readelf -n afl-fuzz | grep -A2 stapsdt`:
+
+     afl:fuzz_one_begin(u32 seed)
+     afl:fuzz_one_end(u32 seed, u8 skipped)
+     afl:common_fuzz_stuff_begin(u32 len)
+     afl:common_fuzz_stuff_end(u8 bail_out)
+     afl:save_if_interesting_begin(u32 len, u8 fault)
+     afl:save_if_interesting_end(u8 kept)
+     afl:sync_begin()
+     afl:sync_end(u32 synced, u32 entries)
+     aflrun:has_new_path_begin(u32 seed, u64 new_paths)
+     aflrun:has_new_path_end(u8 new_fringe)
+     aflrun:assign_energy_begin(u32 num_seeds)
+     aflrun:assign_energy_end(u32 num_seeds)
+     aflrun:cycle_end(u8 old_mode, u8 new_mode, u8 whole_end)
+
+   A probe is a single nop in the code plus an ELF note, and its arguments
+   only live in registers or memory they are in anyway, so probes cost
+   nothing when no tracer is attached. They are compiled in if <sys/sdt.h>
+   (systemtap-sdt-dev) is found, unless NO_USDT is defined.
+
+*/
+
+#ifndef _HAVE_AFL_PROBES_H
+#define _HAVE_AFL_PROBES_H
+
+#if !defined(NO_USDT) && defined(__has_include)
+  #if __has_include(<sys/sdt.h>)
+    #include <sys/sdt.h>
+  #endif
+#endif
+
+#ifdef STAP_PROBEV
+  #define AFL_PROBE(provider, name, ...) STAP_PROBEV(provider, name, ##__VA_ARGS__)
+#else
+  #define AFL_PROBE(provider, name, ...) \
+    do {                                 \
+                                         \
+    } while (0)
+#endif
+
+#endif                                               /* !_HAVE_AFL_PROBES_H */
+
@@ -0,0 +1,199 @@
+#ifndef _HAVE_AFL_SEGMENTS_H
+#define _HAVE_AFL_SEGMENTS_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+
+/*
+  Segment store of a queue directory, written by afl-fuzz instead of one file
+  per queue entry if `AFL_QUEUE_SEGMENTS` is set. Inputs are appended to the
+  data files `<queue>/.segments/NNNNNN.dat`, a new one being started once the
+  current one exceeds SEGMENT_MAX_SIZE, and each input gets a record appended
+  to `<queue>/.segments/index`, which starts with `segments_hdr_t`. Nothing is
+  ever rewritten: when trimming shrinks an entry, the new data and a record
+  with SEGMENT_REC_UPDATE for the same id are appended, and the last record
+  of an id is the valid one.
+
+  Readers (afl-fuzz resuming from or syncing with such a queue, and
+  utils/aflrun_segments/afl-segments-export) map the index read-only, so
+  opening a queue of any size costs a few system calls.
+*/
+
+#define SEGMENTS_DIR ".segments"
+#define SEGMENTS_MAGIC 0x31474553514C4641ULL               /* "AFLQSEG1" */
+#define SEGMENT_MAX_SIZE (64 << 20)
+
+enum {
+
+  /* 01 */ SEGMENT_REC_UPDATE = 1       /* replaces data of an earlier id   */
+
+};
+
+typedef struct segments_hdr {
+
+  u64 magic;
+  u32 rec_size;                         /* sizeof(segment_rec_t)            */
+  u32 reserved;
+
+} segments_hdr_t;
+
+typedef struct segment_rec {
+
+  u64 off;                              /* Offset in data file              */
+  u32 seg;                              /* Number of data file              */
+  u32 len;
+  u32 id;                               /* Queue id of the entry            */
+  u32 flags;                            /* SEGMENT_REC_*                    */
+  char name[NAME_MAX + 1];              /* Name in the classic queue layout */
+
+} segment_rec_t;
+
+/* Read-only view of the segment store of a queue directory. */
+
+typedef struct segments_view {
+
+  const segment_rec_t *recs;
+  u32                  num;
+
+  char  *dir;                           /* <queue>/.segments                */
+  void  *map;
+  size_t map_len;
+  s32    data_fd;                       /* Data file open for `data_seg`    */
+  u32    data_seg;
+  u8    *buf;                           /* Data of last record read         */
+  u32    buf_size;
+
+} segments_view_t;
+
+static inline void segments_data_path(char *path, size_t size, const char *dir,
+                                      u32 seg) {
+
+  snprintf(path, size, "%s/%06u.dat", dir, seg);
+
+}
+
+/* Map the index of the segment store of queue directory `queue`, return 0 on
+   success, or -1 if there is none or it is invalid. Records appended after
+   this are not seen. */
+
+static inline int segments_open(segments_view_t *v, const char *queue) {
+
+  char path[PATH_MAX];
+  memset(v, 0, sizeof(*v));
+  v->data_fd = -1;
+
+  snprintf(path, sizeof(path), "%s/" SEGMENTS_DIR "/index", queue);
+  s32 fd = open(path, O_RDONLY);
+  if (fd < 0) { return -1; }
+
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(segments_hdr_t)) {
+
+    close(fd);
+    return -1;
+
+  }
+
+  v->map_len = st.st_size;
+  v->map = mmap(NULL, v->map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (v->map == MAP_FAILED) { return -1; }
+
+  const segments_hdr_t *hdr = (const segments_hdr_t *)v->map;
+  if (hdr->magic != SEGMENTS_MAGIC || hdr->rec_size != sizeof(segment_rec_t)) {
+
+    munmap(v->map, v->map_len);
+    return -1;
+
+  }
+
+  v->recs = (const segment_rec_t *)(hdr + 1);
+  v->num = (v->map_len - sizeof(segments_hdr_t)) / sizeof(segment_rec_t);
+  snprintf(path, sizeof(path), "%s/" SEGMENTS_DIR, queue);
+  v->dir = strdup(path);
+  return 0;
+
+}
+
+static inline void segments_close(segments_view_t *v) {
+
+  if (v->map) { munmap(v->map, v->map_len); }
+  if (v->data_fd >= 0) { close(v->data_fd); }
+  free(v->dir);
+  free(v->buf);
+  memset(v, 0, sizeof(*v));
+  v->data_fd = -1;
+
+}
+
+/* Return data of record `r`, valid until the next call, or NULL if it cannot
+   be read. */
+
+static inline const u8 *segments_read(segments_view_t *v,
+                                      const segment_rec_t *r) {
+
+  if (v->data_fd < 0 || v->data_seg != r->seg) {
+
+    char path[PATH_MAX];
+    if (v->data_fd >= 0) { close(v->data_fd); }
+    segments_data_path(path, sizeof(path), v->dir, r->seg);
+    v->data_fd = open(path, O_RDONLY);
+    v->data_seg = r->seg;
+    if (v->data_fd < 0) { return NULL; }
+
+  }
+
+  if (r->len > v->buf_size) {
+
+    u8 *buf = realloc(v->buf, r->len);
+    if (!buf) { return NULL; }
+    v->buf = buf;
+    v->buf_size = r->len;
+
+  }
+
+  if (pread(v->data_fd, v->buf, r->len, r->off) != (ssize_t)r->len) {
+
+    return NULL;
+
+  }
+
+  return v->buf;
+
+}
+
+/* Return an array telling for each queue id 1 + the index of its last
+   record, or 0 if it has none, and set `*num_ids` to its size. */
+
+static inline u32 *segments_latest(const segments_view_t *v, u32 *num_ids) {
+
+  u32 n = 0;
+  for (u32 i = 0; i < v->num; ++i) {
+
+    if (v->recs[i].id >= n) { n = v->recs[i].id + 1; }
+
+  }
+
+  u32 *latest = calloc(n ? n : 1, sizeof(u32));
+  if (!latest) { return NULL; }
+  for (u32 i = 0; i < v->num; ++i) {
+
+    latest[v->recs[i].id] = i + 1;
+
+  }
+
+  *num_ids = n;
+  return latest;
+
+}
+
+#endif                                             /* !_HAVE_AFL_SEGMENTS_H */
+
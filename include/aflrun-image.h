@@ -0,0 +1,72 @@
+#ifndef _HAVE_AFLRUN_IMAGE_H
+#define _HAVE_AFLRUN_IMAGE_H
+
+#include "types.h"
+
+/*
+  Binary image `aflrun.bin` emitted by `aflrunPreprocess` in temporary
+  directory beside the text files, so that afl-fuzz can mmap it directly
+  instead of parsing BBreachable.txt, Freachable.txt, BBedges.txt,
+  distance.cfg/, Tgroups.txt and Chash.txt; with AFLRUN_EMBED_IMAGE, it is also embedded
+  in the binary after AFLRUN_IMAGE_SIG. Every section starts at an 8-byte
+  aligned offset from the beginning of the image; arrays indexed by block
+  use reachable index.
+  Tables ending with `_index` have `n + 1` entries in CSR form, so row `i`
+  of the corresponding table is [index[i], index[i + 1]).
+*/
+
+#define AFLRUN_IMAGE_NAME    "aflrun.bin"
+#define AFLRUN_IMAGE_MAGIC   0x314E55524C4641ULL /* "AFLRUN1" */
+#define AFLRUN_IMAGE_VERSION 6
+#define AFLRUN_NO_BLOCK      ((reach_t)-1)
+
+typedef struct aflrun_dist {
+
+  reach_t target;
+  float   dist;
+
+} aflrun_dist_t;
+
+typedef struct aflrun_call_hash {
+
+  reach_t src, dst;                     /* reachable blocks of a call edge  */
+  u32     hash;                         /* context hash of the call         */
+
+} aflrun_call_hash_t;
+
+typedef struct aflrun_image {
+
+  u64     magic;
+  u32     version;
+  u32     ctx_size_pow2;                /* CTX_SIZE_POW2 of the pass        */
+  u64     size;                         /* size of whole image in bytes     */
+
+  reach_t num_targets, num_reachables;
+  reach_t num_ftargets, num_freachables;
+
+  u64 off_target_weights;          /* double[num_targets]                   */
+  u64 off_targets_index;           /* u64[num_reachables + 1]               */
+  u64 off_targets;                 /* reach_t[], targets reached by block   */
+  u64 off_edges_index;             /* u64[num_reachables + 1]               */
+  u64 off_edges;                   /* reach_t[], deduplicated successors    */
+  u64 off_dists_index;             /* u64[num_reachables + 1]               */
+  u64 off_dists;                   /* aflrun_dist_t[], sorted by target     */
+  u64 off_names_index;             /* u64[num_reachables], into name pool   */
+  u64 off_fnames_index;            /* u64[num_freachables], into name pool  */
+  u64 off_names;                   /* NUL-terminated block/function names   */
+  u64 off_fentries;                /* reach_t[num_freachables], entry block
+                                      or AFLRUN_NO_BLOCK if not reachable   */
+  double ctx_radius;               /* AFLRUN_CTX_RADIUS: blocks farther from
+                                      all targets have context 0, or inf    */
+  u64 off_call_hashes;             /* aflrun_call_hash_t[num_call_hashes],
+                                      appended by `aflrunInstrument`        */
+  u64 num_call_hashes;
+  u64 off_target_groups;           /* reach_t[num_targets], static group of
+                                      each target, numbered from 0         */
+
+} aflrun_image_t;
+
+#define AFLRUN_IMAGE_AT(img, off, type) \
+  ((type *)((u8 *)(img) + (img)->off))
+
+#endif                                            /* !_HAVE_AFLRUN_IMAGE_H */
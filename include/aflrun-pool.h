@@ -0,0 +1,262 @@
+#ifndef _HAVE_AFLRUN_POOL_H
+#define _HAVE_AFLRUN_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+
+/*
+  Slab allocator for the nodes of the hash containers of AFLRun, which are
+  allocated and freed one at a time as fringes come and go. Each node size
+  rounded up to `kGranule` has its own slabs of `kSlabSize` bytes, mapped
+  with mmap at an address aligned to their size, so the slab of a node is
+  found from its address. Nodes are taken from the slab at the head of the
+  list of slabs with free nodes of their size; a slab whose nodes are all
+  freed is only unmapped by `compact`, which also sorts the other slabs by
+  decreasing use, so new nodes fill the densest slabs and sparse ones can
+  drain. Arrays, e.g. buckets, and nodes larger than `kMaxSize` go to
+  `operator new` as usual. All functions are thread-safe.
+*/
+
+namespace aflrun_pool
+{
+
+constexpr size_t kSlabSize = 256 << 10;
+constexpr size_t kGranule = 16;
+constexpr size_t kMaxSize = 256;
+constexpr size_t kNumClasses = kMaxSize / kGranule;
+
+struct Slab
+{
+	Slab* prev; Slab* next; // In list of its class, `free_list` or `empty`
+	void* free_nodes;       // Nodes freed in this slab, linked through them
+	char* bump;             // Nodes from here to the end were never used
+	size_t size, live;
+};
+
+constexpr size_t kHeader = (sizeof(Slab) + kGranule - 1) & ~(kGranule - 1);
+
+class Pool
+{
+	struct Class
+	{
+		std::mutex m;
+		Slab* free_list = nullptr; // Slabs with free nodes, some in use
+		Slab* empty = nullptr;     // Slabs with no node in use
+		size_t live = 0;           // Nodes in use in all slabs
+	};
+	Class classes[kNumClasses];
+	std::mutex stats_m;
+	size_t num_slabs = 0;
+
+	static void unlink(Slab*& head, Slab* s)
+	{
+		if (s->prev)
+			s->prev->next = s->next;
+		else
+			head = s->next;
+		if (s->next)
+			s->next->prev = s->prev;
+	}
+
+	static void push(Slab*& head, Slab* s)
+	{
+		s->prev = nullptr; s->next = head;
+		if (head)
+			head->prev = s;
+		head = s;
+	}
+
+	static bool has_free(const Slab* s)
+	{
+		return s->free_nodes ||
+			s->bump + s->size <= reinterpret_cast<const char*>(s) + kSlabSize;
+	}
+
+	Slab* map_slab(size_t size)
+	{
+		// Map twice the size and unmap what is outside of the aligned half
+		char* p = static_cast<char*>(mmap(nullptr, 2 * kSlabSize,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+		char* start = reinterpret_cast<char*>(
+			(reinterpret_cast<size_t>(p) + kSlabSize - 1) & ~(kSlabSize - 1));
+		if (start != p)
+			munmap(p, start - p);
+		munmap(start + kSlabSize, p + kSlabSize - start);
+		Slab* s = reinterpret_cast<Slab*>(start);
+		s->free_nodes = nullptr;
+		s->bump = start + kHeader;
+		s->size = size;
+		s->live = 0;
+		std::lock_guard<std::mutex> lock(stats_m);
+		++num_slabs;
+		return s;
+	}
+
+public:
+	static Pool& get()
+	{
+		// Never destroyed, as global containers may free nodes at exit
+		static Pool* pool = new Pool();
+		return *pool;
+	}
+
+	static bool pooled(size_t size, size_t align)
+	{
+		return size <= kMaxSize && align <= kGranule;
+	}
+
+	void* alloc(size_t size)
+	{
+		size = (size + kGranule - 1) & ~(kGranule - 1);
+		Class& c = classes[size / kGranule - 1];
+		std::unique_lock<std::mutex> lock(c.m);
+		Slab* s = c.free_list;
+		if (s == nullptr)
+		{
+			if (c.empty != nullptr)
+			{
+				s = c.empty;
+				unlink(c.empty, s);
+			}
+			else
+			{
+				lock.unlock();
+				s = map_slab(size);
+				lock.lock();
+			}
+			push(c.free_list, s);
+		}
+		void* ret;
+		if (s->free_nodes)
+		{
+			ret = s->free_nodes;
+			s->free_nodes = *static_cast<void**>(ret);
+		}
+		else
+		{
+			ret = s->bump;
+			s->bump += size;
+		}
+		++s->live; ++c.live;
+		if (!has_free(s))
+			unlink(c.free_list, s);
+		return ret;
+	}
+
+	void free(void* p)
+	{
+		Slab* s = reinterpret_cast<Slab*>(
+			reinterpret_cast<size_t>(p) & ~(kSlabSize - 1));
+		Class& c = classes[s->size / kGranule - 1];
+		std::lock_guard<std::mutex> lock(c.m);
+		if (!has_free(s))
+			push(c.free_list, s);
+		*static_cast<void**>(p) = s->free_nodes;
+		s->free_nodes = p;
+		--c.live;
+		if (--s->live == 0)
+		{ // Reset it so it is used from the start again
+			unlink(c.free_list, s);
+			s->free_nodes = nullptr;
+			s->bump = reinterpret_cast<char*>(s) + kHeader;
+			push(c.empty, s);
+		}
+	}
+
+	// Unmap empty slabs, and sort the others by decreasing use.
+	// Return number of bytes unmapped.
+	size_t compact()
+	{
+		size_t ret = 0;
+		for (Class& c : classes)
+		{
+			std::lock_guard<std::mutex> lock(c.m);
+			while (c.empty)
+			{
+				Slab* s = c.empty;
+				unlink(c.empty, s);
+				munmap(s, kSlabSize);
+				ret += kSlabSize;
+			}
+			// Insertion sort, as it is mostly sorted since last time
+			Slab* sorted = nullptr;
+			while (c.free_list)
+			{
+				Slab* s = c.free_list;
+				unlink(c.free_list, s);
+				Slab** pos = &sorted; Slab* prev = nullptr;
+				while (*pos && (*pos)->live > s->live)
+				{
+					prev = *pos;
+					pos = &(*pos)->next;
+				}
+				s->prev = prev; s->next = *pos;
+				if (*pos)
+					(*pos)->prev = s;
+				*pos = s;
+			}
+			c.free_list = sorted;
+		}
+		std::lock_guard<std::mutex> lock(stats_m);
+		num_slabs -= ret / kSlabSize;
+		return ret;
+	}
+
+	// Bytes mapped for slabs, and bytes of nodes in use in them
+	void usage(size_t* ret_mapped, size_t* ret_used)
+	{
+		*ret_used = 0;
+		for (size_t i = 0; i < kNumClasses; ++i)
+		{
+			std::lock_guard<std::mutex> lock(classes[i].m);
+			*ret_used += classes[i].live * (i + 1) * kGranule;
+		}
+		std::lock_guard<std::mutex> lock(stats_m);
+		*ret_mapped = num_slabs * kSlabSize;
+	}
+};
+
+template <typename T>
+struct Allocator
+{
+	using value_type = T;
+
+	Allocator() noexcept = default;
+	template <typename U>
+	Allocator(const Allocator<U>&) noexcept {}
+
+	T* allocate(size_t n)
+	{
+		if (n == 1 && Pool::pooled(sizeof(T), alignof(T)))
+			return static_cast<T*>(Pool::get().alloc(sizeof(T)));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t n) noexcept
+	{
+		if (n == 1 && Pool::pooled(sizeof(T), alignof(T)))
+			Pool::get().free(p);
+		else
+			::operator delete(p);
+	}
+};
+
+template <typename T, typename U>
+inline bool operator==(const Allocator<T>&, const Allocator<U>&)
+{
+	return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const Allocator<T>&, const Allocator<U>&)
+{
+	return false;
+}
+
+} // namespace aflrun_pool
+
+#endif /* !_HAVE_AFLRUN_POOL_H */
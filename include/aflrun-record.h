@@ -0,0 +1,169 @@
+#ifndef _HAVE_AFLRUN_RECORD_H
+#define _HAVE_AFLRUN_RECORD_H
+
+#include "types.h"
+#include "config.h"
+
+/*
+  Recording of the maps AFLRun sees in each execution, written by afl-fuzz
+  to the file given in `AFL_RECORD_TRACES` and replayed without the target
+  by `test/benchmarks/aflrun_bench -R`. The file starts with
+  `aflrun_record_hdr_t`, followed by records each made of a varint giving
+  the size of the rest of the record and:
+
+    u8 kind (AFLRUN_RECORD_*), u8 fault, u8 inc, seed, len
+    n_edges, n_edges times (index delta, u8 raw hit count)
+    n_blocks, n_blocks times block delta             (`trace_reachables`)
+    n_funcs, n_funcs times function delta            (`trace_freachables`)
+    n_ctx, n_ctx times delta of CTX_IDX(block, ctx)  (`trace_ctx`)
+    n_paths, n_paths times (block, ctx)              (`trace_virgin`)
+    n_targets, n_targets times (block, ctx)          (`trace_targets`)
+
+  where all numbers but u8 are LEB128 varints, and deltas are taken from
+  the previous index of the same list (from 0 for the first one), so the
+  sparse maps of one execution take a few bytes per set entry.
+*/
+
+#define AFLRUN_RECORD_MAGIC 0x3143525452554E52ULL /* "RNURTRC1" */
+
+enum {
+
+  /* 00 */ AFLRUN_RECORD_EXEC,       /* execution checked for new coverage */
+  /* 01 */ AFLRUN_RECORD_IMPORT      /* first run of an imported seed      */
+
+};
+
+typedef struct aflrun_record_hdr {
+
+  u64 magic;
+  u32 map_size;
+  u32 num_reachables, num_freachables;
+  u32 ctx_size_pow2;
+
+} aflrun_record_hdr_t;
+
+/*
+  Summary of a queue entry, written to `queue/.aflrun_summary/<name>` after
+  the entry is calibrated when `--config seed_summary=1` is used: the header
+  below, followed by the body of one record as above, of kind
+  AFLRUN_RECORD_IMPORT, holding the maps of the calibration with classified
+  hit counts. When resuming, the dry run feeds the maps of entries with a
+  summary matching the input, the target and the map sizes to AFLRun and
+  calibration instead of executing them.
+*/
+
+#define AFLRUN_SUMMARY_DIR   ".aflrun_summary"
+#define AFLRUN_SUMMARY_MAGIC 0x314D4D55534E5552ULL /* "RUNSUMM1" */
+
+typedef struct aflrun_summary_hdr {
+
+  u64                 magic;
+  aflrun_record_hdr_t rec;             /* Maps the summary was taken from */
+  u64                 target_mtime;    /* st_mtime and ...                */
+  u64                 target_size;     /* ... st_size of the target       */
+  u64                 input_cksum;     /* hash64() of the input           */
+  u64                 exec_us;         /* `exec_us` of the entry          */
+  u32                 len;
+  u32                 body_len;
+
+} aflrun_summary_hdr_t;
+
+/*
+  Reach log, `aflrun_reach.bin` in the output directory, appended with one
+  record each time the instance reaches a target in a context it has not
+  reached it in before, in host byte order. Records are never changed, so
+  logs of instances are merged by keeping the earliest record of each target
+  and context, as `utils/aflrun_whatsup` does; a resumed session may log a
+  target and context again.
+*/
+
+#define AFLRUN_REACH_LOG "aflrun_reach.bin"
+
+typedef struct aflrun_reach_rec {
+
+  u64 time_ms;                        /* Wall clock, ms since the epoch  */
+  u32 target;                         /* Target block                    */
+  u32 ctx;                            /* Call context, 0 without context */
+  u32 seed;                           /* Id of the queue entry reaching  */
+  u32 reserved;
+
+} aflrun_reach_rec_t;
+
+/*
+  Journal, `aflrun_journal.bin` in the output directory, written with
+  `--config journal=1` instead of rewriting `aflrun_log.txt` and the fringe
+  logs, and turned back into them by `utils/aflrun_journal`. It starts with
+  AFLRUN_JOURNAL_MAGIC, followed by records each made of a varint giving the
+  size of the rest of the record, a u8 kind and:
+
+    AFLRUN_JOURNAL_BLOCK   block, name                 (block reached)
+    AFLRUN_JOURNAL_SEED    seed, f64 factor, f64 quant (factor 0: seed left)
+    AFLRUN_JOURNAL_FRINGE  u8 log, fringe, lines       (no lines: removed)
+    AFLRUN_JOURNAL_TAIL    u8 log, lines
+
+  where `log` is an AFLRUN_JOURNAL_LOG_*, `fringe` is a varint identifying
+  the fringe in its log, and lines are the text of it in the log, up to the
+  end of the record. A record replaces the previous one of the same seed or
+  fringe; lines of the last AFLRUN_JOURNAL_TAIL follow the fringes of a log.
+  The journal is truncated when afl-fuzz starts.
+*/
+
+#define AFLRUN_JOURNAL       "aflrun_journal.bin"
+#define AFLRUN_JOURNAL_MAGIC 0x314E524A4E555252ULL /* "RRUNJRN1" */
+
+enum {
+
+  /* 00 */ AFLRUN_JOURNAL_BLOCK,
+  /* 01 */ AFLRUN_JOURNAL_SEED,
+  /* 02 */ AFLRUN_JOURNAL_FRINGE,
+  /* 03 */ AFLRUN_JOURNAL_TAIL
+
+};
+
+enum {
+
+  /* 00 */ AFLRUN_JOURNAL_LOG_FRINGE,  /* aflrun_fringe.txt     */
+  /* 01 */ AFLRUN_JOURNAL_LOG_PRO,     /* aflrun_pro_fringe.txt */
+  /* 02 */ AFLRUN_JOURNAL_LOG_TARGETS, /* aflrun_targets.txt    */
+  AFLRUN_JOURNAL_LOG_NUM
+
+};
+
+static inline u8 *aflrun_put_varint(u8 *p, u64 v) {
+
+  while (v >= 0x80) {
+
+    *p++ = (u8)(v | 0x80);
+    v >>= 7;
+
+  }
+
+  *p++ = (u8)v;
+  return p;
+
+}
+
+/* Return NULL if the varint does not end before `end`. */
+
+static inline const u8 *aflrun_get_varint(const u8 *p, const u8 *end,
+                                          u64 *v) {
+
+  u64 r = 0;
+  for (u32 shift = 0; p < end && shift < 64; shift += 7) {
+
+    u8 b = *p++;
+    r |= (u64)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+
+      *v = r;
+      return p;
+
+    }
+
+  }
+
+  return NULL;
+
+}
+
+#endif                                           /* !_HAVE_AFLRUN_RECORD_H */
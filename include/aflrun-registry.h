@@ -0,0 +1,111 @@
+#ifndef _HAVE_AFLRUN_REGISTRY_H
+#define _HAVE_AFLRUN_REGISTRY_H
+
+#include "types.h"
+#include "config.h"
+
+#ifdef __cplusplus
+#include <atomic>
+using namespace std;
+#else
+#include <stdatomic.h>
+#endif
+
+/*
+  Registry of reachable blocks shared by all instances syncing to the same
+  directory, mmap-ed from `AFLRUN_REGISTRY_NAME` in the sync directory when
+  `--config shared_state=1` is used. `reached` marks blocks reached by any
+  instance; whoever sets the bit first appends an entry to the log, so each
+  block is logged at most once and the log never needs more entries than
+  reachable blocks. Entries become visible when `seq` is set to index + 1.
+  Other instances react to these entries in their AFLRun state machine
+  without executing the seeds that reached them.
+*/
+
+#define AFLRUN_REGISTRY_NAME  ".aflrun_registry"
+#define AFLRUN_REGISTRY_MAGIC 0x314745524E5552ULL /* "RUNREG1" */
+
+typedef struct aflrun_registry_entry {
+
+  atomic_uint seq;                  /* index + 1 once entry is written    */
+  reach_t     block;
+  u8          fringe;               /* 1: reached, 2: fringe, 3: pro fringe */
+
+} aflrun_registry_entry_t;
+
+typedef struct aflrun_registry {
+
+  u64           magic;
+  reach_t       num_targets, num_reachables;
+  atomic_size_t num;                /* number of entries appended          */
+
+} aflrun_registry_t;
+
+#define AFLRUN_REGISTRY_REACHED(r) \
+  ((atomic_uchar *)((u8 *)(r) + sizeof(aflrun_registry_t)))
+#define AFLRUN_REGISTRY_ENTRIES(r)                                   \
+  ((aflrun_registry_entry_t *)((u8 *)AFLRUN_REGISTRY_REACHED(r) +  \
+                               ((MAP_RBB_SIZE((r)->num_reachables) + 7) & ~7)))
+#define AFLRUN_REGISTRY_SIZE(nr)                        \
+  (sizeof(aflrun_registry_t) + ((MAP_RBB_SIZE(nr) + 7) & ~7) + \
+   sizeof(aflrun_registry_entry_t) * (size_t)(nr))
+
+/*
+  AFLRun metadata of a queue entry, written to `queue/.aflrun/<name>` by
+  each instance when `--config sync_meta=1` is used. It is followed by
+  `num_ctx` u64 indexes of context-sensitive bits set in the trace (i.e.
+  `CTX_IDX(block, ctx)`) and `num_blocks` reachable blocks reached by the
+  entry. When syncing, an entry whose blocks and contexts are all covered
+  locally is skipped without being executed.
+*/
+
+#define AFLRUN_SYNC_META_DIR   ".aflrun"
+#define AFLRUN_SYNC_META_MAGIC 0x314154454D4E5552ULL /* "RUNMETA1" */
+
+typedef struct aflrun_sync_meta {
+
+  u64     magic;
+  u64     path_cksum;                 /* `path_cksum` of the queue entry    */
+  u64     num_ctx;
+  reach_t num_reachables;
+  reach_t num_blocks;
+
+} aflrun_sync_meta_t;
+
+/*
+  Seed scheduler shared by instances syncing to the same directory on one
+  host, mmap-ed from `AFLRUN_SCHED_NAME` in the sync directory when
+  `--config shared_sched=1` is used. Slots are keyed by the trace and path
+  checksums of a seed, which are the same in all instances for the same
+  input. `owner` is the pid of the instance fuzzing the seed right now, and
+  `spent` the quanta spent on it by all instances, in 1/1000 quantum. An
+  instance skips seeds busy in another instance, and seeds whose energy of
+  the cycle was already spent by others; it steals busy seeds once nothing
+  else is left.
+*/
+
+#define AFLRUN_SCHED_NAME  ".aflrun_sched"
+#define AFLRUN_SCHED_MAGIC 0x3144454843534E52ULL /* "RNSCHED1" */
+#define AFLRUN_SCHED_SLOTS (1U << 16)
+
+typedef struct aflrun_sched_slot {
+
+  atomic_ullong key;                /* 0 if free                          */
+  atomic_int    owner;
+  atomic_ullong spent;
+
+} aflrun_sched_slot_t;
+
+typedef struct aflrun_sched {
+
+  u64 magic;
+  u32 num_slots;
+
+} aflrun_sched_t;
+
+#define AFLRUN_SCHED_SLOTS_OF(s) \
+  ((aflrun_sched_slot_t *)((u8 *)(s) + sizeof(aflrun_sched_t)))
+#define AFLRUN_SCHED_SIZE \
+  (sizeof(aflrun_sched_t) + sizeof(aflrun_sched_slot_t) * AFLRUN_SCHED_SLOTS)
+
+#endif                                         /* !_HAVE_AFLRUN_REGISTRY_H */
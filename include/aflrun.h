@@ -4,10 +4,82 @@
 #include "types.h"
 #include "config.h"
 
+// Byte `i` of a cluster virgin map whose words are `stride` `u64` apart
+#define VIRGIN_BYTE(map, i, stride) \
+	((map)[((i) >> 3) * ((stride) << 3) + ((i) & 7)])
+
+// Top-rated map of each non-primary cluster has an entry for each byte of the
+// window of `aflrun_edge_window`, followed by a bitmap of as many bits marking
+// entries that have a top-rated seed; `map_size` is the size of the window.
+#define TOPS_INDEX_WORDS(map_size) (((map_size) + 63) >> 6)
+#define TOPS_INDEX(tops, map_size) ((u64*)((void**)(tops) + (map_size)))
+
+// Classes of havoc operators scheduled by `op_sched`, see afl-fuzz-one.c
+#define AFLRUN_HAVOC_OPS 9
+
+// Phases of AFLRun bookkeeping timed when profiling, see `aflrun_get_phases`
+enum
+{
+	AFLRUN_PHASE_NEW_PATH,   // aflrun_has_new_path, including the two below
+	AFLRUN_PHASE_FRINGE,     // try_add_fringe of a new path and its BFS
+	AFLRUN_PHASE_FRINGE_COV, // fringe_coverage of a new seed
+	AFLRUN_PHASE_ENERGY,     // assign_energy_unite
+	AFLRUN_PHASE_CULL_DIV,   // cull_queue_div in afl-fuzz
+	AFLRUN_PHASE_MERGE,      // Clusters::try_merge
+	AFLRUN_PHASE_NUM
+};
+
+// Data structures of AFLRun whose memory is estimated by `aflrun_get_memory`
+enum
+{
+	AFLRUN_MEM_VIRGINS,      // virgin map of each cluster
+	AFLRUN_MEM_TOPS,         // top-rated seed map of each cluster
+	AFLRUN_MEM_CLUSTERS,     // cluster members, support counts and bit seqs
+	AFLRUN_MEM_FRINGES,      // fringes, their seeds, and indexes to them
+	AFLRUN_MEM_SEED_FRINGES, // fringes covered by each seed
+	AFLRUN_MEM_DECISIVES,    // decisive blocks of fringes
+	AFLRUN_MEM_DIV,          // diversity blocks and their seeds
+	AFLRUN_MEM_NUM
+};
+
+// Number of calls and total `aflrun_ticks` of a phase, and histogram of
+// its calls by ticks, where bucket `i` counts calls of [2^i, 2^(i+1)) ticks
+#define AFLRUN_PHASE_HIST 40
+typedef struct aflrun_phase
+{
+	u64 calls, ticks;
+	u64 hist[AFLRUN_PHASE_HIST];
+} aflrun_phase_t;
+
+// An instance of AFLRun, see `aflrun_ctx_switch`
+typedef struct aflrun_ctx aflrun_ctx_t;
+
+// An execution of a window given to `aflrun_has_new_paths`, with arguments
+// of `aflrun_has_new_path` for it other than the seed
+typedef struct aflrun_exec
+{
+	const u8 *freached, *reached, *path;
+	const ctx_t* virgin_trace; size_t len;
+	u8 inc;
+	const u8* new_bits; const size_t* clusters; size_t num_clusters;
+} aflrun_exec_t;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
+	/* functions managing instances */
+
+	// New instance, uninitialized like the one at startup
+	aflrun_ctx_t* aflrun_ctx_new(void);
+	// Free `ctx`, which must be neither current nor the one at startup
+	void aflrun_ctx_free(aflrun_ctx_t* ctx);
+	// Make `ctx` the instance that all other functions called by this thread
+	// act on, and return the previous one; each thread starts on the one at
+	// startup. Different instances can thus be driven by different threads
+	// at once, while calls acting on the same one must not overlap.
+	aflrun_ctx_t* aflrun_ctx_switch(aflrun_ctx_t* ctx);
+
 	/* functions called at initialization */
 
 	void aflrun_load_config(const char* config_str,
@@ -19,9 +91,59 @@ extern "C"
 	void aflrun_load_edges(const char* bb_edges, reach_t num_reachables);
 	void aflrun_load_dists(const char* dir, reach_t num_targets,
 		reach_t num_reachables, char** reachable_names);
+	// Load function names, edges, distances and target groups from mmap-ed
+	// `aflrun.bin`; `temp_path` is only used for Chash.txt if the image has
+	// no call hashes
+	void aflrun_load_image(const char* temp_path, const void* image);
+	// Load static groups of targets from Tgroups.txt, if any, which
+	// `aflrun_load_image` takes from the image instead
+	void aflrun_load_groups(const char* temp_path);
+	// Load ids of edges of reachable functions from EdgeWindow.txt, if any
+	void aflrun_load_window(const char* temp_path);
 
 	void aflrun_init_fringes(
 		reach_t num_reachables, reach_t num_targets);
+	// Registry shared among instances, see `aflrun-registry.h`
+	bool aflrun_shared_state(void);
+	bool aflrun_shared_sched(void);
+	void aflrun_init_registry(void* registry);
+	// If queue entries carry AFLRun metadata for syncing
+	bool aflrun_sync_meta(void);
+	// If queue entries carry a summary of their maps, see `aflrun-record.h`
+	bool aflrun_seed_summary(void);
+	// If stages before havoc are charged against energy of seed
+	bool aflrun_budget_stages(void);
+	// If fuzzed quanta are measured by CPU time
+	bool aflrun_cpu_quantum(void);
+	// Quanta of each draw from alias table of seeds, 0 if not drawn
+	double aflrun_alias_slice(void);
+	// If seeds are spliced with those covering complementary fringes
+	bool aflrun_splice_fringe(void);
+	// If call edges of indirect calls are learned at runtime
+	bool aflrun_learn_edges_enabled(void);
+	// If energy favors fringes hit by fewer executions, sampled from runtime
+	bool aflrun_rare_fringes(void);
+	// Share of fuzzer time AFLRun bookkeeping is tuned to take, 0 if not tuned
+	double aflrun_auto_tune(void);
+	// If runtime is lowered to AFLRUN_LEVEL_BLOCKS in coverage mode
+	bool aflrun_lean_cov(void);
+	// If blocks that can no longer lead to unreached targets are muted
+	bool aflrun_mute_enabled(void);
+	// If logs are journaled to `aflrun_journal.bin` instead of rewritten
+	bool aflrun_journal_enabled(void);
+	// If input-to-state only solves compares of blocks reaching targets
+	bool aflrun_directed_cmplog(void);
+	// If havoc operators are drawn from weights learned per target group
+	bool aflrun_op_sched(void);
+	// Executions of the inference of influential regions of a seed, or 0
+	u32 aflrun_influence_execs(void);
+	// If deterministic stages are focused on seeds and regions, see below
+	bool aflrun_focus_det(void);
+	// If havoc stacking is bounded by `aflrun_get_seed_dist`
+	bool aflrun_dist_stack(void);
+	bool aflrun_retire_extra(void);
+	// Crashes kept per bucket, or 0 if not bucketed; `depth` blocks per key
+	u32 aflrun_crash_buckets(u32* depth);
 	void aflrun_init_groups(reach_t num_targets);
 
 	void aflrun_init_globals(void* afl,
@@ -33,7 +155,10 @@ extern "C"
 		const double* target_weights, u32 map_size, u8* div_switch,
 		const char* cycle_time);
 
-	void aflrun_remove_seed(u32 seed);
+	// Remove duplicate seeds, each fringe and block of them is updated once
+	void aflrun_remove_seeds(const u32* seeds, u32 num);
+	// If a seed covering no fringe can be removed without changing diversity
+	bool aflrun_can_retire(u32 seed);
 
 	/* functions used to update fringe */
 
@@ -45,21 +170,102 @@ extern "C"
 	u8 aflrun_has_new_path(const u8* freached, const u8* reached, const u8* path,
 		const ctx_t* virgin_trace, size_t len, u8 inc, u32 seed,
 		const u8* new_bits, const size_t* clusters, size_t num_clusters);
+	// Same as `aflrun_has_new_path` for each of `k` executions in order into
+	// `ret`, where the first one is given `seed` and each next one the seed
+	// after those kept before it, i.e. with `new_bits` or non-zero `ret`;
+	// returns the number kept. With `batch_bfs`, paths of the window are
+	// searched together as long as no execution of it reaches new blocks.
+	u32 aflrun_has_new_paths(const aflrun_exec_t* execs, size_t k, u32 seed,
+		u8* ret);
 	u8 aflrun_end_cycle();
+	// React to blocks reached by other instances in the registry
+	void aflrun_registry_poll(void);
+	// Split targets among nodes if `partition_targets` is set, at each sync
+	void aflrun_partition_targets(u8 is_main);
 	void aflrun_update_fuzzed_quant(u32 id, double fuzzed_quant);
+	// Restore clusters from checkpoint of a resumed session before dry run,
+	// return 1 if done, 0 if there is no checkpoint, -1 if it is invalid,
+	// in which case `error` tells why
+	int aflrun_load_checkpoint(const char** error);
+	// Restore the rest of the checkpoint, called after dry run in any case
+	void aflrun_apply_checkpoint(void);
+	// Write a checkpoint at exit, if `checkpoint_interval` is set
+	void aflrun_write_checkpoint(void);
 
 	/* functions for debugging and inspecting */
 
 	void aflrun_check_state(void);
 	void aflrun_log_fringes(const char* path, u8 prog);
+	// Append reached blocks and fringes changed since last call to the journal,
+	// with the parts that are not journaled and all seeds if `snapshot`
+	void aflrun_journal_flush(u8 snapshot);
+	// Journal factor `k` of `seed`, if it differs from the one journaled
+	void aflrun_journal_seed(u32 seed, double k);
 	void aflrun_get_state(int* cycle_count, u32* cov_quant,
 		size_t* div_num_invalid, size_t* div_num_fringes);
+	// Start timing the phases above, which costs two `aflrun_ticks` per call
+	void aflrun_profile_phases(void);
+	void aflrun_add_phase(u32 phase, u64 ticks);
+	// Return `AFLRUN_PHASE_NUM` phases, and the total number of virgin maps
+	// checked by executions in `num_virgin_maps`
+	const aflrun_phase_t* aflrun_get_phases(u64* num_virgin_maps);
+	// Estimate heap bytes of each `AFLRUN_MEM_*` into `cur`, and the largest
+	// estimates among all calls into `peak`; this traverses all structures.
+	void aflrun_get_memory(size_t* cur, size_t* peak);
+	// Bytes mapped for nodes of hash containers, and bytes of nodes in use,
+	// shared by all instances; see aflrun-pool.h, 0 without `AFLRUN_POOL`
+	void aflrun_get_pool(size_t* mapped, size_t* used);
+	// Current numbers of path, progressive path and target fringes
+	void aflrun_get_fringes(size_t* num_path_fringes,
+		size_t* num_pro_fringes, size_t* num_target_fringes);
 	u64 aflrun_queue_cycle(void);
 	u8 aflrun_get_mode(void);
 	bool aflrun_is_uni(void);
 	void aflrun_get_reached(reach_t* num_reached, reach_t* num_freached,
 		reach_t* num_reached_targets, reach_t* num_freached_targets);
 	double aflrun_get_seed_quant(u32 seed);
+	// Blocks of fringes of current mode covered by `seed` (all fringes in
+	// coverage and unite mode) into `ret_blocks`, and for each target the
+	// smallest distance from them into `ret_dists` (infinity if none leads to
+	// it); both are owned by AFLRun and valid until next call.
+	// Return number of blocks.
+	size_t aflrun_get_seed_fringes(u32 seed,
+		const reach_t** ret_blocks, const double** ret_dists);
+	// Sorted blocks of fringes of current mode covered by `seed` (all fringes
+	// in coverage and unite mode) and their decisive blocks into `ret`, owned
+	// by AFLRun and valid until next call. Return number of blocks.
+	size_t aflrun_get_seed_decisives(u32 seed, const reach_t** ret);
+	// Sorted targets reached by `seed` into `ret` if `early_exit` is set and
+	// AFLRun exploits targets, where its runs may exit once they reached all
+	// of them, owned by AFLRun and valid until next call. Return number.
+	size_t aflrun_get_seed_goals(u32 seed, const reach_t** ret);
+	// Smallest distance to a target from fringes of current mode covered by
+	// `seed`, as in `aflrun_get_seed_fringes`, which it invalidates; infinity
+	// if there is none.
+	double aflrun_get_seed_dist(u32 seed);
+	// If `seed` covers a progressive fringe or a target, regardless of mode,
+	// which `focus_det` requires for deterministic stages.
+	bool aflrun_seed_focus(u32 seed);
+	// Top rated seeds of fringes of current mode (all fringes in coverage and
+	// unite mode) not covered by `seed` but leading to a target group that its
+	// fringes lead to, into `ret`, owned by AFLRun and valid until next call.
+	// Return number of seeds.
+	size_t aflrun_get_splice_partners(u32 seed, const u32** ret);
+	// Probabilities of the `AFLRUN_HAVOC_OPS` havoc operators when fuzzing
+	// `seed` into `ret`, of which `widths` are the default shares, learned for
+	// the target groups its fringes lead to; these are credited by the next
+	// `aflrun_op_update` with `finds` out of `uses` executions of each.
+	void aflrun_op_weights(u32 seed, const u32* widths, double* ret);
+	void aflrun_op_update(const u32* uses, const u32* finds);
+	// Add call edges logged by runtime in `log` of `num` entries to the graph
+	// if `learn_edges` is set and repair distances, consuming the entries.
+	void aflrun_learn_edges(aflrun_icall_t* log, size_t num);
+	// Add hits of blocks switched on for diversity counted by runtime in
+	// `counts` to their frequencies if `rare_fringes` is set, clearing them.
+	void aflrun_sample_freq(u8* counts);
+	// Set bits of reached blocks the runtime only needs to mark as reached in
+	// `mute` if `mute_blocks` is set, clearing all others; returns their number.
+	size_t aflrun_mute_blocks(u8* mute);
 	void aflrun_get_time(u64* last_reachable, u64* last_fringe,
 		u64* last_pro_fringe, u64* last_target, u64* last_ctx_reachable,
 		u64* last_ctx_fringe, u64* last_ctx_pro_fringe, u64* last_ctx_target);
@@ -69,12 +275,20 @@ extern "C"
 	// calculate energy for each seed
 	void aflrun_assign_energy(u32 num_seeds, const u32* seeds, double* ret);
 	void aflrun_set_num_active_seeds(u32 n);
+	// Adjust thresholds for `auto_tune`, given `ticks` of bookkeeping out of
+	// `total` ticks of fuzzing so far; called before `aflrun_cycle_end`
+	void aflrun_tune(u64 ticks, u64 total);
 	u8 aflrun_cycle_end(u8*);
 
 	// update score and queue culling
 	void aflrun_update_fringe_score(u32 seed);
 	u32 aflrun_cull_queue(u32* seeds, u32 num);
 	void aflrun_set_favored_seeds(const u32* seeds, u32 num, u8 mode);
+	// Call `fn(arg, i, worker)` for each `i < num` using `num_workers` threads,
+	// where `worker < aflrun_num_workers()` identifies the calling thread.
+	size_t aflrun_num_workers(void);
+	void aflrun_parallel_for(size_t num,
+		void (*fn)(void* arg, size_t i, size_t worker), void* arg);
 
 	/* Functions for the second diversity idea */
 
@@ -85,6 +299,13 @@ extern "C"
 	size_t aflrun_get_seed_virgins(u32 seed, u8** ret_maps, size_t* ret_clusters);
 	size_t aflrun_get_seed_tops(u32 seed, void*** ret_tops);
 	size_t aflrun_get_num_clusters(void);
+	// Stride in `u64` between words of virgin maps returned above,
+	// excluding the primary map which is always contiguous.
+	size_t aflrun_virgin_stride(void);
+	// Bytes [lo, hi) of the primary map that virgin and top-rated maps of
+	// clusters cover, aligned to 64; word `i` of the window is word `i` of
+	// the map of a cluster, and entry `i` is entry `i` of its top-rated map.
+	void aflrun_edge_window(u32* lo, u32* hi);
 	size_t aflrun_get_all_tops(void*** ret_tops, u8 mode);
 
 	// For target clustering
@@ -94,13 +315,18 @@ extern "C"
 #else
 	#error "Please use 64-bit to compile AFLRun"
 #endif
+	// Commit sequences of an execution, and enforce `cluster_mem_budget`
 	void aflrun_commit_bit_seqs(const size_t* clusters, size_t num);
+	// Number of clusters merged into primary cluster by `cluster_mem_budget`
+	size_t aflrun_get_evicted_clusters(void);
 
 	// AFL interfaces
 	u64 get_seed_fav_factor(void* afl_void, u32 seed);
 	double get_seed_perf_score(void* afl_void, u32 seed);
 	bool get_seed_div_favored(void* afl_void, u32 seed);
 	u8 get_seed_cov_favored(void* afl_void, u32 seed);
+	u64 get_seed_exec_us(void* afl_void, u32 seed);
+	void merge_seed_tops(void* afl_void, void** dst, void** src);
 	void disable_aflrun_extra(void* afl_void, u32 seed);
 	u64 get_cur_time(void);
 
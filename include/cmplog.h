@@ -41,6 +41,11 @@
 #define CMP_TYPE_INS 1
 #define CMP_TYPE_RTN 2
 
+/* Values of `cmp_map->blocks`: 1 + the reachable block of the compare as
+   aflrun-pass numbers them, or one of these. */
+#define CMP_BLOCK_UNKNOWN 0                   /* not compiled by aflrun-pass */
+#define CMP_BLOCK_UNREACHABLE 0xffffffffU     /* reaches no target           */
+
 struct cmp_header {
 
   unsigned hits : 24;
@@ -77,6 +82,7 @@ struct cmp_map {
 
   struct cmp_header   headers[CMP_MAP_W];
   struct cmp_operands log[CMP_MAP_W][CMP_MAP_H];
+  u32                 blocks[CMP_MAP_W];    /* `__afl_cmp_block` at last hit */
 
 };
 
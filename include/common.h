@@ -87,6 +87,33 @@ void configure_afl_kill_signals(afl_forkserver_t *fsrv,
 
 void read_bitmap(u8 *fname, u8 *map, size_t len);
 
+/* Read the header of BBreachable.txt or Freachable.txt of AFLRun, this is
+   for the -d option of afl-showmap, afl-tmin, afl-analyze and
+   afl-network-server. */
+
+void load_aflrun_header(u8 *file, reach_t *num_targets,
+                        reach_t *num_reachables);
+
+/* Fork `jobs` workers for the -j option of afl-showmap and afl-analyze,
+   each with a pipe to the parent. A worker gets NULL, with its number in
+   `*job_id` and its end of the pipe in `*job_out`; the parent gets the
+   ends of all workers, and their pids in `*pids`. */
+
+FILE **fork_jobs(u32 jobs, u32 *job_id, FILE **job_out, pid_t **pids);
+
+/* Send results of worker `job_id` to the parent. */
+
+void job_send(FILE *out, u32 job_id, const void *buf, size_t size, size_t n);
+
+/* Read results of worker `w`, which failed if they are cut short. */
+
+void job_recv(FILE *in, u32 w, void *buf, size_t size, size_t n);
+
+/* Close the pipes of the workers and wait for them, which must all exit
+   with 0; `in` and `pids` are freed. */
+
+void reap_jobs(FILE **in, pid_t *pids, u32 jobs);
+
 /* Get unix time in milliseconds */
 
 u64 get_cur_time(void);
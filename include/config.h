@@ -113,6 +113,17 @@
 #define STATSD_DEFAULT_PORT 8125
 #define STATSD_DEFAULT_HOST "127.0.0.1"
 
+/* Prometheus exporter enabled with AFL_PROMETHEUS_PORT: seconds between
+   metric updates by the fuzzing loop, and maximum size of the metrics page. */
+#define PROMETHEUS_UPDATE_SEC 1
+#define PROMETHEUS_MAX_SIZE 8192
+
+/* Log of afl-fuzz when not on a tty, with AFL_NO_UI_LOG_INTERVAL or
+   AFL_NO_UI_LOG_JSON: default milliseconds between lines, and maximum size
+   of a line. */
+#define NOTTYLOG_DEFAULT_MS 1000
+#define NOTTYLOG_MAX_SIZE 2048
+
 /* If you want to have the original afl internal memory corruption checks.
    Disabled by default for speed. it is better to use "make ASAN_BUILD=1". */
 
@@ -157,6 +168,11 @@
 #define CAL_CYCLES 7U
 #define CAL_CYCLES_LONG 12U
 
+/* With AFL_CAL_ADAPTIVE, number of calibration cycles reproducing the trace a
+   new queue entry was saved with, after which calibration stops early: */
+
+#define CAL_CYCLES_ADAPTIVE 1U
+
 /* Number of subsequent timeouts before abandoning an input file: */
 
 #define TMOUT_LIMIT 250U
@@ -181,6 +197,21 @@
 
 #define HAVOC_MIN 12U
 
+/* Maximum number of extra forkservers running havoc inputs (AFL_FSRV_POOL): */
+
+#define FSRV_POOL_MAX 64U
+
+/* Inputs waiting for the sanitizer build (AFL_SAN_BINARY), and how much
+   longer than -t it may run: */
+
+#define SAN_QUEUE_MAX 64U
+#define SAN_TMOUT_MULT 3U
+
+/* Files waiting for the writer thread (AFL_ASYNC_WRITE) before afl-fuzz
+   waits for it: */
+
+#define ASYNCW_QUEUE_MAX 256U
+
 /* Power Schedule Divisor */
 #define POWER_BETA 1U
 #define MAX_FACTOR (POWER_BETA * 32)
@@ -375,6 +406,19 @@
 
 #define TESTCASE_CACHE_SIZE 50
 
+/* In AFLRun mode, number of cached testcases probed for the one with least
+   energy left in the cycle when one has to be evicted, and number of seeds
+   after the current one in the cycle to prefetch from disk: */
+
+#define AFLRUN_CACHE_PROBES 16
+#define AFLRUN_CACHE_PREFETCH 8
+
+/* Maximum number of testcases mapped at once with AFL_TESTCACHE_MMAP, the
+   least recently used ones are unmapped beyond it; keep it well under
+   vm.max_map_count, 65530 by default: */
+
+#define TESTCASE_MMAP_MAX 4096
+
 /* Maximum line length passed from GCC to 'as' and used for parsing
    configuration files: */
 
@@ -508,32 +552,77 @@
 
 #define AFL_TXT_STRING_MAX_MUTATIONS 6
 
-/* Shared memory used to record if each basic block and function
-   reachable to any target has been executed during one execution */
-#define SHM_RBB_ENV_VAR    "__AFLRUN_RBB_SHM_ID"
-#define SHM_RF_ENV_VAR     "__AFLRUN_RF_SHM_ID"
-
-#define SHM_TR_ENV_VAR     "__AFLRUN_TR_SHM_ID"
-#define SHM_VIR_ENV_VAR    "__AFLRUN_VIR_SHM_ID"
-#define SHM_VTR_ENV_VAR    "__AFLRUN_VTR_SHM_ID"
-
-#define SHM_TT_ENV_VAR     "__AFLRUN_TT_SHM_ID"
-#define SHM_DIV_ENV_VAR    "__AFLRUN_DIV_SHM_ID"
-
+/* Shared memory holding all AFLRun maps (e.g. reachable blocks and functions
+   executed, context-sensitive coverage and trace logs) in one region, so the
+   target attaches it once; see `aflrun_shm_hdr_t` in trace.h for its layout */
+#define SHM_AFLRUN_ENV_VAR "__AFLRUN_SHM_ID"
+
+/* AFLRun maps at least this large are backed by huge pages when possible,
+   since context-sensitive maps are large and accessed randomly; setting
+   AFLRUN_NO_HUGEPAGES in environment disables this */
+#define AFLRUN_HUGE_PAGE_SIZE (2UL << 20)
+
+/* Each AFLRun map starts at an offset aligned to this (power of 2), i.e. a
+   pair of cache lines, since adjacent line prefetchers fetch lines in pairs,
+   so the end of a map written by the target (e.g. rbb) and the start of the
+   next one (e.g. rf) do not share a line nor its pair */
+#define AFLRUN_SHM_ALIGN 128
+
+/* In Nyx mode AFLRun maps are moved to the end of the bitmap buffer shared
+   with the guest, starting at an offset aligned to this (power of 2) */
+#define AFLRUN_NYX_ALIGN 4096
+
+/* With AFLRUN_PROFILE set, the runtime times one of every this many slow
+   paths of AFLRun instrumentation (power of 2) */
+#define AFLRUN_PROFILE_PERIOD 64
+
+/* With `--config rare_fringes=1`, the runtime counts runs reaching each
+   fringe in a byte, which the fuzzer adds to a count-min sketch of
+   2^AFLRUN_FREQ_SKETCH_POW2 by AFLRUN_FREQ_SKETCH_DEPTH (at most 4) counters
+   every AFLRUN_FREQ_SAMPLE_EXECS executions, fewer than a byte saturates at */
+#define AFLRUN_FREQ_SAMPLE_EXECS 128
+#define AFLRUN_FREQ_SKETCH_POW2 12
+#define AFLRUN_FREQ_SKETCH_DEPTH 4
+
+/* Calling contexts are hashed into CTX_SIZE values, and each reachable block
+   takes CTX_NUM_BYTES bytes in context-sensitive maps. It can be changed at
+   build time (e.g. -DCTX_SIZE_POW2=12), but the pass, runtime and fuzzer must
+   agree on it, which is checked when they start. */
+#ifndef CTX_SIZE_POW2
 #define CTX_SIZE_POW2       8
+#endif
+#if CTX_SIZE_POW2 < 3 || CTX_SIZE_POW2 > 16
+  #error "CTX_SIZE_POW2 must be within [3, 16]"
+#endif
 #define CTX_SIZE            (1 << CTX_SIZE_POW2)
 #define CTX_NUM_BYTES       (CTX_SIZE / 8)
-#define CTX_IDX(block, ctx) ((block) * CTX_SIZE + (ctx))
+#define CTX_IDX(block, ctx) ((size_t)(block) * CTX_SIZE + (ctx))
 
 #define MAP_RF_SIZE(nr)     (((nr) + 7) / 8)
 #define MAP_RBB_SIZE(nr)    MAP_RF_SIZE((nr) + 1)
 // we need one more bit for telling if counting frequency
-#define MAP_TR_SIZE(nr)     ((nr) * CTX_NUM_BYTES)
-#ifndef AFLRUN_CTX
-#define MAP_VTR_SIZE(nr)    ((nr) * sizeof(ctx_t) + sizeof(trace_t))
-#else
-#define MAP_VTR_SIZE(nr)    (MAP_TR_SIZE(nr) * 8 * sizeof(ctx_t) + sizeof(trace_t))
-#endif // AFLRUN_CTX
+// rounded up to 8 bytes because fringe coverage is tested word by word
+#define MAP_TR_SIZE(nr)     (((size_t)(nr) * CTX_NUM_BYTES + 7) & ~(size_t)7)
+// Logs of new virgin paths and reached diversity blocks have a fixed capacity.
+// Reached diversity blocks are logged at most once for each run, and so are
+// virgin paths without AFLRUN_CTX; with AFLRUN_CTX the virgin path log can be
+// full, then `num` exceeds the capacity, and paths not logged are left virgin
+// by the runtime, so the fuzzer can find them by scanning coverage.
+#define MAP_VTR_CAP(nr)     ((size_t)(nr))
+#define MAP_VTR_SIZE(nr)    (MAP_VTR_CAP(nr) * sizeof(ctx_t) + sizeof(trace_t))
+// each reachable block is logged at most once in each run
+#define MAP_DB_SIZE(nr)     ((nr) * sizeof(ctx_t) + sizeof(trace_t))
+// indirect call edges are hashed into a log of fixed size, a power of 2
+#define AFLRUN_ICALL_LOG_POW2 12
+#define AFLRUN_ICALL_LOG_SIZE (1 << AFLRUN_ICALL_LOG_POW2)
+#define MAP_IC_SIZE         (AFLRUN_ICALL_LOG_SIZE * sizeof(aflrun_icall_t))
+// targets come first among reachables, so a slot for each of them is enough
+#define MAP_CD_SIZE(nr)     (sizeof(aflrun_cmp_map_t) + (nr))
+// saturating count of runs reaching each block switched on for diversity,
+// never cleared between runs but consumed by `aflrun_sample_freq`
+#define MAP_HC_SIZE(nr)     ((size_t)(nr))
+// `num` of dirty log before runtime claims it supports the log
+#define DIRTY_UNSUPPORTED   ((size_t)-1)
 
 #define AFLRUN_SPLICE_TIMES(e, sc) \
    (((e) * SPLICE_HAVOC) / (HAVOC_CYCLES + SPLICE_HAVOC * (sc)))
@@ -547,5 +636,20 @@
 
 #define AFLRUN_TEMP_SIG "##SIG_AFLRUN_TEMP_DIR##="
 
+/* With AFLRUN_EMBED_IMAGE set when linking, `aflrun.bin` is also put into the
+   binary right after this signature (24 bytes with its NUL, so the image
+   stays 8-byte aligned), and afl-fuzz maps it from there */
+#define AFLRUN_IMAGE_SIG "##SIG_AFLRUN_IMAGE#####"
+#define AFLRUN_IMAGE_SECTION ".aflrun_image"
+
+/* Indirect calls get edges in the AFLRun CFG to defined address-taken
+   functions of their type, unless there are more of them than this or
+   AFLRUN_NO_ICALL is set at compile time */
+#define AFLRUN_ICALL_MAX_CALLEES 64
+
+/* Binary compiled with AFLRUN_NO_DIVERSITY, whose non-target blocks never
+   check their diversity switches, so fringe diversity cannot work */
+#define AFLRUN_NO_DIV_SIG "##SIG_AFLRUN_NO_DIVERSITY##"
+
 #endif                                                  /* ! _HAVE_CONFIG_H */
 
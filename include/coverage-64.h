@@ -5,8 +5,10 @@
   #include <immintrin.h>
 #endif
 
-u32 skim(const u64* const* virgins, size_t num,
-  const u64 *current, const u64 *current_end);
+/* `virgins[0]` is the primary map; word `i` of the trace is word `i - lo` of
+   the other ones, whose words are `stride` apart, if `i - lo < win`. */
+u32 skim(const u64* const* virgins, size_t num, size_t stride,
+  size_t lo, size_t win, const u64 *current, const u64 *current_end);
 u64 classify_word(u64 word);
 
 inline u64 classify_word(u64 word) {
@@ -24,11 +26,107 @@ inline u64 classify_word(u64 word) {
 
 }
 
+/* Whole packs of CLASSIFY_PACK trace bytes are tested and rewritten at once
+   with AVX-512BW or AVX2: a count class is looked up by the high nibble of a
+   count, or by the low one if the high one is zero, so no table lookup is
+   done per byte. Tails and other CPUs go word by word. */
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  #define CLASSIFY_PACK 64
+
+static inline u8 pack_is_zero(const u8 *p) {
+
+  __m512i v = _mm512_loadu_si512((const void *)p);
+  return !_mm512_test_epi64_mask(v, v);
+
+}
+
+static inline void classify_pack(u8 *p) {
+
+  const __m512i lo_lut = _mm512_broadcast_i32x4(_mm_setr_epi8(
+      0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16));
+  const __m512i hi_lut = _mm512_broadcast_i32x4(_mm_setr_epi8(
+      0, 32, 64, 64, 64, 64, 64, 64, -128, -128, -128, -128, -128, -128, -128,
+      -128));
+  const __m512i nibble = _mm512_set1_epi8(0x0f);
+
+  __m512i   v = _mm512_loadu_si512((const void *)p);
+  __m512i   lo = _mm512_and_si512(v, nibble);
+  __m512i   hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+  __mmask64 hi_set = _mm512_test_epi8_mask(hi, hi);
+  __m512i   ret = _mm512_mask_blend_epi8(hi_set, _mm512_shuffle_epi8(lo_lut, lo),
+                                         _mm512_shuffle_epi8(hi_lut, hi));
+  _mm512_storeu_si512((void *)p, ret);
+
+}
+
+static inline void simplify_pack(u8 *p) {
+
+  __m512i   v = _mm512_loadu_si512((const void *)p);
+  __mmask64 hit = _mm512_test_epi8_mask(v, v);
+  _mm512_storeu_si512((void *)p, _mm512_mask_blend_epi8(hit, _mm512_set1_epi8(1),
+                                                        _mm512_set1_epi8(-128)));
+
+}
+
+#elif defined(__AVX2__)
+  #define CLASSIFY_PACK 32
+
+static inline u8 pack_is_zero(const u8 *p) {
+
+  __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  return _mm256_testz_si256(v, v);
+
+}
+
+static inline void classify_pack(u8 *p) {
+
+  const __m256i lo_lut = _mm256_setr_epi8(
+      0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16, 0, 1, 2, 4, 8, 8,
+      8, 8, 16, 16, 16, 16, 16, 16, 16, 16);
+  const __m256i hi_lut = _mm256_setr_epi8(
+      0, 32, 64, 64, 64, 64, 64, 64, -128, -128, -128, -128, -128, -128, -128,
+      -128, 0, 32, 64, 64, 64, 64, 64, 64, -128, -128, -128, -128, -128, -128,
+      -128, -128);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+  __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  __m256i lo = _mm256_and_si256(v, nibble);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+  __m256i hi_zero = _mm256_cmpeq_epi8(hi, _mm256_setzero_si256());
+  __m256i ret = _mm256_blendv_epi8(_mm256_shuffle_epi8(hi_lut, hi),
+                                   _mm256_shuffle_epi8(lo_lut, lo), hi_zero);
+  _mm256_storeu_si256((__m256i *)p, ret);
+
+}
+
+static inline void simplify_pack(u8 *p) {
+
+  __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  __m256i zero = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+  _mm256_storeu_si256((__m256i *)p,
+                      _mm256_blendv_epi8(_mm256_set1_epi8(-128),
+                                         _mm256_set1_epi8(1), zero));
+
+}
+
+#endif
+
 void simplify_trace(afl_state_t *afl, u8 *bytes) {
 
   u64 *mem = (u64 *)bytes;
   u32  i = (afl->fsrv.map_size >> 3);
 
+#ifdef CLASSIFY_PACK
+  for (; i >= CLASSIFY_PACK / 8; i -= CLASSIFY_PACK / 8) {
+
+    simplify_pack((u8 *)mem);
+    mem += CLASSIFY_PACK / 8;
+
+  }
+
+#endif
+
   while (i--) {
 
     /* Optimize for sparse bitmaps. */
@@ -61,6 +159,18 @@ inline void classify_counts(afl_forkserver_t *fsrv) {
   u64 *mem = (u64 *)fsrv->trace_bits;
   u32  i = (fsrv->map_size >> 3);
 
+#ifdef CLASSIFY_PACK
+  for (; i >= CLASSIFY_PACK / 8; i -= CLASSIFY_PACK / 8) {
+
+    /* Optimize for sparse bitmaps. */
+
+    if (unlikely(!pack_is_zero((u8 *)mem))) { classify_pack((u8 *)mem); }
+    mem += CLASSIFY_PACK / 8;
+
+  }
+
+#endif
+
   while (i--) {
 
     /* Optimize for sparse bitmaps. */
@@ -112,8 +222,8 @@ inline void discover_word(u8 *ret, u64 *current, u64 *virgin) {
 
 #if defined(__AVX512F__) && defined(__AVX512DQ__)
   #define PACK_SIZE 64
-inline u32 skim(const u64* const* virgins, size_t num,
-  const u64 *current, const u64 *current_end) {
+inline u32 skim(const u64* const* virgins, size_t num, size_t stride,
+  size_t lo, size_t win, const u64 *current, const u64 *current_end) {
 
   size_t idx = 0;
   for (; current < current_end; idx += 8, current += 8) {
@@ -127,9 +237,13 @@ inline u32 skim(const u64* const* virgins, size_t num,
     #define UNROLL(x) \
     if (unlikely(!(mask & (1 << x)))) { \
       u64 classified = classify_word(current[x]); \
-      for (size_t i = 0; i < num; ++i) { \
-        if (classified & virgins[i][idx + x]) \
-          return 1; \
+      if (classified & virgins[0][idx + x]) \
+        return 1; \
+      if (idx + x - lo < win) { \
+        for (size_t i = 1; i < num; ++i) { \
+          if (classified & virgins[i][(idx + x - lo) * stride]) \
+            return 1; \
+        } \
       } \
     }
 
@@ -154,8 +268,8 @@ inline u32 skim(const u64* const* virgins, size_t num,
 
 #if !defined(PACK_SIZE) && defined(__AVX2__)
   #define PACK_SIZE 32
-inline u32 skim(const u64* const* virgins, size_t num,
-  const u64 *current, const u64 *current_end) {
+inline u32 skim(const u64* const* virgins, size_t num, size_t stride,
+  size_t lo, size_t win, const u64 *current, const u64 *current_end) {
 
   __m256i zeroes = _mm256_setzero_si256();
 
@@ -173,9 +287,12 @@ inline u32 skim(const u64* const* virgins, size_t num,
     #define UNROLL(j) \
     if (unlikely(!(mask & (0xff << (j * 8))))) { \
       u64 classified = classify_word(current[j]); \
-      for (size_t i = 0; i < num; ++i) \
-        if (classified & virgins[i][idx + j]) \
-          return 1; \
+      if (classified & virgins[0][idx + j]) \
+        return 1; \
+      if (idx + j - lo < win) \
+        for (size_t i = 1; i < num; ++i) \
+          if (classified & virgins[i][(idx + j - lo) * stride]) \
+            return 1; \
     }
     UNROLL(0)
     UNROLL(1)
@@ -193,8 +310,8 @@ inline u32 skim(const u64* const* virgins, size_t num,
 
 #if !defined(PACK_SIZE)
   #define PACK_SIZE 32
-inline u32 skim(const u64* const* virgins, size_t num,
-  const u64 *current, const u64 *current_end) {
+inline u32 skim(const u64* const* virgins, size_t num, size_t stride,
+  size_t lo, size_t win, const u64 *current, const u64 *current_end) {
 
   size_t idx = 0;
   for (; current < current_end; idx += 4, current += 4) {
@@ -202,9 +319,12 @@ inline u32 skim(const u64* const* virgins, size_t num,
   #define UNROLL(j) \
     if (unlikely(current[j])) { \
       u64 classified = classify_word(current[j]); \
-      for (size_t i = 0; i < num; ++i) \
-        if (classified & virgins[i][idx + j]) \
-          return 1; \
+      if (classified & virgins[0][idx + j]) \
+        return 1; \
+      if (idx + j - lo < win) \
+        for (size_t i = 1; i < num; ++i) \
+          if (classified & virgins[i][(idx + j - lo) * stride]) \
+            return 1; \
     }
 
     UNROLL(0)
@@ -20,11 +20,14 @@ static char *afl_environment_variables[] = {
     "AFL_ALLOW_TMP",
     "AFL_ANALYZE_HEX",
     "AFL_AS",
+    "AFL_ASYNC_WRITE",
     "AFL_AUTORESUME",
     "AFL_AS_FORCE_INSTRUMENT",
     "AFL_BENCH_JUST_ONE",
     "AFL_BENCH_UNTIL_CRASH",
     "AFL_CAL_FAST",
+    "AFL_CAL_DEFER",
+    "AFL_CAL_ADAPTIVE",
     "AFL_CC",
     "AFL_CC_COMPILER",
     "AFL_CMIN_ALLOW_ANY",
@@ -55,6 +58,7 @@ static char *afl_environment_variables[] = {
     "AFL_EXIT_ON_SEED_ISSUES",
     "AFL_FAST_CAL",
     "AFL_FORCE_UI",
+    "AFL_FRIDA_AFLRUN_DIR",
     "AFL_FRIDA_DEBUG_MAPS",
     "AFL_FRIDA_DRIVER_NO_HOOK",
     "AFL_FRIDA_EXCLUDE_RANGES",
@@ -100,11 +104,14 @@ static char *afl_environment_variables[] = {
     "AFL_GCJ",
     "AFL_HANG_TMOUT",
     "AFL_FORKSRV_INIT_TMOUT",
+    "AFL_FORKSRV_PIPE",
+    "AFL_FSRV_POOL",
     "AFL_HARDEN",
     "AFL_I_DONT_CARE_ABOUT_MISSING_CRASHES",
     "AFL_IGNORE_PROBLEMS",
     "AFL_IGNORE_UNKNOWN_ENVS",
     "AFL_IMPORT_FIRST",
+    "AFL_IMPORT_TRIAGE",
     "AFL_INPUT_LEN_MIN",
     "AFL_INPUT_LEN_MAX",
     "AFL_INST_LIBS",
@@ -116,6 +123,7 @@ static char *afl_environment_variables[] = {
     "AFL_KEEP_ASSEMBLY",
     "AFL_LD_HARD_FAIL",
     "AFL_LD_LIMIT_MB",
+    "AFL_LD_NEAR_TARGETS",
     "AFL_LD_NO_CALLOC_OVER",
     "AFL_LD_PASSTHROUGH",
     "AFL_REAL_LD",
@@ -168,6 +176,8 @@ static char *afl_environment_variables[] = {
     "AFL_NO_CRASH_README",
     "AFL_NO_FORKSRV",
     "AFL_NO_UI",
+    "AFL_NO_UI_LOG_INTERVAL",
+    "AFL_NO_UI_LOG_JSON",
     "AFL_NO_PYTHON",
     "AFL_NO_STARTUP_CALIBRATION",
     "AFL_UNTRACER_FILE",
@@ -182,6 +192,8 @@ static char *afl_environment_variables[] = {
     "AFL_PERFORMANCE_FILE",
     "AFL_PERSISTENT_RECORD",
     "AFL_PRELOAD",
+    "AFL_PROMETHEUS_PORT",
+    "AFL_RECORD_TRACES",
     "AFL_TARGET_ENV",
     "AFL_PYTHON_MODULE",
     "AFL_QEMU_CUSTOM_BIN",
@@ -203,9 +215,13 @@ static char *afl_environment_variables[] = {
     "AFL_QEMU_EXCLUDE_RANGES",
     "AFL_QEMU_SNAPSHOT",
     "AFL_QEMU_TRACK_UNSTABLE",
+    "AFL_QUEUE_SEGMENTS",
     "AFL_QUIET",
     "AFL_RANDOM_ALLOC_CANARY",
     "AFL_REAL_PATH",
+    "AFL_SAN_BINARY",
+    "AFL_SEED_TMOUT",
+    "AFL_SHMEM_DELTA",
     "AFL_SHUFFLE_QUEUE",
     "AFL_SKIP_BIN_CHECK",
     "AFL_SKIP_CPUFREQ",
@@ -215,9 +231,11 @@ static char *afl_environment_variables[] = {
     "AFL_STATSD_HOST",
     "AFL_STATSD_PORT",
     "AFL_STATSD_TAGS_FLAVOR",
+    "AFL_SYNC_INOTIFY",
     "AFL_SYNC_TIME",
     "AFL_TESTCACHE_SIZE",
     "AFL_TESTCACHE_ENTRIES",
+    "AFL_TESTCACHE_MMAP",
     "AFL_TMIN_EXACT",
     "AFL_TMPDIR",
     "AFL_TOKEN_FILE",
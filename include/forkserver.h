@@ -89,6 +89,8 @@ typedef struct afl_forkserver {
   trace_t* trace_virgin;               /* For each newly reached virgin block,
  we record call context and path context, this is useful for fringe testing */
   trace_t* trace_targets;              /* Reached targets in each run       */
+  trace_t* trace_dirty;                /* Reached blocks in each run        */
+  aflrun_cmp_map_t* trace_cmp;         /* Closest compares guarding targets */
 
   s32 fsrv_pid,                         /* PID of the fork server           */
       child_pid,                        /* PID of the fuzzed program        */
@@ -102,6 +104,9 @@ typedef struct afl_forkserver {
       fsrv_ctl_fd,                      /* Fork server control pipe (write) */
       fsrv_st_fd;                       /* Fork server status pipe (read)   */
 
+  u32 st_tmout_ms;                      /* SO_RCVTIMEO of a status socket   */
+  u8  st_socket;                        /* Status pipe is a socket (Linux)  */
+
   u32 exec_tmout;                       /* Configurable exec timeout (ms)   */
   u32 init_tmout;                       /* Configurable init timeout (ms)   */
   u32 map_size;                         /* map size used by the target      */
@@ -150,6 +155,12 @@ typedef struct afl_forkserver {
 
   u8 *shmem_fuzz;                       /* allocated memory for fuzzing     */
 
+  /* If non-zero, `shmem_fuzz` holds the buffer of generation
+     `shmem_fuzz_gen` apart from [shmem_fuzz_lo, shmem_fuzz_hi), see
+     afl_fsrv_write_delta() */
+  u64 shmem_fuzz_gen;
+  u32 shmem_fuzz_lo, shmem_fuzz_hi;
+
   char *cmplog_binary;                  /* the name of the cmplog binary    */
 
   /* persistent mode replay functionality */
@@ -185,6 +196,7 @@ typedef struct afl_forkserver {
   u32                   nyx_id;          /* nyx runner id (0 -> master)      */
   u32                   nyx_bind_cpu_id; /* nyx runner cpu id                */
   char                 *nyx_aux_string;
+  struct aflrun_shm    *nyx_shm_run;     /* AFLRun maps moved to nyx bitmap  */
 #endif
 
   reach_t num_targets,           /* Number of target basic blocks */
@@ -196,6 +208,18 @@ typedef struct afl_forkserver {
 
   u8 testing;
 
+  reach_t *entry_funcs;                 /* 1 + function of each reachable
+                                           block that is its entry, or 0;
+                                           the pass only instruments the
+                                           block then, see Fentries.txt     */
+
+  u8 aflrun_reset;                      /* Runtime resets AFLRun maps if
+                                             resumed in persistent mode     */
+
+  u8 aflrun_level;                      /* AFLRUN_LEVEL_* of the runtime;
+                                           virgin paths are only logged at
+                                           AFLRUN_LEVEL_FULL                */
+
 } afl_forkserver_t;
 
 typedef enum fsrv_run_result {
@@ -211,13 +235,21 @@ typedef enum fsrv_run_result {
 
 void afl_fsrv_init(afl_forkserver_t *fsrv);
 void afl_fsrv_init_dup(afl_forkserver_t *fsrv_to, afl_forkserver_t *from);
+void afl_fsrv_attach_aflrun(afl_forkserver_t *fsrv, struct aflrun_shm *shm,
+                            u8 div_targets);
 void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
                     volatile u8 *stop_soon_p, u8 debug_child_output);
 u32  afl_fsrv_get_mapsize(afl_forkserver_t *fsrv, char **argv,
                           volatile u8 *stop_soon_p, u8 debug_child_output);
 void afl_fsrv_write_to_testcase(afl_forkserver_t *fsrv, u8 *buf, size_t len);
+void afl_fsrv_write_delta(afl_forkserver_t *fsrv, u8 *buf, size_t len, u64 gen,
+                          u32 lo, u32 hi);
 fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
                                       volatile u8 *stop_soon_p);
+void afl_fsrv_start_run(afl_forkserver_t *fsrv, volatile u8 *stop_soon_p);
+fsrv_run_result_t afl_fsrv_finish_run(afl_forkserver_t *fsrv, u32 timeout,
+                                      volatile u8 *stop_soon_p);
+void afl_fsrv_copy_result(afl_forkserver_t *to, afl_forkserver_t *from);
 void              afl_fsrv_killall(void);
 void              afl_fsrv_deinit(afl_forkserver_t *fsrv);
 void              afl_fsrv_kill(afl_forkserver_t *fsrv);
@@ -0,0 +1,95 @@
+#ifndef _HAVE_LIBAFLRUN_H
+#define _HAVE_LIBAFLRUN_H
+
+#include <stdbool.h>
+
+#include "aflrun.h"
+
+/*
+  C ABI of libaflrun.a and libaflrun.so, the AFLRun scheduler built without
+  afl-fuzz (`make libaflrun`), for other engines such as LibAFL executors.
+  The scheduler is driven with the functions of aflrun.h, in the order
+  afl-fuzz uses them:
+
+    aflrun_set_callbacks()                            once, before all others
+    aflrun_load_config(), aflrun_load_image() or
+      aflrun_load_freachables/edges/dists/groups()    from AFLRUN_TMP
+    aflrun_init_groups(), aflrun_init_fringes(),
+      aflrun_init_globals()                           with `afl` of callbacks
+    aflrun_has_new_path()                             for each execution, with
+                                                      the maps of trace.h, or
+    aflrun_has_new_paths()                            for a window of them
+    aflrun_update_fringe_score()                      for each new seed
+    aflrun_cycle_end(), aflrun_cull_queue(),
+      aflrun_assign_energy(),
+      aflrun_set_num_active_seeds()                   at each cycle start,
+                                                      giving favored seeds
+                                                      and energy of each one
+    aflrun_update_fuzzed_quant()                      after fuzzing a seed,
+                                                      then a new cycle starts
+                                                      if aflrun_end_cycle()
+
+  Seeds are identified by consecutive ids from 0; aflrun_has_new_path() is
+  given the id the input gets if it is kept, the number of seeds so far,
+  and the engine must keep it if it returns non-zero. Several instances can
+  be kept in one process with aflrun_ctx_switch(), each driven by its own
+  thread if wanted. The scheduler asks the engine about its seeds through
+  the callbacks below, each given the `afl` pointer passed to
+  aflrun_init_globals(); any of them may be NULL to use the default given
+  next to it. AFLRUN_LIB_ABI is bumped on any incompatible change of this
+  header or of aflrun.h.
+*/
+
+#define AFLRUN_LIB_ABI 2
+
+typedef struct aflrun_callbacks {
+
+  /* Cost of a seed among those covering the same edge, lower is better,
+     e.g. exec_us * len; defaults to 1 */
+  u64 (*seed_fav_factor)(void *afl, u32 seed);
+
+  /* Performance score of a seed, 100 on average; defaults to 100 */
+  double (*seed_perf_score)(void *afl, u32 seed);
+
+  /* If a seed is favored for the diversity maps; defaults to false */
+  bool (*seed_div_favored)(void *afl, u32 seed);
+
+  /* 2 for a favored seed, 0 for a seed only kept for AFLRun (an extra
+     seed of afl-fuzz) and 1 otherwise; defaults to 1 */
+  u8 (*seed_cov_favored)(void *afl, u32 seed);
+
+  /* Merge the top rated map `src` of a cluster into `dst`, see
+     merge_seed_tops() of afl-fuzz; defaults to keeping `dst` */
+  void (*merge_seed_tops)(void *afl, void **dst, void **src);
+
+  /* A seed only kept for AFLRun is no longer needed; defaults to nothing */
+  void (*disable_extra)(void *afl, u32 seed);
+
+  /* Milliseconds of a monotonic clock; defaults to gettimeofday() */
+  u64 (*cur_time)(void);
+
+  /* Calibrated execution time of a seed in microseconds, used with
+     `exec_cost`; defaults to 0 for unknown */
+  u64 (*seed_exec_us)(void *afl, u32 seed);
+
+} aflrun_callbacks_t;
+
+#ifdef __cplusplus
+extern "C" {
+
+#endif
+
+/* AFLRUN_LIB_ABI the library was built with */
+u32 aflrun_lib_abi(void);
+
+/* Copy `cb` to be used by all instances */
+void aflrun_set_callbacks(const aflrun_callbacks_t *cb);
+
+#ifdef __cplusplus
+
+}
+
+#endif
+
+#endif                                              /* !_HAVE_LIBAFLRUN_H */
+
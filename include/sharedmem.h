@@ -57,15 +57,19 @@ typedef struct sharedmem {
 
 } sharedmem_t;
 
+typedef struct aflrun_shm {
+
+  /* All AFLRun maps live in one region, starting with `aflrun_shm_hdr_t` */
 #ifdef USEMMAP
-#error "AFLRun Does not support USEMMAP currently"
+  int  g_shm_fd;
+  char g_shm_file_path[L_tmpnam];
+#else
+  s32 shm_id;
 #endif
 
-typedef struct aflrun_shm {
-
-  /* aflrun id */
-  s32 shm_rbb_id, shm_rf_id, shm_tr_id,
-    shm_vir_id, shm_vtr_id, shm_tt_id, shm_div_id;
+  u8    *map;                                  /* whole AFLRun SHM region */
+  size_t map_size;
+  u8     pages;                      /* AFLRUN_SHM_PAGES_* backing the map */
 
   u8 *map_reachables;          /* SHM to trace reachable BBs */
   u8 *map_freachables;         /* SHM to trace reachable Functions */
@@ -76,13 +80,32 @@ typedef struct aflrun_shm {
   trace_t *map_targets;        /* For each reached targets, we record relative
   information, this is useful for target diversity */
   u8 *div_switch; /* A switch to tell program if we should record diversity */
+  trace_t *map_dirty;          /* Blocks reached in each run, so only their
+  context bits need to be cleared before next run */
+  aflrun_icall_t *map_icalls;  /* Call edges taken by indirect calls, never
+  cleared between runs but consumed by `aflrun_learn_edges` */
+  aflrun_cmp_map_t *map_cmp;   /* Closest compares guarding targets */
+  u8 *map_hits;                /* Runs reaching each diversity block, never
+  cleared between runs but consumed by `aflrun_sample_freq` */
+  u8 *map_mute;                /* Blocks only logged as reached, set by
+  `aflrun_mute_blocks` at each cycle end */
 
 } aflrun_shm_t;
 
+enum {
+
+  /* 00 */ AFLRUN_SHM_PAGES_NORMAL,
+  /* 01 */ AFLRUN_SHM_PAGES_THP,              /* transparent huge pages hinted */
+  /* 02 */ AFLRUN_SHM_PAGES_HUGETLB,           /* allocated from hugetlb pool */
+  /* 03 */ AFLRUN_SHM_PAGES_BORROWED           /* in the Nyx bitmap buffer */
+
+};
+
 u8  *afl_shm_init(sharedmem_t *, size_t, unsigned char non_instrumented_mode);
 void afl_shm_deinit(sharedmem_t *);
 void aflrun_shm_init(aflrun_shm_t*, reach_t, reach_t, unsigned char);
 void aflrun_shm_deinit(aflrun_shm_t*);
+size_t aflrun_shm_borrow(aflrun_shm_t*, u8*, size_t, reach_t, reach_t);
 
 #endif
 
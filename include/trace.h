@@ -1,6 +1,7 @@
 #ifndef _HAVE_TRACE_H
 #define _HAVE_TRACE_H
 
+#include <time.h>
 #ifdef __cplusplus
 #include <atomic>
 using namespace std;
@@ -9,11 +10,56 @@ using namespace std;
 #endif
 
 typedef struct _trace_t {
-#ifdef AFLRUN_OVERHEAD
-  atomic_ullong overhead;
-#endif // AFLRUN_OVERHEAD
+  atomic_ullong overhead; // Sampled `aflrun_ticks` in runtime, see below
   atomic_size_t num;
   ctx_t trace[];
 } trace_t;
 
+/* Cheap timestamp used for profiling AFLRun when AFLRUN_PROFILE is set, in
+   an unspecified unit (i.e. TSC cycles on x86), so fuzzer converts it to time
+   by comparing it with wall clock. The runtime takes it for one of every
+   AFLRUN_PROFILE_PERIOD slow paths of reachable block instrumentation, and
+   adds the elapsed ticks times the period to `overhead` of the virgin path
+   log, which is never reset by the fuzzer. */
+static inline u64 aflrun_ticks(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+  u32 lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((u64)hi << 32) | lo;
+#elif defined(__aarch64__)
+  u64 v;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+
+}
+
+#define AFLRUN_MAX_GOALS 16
+
+/* Instrumentation levels of `aflrun_shm_hdr_t`, read by the runtime at the
+   start of each run. With AFLRUN_LEVEL_BLOCKS, only block and context bits
+   are set, and diversity blocks other than targets are neither logged to
+   `tt` nor counted; the fuzzer also leaves virgin paths unlogged then. */
+#define AFLRUN_LEVEL_FULL 0
+#define AFLRUN_LEVEL_BLOCKS 1
+
+/* Header at the beginning of AFLRun shared memory region, giving offsets of
+   each map from the region start; every map is aligned to AFLRUN_SHM_ALIGN.
+   With `early_exit`, the fuzzer also publishes the `num_goals` blocks that
+   settle what the current seed is fuzzed for: a run that has reached all of
+   them exits at the next reachable block it reaches (0 disarms it). */
+typedef struct aflrun_shm_hdr {
+  u64 size;
+  u64 off_rbb, off_rf, off_tr, off_vir, off_vtr, off_tt, off_div, off_db;
+  u64 off_ic, off_cd, off_hc, off_mute;
+  volatile u32 num_goals;
+  reach_t goals[AFLRUN_MAX_GOALS];
+  volatile u8 level;                             /* AFLRUN_LEVEL_*       */
+} aflrun_shm_hdr_t;
+
 #endif
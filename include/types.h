@@ -62,6 +62,8 @@ typedef uint128_t         u128;
 #define FS_OPT_AUTODICT 0x10000000
 #define FS_OPT_SHDMEM_FUZZ 0x01000000
 #define FS_OPT_NEWCMPLOG 0x02000000
+// persistent runtime resets AFLRun maps itself when resumed
+#define FS_OPT_AFLRUN_RESET 0x04000000
 #define FS_OPT_OLD_AFLPP_WORKAROUND 0x0f000000
 // FS_OPT_MAX_MAPSIZE is 8388608 = 0x800000 = 2^23 = 1 << 23
 #define FS_OPT_MAX_MAPSIZE ((0x00fffffeU >> 1) + 1)
@@ -205,6 +207,22 @@ typedef struct {
   u32 call_ctx;
 } ctx_t;
 
+/* Entry of the log of call edges taken by indirect calls, see `aflrun_icall`
+   of the runtime */
+typedef struct {
+  u64 edge;  /* (calling block + 1) << 32 | entry block of callee, 0 if empty */
+  u32 hash;  /* context hash of the call site, 0 without AFLRUN_CTX */
+  u32 pad;
+} aflrun_icall_t;
+
+/* Compares guarding targets, see `aflrun_cmp` of the runtime: `best` of each
+   target is the most equal bits that any run got in such a compare, kept
+   across runs; a run raising it sets `closer`, cleared before each run */
+typedef struct {
+  volatile u32 closer;
+  u8           best[];  /* indexed by target, sized for all reachables */
+} aflrun_cmp_map_t;
+
 #define IS_SET(arr, i) (((arr)[(i) / 8] & (1 << ((i) % 8))) != 0)
 
 #endif                                                   /* ! _HAVE_TYPES_H */
@@ -14,6 +14,8 @@
 #include <set>
 #include <iostream>
 #include <unordered_set>
+#include <unordered_map>
+#include <limits>
 
 #include "llvm/Transforms/Instrumentation/SanitizerCoverage.h"
 #include "llvm/ADT/ArrayRef.h"
@@ -59,6 +61,7 @@
 #include "config.h"
 #include "debug.h"
 #include "afl-llvm-common.h"
+#include "aflrun-targets.h"
 
 using namespace llvm;
 
@@ -204,6 +207,21 @@ class ModuleSanitizerCoverageLTO
   //  *Section,
   //                                                Type *Ty);
 
+  // Add a token of the autodictionary used by `I`, remembering the
+  // distance of its closest use to AFLRun targets
+  void addToken(const std::string &token, const Instruction *I) {
+
+    dictionary.push_back(token);
+    if (inst_dists.empty()) return;
+    auto  it = inst_dists.find(I);
+    float dist =
+        it == inst_dists.end() ? std::numeric_limits<float>::infinity()
+                               : it->second;
+    auto res = token_dists.emplace(token, dist);
+    if (!res.second && dist < res.first->second) res.first->second = dist;
+
+  }
+
   void SetNoSanitizeMetadata(Instruction *I) {
 
     I->setMetadata(I->getModule()->getMDKindID("nosanitize"),
@@ -247,6 +265,8 @@ class ModuleSanitizerCoverageLTO
   std::vector<BasicBlock *>        BlockList;
   DenseMap<Value *, std::string *> valueMap;
   std::vector<std::string>         dictionary;
+  std::unordered_map<const Instruction *, float> inst_dists;
+  std::unordered_map<std::string, float>         token_dists;
   IntegerType                     *Int8Tyi = NULL;
   IntegerType                     *Int32Tyi = NULL;
   IntegerType                     *Int64Tyi = NULL;
@@ -364,14 +384,17 @@ PreservedAnalyses ModuleSanitizerCoverageLTO::run(Module                &M,
 
 }
 
-std::unordered_map<std::string, double> aflrunParseTargets(std::string targets_file);
 bool aflrunPreprocess(
-  Module &M, const std::unordered_map<std::string, double>& targets,
+  Module &M, const AFLRunTargets& targets,
   size_t& num_rm, char be_quiet, std::string out_directory);
 void aflrunInstrument(
   Module &M, std::string out_directory);
 void aflrunAddGlobals(Module& M,
   reach_t num_targets, reach_t num_reachables, reach_t num_freachables);
+std::unordered_map<const Instruction*, float> aflrunInstDists(
+  Module &M, std::string out_directory);
+std::vector<Function*> aflrunFunctionOrder(
+  Module &M, std::string out_directory, size_t& num_reachable);
 
 
 bool ModuleSanitizerCoverageLTO::instrumentModule(
@@ -389,6 +412,8 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
   BlockList.clear();
   valueMap.clear();
   dictionary.clear();
+  inst_dists.clear();
+  token_dists.clear();
   C = &(M.getContext());
   DL = &M.getDataLayout();
   CurModule = &M;
@@ -421,12 +446,12 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
   Int64Tyi = IntegerType::getInt64Ty(Ctx);
 
   /* Load targets for AFLRun */
-  bool is_aflrun = false;
-  std::unordered_map<std::string, double> targets;
+  bool is_aflrun = false, edge_window = false;
+  AFLRunTargets targets;
 
   char* out_directory = getenv("AFLRUN_TEMP_DIR");
   if (out_directory != NULL) {
-    targets = aflrunParseTargets(getenv("AFLRUN_BB_TARGETS"));
+    targets.load(getenv("AFLRUN_BB_TARGETS"));
     is_aflrun = true;
     std::string temp_dir_path(AFLRUN_TEMP_SIG);
     temp_dir_path += out_directory;
@@ -458,8 +483,11 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
       M, targets, num_rm, be_quiet, out_directory);
     if (has_targets) {
       if (!be_quiet)
-        OKF("Removed = %lu", num_rm);
+        OKF("Redundant target blocks merged: %lu", num_rm);
       aflrunInstrument(M, out_directory);
+      edge_window = getenv("AFLRUN_EDGE_WINDOW") != NULL;
+      if (autodictionary)
+        inst_dists = aflrunInstDists(M, out_directory);
     }
     else {
       if (!be_quiet)
@@ -626,12 +654,12 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
 
                 }
 
-                dictionary.push_back(std::string((char *)&val, len));
+                addToken(std::string((char *)&val, len), &IN);
                 found++;
 
                 if (val2) {
 
-                  dictionary.push_back(std::string((char *)&val2, len));
+                  addToken(std::string((char *)&val2, len), &IN);
                   found++;
 
                 }
@@ -1000,7 +1028,7 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
             if (optLen < MIN_AUTO_EXTRA)  // too short? skip
               continue;
 
-            dictionary.push_back(thestring.substr(0, optLen));
+            addToken(thestring.substr(0, optLen), &IN);
 
           }
 
@@ -1033,8 +1061,34 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
   // SanCovTracePCGuard =
   //    M.getOrInsertFunction(SanCovTracePCGuardName, VoidTy, Int32PtrTy);
 
-  for (auto &F : M)
-    instrumentFunction(F, DTCallback, PDTCallback);
+  if (edge_window) {
+
+    // AFLRun: edges of reachable functions get contiguous ids, and afl-fuzz
+    // sizes the maps of its clusters to them, see EdgeWindow.txt
+    size_t                 num_reachable;
+    std::vector<Function *> order =
+        aflrunFunctionOrder(M, out_directory, num_reachable);
+    uint32_t lo = afl_global_id + 1, hi = lo;
+    for (size_t i = 0; i < order.size(); ++i) {
+
+      if (i == num_reachable) hi = afl_global_id + 1;
+      instrumentFunction(*order[i], DTCallback, PDTCallback);
+
+    }
+
+    if (num_reachable == order.size()) hi = afl_global_id + 1;
+
+    std::ofstream window(std::string(out_directory) + "/EdgeWindow.txt");
+    window << lo << ',' << hi << '\n';
+    if (!be_quiet)
+      OKF("Edges of reachable functions: ids [%u, %u)", lo, hi);
+
+  } else {
+
+    for (auto &F : M)
+      instrumentFunction(F, DTCallback, PDTCallback);
+
+  }
 
   // afl++ START
   if (dFile.is_open()) dFile.close();
@@ -1102,6 +1156,42 @@ bool ModuleSanitizerCoverageLTO::instrumentModule(
       auto last = std::unique(dictionary.begin(), dictionary.end());
       dictionary.erase(last, dictionary.end());
 
+      // for AFLRun, rank tokens by the distance of their closest use to
+      // targets, so the bounded dictionary keeps the ones near the targets
+      if (!token_dists.empty()) {
+
+        std::stable_sort(dictionary.begin(), dictionary.end(),
+                         [&](const std::string &a, const std::string &b) {
+
+                           return token_dists[a] < token_dists[b];
+
+                         });
+
+        size_t dict_max = MAX_AUTO_EXTRAS, total = dictionary.size();
+        float  dict_dist = std::numeric_limits<float>::infinity();
+        if ((ptr = getenv("AFLRUN_DICT_MAX")) != NULL) {
+
+          if (atoi(ptr) <= 0)
+            FATAL("AFLRUN_DICT_MAX value of \"%s\" is invalid\n", ptr);
+          dict_max = atoi(ptr);
+
+        }
+
+        if ((ptr = getenv("AFLRUN_DICT_DIST")) != NULL)
+          if (!((dict_dist = atof(ptr)) >= 0))
+            FATAL("AFLRUN_DICT_DIST value of \"%s\" is invalid\n", ptr);
+
+        while (!dictionary.empty() &&
+               (dictionary.size() > dict_max ||
+                !(token_dists[dictionary.back()] <= dict_dist)))
+          dictionary.pop_back();
+
+        if (!be_quiet)
+          printf("AUTODICTIONARY: kept %lu of %lu strings closest to targets\n",
+                 dictionary.size(), total);
+
+      }
+
       for (auto token : dictionary) {
 
         memlen += token.length();
@@ -1230,6 +1320,30 @@ static bool isFullPostDominator(const BasicBlock        *BB,
 
 }
 
+/* With AFLRUN_FUSED_INST, the head of the AFLRun check of a reachable block
+   always takes the edge counter of the block, whatever pruning says, so the
+   counter update and the test of the block bit form one sequence. The rest
+   of the block after the check (the join of its fast and slow paths) is
+   then not instrumented again. Returns 1 for a head, -1 for such a join. */
+static int isAFLRunFused(const Function &F, const BasicBlock *BB) {
+
+  unsigned fused = F.getParent()->getMDKindID("aflrun.fused");
+  unsigned laf = F.getParent()->getMDKindID("laf");
+  if (BB->getTerminator()->getMetadata(fused)) return 1;
+
+  for (const BasicBlock *PRED : make_range(pred_begin(BB), pred_end(BB))) {
+
+    const BasicBlock *Head = PRED->getSinglePredecessor();
+    if (PRED->getTerminator()->getMetadata(laf) && Head &&
+        Head->getTerminator()->getMetadata(fused))
+      return -1;
+
+  }
+
+  return 0;
+
+}
+
 static bool shouldInstrumentBlock(const Function &F, const BasicBlock *BB,
                                   const DominatorTree            *DT,
                                   const PostDominatorTree        *PDT,
@@ -1239,6 +1353,8 @@ static bool shouldInstrumentBlock(const Function &F, const BasicBlock *BB,
   if (BB->getTerminator()->getMetadata(F.getParent()->getMDKindID("laf")))
     return false;
 
+  if (int fused = isAFLRunFused(F, BB)) return fused > 0;
+
   // Don't insert coverage for blocks containing nothing but unreachable: we
   // will never call __sanitizer_cov() for them, so counting them in
   // NumberOfInstrumentedBlocks() might complicate calculation of code coverage
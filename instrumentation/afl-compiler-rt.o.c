@@ -50,6 +50,7 @@
 #endif
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #if !__GNUC__
   #include "llvm/Config/llvm-config.h"
@@ -124,8 +125,43 @@ trace_t* __afl_tt_ptr_shm = NULL;
 atomic_uchar* __afl_div_ptr = NULL;
 atomic_uchar* __afl_div_ptr_bak = NULL;
 atomic_uchar* __afl_div_ptr_shm = NULL;
+trace_t* __afl_db_ptr = NULL;
+trace_t* __afl_db_ptr_bak = NULL;
+trace_t* __afl_db_ptr_shm = NULL;
+aflrun_icall_t* __afl_ic_ptr = NULL;
+aflrun_icall_t* __afl_ic_ptr_bak = NULL;
+aflrun_icall_t* __afl_ic_ptr_shm = NULL;
+aflrun_cmp_map_t* __afl_cd_ptr = NULL;
+aflrun_cmp_map_t* __afl_cd_ptr_bak = NULL;
+aflrun_cmp_map_t* __afl_cd_ptr_shm = NULL;
+atomic_uchar* __afl_hc_ptr = NULL;
+atomic_uchar* __afl_hc_ptr_bak = NULL;
+atomic_uchar* __afl_hc_ptr_shm = NULL;
+u8* __afl_mute_ptr = NULL;
+u8* __afl_mute_ptr_bak = NULL;
+u8* __afl_mute_ptr_shm = NULL;
+static u8* aflrun_shm_base = NULL;
+static atomic_uint aflrun_goals_hit;
+static u8 aflrun_level = AFLRUN_LEVEL_FULL;
 bool inited = false;
 
+/* Set by aflrun-pass around each indirect call of a reachable block, to the
+   block + 1 in low and context hash of the call in high 32 bits */
+__thread u64 __afl_icall_site;
+
+/* Set by aflrun-pass before each cmplog hook call, to 1 + the reachable
+   block of the call or CMP_BLOCK_UNREACHABLE, see `cmp_map->blocks` */
+__thread u32 __afl_cmp_block;
+
+/* Frames of functions near targets running in this thread, counted by
+   aflrun-pass with AFLRUN_NEAR_DIST and read by libdislocator */
+__thread u32 __afl_near_target;
+
+/* Sampled profiling of AFLRun instrumentation, enabled by AFLRUN_PROFILE,
+   see `aflrun_ticks` in trace.h */
+static bool         aflrun_profile;
+static __thread u32 aflrun_profile_cnt;
+
 u32 __afl_final_loc;
 u32 __afl_map_size = MAP_SIZE;
 u32 __afl_dictionary_len;
@@ -153,6 +189,7 @@ __thread u32 __afl_call_ctx = 0;
 
 static reach_t num_targets, num_reachables, num_freachables;
 extern reach_t __aflrun_num_targets, __aflrun_num_reachables, __aflrun_num_freachables;
+extern const u32 __aflrun_ctx_size_pow2;
 
 struct cmp_map *__afl_cmp_map;
 struct cmp_map *__afl_cmp_map_backup;
@@ -311,8 +348,15 @@ static inline void* my_mmap(size_t size) {
   if (size == 0) return NULL;
   const size_t kPageSize = sysconf(_SC_PAGESIZE);
   size = ((size + kPageSize - 1) / kPageSize) * kPageSize;
-  return mmap(NULL, size,
+  void* ret = mmap(NULL, size,
     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+  // Not MAP_HUGETLB: a write of forked child would copy the whole huge page
+  if (ret != MAP_FAILED && size >= AFLRUN_HUGE_PAGE_SIZE &&
+    !getenv("AFLRUN_NO_HUGEPAGES"))
+    madvise(ret, size, MADV_HUGEPAGE);
+#endif
+  return ret;
 }
 
 static inline void switch_to_shm(void) {
@@ -324,42 +368,35 @@ static inline void switch_to_shm(void) {
   __afl_vtr_ptr = __afl_vtr_ptr_shm;
   __afl_tt_ptr = __afl_tt_ptr_shm;
   __afl_div_ptr = __afl_div_ptr_shm;
+  __afl_db_ptr = __afl_db_ptr_shm;
+  __afl_ic_ptr = __afl_ic_ptr_shm;
+  __afl_cd_ptr = __afl_cd_ptr_shm;
+  __afl_hc_ptr = __afl_hc_ptr_shm;
+  __afl_mute_ptr = __afl_mute_ptr_shm;
+  aflrun_goals_hit = 0;
+  aflrun_level = aflrun_shm_base ?
+    ((aflrun_shm_hdr_t *)aflrun_shm_base)->level : AFLRUN_LEVEL_FULL;
+
+  // Each run starts from the counter of the forkserver, so start sampling
+  // at a different call in each run
+  if (unlikely(aflrun_profile)) aflrun_profile_cnt = aflrun_ticks();
 
   if (!IS_SET(__afl_rbb_ptr, num_reachables)) {
     __afl_vir_ptr = __afl_vir_ptr_bak;
   }
 }
 
-/* SHM setup. */
-
-
-
-static void __afl_map_shm(void) {
+/* Attach AFLRun maps in region `aflrun_base` set up by the fuzzer, or use
+   our private maps if it is NULL. */
 
-  if (__afl_already_initialized_shm) return;
-  __afl_already_initialized_shm = 1;
-
-  // if we are not running in afl ensure the map exists
-  if (!__afl_area_ptr) { __afl_area_ptr = __afl_area_ptr_dummy; }
-
-  char *id_str = getenv(SHM_ENV_VAR);
-  char *rbb_id_str = getenv(SHM_RBB_ENV_VAR);
-  char *rf_id_str = getenv(SHM_RF_ENV_VAR);
-  char *tr_id_str = getenv(SHM_TR_ENV_VAR);
-  char *vir_id_str = getenv(SHM_VIR_ENV_VAR);
-  char *vtr_id_str = getenv(SHM_VTR_ENV_VAR);
-  char *tt_id_str = getenv(SHM_TT_ENV_VAR);
-  char *div_id_str = getenv(SHM_DIV_ENV_VAR);
+static void aflrun_attach(u8 *aflrun_base) {
 
+  // All AFLRun maps are in one region, located by offsets in its header
+  aflrun_shm_base = aflrun_base;
 #define SHMAT_AFLRUN(name) \
-  if (name##_id_str) { \
-    u32 shm_##name##_id = atoi(name##_id_str); \
-    __afl_##name##_ptr_shm = shmat(shm_##name##_id, NULL, 0); \
-    if (__afl_##name##_ptr_shm == (void *)-1) { \
-      send_forkserver_error(FS_ERROR_SHMAT); \
-      perror("shmat for aflrun map"); \
-      _exit(1); \
-    } \
+  if (aflrun_base) { \
+    __afl_##name##_ptr_shm = (void *)(aflrun_base + \
+      ((aflrun_shm_hdr_t *)aflrun_base)->off_##name); \
   } \
   else { \
     __afl_##name##_ptr_shm = __afl_##name##_ptr_bak; \
@@ -372,9 +409,91 @@ static void __afl_map_shm(void) {
   SHMAT_AFLRUN(vtr)
   SHMAT_AFLRUN(tt)
   SHMAT_AFLRUN(div)
+  SHMAT_AFLRUN(db)
+  SHMAT_AFLRUN(ic)
+  SHMAT_AFLRUN(cd)
+  SHMAT_AFLRUN(hc)
+  SHMAT_AFLRUN(mute)
 
 #undef SHMAT_AFLRUN
 
+  // Instrumented code logs first reached blocks to __afl_db_ptr, claim it
+  if (aflrun_base) __afl_db_ptr_shm->num = 0;
+
+}
+
+/* For agents sharing one buffer with the fuzzer instead of our SHM, as the
+   agent of a Nyx guest does with its trace buffer: afl-fuzz moves AFLRun maps
+   to the end of that buffer and stores their offset in its last u64. Attach
+   them and return the size left for the coverage map, or `size` if there are
+   none. Call it once the buffer is shared and before the snapshot is taken,
+   so every restored run uses them; the fuzzer resets them between runs. */
+
+u32 __aflrun_attach_buffer(u8 *buf, u32 size) {
+
+  if (num_reachables == 0 || size < sizeof(u64) + sizeof(aflrun_shm_hdr_t))
+    return size;
+
+  u64 off = *(u64 *)(buf + size - sizeof(u64));
+  if (off == 0 || off > size - sizeof(u64) - sizeof(aflrun_shm_hdr_t) ||
+      ((aflrun_shm_hdr_t *)(buf + off))->size > size - sizeof(u64) - off)
+    return size;
+
+  aflrun_attach(buf + off);
+  switch_to_shm();
+  return off;
+
+}
+
+/* SHM setup. */
+
+
+
+static void __afl_map_shm(void) {
+
+  if (__afl_already_initialized_shm) return;
+  __afl_already_initialized_shm = 1;
+
+  // if we are not running in afl ensure the map exists
+  if (!__afl_area_ptr) { __afl_area_ptr = __afl_area_ptr_dummy; }
+
+  char *id_str = getenv(SHM_ENV_VAR);
+  char *aflrun_id_str = getenv(SHM_AFLRUN_ENV_VAR);
+  u8   *aflrun_base = NULL;
+
+  if (aflrun_id_str) {
+
+#ifdef USEMMAP
+    int         aflrun_fd = shm_open(aflrun_id_str, O_RDWR, DEFAULT_PERMISSION);
+    struct stat aflrun_st;
+    if (aflrun_fd == -1 || fstat(aflrun_fd, &aflrun_st)) {
+
+      send_forkserver_error(FS_ERROR_SHM_OPEN);
+      perror("shm_open for aflrun maps");
+      _exit(1);
+
+    }
+
+    aflrun_base = mmap(0, aflrun_st.st_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, aflrun_fd, 0);
+    close(aflrun_fd);
+    if (aflrun_base == MAP_FAILED) aflrun_base = (void *)-1;
+#else
+    aflrun_base = shmat(atoi(aflrun_id_str), NULL, 0);
+#endif
+
+    if (aflrun_base == (void *)-1) {
+
+      send_forkserver_error(FS_ERROR_SHMAT);
+      perror("shmat for aflrun maps");
+      _exit(1);
+
+    }
+
+  }
+
+  aflrun_attach(aflrun_base);
+
   if (__afl_final_loc) {
 
     __afl_map_size = ++__afl_final_loc;  // as we count starting 0
@@ -848,6 +967,43 @@ void write_error_with_location(char *text, char *filename, int linenumber) {
 }
 
 #ifdef __linux__
+static void aflrun_reset_shm(void);
+
+/* Keep AFLRun maps out of the snapshot, so restoring it does not copy them
+   back: the shared ones are reset by aflrun_reset_shm() after each run, and
+   of the private ones only the virgin map is still written once switched to
+   the shared ones, which leaves it all zeros. */
+
+static void aflrun_snapshot_exclude(void) {
+
+  const size_t page = sysconf(_SC_PAGESIZE);
+#define EXCLUDE_AFLRUN(ptr, size) \
+  if (ptr) { \
+    afl_snapshot_exclude_vmrange((void *)(ptr), \
+      (u8 *)(ptr) + ((size) + page - 1) / page * page); \
+  }
+
+  if (aflrun_shm_base) {
+    EXCLUDE_AFLRUN(aflrun_shm_base,
+      ((aflrun_shm_hdr_t *)aflrun_shm_base)->size)
+  }
+  EXCLUDE_AFLRUN(__afl_rbb_ptr_bak, MAP_RBB_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_rf_ptr_bak, MAP_RF_SIZE(num_freachables))
+  EXCLUDE_AFLRUN(__afl_tr_ptr_bak, MAP_TR_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_vir_ptr_bak, MAP_TR_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_vtr_ptr_bak, MAP_VTR_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_tt_ptr_bak, MAP_VTR_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_div_ptr_bak, MAP_RBB_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_db_ptr_bak, MAP_DB_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_ic_ptr_bak, MAP_IC_SIZE)
+  EXCLUDE_AFLRUN(__afl_cd_ptr_bak, MAP_CD_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_hc_ptr_bak, MAP_HC_SIZE(num_reachables))
+  EXCLUDE_AFLRUN(__afl_mute_ptr_bak, MAP_RBB_SIZE(num_reachables))
+
+#undef EXCLUDE_AFLRUN
+
+}
+
 static void __afl_start_snapshots(void) {
 
   static u8 tmp[4] = {0, 0, 0, 0};
@@ -863,6 +1019,8 @@ static void __afl_start_snapshots(void) {
      assume we're not running in forkserver mode and just execute program. */
 
   status |= (FS_OPT_ENABLED | FS_OPT_SNAPSHOT | FS_OPT_NEWCMPLOG);
+  // Stopped children are restored, not forked, so AFLRun maps need a reset
+  status |= FS_OPT_AFLRUN_RESET;
   if (__afl_sharedmem_fuzzing) { status |= FS_OPT_SHDMEM_FUZZ; }
   if (__afl_map_size <= FS_OPT_MAX_MAPSIZE)
     status |= (FS_OPT_SET_MAPSIZE(__afl_map_size) | FS_OPT_MAPSIZE);
@@ -1022,15 +1180,18 @@ static void __afl_start_snapshots(void) {
         close(FORKSRV_FD);
         close(FORKSRV_FD + 1);
 
+        aflrun_snapshot_exclude();
         if (!afl_snapshot_take(AFL_SNAPSHOT_MMAP | AFL_SNAPSHOT_FDS |
                                AFL_SNAPSHOT_REGS | AFL_SNAPSHOT_EXIT)) {
 
           raise(SIGSTOP);
+          aflrun_reset_shm();
 
         }
 
         __afl_area_ptr[0] = 1;
         memset(__afl_prev_loc, 0, NGRAM_SIZE_MAX * sizeof(PREV_LOC_T));
+        if (!is_persistent) { switch_to_shm(); }
 
         return;
 
@@ -1128,6 +1289,7 @@ static void __afl_start_forkserver(void) {
   }
 
   if (__afl_sharedmem_fuzzing) { status_for_fsrv |= FS_OPT_SHDMEM_FUZZ; }
+  if (is_persistent) { status_for_fsrv |= FS_OPT_AFLRUN_RESET; }
   if (status_for_fsrv) {
 
     status_for_fsrv |= (FS_OPT_ENABLED | FS_OPT_NEWCMPLOG);
@@ -1346,6 +1508,44 @@ static void __afl_start_forkserver(void) {
 
 }
 
+/* When resumed in persistent mode, reset AFLRun maps touched in the last
+   iteration, which are blocks in the dirty log, so the fuzzer does not need
+   to clear the whole maps (see FS_OPT_AFLRUN_RESET). */
+
+static void aflrun_reset_shm(void) {
+
+  trace_t *dirty = __afl_db_ptr_shm;
+  if (!dirty) return;
+
+  u8    *rbb = (u8 *)__afl_rbb_ptr_shm;
+  u8    *tr = (u8 *)__afl_tr_ptr_shm;
+  size_t num = dirty->num;
+  if (likely(num <= num_reachables)) {
+
+    for (size_t i = 0; i < num; ++i) {
+
+      reach_t block = dirty->trace[i].block;
+      rbb[block / 8] &= ~(1 << (block % 8));
+      memset(tr + CTX_NUM_BYTES * block, 0, CTX_NUM_BYTES);
+
+    }
+
+  } else {
+
+    // Keep the bit for counting frequency, which is set by the fuzzer
+    memset(rbb, 0, num_reachables / 8);
+    rbb[num_reachables / 8] &= ~((1 << (num_reachables % 8)) - 1);
+    memset(tr, 0, MAP_TR_SIZE(num_reachables));
+
+  }
+
+  memset((u8 *)__afl_rf_ptr_shm, 0, MAP_RF_SIZE(num_freachables));
+  dirty->num = 0;
+  __afl_vtr_ptr_shm->num = 0;
+  __afl_tt_ptr_shm->num = 0;
+
+}
+
 /* A simplified persistent mode handler, used as explained in
  * README.llvm.md. */
 
@@ -1380,6 +1580,7 @@ int __afl_persistent_loop(unsigned int max_cnt) {
     memset(__afl_prev_loc, 0, NGRAM_SIZE_MAX * sizeof(PREV_LOC_T));
     __afl_selective_coverage_temp = 1;
 
+    aflrun_reset_shm();
     switch_to_shm();
     return 1;
 
@@ -1397,6 +1598,11 @@ int __afl_persistent_loop(unsigned int max_cnt) {
     __afl_vtr_ptr = __afl_vtr_ptr_bak;
     __afl_tt_ptr = __afl_tt_ptr_bak;
     __afl_div_ptr = __afl_div_ptr_bak;
+    __afl_db_ptr = __afl_db_ptr_bak;
+    __afl_ic_ptr = __afl_ic_ptr_bak;
+    __afl_cd_ptr = __afl_cd_ptr_bak;
+    __afl_hc_ptr = __afl_hc_ptr_bak;
+    __afl_mute_ptr = __afl_mute_ptr_bak;
 
     return 0;
 
@@ -1478,6 +1684,18 @@ __attribute__((constructor(EARLY_FS_PRIO))) void __early_forkserver(void) {
 __attribute__((constructor(CTOR_PRIO))) void __afl_auto_early(void) {
 
   is_persistent = !!getenv(PERSIST_ENV_VAR);
+  aflrun_profile = !!getenv("AFLRUN_PROFILE");
+
+  // Map sizes depend on CTX_SIZE_POW2, so it must be same as the pass
+  if (__aflrun_ctx_size_pow2 != CTX_SIZE_POW2) {
+
+    fprintf(stderr,
+            "[-] ERROR: target is instrumented with CTX_SIZE_POW2=%u, but "
+            "runtime is built with %u\n",
+            __aflrun_ctx_size_pow2, CTX_SIZE_POW2);
+    _exit(1);
+
+  }
 
   // if there is no aflrun instrumentation, we can just set them to 1 if NULL
   num_targets = __aflrun_num_targets;
@@ -1491,6 +1709,11 @@ __attribute__((constructor(CTOR_PRIO))) void __afl_auto_early(void) {
   __afl_vtr_ptr_bak = my_mmap(MAP_VTR_SIZE(num_reachables));
   __afl_tt_ptr_bak = my_mmap(MAP_VTR_SIZE(num_reachables));
   __afl_div_ptr_bak = my_mmap(MAP_RBB_SIZE(num_reachables));
+  __afl_db_ptr_bak = my_mmap(MAP_DB_SIZE(num_reachables));
+  __afl_ic_ptr_bak = my_mmap(MAP_IC_SIZE);
+  __afl_cd_ptr_bak = my_mmap(MAP_CD_SIZE(num_reachables));
+  __afl_hc_ptr_bak = my_mmap(MAP_HC_SIZE(num_reachables));
+  __afl_mute_ptr_bak = my_mmap(MAP_RBB_SIZE(num_reachables));
 
   __afl_rbb_ptr = __afl_rbb_ptr_bak;
   __afl_rf_ptr = __afl_rf_ptr_bak;
@@ -1499,6 +1722,11 @@ __attribute__((constructor(CTOR_PRIO))) void __afl_auto_early(void) {
   __afl_vtr_ptr = __afl_vtr_ptr_bak;
   __afl_tt_ptr = __afl_tt_ptr_bak;
   __afl_div_ptr = __afl_div_ptr_bak;
+  __afl_db_ptr = __afl_db_ptr_bak;
+  __afl_ic_ptr = __afl_ic_ptr_bak;
+  __afl_cd_ptr = __afl_cd_ptr_bak;
+  __afl_hc_ptr = __afl_hc_ptr_bak;
+  __afl_mute_ptr = __afl_mute_ptr_bak;
 
   inited = true;
 
@@ -1781,6 +2009,7 @@ void __cmplog_ins_hook1(uint8_t arg1, uint8_t arg2, uint8_t attr) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -1811,6 +2040,7 @@ void __cmplog_ins_hook2(uint16_t arg1, uint16_t arg2, uint8_t attr) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -1849,6 +2079,7 @@ void __cmplog_ins_hook4(uint32_t arg1, uint32_t arg2, uint8_t attr) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -1887,6 +2118,7 @@ void __cmplog_ins_hook8(uint64_t arg1, uint64_t arg2, uint8_t attr) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -1930,6 +2162,7 @@ void __cmplog_ins_hookN(uint128_t arg1, uint128_t arg2, uint8_t attr,
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -1973,6 +2206,7 @@ void __cmplog_ins_hook16(uint128_t arg1, uint128_t arg2, uint8_t attr) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -2079,6 +2313,7 @@ void __sanitizer_cov_trace_switch(uint64_t val, uint64_t *cases) {
     uintptr_t k = (uintptr_t)__builtin_return_address(0) + i;
     k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) &
                     (CMP_MAP_W - 1));
+    __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
     u32 hits;
 
@@ -2172,6 +2407,7 @@ void __cmplog_rtn_hook_strn(u8 *ptr1, u8 *ptr2, u64 len) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -2218,6 +2454,7 @@ void __cmplog_rtn_hook_str(u8 *ptr1, u8 *ptr2) {
 
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -2277,6 +2514,7 @@ void __cmplog_rtn_hook(u8 *ptr1, u8 *ptr2) {
   // fprintf(stderr, "RTN2 %u\n", len);
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -2342,6 +2580,7 @@ void __cmplog_rtn_hook_n(u8 *ptr1, u8 *ptr2, u64 len) {
   // fprintf(stderr, "RTN2 %u\n", l);
   uintptr_t k = (uintptr_t)__builtin_return_address(0);
   k = (uintptr_t)(default_hash((u8 *)&k, sizeof(uintptr_t)) & (CMP_MAP_W - 1));
+  __afl_cmp_map->blocks[k] = __afl_cmp_block;
 
   u32 hits;
 
@@ -2537,35 +2776,97 @@ if (block not executed)
   increment frequency of the block
 */
 
-#ifdef AFLRUN_OVERHEAD
+/* Updates of AFLRun maps and trace logs. When target is single-threaded,
+   `aflrun_inst_st` and `aflrun_f_inst_st` are called by instrumentation
+   instead (i.e. AFLRUN_SINGLE_THREAD is set when compiling), so we don't need
+   locked read-modify-write instructions; `atomic` is always constant.
+   Bits are read before they are set, and only set if not set yet: threads of
+   a target reaching the same blocks and functions then keep the cache lines
+   of the maps shared, instead of taking them from each other for each call
+   of `aflrun_f_inst` and for each new context of a block. */
+
+static inline __attribute__((always_inline)) u8 aflrun_fetch_or(
+    atomic_uchar *p, u8 v, bool atomic) {
 
-u64 aflrun_cur_time(void) {
+  u8 r = atomic_load_explicit(p, memory_order_relaxed);
+  if ((r & v) == v) return r;
+  if (atomic) return atomic_fetch_or(p, v);
+  atomic_store_explicit(p, r | v, memory_order_relaxed);
+  return r;
 
-  struct timeval  tv;
-  struct timezone tz;
+}
 
-  gettimeofday(&tv, &tz);
+static inline __attribute__((always_inline)) u8 aflrun_fetch_and(
+    atomic_uchar *p, u8 v, bool atomic) {
 
-  return tv.tv_sec * 1000ULL * 1000ULL + tv.tv_usec;
+  if (atomic) return atomic_fetch_and(p, v);
+  u8 r = atomic_load_explicit(p, memory_order_relaxed);
+  atomic_store_explicit(p, r & v, memory_order_relaxed);
+  return r;
 
 }
 
-#endif // AFLRUN_OVERHEAD
+// Return NULL if the log is full, but `num` is still increased
+static inline __attribute__((always_inline)) ctx_t *aflrun_append(
+    trace_t *t, size_t cap, bool atomic) {
+
+  size_t n;
+  if (atomic) {
+
+    n = atomic_fetch_add(&t->num, 1);
+
+  } else {
+
+    n = atomic_load_explicit(&t->num, memory_order_relaxed);
+    atomic_store_explicit(&t->num, n + 1, memory_order_relaxed);
+
+  }
+
+  return likely(n < cap) ? t->trace + n : NULL;
+
+}
+
+/* With `early_exit`, count the goals published in the header of the shared
+   region that this run reaches, and exit once it has reached them all and
+   goes on to another reachable block: any crash at the goals has happened by
+   then, and the rest of the run cannot settle more of what the seed is
+   fuzzed for. Persistent targets keep running, as exiting costs a fork. */
+
+static void aflrun_goal_check(reach_t block) {
+
+  const aflrun_shm_hdr_t* hdr = (const aflrun_shm_hdr_t*)aflrun_shm_base;
+  u32 num = hdr->num_goals;
+  if (num == 0 || num > AFLRUN_MAX_GOALS) return;
+
+  for (u32 i = 0; i < num; ++i) {
+    if (hdr->goals[i] == block) {
+      atomic_fetch_add_explicit(&aflrun_goals_hit, 1, memory_order_relaxed);
+      return;
+    }
+  }
+
+  if (atomic_load_explicit(&aflrun_goals_hit, memory_order_relaxed) >= num)
+    _exit(0);
+
+}
+
+/* Slow path of reachable block instrumentation: the pass inlines a test of
+   the `__afl_tr_ptr` bit for current context, and only calls this function
+   when the bit is not set yet in this run, or when we are not inited.
+   If `div` is false, the block is instrumented by `aflrun_inst_nodiv` because
+   target is compiled with AFLRUN_NO_DIVERSITY and it is not a target, so its
+   diversity switch is never needed. */
+
+static inline __attribute__((always_inline)) bool aflrun_inst_impl(
+    u64 block, bool atomic, bool div) {
 
-#ifdef __x86_64__
-bool aflrun_inst(u64 block) __attribute__((visibility("default")));
-bool aflrun_inst(u64 block)
-#else
-bool aflrun_inst(u32 block) __attribute__((visibility("default")));
-bool aflrun_inst(u32 block)
-#endif
-{
   // Handle some functions called before backup memory is initialized
   if (unlikely(!inited)) return false;
 
-#ifdef AFLRUN_OVERHEAD
-  u64 t0 = aflrun_cur_time();
-#endif // AFLRUN_OVERHEAD
+  u64 t0 = 0;
+  if (unlikely(aflrun_profile) &&
+      !(++aflrun_profile_cnt & (AFLRUN_PROFILE_PERIOD - 1)))
+    t0 = aflrun_ticks();
 
   u32 ctx = __afl_call_ctx;
   size_t off = CTX_NUM_BYTES * block + ctx / 8;
@@ -2573,41 +2874,127 @@ bool aflrun_inst(u32 block)
 
 #ifdef AFLRUN_CTX_DIV
   #error "TODO: Currently not supported due to introduction of fringe diversity"
-  atomic_fetch_or(__afl_rbb_ptr + block / 8, 1 << (block % 8));
-  u8 val = atomic_fetch_or(__afl_tr_ptr + off, bit);
+  aflrun_fetch_or(__afl_rbb_ptr + block / 8, 1 << (block % 8), atomic);
+  u8 val = aflrun_fetch_or(__afl_tr_ptr + off, bit, atomic);
 
   // For the first time a context-sensitive target is reached, append it
   if (block < num_targets && (val & bit) == 0) {
-    ctx_t* e = __afl_tt_ptr->trace + atomic_fetch_add(&__afl_tt_ptr->num, 1);
-    e->block = block;
-    e->call_ctx = ctx;
+    ctx_t* e =
+        aflrun_append(__afl_tt_ptr, MAP_VTR_CAP(num_reachables), atomic);
+    if (likely(e)) {
+      e->block = block;
+      e->call_ctx = ctx;
+    }
   }
 #else
   u8 bit2 = 1 << (block % 8);
-  u8 val = atomic_fetch_or(__afl_rbb_ptr + block / 8, bit2);
-  atomic_fetch_or(__afl_tr_ptr + off, bit);
+  u8 val = aflrun_fetch_or(__afl_rbb_ptr + block / 8, bit2, atomic);
+
+  // For the first time a block is reached in this run, log it as dirty;
+  // this and the log below cannot be full since each block is logged once.
+  if ((val & bit2) == 0) {
+    ctx_t* e = aflrun_append(__afl_db_ptr, num_reachables, atomic);
+    if (likely(e)) e->block = block;
+    if (aflrun_shm_base && !is_persistent && __afl_db_ptr == __afl_db_ptr_shm)
+      aflrun_goal_check(block);
+  }
 
-  // For the first time a diversity block is reached, append it
-  bool ret = IS_SET(__afl_div_ptr, block);
-  if (ret && (val & bit2) == 0) {
-    ctx_t* e = __afl_tt_ptr->trace + atomic_fetch_add(&__afl_tt_ptr->num, 1);
-    e->block = block;
+  // A block muted by the fuzzer only needs to be reached, so set bits of all
+  // its contexts for the inlined test to skip it for the rest of the run
+  if (unlikely(IS_SET(__afl_mute_ptr, block))) {
+    memset(__afl_tr_ptr + CTX_NUM_BYTES * block, 255, CTX_NUM_BYTES);
+    if (unlikely(t0)) {
+      atomic_fetch_add_explicit(&__afl_vtr_ptr->overhead,
+        (aflrun_ticks() - t0) * AFLRUN_PROFILE_PERIOD, memory_order_relaxed);
+    }
+    return false;
+  }
+  aflrun_fetch_or(__afl_tr_ptr + off, bit, atomic);
+
+  // For the first time a diversity block is reached, append it, and count
+  // the run until the fuzzer samples it; threads may race and lose a count.
+  // At a lowered level, only targets are still logged.
+  bool ret = div && IS_SET(__afl_div_ptr, block);
+  if (ret && (val & bit2) == 0 &&
+    (likely(aflrun_level == AFLRUN_LEVEL_FULL) || block < num_targets)) {
+    ctx_t* e =
+        aflrun_append(__afl_tt_ptr, MAP_VTR_CAP(num_reachables), atomic);
+    if (likely(e)) e->block = block;
+    u8 hits = atomic_load_explicit(__afl_hc_ptr + block, memory_order_relaxed);
+    if (likely(hits != 255))
+      atomic_store_explicit(__afl_hc_ptr + block, hits + 1,
+        memory_order_relaxed);
   }
 #endif
 
-  val = atomic_fetch_and(__afl_vir_ptr + off, ~bit);
+  // Virgin bits are mostly cleared already, so only write to clear one: each
+  // forked child faults again on pages of the maps, and read faults map the
+  // shared pages around too, while the private map stays on the zero page
+  val = atomic_load_explicit(__afl_vir_ptr + off, memory_order_relaxed);
+  if (val & bit) val = aflrun_fetch_and(__afl_vir_ptr + off, ~bit, atomic);
   if (val & bit) {
-    ctx_t* e = __afl_vtr_ptr->trace + atomic_fetch_add(&__afl_vtr_ptr->num, 1);
-    e->block = block;
-    e->call_ctx = ctx;
+    ctx_t* e =
+        aflrun_append(__afl_vtr_ptr, MAP_VTR_CAP(num_reachables), atomic);
+    if (likely(e)) {
+      e->block = block;
+      e->call_ctx = ctx;
+    } else {
+      // Log is full, so keep it virgin for the fuzzer to find it by scanning
+      aflrun_fetch_or(__afl_vir_ptr + off, bit, atomic);
+    }
   }
 
-#ifdef AFLRUN_OVERHEAD
-  atomic_fetch_add(&__afl_tt_ptr->overhead, aflrun_cur_time() - t0);
-#endif // AFLRUN_OVERHEAD
+  if (unlikely(t0)) {
+    atomic_fetch_add_explicit(&__afl_vtr_ptr->overhead,
+      (aflrun_ticks() - t0) * AFLRUN_PROFILE_PERIOD, memory_order_relaxed);
+  }
   return ret; // Return true for laf
 }
 
+#ifdef __x86_64__
+bool aflrun_inst(u64 block) __attribute__((visibility("default")));
+bool aflrun_inst(u64 block)
+#else
+bool aflrun_inst(u32 block) __attribute__((visibility("default")));
+bool aflrun_inst(u32 block)
+#endif
+{
+  return aflrun_inst_impl(block, true, true);
+}
+
+#ifdef __x86_64__
+bool aflrun_inst_st(u64 block) __attribute__((visibility("default")));
+bool aflrun_inst_st(u64 block)
+#else
+bool aflrun_inst_st(u32 block) __attribute__((visibility("default")));
+bool aflrun_inst_st(u32 block)
+#endif
+{
+  return aflrun_inst_impl(block, false, true);
+}
+
+#ifdef __x86_64__
+bool aflrun_inst_nodiv(u64 block) __attribute__((visibility("default")));
+bool aflrun_inst_nodiv(u64 block)
+#else
+bool aflrun_inst_nodiv(u32 block) __attribute__((visibility("default")));
+bool aflrun_inst_nodiv(u32 block)
+#endif
+{
+  return aflrun_inst_impl(block, true, false);
+}
+
+#ifdef __x86_64__
+bool aflrun_inst_nodiv_st(u64 block) __attribute__((visibility("default")));
+bool aflrun_inst_nodiv_st(u64 block)
+#else
+bool aflrun_inst_nodiv_st(u32 block) __attribute__((visibility("default")));
+bool aflrun_inst_nodiv_st(u32 block)
+#endif
+{
+  return aflrun_inst_impl(block, false, false);
+}
+
 #ifdef __x86_64__
 void aflrun_f_inst(u64 func) __attribute__((visibility("default")));
 void aflrun_f_inst(u64 func)
@@ -2617,5 +3004,63 @@ void aflrun_f_inst(u32 func)
 #endif
 {
   if (unlikely(!inited)) return;
-  atomic_fetch_or(__afl_rf_ptr + func / 8, 1 << (func % 8));
+  aflrun_fetch_or(__afl_rf_ptr + func / 8, 1 << (func % 8), true);
+}
+
+/* Called by aflrun-pass at entry of each reachable function whose address is
+   taken: if it is called by an indirect call of a reachable block, log the
+   call edge, so the fuzzer can learn edges that the pass could not resolve.
+   The log is a hash table where same edge always goes to same entry, so it
+   is only written when a call edge is new or evicts another one. */
+
+#ifdef __x86_64__
+void aflrun_icall(u64 entry) __attribute__((visibility("default")));
+void aflrun_icall(u64 entry)
+#else
+void aflrun_icall(u32 entry) __attribute__((visibility("default")));
+void aflrun_icall(u32 entry)
+#endif
+{
+  u64 site = __afl_icall_site;
+  if (likely(site == 0) || unlikely(!inited)) return;
+  __afl_icall_site = 0;
+
+  u64 edge = (site << 32) | entry;
+  u32 hash = site >> 32;
+  aflrun_icall_t *e = __afl_ic_ptr +
+    ((edge * 0x9E3779B97F4A7C15ULL) >> (64 - AFLRUN_ICALL_LOG_POW2));
+  if (e->edge != edge || e->hash != hash) {
+    e->hash = hash;
+    atomic_store_explicit((atomic_ullong *)&e->edge, edge,
+      memory_order_release);
+  }
+}
+
+/* Called by aflrun-pass with AFLRUN_CMP_DIST before each equality compare of
+   integers in a target or in a block branching to one: it counts the equal
+   bits of the operands, and if no run has got them this close for `target`
+   yet, keeps the count and tells the fuzzer the run is a step towards it.
+   The map is shared by threads without atomics, so a raise may be lost. */
+
+void aflrun_cmp(u32 target, u64 a, u64 b) __attribute__((visibility("default")));
+void aflrun_cmp(u32 target, u64 a, u64 b)
+{
+  if (unlikely(!inited)) return;
+  aflrun_cmp_map_t *cd = __afl_cd_ptr;
+  u8 eq = 65 - __builtin_popcountll(a ^ b);
+  if (likely(eq <= cd->best[target])) return;
+  cd->best[target] = eq;
+  cd->closer = 1;
+}
+
+#ifdef __x86_64__
+void aflrun_f_inst_st(u64 func) __attribute__((visibility("default")));
+void aflrun_f_inst_st(u64 func)
+#else
+void aflrun_f_inst_st(u32 func) __attribute__((visibility("default")));
+void aflrun_f_inst_st(u32 func)
+#endif
+{
+  if (unlikely(!inited)) return;
+  aflrun_fetch_or(__afl_rf_ptr + func / 8, 1 << (func % 8), false);
 }
\ No newline at end of file
@@ -2,9 +2,13 @@
 
 #include "config.h"
 #include "debug.h"
+#include "aflrun-image.h"
+#include "aflrun-targets.h"
+#include "cmplog.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <iostream>
@@ -12,13 +16,23 @@
 #include <string>
 #include <sstream>
 #include <list>
+#include <map>
+#include <set>
+#include <tuple>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <array>
+#include <algorithm>
 #include <queue>
+#include <functional>
 #include <unordered_set>
 #include <unordered_map>
 #include <exception>
 #include <limits>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include "llvm/ADT/Statistic.h"
@@ -30,14 +44,16 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Analysis/CFGPrinter.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/graph_traits.hpp>
-#include <boost/graph/dijkstra_shortest_paths.hpp>
 namespace bo = boost;
 
 #if defined(LLVM34)
@@ -117,6 +133,18 @@ static bool isBlacklisted(const Function *F)
 	return false;
 }
 
+// Runtime functions logging compares to `__afl_cmp_map` for cmplog
+static bool isCmplogHook(const Function *F)
+{
+	if (F == nullptr)
+		return false;
+	StringRef name = F->getName();
+	return name.startswith("__cmplog_") ||
+		name.startswith("__sanitizer_cov_trace_cmp") ||
+		name.startswith("__sanitizer_cov_trace_const_cmp") ||
+		name == "__sanitizer_cov_trace_switch";
+}
+
 static void parseReachableHeader(const char* line,
 	reach_t* num_targets, reach_t* num_reachables)
 {
@@ -197,6 +225,47 @@ static void parseReachables(
 	reachablefile.close();
 }
 
+// Read `aflrun.bin` written by `aflrunPreprocess`
+static std::vector<char> readImage(
+	const std::string& temp_path, reach_t num_reachables)
+{
+	std::ifstream fd(temp_path + "/" AFLRUN_IMAGE_NAME, std::ios::binary);
+	if (!fd.is_open())
+		FATAL("Cannot open " AFLRUN_IMAGE_NAME);
+	std::vector<char> buf((std::istreambuf_iterator<char>(fd)),
+		std::istreambuf_iterator<char>());
+
+	const auto* img = reinterpret_cast<const aflrun_image_t*>(buf.data());
+	if (buf.size() < sizeof(aflrun_image_t) ||
+		img->magic != AFLRUN_IMAGE_MAGIC ||
+		img->version != AFLRUN_IMAGE_VERSION || img->size != buf.size() ||
+		img->num_reachables != num_reachables)
+		FATAL(AFLRUN_IMAGE_NAME " is corrupted");
+	return buf;
+}
+
+// Minimum distance of each reachable block to any target, and radius of
+// context sensitivity, as written by `aflrunPreprocess` into the image
+static std::vector<float> loadMinDists(
+	const std::string& temp_path, reach_t num_reachables, double& ctx_radius)
+{
+	std::vector<char> buf = readImage(temp_path, num_reachables);
+	const auto* img = reinterpret_cast<const aflrun_image_t*>(buf.data());
+
+	const u64* index = AFLRUN_IMAGE_AT(img, off_dists_index, const u64);
+	const aflrun_dist_t* rows =
+		AFLRUN_IMAGE_AT(img, off_dists, const aflrun_dist_t);
+	std::vector<float> ret(num_reachables,
+		std::numeric_limits<float>::infinity());
+	for (reach_t bb = 0; bb < num_reachables; ++bb)
+	{
+		for (u64 i = index[bb]; i < index[bb + 1]; ++i)
+			ret[bb] = std::min(ret[bb], rows[i].dist);
+	}
+	ctx_radius = img->ctx_radius;
+	return ret;
+}
+
 static std::unordered_set<BasicBlock*> getOriginalBlocks(Module &M, Function& F)
 {
 	if (F.begin() == F.end())
@@ -274,7 +343,6 @@ static BlockOriData getBlockOriginalData(Module &M, BasicBlock* BB,
 	return make_pair(std::move(instructions), std::move(successors));
 }
 
-/* remove warning, TODO: re-enable target filtering
 static bool isUnreachableBlock(Module& M, BasicBlock& BB)
 {
 	auto* Term = BB.getTerminator();
@@ -325,7 +393,6 @@ static std::unordered_map<BasicBlock*, Instruction*> replaceBr(
 
 	return ret;
 }
-*/
 
 // Get name of basic block,
 static std::string getBlockName(Module &M, const BlockOriData& data)
@@ -352,12 +419,12 @@ static std::string getBlockName(Module &M, const BlockOriData& data)
 	return "none";
 }
 
-// Return all targets covered by block; if empty, the block is not target
-static std::unordered_set<std::string> getBlockTargets(const BlockOriData& data,
-	const std::unordered_map<std::string, double>& targets)
+// Return keys of all targets covered by block; if empty, it is not target
+static std::unordered_set<u64> getBlockTargets(const BlockOriData& data,
+	const AFLRunTargets& targets)
 {
 	std::unordered_set<Instruction*> visited;
-	std::unordered_set<std::string> ret;
+	std::unordered_set<u64> ret;
 	for (auto* I : data.first)
 	{
 		if (visited.find(I) != visited.end())
@@ -374,71 +441,140 @@ static std::unordered_set<std::string> getBlockTargets(const BlockOriData& data,
 			!filename.compare(0, Xlibs.size(), Xlibs))
 			continue;
 
-		std::size_t found = filename.find_last_of("/\\");
-		if (found != std::string::npos)
-			filename = filename.substr(found + 1);
+		StringRef base(filename);
+		std::size_t found = base.find_last_of("/\\");
+		if (found != StringRef::npos)
+			base = base.substr(found + 1);
 
-		std::string location(filename + ":" + std::to_string(line));
-		if (targets.find(location) != targets.end())
-			ret.insert(location);
+		u32 file = targets.file_id(base);
+		if (targets.has(file, line))
+			ret.insert(AFLRunTargets::key(file, line));
 	}
 
 	return ret;
 }
 
 // Given a function, we process it with respect to target information.
+// What preprocessing needs of an original block, taken from the IR before
+// anything is changed, so that functions can be analyzed in parallel
+struct OriBlock
+{
+	BasicBlock* BB;
+	std::string loc; // "file:line", see `getBlockName`
+	std::unordered_set<u64> targets; // see `AFLRunTargets::key`
+	std::vector<BasicBlock*> succs;
+	std::vector<Function*> callees; // direct calls
+	std::vector<FunctionType*> icalls; // function types of indirect calls
+};
+
+static std::vector<OriBlock> analyzeFunction(Module &M, Function& F,
+	const AFLRunTargets& targets)
+{
+	std::vector<OriBlock> ret;
+	// Follow order of blocks in function, so that same IR gets same ids
+	auto BBs = getOriginalBlocks(M, F);
+	for (auto& BBRef : F)
+	{
+		auto* BB = &BBRef;
+		if (BBs.find(BB) == BBs.end())
+			continue;
+		auto data = getBlockOriginalData(M, BB);
+		OriBlock b;
+		b.BB = BB;
+		b.loc = getBlockName(M, data);
+		b.targets = getBlockTargets(data, targets);
+		b.succs.assign(data.second.begin(), data.second.end());
+		for (auto* I : data.first)
+		{
+			auto *c = dyn_cast<CallInst>(I);
+			if (c == nullptr)
+				continue;
+			if (auto *CalledF = c->getCalledFunction())
+				b.callees.push_back(CalledF);
+			else if (!c->isInlineAsm())
+				b.icalls.push_back(c->getFunctionType());
+		}
+		ret.push_back(std::move(b));
+	}
+	return ret;
+}
+
+// Analyze the given functions in parallel; this only reads the IR,
+// and results are in order of `funcs` like analyzing them sequentially.
+static std::vector<std::vector<OriBlock>> analyzeFunctions(Module &M,
+	const std::vector<Function*>& funcs,
+	const AFLRunTargets& targets)
+{
+	// Register the kind first, so that threads only look it up
+	M.getMDKindID("keybranch");
+
+	std::vector<std::vector<OriBlock>> ret(funcs.size());
+	std::atomic<size_t> next_func(0);
+	auto analyze = [&]()
+	{
+		for (size_t i; (i = next_func.fetch_add(1)) < funcs.size();)
+			ret[i] = analyzeFunction(M, *funcs[i], targets);
+	};
+	size_t num_threads = std::min<size_t>(
+		std::max(std::thread::hardware_concurrency(), 1u), funcs.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < num_threads; ++i)
+		workers.emplace_back(analyze);
+	analyze();
+	for (auto& w : workers)
+		w.join();
+	return ret;
+}
+
 // Result:
 //	Name for each basic block is stored in `bb_to_name`;
-//	all target blocks are stored in `target_blocks`.
-static void processTargets(Module &M, Function& F, size_t& next_bb,
-	const std::unordered_map<std::string, double>& targets,
-	std::unordered_map<BasicBlock*, std::string>& bb_to_name,
+//	all target blocks are stored in `target_blocks`,
+//	whose target strings are moved out of `blocks`.
+static void processTargets(Function& F, std::vector<OriBlock>& blocks,
+	size_t& next_bb, std::unordered_map<BasicBlock*, std::string>& bb_to_name,
 	std::unordered_map<BasicBlock*,
-		std::unordered_set<std::string>>& target_blocks,
+		std::unordered_set<u64>>& target_blocks,
 	size_t& num_rm, std::vector<std::string>& id_to_name)
 {
 	if (F.begin() == F.end())
 		return;
 
-	auto BBs = getOriginalBlocks(M, F);
-
-	for (auto* BB : BBs)
+	for (auto& b : blocks)
 	{
-		auto data = getBlockOriginalData(M, BB);
-		std::string bb_name = getBlockName(M, data);
+		if (!b.targets.empty())
+			target_blocks.emplace(b.BB, std::move(b.targets));
 
-		auto res = getBlockTargets(data, targets);
-		if (!res.empty())
-			target_blocks.emplace(BB, std::move(res));
-
-		auto name = std::to_string(next_bb++) + ':' + bb_name;
-		bb_to_name.emplace(BB, name);
+		auto name = std::to_string(next_bb++) + ':' + b.loc;
+		bb_to_name.emplace(b.BB, name);
 		id_to_name.push_back(std::move(name));
 	}
 
-	/* TODO: filter out redundant targets, and sum the weights of removed ones
-	auto bak = replaceBr(M, F);
+	// Filter out redundant targets: a target block that dominates another
+	// one post-dominating it is executed iff that one is, so we only keep the
+	// latter, which gets the targets and thus the weights of removed ones.
+	// Branches to sanitizer reports are ignored, since they end the program.
+	if (target_blocks.size() < 2 || getenv("AFLRUN_NO_MERGE_TARGETS") != NULL)
+		return;
+	auto bak = replaceBr(*F.getParent(), F);
 	DominatorTree Dom(F);
 	PostDominatorTree PostDom(F);
 
 	std::unordered_set<BasicBlock*> to_remove;
-	for (auto& bw0 : target_blocks)
+	for (auto& bt0 : target_blocks)
 	{
-		auto* BB0 = p0.first;
-		if (to_remove.find(BB0) != to_remove.end())
-			continue;
-		for (auto& bw1 : target_blocks)
+		auto* BB0 = bt0.first;
+		for (auto& bt1 : target_blocks)
 		{
-			auto* BB1 = p1.first;
-			if (BB0 == BB1)
+			auto* BB1 = bt1.first;
+			if (BB0 == BB1 || to_remove.find(BB1) != to_remove.end())
 				continue;
 			if (Dom.dominates(BB0, BB1) && PostDom.dominates(BB1, BB0))
 			{
+				// Both relations are transitive, so a chain of such blocks
+				// ends up in its last one whatever the order is
 				to_remove.insert(BB0);
 				++num_rm;
-
-				// weight of block to remove is accumutated
-				bw1.second += bw0.second;
+				bt1.second.insert(bt0.second.begin(), bt0.second.end());
 				break;
 			}
 		}
@@ -448,7 +584,7 @@ static void processTargets(Module &M, Function& F, size_t& next_bb,
 
 	// Resume the function
 	for (const auto& iter : bak)
-		ReplaceInstWithInst(iter.first->getTerminator(), iter.second);//*/
+		ReplaceInstWithInst(iter.first->getTerminator(), iter.second);
 }
 
 static Vertex getBlockId(BasicBlock& BB)
@@ -461,44 +597,95 @@ static Vertex getBlockId(BasicBlock& BB)
 	return strtoul(bb_name.c_str(), NULL, 10);
 }
 
-// parse the CFG from module used for boost graph,
-// note that the edge is inverse, because we want to start dijktra from targets
-static void getGraph(Module& M, std::vector<Edge>& edges,
-	std::vector<Weight>& weights)
+#ifdef AFLRUN_CTX
+// Whether the context needs to be updated around a call of `CalledF`;
+// if callee cannot reach any reachable block, nobody reads the context.
+static bool callNeedsCtx(const Function* CalledF, const TargetLibraryInfo& TLI,
+	const std::unordered_map<Vertex, u32>& bb_to_idx)
+{
+	if (CalledF == nullptr)
+		return true; // Indirect call
+	// A reachable function must have its entry block reachable,
+	// because call edges are included when computing reachable blocks.
+	if (CalledF->begin() != CalledF->end())
+		return bb_to_idx.count(getBlockId(
+			const_cast<Function*>(CalledF)->getEntryBlock())) != 0;
+	// External library functions never call back into target, except qsort
+	LibFunc LF;
+	if (CalledF->hasFnAttribute(Attribute::NoCallback))
+		return false;
+	if (TLI.getLibFunc(*CalledF, LF))
+		return LF == LibFunc_qsort;
+	return true;
+}
+#endif
+
+// Entry blocks of functions that indirect calls of each function type may
+// call: those defined and address taken, as the module is whole program.
+static std::unordered_map<FunctionType*, std::vector<Vertex>>
+	getIndirectCallees(Module& M)
 {
+	std::unordered_map<FunctionType*, std::vector<Vertex>> ret;
+	if (getenv("AFLRUN_NO_ICALL") != NULL)
+		return ret;
 	for (auto& F : M)
 	{
-		if (isBlacklisted(&F))
+		if (isBlacklisted(&F) || F.begin() == F.end() || !F.hasAddressTaken())
 			continue;
+		ret[F.getFunctionType()].push_back(getBlockId(F.getEntryBlock()));
+	}
+	for (auto it = ret.begin(); it != ret.end();)
+	{ // Too many candidates tell nothing about where the call goes
+		if (it->second.size() > AFLRUN_ICALL_MAX_CALLEES)
+			it = ret.erase(it);
+		else
+			++it;
+	}
+	return ret;
+}
 
-		auto BBs = getOriginalBlocks(M, F);
-
-		for (auto* BB : BBs)
+// parse the CFG from module used for boost graph,
+// note that the edge is inverse, because we want to start dijktra from targets
+static void getGraph(Module& M,
+	const std::vector<std::vector<OriBlock>>& blocks,
+	std::vector<Edge>& edges, std::vector<Weight>& weights)
+{
+	auto icallees = getIndirectCallees(M);
+	for (const auto& func_blocks : blocks)
+	{
+		for (const auto& b : func_blocks)
 		{
-			Vertex u = getBlockId(*BB);
+			Vertex u = getBlockId(*b.BB);
 
-			auto p = getBlockOriginalData(M, BB);
+			for (auto* CalledF : b.callees)
+			{
+				if (!isBlacklisted(CalledF) &&
+					CalledF->begin() != CalledF->end())
+				{
+					// link caller BB to entry BB of callee with weight 0
+					edges.emplace_back(
+						getBlockId(CalledF->getEntryBlock()), u);
+					weights.push_back(0);
+				}
+			}
 
-			for (auto* I : p.first)
+			for (auto* FT : b.icalls)
 			{
-				if (auto *c = dyn_cast<CallInst>(I))
+				// link caller BB to entry BB of each function of the
+				// same type, weighted like branches to `n` successors
+				auto it = icallees.find(FT);
+				if (it == icallees.end())
+					continue;
+				double w = log2(it->second.size());
+				for (Vertex v : it->second)
 				{
-					if (auto *CalledF = c->getCalledFunction())
-					{
-						if (!isBlacklisted(CalledF) &&
-							CalledF->begin() != CalledF->end())
-						{
-							// link caller BB to entry BB of callee with weight 0
-							edges.emplace_back(
-								getBlockId(CalledF->getEntryBlock()), u);
-							weights.push_back(0);
-						}
-					}
+					edges.emplace_back(v, u);
+					weights.push_back(w);
 				}
 			}
 
-			double w = log2(p.second.size());
-			for (auto* Succ : p.second)
+			double w = log2(b.succs.size());
+			for (auto* Succ : b.succs)
 			{
 				edges.emplace_back(getBlockId(*Succ), u);
 				weights.push_back(w);
@@ -507,28 +694,70 @@ static void getGraph(Module& M, std::vector<Edge>& edges,
 	}
 }
 
-std::unordered_map<std::string, double> aflrunParseTargets(std::string targets_file)
+void AFLRunTargets::load(const char* path)
 {
-	std::unordered_map<std::string, double> targets;
-	std::ifstream targetsfile(targets_file); assert(targetsfile.is_open());
-	std::string line;
-	while (std::getline(targetsfile, line))
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		PFATAL("Unable to open '%s'", path);
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		PFATAL("Unable to stat '%s'", path);
+	size_t size = st.st_size;
+	const char* buf = static_cast<const char*>(size == 0 ? nullptr :
+		mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+	if (buf == MAP_FAILED)
+		PFATAL("Unable to mmap '%s'", path);
+	close(fd);
+
+	const char* end = buf + size;
+	size_t line_no = 0;
+	for (const char* p = buf; p < end;)
 	{
+		const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (eol == nullptr)
+			eol = end;
+		StringRef line(p, eol - p);
+		p = eol + 1;
+		++line_no;
+
+		line = line.rtrim("\r");
+		if (line.empty())
+			continue;
 		std::size_t found = line.find_last_of("/\\");
-		if (found != std::string::npos)
+		if (found != StringRef::npos)
 			line = line.substr(found + 1);
+
+		double w = 1; // Default weight is 1
 		found = line.find_last_of('|');
-		if (found != std::string::npos)
+		if (found != StringRef::npos)
 		{
-			double w = std::stod(line.substr(found + 1));
-			assert(w >= 0 && !std::isinf(w));
-			targets.emplace(line.substr(0, found), w);
+			std::string ws = line.substr(found + 1).str();
+			char* w_end;
+			w = strtod(ws.c_str(), &w_end);
+			if (ws.empty() || *w_end != 0 || !(w >= 0) || std::isinf(w))
+				FATAL("Invalid weight at %s:%lu", path, line_no);
+			line = line.substr(0, found);
 		}
-		else
-			targets.emplace(line, 1); // Default weight is 1
+
+		found = line.find_last_of(':');
+		unsigned l;
+		if (found == StringRef::npos || found == 0 ||
+			line.substr(found + 1).getAsInteger(10, l) || l == 0)
+			FATAL("Invalid target at %s:%lu, expect 'file:line'",
+				path, line_no);
+
+		auto it = file_ids.try_emplace(line.substr(0, found), files.size());
+		if (it.second)
+		{
+			files.push_back(line.substr(0, found).str());
+			lines.emplace_back();
+		}
+		if (lines[it.first->second].emplace(l, w).second)
+			++num;
 	}
-	targetsfile.close();
-	return targets;
+
+	if (size != 0)
+		munmap(const_cast<char*>(buf), size);
 }
 
 void aflrunAddGlobals(Module& M,
@@ -544,10 +773,780 @@ void aflrunAddGlobals(Module& M,
 		ConstantInt::get(ReachTy, num_reachables), "__aflrun_num_reachables");
 	new GlobalVariable(M, ReachTy, true, GlobalValue::ExternalLinkage,
 		ConstantInt::get(ReachTy, num_freachables), "__aflrun_num_freachables");
+	// Also compile CTX_SIZE_POW2, so runtime can check it uses the same value.
+	IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
+	new GlobalVariable(M, Int32Ty, true, GlobalValue::ExternalLinkage,
+		ConstantInt::get(Int32Ty, CTX_SIZE_POW2), "__aflrun_ctx_size_pow2");
+	// Mark binary without diversity switches for non-target blocks,
+	// so afl-fuzz can detect it and disable fringe diversity.
+	if (getenv("AFLRUN_NO_DIVERSITY") != NULL)
+	{
+		std::string sig(AFLRUN_NO_DIV_SIG);
+		new GlobalVariable(M, ArrayType::get(IntegerType::getInt8Ty(C),
+			sig.size() + 1), true, GlobalValue::ExternalLinkage,
+			ConstantDataArray::getString(C, sig), "__aflrun_no_diversity_sig");
+	}
+}
+
+namespace
+{
+	// Sections of `aflrun.bin`, each aligned to 8 bytes
+	class ImageBuilder
+	{
+		std::vector<char> buf;
+	public:
+		ImageBuilder() : buf(sizeof(aflrun_image_t), 0) {}
+		explicit ImageBuilder(std::vector<char> image) : buf(std::move(image)) {}
+
+		template <typename T>
+		u64 append(const T* data, size_t num)
+		{
+			buf.resize((buf.size() + 7) & ~static_cast<size_t>(7), 0);
+			u64 off = buf.size();
+			const char* p = reinterpret_cast<const char*>(data);
+			buf.insert(buf.end(), p, p + num * sizeof(T));
+			return off;
+		}
+
+		aflrun_image_t* header()
+		{
+			return reinterpret_cast<aflrun_image_t*>(buf.data());
+		}
+
+		void write(const std::string& path)
+		{
+			buf.resize((buf.size() + 7) & ~static_cast<size_t>(7), 0);
+			header()->size = buf.size();
+			std::ofstream out(path, std::ofstream::out | std::ofstream::binary);
+			out.write(buf.data(), buf.size());
+			if (!out)
+				FATAL("Could not write %s.", path.c_str());
+		}
+
+		const std::vector<char>& data() const { return buf; }
+	};
+
+	// Block and target of each distance, in the order Dijkstra discovers them
+	struct BlockDist
+	{
+		Vertex block;
+		reach_t target;
+		float dist;
+	};
+}
+
+void aflrunWriteImage(const std::string& path,
+	reach_t num_targets, const std::vector<double>& target_weights,
+	const std::vector<Vertex>& bb_reachable,
+	const std::unordered_map<Vertex, std::unordered_set<reach_t>>& bb_reachable_map,
+	const std::unordered_map<Vertex, reach_t>& bb_reachable_inv,
+	const std::vector<Edge>& reachable_edges,
+	const std::vector<BlockDist>& block_dists,
+	const std::vector<std::string>& id_to_name,
+	size_t num_f_targets, const std::vector<Vertex>& f_reachable,
+	const std::unordered_map<Vertex, std::string>& id_to_fname,
+	const std::vector<reach_t>& f_entries, double ctx_radius,
+	const std::vector<reach_t>& target_groups)
+{
+	const size_t num_reachables = bb_reachable.size();
+	ImageBuilder img;
+
+	std::vector<u64> index(num_reachables + 1);
+	std::vector<reach_t> targets;
+	for (size_t i = 0; i < num_reachables; ++i)
+	{
+		index[i] = targets.size();
+		const auto& ts = bb_reachable_map.find(bb_reachable[i])->second;
+		targets.insert(targets.end(), ts.begin(), ts.end());
+	}
+	index[num_reachables] = targets.size();
+	u64 off_target_weights = img.append(target_weights.data(), num_targets);
+	u64 off_targets_index = img.append(index.data(), index.size());
+	u64 off_targets = img.append(targets.data(), targets.size());
+
+	// Successors of each reachable block, sorted and without duplication
+	std::vector<std::vector<reach_t>> succs(num_reachables);
+	for (const Edge& e : reachable_edges)
+	{
+		auto src = bb_reachable_inv.find(e.first);
+		if (src == bb_reachable_inv.end())
+			continue;
+		succs[src->second].push_back(bb_reachable_inv.find(e.second)->second);
+	}
+	std::vector<reach_t> edges;
+	for (size_t i = 0; i < num_reachables; ++i)
+	{
+		auto& s = succs[i];
+		std::sort(s.begin(), s.end());
+		s.erase(std::unique(s.begin(), s.end()), s.end());
+		index[i] = edges.size();
+		edges.insert(edges.end(), s.begin(), s.end());
+	}
+	index[num_reachables] = edges.size();
+	u64 off_edges_index = img.append(index.data(), index.size());
+	u64 off_edges = img.append(edges.data(), edges.size());
+
+	// Counting sort by block is stable, so each row stays sorted by target
+	std::fill(index.begin(), index.end(), 0);
+	for (const BlockDist& bd : block_dists)
+		++index[bb_reachable_inv.find(bd.block)->second + 1];
+	for (size_t i = 0; i < num_reachables; ++i)
+		index[i + 1] += index[i];
+	std::vector<aflrun_dist_t> dists(block_dists.size());
+	std::vector<u64> next(index.begin(), index.end() - 1);
+	for (const BlockDist& bd : block_dists)
+	{
+		aflrun_dist_t& d = dists[next[bb_reachable_inv.find(bd.block)->second]++];
+		d.target = bd.target; d.dist = bd.dist;
+	}
+	u64 off_dists_index = img.append(index.data(), index.size());
+	u64 off_dists = img.append(dists.data(), dists.size());
+
+	u64 off_fentries = img.append(f_entries.data(), f_entries.size());
+	u64 off_target_groups =
+		img.append(target_groups.data(), target_groups.size());
+
+	// Name pool goes last, so that it ends with NUL before call hashes
+	std::string names;
+	std::vector<u64> name_offs, fname_offs;
+	for (Vertex bb : bb_reachable)
+	{
+		name_offs.push_back(names.size());
+		names += id_to_name[bb]; names.push_back(0);
+	}
+	for (Vertex f : f_reachable)
+	{
+		fname_offs.push_back(names.size());
+		names += id_to_fname.find(f)->second; names.push_back(0);
+	}
+	u64 off_names_index = img.append(name_offs.data(), name_offs.size());
+	u64 off_fnames_index = img.append(fname_offs.data(), fname_offs.size());
+	u64 off_names = img.append(names.data(), names.size());
+
+	aflrun_image_t* h = img.header();
+	h->magic = AFLRUN_IMAGE_MAGIC;
+	h->version = AFLRUN_IMAGE_VERSION;
+	h->ctx_size_pow2 = CTX_SIZE_POW2;
+	h->num_targets = num_targets;
+	h->num_reachables = num_reachables;
+	h->num_ftargets = num_f_targets;
+	h->num_freachables = f_reachable.size();
+	h->off_target_weights = off_target_weights;
+	h->off_targets_index = off_targets_index;
+	h->off_targets = off_targets;
+	h->off_edges_index = off_edges_index;
+	h->off_edges = off_edges;
+	h->off_dists_index = off_dists_index;
+	h->off_dists = off_dists;
+	h->off_names_index = off_names_index;
+	h->off_fnames_index = off_fnames_index;
+	h->off_names = off_names;
+	h->off_fentries = off_fentries;
+	h->ctx_radius = ctx_radius;
+	h->off_target_groups = off_target_groups;
+	img.write(path);
+}
+
+namespace
+{
+	// Cached distances of a function: targets are referred to by key of
+	// their functions and index of their blocks in those functions.
+	struct CacheHeader
+	{
+		u64 magic;
+		u32 num_refs;
+		u32 num_rows;
+	};
+	struct CacheRef
+	{
+		u64 func;
+		u32 block;
+		u32 pad;
+	};
+	struct CacheRow
+	{
+		u32 block; // index of block in function
+		u32 ref; // index of target in references of the file
+		float dist;
+	};
+	constexpr u64 kCacheMagic = 0x314344524C4641ULL; // "AFLRDC1"
+
+	// Distances from a block only depend on blocks it can reach, which are
+	// those of its function and of functions it calls transitively. So the
+	// distances of each function are cached in `$AFLRUN_TMP/.aflrun-cache/`,
+	// keyed by a hash of these blocks, their edges and the targets among them.
+	// A link then only searches functions not found in cache, starting from
+	// cached distances of functions they call. This saves most of the work
+	// when rebuilding a program after editing some of its functions or
+	// targets, and when linking programs sharing libraries (AFLRUN_TARGETS).
+	class DistCache
+	{
+		std::string dir; // empty if disabled
+		const std::vector<Vertex>& func_first; // first block of each function
+		std::vector<u32> vertex_func;
+		std::vector<u64> keys;
+		std::vector<bool> dup; // functions whose keys are not unique
+		std::vector<std::vector<u32>> calls;
+		std::vector<Edge> cross_edges; // from caller blocks to callee blocks
+
+		std::vector<bool> hit, done, border;
+		// References of targets, if they are unique
+		std::map<std::pair<u64, u32>, reach_t> target_of;
+		std::vector<std::pair<u64, u32>> target_refs;
+		std::vector<bool> target_ok;
+		std::vector<std::vector<std::pair<Vertex, float>>> known;
+		size_t num_hits = 0, num_funcs = 0;
+
+		size_t numBlocks(u32 f) const
+		{
+			return func_first[f + 1] - func_first[f];
+		}
+		std::string path(u32 f) const
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "/%016llx.bin",
+				(unsigned long long)keys[f]);
+			return dir + name;
+		}
+		bool read(u32 f,
+			std::vector<std::pair<reach_t, std::pair<Vertex, float>>>& ret) const;
+		void write(u32 f, const std::vector<std::pair<reach_t, CacheRow>>& rows);
+
+	public:
+		DistCache(const std::vector<Function*>& funcs,
+			const std::vector<Vertex>& func_first, const Graph& cfg,
+			const std::vector<std::string>& id_to_name,
+			const std::unordered_map<Vertex, std::vector<std::string>>& targets,
+			Weight horizon);
+
+		bool enabled() const { return !dir.empty(); }
+		const std::string& directory() const { return dir; }
+		size_t numHits() const { return num_hits; }
+		size_t numFuncs() const { return num_funcs; }
+
+		// Load distances of cached functions to given targets
+		void load(const std::vector<Vertex>& targets);
+		// Store distances of functions that were searched
+		void store(
+			const std::vector<std::vector<std::pair<Vertex, float>>>& dists);
+
+		// Vertexes whose distances are loaded from cache, those of them
+		// with an edge to other vertexes, and their distances to `target`
+		const std::vector<bool>& getDone() const { return done; }
+		const std::vector<bool>& getBorder() const { return border; }
+		const std::vector<std::pair<Vertex, float>>& getKnown(reach_t t) const
+		{
+			return known[t];
+		}
+	};
+}
+
+template <typename T>
+static void appendRaw(std::string& buf, const T& v)
+{
+	buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+DistCache::DistCache(const std::vector<Function*>& funcs,
+	const std::vector<Vertex>& func_first, const Graph& cfg,
+	const std::vector<std::string>& id_to_name,
+	const std::unordered_map<Vertex, std::vector<std::string>>& targets,
+	Weight horizon) : func_first(func_first)
+{
+	const u32 n = funcs.size();
+	const size_t num_vertices = func_first[n];
+	done.resize(num_vertices);
+	border.resize(num_vertices);
+	hit.assign(n, true);
+
+	const char* tmp_dir = getenv("AFLRUN_TMP");
+	if (tmp_dir == NULL || getenv("AFLRUN_NO_CACHE") != NULL)
+		return;
+	dir = std::string(tmp_dir) + "/.aflrun-cache";
+	if (sys::fs::create_directories(dir))
+	{
+		WARNF("Could not create directory %s, not caching distances",
+			dir.c_str());
+		dir.clear();
+		return;
+	}
+
+	vertex_func.resize(num_vertices);
+	for (u32 f = 0; f < n; ++f)
+	{
+		for (Vertex v = func_first[f]; v < func_first[f + 1]; ++v)
+			vertex_func[v] = f;
+	}
+
+	// Edges of CFG, which is inverse
+	auto weight = bo::get(bo::edge_weight, cfg);
+	std::vector<std::vector<std::pair<Vertex, Weight>>> succs(num_vertices);
+	for (Vertex u = 0; u < num_vertices; ++u)
+	{
+		for (auto e : bo::make_iterator_range(bo::out_edges(u, cfg)))
+			succs[bo::target(e, cfg)].emplace_back(u, weight[e]);
+	}
+
+	// Key of each function without functions it calls, which does not
+	// depend on ids of blocks nor on order of functions in module
+	std::vector<u64> local(n);
+	calls.resize(n);
+	for (u32 f = 0; f < n; ++f)
+	{
+		std::string buf = funcs[f]->getName().str();
+		buf.push_back(0);
+		for (Vertex v = func_first[f]; v < func_first[f + 1]; ++v)
+		{
+			const std::string& name = id_to_name[v];
+			buf.append(name, name.find(':') + 1, std::string::npos);
+			buf.push_back(0);
+			auto it = targets.find(v);
+			if (it != targets.end())
+			{
+				for (const auto& t : it->second)
+				{
+					buf += t;
+					buf.push_back(1);
+				}
+			}
+
+			std::vector<std::tuple<std::string, u64, u64>> out;
+			for (const auto& e : succs[v])
+			{
+				u32 g = vertex_func[e.first];
+				u64 w;
+				memcpy(&w, &e.second, sizeof(w));
+				out.emplace_back(g == f ? "" : funcs[g]->getName().str(),
+					e.first - func_first[g], w);
+				if (g != f)
+				{
+					calls[f].push_back(g);
+					cross_edges.emplace_back(v, e.first);
+				}
+			}
+			std::sort(out.begin(), out.end());
+			for (const auto& e : out)
+			{
+				buf += std::get<0>(e);
+				buf.push_back(2);
+				appendRaw(buf, std::get<1>(e));
+				appendRaw(buf, std::get<2>(e));
+			}
+			buf.push_back(3);
+		}
+		local[f] = xxHash64(buf);
+	}
+
+	// Functions calling each other share a key of all of them, computed
+	// with Tarjan's algorithm, which finds each strongly connected component
+	// after all components it calls.
+	const u32 none = std::numeric_limits<u32>::max();
+	std::vector<u32> index(n, none), low(n), scc_of(n);
+	std::vector<bool> on_stack(n);
+	std::vector<u32> stack;
+	std::vector<std::pair<u32, size_t>> work;
+	std::vector<u64> closure;
+	u32 next_index = 0;
+	u64 horizon_bits;
+	memcpy(&horizon_bits, &horizon, sizeof(horizon_bits));
+	for (u32 s = 0; s < n; ++s)
+	{
+		if (index[s] != none)
+			continue;
+		work.emplace_back(s, 0);
+		while (!work.empty())
+		{
+			u32 f = work.back().first;
+			if (index[f] == none)
+			{
+				index[f] = low[f] = next_index++;
+				stack.push_back(f);
+				on_stack[f] = true;
+			}
+			if (work.back().second < calls[f].size())
+			{
+				u32 g = calls[f][work.back().second++];
+				if (index[g] == none)
+					work.emplace_back(g, 0);
+				else if (on_stack[g])
+					low[f] = std::min(low[f], index[g]);
+				continue;
+			}
+			work.pop_back();
+			if (!work.empty())
+			{
+				u32 p = work.back().first;
+				low[p] = std::min(low[p], low[f]);
+			}
+			if (low[f] != index[f])
+				continue;
+
+			u32 scc = closure.size();
+			std::vector<u64> data, callees;
+			u32 g;
+			do
+			{
+				g = stack.back(); stack.pop_back();
+				on_stack[g] = false;
+				scc_of[g] = scc;
+				data.push_back(local[g]);
+				for (u32 h : calls[g])
+				{
+					if (!on_stack[h] && scc_of[h] != scc)
+						callees.push_back(closure[scc_of[h]]);
+				}
+			} while (g != f);
+			std::sort(data.begin(), data.end());
+			std::sort(callees.begin(), callees.end());
+			callees.erase(std::unique(callees.begin(), callees.end()),
+				callees.end());
+			data.insert(data.end(), callees.begin(), callees.end());
+			data.push_back(horizon_bits);
+			closure.push_back(xxHash64(StringRef(
+				reinterpret_cast<const char*>(data.data()),
+				data.size() * sizeof(u64))));
+		}
+	}
+
+	keys.resize(n);
+	std::unordered_map<u64, u32> key_cnt;
+	for (u32 f = 0; f < n; ++f)
+	{
+		u64 data[2] = {closure[scc_of[f]], local[f]};
+		keys[f] = xxHash64(StringRef(
+			reinterpret_cast<const char*>(data), sizeof(data)));
+		++key_cnt[keys[f]];
+	}
+	dup.resize(n);
+	for (u32 f = 0; f < n; ++f)
+		dup[f] = key_cnt[keys[f]] > 1;
+}
+
+bool DistCache::read(u32 f,
+	std::vector<std::pair<reach_t, std::pair<Vertex, float>>>& ret) const
+{
+	std::ifstream in(path(f), std::ifstream::binary);
+	CacheHeader hdr;
+	if (!in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+		hdr.magic != kCacheMagic)
+		return false;
+
+	std::vector<reach_t> ref_targets;
+	for (u32 i = 0; i < hdr.num_refs; ++i)
+	{
+		CacheRef ref;
+		if (!in.read(reinterpret_cast<char*>(&ref), sizeof(ref)))
+			return false;
+		auto it = target_of.find(std::make_pair(ref.func, ref.block));
+		if (it == target_of.end())
+			return false;
+		ref_targets.push_back(it->second);
+	}
+	for (u32 i = 0; i < hdr.num_rows; ++i)
+	{
+		CacheRow row;
+		if (!in.read(reinterpret_cast<char*>(&row), sizeof(row)) ||
+			row.block >= numBlocks(f) || row.ref >= hdr.num_refs)
+			return false;
+		ret.emplace_back(ref_targets[row.ref],
+			std::make_pair(func_first[f] + row.block, row.dist));
+	}
+	return true;
+}
+
+void DistCache::load(const std::vector<Vertex>& targets)
+{
+	const u32 n = keys.size();
+	known.resize(targets.size());
+	if (!enabled())
+		return;
+
+	target_refs.resize(targets.size());
+	target_ok.assign(targets.size(), true);
+	std::set<std::pair<u64, u32>> ambiguous;
+	for (reach_t t = 0; t < targets.size(); ++t)
+	{
+		u32 f = vertex_func[targets[t]];
+		auto ref = std::make_pair(keys[f], (u32)(targets[t] - func_first[f]));
+		target_refs[t] = ref;
+		if (dup[f] || !target_of.emplace(ref, t).second)
+			ambiguous.insert(ref);
+	}
+	for (reach_t t = 0; t < targets.size(); ++t)
+	{
+		if (ambiguous.count(target_refs[t]))
+		{
+			target_ok[t] = false;
+			target_of.erase(target_refs[t]);
+		}
+	}
+
+	// Functions calling functions not in cache must be searched too
+	std::vector<std::vector<std::pair<reach_t, std::pair<Vertex, float>>>>
+		rows(n);
+	std::vector<std::vector<u32>> callers(n);
+	std::queue<u32> q;
+	for (u32 f = 0; f < n; ++f)
+	{
+		if (numBlocks(f) == 0)
+			continue;
+		++num_funcs;
+		for (u32 g : calls[f])
+			callers[g].push_back(f);
+		hit[f] = !dup[f] && read(f, rows[f]);
+		if (!hit[f])
+			q.push(f);
+	}
+	while (!q.empty())
+	{
+		u32 f = q.front(); q.pop();
+		for (u32 g : callers[f])
+		{
+			if (hit[g])
+			{
+				hit[g] = false;
+				q.push(g);
+			}
+		}
+	}
+
+	for (u32 f = 0; f < n; ++f)
+	{
+		if (!hit[f] || numBlocks(f) == 0)
+			continue;
+		++num_hits;
+		for (Vertex v = func_first[f]; v < func_first[f + 1]; ++v)
+			done[v] = true;
+		for (const auto& r : rows[f])
+			known[r.first].push_back(r.second);
+	}
+	for (const Edge& e : cross_edges)
+	{
+		if (!hit[vertex_func[e.first]] && hit[vertex_func[e.second]])
+			border[e.second] = true;
+	}
+}
+
+void DistCache::write(u32 f, const std::vector<std::pair<reach_t, CacheRow>>& rows)
+{
+	std::vector<CacheRef> refs;
+	std::unordered_map<reach_t, u32> ref_idx;
+	std::vector<CacheRow> out;
+	for (const auto& r : rows)
+	{
+		auto it = ref_idx.emplace(r.first, refs.size());
+		if (it.second)
+		{
+			const auto& ref = target_refs[r.first];
+			refs.push_back({ref.first, ref.second, 0});
+		}
+		out.push_back(r.second);
+		out.back().ref = it.first->second;
+	}
+	CacheHeader hdr = {kCacheMagic, (u32)refs.size(), (u32)out.size()};
+
+	// Write to a temporary file first, since builds may share the cache
+	std::string dst = path(f);
+	std::ostringstream tmp;
+	tmp << dst << '.' << getpid();
+	{
+		std::ofstream o(tmp.str(), std::ofstream::binary);
+		o.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+		o.write(reinterpret_cast<const char*>(refs.data()),
+			refs.size() * sizeof(CacheRef));
+		o.write(reinterpret_cast<const char*>(out.data()),
+			out.size() * sizeof(CacheRow));
+		if (!o)
+			return;
+	}
+	if (sys::fs::rename(tmp.str(), dst))
+		sys::fs::remove(tmp.str());
+}
+
+void DistCache::store(
+	const std::vector<std::vector<std::pair<Vertex, float>>>& dists)
+{
+	if (!enabled())
+		return;
+	const u32 n = keys.size();
+
+	// Distances to a target not uniquely referred to cannot be stored
+	std::vector<bool> skip(dup.begin(), dup.end());
+	std::vector<std::vector<std::pair<reach_t, CacheRow>>> rows(n);
+	for (reach_t t = 0; t < dists.size(); ++t)
+	{
+		for (const auto& vd : dists[t])
+		{
+			u32 f = vertex_func[vd.first];
+			if (!target_ok[t])
+				skip[f] = true;
+			else if (!hit[f] && !skip[f])
+				rows[f].push_back({t, {(u32)(vd.first - func_first[f]), 0,
+					vd.second}});
+		}
+	}
+	for (u32 f = 0; f < n; ++f)
+	{
+		if (!hit[f] && !skip[f] && numBlocks(f) != 0)
+			write(f, rows[f]);
+	}
+}
+
+// Run Dijkstra from `target` on inverse CFG, ignoring vertexes farther than
+// `horizon`, and append those reached to `res` with distances in order of
+// vertex. Entries of `d` must be infinity, and they are so again on return;
+// only vertexes reached are touched, so the search costs nothing for parts of
+// the CFG beyond the horizon. Distances of vertexes in `done` are not
+// searched but given by `known`, of which those in `border` are searched
+// from like the target, see `DistCache`.
+static void searchTarget(const Graph& cfg, Vertex target, Weight horizon,
+	const std::vector<bool>& done, const std::vector<bool>& border,
+	const std::vector<std::pair<Vertex, float>>& known,
+	std::vector<Weight>& d, std::vector<std::pair<Vertex, float>>& res)
+{
+	using Item = std::pair<Weight, Vertex>;
+	std::priority_queue<Item, std::vector<Item>, std::greater<Item>> q;
+	std::vector<Vertex> reached;
+	auto weight = bo::get(bo::edge_weight, cfg);
+
+	for (const auto& vd : known)
+	{
+		reached.push_back(vd.first);
+		d[vd.first] = vd.second;
+		if (border[vd.first])
+			q.emplace(vd.second, vd.first);
+	}
+	if (!done[target])
+	{
+		reached.push_back(target);
+		d[target] = 0;
+		q.emplace(0, target);
+	}
+	while (!q.empty())
+	{
+		Weight du = q.top().first;
+		Vertex u = q.top().second;
+		q.pop();
+		if (du > d[u])
+			continue;
+		for (auto e : bo::make_iterator_range(bo::out_edges(u, cfg)))
+		{
+			Vertex v = bo::target(e, cfg);
+			Weight dv = du + weight[e];
+			if (!done[v] && dv < d[v] && dv <= horizon)
+			{
+				if (d[v] == std::numeric_limits<Weight>::infinity())
+					reached.push_back(v);
+				d[v] = dv;
+				q.emplace(dv, v);
+			}
+		}
+	}
+
+	std::sort(reached.begin(), reached.end());
+	for (Vertex v : reached)
+	{
+		res.emplace_back(v, static_cast<float>(d[v]));
+		d[v] = std::numeric_limits<Weight>::infinity();
+	}
+}
+
+// Distance beyond which blocks don't count as reaching a target,
+// given by `AFLRUN_MAX_DIST`; infinity by default.
+static Weight getHorizon()
+{
+	const char* s = getenv("AFLRUN_MAX_DIST");
+	if (s == NULL)
+		return std::numeric_limits<Weight>::infinity();
+	char* end;
+	Weight ret = strtod(s, &end);
+	if (end == s || *end != 0 || !(ret >= 0))
+		FATAL("Invalid AFLRUN_MAX_DIST: %s", s);
+	return ret;
+}
+
+// Distance beyond which blocks have no call context, given by
+// `AFLRUN_CTX_RADIUS`; infinity by default, so all blocks have contexts.
+static double getCtxRadius()
+{
+	const char* s = getenv("AFLRUN_CTX_RADIUS");
+	if (s == NULL)
+		return std::numeric_limits<double>::infinity();
+	char* end;
+	double ret = strtod(s, &end);
+	if (end == s || *end != 0 || !(ret >= 0))
+		FATAL("Invalid AFLRUN_CTX_RADIUS: %s", s);
+	return ret;
+}
+
+// Renumber non-target reachable blocks listed in file AFLRUN_BB_ORDER, one
+// name of BBreachable.txt per line as in `order.txt` of `afl-showmap -d`:
+// they go right after targets in order of the file, so blocks that are hot
+// and run together get close bits and bytes in the AFLRun maps. The others
+// keep their order after them, and names not found are ignored.
+static void reorderReachables(std::vector<Vertex>& bb_reachable,
+	reach_t num_targets, const std::vector<std::string>& id_to_name,
+	char be_quiet)
+{
+	const char* path = getenv("AFLRUN_BB_ORDER");
+	if (path == NULL)
+		return;
+	std::ifstream orderfile(path);
+	if (!orderfile.is_open())
+		FATAL("Cannot open AFLRUN_BB_ORDER %s", path);
+
+	std::unordered_map<std::string, size_t> rank;
+	std::string line;
+	while (std::getline(orderfile, line))
+		rank.emplace(line, rank.size());
+
+	std::vector<std::pair<size_t, Vertex>> keys;
+	size_t num_ordered = 0;
+	for (auto it = bb_reachable.begin() + num_targets;
+		it != bb_reachable.end(); ++it)
+	{
+		auto r = rank.find(id_to_name[*it]);
+		num_ordered += r != rank.end();
+		keys.emplace_back(r == rank.end() ? rank.size() : r->second, *it);
+	}
+	std::stable_sort(keys.begin(), keys.end(),
+		[](const auto& a, const auto& b) { return a.first < b.first; });
+	for (size_t i = 0; i < keys.size(); ++i)
+		bb_reachable[num_targets + i] = keys[i].second;
+
+	if (!be_quiet)
+		OKF("Reordered %lu/%lu reachable blocks by %s",
+			num_ordered, keys.size(), path);
+}
+
+// Number targets by the set of reachable blocks reaching them, in order of
+// their first target. Targets with the same set are reached through the same
+// blocks, so they are mostly led to by the same fringes as well, and afl-fuzz
+// starts grouping targets from these groups instead of a single one.
+static std::vector<reach_t> groupTargets(
+	const std::vector<Vertex>& bb_reachable,
+	const std::unordered_map<Vertex, std::unordered_set<reach_t>>& bb_reachable_map,
+	reach_t num_targets)
+{
+	std::vector<std::vector<reach_t>> preds(num_targets);
+	for (reach_t i = 0; i < bb_reachable.size(); ++i)
+	{
+		for (reach_t t : bb_reachable_map.find(bb_reachable[i])->second)
+			preds[t].push_back(i);
+	}
+
+	std::map<std::vector<reach_t>, reach_t> groups;
+	std::vector<reach_t> ret(num_targets);
+	for (reach_t t = 0; t < num_targets; ++t)
+	{
+		reach_t next = groups.size();
+		ret[t] = groups.emplace(std::move(preds[t]), next).first->second;
+	}
+	return ret;
 }
 
 bool aflrunPreprocess(
-	Module &M, const std::unordered_map<std::string, double>& targets,
+	Module &M, const AFLRunTargets& targets,
 	size_t& num_rm, char be_quiet, std::string out_directory)
 {
 	bool ret = false;
@@ -568,23 +1567,31 @@ bool aflrunPreprocess(
 	std::unordered_map<Vertex, std::string> id_to_fname; // entry BB id to func
 	std::vector<Vertex> bb_reachable, f_reachable;
 
-	// Map each target string to set of basic blocks containing the target
-	// Note that each block can also have multiple string (e.i. n to n relation)
-	std::unordered_map<std::string, std::unordered_set<reach_t>> association;
+	// Map each target key to set of basic blocks containing the target
+	// Note that each block can also have multiple targets (e.i. n to n relation)
+	std::unordered_map<u64, std::unordered_set<reach_t>> association;
 
+	/* Black list of function names */
+	std::vector<Function*> funcs;
 	for (auto &F : M)
 	{
-		bool has_BBs = false;
-		std::string funcName = F.getName().str();
+		if (!isBlacklisted(&F))
+			funcs.push_back(&F);
+	}
+	auto blocks = analyzeFunctions(M, funcs, targets);
+	std::vector<Vertex> func_first; // first block id of each function
+	std::unordered_map<Vertex, std::vector<std::string>> vertex_targets;
 
-		/* Black list of function names */
-		if (isBlacklisted(&F))
-			continue;
+	for (size_t i = 0; i < funcs.size(); ++i)
+	{
+		auto& F = *funcs[i];
+		bool has_BBs = false;
+		func_first.push_back(next_bb);
 
 		std::unordered_map<BasicBlock*, std::string> bb_to_name;
 		std::unordered_map<BasicBlock*,
-			std::unordered_set<std::string>> target_blocks;
-		processTargets(M, F, next_bb, targets, bb_to_name,
+			std::unordered_set<u64>> target_blocks;
+		processTargets(F, blocks[i], next_bb, bb_to_name,
 			target_blocks, num_rm, id_to_name);
 
 		bool is_target = !target_blocks.empty();
@@ -622,6 +1629,11 @@ bool aflrunPreprocess(
 				for (const auto& t : ts.second)
 					association[t].insert(idx);
 				bb_reachable.push_back(getBlockId(*ts.first));
+
+				auto& strs = vertex_targets[bb_reachable.back()];
+				for (u64 t : ts.second)
+					strs.push_back(targets.name(t));
+				std::sort(strs.begin(), strs.end());
 			}
 
 			Vertex entry_id = getBlockId(F.getEntryBlock());
@@ -632,11 +1644,13 @@ bool aflrunPreprocess(
 		}
 	}
 
+	func_first.push_back(next_bb);
+
 	reach_t num_targets = bb_reachable.size();
 	std::vector<double> target_weights(num_targets, 0.0);
 	for (const auto& ta : association)
 	{ // Iterate each target, with corresponding weight and blocks
-		double w = targets.find(ta.first)->second;
+		double w = targets.weight(ta.first);
 		for (reach_t t : ta.second)
 		{ // For each block, increment its weight
 			target_weights[t] += w / ta.second.size();
@@ -645,7 +1659,7 @@ bool aflrunPreprocess(
 
 	std::vector<Edge> edges;
 	std::vector<Weight> weights;
-	getGraph(M, edges, weights);
+	getGraph(M, blocks, edges, weights);
 	Graph cfg(edges.begin(), edges.end(), weights.begin(), next_bb);
 	assert(bo::num_vertices(cfg) == next_bb && next_bb == id_to_name.size());
 
@@ -663,35 +1677,66 @@ bool aflrunPreprocess(
 	size_t num_f_targets = f_reachable.size();
 
 	std::vector<Edge> reachable_edges;
-
-	Weight* d = new Weight[next_bb];
-	Vertex* p = new Vertex[next_bb];
-	for (reach_t i = 0; i < num_targets; ++i)
+	std::vector<BlockDist> block_dists;
+
+	// Run Dijkstra for each target in parallel, each thread with its own
+	// buffers; the reachable vertexes of each target are then merged in
+	// target order, so results are same as running them sequentially.
+	std::vector<std::vector<std::pair<Vertex, float>>> target_dists(num_targets);
+	std::atomic<reach_t> next_target(0);
+	Weight horizon = getHorizon();
+	DistCache cache(funcs, func_first, cfg, id_to_name, vertex_targets, horizon);
+	cache.load(bb_reachable);
+	auto search = [&]()
 	{
-		Vertex target = bb_reachable[i];
+		std::vector<Weight> d(next_bb, std::numeric_limits<Weight>::infinity());
+		std::ostringstream dist;
+		for (reach_t i; (i = next_target.fetch_add(1)) < num_targets;)
+		{
+			Vertex target = bb_reachable[i];
+			auto& res = target_dists[i];
 
-		dijkstra_shortest_paths(
-			cfg, target, bo::predecessor_map(p).distance_map(d));
+			// Blocks beyond the horizon get edge coverage only
+			searchTarget(cfg, target, horizon, cache.getDone(),
+				cache.getBorder(), cache.getKnown(i), d, res);
 
-		std::ofstream dist(distances + "/" + std::to_string(i) + ".txt",
-			std::ofstream::out);
+			dist.str("");
+			for (const auto& vd : res)
+				dist << id_to_name[vd.first] << ',' << vd.second << '\n';
 
-		bo::graph_traits<Graph>::vertex_iterator vi, vend;
-		for (bo::tie(vi, vend) = bo::vertices(cfg); vi != vend; ++vi)
+			std::ofstream out(distances + "/" + std::to_string(i) + ".txt",
+				std::ofstream::out);
+			out << dist.str();
+		}
+	};
+	size_t num_threads = std::min<size_t>(
+		std::max(std::thread::hardware_concurrency(), 1u), num_targets);
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < num_threads; ++i)
+		workers.emplace_back(search);
+	search();
+	for (auto& w : workers)
+		w.join();
+	cache.store(target_dists);
+	if (!be_quiet && cache.enabled())
+		OKF("Distances of %lu/%lu functions loaded from cache %s",
+			cache.numHits(), cache.numFuncs(), cache.directory().c_str());
+
+	std::vector<bool> edges_added(next_bb);
+	for (reach_t i = 0; i < num_targets; ++i)
+	{
+		for (const auto& vd : target_dists[i])
 		{
-			// Skip unreachable vertexes
-			if (p[*vi] == *vi && *vi != target)
-				continue;
-
-			dist << id_to_name[*vi] << ',' << d[*vi] << std::endl;
+			Vertex v = vd.first;
+			block_dists.push_back({v, i, vd.second});
 
 			// for each reachable vertex,
 			// add to BBreachable with targets it reaches
-			auto tmp = bb_reachable_map.find(*vi);
+			auto tmp = bb_reachable_map.find(v);
 			if (tmp == bb_reachable_map.end())
 			{
-				bb_reachable.push_back(*vi);
-				bb_reachable_map.emplace(*vi, std::unordered_set<reach_t>({i}));
+				bb_reachable.push_back(v);
+				bb_reachable_map.emplace(v, std::unordered_set<reach_t>({i}));
 			}
 			else
 			{
@@ -699,27 +1744,31 @@ bool aflrunPreprocess(
 			}
 
 			// for each reachable function entry vertex, add to Freachable
-			if (id_to_fname.find(*vi) != id_to_fname.end() &&
-				f_reachable_set.find(*vi) == f_reachable_set.end())
+			if (id_to_fname.find(v) != id_to_fname.end() &&
+				f_reachable_set.find(v) == f_reachable_set.end())
 			{
-				f_reachable.push_back(*vi);
-				f_reachable_set.insert(*vi);
+				f_reachable.push_back(v);
+				f_reachable_set.insert(v);
 
 			}
 
-			// for each reachable vertex, add all of its out edges
-			for (auto ed : bo::make_iterator_range(bo::out_edges(*vi, cfg)))
+			// for each reachable vertex, add all of its out edges once
+			if (edges_added[v])
+				continue;
+			edges_added[v] = true;
+			for (auto ed : bo::make_iterator_range(bo::out_edges(v, cfg)))
 			{
 				// since cfg constructed is inverse,
 				// we swap source and target here
-				reachable_edges.emplace_back(ed.m_target, *vi);
-				// TODO: remove replicate
+				reachable_edges.emplace_back(ed.m_target, v);
 			}
 
 		}
-
+		std::vector<std::pair<Vertex, float>>().swap(target_dists[i]);
 	}
 
+	reorderReachables(bb_reachable, num_targets, id_to_name, be_quiet);
+
 	// Output info to BBreachable
 	if (!be_quiet)
 		OKF("Basic Block: %u targets, %lu reachables",
@@ -753,23 +1802,106 @@ bool aflrunPreprocess(
 	for (reach_t i = 0; i < bb_reachable.size(); ++i)
 		bb_reachable_inv.emplace(bb_reachable[i], i);
 
-	// Output info to BBedges
+	// Output info to BBedges, sorted and without duplication,
+	// since the CFG has an edge for each call from a block to same callee
+	std::vector<std::pair<reach_t, reach_t>> bb_edges;
 	for (const Edge& e : reachable_edges)
 	{
 		auto src = bb_reachable_inv.find(e.first);
 		if (src == bb_reachable_inv.end())
 			continue;
-		bbedges << src->second << ',' <<
-			bb_reachable_inv.find(e.second)->second << std::endl;
+		bb_edges.emplace_back(src->second,
+			bb_reachable_inv.find(e.second)->second);
+	}
+	std::sort(bb_edges.begin(), bb_edges.end());
+	bb_edges.erase(std::unique(bb_edges.begin(), bb_edges.end()),
+		bb_edges.end());
+	for (const auto& e : bb_edges)
+		bbedges << e.first << ',' << e.second << '\n';
+
+	// Output info to Fentries: reachable index of entry block of each
+	// reachable function whose entry block is reachable, so that reaching
+	// the function is told by the block and it needs no instrumentation.
+	std::ofstream fentries(out_directory + "/Fentries.txt", std::ofstream::out);
+	std::vector<reach_t> f_entries;
+	for (reach_t i = 0; i < f_reachable.size(); ++i)
+	{
+		auto it = bb_reachable_inv.find(f_reachable[i]);
+		if (it == bb_reachable_inv.end())
+		{
+			f_entries.push_back(AFLRUN_NO_BLOCK);
+			continue;
+		}
+		f_entries.push_back(it->second);
+		fentries << i << ',' << it->second << '\n';
 	}
 
-	delete[] d; delete[] p;
+	// Output info to Tgroups: static group of each target
+	std::vector<reach_t> target_groups =
+		groupTargets(bb_reachable, bb_reachable_map, num_targets);
+	std::ofstream tgroups(out_directory + "/Tgroups.txt", std::ofstream::out);
+	for (reach_t g : target_groups)
+		tgroups << g << '\n';
+	if (!be_quiet)
+		OKF("Target groups: %u targets, %u groups", num_targets,
+			num_targets ? *std::max_element(
+				target_groups.begin(), target_groups.end()) + 1 : 0);
+
+	aflrunWriteImage(out_directory + "/" AFLRUN_IMAGE_NAME,
+		num_targets, target_weights, bb_reachable, bb_reachable_map,
+		bb_reachable_inv, reachable_edges, block_dists, id_to_name,
+		num_f_targets, f_reachable, id_to_fname, f_entries, getCtxRadius(),
+		target_groups);
+
 	aflrunAddGlobals(M, num_targets, bb_reachable.size(), f_reachable.size());
 	return ret;
 }
 
+// Append call hashes found by `aflrunInstrument` to `aflrun.bin`, and with
+// AFLRUN_EMBED_IMAGE, embed the image after AFLRUN_IMAGE_SIG in the binary,
+// so afl-fuzz maps it from there when the temporary directory is gone.
+static void aflrunFinishImage(Module& M, const std::string& out_directory,
+	const std::vector<aflrun_call_hash_t>& hashes)
+{
+	const std::string path = out_directory + "/" AFLRUN_IMAGE_NAME;
+	std::ifstream fd(path, std::ios::binary);
+	if (!fd.is_open())
+		FATAL("Cannot open " AFLRUN_IMAGE_NAME);
+	ImageBuilder img(std::vector<char>((std::istreambuf_iterator<char>(fd)),
+		std::istreambuf_iterator<char>()));
+	fd.close();
+	if (img.data().size() < sizeof(aflrun_image_t) ||
+		img.header()->magic != AFLRUN_IMAGE_MAGIC)
+		FATAL(AFLRUN_IMAGE_NAME " is corrupted");
+
+	u64 off = img.append(hashes.data(), hashes.size());
+	img.header()->off_call_hashes = off;
+	img.header()->num_call_hashes = hashes.size();
+	img.write(path);
+
+	if (getenv("AFLRUN_EMBED_IMAGE") == NULL)
+		return;
+	static const char sig[] = AFLRUN_IMAGE_SIG;
+	static_assert(sizeof(sig) % 8 == 0, "image must stay aligned");
+	std::vector<char> bytes(sig, sig + sizeof(sig));
+	bytes.insert(bytes.end(), img.data().begin(), img.data().end());
+	auto* GV = new GlobalVariable(M,
+		ArrayType::get(IntegerType::getInt8Ty(M.getContext()), bytes.size()),
+		true, GlobalValue::PrivateLinkage,
+		ConstantDataArray::get(M.getContext(),
+			ArrayRef<char>(bytes.data(), bytes.size())),
+		"__aflrun_image");
+	GV->setSection(AFLRUN_IMAGE_SECTION);
+	GV->setAlignment(Align(8));
+	appendToUsed(M, {GV});
+	if (getenv("AFL_QUIET") == NULL)
+		OKF("Embedded " AFLRUN_IMAGE_NAME " of %lu bytes", img.data().size());
+}
+
 void aflrun_laf_targets(
 	Module& M, const std::unordered_set<BasicBlock*>& target_bb);
+void aflrun_transform_compares(
+	Module& M, const std::unordered_set<Instruction*>& calls);
 
 void aflrunInstrument(
 	Module &M, std::string out_directory)
@@ -783,11 +1915,11 @@ void aflrunInstrument(
 		bb_to_idx, f_to_idx, out_directory);
 
 	LLVMContext &C = M.getContext();
-#ifdef AFLRUN_CTX // remove unused var warning
 	IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
-#endif
 	IntegerType *Int64Ty = IntegerType::getInt64Ty(C);
+	IntegerType *Int8Ty = IntegerType::getInt8Ty(C);
 	IntegerType *Int1Ty = IntegerType::getInt1Ty(C);
+	PointerType *Int8PtrTy = PointerType::get(Int8Ty, 0);
 
 #ifdef __x86_64__
 	IntegerType *LargestType = Int64Ty;
@@ -800,14 +1932,97 @@ void aflrunInstrument(
 		M, Int32Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_call_ctx",
 		0, GlobalVariable::GeneralDynamicTLSModel, 0, false);
 #endif
+	GlobalVariable *AFLTrPtr = new GlobalVariable(
+		M, Int8PtrTy, false, GlobalValue::ExternalLinkage, 0, "__afl_tr_ptr");
+	GlobalVariable *AFLDivPtr = new GlobalVariable(
+		M, Int8PtrTy, false, GlobalValue::ExternalLinkage, 0, "__afl_div_ptr");
+	GlobalVariable *AFLIcallSite = new GlobalVariable(
+		M, Int64Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_icall_site",
+		0, GlobalVariable::GeneralDynamicTLSModel, 0, false);
+	GlobalVariable *AFLCmpBlock = nullptr;
 
 	std::unordered_set<size_t> index_used, findex_used;
 	std::vector<std::tuple<reach_t, reach_t, u32>> call_hashes;
 	std::unordered_set<BasicBlock*> TargetBB;
 	bool switch_laf = getenv("AFLRUN_SWITCH_LAF") != NULL;
 	bool target_laf = getenv("AFLRUN_NO_TARET_LAF") == NULL;
+	// Transform string compares only in reachable blocks within distance,
+	// instead of everywhere with AFL_LLVM_LAF_TRANSFORM_COMPARES
+	bool transform_laf = getenv("AFLRUN_LAF_TRANSFORM") != NULL;
+	std::unordered_set<Instruction*> TransformCalls;
+	// Drop cmplog hooks of blocks reaching no target, since the hooks are
+	// added by cmplog passes before reachability is known at link time
+	bool cmplog_reachable = getenv("AFLRUN_CMPLOG_REACHABLE") != NULL;
+	std::vector<CallInst*> CmplogDead;
+	// Equality compares guarding targets report how close they are to flip
+	bool cmp_dist = getenv("AFLRUN_CMP_DIST") != NULL;
+	size_t cmp_dist_insts = 0;
+	// Functions within distance count their frames in `__afl_near_target`,
+	// so libdislocator with AFL_LD_NEAR_TARGETS only guards allocations
+	// made while one of them is running
+	const char* near_dist_str = getenv("AFLRUN_NEAR_DIST");
+	double near_dist = std::numeric_limits<double>::infinity();
+	std::vector<Function*> NearFuncs;
+	// Single-threaded target can use runtime functions without atomics
+	bool single_thread = getenv("AFLRUN_SINGLE_THREAD") != NULL;
+	// Edge counter of each reachable block goes into the head of its AFLRun
+	// check, so both are one sequence; see `isAFLRunFused` of LTO pass
+	bool fused = getenv("AFLRUN_FUSED_INST") != NULL;
+	const char* inst_name = single_thread ? "aflrun_inst_st" : "aflrun_inst";
+	const char* f_inst_name =
+		single_thread ? "aflrun_f_inst_st" : "aflrun_f_inst";
+	// Without fringe diversity, only targets need their diversity switches
+	bool no_div = getenv("AFLRUN_NO_DIVERSITY") != NULL;
+	const char* nodiv_inst_name =
+		single_thread ? "aflrun_inst_nodiv_st" : "aflrun_inst_nodiv";
+	// Indirect calls of reachable blocks tell `aflrun_icall` at entries of
+	// address taken functions where they are from, so fuzzer learns the edges
+	bool icall = getenv("AFLRUN_NO_ICALL") == NULL;
+	auto icallees = getIndirectCallees(M);
+#ifdef AFLRUN_CTX
+	// Use context loaded at function entry instead of reloading it from TLS,
+	// and store it to TLS only before calls that need it.
+	bool local_ctx = getenv("AFLRUN_LOCAL_CTX") != NULL;
+	TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+	TargetLibraryInfo TLI(TLII);
+#endif
 	if (switch_laf && target_laf)
 		FATAL("Switch LAF and Target LAF currently is exclusive!");
+	if (switch_laf && no_div)
+		FATAL("Switch LAF uses diversity switches of fringes, "
+			"so it cannot be used with AFLRUN_NO_DIVERSITY!");
+
+	// For Switch LAF and LAF transform, only split compares in blocks within
+	// given distance to any target, because splitting everything costs much
+	// code size.
+	const char* laf_dist_str = getenv("AFLRUN_LAF_DIST");
+	double laf_dist = std::numeric_limits<double>::infinity();
+	double ctx_radius = std::numeric_limits<double>::infinity();
+	std::vector<float> min_dists;
+#ifdef AFLRUN_CTX
+	// Blocks farther than `ctx_radius` from all targets use context 0
+	min_dists = loadMinDists(out_directory, num_reachables, ctx_radius);
+	size_t no_ctx_blocks = 0;
+#endif
+	if ((switch_laf || transform_laf) && laf_dist_str != NULL)
+	{
+		char* end;
+		laf_dist = strtod(laf_dist_str, &end);
+		if (*laf_dist_str == 0 || *end != 0 || !(laf_dist >= 0))
+			FATAL("Invalid AFLRUN_LAF_DIST: %s", laf_dist_str);
+		if (min_dists.empty())
+			min_dists = loadMinDists(out_directory, num_reachables, ctx_radius);
+	}
+	if (near_dist_str != NULL)
+	{
+		char* end;
+		near_dist = strtod(near_dist_str, &end);
+		if (*near_dist_str == 0 || *end != 0 || !(near_dist >= 0))
+			FATAL("Invalid AFLRUN_NEAR_DIST: %s", near_dist_str);
+		if (min_dists.empty())
+			min_dists = loadMinDists(out_directory, num_reachables, ctx_radius);
+	}
+	size_t laf_split = 0, laf_skipped = 0, laf_insts = 0, laf_blocks = 0;
 
 	for (auto &F : M)
 	{
@@ -851,7 +2066,9 @@ void aflrunInstrument(
 			CurCallCtx = IRB.CreateZExt(CtxOld, IRB.getInt32Ty());
 #endif
 
-			// Instrument `aflrun_f_inst` at start of each reachable function
+			// Instrument `aflrun_f_inst` at start of each reachable function,
+			// unless its entry block is reachable: then afl-fuzz sets the
+			// function bit from the block bit, as listed in Fentries.txt.
 			if (has_findex)
 			{
 // When doing overhead measurement, we don't instrument function,
@@ -863,16 +2080,34 @@ void aflrunInstrument(
 				FunctionType *FTy = FunctionType::get(
 					Type::getVoidTy(C), Args, false);
 
-				IRB.CreateCall(
-					M.getOrInsertFunction("aflrun_f_inst", FTy), {FuncIdx});
+				auto entry = bb_to_idx.find(getBlockId(F.getEntryBlock()));
+				if (entry == bb_to_idx.end())
+				{
+					IRB.CreateCall(
+						M.getOrInsertFunction(f_inst_name, FTy), {FuncIdx});
+				}
+
+				if (icall && F.hasAddressTaken() && entry != bb_to_idx.end())
+				{
+					IRB.CreateCall(M.getOrInsertFunction("aflrun_icall", FTy),
+						{ConstantInt::get(LargestType, entry->second)});
+				}
 #endif // AFLRUN_OVERHEAD
 
 				assert(findex_used.find(findex) == findex_used.end());
 				findex_used.insert(findex);
 			}
+
+			auto entry = bb_to_idx.find(getBlockId(F.getEntryBlock()));
+			if (near_dist_str != NULL && entry != bb_to_idx.end() &&
+				min_dists[entry->second] <= near_dist)
+				NearFuncs.push_back(&F);
 		}
 
-		std::unordered_set<CallInst*> visited;
+		std::unordered_set<CallInst*> visited, icall_visited;
+#ifdef AFLRUN_CTX
+		std::unordered_map<CallInst*, u32> icall_hashes;
+#endif
 
 		for (auto BB_ : BBs)
 		{
@@ -889,19 +2124,170 @@ void aflrunInstrument(
 
 			BasicBlock::iterator IP = BB.getFirstInsertionPt();
 			IRBuilder<> IRB(&(*IP));
-			CallInst* LAF = nullptr;
+			Value* LAF = nullptr;
+			std::unordered_set<Instruction*> fast_path;
+			bool block_laf = switch_laf && has_index &&
+				(min_dists.empty() || min_dists[index] <= laf_dist);
+
+			// Take calls before the block is split by instrumentation
+			if (transform_laf && has_index &&
+				(min_dists.empty() || min_dists[index] <= laf_dist))
+			{
+				for (auto& I : BB)
+				{
+					if (isa<CallInst>(I))
+						TransformCalls.insert(&I);
+				}
+			}
 
 			if (has_index)
 			{
-				// Call `aflrun_inst` at start of each reachable basic block
+				// Call `aflrun_inst` at start of each reachable basic block,
+				// but only at its first hit in each run for current context:
+				// after that the bit in `__afl_tr_ptr` is set, so all work of
+				// `aflrun_inst` has already been done and we can skip it.
+				// The bit is tested non-atomically, which is fine because it
+				// can only be set, and a stale zero just takes the slow path.
 
 				ConstantInt* BlockIdx = ConstantInt::get(LargestType, index);
 
 				Type *Args[] = {LargestType};
 				FunctionType *FTy = FunctionType::get(Int1Ty, Args, false);
 
-				LAF = IRB.CreateCall(
-					M.getOrInsertFunction("aflrun_inst", FTy), {BlockIdx});
+				// Keep static allocas in entry block when splitting it
+				Instruction* SplitPt = &(*IP);
+				if (&BB == &F.getEntryBlock())
+				{
+					std::vector<AllocaInst*> allocas;
+					while (isa<AllocaInst>(SplitPt))
+						SplitPt = SplitPt->getNextNode();
+					for (auto* I = SplitPt; I != nullptr; I = I->getNextNode())
+					{
+						auto* AI = dyn_cast<AllocaInst>(I);
+						if (AI != nullptr && isa<Constant>(AI->getArraySize()))
+							allocas.push_back(AI);
+					}
+					for (auto* AI : allocas)
+						AI->moveBefore(SplitPt);
+#ifdef AFLRUN_CTX
+					// Fast path uses the context, so it must be loaded before
+					auto* CtxI = cast<Instruction>(CurCallCtx);
+					if (local_ctx && SplitPt == CtxI)
+						SplitPt = SplitPt->getNextNode();
+					else if (local_ctx)
+						CtxI->moveBefore(SplitPt);
+#endif
+				}
+				BasicBlock* Tail = BB.splitBasicBlock(SplitPt);
+				BasicBlock* Check = BasicBlock::Create(C, "", &F, Tail);
+				BasicBlock* Slow = BasicBlock::Create(C, "", &F, Tail);
+				BB.getTerminator()->eraseFromParent();
+
+				// Runtime is not initialized if `__afl_tr_ptr` is NULL
+				IRB.SetInsertPoint(&BB);
+				LoadInst* TrPtr = IRB.CreateLoad(Int8PtrTy, AFLTrPtr);
+				TrPtr->setMetadata(
+					M.getMDKindID("nosanitize"), MDNode::get(C, None));
+				Value* Inited = IRB.CreateICmpNE(
+					TrPtr, ConstantPointerNull::get(Int8PtrTy));
+				BranchInst* InitBr = IRB.CreateCondBr(Inited, Check, Slow);
+				fast_path.insert(cast<Instruction>(Inited));
+				if (fused)
+					InitBr->setMetadata(
+						M.getMDKindID("aflrun.fused"), MDNode::get(C, None));
+
+				// Test `__afl_tr_ptr[CTX_NUM_BYTES * block + ctx / 8]`
+				IRB.SetInsertPoint(Check);
+#ifdef AFLRUN_CTX
+				bool no_ctx = min_dists[index] > ctx_radius;
+				no_ctx_blocks += no_ctx;
+				Value* Ctx = CurCallCtx;
+				if (no_ctx)
+					Ctx = ConstantInt::get(Int32Ty, 0);
+				else if (!local_ctx)
+				{
+					LoadInst* CtxLoad = IRB.CreateLoad(Int32Ty, AFLCallCtx);
+					CtxLoad->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+					Ctx = CtxLoad;
+				}
+				Value* CtxOff = IRB.CreateZExt(
+					IRB.CreateLShr(Ctx, 3), LargestType);
+				Value* Bit = IRB.CreateShl(ConstantInt::get(Int8Ty, 1),
+					IRB.CreateTrunc(IRB.CreateAnd(Ctx, 7), Int8Ty));
+#else
+				Value* CtxOff = ConstantInt::get(LargestType, 0);
+				Value* Bit = ConstantInt::get(Int8Ty, 1);
+#endif
+				Value* Off = IRB.CreateAdd(CtxOff,
+					ConstantInt::get(LargestType, CTX_NUM_BYTES * index));
+				LoadInst* Byte = IRB.CreateLoad(
+					Int8Ty, IRB.CreateGEP(Int8Ty, TrPtr, Off));
+				Byte->setMetadata(
+					M.getMDKindID("nosanitize"), MDNode::get(C, None));
+				Value* Seen = IRB.CreateICmpNE(
+					IRB.CreateAnd(Byte, Bit), ConstantInt::get(Int8Ty, 0));
+				fast_path.insert(cast<Instruction>(Seen));
+
+				// Return value of `aflrun_inst`, only used by switch LAF
+				Value* IsDiv = nullptr;
+				if (block_laf)
+				{
+					LoadInst* DivPtr = IRB.CreateLoad(Int8PtrTy, AFLDivPtr);
+					DivPtr->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+					LoadInst* DivByte = IRB.CreateLoad(Int8Ty, IRB.CreateGEP(
+						Int8Ty, DivPtr, ConstantInt::get(LargestType, index / 8)));
+					DivByte->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+					IsDiv = IRB.CreateICmpNE(
+						IRB.CreateAnd(DivByte,
+							ConstantInt::get(Int8Ty, 1 << (index % 8))),
+						ConstantInt::get(Int8Ty, 0));
+					fast_path.insert(cast<Instruction>(IsDiv));
+				}
+				IRB.CreateCondBr(Seen, Tail, Slow)->setMetadata(
+					M.getMDKindID("laf"), MDNode::get(C, None));
+
+				IRB.SetInsertPoint(Slow);
+#ifdef AFLRUN_CTX
+				// Context in TLS may be stale, because it is not restored;
+				// and `aflrun_inst` of a block without context sees 0.
+				LoadInst* CtxSaved = nullptr;
+				if (no_ctx && !local_ctx)
+				{
+					CtxSaved = IRB.CreateLoad(Int32Ty, AFLCallCtx);
+					CtxSaved->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+				}
+				if (no_ctx || local_ctx)
+					IRB.CreateStore(no_ctx ? Ctx : CurCallCtx, AFLCallCtx)
+						->setMetadata(
+							M.getMDKindID("nosanitize"), MDNode::get(C, None));
+#endif
+				CallInst* Call = IRB.CreateCall(M.getOrInsertFunction(
+					no_div && index >= num_targets ? nodiv_inst_name : inst_name,
+					FTy), {BlockIdx});
+#ifdef AFLRUN_CTX
+				if (CtxSaved != nullptr)
+					IRB.CreateStore(CtxSaved, AFLCallCtx)->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+#endif
+				IRB.CreateBr(Tail)->setMetadata(
+					M.getMDKindID("laf"), MDNode::get(C, None));
+
+				LAF = Call;
+				if (IsDiv)
+				{
+					PHINode* PN = PHINode::Create(Int1Ty, 2, "", &Tail->front());
+					PN->addIncoming(IsDiv, Check);
+					PN->addIncoming(Call, Slow);
+					LAF = PN;
+				}
+
+				// We don't want to instrument these new blocks
+				Tail->getTerminator()->setMetadata(
+					M.getMDKindID("laf"), MDNode::get(C, None));
 
 				assert(index_used.find(index) == index_used.end());
 				index_used.insert(index);
@@ -911,6 +2297,50 @@ void aflrunInstrument(
 			auto p = getBlockOriginalData(M, BB_,
 				target_laf && has_index && index < num_targets ?
 				&TargetBB : nullptr);
+
+			// Compares of a target, or of a block branching to a target,
+			// are guarding it; those against a constant are the magic values
+			// whose progress is invisible to coverage, so they call
+			// `aflrun_cmp` with their operands first.
+			reach_t cmp_target = num_targets;
+			if (cmp_dist && has_index)
+			{
+				if (index < num_targets)
+					cmp_target = index;
+				for (auto* Succ : p.second)
+				{
+					if (cmp_target < num_targets)
+						break;
+					auto it = bb_to_idx.find(getBlockId(*Succ));
+					if (it != bb_to_idx.end() && it->second < num_targets)
+						cmp_target = it->second;
+				}
+			}
+			for (auto* I : p.first)
+			{
+				if (cmp_target >= num_targets)
+					break;
+				auto* Cmp = dyn_cast<ICmpInst>(I);
+				if (Cmp == nullptr || !Cmp->isEquality() || fast_path.count(Cmp))
+					continue;
+				Value* A = Cmp->getOperand(0);
+				Value* B = Cmp->getOperand(1);
+				auto* Ty = dyn_cast<IntegerType>(A->getType());
+				if (Ty == nullptr || Ty->getBitWidth() < 8 ||
+					Ty->getBitWidth() > 64 ||
+					!(isa<ConstantInt>(A) || isa<ConstantInt>(B)))
+					continue;
+
+				IRB.SetInsertPoint(Cmp);
+				IRB.CreateCall(M.getOrInsertFunction("aflrun_cmp",
+					FunctionType::get(Type::getVoidTy(C),
+						{Int32Ty, Int64Ty, Int64Ty}, false)),
+					{ConstantInt::get(Int32Ty, cmp_target),
+						IRB.CreateZExt(A, Int64Ty), IRB.CreateZExt(B, Int64Ty)})
+					->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+				++cmp_dist_insts;
+			}
 #ifdef AFLRUN_CTX
 
 			for (auto* I : p.first)
@@ -924,10 +2354,13 @@ void aflrunInstrument(
 					continue;
 				visited.insert(Call);
 
-				// We don't instrument Call to blacklisted function
+				// We don't instrument Call to blacklisted function,
+				// or function that cannot reach any reachable block
 				auto* CalledF = Call->getCalledFunction();
 				if (CalledF != nullptr && isBlacklisted(CalledF))
 					continue;
+				if (!callNeedsCtx(CalledF, TLI, bb_to_idx))
+					continue;
 
 				// Instrument to any call,
 				// in case context may be changed in these calls
@@ -943,6 +2376,16 @@ void aflrunInstrument(
 					call_hashes.emplace_back(
 						bb_name, getBlockId(CalledF->getEntryBlock()), cur_ctx);
 				}
+				else if (CalledF == nullptr && !Call->isInlineAsm())
+				{ // Same for functions it may call, see `getIndirectCallees`
+					icall_hashes.emplace(Call, cur_ctx);
+					auto it = icallees.find(Call->getFunctionType());
+					if (it != icallees.end())
+					{
+						for (Vertex v : it->second)
+							call_hashes.emplace_back(bb_name, v, cur_ctx);
+					}
+				}
 
 				// Xor current context and old context
 				// and store the result to __afl_call_ctx
@@ -950,26 +2393,100 @@ void aflrunInstrument(
 					->setMetadata(
 						M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-				// Restore contexts to old context value after call
+				// Restore contexts to old context value after call,
+				// unless only the local is used after it.
+				if (local_ctx)
+					continue;
 				IRB.SetInsertPoint(Call->getNextNode());
 				IRB.CreateStore(CurCallCtx, AFLCallCtx)
 					->setMetadata(
 						M.getMDKindID("nosanitize"), MDNode::get(C, None));
 			}
 #endif
+			for (auto* I : p.first)
+			{
+				auto* Call = dyn_cast<CallInst>(I);
+				if (!icall || !has_index || Call == nullptr ||
+					Call->getCalledFunction() != nullptr || Call->isInlineAsm())
+					continue;
+				if (!icall_visited.insert(Call).second)
+					continue;
+
+				// Block + 1 and context hash of the call, read by `aflrun_icall`
+				u64 site = index + 1;
+#ifdef AFLRUN_CTX
+				auto h = icall_hashes.find(Call);
+				if (h != icall_hashes.end())
+					site |= static_cast<u64>(h->second) << 32;
+#endif
+				IRB.SetInsertPoint(Call);
+				IRB.CreateStore(ConstantInt::get(Int64Ty, site), AFLIcallSite)
+					->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+				IRB.SetInsertPoint(Call->getNextNode());
+				IRB.CreateStore(ConstantInt::get(Int64Ty, 0), AFLIcallSite)
+					->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+			}
+
+			// Cmplog hooks called by the block log where they are from, so
+			// input-to-state can tell compares of blocks reaching no target.
+			// The tag stays valid until the next call in the same block.
+			BasicBlock* TaggedBB = nullptr;
+			for (auto* I : p.first)
+			{
+				auto* Call = dyn_cast<CallInst>(I);
+				if (Call == nullptr)
+					continue;
+				if (!isCmplogHook(Call->getCalledFunction()))
+				{
+					TaggedBB = nullptr;
+					continue;
+				}
+				if (cmplog_reachable && !has_index)
+				{ // Erased after all blocks, as `p.first` is still used below
+					CmplogDead.push_back(Call);
+					continue;
+				}
+				if (TaggedBB == Call->getParent())
+					continue;
+				TaggedBB = Call->getParent();
+
+				if (AFLCmpBlock == nullptr)
+				{
+					AFLCmpBlock = new GlobalVariable(M, Int32Ty, false,
+						GlobalValue::ExternalLinkage, 0, "__afl_cmp_block", 0,
+						GlobalVariable::GeneralDynamicTLSModel, 0, false);
+				}
+				u32 tag = has_index ? index + 1 : CMP_BLOCK_UNREACHABLE;
+				IRB.SetInsertPoint(Call);
+				IRB.CreateStore(ConstantInt::get(Int32Ty, tag), AFLCmpBlock)
+					->setMetadata(
+						M.getMDKindID("nosanitize"), MDNode::get(C, None));
+			}
+
 			if (LAF && switch_laf)
 			{ // For reachable block, we split all compare instructions
 				for (auto* I : p.first)
 				{
 					CmpInst* Cmp = dyn_cast<CmpInst>(I);
-					if (Cmp == nullptr)
+					if (Cmp == nullptr || fast_path.count(Cmp))
 						continue;
+					if (!block_laf)
+					{
+						++laf_skipped;
+						continue;
+					}
 
 					// When we encounter a Cmp, we split an if-else before it,
 					// using return value from `aflrun_inst` function.
 					Instruction* LAFTerm = nullptr;
 					Instruction* NoLAFTerm = nullptr;
+					BasicBlock* CmpBlock = Cmp->getParent();
 					SplitBlockAndInsertIfThenElse(LAF, Cmp, &LAFTerm, &NoLAFTerm);
+					if (CmpBlock != &BB)
+						CmpBlock->getTerminator()->setMetadata(
+							M.getMDKindID("laf"), MDNode::get(C, None));
 
 					// Clone the Cmp instruction, and insert to these 2 blocks
 					Instruction* LAFCmp = Cmp->clone();
@@ -994,24 +2511,199 @@ void aflrunInstrument(
 						M.getMDKindID("laf"), MDNode::get(C, None));
 
 					TargetBB.insert(LAFCmp->getParent());
+
+					// Three blocks are added, with the cloned compares, their
+					// branches and the conditional branch (phi replaces `Cmp`)
+					++laf_split;
+					laf_blocks += 3;
+					laf_insts += LAFBlock->size() + NoLAFBlock->size() + 1;
 				}
 			}
 		}
 	}
+	size_t cmplog_removed = 0;
+	for (auto* Call : CmplogDead)
+	{
+		if (!Call->use_empty())
+			continue;
+		Call->eraseFromParent();
+		++cmplog_removed;
+	}
+	if (cmplog_reachable && !getenv("AFL_QUIET"))
+		OKF("Reachable cmplog: removed %lu hooks of unreachable blocks",
+			cmplog_removed);
+	if (!NearFuncs.empty())
+	{
+		GlobalVariable* AFLNearTarget = new GlobalVariable(M, Int32Ty, false,
+			GlobalValue::ExternalLinkage, 0, "__afl_near_target", 0,
+			GlobalVariable::GeneralDynamicTLSModel, 0, false);
+		auto addNear = [&](Instruction* I, int delta)
+		{
+			IRBuilder<> IRB(I);
+			LoadInst* Old = IRB.CreateLoad(Int32Ty, AFLNearTarget);
+			Old->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+			IRB.CreateStore(IRB.CreateAdd(Old, ConstantInt::get(Int32Ty, delta)),
+				AFLNearTarget)->setMetadata(
+					M.getMDKindID("nosanitize"), MDNode::get(C, None));
+		};
+		// Exits by longjmp or exceptions not caught by the function are not
+		// counted, so the frames of such exits stay counted until exit
+		for (Function* F : NearFuncs)
+		{
+			std::vector<Instruction*> Exits;
+			for (auto& BB : *F)
+			{
+				Instruction* Term = BB.getTerminator();
+				if (isa<ReturnInst>(Term) || isa<ResumeInst>(Term))
+					Exits.push_back(Term);
+			}
+			addNear(&*F->getEntryBlock().getFirstInsertionPt(), 1);
+			for (Instruction* Exit : Exits)
+				addNear(Exit, -1);
+		}
+	}
+	if (near_dist_str != NULL && !getenv("AFL_QUIET"))
+		OKF("Near targets: %lu functions within distance %g",
+			NearFuncs.size(), near_dist);
+	if (cmp_dist && !getenv("AFL_QUIET"))
+		OKF("Compare distance: %lu compares guarding targets instrumented",
+			cmp_dist_insts);
+
 	// Each index should be instrumented exactly once
 	assert(findex_used.size() == f_to_idx.size());
 	assert(index_used.size() == bb_to_idx.size());
 
 	std::ofstream chash(out_directory + "/Chash.txt", std::ofstream::out);
+	std::vector<aflrun_call_hash_t> image_hashes;
 	for (const auto& p : call_hashes)
 	{
 		auto src = bb_to_idx.find(std::get<0>(p));
 		auto dst = bb_to_idx.find(std::get<1>(p));
 		if (src != bb_to_idx.end() && dst != bb_to_idx.end())
+		{
 			chash << src->second << ',' << dst->second <<
 				'|' << std::get<2>(p) << std::endl;;
+			image_hashes.push_back({src->second, dst->second, std::get<2>(p)});
+		}
 	}
 	chash.close();
+	aflrunFinishImage(M, out_directory, image_hashes);
+
+#ifdef AFLRUN_CTX
+	if (ctx_radius < std::numeric_limits<double>::infinity() &&
+		!getenv("AFL_QUIET"))
+		OKF("Context radius %g: %lu of %u reachable blocks have no context",
+			ctx_radius, no_ctx_blocks, num_reachables);
+#endif
 
+	if (switch_laf && !getenv("AFL_QUIET"))
+		OKF("Switch LAF: split %lu compares (+%lu blocks, +%lu instructions), "
+			"skipped %lu beyond distance %g", laf_split, laf_blocks, laf_insts,
+			laf_skipped, laf_dist);
+
+	if (transform_laf) aflrun_transform_compares(M, TransformCalls);
 	if (switch_laf || target_laf) aflrun_laf_targets(M, TargetBB);
-}
\ No newline at end of file
+}
+
+std::unordered_map<const Instruction*, float> aflrunInstDists(
+	Module &M, std::string out_directory)
+{
+	reach_t num_targets = 0, num_reachables = 0;
+	reach_t num_ftargets = 0, num_freachables = 0;
+	std::unordered_map<std::string, u32> f_to_idx;
+	std::unordered_map<Vertex, u32> bb_to_idx;
+	parseReachables(
+		num_targets, num_reachables, num_ftargets, num_freachables,
+		bb_to_idx, f_to_idx, out_directory);
+	double ctx_radius;
+	std::vector<float> min_dists =
+		loadMinDists(out_directory, num_reachables, ctx_radius);
+
+	// Instructions added by instrumentation belong to the original block
+	// they are in, so they are found by the same search as in instrumentation
+	std::unordered_map<const Instruction*, float> ret;
+	for (auto &F : M)
+	{
+		if (isBlacklisted(&F))
+			continue;
+		for (auto* BB : getOriginalBlocks(M, F))
+		{
+			auto it = bb_to_idx.find(getBlockId(*BB));
+			if (it == bb_to_idx.end())
+				continue;
+			for (auto* I : getBlockOriginalData(M, BB).first)
+				ret.emplace(I, min_dists[it->second]);
+		}
+	}
+	return ret;
+}
+
+// Order in which the LTO pass numbers edges with AFLRUN_EDGE_WINDOW:
+// functions with reachable blocks first, grouped by the target closest to
+// any of their blocks and then by that distance, so edges near the same
+// target get nearby ids; the rest follow in module order. `num_reachable`
+// is set to the number of the former.
+std::vector<Function*> aflrunFunctionOrder(
+	Module &M, std::string out_directory, size_t& num_reachable)
+{
+	reach_t num_targets = 0, num_reachables = 0;
+	reach_t num_ftargets = 0, num_freachables = 0;
+	std::unordered_map<std::string, u32> f_to_idx;
+	std::unordered_map<Vertex, u32> bb_to_idx;
+	parseReachables(
+		num_targets, num_reachables, num_ftargets, num_freachables,
+		bb_to_idx, f_to_idx, out_directory);
+	std::vector<char> buf = readImage(out_directory, num_reachables);
+	const auto* img = reinterpret_cast<const aflrun_image_t*>(buf.data());
+	const u64* index = AFLRUN_IMAGE_AT(img, off_dists_index, const u64);
+	const aflrun_dist_t* rows =
+		AFLRUN_IMAGE_AT(img, off_dists, const aflrun_dist_t);
+
+	typedef std::pair<reach_t, float> Nearest;
+	const Nearest none(num_targets, std::numeric_limits<float>::infinity());
+	std::vector<Nearest> nearest(num_reachables, none);
+	for (reach_t bb = 0; bb < num_reachables; ++bb)
+	{
+		for (u64 i = index[bb]; i < index[bb + 1]; ++i)
+		{
+			if (rows[i].dist < nearest[bb].second)
+				nearest[bb] = Nearest(rows[i].target, rows[i].dist);
+		}
+	}
+
+	std::vector<std::tuple<reach_t, float, size_t>> keys;
+	std::vector<Function*> funcs, rest;
+	for (auto &F : M)
+	{
+		bool reachable = false;
+		Nearest best = none;
+		if (!isBlacklisted(&F))
+		{
+			for (auto* BB : getOriginalBlocks(M, F))
+			{
+				auto it = bb_to_idx.find(getBlockId(*BB));
+				if (it == bb_to_idx.end())
+					continue;
+				reachable = true;
+				if (nearest[it->second].second < best.second)
+					best = nearest[it->second];
+			}
+		}
+		if (reachable)
+		{
+			keys.emplace_back(best.first, best.second, funcs.size());
+			funcs.push_back(&F);
+		}
+		else
+			rest.push_back(&F);
+	}
+
+	std::sort(keys.begin(), keys.end());
+	std::vector<Function*> ret;
+	ret.reserve(funcs.size() + rest.size());
+	for (const auto& k : keys)
+		ret.push_back(funcs[std::get<2>(k)]);
+	num_reachable = ret.size();
+	ret.insert(ret.end(), rest.begin(), rest.end());
+	return ret;
+}
@@ -0,0 +1,67 @@
+#ifndef _HAVE_AFLRUN_TARGETS_H
+#define _HAVE_AFLRUN_TARGETS_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "types.h"
+
+/*
+  Targets of AFLRUN_BB_TARGETS, one "file:line" or "file:line|weight" per
+  line, where directories of the file are ignored and the weight is 1 by
+  default. Each file with targets gets an id and a set of its target lines,
+  so locations of instructions are looked up by file name and line number,
+  and a target is referred to by a key made of both, without building any
+  "file:line" string until it is found.
+*/
+class AFLRunTargets
+{
+	llvm::StringMap<u32> file_ids;
+	std::vector<std::string> files;
+	std::vector<std::unordered_map<unsigned, double>> lines; // Weight of each
+	size_t num = 0;
+
+public:
+	static constexpr u32 kNoFile = static_cast<u32>(-1);
+
+	// Read `path`, exit with FATAL at the first malformed line;
+	// a target given more than once keeps its first weight.
+	void load(const char* path);
+
+	// Id of the file with base name `name`, or `kNoFile` if it has no target
+	u32 file_id(llvm::StringRef name) const
+	{
+		auto it = file_ids.find(name);
+		return it == file_ids.end() ? kNoFile : it->second;
+	}
+
+	static u64 key(u32 file, unsigned line)
+	{
+		return (static_cast<u64>(file) << 32) | line;
+	}
+
+	bool has(u32 file, unsigned line) const
+	{
+		return file < lines.size() && lines[file].count(line) != 0;
+	}
+
+	double weight(u64 key) const
+	{
+		return lines[key >> 32].at(static_cast<unsigned>(key));
+	}
+
+	// "file:line" of a target
+	std::string name(u64 key) const
+	{
+		return files[key >> 32] + ':' +
+			std::to_string(static_cast<unsigned>(key));
+	}
+
+	size_t size() const { return num; }
+};
+
+#endif /* !_HAVE_AFLRUN_TARGETS_H */
@@ -55,6 +55,7 @@
 #endif
 
 #include <set>
+#include <unordered_set>
 #include "afl-llvm-common.h"
 
 using namespace llvm;
@@ -80,6 +81,15 @@ class CompareTransform : public ModulePass {
 
   }
 
+  /* Only transform `calls`, as chosen by AFLRun, see
+     aflrun_transform_compares() */
+  CompareTransform(const std::unordered_set<Instruction *> &calls)
+      : CompareTransform() {
+
+    only = &calls;
+
+  }
+
 #if LLVM_MAJOR < 11
   #if LLVM_VERSION_MAJOR >= 4
   StringRef getPassName() const override {
@@ -101,17 +111,20 @@ class CompareTransform : public ModulePass {
   bool runOnModule(Module &M) override;
 #endif
 
- private:
   bool transformCmps(Module &M, const bool processStrcmp,
                      const bool processMemcmp, const bool processStrncmp,
                      const bool processStrcasecmp,
                      const bool processStrncasecmp);
 
+ private:
+  const std::unordered_set<Instruction *> *only = nullptr;
+
 };
 
 }  // namespace
 
-#if LLVM_MAJOR >= 11                                /* use new pass manager */
+/* Linked into SanitizerCoverageLTO.so for AFLRun, which has its own plugin */
+#if LLVM_MAJOR >= 11 && !defined(AFLRUN_LTO)        /* use new pass manager */
 extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
 llvmGetPassPluginInfo() {
 
@@ -156,7 +169,7 @@ llvmGetPassPluginInfo() {
 
 }
 
-#else
+#elif LLVM_MAJOR < 11
 char CompareTransform::ID = 0;
 #endif
 
@@ -213,6 +226,8 @@ bool CompareTransform::transformCmps(Module &M, const bool processStrcmp,
 
         if ((callInst = dyn_cast<CallInst>(&IN))) {
 
+          if (only && !only->count(callInst)) continue;
+
           bool isStrcmp = processStrcmp;
           bool isMemcmp = processMemcmp;
           bool isStrncmp = processStrncmp;
@@ -752,7 +767,7 @@ bool CompareTransform::runOnModule(Module &M) {
 
 }
 
-#if LLVM_MAJOR < 11                                 /* use old pass manager */
+#if LLVM_MAJOR < 11 && !defined(AFLRUN_LTO)         /* use old pass manager */
 static void registerCompTransPass(const PassManagerBuilder &,
                                   legacy::PassManagerBase &PM) {
 
@@ -773,3 +788,14 @@ static RegisterStandardPasses RegisterCompTransPassLTO(
   #endif
 #endif
 
+/* Transform compares of `calls` only, which AFLRun picks from reachable blocks
+   near targets instead of the whole program */
+void aflrun_transform_compares(Module                                  &M,
+                               const std::unordered_set<Instruction *> &calls) {
+
+  if (calls.empty()) return;
+  CompareTransform(calls).transformCmps(M, true, true, true, true, true);
+  verifyModule(M);
+
+}
+
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+import sys
+import time
+
+# Compare iterative trimming against water filling used by `solve_new_cvx`,
+# on energy assignments recorded in `cvx/opt.py` of AFLRun output directories.
+
+class FakeNumpy:
+	@staticmethod
+	def array(x):
+		return x
+
+def load_opt(path):
+	with open(path) as fd:
+		src = fd.read().replace("import numpy as np", "")
+	env = {"np": FakeNumpy}
+	exec(src, env)
+	# Each row begins with: seed, prev, ratio, solution
+	rows = [(int(r[0]), r[1], r[2], r[3]) for r in env["opt"]]
+	total = sum(r[3] for r in rows)
+	return rows, total
+
+def solve_trim(rows, total):
+	seeds = {seed : (w, prev) for seed, prev, w, _ in rows}
+	all_sum = sum(w for w, _ in seeds.values())
+	while True:
+		total_after = total + sum(p for _, p in seeds.values())
+		trimmed = [s for s, (w, p) in seeds.items() \
+			if p >= total_after * w / all_sum]
+		if not trimmed:
+			break
+		for s in trimmed:
+			all_sum -= seeds.pop(s)[0]
+	total_after = total + sum(p for _, p in seeds.values())
+	return {s : total_after * w / all_sum - p for s, (w, p) in seeds.items()}
+
+def solve_water_filling(rows, total):
+	seeds = sorted(((prev / w, seed, w, prev) for seed, prev, w, _ in rows))
+	total_after = total; all_sum = 0; num = 0
+	for _, _, w, prev in seeds:
+		if num > 0 and prev * all_sum >= total_after * w:
+			break
+		total_after += prev; all_sum += w; num += 1
+	return {s : total_after * w / all_sum - p for _, s, w, p in seeds[:num]}
+
+def same(a, b, eps=1e-9):
+	return a.keys() == b.keys() and \
+		all(abs(a[s] - b[s]) <= eps * max(1.0, abs(a[s])) for s in a)
+
+def bench(f, rows, total, rounds):
+	start = time.perf_counter()
+	for _ in range(rounds):
+		ret = f(rows, total)
+	return ret, (time.perf_counter() - start) / rounds
+
+if __name__ == '__main__':
+	if len(sys.argv) < 2:
+		print("Usage: python3 cvx_bench.py [opt.py]...", file=sys.stderr)
+		exit(1)
+
+	ok = True
+	for path in sys.argv[1:]:
+		rows, total = load_opt(path)
+		if total <= 0 or any(r[2] <= 0 for r in rows):
+			print("%s: skipped, no energy assigned" % path)
+			continue
+		rounds = max(1, 100000 // len(rows))
+		trim, t0 = bench(solve_trim, rows, total, rounds)
+		water, t1 = bench(solve_water_filling, rows, total, rounds)
+		recorded = {r[0] : r[3] for r in rows if r[3] > 0}
+		# Dumped values only have 6 significant digits
+		match = same(trim, water) and same(water, recorded, 1e-4)
+		ok = ok and match
+		print("%s: %u seeds, trim %.3f ms, water filling %.3f ms, %s" % \
+			(path, len(rows), t0 * 1000, t1 * 1000,
+			"same" if match else "DIFFERENT"))
+
+	exit(0 if ok else 1)
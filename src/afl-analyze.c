@@ -82,6 +82,35 @@ static u32 map_size = MAP_SIZE;
 
 static afl_forkserver_t fsrv = {0};   /* The forkserver                     */
 
+/* AFLRun (-d): besides the edge checksum, each adjustment is compared with
+   the original run by the reachables and targets it reaches, and by the
+   reached (block, context) pairs that fringe diversity is built from. */
+
+static aflrun_shm_t shm_run;
+static u8          *orig_reach;        /* Reachables reached at first       */
+static u64          orig_ctx_cksum;    /* Checksum of first context pairs   */
+static u8           aflrun_d;          /* AFLRun maps set up (-d)?          */
+
+static u32   jobs = 1, job_id;         /* -j workers, and id of this one    */
+static FILE *job_out;                  /* Results of worker, to the parent  */
+static pid_t *job_pids;                /* -j workers, in the parent         */
+static FILE *csv_out;                  /* Ranges written for -o             */
+
+/* What the four adjustments of a byte did, sent by -j workers as is. */
+
+typedef struct byte_result {
+
+  u64 cksum[4];                        /* Edge checksums of adjustments     */
+  u32 reach_gain, reach_lose,          /* Most reachables one of them gains */
+      target_gain, target_lose;        /* ... or loses, and the same for
+                                          targets                           */
+  u8 same;                             /* Bit k: k-th kept orig checksum    */
+  u8 ctx;                              /* Number changing context pairs     */
+
+} byte_result_t;
+
+static byte_result_t *results;         /* One per byte of the input         */
+
 /* Constants used for describing byte behavior. */
 
 #define RESP_NONE 0x00                 /* Changing byte is a no-op.         */
@@ -169,6 +198,7 @@ static inline u8 anything_set(void) {
 static void at_exit_handler(void) {
 
   unlink(fsrv.out_file);                                   /* Ignore errors */
+  if (shm_run.map) { aflrun_shm_deinit(&shm_run); }
 
 }
 
@@ -203,6 +233,74 @@ static void read_initial_file(void) {
 /* Execute target application. Returns exec checksum, or 0 if program
    times out. */
 
+/* Checksum of the reached (block, context) pairs, in any order, from the
+   dirty log if the runtime has one. */
+
+static u64 aflrun_ctx_cksum(void) {
+
+  trace_t *dirty = fsrv.trace_dirty;
+  u64      cksum = 0;
+
+  if (dirty->num > fsrv.num_reachables) {
+
+    return hash64(fsrv.trace_ctx, MAP_TR_SIZE(fsrv.num_reachables), HASH_CONST);
+
+  }
+
+  for (size_t i = 0; i < dirty->num; i++) {
+
+    reach_t block = dirty->trace[i].block;
+    cksum += hash64(fsrv.trace_ctx + CTX_NUM_BYTES * block, CTX_NUM_BYTES,
+                    HASH_CONST ^ block);
+
+  }
+
+  return cksum;
+
+}
+
+/* Count the first `num` bits set in `cur` but not in `orig`, and the other
+   way round. */
+
+static void aflrun_count_diff(const u8 *cur, const u8 *orig, reach_t num,
+                              u32 *gain, u32 *lose) {
+
+  u32 g = 0, l = 0;
+
+  for (reach_t j = 0; j < num / 8; j++) {
+
+    g += __builtin_popcount(cur[j] & ~orig[j] & 0xff);
+    l += __builtin_popcount(orig[j] & ~cur[j] & 0xff);
+
+  }
+
+  if (num % 8) {
+
+    u8 mask = (1 << (num % 8)) - 1;
+    g += __builtin_popcount(cur[num / 8] & ~orig[num / 8] & mask);
+    l += __builtin_popcount(orig[num / 8] & ~cur[num / 8] & mask);
+
+  }
+
+  if (g > *gain) { *gain = g; }
+  if (l > *lose) { *lose = l; }
+
+}
+
+/* Compare the AFLRun maps of the last run with the original one. */
+
+static void aflrun_compare(byte_result_t *r) {
+
+  if (!aflrun_d || fsrv.last_run_timed_out) { return; }
+
+  aflrun_count_diff(fsrv.trace_reachables, orig_reach, fsrv.num_reachables,
+                    &r->reach_gain, &r->reach_lose);
+  aflrun_count_diff(fsrv.trace_reachables, orig_reach, fsrv.num_targets,
+                    &r->target_gain, &r->target_lose);
+  if (aflrun_ctx_cksum() != orig_ctx_cksum) { r->ctx++; }
+
+}
+
 static u64 analyze_run_target(u8 *mem, u32 len, u8 first_run) {
 
   afl_fsrv_write_to_testcase(&fsrv, mem, len);
@@ -252,7 +350,19 @@ static u64 analyze_run_target(u8 *mem, u32 len, u8 first_run) {
 
   }
 
-  if (first_run) { orig_cksum = cksum; }
+  if (first_run) {
+
+    orig_cksum = cksum;
+
+    if (aflrun_d) {
+
+      memcpy(orig_reach, fsrv.trace_reachables,
+             MAP_RBB_SIZE(fsrv.num_reachables));
+      orig_ctx_cksum = aflrun_ctx_cksum();
+
+    }
+
+  }
 
   return cksum;
 
@@ -297,6 +407,32 @@ static void show_legend(void) {
 
 #endif                                                         /* USE_COLOR */
 
+/* Write a run of bytes to the -o file, with the largest AFLRun changes of
+   its bytes and the number of them changing context pairs. */
+
+static void write_range(u32 off, u32 len, u8 rtype) {
+
+  static const char *names[] = {"no-op",  "superficial", "critical", "magic",
+                                "length", "cksum",       "suspect"};
+
+  u32 reach_gain = 0, reach_lose = 0, target_gain = 0, target_lose = 0,
+      ctx_bytes = 0;
+
+  for (u32 j = off; j < off + len; j++) {
+
+    reach_gain = MAX(reach_gain, results[j].reach_gain);
+    reach_lose = MAX(reach_lose, results[j].reach_lose);
+    target_gain = MAX(target_gain, results[j].target_gain);
+    target_lose = MAX(target_lose, results[j].target_lose);
+    ctx_bytes += !!results[j].ctx;
+
+  }
+
+  fprintf(csv_out, "%u,%u,%s,%u,%u,%u,%u,%u\n", off, len, names[rtype],
+          reach_gain, reach_lose, target_gain, target_lose, ctx_bytes);
+
+}
+
 /* Interpret and report a pattern in the input file. */
 
 static void dump_hex(u32 len, u8 *b_data) {
@@ -399,6 +535,8 @@ static void dump_hex(u32 len, u8 *b_data) {
 
     }
 
+    if (csv_out) { write_range(i, rlen, rtype); }
+
     /* Print out the entire run. */
 
 #ifdef USE_COLOR
@@ -508,12 +646,122 @@ static void dump_hex(u32 len, u8 *b_data) {
 
 }
 
-/* Actually analyze! */
+/* Perform walking byte adjustments on byte `i`. We perform four operations
+   designed to elicit some response from the underlying code. */
+
+static void analyze_byte(u32 i, byte_result_t *r) {
+
+  memset(r, 0, sizeof(byte_result_t));
+
+  in_data[i] ^= 0xff;
+  r->cksum[0] = analyze_run_target(in_data, in_len, 0);
+  aflrun_compare(r);
+
+  in_data[i] ^= 0xfe;
+  r->cksum[1] = analyze_run_target(in_data, in_len, 0);
+  aflrun_compare(r);
+
+  in_data[i] = (in_data[i] ^ 0x01) - 0x10;
+  r->cksum[2] = analyze_run_target(in_data, in_len, 0);
+  aflrun_compare(r);
+
+  in_data[i] += 0x20;
+  r->cksum[3] = analyze_run_target(in_data, in_len, 0);
+  aflrun_compare(r);
+  in_data[i] -= 0x10;
+
+  for (u32 k = 0; k < 4; k++) {
+
+    if (r->cksum[k] == orig_cksum) { r->same |= 1 << k; }
+
+  }
+
+}
+
+/* Adjust every jobs-th byte from the one of this -j worker, and send what
+   that did to the parent. */
+
+static void analyze_job(void) {
+
+  byte_result_t r;
+
+  for (u32 i = job_id; i < in_len; i += jobs) {
+
+    analyze_byte(i, &r);
+    job_send(job_out, job_id, &r, sizeof(byte_result_t), 1);
+
+  }
+
+  job_send(job_out, job_id, &total_execs, sizeof(u32), 1);
+  job_send(job_out, job_id, &exec_hangs, sizeof(u32), 1);
+  if (fclose(job_out)) { PFATAL("Unable to send results of worker %u", job_id); }
+
+}
+
+/* Fork -j workers, each of which returns from here to adjust every jobs-th
+   byte with its own forkserver and shared memory. Returns pipes with their
+   results in the parent. */
+
+static FILE **analyze_fork_jobs(void) {
+
+  FILE **in = fork_jobs(jobs, &job_id, &job_out, &job_pids);
+
+  if (!in && job_id) {
+
+    s32 fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) { dup2(fd, 1); }
+
+  }
+
+  return in;
+
+}
+
+/* Gather what -j workers did to each byte, in order, and reap them. */
+
+static void analyze_collect_jobs(FILE **in) {
+
+  u32 w;
+
+  for (u32 i = 0; i < in_len; i++)
+    job_recv(in[i % jobs], i % jobs, &results[i], sizeof(byte_result_t), 1);
 
-static void analyze() {
+  for (w = 0; w < jobs; w++) {
+
+    u32 w_execs, w_hangs;
+
+    job_recv(in[w], w, &w_execs, sizeof(u32), 1);
+    job_recv(in[w], w, &w_hangs, sizeof(u32), 1);
+    total_execs += w_execs;
+    exec_hangs += w_hangs;
+
+  }
+
+  reap_jobs(in, job_pids, jobs);
+
+}
+
+/* Open the -o file, in the parent only. */
+
+static void open_csv(u8 *csv_file) {
+
+  if (!csv_file) { return; }
+
+  csv_out = fopen(csv_file, "w");
+  if (!csv_out) { PFATAL("Unable to create '%s'", csv_file); }
+  fprintf(csv_out,
+          "offset,length,type,reach_gain,reach_lose,target_gain,target_lose,"
+          "ctx_bytes\n");
+
+}
+
+/* Actually analyze! With -j, `in` has the results of the workers. */
+
+static void analyze(FILE **in) {
 
   u32 i;
   u32 boring_len = 0, prev_xff = 0, prev_x01 = 0, prev_s10 = 0, prev_a10 = 0;
+  u32 reach_bytes = 0, target_bytes = 0, ctx_bytes = 0;
 
   u8 *b_data = ck_alloc(in_len + 1);
   u8  seq_byte = 0;
@@ -526,34 +774,36 @@ static void analyze() {
   show_legend();
 #endif                                                         /* USE_COLOR */
 
-  for (i = 0; i < in_len; i++) {
+  results = ck_alloc(in_len * sizeof(byte_result_t));
+
+  if (in) {
 
-    u64 xor_ff, xor_01, sub_10, add_10;
-    u8  xff_orig, x01_orig, s10_orig, a10_orig;
+    analyze_collect_jobs(in);
 
-    /* Perform walking byte adjustments across the file. We perform four
-       operations designed to elicit some response from the underlying
-       code. */
+  } else {
 
-    in_data[i] ^= 0xff;
-    xor_ff = analyze_run_target(in_data, in_len, 0);
+    for (i = 0; i < in_len; i++)
+      analyze_byte(i, &results[i]);
 
-    in_data[i] ^= 0xfe;
-    xor_01 = analyze_run_target(in_data, in_len, 0);
+  }
 
-    in_data[i] = (in_data[i] ^ 0x01) - 0x10;
-    sub_10 = analyze_run_target(in_data, in_len, 0);
+  for (i = 0; i < in_len; i++) {
 
-    in_data[i] += 0x20;
-    add_10 = analyze_run_target(in_data, in_len, 0);
-    in_data[i] -= 0x10;
+    byte_result_t *r = &results[i];
+    u64 xor_ff = r->cksum[0], xor_01 = r->cksum[1], sub_10 = r->cksum[2],
+        add_10 = r->cksum[3];
+    u8 xff_orig, x01_orig, s10_orig, a10_orig;
 
     /* Classify current behavior. */
 
-    xff_orig = (xor_ff == orig_cksum);
-    x01_orig = (xor_01 == orig_cksum);
-    s10_orig = (sub_10 == orig_cksum);
-    a10_orig = (add_10 == orig_cksum);
+    xff_orig = !!(r->same & 1);
+    x01_orig = !!(r->same & 2);
+    s10_orig = !!(r->same & 4);
+    a10_orig = !!(r->same & 8);
+
+    reach_bytes += r->reach_gain || r->reach_lose;
+    target_bytes += r->target_gain || r->target_lose;
+    ctx_bytes += !!r->ctx;
 
     if (xff_orig && x01_orig && s10_orig && a10_orig) {
 
@@ -600,6 +850,13 @@ static void analyze() {
   OKF("Analysis complete. Interesting bits: %0.02f%% of the input file.",
       100.0 - ((double)boring_len * 100) / in_len);
 
+  if (aflrun_d) {
+
+    OKF("Bytes changing reachables: %u, targets: %u, context pairs: %u.",
+        reach_bytes, target_bytes, ctx_bytes);
+
+  }
+
   if (exec_hangs) {
 
     WARNF(cLRD "Encountered %u timeouts - results may be skewed." cRST,
@@ -608,6 +865,7 @@ static void analyze() {
   }
 
   ck_free(b_data);
+  ck_free(results);
 
 }
 
@@ -851,7 +1109,11 @@ static void usage(u8 *argv0) {
 
       "Analysis settings:\n"
 
-      "  -e            - look for edge coverage only, ignore hit counts\n\n"
+      "  -e            - look for edge coverage only, ignore hit counts\n"
+      "  -d dir        - AFLRun temporary directory of the target, also compare\n"
+      "                  reached reachables, targets and context pairs\n"
+      "  -j num        - run adjustments on num forkservers in parallel\n"
+      "  -o file       - write byte ranges and their effects there as CSV\n\n"
 
       "For additional tips, please consult %s/README.md.\n\n"
 
@@ -883,6 +1145,8 @@ int main(int argc, char **argv_orig, char **envp) {
 
   s32    opt;
   u8     mem_limit_given = 0, timeout_given = 0, unicorn_mode = 0, use_wine = 0;
+  u8    *csv_file = NULL;
+  FILE **in = NULL;
   char **use_argv;
   char **argv = argv_cpy_dup(argc, argv_orig);
 
@@ -892,7 +1156,7 @@ int main(int argc, char **argv_orig, char **envp) {
 
   afl_fsrv_init(&fsrv);
 
-  while ((opt = getopt(argc, argv, "+i:f:m:t:eAOQUWh")) > 0) {
+  while ((opt = getopt(argc, argv, "+i:f:m:t:d:j:o:eAOQUWh")) > 0) {
 
     switch (opt) {
 
@@ -1044,6 +1308,28 @@ int main(int argc, char **argv_orig, char **envp) {
 
         break;
 
+      case 'd':
+
+        if (aflrun_d) { FATAL("Multiple -d options not supported"); }
+        aflrun_d = 1;
+        load_aflrun_header(alloc_printf("%s/BBreachable.txt", optarg),
+                           &fsrv.num_targets, &fsrv.num_reachables);
+        load_aflrun_header(alloc_printf("%s/Freachable.txt", optarg),
+                           &fsrv.num_ftargets, &fsrv.num_freachables);
+        break;
+
+      case 'j':
+
+        jobs = atoi(optarg);
+        if (jobs < 1 || optarg[0] == '-') { FATAL("Bad value of -j"); }
+        break;
+
+      case 'o':
+
+        if (csv_file) { FATAL("Multiple -o options not supported"); }
+        csv_file = optarg;
+        break;
+
       case 'h':
         usage(argv[0]);
         return -1;
@@ -1065,6 +1351,25 @@ int main(int argc, char **argv_orig, char **envp) {
 
   check_environment_vars(envp);
 
+  read_initial_file();
+
+  if (jobs > 1) {
+
+    if (fsrv.out_file) { FATAL("-j cannot be used with -f"); }
+    if (jobs > in_len) { jobs = in_len; }
+
+  }
+
+  if (jobs > 1 && (in = analyze_fork_jobs())) {
+
+    open_csv(csv_file);
+    analyze(in);
+    if (csv_out) { fclose(csv_out); }
+    OKF("We're done here. Have a nice day!\n");
+    exit(0);
+
+  }
+
   sharedmem_t shm = {0};
 
   /* initialize cmplog_mode */
@@ -1077,6 +1382,14 @@ int main(int argc, char **argv_orig, char **envp) {
 
   fsrv.target_path = find_binary(argv[optind]);
   fsrv.trace_bits = afl_shm_init(&shm, map_size, 0);
+  if (aflrun_d) {
+
+    aflrun_shm_init(&shm_run, fsrv.num_reachables, fsrv.num_freachables, 0);
+    afl_fsrv_attach_aflrun(&fsrv, &shm_run, 1);
+    orig_reach = ck_alloc(MAP_RBB_SIZE(fsrv.num_reachables));
+
+  }
+
   detect_file_args(argv + optind, fsrv.out_file, &use_stdin);
   signal(SIGALRM, kill_child);
 
@@ -1122,7 +1435,6 @@ int main(int argc, char **argv_orig, char **envp) {
   configure_afl_kill_signals(
       &fsrv, NULL, NULL, (fsrv.qemu_mode || unicorn_mode) ? SIGKILL : SIGTERM);
 
-  read_initial_file();
   (void)check_binary_signatures(fsrv.target_path);
 
   ACTF("Performing dry run (mem limit = %llu MB, timeout = %u ms%s)...",
@@ -1143,11 +1455,27 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
-  analyze();
+  if (job_out) {
 
-  OKF("We're done here. Have a nice day!\n");
+    analyze_job();
+
+  } else {
+
+    open_csv(csv_file);
+    analyze(NULL);
+    if (csv_out) { fclose(csv_out); }
+    OKF("We're done here. Have a nice day!\n");
+
+  }
 
   afl_shm_deinit(&shm);
+  if (aflrun_d) {
+
+    aflrun_shm_deinit(&shm_run);
+    ck_free(orig_reach);
+
+  }
+
   afl_fsrv_deinit(&fsrv);
   if (fsrv.target_path) { ck_free(fsrv.target_path); }
   if (in_data) { ck_free(in_data); }
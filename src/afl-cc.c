@@ -653,8 +653,12 @@ static void edit_params(u32 argc, char **argv, char **envp) {
 
     }
 
-    if (getenv("LAF_TRANSFORM_COMPARES") ||
-        getenv("AFL_LLVM_LAF_TRANSFORM_COMPARES")) {
+    /* With AFLRUN_LAF_TRANSFORM, AFLRun transforms them at link time, only
+       near targets */
+
+    if ((getenv("LAF_TRANSFORM_COMPARES") ||
+         getenv("AFL_LLVM_LAF_TRANSFORM_COMPARES")) &&
+        !getenv("AFLRUN_LAF_TRANSFORM")) {
 
 #if LLVM_MAJOR >= 11                                /* use new pass manager */
   #if LLVM_MAJOR < 16
@@ -781,6 +785,24 @@ static void edit_params(u32 argc, char **argv, char **envp) {
       cc_params[cc_par_cnt++] = "-Wl,--allow-multiple-definition";
       cc_params[cc_par_cnt++] = lto_flag;
 
+      /* AFLRun needs the whole module, but once it is instrumented, its
+         code generation can be split into partitions run in parallel. */
+      u8 *lto_jobs = getenv("AFLRUN_LTO_JOBS");
+      if (lto_jobs) {
+
+        char *end;
+        long  jobs = strtol(lto_jobs, &end, 10);
+        if (!*lto_jobs || *end || jobs < 1) {
+
+          FATAL("Invalid AFLRUN_LTO_JOBS: %s", lto_jobs);
+
+        }
+
+        cc_params[cc_par_cnt++] =
+            alloc_printf("-Wl,--lto-partitions=%ld", jobs);
+
+      }
+
     } else {
 
       if (instrument_mode == INSTRUMENT_PCGUARD) {
@@ -932,6 +954,23 @@ static void edit_params(u32 argc, char **argv, char **envp) {
     if (!strncmp(cur, "--afl", 5)) continue;
     if (lto_mode && !strncmp(cur, "-fuse-ld=", 9)) continue;
     if (lto_mode && !strncmp(cur, "--ld-path=", 10)) continue;
+
+    /* AFLRun numbers reachable blocks over the whole linked module, which
+       ThinLTO backends never see, so build systems asking for it get full
+       LTO; AFLRUN_LTO_JOBS parallelizes its code generation instead. */
+    if (lto_mode && !strcmp(cur, "-flto=thin")) {
+
+      if (!be_quiet) {
+
+        WARNF("AFLRun needs full LTO, ignoring '%s' (see AFLRUN_LTO_JOBS)",
+              cur);
+
+      }
+
+      continue;
+
+    }
+
     if (!strncmp(cur, "-fno-unroll", 11)) continue;
     if (strstr(cur, "afl-compiler-rt") || strstr(cur, "afl-llvm-rt")) continue;
     if (!strcmp(cur, "-Wl,-z,defs") || !strcmp(cur, "-Wl,--no-undefined") ||
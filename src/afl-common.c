@@ -47,6 +47,7 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <signal.h>
 
@@ -849,6 +850,118 @@ free_and_return:
 
 }
 
+/* Read the `<targets>,<reachables>` header line of BBreachable.txt or
+   Freachable.txt of an AFLRun temporary directory; `file` is freed. */
+
+void load_aflrun_header(u8 *file, reach_t *num_targets,
+                        reach_t *num_reachables) {
+
+  FILE *fd = fopen(file, "r");
+  if (fd == NULL) { FATAL("Failed to open %s", file); }
+
+  char  *line = NULL;
+  size_t len = 0;
+  if (getline(&line, &len, fd) == -1 || line == NULL) {
+
+    FATAL("Failed to read %s", file);
+
+  }
+
+  fclose(fd);
+
+  char *endptr;
+  *num_targets = strtoul(line, &endptr, 10);
+  if (*endptr != ',') { FATAL("Wrong format for %s", file); }
+  *num_reachables = strtoul(endptr + 1, &endptr, 10);
+  if (*endptr != 0 && *endptr != '\n') { FATAL("Wrong format for %s", file); }
+  if (*num_targets == 0 || *num_targets > *num_reachables) {
+
+    FATAL("Wrong number of targets and reachables");
+
+  }
+
+  ck_free(file);
+  free(line);
+
+}
+
+FILE **fork_jobs(u32 jobs, u32 *job_id, FILE **job_out, pid_t **pids) {
+
+  FILE **in = ck_alloc(jobs * sizeof(FILE *));
+  *pids = ck_alloc(jobs * sizeof(pid_t));
+
+  for (u32 w = 0; w < jobs; w++) {
+
+    int fds[2];
+    if (pipe(fds)) { PFATAL("pipe() failed"); }
+
+    fflush(stdout);
+    fflush(stderr);
+    (*pids)[w] = fork();
+    if ((*pids)[w] < 0) { PFATAL("fork() failed"); }
+
+    if (!(*pids)[w]) {
+
+      close(fds[0]);
+      for (u32 v = 0; v < w; v++)
+        fclose(in[v]);
+      ck_free(in);
+      ck_free(*pids);
+      *pids = NULL;
+
+      *job_id = w;
+      *job_out = fdopen(fds[1], "w");
+      if (!*job_out) { PFATAL("fdopen() failed"); }
+      return NULL;
+
+    }
+
+    close(fds[1]);
+    in[w] = fdopen(fds[0], "r");
+    if (!in[w]) { PFATAL("fdopen() failed"); }
+
+  }
+
+  return in;
+
+}
+
+void job_send(FILE *out, u32 job_id, const void *buf, size_t size, size_t n) {
+
+  if (fwrite(buf, size, n, out) != n) {
+
+    PFATAL("Unable to send results of worker %u", job_id);
+
+  }
+
+}
+
+void job_recv(FILE *in, u32 w, void *buf, size_t size, size_t n) {
+
+  if (fread(buf, size, n, in) != n) { FATAL("Worker %u of -j failed", w); }
+
+}
+
+void reap_jobs(FILE **in, pid_t *pids, u32 jobs) {
+
+  for (u32 w = 0; w < jobs; w++) {
+
+    int status;
+    fclose(in[w]);
+    if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+
+      FATAL("Worker %u of -j failed", w);
+
+    }
+
+  }
+
+  ck_free(in);
+  ck_free(pids);
+
+}
+
 /* Read mask bitmap from file. This is for the -B option. */
 
 void read_bitmap(u8 *fname, u8 *map, size_t len) {
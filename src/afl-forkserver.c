@@ -32,6 +32,7 @@
 #include "common.h"
 #include "list.h"
 #include "forkserver.h"
+#include "sharedmem.h"
 #include "hash.h"
 
 #include <stdio.h>
@@ -48,6 +49,9 @@
 #include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#ifdef __linux__
+  #include <sys/socket.h>
+#endif
 
 /**
  * The correct fds for reading and writing pipes
@@ -84,6 +88,7 @@ void afl_fsrv_init(afl_forkserver_t *fsrv) {
   fsrv->nyx_runner = NULL;
   fsrv->nyx_id = 0xFFFFFFFF;
   fsrv->nyx_bind_cpu_id = 0xFFFFFFFF;
+  fsrv->nyx_shm_run = NULL;
 #endif
 
   // this structure needs default so we initialize it if this was not done
@@ -150,6 +155,30 @@ void afl_fsrv_init_dup(afl_forkserver_t *fsrv_to, afl_forkserver_t *from) {
 
 }
 
+/* Point the AFLRun trace maps of `fsrv` to those in `shm`. With
+   `div_targets`, the diversity switches of all targets are turned on, as
+   tools running the target on their own need no other diversity blocks. */
+
+void afl_fsrv_attach_aflrun(afl_forkserver_t *fsrv, aflrun_shm_t *shm,
+                            u8 div_targets) {
+
+  fsrv->trace_reachables = shm->map_reachables;
+  fsrv->trace_freachables = shm->map_freachables;
+  fsrv->trace_ctx = shm->map_ctx;
+  fsrv->trace_virgin = shm->map_new_blocks;
+  fsrv->trace_targets = shm->map_targets;
+  fsrv->trace_dirty = shm->map_dirty;
+  fsrv->trace_cmp = shm->map_cmp;
+
+  if (div_targets) {
+
+    for (reach_t t = 0; t < fsrv->num_targets; ++t)
+      shm->div_switch[t / 8] |= 1 << (t % 8);
+
+  }
+
+}
+
 /* Wrapper for select() and read(), reading a 32 bit var.
   Returns the time passed to read.
   If the wait times out, returns timeout_ms + 1;
@@ -227,6 +256,81 @@ restart_select:
 
 }
 
+#ifdef __linux__
+
+/* Same as read_s32_timed() for a status socket: the timeout of the socket
+   makes read() wait for the status and time out at once, which saves the
+   select() of each run; the timeout is only set when it changes. */
+static u32 __attribute__((hot))
+read_s32_sock_timed(afl_forkserver_t *fsrv, s32 *buf, u32 timeout_ms,
+                    volatile u8 *stop_soon_p) {
+
+  u64 start_us = get_cur_time_us();
+  u32 left_ms = timeout_ms;
+
+  while (1) {
+
+    if (unlikely(fsrv->st_tmout_ms != left_ms)) {
+
+      /* A zero timeout would block forever */
+      struct timeval tv = {.tv_sec = left_ms / 1000,
+                           .tv_usec = (left_ms % 1000) * 1000 + !left_ms};
+      if (setsockopt(fsrv->fsrv_st_fd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+                     sizeof(tv))) {
+
+        *buf = -1;
+        return 0;
+
+      }
+
+      fsrv->st_tmout_ms = left_ms;
+
+    }
+
+    ssize_t len_read = read(fsrv->fsrv_st_fd, (u8 *)buf, 4);
+    u32     exec_ms = MIN(timeout_ms, (get_cur_time_us() - start_us) / 1000);
+
+    if (likely(len_read == 4)) { return exec_ms > 0 ? exec_ms : 1; }
+
+    if (len_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+
+      *buf = -1;
+      return timeout_ms + 1;
+
+    }
+
+    if (len_read != -1 || errno != EINTR || *stop_soon_p) { return 0; }
+
+    if (exec_ms >= timeout_ms) {
+
+      *buf = -1;
+      return timeout_ms + 1;
+
+    }
+
+    left_ms = timeout_ms - exec_ms;
+
+  }
+
+}
+
+#endif
+
+/* Read 4 bytes of the status pipe without any timeout, even if it has one. */
+static ssize_t read_s32_st(afl_forkserver_t *fsrv, s32 *buf) {
+
+  ssize_t res;
+  do {
+
+    res = read(fsrv->fsrv_st_fd, (u8 *)buf, 4);
+
+  } while (unlikely(res == -1 && fsrv->st_socket &&
+                    (errno == EAGAIN || errno == EWOULDBLOCK)));
+
+  return res;
+
+}
+
 /* Internal forkserver for non_instrumented_mode=1 and non-forkserver mode runs.
   It execvs for each fork, forwarding exit codes and child pids to afl. */
 
@@ -436,13 +540,37 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
 
     u32 tmp_map_size =
         fsrv->nyx_handlers->nyx_get_bitmap_buffer_size(fsrv->nyx_runner);
-    fsrv->real_map_size = tmp_map_size;
-    fsrv->map_size = (((tmp_map_size + 63) >> 6) << 6);
-    if (!be_quiet) { ACTF("Target map size: %u", fsrv->real_map_size); }
 
     fsrv->trace_bits =
         fsrv->nyx_handlers->nyx_get_bitmap_buffer(fsrv->nyx_runner);
 
+    /* AFLRun maps go to the end of the bitmap buffer, the only memory libnyx
+       shares with the guest, before the agent attaches them in the dry run */
+    if (fsrv->num_reachables != 0 && fsrv->nyx_shm_run != NULL) {
+
+      aflrun_shm_t *shm = fsrv->nyx_shm_run;
+      size_t        off = aflrun_shm_borrow(shm, fsrv->trace_bits, tmp_map_size,
+                                            fsrv->num_reachables,
+                                            fsrv->num_freachables);
+
+      if (!off) {
+
+        FATAL(
+            "Nyx bitmap buffer of %u bytes is too small for the AFLRun maps, "
+            "raise the bitmap size in the Nyx configuration to more than %zu",
+            tmp_map_size, shm->map_size + AFLRUN_NYX_ALIGN + sizeof(u64));
+
+      }
+
+      afl_fsrv_attach_aflrun(fsrv, shm, 0);
+      tmp_map_size = off;
+
+    }
+
+    fsrv->real_map_size = tmp_map_size;
+    fsrv->map_size = (((tmp_map_size + 63) >> 6) << 6);
+    if (!be_quiet) { ACTF("Target map size: %u", fsrv->real_map_size); }
+
     fsrv->nyx_handlers->nyx_option_set_reload_mode(
         fsrv->nyx_runner, getenv("NYX_DISABLE_SNAPSHOT_MODE") == NULL);
     fsrv->nyx_handlers->nyx_option_apply(fsrv->nyx_runner);
@@ -579,7 +707,23 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
 
   }
 
-  if (pipe(st_pipe) || pipe(ctl_pipe)) { PFATAL("pipe() failed"); }
+  fsrv->st_socket = 0;
+  fsrv->st_tmout_ms = 0;
+#ifdef __linux__
+  /* The status pipe is a socket, see read_s32_sock_timed(). */
+  fsrv->st_socket = !getenv("AFL_FORKSRV_PIPE");
+  if (fsrv->st_socket && socketpair(AF_UNIX, SOCK_STREAM, 0, st_pipe)) {
+
+    PFATAL("socketpair() failed");
+
+  }
+
+#endif
+  if ((!fsrv->st_socket && pipe(st_pipe)) || pipe(ctl_pipe)) {
+
+    PFATAL("pipe() failed");
+
+  }
 
   fsrv->last_run_timed_out = 0;
   fsrv->fsrv_pid = fork();
@@ -864,6 +1008,12 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
 
       }
 
+      if ((status & FS_OPT_AFLRUN_RESET) == FS_OPT_AFLRUN_RESET) {
+
+        fsrv->aflrun_reset = 1;
+
+      }
+
       if ((status & FS_OPT_SHDMEM_FUZZ) == FS_OPT_SHDMEM_FUZZ) {
 
         if (fsrv->support_shmem_fuzz) {
@@ -1324,6 +1474,7 @@ afl_fsrv_write_to_testcase(afl_forkserver_t *fsrv, u8 *buf, size_t len) {
 
     *fsrv->shmem_fuzz_len = len;
     memcpy(fsrv->shmem_fuzz, buf, len);
+    fsrv->shmem_fuzz_gen = 0;
 #ifdef _DEBUG
     if (getenv("AFL_DEBUG")) {
 
@@ -1395,20 +1546,152 @@ afl_fsrv_write_to_testcase(afl_forkserver_t *fsrv, u8 *buf, size_t len) {
 
 }
 
+/* Write `buf` as testcase, knowing that it only differs in [lo, hi) from the
+   buffer of generation `gen`, which does not change while its generation is
+   in use. If the shared memory testcase already holds that buffer apart from
+   the span changed last time, only both spans are copied instead of all of
+   `buf`: outside of them, all three are the same. */
+
+void __attribute__((hot))
+afl_fsrv_write_delta(afl_forkserver_t *fsrv, u8 *buf, size_t len, u64 gen,
+                     u32 lo, u32 hi) {
+
+  u8 plain = !fsrv->use_shmem_fuzz || len > MAX_FILE;
+#ifdef __linux__
+  plain |= fsrv->nyx_mode;
+#endif
+#ifdef AFL_PERSISTENT_RECORD
+  plain |= fsrv->persistent_record != 0;
+#endif
+
+  if (unlikely(plain)) {
+
+    afl_fsrv_write_to_testcase(fsrv, buf, len);
+    return;
+
+  }
+
+  if (fsrv->shmem_fuzz_gen == gen && *fsrv->shmem_fuzz_len == len) {
+
+    u32 old_lo = fsrv->shmem_fuzz_lo, old_hi = fsrv->shmem_fuzz_hi;
+    if (old_lo < old_hi) {
+
+      memcpy(fsrv->shmem_fuzz + old_lo, buf + old_lo, old_hi - old_lo);
+
+    }
+
+    if (lo < hi) { memcpy(fsrv->shmem_fuzz + lo, buf + lo, hi - lo); }
+
+  } else {
+
+    afl_fsrv_write_to_testcase(fsrv, buf, len);
+
+  }
+
+  fsrv->shmem_fuzz_gen = gen;
+  fsrv->shmem_fuzz_lo = lo;
+  fsrv->shmem_fuzz_hi = hi;
+
+}
+
+/* Set bits of reachable functions whose entry blocks were reached in the
+   last run, as aflrun-pass only instruments the block for them. Blocks are
+   taken from the dirty log, unless the runtime does not support it, in
+   which case the block bitmap is scanned skipping zero words. */
+
+static void afl_fsrv_entry_funcs(afl_forkserver_t *fsrv) {
+
+  reach_t *funcs = fsrv->entry_funcs;
+  u8      *rf = fsrv->trace_freachables;
+  if (funcs == NULL || fsrv->num_reachables == 0) { return; }
+
+  trace_t *dirty = fsrv->trace_dirty;
+  size_t   num_dirty = dirty->num;
+  if (likely(num_dirty <= fsrv->num_reachables)) {
+
+    for (size_t i = 0; i < num_dirty; ++i) {
+
+      reach_t f = funcs[dirty->trace[i].block];
+      if (f) { rf[(f - 1) / 8] |= 1 << ((f - 1) % 8); }
+
+    }
+
+    return;
+
+  }
+
+  reach_t nr = fsrv->num_reachables;
+  u8     *rbb = fsrv->trace_reachables;
+  size_t  num_bytes = MAP_RF_SIZE(nr);
+  for (size_t off = 0; off < num_bytes; off += sizeof(u64)) {
+
+    size_t n = MIN(sizeof(u64), num_bytes - off);
+    u64    word = 0;
+    memcpy(&word, rbb + off, n);
+    if (likely(!word)) { continue; }
+
+    for (size_t j = off; j < off + n; ++j) {
+
+      for (u32 k = 0; k < 8; ++k) {
+
+        reach_t block = j * 8 + k;
+        if (!(rbb[j] & (1 << k)) || block >= nr) { continue; }
+        reach_t f = funcs[block];
+        if (f) { rf[(f - 1) / 8] |= 1 << ((f - 1) % 8); }
+
+      }
+
+    }
+
+  }
+
+}
+
 /* Reset shared memory before each run */
 void afl_fsrv_clear(afl_forkserver_t *fsrv) {
   memset(fsrv->trace_bits, 0, fsrv->map_size);
 
-  if (fsrv->num_reachables != 0) {
+  // Best compares are kept across runs, only whether this run beat them is not
+  if (fsrv->trace_cmp) fsrv->trace_cmp->closer = 0;
+
+  // If last child stopped in persistent mode, it will be resumed and reset
+  // AFLRun maps touched in its last iteration by itself, so we only need to
+  // update the bit for counting frequency.
+  if (fsrv->num_reachables != 0 && fsrv->aflrun_reset && fsrv->child_pid > 0) {
+
+    u8 bit = 1 << (fsrv->num_reachables % 8);
+    if (fsrv->testing && fsrv->aflrun_level == AFLRUN_LEVEL_FULL)
+      fsrv->trace_reachables[fsrv->num_reachables / 8] |= bit;
+    else
+      fsrv->trace_reachables[fsrv->num_reachables / 8] &= ~bit;
+
+  } else if (fsrv->num_reachables != 0) {
 
     memset(fsrv->trace_reachables, 0, MAP_RBB_SIZE(fsrv->num_reachables));
     memset(fsrv->trace_freachables, 0, MAP_RF_SIZE(fsrv->num_freachables));
-    memset(fsrv->trace_ctx, 0, MAP_TR_SIZE(fsrv->num_reachables));
+
+    // Only clear context bits of blocks logged by runtime in the last run,
+    // unless the runtime does not support the dirty log.
+    trace_t *dirty = fsrv->trace_dirty;
+    size_t num_dirty = dirty->num;
+    if (likely(num_dirty <= fsrv->num_reachables)) {
+
+      for (size_t i = 0; i < num_dirty; ++i)
+        memset(fsrv->trace_ctx + CTX_NUM_BYTES * dirty->trace[i].block, 0,
+          CTX_NUM_BYTES);
+      dirty->num = 0;
+
+    } else {
+
+      memset(fsrv->trace_ctx, 0, MAP_TR_SIZE(fsrv->num_reachables));
+
+    }
+
     fsrv->trace_virgin->num = 0;
     fsrv->trace_targets->num = 0;
 
     // If we want to count frequency, set last bit of block bitmap
-    if (fsrv->testing)
+    if (fsrv->testing && fsrv->aflrun_level == AFLRUN_LEVEL_FULL)
       fsrv->trace_reachables[fsrv->num_reachables / 8] |=
         1 << (fsrv->num_reachables % 8);
 
@@ -1422,10 +1705,6 @@ fsrv_run_result_t __attribute__((hot))
 afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
                     volatile u8 *stop_soon_p) {
 
-  s32 res;
-  u32 exec_ms;
-  u32 write_value = fsrv->last_run_timed_out;
-
 #ifdef __linux__
   if (fsrv->nyx_mode) {
 
@@ -1444,6 +1723,7 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
         fsrv->nyx_handlers->nyx_exec(fsrv->nyx_runner);
 
     fsrv->total_execs++;
+    afl_fsrv_entry_funcs(fsrv);
 
     switch (ret_val) {
 
@@ -1484,34 +1764,54 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
   }
 
 #endif
+
+  afl_fsrv_start_run(fsrv, stop_soon_p);
+  return afl_fsrv_finish_run(fsrv, timeout, stop_soon_p);
+
+}
+
+/* Start running the testcase written by afl_fsrv_write_to_testcase() without
+   waiting for it, afl_fsrv_finish_run() then waits for the outcome. Not for
+   nyx mode. This lets a pool of forkservers run several testcases at once. */
+
+void __attribute__((hot))
+afl_fsrv_start_run(afl_forkserver_t *fsrv, volatile u8 *stop_soon_p) {
+
+  s32 res;
+  u32 write_value = fsrv->last_run_timed_out;
+
   /* After this memset, fsrv->trace_bits[] are effectively volatile, so we
      must prevent any earlier operations from venturing into that
      territory. */
 
-#ifdef __linux__
-  if (!fsrv->nyx_mode) {
-    afl_fsrv_clear(fsrv);
-    MEM_BARRIER();
-  }
-
-#else
   afl_fsrv_clear(fsrv);
   MEM_BARRIER();
-#endif
 
   /* we have the fork server (or faux server) up and running
   First, tell it if the previous run timed out. */
 
   if ((res = write(fsrv->fsrv_ctl_fd, &write_value, 4)) != 4) {
 
-    if (*stop_soon_p) { return 0; }
+    if (*stop_soon_p) { return; }
     RPFATAL(res, "Unable to request new process from fork server (OOM?)");
 
   }
 
   fsrv->last_run_timed_out = 0;
 
-  if ((res = read(fsrv->fsrv_st_fd, &fsrv->child_pid, 4)) != 4) {
+}
+
+/* Wait for the run started by afl_fsrv_start_run(), monitoring for timeouts.
+   Return status information. */
+
+fsrv_run_result_t __attribute__((hot))
+afl_fsrv_finish_run(afl_forkserver_t *fsrv, u32 timeout,
+                    volatile u8 *stop_soon_p) {
+
+  s32 res;
+  u32 exec_ms;
+
+  if ((res = read_s32_st(fsrv, &fsrv->child_pid)) != 4) {
 
     if (*stop_soon_p) { return 0; }
     RPFATAL(res, "Unable to request new process from fork server (OOM?)");
@@ -1552,8 +1852,14 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
 
   }
 
-  exec_ms = read_s32_timed(fsrv->fsrv_st_fd, &fsrv->child_status, timeout,
-                           stop_soon_p);
+#ifdef __linux__
+  if (likely(fsrv->st_socket))
+    exec_ms = read_s32_sock_timed(fsrv, &fsrv->child_status, timeout,
+                                  stop_soon_p);
+  else
+#endif
+    exec_ms = read_s32_timed(fsrv->fsrv_st_fd, &fsrv->child_status, timeout,
+                             stop_soon_p);
 
   if (exec_ms > timeout) {
 
@@ -1569,7 +1875,7 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
     }
 
     fsrv->last_run_timed_out = 1;
-    if (read(fsrv->fsrv_st_fd, &fsrv->child_status, 4) < 4) { exec_ms = 0; }
+    if (read_s32_st(fsrv, &fsrv->child_status) < 4) { exec_ms = 0; }
 
   }
 
@@ -1611,6 +1917,8 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
 
   MEM_BARRIER();
 
+  afl_fsrv_entry_funcs(fsrv);
+
   /* Report outcome to caller. */
 
   /* Was the run unsuccessful? */
@@ -1690,6 +1998,71 @@ afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
 
 }
 
+/* Make the maps of `to` hold the outcome of the last run of `from`, as if `to`
+   had run it, so runs of a forkserver pool are processed with the maps of the
+   main forkserver. Runs of `from` must not log virgin paths (i.e. `testing`
+   is not set), since virgin context bits only live in the maps of `to`. */
+
+void afl_fsrv_copy_result(afl_forkserver_t *to, afl_forkserver_t *from) {
+
+  memcpy(to->trace_bits, from->trace_bits, to->map_size);
+  to->child_status = from->child_status;
+  to->last_kill_signal = from->last_kill_signal;
+  ++to->total_execs;
+
+  if (!to->num_reachables) { return; }
+
+  /* Clear context bits left by the last run of `to`, the runtime of `to`
+     does not know about what we copy, so this is done even if it resets
+     the maps by itself. */
+
+  trace_t *dirty = to->trace_dirty, *from_dirty = from->trace_dirty;
+  size_t   nr = to->num_reachables;
+  if (likely(dirty->num <= nr)) {
+
+    for (size_t i = 0; i < dirty->num; ++i)
+      memset(to->trace_ctx + CTX_NUM_BYTES * dirty->trace[i].block, 0,
+             CTX_NUM_BYTES);
+
+  } else {
+
+    memset(to->trace_ctx, 0, MAP_TR_SIZE(nr));
+
+  }
+
+  if (likely(from_dirty->num <= nr)) {
+
+    for (size_t i = 0; i < from_dirty->num; ++i) {
+
+      size_t off = CTX_NUM_BYTES * from_dirty->trace[i].block;
+      memcpy(to->trace_ctx + off, from->trace_ctx + off, CTX_NUM_BYTES);
+
+    }
+
+    memcpy(dirty->trace, from_dirty->trace, from_dirty->num * sizeof(ctx_t));
+
+  } else {
+
+    memcpy(to->trace_ctx, from->trace_ctx, MAP_TR_SIZE(nr));
+
+  }
+
+  dirty->num = from_dirty->num;
+
+  memcpy(to->trace_reachables, from->trace_reachables, MAP_RBB_SIZE(nr));
+  memcpy(to->trace_freachables, from->trace_freachables,
+         MAP_RF_SIZE(to->num_freachables));
+
+  size_t num = from->trace_targets->num;
+  memcpy(to->trace_targets->trace, from->trace_targets->trace,
+         MIN(num, MAP_VTR_CAP(nr)) * sizeof(ctx_t));
+  to->trace_targets->num = num;
+  to->trace_virgin->num = 0;
+  if (to->trace_cmp && from->trace_cmp)
+    to->trace_cmp->closer = from->trace_cmp->closer;
+
+}
+
 void afl_fsrv_killall() {
 
   LIST_FOREACH(&fsrv_list, afl_forkserver_t, {
@@ -0,0 +1,151 @@
+/*
+ * This implements the asynchronous writes of queue entries, crashes and
+ * hangs, see AFL_ASYNC_WRITE in docs/env_variables.md
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "afl-fuzz.h"
+
+/* The fuzzing loop queues a copy of each file to write, which the writer
+   thread creates, writes and closes in order. Operations are numbered from
+   1, so a reader of a file waits until the number of its write is done;
+   the fuzzing loop also waits when ASYNCW_QUEUE_MAX writes are pending. */
+
+struct asyncw_op {
+
+  u8 *fn;
+  u8 *buf;
+  u32 len;
+  u8  replace;                           /* Unlink `fn` first             */
+
+};
+
+struct afl_asyncw {
+
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;                  /* Writes queued or done         */
+
+  struct asyncw_op ops[ASYNCW_QUEUE_MAX];
+  u32              head, cnt;
+  u64              queued, done;         /* Numbers of the last ones      */
+
+};
+
+static void asyncw_do(struct asyncw_op *op) {
+
+  if (op->replace) { unlink(op->fn); }                 /* ignore errors */
+  s32 fd = open(op->fn, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
+  if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", op->fn); }
+  ck_write(fd, op->buf, op->len, op->fn);
+  close(fd);
+
+}
+
+static void *asyncw_thread(void *arg) {
+
+  struct afl_asyncw *w = arg;
+
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+
+    while (!w->cnt) {
+
+      pthread_cond_wait(&w->cond, &w->lock);
+
+    }
+
+    struct asyncw_op op = w->ops[w->head];
+    pthread_mutex_unlock(&w->lock);
+
+    asyncw_do(&op);
+    free(op.fn);
+
+    pthread_mutex_lock(&w->lock);
+    w->head = (w->head + 1) % ASYNCW_QUEUE_MAX;
+    --w->cnt;
+    ++w->done;
+    pthread_cond_broadcast(&w->cond);
+
+  }
+
+  return NULL;
+
+}
+
+void asyncw_init(afl_state_t *afl) {
+
+  struct afl_asyncw *w = ck_alloc(sizeof(struct afl_asyncw));
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+
+  start_detached_thread(asyncw_thread, w, "writer");
+
+  afl->asyncw = w;
+  OKF("Writing queue entries, crashes and hangs asynchronously.");
+
+}
+
+u64 asyncw_write(afl_state_t *afl, u8 *fn, u8 *mem, u32 len, u8 replace) {
+
+  struct afl_asyncw *w = afl->asyncw;
+  struct asyncw_op   op = {.fn = fn, .buf = mem, .len = len,
+                           .replace = replace};
+
+  if (!w) {
+
+    asyncw_do(&op);
+    return 0;
+
+  }
+
+  /* One allocation for the path and the data, freed by the writer thread */
+  size_t fn_len = strlen(fn) + 1;
+  op.fn = malloc(fn_len + len);
+  if (!op.fn) { PFATAL("Unable to allocate write of '%s'", fn); }
+  memcpy(op.fn, fn, fn_len);
+  op.buf = op.fn + fn_len;
+  memcpy(op.buf, mem, len);
+
+  pthread_mutex_lock(&w->lock);
+  while (w->cnt == ASYNCW_QUEUE_MAX) {
+
+    pthread_cond_wait(&w->cond, &w->lock);
+
+  }
+
+  w->ops[(w->head + w->cnt) % ASYNCW_QUEUE_MAX] = op;
+  ++w->cnt;
+  u64 seq = ++w->queued;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+
+  return seq;
+
+}
+
+void asyncw_wait(afl_state_t *afl, u64 seq) {
+
+  struct afl_asyncw *w = afl->asyncw;
+  if (!w || !seq) { return; }
+
+  pthread_mutex_lock(&w->lock);
+  while (w->done < seq) {
+
+    pthread_cond_wait(&w->cond, &w->lock);
+
+  }
+
+  pthread_mutex_unlock(&w->lock);
+
+}
+
+void asyncw_flush(afl_state_t *afl) {
+
+  if (afl->asyncw) { asyncw_wait(afl, afl->asyncw->queued); }
+
+}
+
@@ -26,6 +26,8 @@
 #include "afl-fuzz.h"
 #include "debug.h"
 #include "aflrun.h"
+#include "aflrun-record.h"
+#include "afl-probes.h"
 #include <limits.h>
 #if !defined NAME_MAX
   #define NAME_MAX _XOPEN_NAME_MAX
@@ -223,6 +225,24 @@ inline u8 has_new_bits(afl_state_t *afl, u8 *virgin_map) {
 #endif                                                     /* ^WORD_SIZE_64 */
 
   u8 ret = 0;
+
+#if defined(WORD_SIZE_64) && defined(CLASSIFY_PACK)
+  for (; i >= CLASSIFY_PACK / 8; i -= CLASSIFY_PACK / 8) {
+
+    if (unlikely(!pack_is_zero((u8 *)current))) {
+
+      for (u32 k = 0; k < CLASSIFY_PACK / 8; ++k)
+        if (current[k]) discover_word(&ret, current + k, virgin + k);
+
+    }
+
+    current += CLASSIFY_PACK / 8;
+    virgin += CLASSIFY_PACK / 8;
+
+  }
+
+#endif
+
   while (i--) {
 
     if (unlikely(*current)) discover_word(&ret, current, virgin);
@@ -239,6 +259,18 @@ inline u8 has_new_bits(afl_state_t *afl, u8 *virgin_map) {
 
 }
 
+static inline u8 new_bits_mul_result(const u8* new_bits, size_t num) {
+
+  u8 primary = num ? new_bits[0] : 0, diversity = 0;
+  for (size_t i = 1; i < num; ++i) // Get max level of new edge from all div maps
+    diversity = MAX(diversity, new_bits[i]);
+
+  // lowest 2 bits are result from primary map,
+  // and 2-3 bits are from diversity maps
+  return primary | (diversity << 2);
+
+}
+
 inline u8 has_new_bits_mul(afl_state_t *afl,
   u8* const *virgin_maps, u8** p_new_bits, size_t num, u8 modify) {
 
@@ -249,22 +281,111 @@ inline u8 has_new_bits_mul(afl_state_t *afl,
   u64 *current = (u64 *)afl->fsrv.trace_bits;
   u64* const *virgins = (u64* const *)virgin_maps;
 
-  u32 len = ((afl->fsrv.real_map_size + 7) >> 3);
+  u32 len = ((afl->fsrv.real_map_size + 7) >> 3), i = 0;
+
+#ifdef CLASSIFY_PACK
+  for (; i + CLASSIFY_PACK / 8 <= len; i += CLASSIFY_PACK / 8) {
 
-  for (u32 i = 0; i < len; ++i, ++current) {
+    if (likely(pack_is_zero((u8 *)(current + i)))) { continue; }
+    for (u32 k = i; k < i + CLASSIFY_PACK / 8; ++k) {
 
-    if (unlikely(*current))
-      discover_word_mul(new_bits, current, virgins, num, i, modify);
+      if (current[k])
+        discover_word_mul(new_bits, current + k, virgins, num, k, modify);
+
+    }
 
   }
 
-  u8 primary = new_bits[0], diversity = 0;
-  for (size_t i = 1; i < num; ++i) // Get max level of new edge from all div maps
-    diversity = MAX(diversity, new_bits[i]);
+#endif
 
-  // lowest 2 bits are result from primary map,
-  // and 2-3 bits are from diversity maps
-  return primary | (diversity << 2);
+  for (; i < len; ++i) {
+
+    if (unlikely(current[i]))
+      discover_word_mul(new_bits, current + i, virgins, num, i, modify);
+
+  }
+
+  return new_bits_mul_result(new_bits, num);
+
+}
+
+/* Fused classify_counts() and has_new_bits_mul(..., 0): classify each non-zero
+   word, compare it with `num` virgin maps without updating them, and record
+   its index in `afl->touched_words`, so that has_new_bits_mul_touched() can
+   later commit only these words instead of sweeping the whole trace again.
+   If `num` is 0, only classification and recording are done. */
+
+static u8 classify_new_bits_mul(afl_state_t *afl,
+  u8* const *virgin_maps, u8** p_new_bits, size_t num) {
+
+  u8* new_bits = *p_new_bits = afl_realloc((void **)p_new_bits, sizeof(u8) * num);
+  memset(new_bits, 0, sizeof(u8) * num);
+
+  u32 len = (afl->fsrv.map_size >> 3);
+  u32* touched = afl->touched_words =
+    afl_realloc((void **)&afl->touched_words, sizeof(u32) * len);
+  u32 num_touched = 0;
+
+  u64 *current = (u64 *)afl->fsrv.trace_bits;
+  u64* const *virgins = (u64* const *)virgin_maps;
+  u32 i = 0;
+
+#ifdef CLASSIFY_PACK
+  /* A pack with any count is classified at once, then visited by words. */
+  for (; i + CLASSIFY_PACK / 8 <= len; i += CLASSIFY_PACK / 8) {
+
+    if (likely(pack_is_zero((u8 *)(current + i)))) { continue; }
+    classify_pack((u8 *)(current + i));
+    for (u32 k = i; k < i + CLASSIFY_PACK / 8; ++k) {
+
+      if (!current[k]) { continue; }
+      touched[num_touched++] = k;
+      if (num) discover_word_mul(new_bits, current + k, virgins, num, k, 0);
+
+    }
+
+  }
+
+#endif
+
+  for (; i < len; ++i) {
+
+    if (unlikely(current[i])) {
+
+      current[i] = classify_word(current[i]);
+      touched[num_touched++] = i;
+      if (num) discover_word_mul(new_bits, current + i, virgins, num, i, 0);
+
+    }
+
+  }
+
+  afl->num_touched_words = num_touched;
+  return new_bits_mul_result(new_bits, num);
+
+}
+
+/* Same as has_new_bits_mul(..., 1), but only visits words recorded by
+   classify_new_bits_mul() for current trace. */
+
+static u8 has_new_bits_mul_touched(afl_state_t *afl,
+  u8* const *virgin_maps, u8** p_new_bits, size_t num) {
+
+  u8* new_bits = *p_new_bits = afl_realloc((void **)p_new_bits, sizeof(u8) * num);
+  memset(new_bits, 0, sizeof(u8) * num);
+
+  u64 *trace = (u64 *)afl->fsrv.trace_bits;
+  u64* const *virgins = (u64* const *)virgin_maps;
+  const u32* touched = afl->touched_words;
+
+  for (u32 j = 0; j < afl->num_touched_words; ++j) {
+
+    u32 i = touched[j];
+    discover_word_mul(new_bits, trace + i, virgins, num, i, 1);
+
+  }
+
+  return new_bits_mul_result(new_bits, num);
 
 }
 
@@ -286,7 +407,8 @@ static u8 has_new_bits_unclassified(
 
 #ifdef WORD_SIZE_64
 
-  if (!skim((const u64* const*)virgin_maps, num,
+  if (!skim((const u64* const*)virgin_maps, num, afl->virgin_stride,
+    afl->edge_lo >> 3, (afl->edge_hi - afl->edge_lo) >> 3,
     (u64 *)afl->fsrv.trace_bits, (u64 *)end))
     return 0;
 
@@ -303,21 +425,58 @@ static u8 has_new_bits_unclassified(
   return 1;
 }
 
-/* Compact trace bytes into a smaller bitmap. We effectively just drop the
-   count information here. This is called only sporadically, for some
-   new paths. */
+/* Compact trace bytes into runs of bitmap words, given the ascending indices
+   of non-zero bytes. We effectively just drop the count information here.
+   This is called only sporadically, for some new paths. */
 
-void minimize_bits(afl_state_t *afl, u8 *dst, u8 *src) {
+trace_mini_t *minimize_trace(const u32 *edges, u32 num_edges) {
 
-  u32 i = 0;
+  u32 size = 0, k;
+  s64 last = -1, cur = -1;
 
-  while (i < afl->fsrv.map_size) {
+  for (k = 0; k < num_edges; ++k) {
 
-    if (*(src++)) { dst[i >> 3] |= 1 << (i & 7); }
-    ++i;
+    s64 w = edges[k] >> 6;
+    if (w == last) { continue; }
+    size += (last >= 0 && w - last <= 2) ? w - last : 2;
+    last = w;
 
   }
 
+  trace_mini_t *m = ck_alloc(sizeof(trace_mini_t) + size * sizeof(u64));
+  u64          *hdr = NULL;
+  m->size = size;
+  last = -1;
+
+  for (k = 0; k < num_edges; ++k) {
+
+    s64 w = edges[k] >> 6;
+
+    if (w != last) {
+
+      if (hdr && w - last <= 2) {
+
+        *hdr += w - last;
+        cur += w - last;
+
+      } else {
+
+        hdr = m->data + cur + 1;
+        *hdr = ((u64)w << 32) | 1;
+        cur += 2;
+
+      }
+
+      last = w;
+
+    }
+
+    m->data[cur] |= 1ULL << (edges[k] & 63);
+
+  }
+
+  return m;
+
 }
 
 #ifndef SIMPLE_FILES
@@ -496,12 +655,124 @@ void write_crash_readme(afl_state_t *afl) {
 
 }
 
+/* Bucket of a crash with `--config crash_buckets=<n>`, from the dirty log of
+   the run, which lists reachable blocks in the order they were first reached:
+   the last target in it with all its context bits, and the last
+   `crash_bucket_depth` blocks of it. `target` and `ctx` are the target and
+   its lowest context for the crash index, or -1 if no target was reached.
+   Returns 0 if the runtime does not log reached blocks. */
+
+static u8 crash_bucket(afl_state_t *afl, u64 *bucket, s64 *target, s32 *ctx) {
+
+  afl_forkserver_t *fsrv = &afl->fsrv;
+  trace_t          *dirty = fsrv->trace_dirty;
+  if (!dirty || !fsrv->num_reachables) { return 0; }
+  size_t num = dirty->num;
+  if (num > fsrv->num_reachables) { return 0; }
+
+  u64 h = HASH_CONST;
+  *target = -1;
+  *ctx = -1;
+  for (size_t i = num; i-- > 0;) {
+
+    reach_t block = dirty->trace[i].block;
+    if (block >= fsrv->num_targets) { continue; }
+
+    u8 *cur = fsrv->trace_ctx + CTX_NUM_BYTES * block;
+    h = hash64(cur, CTX_NUM_BYTES, h ^ block);
+    *target = block;
+    for (u32 j = 0; j < CTX_SIZE; ++j) {
+
+      if (cur[j / 8] & (1 << (j % 8))) {
+
+        *ctx = j;
+        break;
+
+      }
+
+    }
+
+    break;
+
+  }
+
+  for (size_t i = num - MIN(num, (size_t)afl->crash_bucket_depth); i < num;
+       ++i) {
+
+    reach_t block = dirty->trace[i].block;
+    h = hash64((u8 *)&block, sizeof(reach_t), h);
+
+  }
+
+  *bucket = h;
+  return 1;
+
+}
+
+/* Count a crash in `bucket`; returns its number in the bucket, starting at
+   1, or 0 if the bucket already has `crash_buckets` crashes. */
+
+static u32 crash_bucket_add(afl_state_t *afl, u64 bucket) {
+
+  if (unlikely(!afl->crash_bucket_map)) {
+
+    afl->crash_bucket_map = hashmap_create(1024);
+
+  }
+
+  u32                    key = (u32)(bucket ^ (bucket >> 32));
+  struct key_value_pair *pair = hashmap_get(afl->crash_bucket_map, key);
+  uintptr_t              n = pair ? (uintptr_t)pair->value : 0;
+  if (n >= afl->crash_buckets) { return 0; }
+
+  if (pair) {
+
+    pair->value = (void *)(n + 1);
+
+  } else {
+
+    hashmap_insert(afl->crash_bucket_map, key, (void *)(n + 1));
+
+  }
+
+  return n + 1;
+
+}
+
+/* One line of crashes/index.csv for each crash kept with `crash_buckets`, so
+   triage can go through buckets instead of re-running every crash. Crashes
+   are given by their id, as their names have commas. */
+
+static void write_crash_index(afl_state_t *afl, u64 bucket, u32 sample,
+                              s64 target, s32 ctx) {
+
+  if (unlikely(!afl->crash_index)) {
+
+    u8 *tmp = alloc_printf("%s/crashes/index.csv", afl->out_dir);
+    afl->crash_index = fopen(tmp, "a");
+    if (!afl->crash_index) { PFATAL("Unable to create '%s'", tmp); }
+    ck_free(tmp);
+    if (!ftell(afl->crash_index)) {
+
+      fprintf(afl->crash_index, "id,bucket,sample,target,ctx,signal\n");
+
+    }
+
+  }
+
+  fprintf(afl->crash_index, "%06llu,%016llx,%u,%lld,%d,%u\n",
+          afl->saved_crashes, bucket, sample, (long long)target, ctx,
+          afl->fsrv.last_kill_signal);
+  fflush(afl->crash_index);
+
+}
+
 /* Check if the result of an execve() during routine fuzzing is interesting,
    save or queue the input test case for further analysis if so. Returns 1 if
    entry is saved, 0 otherwise. */
 
-u8 __attribute__((hot))
-save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
+static inline u8 __attribute__((hot))
+do_save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
 
   if (unlikely(len == 0)) {
     aflrun_recover_virgin(afl);
@@ -510,7 +781,7 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
 
   u8  fn[PATH_MAX];
   u8 *queue_fn = "";
-  u8  new_bits = 0, new_paths = 0,
+  u8  new_bits = 0, new_paths = 0, div_bits = 0,
     keeping = 0, res, classified = 0, is_timeout = 0;
   s32 fd;
   u64 cksum = 0;
@@ -546,10 +817,7 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
         is_crash ? "neg" : "pos", is_crash ? afl->total_saved_crashes : afl->total_saved_positives,
         dop, get_cur_time() - afl->start_time);
 
-      fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
-      if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", fn); }
-      ck_write(fd, mem, len, fn);
-      close(fd);
+      asyncw_write(afl, fn, mem, len, 0);
     }
   }
 
@@ -558,24 +826,65 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
     /* Keep only if there are new bits in the map, add to queue for
        future fuzzing, etc. */
 
+    if (unlikely(afl->afl_env.afl_record_traces)) {
+
+      aflrun_record_exec(afl, AFLRUN_RECORD_EXEC, afl->queued_items, len,
+                         fault, inc);
+
+    }
+
+    u64    t0 = aflrun_prof_begin(afl);
     size_t n = afl->fsrv.trace_targets->num;
     afl->virgins = afl_realloc((void **)&afl->virgins, sizeof(u8 *) * (n + 1));
     afl->clusters = afl_realloc((void **)&afl->clusters, sizeof(size_t) * (n+1));
     afl->virgins[0] = afl->virgin_bits;
     afl->clusters[0] = 0; // primary map is always cluster 0
-    afl->num_maps = aflrun_get_virgins(afl->fsrv.trace_targets->trace, n,
-      afl->virgins + 1, afl->clusters + 1) + 1;
+    afl->num_maps = 1;
+
+    /* Most runs reach neither a diversity block nor a virgin path: then only
+       the primary map is looked at, and AFLRun is not called unless it has
+       new bits, as it would find nothing new anyway. */
+    if (unlikely(n))
+      afl->num_maps += aflrun_get_virgins(afl->fsrv.trace_targets->trace, n,
+        afl->virgins + 1, afl->clusters + 1);
     new_bits = has_new_bits_unclassified(afl, afl->virgins, afl->num_maps);
     if (new_bits) {
-      classify_counts(&afl->fsrv);
+      div_bits = classify_new_bits_mul(afl, afl->virgins, &afl->new_bits,
+                                       afl->num_maps) >> 2;
       classified = 1;
-      has_new_bits_mul(afl, afl->virgins, &afl->new_bits, afl->num_maps, 0);
+      aflrun_collect_deferred_paths(afl);
     }
-    new_paths = aflrun_has_new_path(afl->fsrv.trace_freachables,
-      afl->fsrv.trace_reachables, afl->fsrv.trace_ctx,
-      afl->fsrv.trace_virgin->trace, afl->fsrv.trace_virgin->num,
-      inc, afl->queued_items,
-      new_bits ? afl->new_bits : NULL, afl->clusters, afl->num_maps);
+
+    /* Triage of foreign test cases: keep only those reaching new contexts of
+       reachable blocks or new bits in diversity maps of fringes, and drop
+       others before AFLRun or the virgin maps take note of them. */
+    u8 closer = afl->fsrv.trace_cmp && afl->fsrv.trace_cmp->closer;
+    if (unlikely(afl->import_triage) && !afl->num_new_paths && !div_bits &&
+        !closer) {
+
+      aflrun_prof_end(afl, AFLRUN_PROF_NEW_PATH, t0);
+      ++afl->import_dropped;
+      return 0;
+
+    }
+
+    if (new_bits || afl->num_new_paths)
+      new_paths = aflrun_has_new_path(afl->fsrv.trace_freachables,
+        afl->fsrv.trace_reachables, afl->fsrv.trace_ctx,
+        afl->new_paths, afl->num_new_paths,
+        inc, afl->queued_items,
+        new_bits ? afl->new_bits : NULL, afl->clusters, afl->num_maps);
+
+    /* A run getting a compare guarding a target closer to equal than any run
+       before is kept as a step towards the target, see AFLRUN_CMP_DIST. */
+    if (unlikely(closer) && !new_bits && !new_paths) {
+
+      new_paths = 1;
+      ++afl->cmp_closer;
+
+    }
+
+    aflrun_prof_end(afl, AFLRUN_PROF_NEW_PATH, t0);
 
     if (likely(!new_bits && !new_paths)) {
 
@@ -602,6 +911,7 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
     // but before that we may need to update `virgin_maps`
     // because there might be new fringes.
 
+    t0 = aflrun_prof_begin(afl);
     n = aflrun_max_clusters(afl->queued_items);
     afl->virgins = afl_realloc((void **)&afl->virgins, sizeof(u8*) * n);
     afl->clusters = afl_realloc((void **)&afl->clusters, sizeof(size_t) * n);
@@ -609,13 +919,14 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
     afl->clusters[0] = 0;
     afl->num_maps = aflrun_get_seed_virgins(
       afl->queued_items, afl->virgins + 1, afl->clusters + 1) + 1;
+    aflrun_prof_end(afl, AFLRUN_PROF_NEW_PATH, t0);
 
     if (!classified) {
-      classify_counts(&afl->fsrv);
+      classify_new_bits_mul(afl, afl->virgins, &afl->new_bits, 0);
       classified = 1;
     }
-    new_bits = has_new_bits_mul(
-      afl, afl->virgins, &afl->new_bits, afl->num_maps, 1);
+    new_bits = has_new_bits_mul_touched(
+      afl, afl->virgins, &afl->new_bits, afl->num_maps);
 
   save_to_queue:
 
@@ -632,20 +943,34 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
         alloc_printf("%s/queue/id_%06u", afl->out_dir, afl->queued_items);
 
 #endif                                                    /* ^!SIMPLE_FILES */
-    fd = open(queue_fn, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
-    if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", queue_fn); }
-    ck_write(fd, mem, len, queue_fn);
-    close(fd);
-    add_to_queue(afl, queue_fn, len, 0);
+    if (unlikely(afl->segments)) {
+
+      add_to_queue(afl, queue_fn, len, 0);
+      segments_add(afl, afl->queue_top, mem, len);
+      if (afl->shm.cmplog_mode) {
+
+        afl->queue_top->is_ascii = check_if_text(afl, afl->queue_top);
+
+      }
+
+    } else {
+
+      u64 seq = asyncw_write(afl, queue_fn, mem, len, 0);
+      add_to_queue(afl, queue_fn, len, 0);
+      afl->queue_top->write_seq = seq;
+
+    }
+
     afl->queue_top->tested = 1;
-    afl->queue_top->path_cksum = hash64(
-      afl->fsrv.trace_ctx, MAP_TR_SIZE(afl->fsrv.num_reachables), HASH_CONST);
+    afl->queue_top->path_cksum = aflrun_path_cksum(&afl->fsrv);
+    if (aflrun_sync_meta()) aflrun_write_sync_meta(afl, afl->queue_top);
 
     // If the new seed only comes from diversity or path, mark it as extra
     if ((new_bits & 3) == 0 && ((new_bits >> 2) || new_paths)) {
       ++afl->queued_extra;
       afl->queue_top->aflrun_extra = 1;
     }
+    if ((new_bits >> 2) || new_paths) ++afl->aflrun_finds;
 
 #ifdef INTROSPECTION
     if (afl->custom_mutators_count && afl->current_custom_fuzz) {
@@ -696,13 +1021,23 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
         hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
 
     /* Try to calibrate inline; this also calls update_bitmap_score() when
-       successful. */
+       successful. With AFL_CAL_DEFER, only commit the bit sequences found
+       here and calibrate once the current queue entry is done. */
 
-    res = calibrate_case(afl, afl->queue_top, mem, aflrun_queue_cycle(), 0);
+    if (unlikely(afl->cal_deferring)) {
 
-    if (unlikely(res == FSRV_RUN_ERROR)) {
+      aflrun_commit_bit_seqs(afl->clusters, afl->num_maps);
+      defer_calibration(afl, afl->queue_top, aflrun_queue_cycle());
 
-      FATAL("Unable to execute target application");
+    } else {
+
+      res = calibrate_case(afl, afl->queue_top, mem, aflrun_queue_cycle(), 0);
+
+      if (unlikely(res == FSRV_RUN_ERROR)) {
+
+        FATAL("Unable to execute target application");
+
+      }
 
     }
 
@@ -781,7 +1116,7 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
          the target with a more generous timeout (unless the default timeout
          is already generous). */
 
-      if (afl->fsrv.exec_tmout < afl->hang_tmout) {
+      if (fuzz_tmout(afl) < afl->hang_tmout) {
 
         u8  new_fault;
         u32 tmp_len = write_to_testcase(afl, &mem, len, 0);
@@ -864,7 +1199,23 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
 
       if (afl->saved_crashes >= KEEP_UNIQUE_CRASH) { return keeping; }
 
-      if (likely(!afl->non_instrumented_mode)) {
+      /* Bucketed crashes are kept by bucket instead of by new crash bits. */
+      u64 bucket = 0;
+      s64 target = -1;
+      s32 ctx = -1;
+      u32 sample = 0;
+      if (unlikely(afl->crash_buckets) &&
+          crash_bucket(afl, &bucket, &target, &ctx)) {
+
+        sample = crash_bucket_add(afl, bucket);
+        if (!sample) {
+
+          ++afl->crash_bucket_full;
+          return keeping;
+
+        }
+
+      } else if (likely(!afl->non_instrumented_mode)) {
 
         if (!classified) { classify_counts(&afl->fsrv); }
 
@@ -894,6 +1245,8 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
 
 #endif                                                    /* ^!SIMPLE_FILES */
 
+      if (sample) { write_crash_index(afl, bucket, sample, target, ctx); }
+
       ++afl->saved_crashes;
 #ifdef INTROSPECTION
       if (afl->custom_mutators_count && afl->current_custom_fuzz) {
@@ -955,10 +1308,7 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
   /* If we're here, we apparently want to save the crash or hang
      test case, too. */
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
-  if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", fn); }
-  ck_write(fd, mem, len, fn);
-  close(fd);
+  asyncw_write(afl, fn, mem, len, 0);
 
 #ifdef __linux__
   if (afl->fsrv.nyx_mode && fault == FSRV_RUN_CRASH) {
@@ -983,6 +1333,16 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
 
 }
 
+u8 __attribute__((hot))
+save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault, u8 inc) {
+
+  AFL_PROBE(afl, save_if_interesting_begin, len, fault);
+  u8 keeping = do_save_if_interesting(afl, mem, len, fault, inc);
+  AFL_PROBE(afl, save_if_interesting_end, keeping);
+  return keeping;
+
+}
+
 // Hashmap implementation
 struct hashmap* hashmap_create(u32 table_size) {
   struct hashmap* map = ck_alloc(sizeof(struct hashmap));
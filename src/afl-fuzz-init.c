@@ -25,11 +25,18 @@
 
 #include "afl-fuzz.h"
 #include "aflrun.h"
+#include "aflrun-image.h"
+#include "aflrun-registry.h"
+#include "aflrun-record.h"
+#include "afl-segments.h"
 #include "cmplog.h"
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef __linux__
+  #include <sys/syscall.h>
+#endif
 
 #ifdef HAVE_AFFINITY
 
@@ -108,6 +115,125 @@ static u8 bind_cpu(afl_state_t *afl, s32 cpuid) {
 
 }
 
+  #if defined(__linux__)
+
+    #ifndef MPOL_PREFERRED
+      #define MPOL_PREFERRED 1
+    #endif
+
+/* NUMA node of `cpuid` according to sysfs, -1 if unknown. */
+
+static s32 cpu_numa_node(s32 cpuid) {
+
+  u8             fn[PATH_MAX];
+  DIR           *d;
+  struct dirent *de;
+  s32            node = -1;
+
+  snprintf(fn, PATH_MAX, "/sys/devices/system/cpu/cpu%d", cpuid);
+  if (!(d = opendir(fn))) { return -1; }
+
+  while ((de = readdir(d))) {
+
+    if (!strncmp(de->d_name, "node", 4) && isdigit(de->d_name[4])) {
+
+      node = atoi(de->d_name + 4);
+      break;
+
+    }
+
+  }
+
+  closedir(d);
+  return node;
+
+}
+
+/* Node that instances syncing to the same directory are grouped on: the one
+   recorded in `<sync_dir>/.affinity_numa` by the first instance, or else the
+   node with most free cores. Returns -1 on machines with a single node. */
+
+static s32 numa_preferred_node(afl_state_t *afl, u8 *cpu_used, u8 *fn) {
+
+  s32 free_cnt[256] = {0}, node = -1, i;
+
+  if (access("/sys/devices/system/node/node1", F_OK)) { return -1; }
+
+  if (afl->sync_id) {
+
+    FILE *f = fopen(fn, "r");
+    if (f) {
+
+      if (fscanf(f, "%d", &node) != 1) { node = -1; }
+      fclose(f);
+      if (node >= 0) { return node; }
+
+    }
+
+  }
+
+  for (i = 0; i < afl->cpu_core_count; i++) {
+
+    s32 n = cpu_numa_node(i);
+    if (!cpu_used[i] && n >= 0 && n < 256) { ++free_cnt[n]; }
+
+  }
+
+  for (i = 0; i < 256; i++) {
+
+    if (free_cnt[i] && (node < 0 || free_cnt[i] > free_cnt[node])) {
+
+      node = i;
+
+    }
+
+  }
+
+  return node;
+
+}
+
+/* Prefer memory of the NUMA node of the core we are bound to for everything
+   allocated from now on; the AFLRun maps, virgin and cluster maps, shared
+   memory and the testcase cache are all allocated and first touched after
+   binding. The node is recorded for other instances syncing with us. */
+
+static void bind_numa_node(afl_state_t *afl, u8 *fn) {
+
+  unsigned long mask[4] = {0};
+  s32           node;
+
+  if (access("/sys/devices/system/node/node1", F_OK)) { return; }
+
+  node = cpu_numa_node(afl->cpu_aff);
+  if (node < 0 || node >= (s32)(sizeof(mask) * 8)) { return; }
+
+  mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1)) {
+
+    WARNF("Unable to prefer memory of NUMA node %d", node);
+    return;
+
+  }
+
+  OKF("Preferring memory of NUMA node %d.", node);
+
+  if (fn && access(fn, F_OK)) {
+
+    FILE *f = fopen(fn, "w");
+    if (f) {
+
+      fprintf(f, "%d\n", node);
+      fclose(f);
+
+    }
+
+  }
+
+}
+
+  #endif
+
 /* Build a list of processes bound to specific cores. Returns -1 if nothing
    can be found. Assumes an upper bound of 4k CPUs. */
 
@@ -116,6 +242,16 @@ void bind_to_free_cpu(afl_state_t *afl) {
   u8  cpu_used[4096] = {0};
   u8  lockfile[PATH_MAX] = "";
   s32 i;
+  #if defined(__linux__)
+  u8  numa_file[PATH_MAX] = "";
+  s32 numa_node, pass;
+  if (afl->sync_id) {
+
+    snprintf(numa_file, sizeof(numa_file), "%s/.affinity_numa", afl->sync_dir);
+
+  }
+
+  #endif
 
   if (afl->afl_env.afl_no_affinity && !afl->afl_env.afl_try_affinity) {
 
@@ -153,6 +289,9 @@ void bind_to_free_cpu(afl_state_t *afl) {
     } else {
 
       OKF("CPU binding request using -b %d successful.", afl->cpu_to_bind);
+  #if defined(__linux__)
+      bind_numa_node(afl, NULL);
+  #endif
 
     }
 
@@ -401,6 +540,16 @@ void bind_to_free_cpu(afl_state_t *afl) {
         "For this platform we do not have free CPU binding code yet. If possible, please supply a PR to https://github.com/AFLplusplus/AFLplusplus"
   #endif
 
+  #if defined(__linux__)
+
+  /* Try free cores of the preferred NUMA node first. */
+
+  numa_node = numa_preferred_node(afl, cpu_used, numa_file);
+  pass = numa_node < 0;
+
+next_pass:
+  #endif
+
   #if !defined(__aarch64__) && !defined(__arm__) && !defined(__arm64__)
 
   for (i = 0; i < afl->cpu_core_count; i++) {
@@ -415,6 +564,9 @@ void bind_to_free_cpu(afl_state_t *afl) {
   #endif
 
     if (cpu_used[i]) { continue; }
+  #if defined(__linux__)
+    if (!pass && cpu_numa_node(i) != numa_node) { continue; }
+  #endif
 
     OKF("Found a free CPU core, try binding to #%u.", i);
 
@@ -432,6 +584,19 @@ void bind_to_free_cpu(afl_state_t *afl) {
 
   }
 
+  #if defined(__linux__)
+  if (i == afl->cpu_core_count || i == -1) {
+
+    if (!pass++) { goto next_pass; }
+
+  } else {
+
+    bind_numa_node(afl, numa_file[0] ? numa_file : NULL);
+
+  }
+
+  #endif
+
   if (lockfile[0]) unlink(lockfile);
 
   if (i == afl->cpu_core_count || i == -1) {
@@ -472,6 +637,53 @@ static void shuffle_ptrs(afl_state_t *afl, void **ptrs, u32 cnt) {
 
 }
 
+/* Add the entries of the segment store of queue directory `dir`, if it has
+   one, in the order of their ids. Their data is copied by pivot_inputs(). */
+
+static void read_segments(afl_state_t *afl, u8 *dir) {
+
+  segments_view_t v;
+  if (segments_open(&v, dir)) { return; }
+
+  if (afl->segments_in) {
+
+    WARNF("Skipping segment store of '%s', only one can be read", dir);
+    segments_close(&v);
+    return;
+
+  }
+
+  u32  num_ids = 0, num = 0;
+  u32 *latest = segments_latest(&v, &num_ids);
+  if (!latest) { PFATAL("alloc"); }
+
+  for (u32 id = 0; id < num_ids; ++id) {
+
+    if (!latest[id]) { continue; }
+
+    const segment_rec_t *r = v.recs + latest[id] - 1;
+    if (!r->len) { continue; }
+
+    u8 dfn[PATH_MAX];
+    snprintf(dfn, PATH_MAX, "%s/.state/deterministic_done/%s", afl->in_dir,
+             r->name);
+
+    add_to_queue(afl, alloc_printf("%s/%s", dir, r->name),
+                 MIN(r->len, (u32)MAX_FILE), !access(dfn, F_OK));
+    afl->queue_top->seg_stored = 2;
+    afl->queue_top->seg_off = latest[id] - 1;
+    ++num;
+
+  }
+
+  free(latest);
+  afl->segments_in = ck_alloc(sizeof(segments_view_t));
+  *afl->segments_in = v;
+
+  OKF("Loaded %u seeds from segment store of '%s'.", num, dir);
+
+}
+
 /* Read all testcases from foreign input directories, then queue them for
    testing. Called at startup and at sync intervals.
    Does not descend into subdirectories! */
@@ -487,6 +699,12 @@ void read_foreign_testcases(afl_state_t *afl, int first) {
   u8 val_buf[2][STRINGIFY_VAL_SIZE_MAX];
   u8 foreign_name[16];
 
+  /* With AFL_IMPORT_TRIAGE, only test cases AFLRun finds new are kept, see
+     save_if_interesting(), and they are run on the forkserver pool. */
+
+  afl->import_triage = afl->afl_env.afl_import_triage && afl->is_aflrun;
+  u32 dropped = afl->import_dropped;
+
   for (iter = 0; iter < afl->foreign_sync_cnt; iter++) {
 
     if (afl->foreign_syncs[iter].dir && afl->foreign_syncs[iter].dir[0]) {
@@ -625,10 +843,21 @@ void read_foreign_testcases(afl_state_t *afl, int first) {
 
         }
 
-        u32 len = write_to_testcase(afl, (void **)&mem, st.st_size, 1);
-        fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
         afl->syncing_party = foreign_name;
-        afl->queued_imported += save_if_interesting(afl, mem, len, fault, 0);
+
+        if (afl->import_triage && afl->fsrv_pool_cnt) {
+
+          /* The pool keeps its own copy of the test case. */
+          pool_fuzz_stuff(afl, mem, st.st_size);
+
+        } else {
+
+          u32 len = write_to_testcase(afl, (void **)&mem, st.st_size, 1);
+          fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+          afl->queued_imported += save_if_interesting(afl, mem, len, fault, 0);
+
+        }
+
         afl->syncing_party = 0;
         munmap(mem, st.st_size);
         close(fd);
@@ -637,6 +866,10 @@ void read_foreign_testcases(afl_state_t *afl, int first) {
 
       }
 
+      afl->syncing_party = foreign_name;
+      pool_flush(afl);
+      afl->syncing_party = 0;
+
       afl->foreign_syncs[iter].mtime = mtime_max;
       free(nl);                                              /* not tracked */
 
@@ -644,6 +877,15 @@ void read_foreign_testcases(afl_state_t *afl, int first) {
 
   }
 
+  afl->import_triage = 0;
+
+  if (first && afl->import_dropped > dropped) {
+
+    OKF("Triage dropped %u foreign test cases with nothing new for AFLRun.",
+        afl->import_dropped - dropped);
+
+  }
+
   if (first) {
 
     afl->last_find_time = 0;
@@ -816,6 +1058,8 @@ void read_testcases(afl_state_t *afl, u8 *directory) {
 
   free(nl);                                                  /* not tracked */
 
+  read_segments(afl, dir);
+
   if (!afl->queued_items && directory == NULL) {
 
     SAYF("\n" cLRD "[-] " cRST
@@ -866,8 +1110,7 @@ void perform_dry_run(afl_state_t *afl) {
     q = afl->queue_buf[idx];
     if (unlikely(!q || q->disabled)) { continue; }
 
-    u8  res;
-    s32 fd;
+    u8 res;
 
     if (unlikely(!q->len)) {
 
@@ -882,14 +1125,19 @@ void perform_dry_run(afl_state_t *afl) {
 
     ACTF("Attempting dry run with '%s'...", fn);
 
-    fd = open(q->fname, O_RDONLY);
-    if (fd < 0) { PFATAL("Unable to open '%s'", q->fname); }
-
     u32 read_len = MIN(q->len, (u32)MAX_FILE);
     use_mem = afl_realloc(AFL_BUF_PARAM(in), read_len);
-    ck_read(fd, use_mem, read_len, q->fname);
+    if (queue_read_case(afl, q, use_mem, read_len) != (ssize_t)read_len) {
 
-    close(fd);
+      PFATAL("Short read from '%s'", q->fname);
+
+    }
+
+    if (unlikely(aflrun_seed_summary())) {
+
+      aflrun_load_summary(afl, q, use_mem);
+
+    }
 
     res = calibrate_case(afl, q, use_mem, 0, 1);
 
@@ -1196,6 +1444,13 @@ void perform_dry_run(afl_state_t *afl) {
 
   }
 
+  if (afl->summary_replayed) {
+
+    OKF("Replayed %u of %u seeds from their AFLRun summaries.",
+        afl->summary_replayed, afl->queued_items);
+
+  }
+
   if (cal_failures) {
 
     if (cal_failures == afl->queued_items) {
@@ -1221,6 +1476,7 @@ void perform_dry_run(afl_state_t *afl) {
   /* Now we remove all entries from the queue that have a duplicate trace map */
 
   u32 duplicates = 0, i;
+  u32 *removed = ck_alloc(afl->queued_items * sizeof(u32)), num_removed = 0;
 
   for (idx = 0; idx < afl->queued_items; idx++) {
 
@@ -1250,7 +1506,7 @@ void perform_dry_run(afl_state_t *afl) {
           }
 
           p->disabled = 1;
-          aflrun_remove_seed(p->id);
+          removed[num_removed++] = p->id;
           p->perf_score = 0;
 
         } else {
@@ -1264,7 +1520,7 @@ void perform_dry_run(afl_state_t *afl) {
           }
 
           q->disabled = 1;
-          aflrun_remove_seed(q->id);
+          removed[num_removed++] = q->id;
           q->perf_score = 0;
 
           done = 1;
@@ -1277,6 +1533,10 @@ void perform_dry_run(afl_state_t *afl) {
 
   }
 
+  /* Disabled entries are skipped above, so AFLRun can drop them at once. */
+  aflrun_remove_seeds(removed, num_removed);
+  ck_free(removed);
+
   if (duplicates) {
 
     afl->max_depth = 0;
@@ -1332,6 +1592,76 @@ static void link_or_copy(u8 *old_path, u8 *new_path) {
 
 }
 
+/* Carry over the AFLRun summary of input `old_path`, if any, to the entry
+   `new_path` of our queue, for the dry run to replay. */
+
+static void pivot_summary(afl_state_t *afl, u8 *old_path, u8 *new_path) {
+
+  u8 *old_name = strrchr(old_path, '/'), *new_name = strrchr(new_path, '/');
+  if (!old_name || !new_name) { return; }
+
+  u8 *src = alloc_printf("%.*s/" AFLRUN_SUMMARY_DIR "%s",
+                         (int)(old_name - old_path), old_path, old_name);
+
+  if (!access(src, F_OK)) {
+
+    u8 *dst = alloc_printf("%s/queue/" AFLRUN_SUMMARY_DIR "%s", afl->out_dir,
+                           new_name);
+    link_or_copy(src, dst);
+    ck_free(dst);
+
+  }
+
+  ck_free(src);
+
+}
+
+/* Copy the input of `q`, whose name in the output directory was just set,
+   from `old_path` or the segment store resumed from to our segment store,
+   or to a file if there is no store. */
+
+static void pivot_data(afl_state_t *afl, struct queue_entry *q, u8 *old_path) {
+
+  const u8 *mem;
+  u8       *buf = NULL;
+
+  if (q->seg_stored == 2) {
+
+    mem = segments_read(afl->segments_in, afl->segments_in->recs + q->seg_off);
+    if (!mem) { PFATAL("Unable to read '%s'", old_path); }
+    q->seg_stored = 0;
+
+  } else {
+
+    s32 fd = open(old_path, O_RDONLY);
+    if (fd < 0) { PFATAL("Unable to open '%s'", old_path); }
+    buf = ck_alloc(q->len);
+    ck_read(fd, buf, q->len, old_path);
+    close(fd);
+    mem = buf;
+
+  }
+
+  if (afl->segments) {
+
+    segments_add(afl, q, mem, q->len);
+
+  } else {
+
+    s32 fd = open(q->fname, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
+    if (fd < 0) { PFATAL("Unable to create '%s'", q->fname); }
+    ck_write(fd, mem, q->len, q->fname);
+    close(fd);
+
+  }
+
+  /* add_to_queue() could not look at data of the segment store. */
+  if (afl->shm.cmplog_mode) { q->is_ascii = check_if_text(afl, q); }
+
+  ck_free(buf);
+
+}
+
 /* Create hard links for input test cases in the output directory, choosing
    good names and pivoting accordingly. */
 
@@ -1342,6 +1672,26 @@ void pivot_inputs(afl_state_t *afl) {
 
   ACTF("Creating hard links for all input files...");
 
+  /* The AFLRun config is not loaded yet, so summaries are carried over
+     whenever the input directory has any. */
+
+  u8 *fn = alloc_printf("%s/" AFLRUN_SUMMARY_DIR, afl->in_dir);
+  u8  summaries = !access(fn, F_OK);
+  ck_free(fn);
+
+  if (summaries) {
+
+    fn = alloc_printf("%s/queue/" AFLRUN_SUMMARY_DIR, afl->out_dir);
+    if (mkdir(fn, 0700) && errno != EEXIST) {
+
+      PFATAL("Unable to create '%s'", fn);
+
+    }
+
+    ck_free(fn);
+
+  }
+
   for (i = 0; i < afl->queued_items && likely(afl->queue_buf[i]); i++) {
 
     q = afl->queue_buf[i];
@@ -1425,9 +1775,22 @@ void pivot_inputs(afl_state_t *afl) {
 
     /* Pivot to the new queue entry. */
 
-    link_or_copy(q->fname, nfn);
-    ck_free(q->fname);
-    q->fname = nfn;
+    if (unlikely(summaries)) { pivot_summary(afl, q->fname, nfn); }
+
+    if (unlikely(afl->segments || q->seg_stored)) {
+
+      u8 *old_path = q->fname;
+      q->fname = nfn;
+      pivot_data(afl, q, old_path);
+      ck_free(old_path);
+
+    } else {
+
+      link_or_copy(q->fname, nfn);
+      ck_free(q->fname);
+      q->fname = nfn;
+
+    }
 
     /* Make sure that the passed_det value carries over, too. */
 
@@ -1443,6 +1806,14 @@ void pivot_inputs(afl_state_t *afl) {
 
   }
 
+  if (afl->segments_in) {
+
+    segments_close(afl->segments_in);
+    ck_free(afl->segments_in);
+    afl->segments_in = NULL;
+
+  }
+
   if (afl->in_place_resume) { nuke_resume_dir(afl); }
 
 }
@@ -1646,6 +2017,14 @@ void nuke_resume_dir(afl_state_t *afl) {
   if (rmdir(fn) && errno != ENOENT) { goto dir_cleanup_failed; }
   ck_free(fn);
 
+  fn = alloc_printf("%s/_resume/" AFLRUN_SUMMARY_DIR, afl->out_dir);
+  if (delete_files(fn, CASE_PREFIX)) { goto dir_cleanup_failed; }
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/" SEGMENTS_DIR, afl->out_dir);
+  if (delete_files(fn, NULL)) { goto dir_cleanup_failed; }
+  ck_free(fn);
+
   fn = alloc_printf("%s/_resume", afl->out_dir);
   if (delete_files(fn, CASE_PREFIX)) { goto dir_cleanup_failed; }
   ck_free(fn);
@@ -1802,6 +2181,18 @@ static void handle_existing_out_dir(afl_state_t *afl) {
   if (delete_files(fn, CASE_PREFIX)) { goto dir_cleanup_failed; }
   ck_free(fn);
 
+  fn = alloc_printf("%s/queue/" AFLRUN_SYNC_META_DIR, afl->out_dir);
+  if (delete_files(fn, CASE_PREFIX)) { goto dir_cleanup_failed; }
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/" SEGMENTS_DIR, afl->out_dir);
+  if (delete_files(fn, NULL)) { goto dir_cleanup_failed; }
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/" AFLRUN_SUMMARY_DIR, afl->out_dir);
+  if (delete_files(fn, CASE_PREFIX)) { goto dir_cleanup_failed; }
+  ck_free(fn);
+
   /* Then, get rid of the .state subdirectory itself (should be empty by now)
      and everything matching <afl->out_dir>/queue/id:*. */
 
@@ -1822,6 +2213,10 @@ static void handle_existing_out_dir(afl_state_t *afl) {
     unlink(fn);                                            /* Ignore errors */
     ck_free(fn);
 
+    fn = alloc_printf("%s/crashes/index.csv", afl->out_dir);
+    unlink(fn);                                            /* Ignore errors */
+    ck_free(fn);
+
   }
 
   fn = alloc_printf("%s/crashes", afl->out_dir);
@@ -1938,6 +2333,10 @@ static void handle_existing_out_dir(afl_state_t *afl) {
     if (unlink(fn) && errno != ENOENT) { goto dir_cleanup_failed; }
     ck_free(fn);
 
+    fn = alloc_printf("%s/aflrun_state", afl->out_dir);
+    if (unlink(fn) && errno != ENOENT) { goto dir_cleanup_failed; }
+    ck_free(fn);
+
   }
 
   if (!afl->in_place_resume) {
@@ -2187,7 +2586,18 @@ void setup_dirs_fds(afl_state_t *afl) {
         afl->fsrv.plot_file,
         "# relative_time, cycles_done, cur_item, corpus_count, "
         "pending_total, pending_favs, map_size, saved_crashes, "
-        "saved_hangs, max_depth, execs_per_sec, total_execs, edges_found\n");
+        "saved_hangs, max_depth, execs_per_sec, total_execs, edges_found");
+
+    /* AFLRun phases in ms, see maybe_update_plot_file() */
+    if (getenv("AFLRUN_PROFILE")) {
+
+      fprintf(afl->fsrv.plot_file,
+              ", new_path_ms, fringe_ms, fringe_cov_ms, energy_ms, "
+              "cull_div_ms, merge_ms, virgin_maps");
+
+    }
+
+    fputc('\n', afl->fsrv.plot_file);
 
   } else {
 
@@ -2687,28 +3097,301 @@ static void handle_skipreq(int sig) {
 
 }
 
-/* Setup shared map for fuzzing with input via sharedmem */
+/* Handle memory report request (SIGUSR2). */
 
-void setup_testcase_shmem(afl_state_t *afl) {
+static void handle_mem_report(int sig) {
 
-  afl->shm_fuzz = ck_alloc(sizeof(sharedmem_t));
+  (void)sig;
+  afl_states_request_mem_report();
+
+}
+
+/* Setup shared map for fuzzing with input via sharedmem */
+
+static void testcase_shmem_init(sharedmem_t *shm_fuzz, afl_forkserver_t *fsrv) {
 
   // we need to set the non-instrumented mode to not overwrite the SHM_ENV_VAR
-  u8 *map = afl_shm_init(afl->shm_fuzz, MAX_FILE + sizeof(u32), 1);
-  afl->shm_fuzz->shmemfuzz_mode = 1;
+  u8 *map = afl_shm_init(shm_fuzz, MAX_FILE + sizeof(u32), 1);
+  shm_fuzz->shmemfuzz_mode = 1;
 
   if (!map) { FATAL("BUG: Zero return from afl_shm_init."); }
 
 #ifdef USEMMAP
-  setenv(SHM_FUZZ_ENV_VAR, afl->shm_fuzz->g_shm_file_path, 1);
+  setenv(SHM_FUZZ_ENV_VAR, shm_fuzz->g_shm_file_path, 1);
 #else
-  u8 *shm_str = alloc_printf("%d", afl->shm_fuzz->shm_id);
+  u8 *shm_str = alloc_printf("%d", shm_fuzz->shm_id);
   setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
   ck_free(shm_str);
 #endif
-  afl->fsrv.support_shmem_fuzz = 1;
-  afl->fsrv.shmem_fuzz_len = (u32 *)map;
-  afl->fsrv.shmem_fuzz = map + sizeof(u32);
+  fsrv->support_shmem_fuzz = 1;
+  fsrv->shmem_fuzz_len = (u32 *)map;
+  fsrv->shmem_fuzz = map + sizeof(u32);
+
+}
+
+void setup_testcase_shmem(afl_state_t *afl) {
+
+  afl->shm_fuzz = ck_alloc(sizeof(sharedmem_t));
+  testcase_shmem_init(afl->shm_fuzz, &afl->fsrv);
+
+}
+
+/* Start `fsrv`, an extra forkserver set up from afl->fsrv by the caller,
+   with its own coverage map in `shm`, AFLRun maps in `shm_run` unless it is
+   NULL, and test cases in `shm_fuzz`, or else in its `out_file`. Ids of the
+   maps and the map size are passed in environment, so they are restored for
+   afl->fsrv afterwards. `name` starts the error message about it. */
+
+static void start_extra_fsrv(afl_state_t *afl, afl_forkserver_t *fsrv,
+                             sharedmem_t *shm, aflrun_shm_t *shm_run,
+                             sharedmem_t *shm_fuzz, const char *name) {
+
+  static const char *env_vars[] = {SHM_ENV_VAR, SHM_AFLRUN_ENV_VAR,
+                                   SHM_FUZZ_ENV_VAR, "AFL_MAP_SIZE"};
+  u8  *saved[4];
+  char vbuf[16];
+  u32  i;
+
+  for (i = 0; i < 4; ++i) {
+
+    saved[i] = getenv(env_vars[i]) ? ck_strdup(getenv(env_vars[i])) : NULL;
+
+  }
+
+  snprintf(vbuf, sizeof(vbuf), "%u", fsrv->map_size);
+  setenv("AFL_MAP_SIZE", vbuf, 1);
+
+  fsrv->fsrv_kill_signal = afl->fsrv.fsrv_kill_signal;
+  fsrv->trace_bits = afl_shm_init(shm, fsrv->map_size, 0);
+
+  if (shm_run) {
+
+    fsrv->num_targets = afl->fsrv.num_targets;
+    fsrv->num_reachables = afl->fsrv.num_reachables;
+    fsrv->num_ftargets = afl->fsrv.num_ftargets;
+    fsrv->num_freachables = afl->fsrv.num_freachables;
+    fsrv->entry_funcs = afl->fsrv.entry_funcs;
+
+    aflrun_shm_init(shm_run, fsrv->num_reachables, fsrv->num_freachables, 0);
+    afl_fsrv_attach_aflrun(fsrv, shm_run, 0);
+
+  } else {
+
+    unsetenv(SHM_AFLRUN_ENV_VAR);
+
+  }
+
+  if (afl->fsrv.use_shmem_fuzz) {
+
+    testcase_shmem_init(shm_fuzz, fsrv);
+
+  } else {
+
+    unlink(fsrv->out_file);                                /* Ignore errors */
+    fsrv->out_fd =
+        open(fsrv->out_file, O_RDWR | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
+    if (fsrv->out_fd < 0) { PFATAL("Unable to create '%s'", fsrv->out_file); }
+
+  }
+
+  afl_fsrv_start(fsrv, afl->argv, &afl->stop_soon,
+                 afl->afl_env.afl_debug_child);
+
+  if (afl->fsrv.use_shmem_fuzz && !fsrv->use_shmem_fuzz) {
+
+    FATAL("%s does not take shared memory test cases", name);
+
+  }
+
+  for (i = 0; i < 4; ++i) {
+
+    if (saved[i]) {
+
+      setenv(env_vars[i], saved[i], 1);
+      ck_free(saved[i]);
+
+    } else {
+
+      unsetenv(env_vars[i]);
+
+    }
+
+  }
+
+}
+
+/* Start the extra forkservers of AFL_FSRV_POOL. Each has its own coverage,
+   AFLRun and testcase maps. Test cases are given through shared memory or
+   stdin, a pool cannot share the single file given with @@. */
+
+void setup_fsrv_pool(afl_state_t *afl) {
+
+  u32 i;
+
+  u8 fuzz_send = 0;
+  if (afl->custom_mutators_count) {
+
+    LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
+
+      if (el->afl_custom_fuzz_send) { fuzz_send = 1; }
+
+    });
+
+  }
+
+  if (afl->fsrv.nyx_mode || afl->non_instrumented_mode || fuzz_send) {
+
+    WARNF("AFL_FSRV_POOL is not supported with nyx mode, -n or custom "
+          "mutators sending test cases, not using it.");
+    afl->fsrv_pool_cnt = 0;
+    return;
+
+  }
+
+  if (!afl->fsrv.use_shmem_fuzz && !afl->fsrv.use_stdin) {
+
+    WARNF("AFL_FSRV_POOL needs test cases in shared memory or stdin, "
+          "not using it.");
+    afl->fsrv_pool_cnt = 0;
+    return;
+
+  }
+
+  afl->fsrv_pool = ck_alloc(afl->fsrv_pool_cnt * sizeof(struct fsrv_pool_entry));
+
+  for (i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    struct fsrv_pool_entry *e = afl->fsrv_pool + i;
+    afl_forkserver_t       *fsrv = &e->fsrv;
+
+    afl_fsrv_init_dup(fsrv, &afl->fsrv);
+    fsrv->target_path = afl->fsrv.target_path;
+    fsrv->qemu_mode = afl->fsrv.qemu_mode;
+    fsrv->frida_mode = afl->fsrv.frida_mode;
+    fsrv->cs_mode = afl->fsrv.cs_mode;
+    fsrv->uses_asan = afl->fsrv.uses_asan;
+    fsrv->out_file = afl->fsrv.use_shmem_fuzz
+                         ? NULL
+                         : alloc_printf("%s/.cur_input_%u", afl->tmp_dir, i);
+
+    char name[32];
+    snprintf(name, sizeof(name), "Forkserver %u of the pool", i + 1);
+    start_extra_fsrv(afl, fsrv, &e->shm, &e->shm_run, &e->shm_fuzz, name);
+
+  }
+
+  OKF("Started a pool of %u more forkservers.", afl->fsrv_pool_cnt);
+
+}
+
+void destroy_fsrv_pool(afl_state_t *afl) {
+
+  for (u32 i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    struct fsrv_pool_entry *e = afl->fsrv_pool + i;
+
+    afl_fsrv_deinit(&e->fsrv);
+    afl_shm_deinit(&e->shm);
+    aflrun_shm_deinit(&e->shm_run);
+    if (e->fsrv.shmem_fuzz) { afl_shm_deinit(&e->shm_fuzz); }
+    if (e->fsrv.out_file) {
+
+      unlink(e->fsrv.out_file);
+      ck_free(e->fsrv.out_file);
+
+    }
+
+    afl_free(e->buf);
+
+  }
+
+  ck_free(afl->fsrv_pool);
+  afl->fsrv_pool = NULL;
+  afl->fsrv_pool_cnt = 0;
+
+}
+
+/* Start the forkserver of the sanitizer build given with AFL_SAN_BINARY,
+   with its own coverage map and test case, like those of the pool. Its
+   edges may be others than those of the fast build, and it may need a
+   larger coverage map. It gets no AFLRun maps: they are never read for its
+   runs, and nothing tells whether it numbers reachables as the fast build
+   does, so its runtime keeps them in its own memory. */
+
+void setup_san_fsrv(afl_state_t *afl) {
+
+  if (afl->fsrv.nyx_mode || afl->non_instrumented_mode ||
+      afl->fsrv.qemu_mode || afl->fsrv.frida_mode || afl->fsrv.cs_mode ||
+      afl->unicorn_mode) {
+
+    WARNF("AFL_SAN_BINARY needs an instrumented build in the default mode, "
+          "not using it.");
+    return;
+
+  }
+
+  if (!afl->fsrv.use_shmem_fuzz && !afl->fsrv.use_stdin) {
+
+    WARNF("AFL_SAN_BINARY needs test cases in shared memory or stdin, "
+          "not using it.");
+    return;
+
+  }
+
+  if (access(afl->afl_env.afl_san_binary, X_OK)) {
+
+    PFATAL("Sanitizer build '%s' is not executable",
+           afl->afl_env.afl_san_binary);
+
+  }
+
+  struct san_fsrv  *s = ck_alloc(sizeof(struct san_fsrv));
+  afl_forkserver_t *fsrv = &s->fsrv;
+
+  afl_fsrv_init_dup(fsrv, &afl->fsrv);
+  fsrv->target_path = afl->afl_env.afl_san_binary;
+  fsrv->uses_asan = 1;
+  fsrv->mem_limit = 0;
+  fsrv->map_size = MAX(afl->fsrv.map_size, (u32)DEFAULT_SHMEM_SIZE);
+  fsrv->out_file = afl->fsrv.use_shmem_fuzz
+                       ? NULL
+                       : alloc_printf("%s/.san_input", afl->tmp_dir);
+
+  ACTF("Spawning sanitizer forkserver");
+  start_extra_fsrv(afl, fsrv, &s->shm, NULL, &s->shm_fuzz, "Sanitizer build");
+
+  s->tmout = afl->fsrv.exec_tmout * SAN_TMOUT_MULT;
+  s->virgin_crash = ck_alloc(fsrv->map_size);
+  memset(s->virgin_crash, 255, fsrv->map_size);
+  afl->san = s;
+
+  OKF("Sanitizer forkserver successfully started");
+
+}
+
+void destroy_san_fsrv(afl_state_t *afl) {
+
+  struct san_fsrv *s = afl->san;
+
+  afl_fsrv_deinit(&s->fsrv);
+  afl_shm_deinit(&s->shm);
+  if (s->fsrv.shmem_fuzz) { afl_shm_deinit(&s->shm_fuzz); }
+  if (s->fsrv.out_file) {
+
+    unlink(s->fsrv.out_file);
+    ck_free(s->fsrv.out_file);
+
+  }
+
+  for (u32 i = 0; i < SAN_QUEUE_MAX; ++i) {
+
+    afl_free(s->queue[i].buf);
+
+  }
+
+  ck_free(s->virgin_crash);
+  ck_free(s);
+  afl->san = NULL;
 
 }
 
@@ -2999,6 +3682,18 @@ void check_binary(afl_state_t *afl, u8 *fname) {
     FATAL("Binary is not compiled from AFLRun compiler.");
   afl->temp_dir = strdup(temp_str + strlen(AFLRUN_TEMP_SIG));
 
+  const char* img_str = memmem(
+    f_data, f_len, AFLRUN_IMAGE_SIG, sizeof(AFLRUN_IMAGE_SIG));
+  afl->aflrun_image_off =
+    img_str ? (u64)(img_str - (char*)f_data) + sizeof(AFLRUN_IMAGE_SIG) : 0;
+
+  if (memmem(f_data, f_len, AFLRUN_NO_DIV_SIG, strlen(AFLRUN_NO_DIV_SIG) + 1)) {
+
+    OKF("Binary compiled without fringe diversity detected.");
+    afl->aflrun_no_div = 1;
+
+  }
+
   if (munmap(f_data, f_len)) { PFATAL("unmap() failed"); }
 
 }
@@ -3064,6 +3759,11 @@ void setup_signal_handlers(void) {
   sa.sa_handler = handle_skipreq;
   sigaction(SIGUSR1, &sa, NULL);
 
+  /* SIGUSR2: write AFLRun memory report */
+
+  sa.sa_handler = handle_mem_report;
+  sigaction(SIGUSR2, &sa, NULL);
+
   /* Things we don't care about. */
 
   sa.sa_handler = SIG_IGN;
@@ -3104,10 +3804,237 @@ void save_cmdline(afl_state_t *afl, u32 argc, char **argv) {
 
 }
 
+/* Check that CSR table `off` of `num` rows with `elem` bytes per entry
+   lies within the image. */
+
+static u8 aflrun_image_csr_ok(const aflrun_image_t* img, u64 off_index,
+                              u64 off, u64 num, u64 elem) {
+
+  if (off_index > img->size || (img->size - off_index) / 8 < num + 1)
+    return 0;
+  const u64* index = (const u64*)((const u8*)img + off_index);
+  for (u64 i = 0; i < num; ++i)
+    if (index[i] > index[i + 1]) return 0;
+  return index[0] == 0 && off <= img->size &&
+         (img->size - off) / elem >= index[num];
+
+}
+
+/* Point the AFLRun tables into the image `img` of `size` bytes, mapped
+   from the temp dir or from the binary; `temp_dir` is NULL for the latter,
+   as it then has call hashes. */
+
+static void aflrun_image_init(afl_state_t* afl, aflrun_image_t* img,
+                              u64 size, const char* temp_dir) {
+
+  reach_t nt = img->num_targets, nr = img->num_reachables;
+  reach_t nf = img->num_freachables;
+  if (img->magic != AFLRUN_IMAGE_MAGIC ||
+      img->version != AFLRUN_IMAGE_VERSION || img->size != size)
+    FATAL(AFLRUN_IMAGE_NAME " is corrupted or of a different version");
+
+  if (img->ctx_size_pow2 != CTX_SIZE_POW2)
+    FATAL("Target is instrumented with CTX_SIZE_POW2=%u, but afl-fuzz is "
+          "built with %u", img->ctx_size_pow2, CTX_SIZE_POW2);
+  if (nt == 0 || nt > nr)
+    FATAL("Wrong number of targets and reachables");
+  if (img->num_ftargets == 0 || img->num_ftargets > nf)
+    FATAL("Wrong number of function targets and reachables");
+
+  /* The name pool ends with NUL where call hashes start, or at the end */
+  u64 names_end = img->off_call_hashes ? img->off_call_hashes : img->size;
+  if (!aflrun_image_csr_ok(img, img->off_targets_index, img->off_targets, nr,
+                           sizeof(reach_t)) ||
+      !aflrun_image_csr_ok(img, img->off_edges_index, img->off_edges, nr,
+                           sizeof(reach_t)) ||
+      !aflrun_image_csr_ok(img, img->off_dists_index, img->off_dists, nr,
+                           sizeof(aflrun_dist_t)) ||
+      img->off_target_weights > img->size ||
+      (img->size - img->off_target_weights) / sizeof(double) < nt ||
+      img->off_names_index > img->size ||
+      (img->size - img->off_names_index) / 8 < nr ||
+      img->off_fnames_index > img->size ||
+      (img->size - img->off_fnames_index) / 8 < nf ||
+      names_end > img->size || img->off_names >= names_end ||
+      ((u8*)img)[names_end - 1] != 0 ||
+      img->off_fentries > img->size ||
+      (img->size - img->off_fentries) / sizeof(reach_t) < nf ||
+      img->off_target_groups > img->size ||
+      (img->size - img->off_target_groups) / sizeof(reach_t) < nt ||
+      !(img->ctx_radius >= 0) || img->off_call_hashes > img->size ||
+      (img->size - img->off_call_hashes) / sizeof(aflrun_call_hash_t) <
+          img->num_call_hashes ||
+      (img->off_call_hashes == 0 && temp_dir == NULL))
+    FATAL(AFLRUN_IMAGE_NAME " is corrupted");
+
+  const u64* targets_index = AFLRUN_IMAGE_AT(img, off_targets_index, u64);
+  reach_t*   targets = AFLRUN_IMAGE_AT(img, off_targets, reach_t);
+  const u64* names_index = AFLRUN_IMAGE_AT(img, off_names_index, u64);
+  const u64* fnames_index = AFLRUN_IMAGE_AT(img, off_fnames_index, u64);
+  const u64* edges_index = AFLRUN_IMAGE_AT(img, off_edges_index, u64);
+  const reach_t* edges = AFLRUN_IMAGE_AT(img, off_edges, reach_t);
+  const u64* dists_index = AFLRUN_IMAGE_AT(img, off_dists_index, u64);
+  const aflrun_dist_t* dists = AFLRUN_IMAGE_AT(img, off_dists, aflrun_dist_t);
+  u64 names_size = names_end - img->off_names;
+
+  for (u64 i = 0; i < targets_index[nr]; ++i)
+    if (targets[i] >= nt) FATAL("Invalid target in " AFLRUN_IMAGE_NAME);
+  for (u64 i = 0; i < edges_index[nr]; ++i)
+    if (edges[i] >= nr) FATAL("Invalid edge in " AFLRUN_IMAGE_NAME);
+  for (u64 i = 0; i < dists_index[nr]; ++i)
+    if (dists[i].target >= nt) FATAL("Invalid distance in " AFLRUN_IMAGE_NAME);
+  for (reach_t i = 0; i < nr; ++i)
+    if (names_index[i] >= names_size ||
+        targets_index[i] == targets_index[i + 1] ||
+        dists_index[i] == dists_index[i + 1])
+      FATAL("Invalid block in " AFLRUN_IMAGE_NAME);
+  for (reach_t i = 0; i < nf; ++i)
+    if (fnames_index[i] >= names_size)
+      FATAL("Invalid function in " AFLRUN_IMAGE_NAME);
+  const reach_t* target_groups =
+    AFLRUN_IMAGE_AT(img, off_target_groups, reach_t);
+  for (reach_t i = 0; i < nt; ++i)
+    if (target_groups[i] >= nt)
+      FATAL("Invalid target group in " AFLRUN_IMAGE_NAME);
+  const aflrun_call_hash_t* hashes =
+    AFLRUN_IMAGE_AT(img, off_call_hashes, aflrun_call_hash_t);
+  for (u64 i = 0; img->off_call_hashes && i < img->num_call_hashes; ++i)
+    if (hashes[i].src >= nr || hashes[i].dst >= nr)
+      FATAL("Invalid call hash in " AFLRUN_IMAGE_NAME);
+
+  const reach_t* fentries = AFLRUN_IMAGE_AT(img, off_fentries, reach_t);
+  afl->fsrv.entry_funcs = calloc(nr, sizeof(reach_t));
+  for (reach_t i = 0; i < nf; ++i) {
+
+    if (fentries[i] == AFLRUN_NO_BLOCK) continue;
+    if (fentries[i] >= nr || afl->fsrv.entry_funcs[fentries[i]])
+      FATAL("Invalid function entry in " AFLRUN_IMAGE_NAME);
+    afl->fsrv.entry_funcs[fentries[i]] = i + 1;
+
+  }
+
+  afl->fsrv.num_targets = nt;
+  afl->fsrv.num_reachables = nr;
+  afl->fsrv.num_ftargets = img->num_ftargets;
+  afl->fsrv.num_freachables = nf;
+
+  /* Names, targets and weights point directly into the image */
+  char* names = AFLRUN_IMAGE_AT(img, off_names, char);
+  afl->reachable_names = malloc(nr * sizeof(char*));
+  afl->reachable_to_targets = malloc(nr * sizeof(reach_t*));
+  afl->reachable_to_size = malloc(nr * sizeof(reach_t));
+  for (reach_t i = 0; i < nr; ++i) {
+
+    afl->reachable_names[i] = names + names_index[i];
+    afl->reachable_to_targets[i] = targets + targets_index[i];
+    afl->reachable_to_size[i] = targets_index[i + 1] - targets_index[i];
+
+  }
+
+  afl->target_weights = AFLRUN_IMAGE_AT(img, off_target_weights, double);
+  afl->virgin_reachables = malloc(MAP_RBB_SIZE(nr));
+  afl->virgin_freachables = malloc(MAP_RF_SIZE(nf));
+
+  ACTF("Loading " AFLRUN_IMAGE_NAME "...");
+  if (img->ctx_radius != INFINITY)
+    OKF("Blocks farther than %g from all targets have no call context.",
+        img->ctx_radius);
+  aflrun_load_image(temp_dir, img);
+  aflrun_init_groups(nt);
+
+}
+
+/* Try mmap-ing `aflrun.bin` from the temp dir and pointing the AFLRun tables
+   into it; return 0 so that the caller parses the text files if the image
+   does not exist. */
+
+static u8 aflrun_temp_dir_image(afl_state_t* afl, const char* temp_dir) {
+
+  u8* img_path = alloc_printf("%s/" AFLRUN_IMAGE_NAME, temp_dir);
+  s32 fd = open(img_path, O_RDONLY);
+  ck_free(img_path);
+  if (fd < 0) return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) || (u64)st.st_size < sizeof(aflrun_image_t))
+    FATAL("Invalid " AFLRUN_IMAGE_NAME);
+
+  /* Private writable mapping, since the loaded arrays are not const */
+  aflrun_image_t* img = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (img == MAP_FAILED) PFATAL("Unable to mmap " AFLRUN_IMAGE_NAME);
+
+  aflrun_image_init(afl, img, st.st_size, temp_dir);
+  return 1;
+
+}
+
+/* Map the image embedded by AFLRUN_EMBED_IMAGE from the target binary, at
+   `aflrun_image_off` found by check_binary(), so no temp dir is needed. */
+
+void aflrun_binary_image_init(afl_state_t* afl) {
+
+  s32 fd = open(afl->fsrv.target_path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st))
+    PFATAL("Unable to open '%s'", afl->fsrv.target_path);
+
+  u64 off = afl->aflrun_image_off, delta = off % sysconf(_SC_PAGESIZE);
+  aflrun_image_t hdr;
+  if (off % 8 || off + sizeof(hdr) > (u64)st.st_size ||
+      pread(fd, &hdr, sizeof(hdr), off) != sizeof(hdr) ||
+      hdr.size < sizeof(hdr) || hdr.size > st.st_size - off)
+    FATAL("Invalid " AFLRUN_IMAGE_NAME " embedded in '%s'",
+          afl->fsrv.target_path);
+
+  /* Same private writable mapping, from the page holding the image */
+  u8* base = mmap(NULL, hdr.size + delta, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                  fd, off - delta);
+  close(fd);
+  if (base == MAP_FAILED) PFATAL("Unable to mmap " AFLRUN_IMAGE_NAME);
+
+  aflrun_image_init(afl, (aflrun_image_t*)(base + delta), hdr.size, NULL);
+
+}
+
+/* Load Fentries.txt, of which each line is `<function>,<block>` telling the
+   entry block of a reachable function, for which aflrun-pass instruments
+   the block only. An older pass does not write it, and it instruments all
+   reachable functions, so nothing is needed then. */
+
+static void aflrun_load_fentries(afl_state_t* afl, const char* temp_dir) {
+
+  u8* path = alloc_printf("%s/Fentries.txt", temp_dir);
+  FILE* fd = fopen(path, "r");
+  ck_free(path);
+  if (fd == NULL) return;
+
+  reach_t nr = afl->fsrv.num_reachables, nf = afl->fsrv.num_freachables;
+  afl->fsrv.entry_funcs = calloc(nr, sizeof(reach_t));
+  unsigned long f, b;
+  int res;
+  while ((res = fscanf(fd, "%lu,%lu\n", &f, &b)) == 2) {
+
+    if (f >= nf || b >= nr || afl->fsrv.entry_funcs[b])
+      FATAL("Invalid line in Fentries.txt");
+    afl->fsrv.entry_funcs[b] = f + 1;
+
+  }
+  if (res != EOF)
+    FATAL("Wrong format for Fentries.txt");
+
+  fclose(fd);
+
+}
+
 /* Initialize AFLRun with the temp dir */
 
 void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
 
+  aflrun_load_window(temp_dir);
+  if (aflrun_temp_dir_image(afl, temp_dir)) return;
+
   u8* bbr_path = alloc_printf("%s/BBreachable.txt", temp_dir);
   FILE* fd = fopen(bbr_path, "r");
   ck_free(bbr_path);
@@ -3145,6 +4072,11 @@ void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
   afl->target_weights =
     malloc(afl->fsrv.num_targets * sizeof(double));
 
+  /* Targets of all lines go into one array, like the CSR arrays of the
+     image, and pointers into it are only set once it stops growing */
+  size_t   targets_cap = afl->fsrv.num_reachables, num_all_targets = 0;
+  reach_t* targets = malloc(targets_cap * sizeof(reach_t));
+
   reach_t next_idx = 0;
   while (1) {
     line = NULL; len = 0;
@@ -3155,7 +4087,6 @@ void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
     }
 
     // Parse the line into targets
-    reach_t* buf = malloc(afl->fsrv.num_targets * sizeof(reach_t));
     reach_t idx = 0;
     char* iter = strchr(line, ',');
     if (iter == NULL)
@@ -3170,7 +4101,14 @@ void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
       reach_t t = strtoul(iter, &endptr, 10);
       if (t >= afl->fsrv.num_targets)
         FATAL("Invalid target in line of BBreachable.txt");
-      buf[idx++] = t;
+      if (num_all_targets == targets_cap) {
+        targets_cap *= 2;
+        targets = realloc(targets, targets_cap * sizeof(reach_t));
+        if (targets == NULL)
+          PFATAL("Unable to allocate targets of BBreachable.txt");
+      }
+      targets[num_all_targets++] = t;
+      ++idx;
       if (*endptr != ',')
         break;
       iter = endptr + 1;
@@ -3183,14 +4121,18 @@ void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
 
     if (next_idx >= afl->fsrv.num_reachables)
       FATAL("Header and countent of BBreachable.txt does not match");
-    afl->reachable_to_size[next_idx] = idx;
-    afl->reachable_to_targets[next_idx++] =
-      realloc(buf, idx * sizeof(reach_t));
+    afl->reachable_to_size[next_idx++] = idx;
     free(line);
   }
   if (next_idx != afl->fsrv.num_reachables)
     FATAL("Header and countent of BBreachable.txt does not match");
 
+  targets = realloc(targets, num_all_targets * sizeof(reach_t));
+  for (reach_t i = 0; i < next_idx; ++i) {
+    afl->reachable_to_targets[i] = targets;
+    targets += afl->reachable_to_size[i];
+  }
+
   fclose(fd);
 
   aflrun_load_freachables(
@@ -3200,6 +4142,7 @@ void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
       FATAL("Parsing Freachable.txt failed");
   afl->virgin_freachables = malloc(
     MAP_RF_SIZE(afl->fsrv.num_freachables));
+  aflrun_load_fentries(afl, temp_dir);
 
   ACTF("Loading edges...");
   aflrun_load_edges(temp_dir, afl->fsrv.num_reachables);
@@ -3207,6 +4150,7 @@ void aflrun_temp_dir_init(afl_state_t* afl, const char* temp_dir) {
   aflrun_load_dists(
     temp_dir, afl->fsrv.num_targets,
     afl->fsrv.num_reachables, afl->reachable_names);
+  aflrun_load_groups(temp_dir);
   aflrun_init_groups(afl->fsrv.num_targets);
 
 }
@@ -3282,4 +4226,98 @@ char* aflrun_find_temp(char* temp_dir) {
 
   return search_temp_dir(pwd, dir_name);
 
-}
\ No newline at end of file
+}
+
+/* Map the registry shared by instances syncing to the same directory, and
+   create it if we are the first one. */
+
+void aflrun_setup_registry(afl_state_t* afl) {
+
+  reach_t nr = afl->fsrv.num_reachables;
+  size_t  size = AFLRUN_REGISTRY_SIZE(nr);
+  u8*     fn = alloc_printf("%s/" AFLRUN_REGISTRY_NAME, afl->sync_dir);
+
+  s32 fd = open(fn, O_RDWR | O_CREAT, DEFAULT_PERMISSION);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  /* Lock so that only one instance initializes the header */
+  if (flock(fd, LOCK_EX)) PFATAL("Unable to flock() '%s'", fn);
+
+  struct stat st;
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+  if (st.st_size == 0 && ftruncate(fd, size))
+    PFATAL("Unable to resize '%s'", fn);
+  else if (st.st_size != 0 && (u64)st.st_size != size)
+    FATAL("'%s' is created for another target, please remove it", fn);
+
+  aflrun_registry_t* reg =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+
+  if (st.st_size == 0) {
+
+    reg->num_targets = afl->fsrv.num_targets;
+    reg->num_reachables = nr;
+    reg->magic = AFLRUN_REGISTRY_MAGIC;
+
+  } else if (reg->magic != AFLRUN_REGISTRY_MAGIC ||
+             reg->num_targets != afl->fsrv.num_targets ||
+             reg->num_reachables != nr) {
+
+    FATAL("'%s' is created for another target, please remove it", fn);
+
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  OKF("Sharing AFLRun state through '%s'.", fn);
+  ck_free(fn);
+  aflrun_init_registry(reg);
+
+}
+
+/* Map the seed scheduler shared by instances syncing to the same directory
+   on this host, and create it if we are the first one. */
+
+void aflrun_setup_sched(afl_state_t* afl) {
+
+  u8* fn = alloc_printf("%s/" AFLRUN_SCHED_NAME, afl->sync_dir);
+
+  s32 fd = open(fn, O_RDWR | O_CREAT, DEFAULT_PERMISSION);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  /* Lock so that only one instance initializes the header */
+  if (flock(fd, LOCK_EX)) PFATAL("Unable to flock() '%s'", fn);
+
+  struct stat st;
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+  if (st.st_size == 0 && ftruncate(fd, AFLRUN_SCHED_SIZE))
+    PFATAL("Unable to resize '%s'", fn);
+  else if (st.st_size != 0 && (u64)st.st_size != AFLRUN_SCHED_SIZE)
+    FATAL("'%s' is of another version, please remove it", fn);
+
+  aflrun_sched_t* sched =
+      mmap(NULL, AFLRUN_SCHED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (sched == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+
+  if (st.st_size == 0) {
+
+    sched->num_slots = AFLRUN_SCHED_SLOTS;
+    sched->magic = AFLRUN_SCHED_MAGIC;
+
+  } else if (sched->magic != AFLRUN_SCHED_MAGIC ||
+             sched->num_slots != AFLRUN_SCHED_SLOTS) {
+
+    FATAL("'%s' is of another version, please remove it", fn);
+
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  OKF("Sharing seed energy through '%s'.", fn);
+  ck_free(fn);
+  afl->aflrun_sched = sched;
+
+}
@@ -39,6 +39,9 @@ void run_afl_custom_queue_new_entry(afl_state_t *afl, struct queue_entry *q,
 
     u8 updated = 0;
 
+    /* Mutators may read the file, whose write `q` has no number of yet */
+    asyncw_flush(afl);
+
     LIST_FOREACH(&afl->custom_mutator_list, struct custom_mutator, {
 
       if (el->afl_custom_queue_new_entry) {
@@ -71,8 +74,35 @@ void run_afl_custom_queue_new_entry(afl_state_t *afl, struct queue_entry *q,
 
 }
 
+/* AFLRun view of seed `id` for custom mutators, see aflrun_seed_info_t */
+
+static void aflrun_custom_seed_info(afl_state_t *afl, u32 id,
+                                    aflrun_seed_info_t *info) {
+
+  info->num_fringes =
+      aflrun_get_seed_fringes(id, &info->fringes, &info->target_dists);
+  info->num_decisives = aflrun_get_seed_decisives(id, &info->decisives);
+  info->focus = aflrun_seed_focus(id);
+  info->num_targets = afl->fsrv.num_targets;
+  info->mode = aflrun_get_mode();
+
+  if (id < afl->queued_items) {
+
+    info->quant_score = afl->queue_buf[id]->quant_score;
+    info->perf_score = afl->queue_buf[id]->perf_score;
+
+  } else {
+
+    info->quant_score = info->perf_score = 0;
+
+  }
+
+}
+
 void setup_custom_mutators(afl_state_t *afl) {
 
+  afl->aflrun_seed_info = aflrun_custom_seed_info;
+
   /* Try mutator library first */
   struct custom_mutator *mutator;
   u8                    *fn = afl->afl_env.afl_custom_mutator_library;
@@ -453,7 +483,7 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
     sprintf(afl->stage_name_buf, "ptrim %s",
             u_stringify_int(val_buf, trim_exec));
 
-    u64 cksum, pcksum;
+    u64 cksum;
 
     size_t retlen = mutator->afl_custom_trim(mutator->data, &retbuf);
 
@@ -508,14 +538,13 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
 
         classify_counts(&afl->fsrv);
         cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
-        pcksum = hash64(
-          afl->fsrv.trace_ctx, MAP_TR_SIZE(afl->fsrv.num_reachables), HASH_CONST);
 
       }
 
     }
 
-    if (likely(retlen && cksum == q->exec_cksum && pcksum == q->path_cksum)) {
+    if (likely(retlen && cksum == q->exec_cksum &&
+               aflrun_path_cksum(&afl->fsrv) == q->path_cksum)) {
 
       /* Let's save a clean trace, which will be needed by
          update_bitmap_score once we're done with the trimming stuff.
@@ -585,6 +614,7 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
 
     s32 fd;
 
+    asyncw_wait(afl, q->write_seq);
     unlink(q->fname);                                      /* ignore errors */
 
     fd = open(q->fname, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
@@ -0,0 +1,238 @@
+/*
+ * This implements the rate-limited log of afl-fuzz when not on a tty, see
+ * AFL_NO_UI_LOG_INTERVAL in docs/env_variables.md
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "afl-fuzz.h"
+#include "aflrun.h"
+
+/* Seeds fuzzed are only counted by the fuzzing loop, which renders one line
+   for all of them at most every `interval_ms` into `tmp` and publishes it
+   into `buf`. The flusher thread wakes up every `interval_ms` and writes the
+   published line, if any, to stdout. As for the Prometheus exporter, the
+   fuzzing loop only tries the lock, and nothing of afl-fuzz or AFLRun is
+   touched by the flusher thread. */
+
+struct afl_nottylog {
+
+  pthread_mutex_t lock;
+
+  u64  interval_ms;
+  u8   json;
+  u8   pending;                          /* `buf` not written yet         */
+  u64  last_render_ms;
+  u64  num_seeds, num_execs;             /* Since the last rendered line  */
+  u64  last_execs;
+  char buf[NOTTYLOG_MAX_SIZE];           /* Published line, under `lock`  */
+  char tmp[NOTTYLOG_MAX_SIZE];           /* Line being rendered           */
+  char out[NOTTYLOG_MAX_SIZE];           /* Line of the flusher thread    */
+
+};
+
+static size_t nottylog_render(afl_state_t *afl, struct afl_nottylog *p,
+                              u64 cur_ms) {
+
+  static const char mode_c[] = {'C', 'N', 'P', 'T', 'U'};
+
+  struct queue_entry *q = afl->queue_cur;
+  u32                 idx = afl->is_aflrun ? afl->aflrun_idx
+                            : (afl->old_seed_selection ? afl->current_entry
+                                                       : afl->runs_in_current_cycle);
+
+  reach_t num_reached, num_freached, num_reached_targets, num_freached_targets;
+  aflrun_get_reached(&num_reached, &num_freached, &num_reached_targets,
+                     &num_freached_targets);
+
+  int    cycle_count;
+  u32    cov_quant;
+  size_t div_num_invalid, div_num_fringes;
+  aflrun_get_state(&cycle_count, &cov_quant, &div_num_invalid,
+                   &div_num_fringes);
+
+  u64 last[8];
+  aflrun_get_time(last, last + 1, last + 2, last + 3, last + 4, last + 5,
+                  last + 6, last + 7);
+  for (u32 i = 0; i < 8; ++i) {
+
+    last[i] = cur_ms > last[i] ? (cur_ms - last[i]) / 1000 : 0;
+
+  }
+
+  u8 mode = aflrun_get_mode();
+  u32 hits = likely(afl->n_fuzz) ? afl->n_fuzz[q->n_fuzz_entry] : 0;
+  double exec_ratio =
+      (double)afl->exec_time * 100 / (afl->exec_time + afl->fuzz_time);
+  double exec_ratio_short = (double)afl->exec_time_short * 100 /
+                            (afl->exec_time_short + afl->fuzz_time_short);
+  double prof = afl->aflrun_profile ? aflrun_runtime_ratio(afl) : 0;
+  u64    span_ms = cur_ms - (p->last_render_ms ? p->last_render_ms
+                                               : afl->start_time);
+
+  int len;
+  if (p->json) {
+
+    len = snprintf(
+        p->tmp, sizeof(p->tmp),
+        "{\"time_ms\":%llu,\"span_ms\":%llu,\"seeds\":%llu,\"execs\":%llu,"
+        "\"seed\":{\"id\":%u,\"idx\":%u,\"perf_score\":%0.0f,"
+        "\"quant_score\":%0.0f,\"exec_us\":%llu,\"hits\":%u,\"map\":%u,"
+        "\"ascii\":%u},\"queued\":%u,\"disabled\":%u,\"crashes\":%llu,"
+        "\"mode\":\"%c\",\"cycle\":%d,\"queue_cycle\":%llu,"
+        "\"cov_quant\":%u,\"div_invalid\":%zu,\"div_fringes\":%zu,"
+        "\"since_last\":[%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu],"
+        "\"reached\":%llu,\"reachables\":%llu,\"reached_targets\":%llu,"
+        "\"targets\":%llu,\"aflrun_ratio\":%0.02f,\"exec_ratio\":%0.02f,"
+        "\"exec_ratio_short\":%0.02f,\"quantum_ratio\":%0.02f}\n",
+        cur_ms, span_ms, p->num_seeds, p->num_execs, q->id, idx,
+        q->perf_score, q->quant_score, q->exec_us, hits, q->bitmap_size,
+        q->is_ascii, afl->queued_items, afl->queued_extra_disabled,
+        afl->saved_crashes, mode_c[mode], cycle_count, aflrun_queue_cycle(),
+        cov_quant, div_num_invalid, div_num_fringes, last[0], last[1],
+        last[2], last[3], last[4], last[5], last[6], last[7],
+        (u64)num_reached, (u64)afl->fsrv.num_reachables,
+        (u64)num_reached_targets, (u64)afl->fsrv.num_targets, prof,
+        exec_ratio, exec_ratio_short, afl->quantum_ratio * 100);
+
+  } else {
+
+    u8 prof_s[32] = "";
+    if (afl->aflrun_profile) {
+
+      snprintf(prof_s, sizeof(prof_s), "%0.02f%%, ", prof);
+
+    }
+
+    len = snprintf(
+        p->tmp, sizeof(p->tmp),
+        cLBL "[*] " cRST
+             "%llu seeds, %llu execs in %llu ms, last #%u,%u (%u total, %u "
+             "disabled, %llu crashes saved, perf_score=%0.0f, "
+             "quant_score=%0.0f, exec_us=%llu, hits=%u, map=%u, ascii=%u) "
+             "%c,%d,%llu,%u %zu/%zu %llu/%llu/%llu/%llu %llu/%llu/%llu/%llu "
+             "%llu/%llu(%llu%%) %llu/%llu(%llu%%) "
+             "%s%0.02f%%, %0.02f%%, %0.02f%%\n",
+        p->num_seeds, p->num_execs, span_ms, q->id, idx, afl->queued_items,
+        afl->queued_extra_disabled, afl->saved_crashes, q->perf_score,
+        q->quant_score, q->exec_us, hits, q->bitmap_size, q->is_ascii,
+        mode_c[mode], cycle_count, aflrun_queue_cycle(), cov_quant,
+        div_num_invalid, div_num_fringes, last[0], last[1], last[2], last[3],
+        last[4], last[5], last[6], last[7], (u64)num_reached,
+        (u64)afl->fsrv.num_reachables,
+        100uLL * num_reached / afl->fsrv.num_reachables,
+        (u64)num_reached_targets, (u64)afl->fsrv.num_targets,
+        100uLL * num_reached_targets / afl->fsrv.num_targets, prof_s,
+        exec_ratio, exec_ratio_short, afl->quantum_ratio * 100);
+
+  }
+
+  if (len < 0) { return 0; }
+  if ((size_t)len >= sizeof(p->tmp)) {
+
+    /* Keep lines whole, even if cut. */
+    len = sizeof(p->tmp) - 1;
+    p->tmp[len - 1] = '\n';
+
+  }
+
+  return len;
+
+}
+
+static void *nottylog_thread(void *arg) {
+
+  struct afl_nottylog *p = arg;
+  struct timespec      ts = {.tv_sec = p->interval_ms / 1000,
+                             .tv_nsec = (p->interval_ms % 1000) * 1000000};
+
+  while (1) {
+
+    nanosleep(&ts, NULL);
+
+    u8 flush = 0;
+    pthread_mutex_lock(&p->lock);
+    if (p->pending) {
+
+      memcpy(p->out, p->buf, sizeof(p->out));
+      p->pending = 0;
+      flush = 1;
+
+    }
+
+    pthread_mutex_unlock(&p->lock);
+
+    if (flush) {
+
+      fputs(p->out, stdout);
+      fflush(stdout);
+
+    }
+
+  }
+
+  return NULL;
+
+}
+
+void nottylog_init(afl_state_t *afl) {
+
+  struct afl_nottylog *p = ck_alloc(sizeof(struct afl_nottylog));
+  pthread_mutex_init(&p->lock, NULL);
+
+  p->interval_ms = NOTTYLOG_DEFAULT_MS;
+  if (afl->afl_env.afl_no_ui_log_interval) {
+
+    char *end;
+    p->interval_ms = strtoull(afl->afl_env.afl_no_ui_log_interval, &end, 10);
+    if (end == (char *)afl->afl_env.afl_no_ui_log_interval || *end ||
+        p->interval_ms == 0) {
+
+      FATAL("Invalid AFL_NO_UI_LOG_INTERVAL '%s'",
+            afl->afl_env.afl_no_ui_log_interval);
+
+    }
+
+  }
+
+  p->json = afl->afl_env.afl_no_ui_log_json;
+
+  start_detached_thread(nottylog_thread, p, "log flusher");
+
+  afl->nottylog = p;
+  OKF("Logging at most every %llu ms%s.", p->interval_ms,
+      p->json ? " as JSON lines" : "");
+
+}
+
+/* Called for each seed fuzzed, instead of printing two lines for it. */
+
+void nottylog_seed(afl_state_t *afl) {
+
+  struct afl_nottylog *p = afl->nottylog;
+  u64                  cur_ms = get_cur_time();
+
+  ++p->num_seeds;
+  if (cur_ms - p->last_render_ms < p->interval_ms) { return; }
+
+  p->num_execs += afl->fsrv.total_execs - p->last_execs;
+  p->last_execs = afl->fsrv.total_execs;
+
+  size_t len = nottylog_render(afl, p, cur_ms);
+
+  /* Keep counting, and retry at the next seed if the flusher is copying. */
+  if (pthread_mutex_trylock(&p->lock)) { return; }
+  memcpy(p->buf, p->tmp, len);
+  p->buf[len] = 0;
+  p->pending = 1;
+  pthread_mutex_unlock(&p->lock);
+
+  p->last_render_ms = cur_ms;
+  p->num_seeds = 0;
+  p->num_execs = 0;
+
+}
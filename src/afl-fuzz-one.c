@@ -25,6 +25,7 @@
 
 #include "afl-fuzz.h"
 #include "aflrun.h"
+#include "afl-probes.h"
 #include <string.h>
 #include <limits.h>
 #include "cmplog.h"
@@ -71,6 +72,141 @@ static int select_algorithm(afl_state_t *afl, u32 max_algorithm) {
 
 }
 
+/* Pick a queue entry other than the current one to splice it with, one of
+   the AFLRun splice partners of the current one if there are any, and a
+   random one otherwise or if the partner drawn is unfit. */
+static inline u32 splice_pick(afl_state_t *afl, u8 no_extra) {
+
+  u32 tid;
+  if (afl->splice_partners_cnt) {
+
+    tid = afl->splice_partners[rand_below(afl, afl->splice_partners_cnt)];
+    if (likely(tid < afl->queued_items && tid != afl->current_entry &&
+               afl->queue_buf[tid]->len >= 4 &&
+               !(no_extra && afl->queue_buf[tid]->aflrun_extra))) {
+
+      return tid;
+
+    }
+
+  }
+
+  do {
+
+    tid = rand_below(afl, afl->queued_items);
+
+  } while (unlikely(tid == afl->current_entry ||
+                    afl->queue_buf[tid]->len < 4 ||
+                    (no_extra && afl->queue_buf[tid]->aflrun_extra)));
+
+  return tid;
+
+}
+
+/* Set the splice partners of the current entry, if `splice_fringe` is on. */
+static inline void splice_partners_update(afl_state_t *afl) {
+
+  afl->splice_partners_cnt = 0;
+  if (afl->is_aflrun && afl->splice_fringe) {
+
+    afl->splice_partners_cnt =
+        aflrun_get_splice_partners(afl->current_entry, &afl->splice_partners);
+
+  }
+
+}
+
+/* First case of each class of havoc operators in the switch of fuzz_one(),
+   as scheduled by `op_sched`: bit flips, interesting values, arithmetics,
+   random bytes, clones and inserts, overwrites, byte tweaks, deletions, and
+   dictionary and splicing cases up to `r_max`. */
+
+static const u32 havoc_op_begin[AFLRUN_HAVOC_OPS] = {0,  4,  16, 40, 44,
+                                                     48, 52, 57, 65};
+
+static inline u32 havoc_op_end(u32 k, u32 r_max) {
+
+  return k + 1 < AFLRUN_HAVOC_OPS ? havoc_op_begin[k + 1] : r_max;
+
+}
+
+/* Draw a case of the havoc switch, from cumulative probabilities `cdf` of the
+   classes if `op_sched` is on, and mark its class in `used`. */
+
+static inline u32 havoc_op_draw(afl_state_t *afl, const double *cdf,
+                                u32 r_max, u32 *used) {
+
+  if (likely(!cdf)) { return rand_below(afl, r_max); }
+
+  double x = rand_next_percent(afl);
+  u32    k = 0;
+  while (k + 1 < AFLRUN_HAVOC_OPS && x >= cdf[k]) {
+
+    ++k;
+
+  }
+
+  u32 begin = havoc_op_begin[k], end = havoc_op_end(k, r_max);
+  if (unlikely(begin >= end)) { return rand_below(afl, r_max); }
+
+  *used |= 1 << k;
+  return begin + rand_below(afl, end - begin);
+
+}
+
+/* Add `n` bytes at `pos` to the span of out_buf changed by the havoc
+   operators of the current execution, which is all of it after a change of
+   size (n = UINT32_MAX). Only that span is restored from in_buf and, with
+   AFL_SHMEM_DELTA, written to the shared memory testcase. */
+
+static inline void havoc_touch(afl_state_t *afl, u32 pos, u32 n) {
+
+  if (pos < afl->havoc_lo) { afl->havoc_lo = pos; }
+  if (pos + n > afl->havoc_hi) { afl->havoc_hi = pos + n; }
+
+}
+
+/* Position below `limit` for a havoc operator changing `n` bytes there:
+   three times out of four in one of the regions of the current entry found
+   by influence_stage(), if there are any. */
+
+static inline u32 havoc_pos(afl_state_t *afl, u32 limit, u32 n) {
+
+  struct queue_entry *q = afl->queue_cur;
+  u32                 pos;
+  if (likely(!q->infl_cnt) || !rand_below(afl, 4)) {
+
+    pos = rand_below(afl, limit);
+
+  } else {
+
+    pos = q->infl_regions[rand_below(afl, q->infl_cnt)] * q->infl_size +
+          rand_below(afl, q->infl_size);
+    if (pos >= limit) { pos = rand_below(afl, limit); }
+
+  }
+
+  havoc_touch(afl, pos, n);
+  return pos;
+
+}
+
+/* Same as havoc_pos(), for a bit of the first `len` bytes. */
+
+static inline u32 havoc_bit(afl_state_t *afl, u32 len) {
+
+  if (likely(!afl->queue_cur->infl_cnt)) {
+
+    u32 bit = rand_below(afl, len << 3);
+    havoc_touch(afl, bit >> 3, 1);
+    return bit;
+
+  }
+
+  return (havoc_pos(afl, len, 1) << 3) + rand_below(afl, 8);
+
+}
+
 /* Helper to choose random block len for block operations in fuzz_one().
    Doesn't return zero, provided that max_len is > 0. */
 
@@ -366,7 +502,11 @@ static void locate_diffs(u8 *ptr1, u8 *ptr2, u32 len, s32 *first, s32 *last) {
 
 static void log_when_no_tty(afl_state_t *afl) {
 
-  if (unlikely(afl->not_on_tty)) {
+  if (unlikely(afl->nottylog)) {
+
+    nottylog_seed(afl);
+
+  } else if (unlikely(afl->not_on_tty)) {
 
     u32 idx = afl->is_aflrun ? afl->aflrun_idx :
       (afl->old_seed_selection ? afl->current_entry : afl->runs_in_current_cycle);
@@ -397,12 +537,12 @@ static void log_when_no_tty(afl_state_t *afl) {
     aflrun_get_time(&last_reachable, &last_fringe, &last_pro_fringe,
       &last_target, &last_ctx_reachable, &last_ctx_fringe,
       &last_ctx_pro_fringe, &last_ctx_target);
+    u8 prof[32] = "";
+    if (afl->aflrun_profile)
+      snprintf(prof, sizeof(prof), "%0.02f%%, ", aflrun_runtime_ratio(afl));
     ACTF("%c,%d,%llu,%u %lu/%lu %llu/%llu/%llu/%llu %llu/%llu/%llu/%llu "
         "%llu/%llu(%llu%%) %llu/%llu(%llu%%) "
-#ifdef AFLRUN_OVERHEAD
-        "%0.02f%%, "
-#endif // AFLRUN_OVERHEAD
-        "%0.02f%%, %0.02f%%, %0.02f%%",
+        "%s%0.02f%%, %0.02f%%, %0.02f%%",
       mode_c[mode], cycle_count, aflrun_queue_cycle(), cov_quant,
       div_num_invalid, div_num_fringes,
       (t - last_reachable) / 1000, (t - last_fringe) / 1000,
@@ -412,11 +552,7 @@ static void log_when_no_tty(afl_state_t *afl) {
       (u64)num_reached, (u64)afl->fsrv.num_reachables,
       100uLL * num_reached / afl->fsrv.num_reachables,
       (u64)num_reached_targets, (u64)afl->fsrv.num_targets,
-      100uLL * num_reached_targets / afl->fsrv.num_targets,
-#ifdef AFLRUN_OVERHEAD
-      (double)afl->fsrv.trace_virgin->overhead * 100 /
-      (afl->exec_time + afl->fuzz_time),
-#endif // AFLRUN_OVERHEAD
+      100uLL * num_reached_targets / afl->fsrv.num_targets, prof,
       (double)afl->exec_time * 100 /
         (afl->exec_time + afl->fuzz_time),
       (double)afl->exec_time_short * 100 /
@@ -430,6 +566,167 @@ static void log_when_no_tty(afl_state_t *afl) {
 
 }
 
+/* With `--config budget_stages=1`, executions of trimming, colorization and
+   deterministic stages are charged against the executions an AFLRun seed
+   gets from its quant, and a stage is skipped if it is expected to cost more
+   than what is left. Deterministic stages are cut short once nothing is
+   left; they are then tried again next time, as the seed is not marked as
+   done. What remains goes to custom mutators, havoc and splicing. */
+
+static inline u32 aflrun_budget_left(afl_state_t *afl, u32 num_execs,
+                                     u64 start) {
+
+  u64 spent = afl->fsrv.total_execs - start;
+  return spent < num_execs ? num_execs - spent : 0;
+
+}
+
+/* With `--config influence_execs=<n>`, a seed left with at least 8 times
+   as many executions gets n + 1 of them spent once on finding the regions of
+   its input influencing its path: regions of len / n bytes rounded up are
+   inverted one at a time, and those changing the checksum of `trace_ctx`
+   from the one of the unchanged input are kept in the entry for havoc_pos(),
+   unless all of them do. The executions are taken from `*num_execs`. Returns
+   1 if fuzzing should be abandoned. */
+
+static u8 influence_stage(afl_state_t *afl, u8 *buf, u32 len, u32 *num_execs) {
+
+  struct queue_entry *q = afl->queue_cur;
+  u32                 budget = afl->influence_execs;
+
+  if (likely(!budget) || q->infl_done || len < 2 || *num_execs / 8 < budget) {
+
+    return 0;
+
+  }
+
+  q->infl_done = 1;
+
+  u32 size = (len + budget - 1) / budget, num = (len + size - 1) / size;
+
+  afl->stage_name = "run-infl";
+  afl->stage_short = "run-infl";
+  afl->stage_max = num + 1;
+  afl->stage_cur = 0;
+  afl->stage_cur_byte = -1;
+  *num_execs -= num + 1;
+
+  if (common_fuzz_stuff(afl, buf, len)) { return 1; }
+  u64 base = aflrun_path_cksum(&afl->fsrv);
+
+  u32 *regions = ck_alloc(num * sizeof(u32)), cnt = 0;
+  for (u32 i = 0; i < num; ++i) {
+
+    u32 begin = i * size, end = MIN(begin + size, len);
+    afl->stage_cur = i + 1;
+    afl->stage_cur_byte = begin;
+
+    for (u32 j = begin; j < end; ++j) {
+
+      buf[j] ^= 0xff;
+
+    }
+
+    u8 stop = common_fuzz_stuff(afl, buf, len);
+
+    for (u32 j = begin; j < end; ++j) {
+
+      buf[j] ^= 0xff;
+
+    }
+
+    if (stop) {
+
+      ck_free(regions);
+      return 1;
+
+    }
+
+    if (aflrun_path_cksum(&afl->fsrv) != base) { regions[cnt++] = i; }
+
+  }
+
+  afl->stage_cur_byte = -1;
+
+  if (cnt == 0 || cnt == num) {
+
+    ck_free(regions);
+    return 0;
+
+  }
+
+  q->infl_regions = regions;
+  q->infl_cnt = cnt;
+  q->infl_size = size;
+  return 0;
+
+}
+
+/* With `--config focus_det=1`, if byte `pos` of `q` is in one of the regions
+   found by influence_stage(), or `q` has none. */
+
+static u8 det_focused(struct queue_entry *q, u32 pos) {
+
+  if (likely(!q->infl_cnt)) { return 1; }
+
+  u32 r = pos / q->infl_size, lo = 0, hi = q->infl_cnt;
+  while (lo < hi) {
+
+    u32 mid = (lo + hi) / 2;
+    if (q->infl_regions[mid] < r) {
+
+      lo = mid + 1;
+
+    } else {
+
+      hi = mid;
+
+    }
+
+  }
+
+  return lo < q->infl_cnt && q->infl_regions[lo] == r;
+
+}
+
+/* Number of the `len` bytes of `q` for which det_focused() holds. */
+
+static u32 det_focus_len(struct queue_entry *q, u32 len) {
+
+  if (likely(!q->infl_cnt)) { return len; }
+
+  u32 ret = 0;
+  for (u32 i = 0; i < q->infl_cnt; ++i) {
+
+    u32 begin = q->infl_regions[i] * q->infl_size;
+    if (begin < len) { ret += MIN(q->infl_size, len - begin); }
+
+  }
+
+  return ret;
+
+}
+
+/* Executions trim_case() needs at most for `len` bytes, if nothing is
+   trimmed. */
+
+static u32 aflrun_trim_execs(u32 len) {
+
+  if (len < 5) { return 0; }
+
+  u32 len_p2 = next_pow2(len), execs = 0;
+  for (u32 remove_len = MAX(len_p2 / TRIM_START_STEPS, (u32)TRIM_MIN_BYTES);
+       remove_len >= MAX(len_p2 / TRIM_END_STEPS, (u32)TRIM_MIN_BYTES);
+       remove_len >>= 1) {
+
+    execs += len / remove_len;
+
+  }
+
+  return execs;
+
+}
+
 /* Take the current entry from the queue, fuzz it for a while. This
    function is a tad too long... returns 0 if fuzzed successfully, 1 if
    skipped or bailed out. */
@@ -442,6 +739,10 @@ u8 fuzz_one_original(afl_state_t *afl) {
   u8 *in_buf, *out_buf, *orig_in, *ex_tmp, *eff_map = 0;
   u64 havoc_queued = 0, orig_hit_cnt, new_hit_cnt = 0, prev_cksum, _prev_cksum;
   u32 splice_cycle = 0, retry_splicing_times, eff_cnt = 1, num_execs = UINT_MAX;
+  u64 budget_start = 0;
+  u8  budget = afl->is_aflrun && aflrun_budget_stages();
+  u8  focus = afl->is_aflrun && afl->focus_det;
+  u32 focus_skip = 0;
   double perf_score = 100, orig_perf;
 
   u8 ret_val = 1, doing_det = 0;
@@ -520,6 +821,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
 #endif                                                     /* ^IGNORE_FINDS */
 
   log_when_no_tty(afl);
+  splice_partners_update(afl);
 
   orig_in = in_buf = queue_testcase_get(afl, afl->queue_cur);
   len = afl->queue_cur->len;
@@ -567,10 +869,15 @@ u8 fuzz_one_original(afl_state_t *afl) {
    * TRIMMING *
    ************/
 
+  budget_start = afl->fsrv.total_execs;
+
   if (unlikely(!afl->non_instrumented_mode && !afl->queue_cur->trim_done &&
                !afl->disable_trim && (!afl->is_aflrun ||
                  // In aflrun mode, we only trim when quant is large enough
-                 afl->queue_cur->quant_score > afl->trim_thr))) {
+                 afl->queue_cur->quant_score > afl->trim_thr) &&
+               (!budget || aflrun_trim_execs(afl->queue_cur->len) <=
+                   QUANTUM_TIME * aflrun_visit_quant(afl, afl->queue_cur) /
+                   afl->queue_cur->exec_us))) {
 
     u32 old_len = afl->queue_cur->len;
 
@@ -607,7 +914,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
    * PERFORMANCE SCORE *
    *********************/
   if (likely(afl->is_aflrun)) {
-    orig_perf = perf_score = afl->queue_cur->quant_score;
+    orig_perf = perf_score = aflrun_visit_quant(afl, afl->queue_cur);
     // num_execs = 0.1s * (1 / exec_us) * quantum
     num_execs = QUANTUM_TIME * perf_score / afl->queue_cur->exec_us;
 
@@ -638,7 +945,9 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   if (unlikely(afl->shm.cmplog_mode &&
                afl->queue_cur->colorized < afl->cmplog_lvl &&
-               (u32)len <= afl->cmplog_max_filesize)) {
+               (u32)len <= afl->cmplog_max_filesize &&
+               (!budget ||
+                len <= aflrun_budget_left(afl, num_execs, budget_start)))) {
 
     if (unlikely(len < 4)) {
 
@@ -652,6 +961,7 @@ u8 fuzz_one_original(afl_state_t *afl) {
           !(afl->fsrv.total_execs % afl->queued_items) ||
           get_cur_time() - afl->last_find_time > 300000) {  // 300 seconds
 
+        afl->cmplog_exec_limit = budget ? budget_start + num_execs : 0;
         if (input_to_state_stage(afl, in_buf, out_buf, len)) {
 
           goto abandon_entry;
@@ -679,6 +989,15 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   }
 
+  /* In budgeted mode, skip it if there is not enough for bitflip 1/1. */
+
+  if (unlikely(budget) &&
+      len * 8 > aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto custom_mutator_stage;
+
+  }
+
   /* Skip deterministic fuzzing if exec path checksum puts this out of scope
      for this main instance. */
 
@@ -690,6 +1009,29 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   }
 
+  /* With `focus_det`, only seeds covering a progressive fringe or a target
+     get deterministic stages, which then skip the bytes outside of their
+     influential regions, found here first if needed. Bitflip 1/1 of the
+     remaining bytes has to fit into the executions of the seed. */
+
+  if (unlikely(focus)) {
+
+    if (!aflrun_seed_focus(afl->queue_cur->id)) { goto custom_mutator_stage; }
+
+    u32 left = num_execs;
+    if (influence_stage(afl, out_buf, len, &left)) { goto abandon_entry; }
+    if (!budget) { num_execs = left; }
+
+    if (det_focus_len(afl->queue_cur, len) * 8 >
+        (budget ? aflrun_budget_left(afl, num_execs, budget_start)
+                : num_execs)) {
+
+      goto custom_mutator_stage;
+
+    }
+
+  }
+
   doing_det = 1;
 
   /*********************************************
@@ -728,6 +1070,15 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
     afl->stage_cur_byte = afl->stage_cur >> 3;
 
+    if (unlikely(focus) &&
+        !det_focused(afl->queue_cur, afl->stage_cur_byte)) {
+
+      ++focus_skip;
+      a_len = 0;
+      continue;
+
+    }
+
     FLIP_BIT(out_buf, afl->stage_cur);
 
 #ifdef INTROSPECTION
@@ -827,6 +1178,8 @@ u8 fuzz_one_original(afl_state_t *afl) {
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   afl->stage_finds[STAGE_FLIP1] += new_hit_cnt - orig_hit_cnt;
+  afl->stage_max -= focus_skip;
+  focus_skip = 0;
   afl->stage_cycles[STAGE_FLIP1] += afl->stage_max;
 #ifdef INTROSPECTION
   afl->queue_cur->stats_mutated += afl->stage_max;
@@ -844,6 +1197,14 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
     afl->stage_cur_byte = afl->stage_cur >> 3;
 
+    if (unlikely(focus) &&
+        !det_focused(afl->queue_cur, afl->stage_cur_byte)) {
+
+      ++focus_skip;
+      continue;
+
+    }
+
     FLIP_BIT(out_buf, afl->stage_cur);
     FLIP_BIT(out_buf, afl->stage_cur + 1);
 
@@ -862,6 +1223,8 @@ u8 fuzz_one_original(afl_state_t *afl) {
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   afl->stage_finds[STAGE_FLIP2] += new_hit_cnt - orig_hit_cnt;
+  afl->stage_max -= focus_skip;
+  focus_skip = 0;
   afl->stage_cycles[STAGE_FLIP2] += afl->stage_max;
 #ifdef INTROSPECTION
   afl->queue_cur->stats_mutated += afl->stage_max;
@@ -879,6 +1242,14 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
     afl->stage_cur_byte = afl->stage_cur >> 3;
 
+    if (unlikely(focus) &&
+        !det_focused(afl->queue_cur, afl->stage_cur_byte)) {
+
+      ++focus_skip;
+      continue;
+
+    }
+
     FLIP_BIT(out_buf, afl->stage_cur);
     FLIP_BIT(out_buf, afl->stage_cur + 1);
     FLIP_BIT(out_buf, afl->stage_cur + 2);
@@ -901,6 +1272,8 @@ u8 fuzz_one_original(afl_state_t *afl) {
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   afl->stage_finds[STAGE_FLIP4] += new_hit_cnt - orig_hit_cnt;
+  afl->stage_max -= focus_skip;
+  focus_skip = 0;
   afl->stage_cycles[STAGE_FLIP4] += afl->stage_max;
 #ifdef INTROSPECTION
   afl->queue_cur->stats_mutated += afl->stage_max;
@@ -946,6 +1319,13 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
     afl->stage_cur_byte = afl->stage_cur;
 
+    if (unlikely(focus) && !det_focused(afl->queue_cur, afl->stage_cur)) {
+
+      ++focus_skip;
+      continue;
+
+    }
+
     out_buf[afl->stage_cur] ^= 0xFF;
 
 #ifdef INTROSPECTION
@@ -1009,9 +1389,31 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   afl->blocks_eff_total += EFF_ALEN(len);
 
+  /* With `focus_det`, the stages below skip the blocks outside of the
+     influential regions. */
+
+  if (unlikely(focus && afl->queue_cur->infl_cnt)) {
+
+    for (i = 0; i < (u32)EFF_ALEN(len); ++i) {
+
+      u32 end = MIN((i + 1) << EFF_MAP_SCALE2, len);
+      for (j = i << EFF_MAP_SCALE2; j < end; ++j) {
+
+        if (det_focused(afl->queue_cur, j)) { break; }
+
+      }
+
+      if (j == end) { eff_map[i] = 0; }
+
+    }
+
+  }
+
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   afl->stage_finds[STAGE_FLIP8] += new_hit_cnt - orig_hit_cnt;
+  afl->stage_max -= focus_skip;
+  focus_skip = 0;
   afl->stage_cycles[STAGE_FLIP8] += afl->stage_max;
 #ifdef INTROSPECTION
   afl->queue_cur->stats_mutated += afl->stage_max;
@@ -1111,6 +1513,12 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
 skip_bitflip:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto custom_mutator_stage;
+
+  }
+
   if (afl->no_arith) { goto skip_arith; }
 
   /**********************
@@ -1471,6 +1879,12 @@ skip_bitflip:
 
 skip_arith:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto custom_mutator_stage;
+
+  }
+
   /**********************
    * INTERESTING VALUES *
    **********************/
@@ -1723,6 +2137,12 @@ skip_arith:
 
 skip_interest:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto custom_mutator_stage;
+
+  }
+
   /********************
    * DICTIONARY STUFF *
    ********************/
@@ -1858,6 +2278,12 @@ skip_interest:
 
 skip_user_extras:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto custom_mutator_stage;
+
+  }
+
   if (!afl->a_extras_cnt) { goto skip_extras; }
 
   afl->stage_name = "auto extras (over)";
@@ -1985,6 +2411,21 @@ skip_extras:
   if (!afl->queue_cur->passed_det) { mark_as_det_done(afl, afl->queue_cur); }
 
 custom_mutator_stage:
+
+  /* In budgeted mode, executions of all stages above are charged. */
+
+  if (unlikely(budget)) {
+
+    num_execs = aflrun_budget_left(afl, num_execs, budget_start);
+
+  }
+
+  if (afl->is_aflrun && influence_stage(afl, out_buf, len, &num_execs)) {
+
+    goto abandon_entry;
+
+  }
+
   /*******************
    * CUSTOM MUTATORS *
    *******************/
@@ -2069,13 +2510,7 @@ custom_mutator_stage:
           /* Pick a random other queue entry for passing to external API
              that has the necessary length */
 
-          do {
-
-            tid = rand_below(afl, afl->queued_items);
-
-          } while (unlikely(tid == afl->current_entry ||
-                   afl->queue_buf[tid]->aflrun_extra ||
-                   afl->queue_buf[tid]->len < 4));
+          tid = splice_pick(afl, 1);
 
           target = afl->queue_buf[tid];
           afl->splicing_with = tid;
@@ -2181,6 +2616,19 @@ havoc_stage:
 
       afl->stage_name = "run-havoc";
       afl->stage_short = "run-havoc";
+
+      /* With `early_exit`, havoc runs may exit once they have passed the
+         targets of the seed, see aflrun_shm_hdr_t. */
+      const reach_t *goals;
+      size_t num_goals = aflrun_get_seed_goals(afl->queue_cur->id, &goals);
+      if (num_goals && num_goals <= AFLRUN_MAX_GOALS) {
+
+        memcpy(afl->aflrun_goals, goals, num_goals * sizeof(reach_t));
+        afl->aflrun_num_goals = num_goals;
+        aflrun_arm_goals(afl, num_goals);
+
+      }
+
       if (afl->use_splicing && afl->ready_for_splicing_count > 1 &&
           afl->queue_cur->len >= 4) {
         afl->stage_max = AFLRUN_HAVOC_TIMES(num_execs, SPLICE_CYCLES);
@@ -2287,9 +2735,61 @@ havoc_stage:
 
   }
 
+  /* With `op_sched`, classes of operators are drawn from probabilities
+     learned for the targets of this seed, and each execution is credited to
+     the classes it used. */
+
+  double  op_probs[AFLRUN_HAVOC_OPS], *op_cdf = NULL;
+  u32     op_uses[AFLRUN_HAVOC_OPS] = {0}, op_finds[AFLRUN_HAVOC_OPS] = {0};
+  u32     op_used = 0;
+  if (afl->is_aflrun && afl->op_sched) {
+
+    u32 widths[AFLRUN_HAVOC_OPS];
+    for (u32 k = 0; k < AFLRUN_HAVOC_OPS; ++k) {
+
+      widths[k] = havoc_op_end(k, r_max) - havoc_op_begin[k];
+
+    }
+
+    aflrun_op_weights(afl->current_entry, widths, op_probs);
+    for (u32 k = 1; k < AFLRUN_HAVOC_OPS; ++k) {
+
+      op_probs[k] += op_probs[k - 1];
+
+    }
+
+    op_cdf = op_probs;
+
+  }
+
+  /* With `dist_stack`, seeds whose fringes are closer than 2^k to a
+     target stack at most 2^k operators, so seeds next to a target get small
+     mutations and far away seeds the usual ones. */
+
+  u32 stack_pow2 = afl->havoc_stack_pow2;
+  if (afl->is_aflrun && afl->dist_stack) {
+
+    double dist = aflrun_get_seed_dist(afl->current_entry);
+    stack_pow2 = 1;
+    while (stack_pow2 < afl->havoc_stack_pow2 && dist >= (1U << stack_pow2)) {
+
+      ++stack_pow2;
+
+    }
+
+  }
+
+  /* Nothing of out_buf is changed yet, and in_buf has new contents. */
+
+  afl->havoc_lo = UINT32_MAX;
+  afl->havoc_hi = 0;
+  ++afl->havoc_gen;
+
   for (afl->stage_cur = 0; afl->stage_cur < afl->stage_max; ++afl->stage_cur) {
 
-    u32 use_stacking = 1 << (1 + rand_below(afl, afl->havoc_stack_pow2));
+    u32 use_stacking = 1 << (1 + rand_below(afl, stack_pow2));
+    u64 finds = afl->aflrun_finds;
+    op_used = 0;
 
     afl->stage_cur_val = use_stacking;
 
@@ -2310,6 +2810,7 @@ havoc_stage:
             u8    *custom_havoc_buf = NULL;
             size_t new_len = el->afl_custom_havoc_mutation(
                 el->data, out_buf, temp_len, &custom_havoc_buf, MAX_FILE);
+            havoc_touch(afl, 0, UINT32_MAX);
             if (unlikely(!custom_havoc_buf)) {
 
               FATAL("Error in custom_havoc (return %zu)", new_len);
@@ -2335,7 +2836,7 @@ havoc_stage:
 
       }
 
-      switch ((r = rand_below(afl, r_max))) {
+      switch ((r = havoc_op_draw(afl, op_cdf, r_max, &op_used))) {
 
         case 0 ... 3: {
 
@@ -2345,7 +2846,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP_BIT1");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          FLIP_BIT(out_buf, rand_below(afl, temp_len << 3));
+          FLIP_BIT(out_buf, havoc_bit(afl, temp_len));
           break;
 
         }
@@ -2358,7 +2859,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " INTERESTING8");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)] =
+          out_buf[havoc_pos(afl, temp_len, 1)] =
               interesting_8[rand_below(afl, sizeof(interesting_8))];
           break;
 
@@ -2374,7 +2875,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " INTERESTING16");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          *(u16 *)(out_buf + rand_below(afl, temp_len - 1)) =
+          *(u16 *)(out_buf + havoc_pos(afl, temp_len - 1, 2)) =
               interesting_16[rand_below(afl, sizeof(interesting_16) >> 1)];
 
           break;
@@ -2391,7 +2892,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " INTERESTING16BE");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          *(u16 *)(out_buf + rand_below(afl, temp_len - 1)) = SWAP16(
+          *(u16 *)(out_buf + havoc_pos(afl, temp_len - 1, 2)) = SWAP16(
               interesting_16[rand_below(afl, sizeof(interesting_16) >> 1)]);
 
           break;
@@ -2408,7 +2909,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " INTERESTING32");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          *(u32 *)(out_buf + rand_below(afl, temp_len - 3)) =
+          *(u32 *)(out_buf + havoc_pos(afl, temp_len - 3, 4)) =
               interesting_32[rand_below(afl, sizeof(interesting_32) >> 2)];
 
           break;
@@ -2425,7 +2926,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " INTERESTING32BE");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          *(u32 *)(out_buf + rand_below(afl, temp_len - 3)) = SWAP32(
+          *(u32 *)(out_buf + havoc_pos(afl, temp_len - 3, 4)) = SWAP32(
               interesting_32[rand_below(afl, sizeof(interesting_32) >> 2)]);
 
           break;
@@ -2440,7 +2941,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH8_");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)] -= 1 + rand_below(afl, ARITH_MAX);
+          out_buf[havoc_pos(afl, temp_len, 1)] -= 1 + rand_below(afl, ARITH_MAX);
           break;
 
         }
@@ -2453,7 +2954,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH8+");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)] += 1 + rand_below(afl, ARITH_MAX);
+          out_buf[havoc_pos(afl, temp_len, 1)] += 1 + rand_below(afl, ARITH_MAX);
           break;
 
         }
@@ -2464,7 +2965,7 @@ havoc_stage:
 
           if (temp_len < 2) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 1);
+          u32 pos = havoc_pos(afl, temp_len - 1, 2);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH16_-%u", pos);
@@ -2482,7 +2983,7 @@ havoc_stage:
 
           if (temp_len < 2) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 1);
+          u32 pos = havoc_pos(afl, temp_len - 1, 2);
           u16 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -2503,7 +3004,7 @@ havoc_stage:
 
           if (temp_len < 2) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 1);
+          u32 pos = havoc_pos(afl, temp_len - 1, 2);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH16+-%u", pos);
@@ -2521,7 +3022,7 @@ havoc_stage:
 
           if (temp_len < 2) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 1);
+          u32 pos = havoc_pos(afl, temp_len - 1, 2);
           u16 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -2542,7 +3043,7 @@ havoc_stage:
 
           if (temp_len < 4) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 3);
+          u32 pos = havoc_pos(afl, temp_len - 3, 4);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH32_-%u", pos);
@@ -2560,7 +3061,7 @@ havoc_stage:
 
           if (temp_len < 4) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 3);
+          u32 pos = havoc_pos(afl, temp_len - 3, 4);
           u32 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -2581,7 +3082,7 @@ havoc_stage:
 
           if (temp_len < 4) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 3);
+          u32 pos = havoc_pos(afl, temp_len - 3, 4);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH32+-%u", pos);
@@ -2599,7 +3100,7 @@ havoc_stage:
 
           if (temp_len < 4) { break; }
 
-          u32 pos = rand_below(afl, temp_len - 3);
+          u32 pos = havoc_pos(afl, temp_len - 3, 4);
           u32 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -2624,7 +3125,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " RAND8");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)] ^= 1 + rand_below(afl, 255);
+          out_buf[havoc_pos(afl, temp_len, 1)] ^= 1 + rand_below(afl, 255);
           break;
 
         }
@@ -2637,7 +3138,7 @@ havoc_stage:
 
             u32 clone_len = choose_block_len(afl, temp_len);
             u32 clone_from = rand_below(afl, temp_len - clone_len + 1);
-            u32 clone_to = rand_below(afl, temp_len);
+            u32 clone_to = havoc_pos(afl, temp_len, 0);
 
 #ifdef INTROSPECTION
             snprintf(afl->m_tmp, sizeof(afl->m_tmp), " CLONE-%s-%u-%u-%u",
@@ -2663,6 +3164,7 @@ havoc_stage:
             out_buf = new_buf;
             afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
             temp_len += clone_len;
+            havoc_touch(afl, 0, UINT32_MAX);
 
           }
 
@@ -2677,7 +3179,7 @@ havoc_stage:
             /* Insert a block of constant bytes (25%). */
 
             u32 clone_len = choose_block_len(afl, HAVOC_BLK_XL);
-            u32 clone_to = rand_below(afl, temp_len);
+            u32 clone_to = havoc_pos(afl, temp_len, 0);
 
 #ifdef INTROSPECTION
             snprintf(afl->m_tmp, sizeof(afl->m_tmp), " CLONE-%s-%u-%u",
@@ -2706,6 +3208,7 @@ havoc_stage:
             out_buf = new_buf;
             afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
             temp_len += clone_len;
+            havoc_touch(afl, 0, UINT32_MAX);
 
           }
 
@@ -2721,7 +3224,7 @@ havoc_stage:
 
           u32 copy_len = choose_block_len(afl, temp_len - 1);
           u32 copy_from = rand_below(afl, temp_len - copy_len + 1);
-          u32 copy_to = rand_below(afl, temp_len - copy_len + 1);
+          u32 copy_to = havoc_pos(afl, temp_len - copy_len + 1, copy_len);
 
           if (likely(copy_from != copy_to)) {
 
@@ -2745,7 +3248,7 @@ havoc_stage:
           if (temp_len < 2) { break; }
 
           u32 copy_len = choose_block_len(afl, temp_len - 1);
-          u32 copy_to = rand_below(afl, temp_len - copy_len + 1);
+          u32 copy_to = havoc_pos(afl, temp_len - copy_len + 1, copy_len);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " OVERWRITE_FIXED-%u-%u",
@@ -2769,7 +3272,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ADDBYTE_");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)]++;
+          out_buf[havoc_pos(afl, temp_len, 1)]++;
           break;
 
         }
@@ -2782,7 +3285,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " SUBBYTE_");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)]--;
+          out_buf[havoc_pos(afl, temp_len, 1)]--;
           break;
 
         }
@@ -2795,7 +3298,7 @@ havoc_stage:
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " FLIP8_");
           strcat(afl->mutation, afl->m_tmp);
 #endif
-          out_buf[rand_below(afl, temp_len)] ^= 0xff;
+          out_buf[havoc_pos(afl, temp_len, 1)] ^= 0xff;
           break;
 
         }
@@ -2807,7 +3310,7 @@ havoc_stage:
           /* Switch bytes. */
 
           u32 to_end, switch_to, switch_len, switch_from;
-          switch_from = rand_below(afl, temp_len);
+          switch_from = havoc_pos(afl, temp_len, 0);
           do {
 
             switch_to = rand_below(afl, temp_len);
@@ -2847,6 +3350,8 @@ havoc_stage:
           /* Switch 2 */
 
           memcpy(out_buf + switch_to, new_buf, switch_len);
+          havoc_touch(afl, switch_from, switch_len);
+          havoc_touch(afl, switch_to, switch_len);
 
           break;
 
@@ -2862,7 +3367,7 @@ havoc_stage:
           /* Don't delete too much. */
 
           u32 del_len = choose_block_len(afl, temp_len - 1);
-          u32 del_from = rand_below(afl, temp_len - del_len + 1);
+          u32 del_from = havoc_pos(afl, temp_len - del_len + 1, 0);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " DEL-%u-%u", del_from,
@@ -2873,6 +3378,7 @@ havoc_stage:
                   temp_len - del_from - del_len);
 
           temp_len -= del_len;
+          havoc_touch(afl, 0, UINT32_MAX);
 
           break;
 
@@ -2893,7 +3399,7 @@ havoc_stage:
 
               if (extra_len > temp_len) { break; }
 
-              u32 insert_at = rand_below(afl, temp_len - extra_len + 1);
+              u32 insert_at = havoc_pos(afl, temp_len - extra_len + 1, extra_len);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " EXTRA_OVERWRITE-%u-%u",
                        insert_at, extra_len);
@@ -2911,7 +3417,7 @@ havoc_stage:
               if (temp_len + extra_len >= MAX_FILE) { break; }
 
               u8 *ptr = afl->extras[use_extra].data;
-              u32 insert_at = rand_below(afl, temp_len + 1);
+              u32 insert_at = havoc_pos(afl, temp_len + 1, 0);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp), " EXTRA_INSERT-%u-%u",
                        insert_at, extra_len);
@@ -2928,6 +3434,7 @@ havoc_stage:
               /* Inserted part */
               memcpy(out_buf + insert_at, ptr, extra_len);
               temp_len += extra_len;
+              havoc_touch(afl, 0, UINT32_MAX);
 
               break;
 
@@ -2958,7 +3465,7 @@ havoc_stage:
 
               if (extra_len > temp_len) { break; }
 
-              u32 insert_at = rand_below(afl, temp_len - extra_len + 1);
+              u32 insert_at = havoc_pos(afl, temp_len - extra_len + 1, extra_len);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp),
                        " AUTO_EXTRA_OVERWRITE-%u-%u", insert_at, extra_len);
@@ -2976,7 +3483,7 @@ havoc_stage:
               if (temp_len + extra_len >= MAX_FILE) { break; }
 
               u8 *ptr = afl->a_extras[use_extra].data;
-              u32 insert_at = rand_below(afl, temp_len + 1);
+              u32 insert_at = havoc_pos(afl, temp_len + 1, 0);
 #ifdef INTROSPECTION
               snprintf(afl->m_tmp, sizeof(afl->m_tmp),
                        " AUTO_EXTRA_INSERT-%u-%u", insert_at, extra_len);
@@ -2993,6 +3500,7 @@ havoc_stage:
               /* Inserted part */
               memcpy(out_buf + insert_at, ptr, extra_len);
               temp_len += extra_len;
+              havoc_touch(afl, 0, UINT32_MAX);
 
               break;
 
@@ -3010,12 +3518,7 @@ havoc_stage:
 
           /* Pick a random queue entry and seek to it. */
 
-          u32 tid;
-          do {
-
-            tid = rand_below(afl, afl->queued_items);
-
-          } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4);
+          u32 tid = splice_pick(afl, 0);
 
           /* Get the testcase for splicing. */
           struct queue_entry *target = afl->queue_buf[tid];
@@ -3032,7 +3535,7 @@ havoc_stage:
             if (copy_len > temp_len) copy_len = temp_len;
 
             copy_from = rand_below(afl, new_len - copy_len + 1);
-            copy_to = rand_below(afl, temp_len - copy_len + 1);
+            copy_to = havoc_pos(afl, temp_len - copy_len + 1, copy_len);
 
 #ifdef INTROSPECTION
             snprintf(afl->m_tmp, sizeof(afl->m_tmp),
@@ -3050,7 +3553,7 @@ havoc_stage:
 
             clone_len = choose_block_len(afl, new_len);
             clone_from = rand_below(afl, new_len - clone_len + 1);
-            clone_to = rand_below(afl, temp_len + 1);
+            clone_to = havoc_pos(afl, temp_len + 1, 0);
 
             u8 *temp_buf = afl_realloc(AFL_BUF_PARAM(out_scratch),
                                        temp_len + clone_len + 1);
@@ -3077,6 +3580,7 @@ havoc_stage:
             out_buf = temp_buf;
             afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
             temp_len += clone_len;
+            havoc_touch(afl, 0, UINT32_MAX);
 
           }
 
@@ -3088,15 +3592,51 @@ havoc_stage:
 
     }
 
-    if (common_fuzz_stuff(afl, out_buf, temp_len)) { goto abandon_entry; }
+    if (afl->afl_env.afl_shmem_delta && temp_len == len &&
+        afl->havoc_hi <= len) {
+
+      afl->delta_gen = afl->havoc_gen;
+
+    }
+
+    if (pool_fuzz_stuff(afl, out_buf, temp_len)) { goto abandon_entry; }
+
+    if (op_cdf) {
+
+      for (u32 k = 0; k < AFLRUN_HAVOC_OPS; ++k) {
+
+        if (!(op_used & (1 << k))) { continue; }
+        ++op_uses[k];
+        op_finds[k] += afl->aflrun_finds != finds;
+
+      }
+
+    }
 
     /* out_buf might have been mangled a bit, so let's restore it to its
-       original size and shape. */
+       original size and shape, only copying the span changed if its size
+       was not. */
 
-    out_buf = afl_realloc(AFL_BUF_PARAM(out), len);
-    if (unlikely(!out_buf)) { PFATAL("alloc"); }
-    temp_len = len;
-    memcpy(out_buf, in_buf, len);
+    if (likely(temp_len == len && afl->havoc_hi <= len)) {
+
+      if (afl->havoc_lo < afl->havoc_hi) {
+
+        memcpy(out_buf + afl->havoc_lo, in_buf + afl->havoc_lo,
+               afl->havoc_hi - afl->havoc_lo);
+
+      }
+
+    } else {
+
+      out_buf = afl_realloc(AFL_BUF_PARAM(out), len);
+      if (unlikely(!out_buf)) { PFATAL("alloc"); }
+      temp_len = len;
+      memcpy(out_buf, in_buf, len);
+
+    }
+
+    afl->havoc_lo = UINT32_MAX;
+    afl->havoc_hi = 0;
 
     /* If we're finding new stuff, let's run for a bit longer, limits
        permitting. */
@@ -3126,6 +3666,12 @@ havoc_stage:
 
   }
 
+  /* Inputs still running in the forkserver pool belong to this stage. */
+
+  if (pool_flush(afl)) { goto abandon_entry; }
+
+  if (op_cdf) { aflrun_op_update(op_uses, op_finds); }
+
   new_hit_cnt = afl->queued_items + afl->saved_crashes;
 
   if (!splice_cycle) {
@@ -3180,12 +3726,7 @@ retry_splicing:
 
     /* Pick a random queue entry and seek to it. Don't splice with yourself. */
 
-    do {
-
-      tid = rand_below(afl, afl->queued_items);
-
-    } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4 ||
-        afl->queue_buf[tid]->aflrun_extra);
+    tid = splice_pick(afl, 1);
 
     /* Get the testcase */
     afl->splicing_with = tid;
@@ -3235,6 +3776,13 @@ abandon_entry:
 
   afl->splicing_with = -1;
 
+  if (afl->aflrun_num_goals) {
+
+    aflrun_arm_goals(afl, 0);
+    afl->aflrun_num_goals = 0;
+
+  }
+
   /* Update afl->pending_not_fuzzed count if we made it through the calibration
      cycle and have not seen this entry before. */
 
@@ -3277,6 +3825,8 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
   u64 havoc_queued = 0, orig_hit_cnt, new_hit_cnt = 0, cur_ms_lv, prev_cksum,
       _prev_cksum;
   u32 splice_cycle = 0, eff_cnt = 1, retry_splicing_times, num_execs = UINT_MAX;
+  u64 budget_start = 0;
+  u8  budget = afl->is_aflrun && aflrun_budget_stages();
   double perf_score = 100, orig_perf;
   s32 temp_len_puppet;
 
@@ -3339,6 +3889,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 #endif                                                     /* ^IGNORE_FINDS */
 
   log_when_no_tty(afl);
+  splice_partners_update(afl);
 
   /* Map the test case into memory. */
   orig_in = in_buf = queue_testcase_get(afl, afl->queue_cur);
@@ -3387,10 +3938,15 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
    * TRIMMING *
    ************/
 
+  budget_start = afl->fsrv.total_execs;
+
   if (unlikely(!afl->non_instrumented_mode && !afl->queue_cur->trim_done &&
                !afl->disable_trim && (!afl->is_aflrun ||
                  // In aflrun mode, we only trim when quant is large enough
-                 afl->queue_cur->quant_score > afl->trim_thr))) {
+                 afl->queue_cur->quant_score > afl->trim_thr) &&
+               (!budget || aflrun_trim_execs(afl->queue_cur->len) <=
+                   QUANTUM_TIME * aflrun_visit_quant(afl, afl->queue_cur) /
+                   afl->queue_cur->exec_us))) {
 
     u32 old_len = afl->queue_cur->len;
 
@@ -3428,7 +3984,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
    *********************/
 
   if (likely(afl->is_aflrun)) {
-    orig_perf = perf_score = afl->queue_cur->quant_score;
+    orig_perf = perf_score = aflrun_visit_quant(afl, afl->queue_cur);
     // num_execs = 0.1s * (1 / exec_us) * quantum
     num_execs = QUANTUM_TIME * perf_score / afl->queue_cur->exec_us;
 
@@ -3458,7 +4014,9 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
   if (unlikely(afl->shm.cmplog_mode &&
                afl->queue_cur->colorized < afl->cmplog_lvl &&
-               (u32)len <= afl->cmplog_max_filesize)) {
+               (u32)len <= afl->cmplog_max_filesize &&
+               (!budget ||
+                len <= aflrun_budget_left(afl, num_execs, budget_start)))) {
 
     if (unlikely(len < 4)) {
 
@@ -3471,6 +4029,7 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
           !(afl->fsrv.total_execs % afl->queued_items) ||
           get_cur_time() - afl->last_find_time > 300000) {  // 300 seconds
 
+        afl->cmplog_exec_limit = budget ? budget_start + num_execs : 0;
         if (input_to_state_stage(afl, in_buf, out_buf, len)) {
 
           goto abandon_entry;
@@ -3508,6 +4067,15 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
   }
 
+  /* In budgeted mode, skip it if there is not enough for bitflip 1/1. */
+
+  if (unlikely(budget) &&
+      len * 8 > aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto havoc_stage;
+
+  }
+
   /* Skip deterministic fuzzing if exec path checksum puts this out of scope
      for this main instance. */
 
@@ -3934,6 +4502,12 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
 skip_bitflip:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto havoc_stage;
+
+  }
+
   if (afl->no_arith) { goto skip_arith; }
 
   /**********************
@@ -4284,6 +4858,12 @@ skip_bitflip:
 
 skip_arith:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto havoc_stage;
+
+  }
+
   /**********************
    * INTERESTING VALUES *
    **********************/
@@ -4531,6 +5111,12 @@ skip_arith:
 
 skip_interest:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto havoc_stage;
+
+  }
+
   /********************
    * DICTIONARY STUFF *
    ********************/
@@ -4666,6 +5252,12 @@ skip_interest:
 
 skip_user_extras:
 
+  if (unlikely(budget) && !aflrun_budget_left(afl, num_execs, budget_start)) {
+
+    goto havoc_stage;
+
+  }
+
   if (!afl->a_extras_cnt) { goto skip_extras; }
 
   afl->stage_name = "auto extras (over)";
@@ -4800,6 +5392,14 @@ skip_extras:
 havoc_stage:
 pacemaker_fuzzing:
 
+  /* In budgeted mode, executions of all stages above are charged. */
+
+  if (unlikely(budget)) {
+
+    num_execs = aflrun_budget_left(afl, num_execs, budget_start);
+
+  }
+
   // for (; afl->swarm_now < swarm_num; ++afl->swarm_now)
   {
 
@@ -5456,14 +6056,7 @@ pacemaker_fuzzing:
 
                 if (unlikely(afl->ready_for_splicing_count < 2)) break;
 
-                u32 tid;
-                do {
-
-                  tid = rand_below(afl, afl->queued_items);
-
-                } while (tid == afl->current_entry ||
-
-                         afl->queue_buf[tid]->len < 4);
+                u32 tid = splice_pick(afl, 0);
 
                 /* Get the testcase for splicing. */
                 struct queue_entry *target = afl->queue_buf[tid];
@@ -5675,12 +6268,7 @@ pacemaker_fuzzing:
         /* Pick a random queue entry and seek to it. Don't splice with yourself.
          */
 
-        do {
-
-          tid = rand_below(afl, afl->queued_items);
-
-        } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4 ||
-                  afl->queue_buf[tid]->aflrun_extra);
+        tid = splice_pick(afl, 1);
 
         afl->splicing_with = tid;
         target = afl->queue_buf[tid];
@@ -6013,6 +6601,8 @@ u8 fuzz_one(afl_state_t *afl) {
 
   int key_val_lv_1 = 0, key_val_lv_2 = 0;
 
+  AFL_PROBE(afl, fuzz_one_begin, afl->current_entry);
+
 #ifdef _AFL_DOCUMENT_MUTATIONS
 
   u8 path_buf[PATH_MAX];
@@ -6035,6 +6625,21 @@ u8 fuzz_one(afl_state_t *afl) {
   // therefore we reduce the quant by half so the sum is unchanged
   if (afl->limit_time_sig < 0) { afl->queue_cur->quant_score /= 2; }
 
+  afl->cal_deferring = afl->afl_env.afl_cal_defer;
+
+  /* With AFL_SEED_TMOUT, mutants of a fast seed time out long before the
+     global timeout, which only slow seeds need; like that timeout, it is
+     rounded up to EXEC_TM_ROUND ms. Calibration and hang confirmation still
+     use the global ones. */
+
+  if (afl->seed_tmout_mult && afl->queue_cur->exec_us) {
+
+    u64 tmout = afl->queue_cur->exec_us * afl->seed_tmout_mult / 1000;
+    tmout = (tmout + EXEC_TM_ROUND) / EXEC_TM_ROUND * EXEC_TM_ROUND;
+    afl->seed_tmout = MIN(tmout, afl->fsrv.exec_tmout);
+
+  }
+
   if (afl->limit_time_sig <= 0) { key_val_lv_1 = fuzz_one_original(afl); }
 
   if (afl->limit_time_sig != 0) {
@@ -6057,6 +6662,12 @@ u8 fuzz_one(afl_state_t *afl) {
 
   }
 
+  afl->seed_tmout = 0;
+  afl->cal_deferring = 0;
+  calibrate_deferred(afl);
+
+  AFL_PROBE(afl, fuzz_one_end, afl->current_entry,
+            (u8)(key_val_lv_1 | key_val_lv_2));
   return (key_val_lv_1 | key_val_lv_2);
 
 }
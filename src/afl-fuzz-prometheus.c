@@ -0,0 +1,271 @@
+/*
+ * This implements a Prometheus scrape endpoint, see docs/rpc_statsd.md
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "afl-fuzz.h"
+#include "aflrun.h"
+
+/* Metrics are rendered by the fuzzing loop into `tmp` every
+   PROMETHEUS_UPDATE_SEC and published into `buf`, from which the exporter
+   thread serves a copy. The fuzzing loop only tries the lock, so a slow
+   scraper can delay an update but never the fuzzing itself; nothing of
+   afl-fuzz or AFLRun is touched by the exporter thread. */
+
+struct afl_prometheus {
+
+  pthread_mutex_t lock;
+  int             sock;
+
+  u64    last_update_ms;
+  size_t len;                            /* Length of published page      */
+  char   buf[PROMETHEUS_MAX_SIZE];       /* Published page, under `lock`  */
+  char   tmp[PROMETHEUS_MAX_SIZE];       /* Page being rendered           */
+  char   out[PROMETHEUS_MAX_SIZE + 256]; /* Response of exporter thread   */
+
+};
+
+#define PROM_METRIC(name, type, help) \
+  "# HELP " name " " help "\n# TYPE " name " " type "\n"
+
+static size_t prometheus_render(afl_state_t *afl, char *buf, size_t size) {
+
+  static const char *const modes[] = {"coverage", "fringe", "pro_fringe",
+                                      "target", "unite"};
+  static const char *const last_names[] = {
+
+      "reachable",     "fringe",     "pro_fringe",     "target",
+      "ctx_reachable", "ctx_fringe",  "ctx_pro_fringe", "ctx_target"};
+
+  u64 cur_ms = get_cur_time();
+  u64 run_ms = afl->prev_run_time + cur_ms - afl->start_time;
+
+  reach_t num_reached, num_freached, num_reached_targets, num_freached_targets;
+  aflrun_get_reached(&num_reached, &num_freached, &num_reached_targets,
+                     &num_freached_targets);
+
+  size_t num_path_fringes, num_pro_fringes, num_target_fringes;
+  aflrun_get_fringes(&num_path_fringes, &num_pro_fringes, &num_target_fringes);
+
+  int    cycle_count;
+  u32    cov_quant;
+  size_t div_num_invalid, div_num_fringes;
+  aflrun_get_state(&cycle_count, &cov_quant, &div_num_invalid,
+                   &div_num_fringes);
+
+  u64 last[8];
+  aflrun_get_time(last, last + 1, last + 2, last + 3, last + 4, last + 5,
+                  last + 6, last + 7);
+
+  u8 mode = aflrun_get_mode();
+
+  size_t len = snprintf(
+      buf, size,
+      PROM_METRIC("afl_execs_total", "counter", "Executions of the target")
+      "afl_execs_total %llu\n"
+      PROM_METRIC("afl_execs_per_sec", "gauge", "Current executions per second")
+      "afl_execs_per_sec %0.02f\n"
+      PROM_METRIC("afl_run_time_seconds", "gauge", "Time spent fuzzing")
+      "afl_run_time_seconds %llu\n"
+      PROM_METRIC("afl_corpus_count", "gauge", "Seeds in the queue")
+      "afl_corpus_count %u\n"
+      PROM_METRIC("afl_saved_crashes", "gauge", "Unique crashes saved")
+      "afl_saved_crashes %llu\n"
+      PROM_METRIC("afl_saved_hangs", "gauge", "Unique hangs saved")
+      "afl_saved_hangs %llu\n"
+      PROM_METRIC("aflrun_mode", "gauge", "Current AFLRun mode, 1 for the "
+                  "mode given by the label")
+      "aflrun_mode{mode=\"%s\"} 1\n"
+      PROM_METRIC("aflrun_cycle", "gauge", "AFLRun cycles done")
+      "aflrun_cycle %d\n"
+      PROM_METRIC("aflrun_reached", "gauge", "Reachable blocks and "
+                  "functions reached")
+      "aflrun_reached{kind=\"blocks\"} %llu\n"
+      "aflrun_reached{kind=\"functions\"} %llu\n"
+      "aflrun_reached{kind=\"targets\"} %llu\n"
+      "aflrun_reached{kind=\"ftargets\"} %llu\n"
+      PROM_METRIC("aflrun_reachable", "gauge", "Reachable blocks and "
+                  "functions in total")
+      "aflrun_reachable{kind=\"blocks\"} %llu\n"
+      "aflrun_reachable{kind=\"functions\"} %llu\n"
+      "aflrun_reachable{kind=\"targets\"} %llu\n"
+      "aflrun_reachable{kind=\"ftargets\"} %llu\n"
+      PROM_METRIC("aflrun_clusters", "gauge", "Target clusters with a "
+                  "virgin map")
+      "aflrun_clusters %zu\n"
+      PROM_METRIC("aflrun_clusters_evicted_total", "counter", "Clusters "
+                  "merged into primary one by cluster_mem_budget")
+      "aflrun_clusters_evicted_total %zu\n"
+      PROM_METRIC("aflrun_fringes", "gauge", "Current fringes")
+      "aflrun_fringes{kind=\"path\"} %zu\n"
+      "aflrun_fringes{kind=\"pro\"} %zu\n"
+      "aflrun_fringes{kind=\"target\"} %zu\n"
+      "aflrun_fringes{kind=\"div\"} %zu\n"
+      "aflrun_fringes{kind=\"div_invalid\"} %zu\n"
+      PROM_METRIC("aflrun_seconds_since_last", "gauge", "Time since the last "
+                  "update of AFLRun coverage, or since start if none"),
+      afl->fsrv.total_execs, afl->stats_avg_exec, run_ms / 1000,
+      afl->queued_items, afl->saved_crashes, afl->saved_hangs,
+      mode < sizeof(modes) / sizeof(*modes) ? modes[mode] : "unknown",
+      cycle_count, (u64)num_reached, (u64)num_freached,
+      (u64)num_reached_targets, (u64)num_freached_targets,
+      (u64)afl->fsrv.num_reachables, (u64)afl->fsrv.num_freachables,
+      (u64)afl->fsrv.num_targets, (u64)afl->fsrv.num_ftargets,
+      aflrun_get_num_clusters(), aflrun_get_evicted_clusters(),
+      num_path_fringes, num_pro_fringes,
+      num_target_fringes, div_num_fringes, div_num_invalid);
+
+  for (u32 i = 0; i < 8 && len < size; ++i) {
+
+    u64 t = last[i] ? last[i] : afl->start_time;
+    len += snprintf(buf + len, size - len,
+                    "aflrun_seconds_since_last{what=\"%s\"} %llu\n",
+                    last_names[i], cur_ms > t ? (cur_ms - t) / 1000 : 0);
+
+  }
+
+  return len < size ? len : size - 1;
+
+}
+
+static void *prometheus_thread(void *arg) {
+
+  struct afl_prometheus *p = arg;
+  char                   req[1024];
+
+  while (1) {
+
+    int fd = accept(p->sock, NULL, NULL);
+    if (fd < 0) {
+
+      if (errno != EINTR && errno != ECONNABORTED) { usleep(100000); }
+      continue;
+
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    /* Never let a scraper hold the thread for long. */
+    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    ssize_t n = recv(fd, req, sizeof(req) - 1, 0);
+    if (n <= 0) {
+
+      close(fd);
+      continue;
+
+    }
+
+    req[n] = 0;
+
+    size_t len;
+    if (strncmp(req, "GET / ", 6) && strncmp(req, "GET /metrics ", 13)) {
+
+      len = snprintf(p->out, sizeof(p->out),
+                     "HTTP/1.0 404 Not Found\r\n"
+                     "Content-Length: 0\r\nConnection: close\r\n\r\n");
+
+    } else {
+
+      pthread_mutex_lock(&p->lock);
+      len = snprintf(p->out, sizeof(p->out),
+                     "HTTP/1.0 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                     p->len);
+      memcpy(p->out + len, p->buf, p->len);
+      len += p->len;
+      pthread_mutex_unlock(&p->lock);
+
+    }
+
+    for (size_t sent = 0; sent < len;) {
+
+      ssize_t r = send(fd, p->out + sent, len - sent, MSG_NOSIGNAL);
+      if (r <= 0) { break; }
+      sent += r;
+
+    }
+
+    close(fd);
+
+  }
+
+  return NULL;
+
+}
+
+void prometheus_init(afl_state_t *afl) {
+
+  int port = atoi(afl->afl_env.afl_prometheus_port);
+  if (port <= 0 || port > 65535) {
+
+    FATAL("Invalid AFL_PROMETHEUS_PORT '%s'", afl->afl_env.afl_prometheus_port);
+
+  }
+
+  struct afl_prometheus *p = ck_alloc(sizeof(struct afl_prometheus));
+  pthread_mutex_init(&p->lock, NULL);
+
+  p->sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (p->sock < 0) { PFATAL("Failed to create Prometheus socket"); }
+  fcntl(p->sock, F_SETFD, FD_CLOEXEC);
+
+  int one = 1;
+  setsockopt(p->sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+
+  if (bind(p->sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(p->sock, 16)) {
+
+    PFATAL("Unable to listen on Prometheus port %d", port);
+
+  }
+
+  start_detached_thread(prometheus_thread, p, "Prometheus exporter");
+
+  afl->prometheus = p;
+  OKF("Serving Prometheus metrics on port %d.", port);
+
+}
+
+void prometheus_update(afl_state_t *afl) {
+
+  struct afl_prometheus *p = afl->prometheus;
+  u64                    cur_ms = get_cur_time();
+
+  if (!afl->force_ui_update &&
+      cur_ms - p->last_update_ms < PROMETHEUS_UPDATE_SEC * 1000) {
+
+    return;
+
+  }
+
+  size_t len = prometheus_render(afl, p->tmp, sizeof(p->tmp));
+
+  /* Retry at the next call if the exporter is copying the page. */
+  if (pthread_mutex_trylock(&p->lock)) { return; }
+  memcpy(p->buf, p->tmp, len);
+  p->len = len;
+  pthread_mutex_unlock(&p->lock);
+
+  p->last_update_ms = cur_ms;
+
+}
+
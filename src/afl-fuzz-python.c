@@ -182,16 +182,103 @@ static const char *custom_describe_py(void  *py_mutator,
 
 }
 
-static py_mutator_t *init_py_module(afl_state_t *afl, u8 *module_name) {
+/* Built-in `aflrun` module, giving mutators the AFLRun view of seeds */
 
-  (void)afl;
+static afl_state_t *py_afl;
+
+// Read-only memoryview of `num` items of AFLRun without copying them
+static PyObject *py_aflrun_view(const void *items, size_t num, size_t size,
+                                char *format) {
+
+  static u64 empty;
+  Py_ssize_t shape = num;
+  Py_buffer  view;
+
+  memset(&view, 0, sizeof(view));
+  view.buf = num ? (void *)items : (void *)&empty;
+  view.len = num * size;
+  view.itemsize = size;
+  view.readonly = 1;
+  view.ndim = 1;
+  view.format = format;
+  view.shape = &shape;
+  return PyMemoryView_FromBuffer(&view);
+
+}
+
+static PyObject *py_aflrun_seed_info(PyObject *self, PyObject *args) {
+
+  (void)self;
+  long id = -1;
+  if (!PyArg_ParseTuple(args, "|l", &id)) { return NULL; }
+
+  if (id < 0) {
+
+    if (!py_afl->queue_cur) { Py_RETURN_NONE; }
+    id = py_afl->queue_cur->id;
+
+  }
+
+  aflrun_seed_info_t info;
+  py_afl->aflrun_seed_info(py_afl, id, &info);
+
+  return Py_BuildValue(
+      "{s:N,s:N,s:N,s:O,s:d,s:d,s:i}", "fringes",
+      py_aflrun_view(info.fringes, info.num_fringes, sizeof(reach_t), "I"),
+      "target_dists",
+      py_aflrun_view(info.target_dists, info.num_targets, sizeof(double), "d"),
+      "decisives",
+      py_aflrun_view(info.decisives, info.num_decisives, sizeof(reach_t), "I"),
+      "focus", info.focus ? Py_True : Py_False, "quant_score",
+      info.quant_score, "perf_score", info.perf_score, "mode", (int)info.mode);
+
+}
+
+static PyMethodDef py_aflrun_methods[] = {
+
+    {"seed_info", py_aflrun_seed_info, METH_VARARGS,
+     "seed_info([id]) -> dict of fringes, target_dists, decisives, focus, "
+     "quant_score, perf_score and mode of seed `id` (default: the one being fuzzed); "
+     "the memoryviews are only valid until the next call."},
+    {NULL, NULL, 0, NULL}
+
+};
+
+  #if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef py_aflrun_module = {
+
+    PyModuleDef_HEAD_INIT, "aflrun", NULL, -1, py_aflrun_methods,
+    NULL,                  NULL,     NULL, NULL
+
+};
+
+static PyObject *py_aflrun_init(void) {
+
+  return PyModule_Create(&py_aflrun_module);
+
+}
+
+  #endif
+
+static py_mutator_t *init_py_module(afl_state_t *afl, u8 *module_name) {
 
   if (!module_name) { return NULL; }
 
   py_mutator_t *py = calloc(1, sizeof(py_mutator_t));
   if (!py) { PFATAL("Could not allocate memory for python mutator!"); }
 
-  Py_Initialize();
+  py_afl = afl;
+  if (!Py_IsInitialized()) {
+
+  #if PY_MAJOR_VERSION >= 3
+    PyImport_AppendInittab("aflrun", py_aflrun_init);
+    Py_Initialize();
+  #else
+    Py_Initialize();
+    Py_InitModule("aflrun", py_aflrun_methods);
+  #endif
+
+  }
 
   #if PY_MAJOR_VERSION >= 3
   PyObject *py_name = PyUnicode_FromString(module_name);
@@ -24,9 +24,11 @@
 
 #include "afl-fuzz.h"
 #include "aflrun.h"
+#include "aflrun-registry.h"
 #include <limits.h>
 #include <ctype.h>
 #include <math.h>
+#include <sys/mman.h>
 
 /* select next queue entry based on alias algo - fast! */
 
@@ -67,11 +69,60 @@ double compute_weight(afl_state_t *afl, struct queue_entry *q,
 
 }
 
+/* Fill the alias table from probabilities `P` of `n` entries scaled to sum
+   up to `n`, with Vose's method, using scratch arrays `S` and `L`. */
+
+static void build_alias_table(afl_state_t *afl, double *P, int *S, int *L,
+                              u32 n) {
+
+  u32 a, g;
+  int nS = 0, nL = 0, s;
+  for (s = (s32)n - 1; s >= 0; --s) {
+
+    if (P[s] < 1) {
+
+      S[nS++] = s;
+
+    } else {
+
+      L[nL++] = s;
+
+    }
+
+  }
+
+  while (nS && nL) {
+
+    a = S[--nS];
+    g = L[--nL];
+    afl->alias_probability[a] = P[a];
+    afl->alias_table[a] = g;
+    P[g] = P[g] + P[a] - 1;
+    if (P[g] < 1) {
+
+      S[nS++] = g;
+
+    } else {
+
+      L[nL++] = g;
+
+    }
+
+  }
+
+  while (nL)
+    afl->alias_probability[L[--nL]] = 1;
+
+  while (nS)
+    afl->alias_probability[S[--nS]] = 1;
+
+}
+
 /* create the alias table that allows weighted random selection - expensive */
 
 void create_alias_table(afl_state_t *afl) {
 
-  u32    n = afl->queued_items, i = 0, a, g;
+  u32    n = afl->queued_items, i = 0;
   double sum = 0;
 
   afl->alias_table =
@@ -162,45 +213,7 @@ void create_alias_table(afl_state_t *afl) {
 
   }
 
-  int nS = 0, nL = 0, s;
-  for (s = (s32)n - 1; s >= 0; --s) {
-
-    if (P[s] < 1) {
-
-      S[nS++] = s;
-
-    } else {
-
-      L[nL++] = s;
-
-    }
-
-  }
-
-  while (nS && nL) {
-
-    a = S[--nS];
-    g = L[--nL];
-    afl->alias_probability[a] = P[a];
-    afl->alias_table[a] = g;
-    P[g] = P[g] + P[a] - 1;
-    if (P[g] < 1) {
-
-      S[nS++] = g;
-
-    } else {
-
-      L[nL++] = g;
-
-    }
-
-  }
-
-  while (nL)
-    afl->alias_probability[L[--nL]] = 1;
-
-  while (nS)
-    afl->alias_probability[S[--nS]] = 1;
+  build_alias_table(afl, P, S, L, n);
 
   afl->reinit_table = 0;
 
@@ -409,20 +422,17 @@ u8 check_if_text_buf(u8 *buf, u32 len) {
 
 /* check if queue entry is ascii or UTF-8 */
 
-static u8 check_if_text(afl_state_t *afl, struct queue_entry *q) {
+u8 check_if_text(afl_state_t *afl, struct queue_entry *q) {
 
   if (q->len < AFL_TXT_MIN_LEN) return 0;
 
   u8     *buf;
-  int     fd;
   u32     len = q->len, offset = 0, ascii = 0, utf8 = 0;
   ssize_t comp;
 
   if (len >= MAX_FILE) len = MAX_FILE - 1;
-  if ((fd = open(q->fname, O_RDONLY)) < 0) return 0;
   buf = afl_realloc(AFL_BUF_PARAM(in_scratch), len + 1);
-  comp = read(fd, buf, len);
-  close(fd);
+  comp = queue_read_case(afl, q, buf, len);
   if (comp != (ssize_t)len) return 0;
   buf[len] = 0;
 
@@ -593,6 +603,7 @@ void destroy_queue(afl_state_t *afl) {
     q = afl->queue_buf[i];
     ck_free(q->fname);
     ck_free(q->trace_mini);
+    ck_free(q->infl_regions);
     ck_free(q);
 
   }
@@ -646,6 +657,17 @@ u8 get_seed_cov_favored(void* afl, u32 seed) {
 
 }
 
+u64 get_seed_exec_us(void* afl, u32 seed) {
+
+  struct queue_entry *q = ((afl_state_t*)afl)->queue_buf[seed];
+
+  if (q->id != seed)
+    FATAL("ID Error");
+
+  return q->exec_us;
+
+}
+
 /* When we bump into a new path, we call this to see if the path appears
    more "favorable" than any of the existing ones. The purpose of the
    "favorables" is to have a minimal set of paths that trigger all the bits
@@ -655,12 +677,14 @@ u8 get_seed_cov_favored(void* afl, u32 seed) {
    The first step of the process is to maintain a list of afl->top_rated[]
    entries for every byte in the bitmap. We win that slot if there is no
    previous contender, or if the contender has a more favorable speed x size
-   factor. */
+   factor. Entry `i` of `top_rated` is for byte `i + lo` of the bitmap, and a
+   top-rated map of a cluster only has the window of aflrun_edge_window(). */
 
 static void update_bitmap_score_original(u8 primary,
-  afl_state_t *afl, struct queue_entry *q, struct queue_entry **top_rated) {
+  afl_state_t *afl, struct queue_entry *q, struct queue_entry **top_rated,
+  const u32 *edges, u32 num_edges, u32 lo) {
 
-  u32 i;
+  u32 i, k;
   u64 fav_factor;
   u64 fuzz_p2;
 
@@ -683,102 +707,268 @@ static void update_bitmap_score_original(u8 primary,
 
   /* For every byte set in afl->fsrv.trace_bits[], see if there is a previous
      winner, and how it compares to us. */
-  for (i = 0; i < afl->fsrv.map_size; ++i) {
+  for (k = 0; k < num_edges; ++k) {
 
-    if (afl->fsrv.trace_bits[i]) {
+    i = edges[k] - lo;
 
-      if (top_rated[i]) {
+    if (top_rated[i]) {
 
-        /* Faster-executing or smaller test cases are favored. */
-        u64 top_rated_fav_factor;
-        u64 top_rated_fuzz_p2;
-        if (unlikely(afl->schedule >= FAST && afl->schedule <= RARE))
-          top_rated_fuzz_p2 =
-              next_pow2(afl->n_fuzz[top_rated[i]->n_fuzz_entry]);
-        else
-          top_rated_fuzz_p2 = top_rated[i]->fuzz_level;
-
-        if (unlikely(afl->schedule >= RARE) || unlikely(afl->fixed_seed)) {
+      /* Faster-executing or smaller test cases are favored. */
+      u64 top_rated_fav_factor;
+      u64 top_rated_fuzz_p2;
+      if (unlikely(afl->schedule >= FAST && afl->schedule <= RARE))
+        top_rated_fuzz_p2 =
+            next_pow2(afl->n_fuzz[top_rated[i]->n_fuzz_entry]);
+      else
+        top_rated_fuzz_p2 = top_rated[i]->fuzz_level;
 
-          top_rated_fav_factor = top_rated[i]->len << 2;
+      if (unlikely(afl->schedule >= RARE) || unlikely(afl->fixed_seed)) {
 
-        } else {
+        top_rated_fav_factor = top_rated[i]->len << 2;
 
-          top_rated_fav_factor =
-              top_rated[i]->exec_us * top_rated[i]->len;
+      } else {
 
-        }
+        top_rated_fav_factor =
+            top_rated[i]->exec_us * top_rated[i]->len;
 
-        if (fuzz_p2 > top_rated_fuzz_p2) {
+      }
 
-          continue;
+      if (fuzz_p2 > top_rated_fuzz_p2) {
 
-        } else if (fuzz_p2 == top_rated_fuzz_p2) {
+        continue;
 
-          if (fav_factor > top_rated_fav_factor) { continue; }
+      } else if (fuzz_p2 == top_rated_fuzz_p2) {
 
-        }
+        if (fav_factor > top_rated_fav_factor) { continue; }
 
-        if (unlikely(afl->schedule >= RARE) || unlikely(afl->fixed_seed)) {
+      }
 
-          if (fav_factor > top_rated[i]->len << 2) { continue; }
+      if (unlikely(afl->schedule >= RARE) || unlikely(afl->fixed_seed)) {
 
-        } else {
+        if (fav_factor > top_rated[i]->len << 2) { continue; }
 
-          if (fav_factor >
-              top_rated[i]->exec_us * top_rated[i]->len) {
+      } else {
 
-            continue;
+        if (fav_factor >
+            top_rated[i]->exec_us * top_rated[i]->len) {
 
-          }
+          continue;
 
         }
 
-        /* Looks like we're going to win. Decrease ref count for the
-           previous winner, discard its afl->fsrv.trace_bits[] if necessary. */
+      }
 
-        if (!--top_rated[i]->tc_ref) {
+      /* Looks like we're going to win. Decrease ref count for the
+         previous winner, discard its afl->fsrv.trace_bits[] if necessary. */
 
-          ck_free(top_rated[i]->trace_mini);
-          top_rated[i]->trace_mini = 0;
+      if (!--top_rated[i]->tc_ref) {
 
-        }
+        ck_free(top_rated[i]->trace_mini);
+        top_rated[i]->trace_mini = 0;
 
       }
 
-      /* Insert ourselves as the new winner. */
+    }
 
-      top_rated[i] = q;
-      ++q->tc_ref;
+    /* Insert ourselves as the new winner. */
 
-      if (!q->trace_mini) {
+    if (!primary && !top_rated[i])
+      TOPS_INDEX(top_rated, afl->edge_hi - afl->edge_lo)[i >> 6] |=
+          1ULL << (i & 63);
 
-        u32 len = (afl->fsrv.map_size >> 3);
-        q->trace_mini = ck_alloc(len);
-        minimize_bits(afl, q->trace_mini, afl->fsrv.trace_bits);
+    top_rated[i] = q;
+    ++q->tc_ref;
 
-      }
+    if (!q->trace_mini) {
 
-      if (primary)
-        afl->score_changed = 1;
-      else
-        afl->div_score_changed = 1;
+      q->trace_mini = minimize_trace(edges, num_edges);
 
     }
 
+    if (primary)
+      afl->score_changed = 1;
+    else
+      afl->div_score_changed = 1;
+
+  }
+
+}
+
+/* Collect indices of non-zero bytes of afl->fsrv.trace_bits[] in order, so
+   a seed in many clusters scans the map only once. Returns their number. */
+
+static u32 collect_score_edges(afl_state_t *afl) {
+
+  const u64 *trace = (const u64 *)afl->fsrv.trace_bits;
+  u32        words = afl->fsrv.map_size >> 3, num = 0;
+
+  afl->score_edges =
+      afl_realloc((void **)&afl->score_edges, afl->fsrv.map_size * sizeof(u32));
+  if (unlikely(!afl->score_edges)) { PFATAL("alloc"); }
+
+  for (u32 w = 0; w < words; ++w) {
+
+    u64 v = trace[w];
+    if (likely(!v)) { continue; }
+
+    // Lowest bit of each non-zero byte
+    v |= v >> 4;
+    v |= v >> 2;
+    v |= v >> 1;
+    v &= 0x0101010101010101ULL;
+
+    for (; v; v &= v - 1)
+      afl->score_edges[num++] = (w << 3) + (__builtin_ctzll(v) >> 3);
+
+  }
+
+  for (u32 i = words << 3; i < afl->fsrv.map_size; ++i)
+    if (afl->fsrv.trace_bits[i]) afl->score_edges[num++] = i;
+
+  return num;
+
+}
+
+/* Number of `edges`, which are ascending, less than `e`. */
+
+static u32 score_edges_below(const u32 *edges, u32 num_edges, u32 e) {
+
+  u32 lo = 0, hi = num_edges;
+  while (lo < hi) {
+
+    u32 mid = lo + (hi - lo) / 2;
+    if (edges[mid] < e)
+      lo = mid + 1;
+    else
+      hi = mid;
+
   }
 
+  return lo;
+
 }
 
 void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
 
+  u32 num_edges = collect_score_edges(afl);
   size_t n = aflrun_max_clusters(q->id);
   afl->tops = afl_realloc((void **)&afl->tops, sizeof(struct queue_entry**) * n);
   afl->tops[0] = afl->top_rated;
   size_t num_tops = aflrun_get_seed_tops(q->id, (void***)(afl->tops + 1)) + 1;
 
-  for (size_t i = 0; i < num_tops; ++i)
-    update_bitmap_score_original(i == 0, afl, q, afl->tops[i]);
+  update_bitmap_score_original(
+    1, afl, q, afl->top_rated, afl->score_edges, num_edges, 0);
+  if (num_tops == 1) { return; }
+
+  /* Clusters only rate edges of their window. */
+  u32 first = score_edges_below(afl->score_edges, num_edges, afl->edge_lo);
+  u32 last = score_edges_below(afl->score_edges, num_edges, afl->edge_hi);
+  for (size_t i = 1; i < num_tops; ++i)
+    update_bitmap_score_original(0, afl, q, afl->tops[i],
+      afl->score_edges + first, last - first, afl->edge_lo);
+
+}
+
+/* Whether `q` would take the slot of `top` in update_bitmap_score_original(),
+   when both are already in the queue. */
+
+static u8 top_rated_wins(afl_state_t *afl, struct queue_entry *q,
+                         struct queue_entry *top) {
+
+  u64 q_p2, top_p2, q_fav, top_fav;
+
+  if (unlikely(afl->schedule >= FAST && afl->schedule <= RARE)) {
+
+    q_p2 = next_pow2(afl->n_fuzz[q->n_fuzz_entry]);
+    top_p2 = next_pow2(afl->n_fuzz[top->n_fuzz_entry]);
+
+  } else {
+
+    q_p2 = q->fuzz_level;
+    top_p2 = top->fuzz_level;
+
+  }
+
+  if (unlikely(afl->schedule >= RARE) || unlikely(afl->fixed_seed)) {
+
+    q_fav = q->len << 2;
+    top_fav = top->len << 2;
+
+  } else {
+
+    q_fav = q->exec_us * q->len;
+    top_fav = top->exec_us * top->len;
+
+  }
+
+  return q_p2 < top_p2 || (q_p2 == top_p2 && q_fav <= top_fav);
+
+}
+
+/* Merge the top_rated map `src` of a cluster being merged into the one of
+   `dst`, keeping the winner of each slot, and release the references `src`
+   holds that are not moved. If `dst` is NULL, all of them are released. */
+
+void merge_seed_tops(void *afl_void, void **dst_void, void **src_void) {
+
+  afl_state_t         *afl = (afl_state_t *)afl_void;
+  struct queue_entry **dst = (struct queue_entry **)dst_void;
+  struct queue_entry **src = (struct queue_entry **)src_void;
+  u32                  win = afl->edge_hi - afl->edge_lo;
+  const u64           *src_index = TOPS_INDEX(src, win);
+
+  for (u32 w = 0; w < TOPS_INDEX_WORDS(win); ++w) {
+
+    for (u64 bits = src_index[w]; bits; bits &= bits - 1) {
+
+      u32                 i = (w << 6) + __builtin_ctzll(bits);
+      struct queue_entry *q = src[i], *loser = q;
+
+      if (dst && !dst[i]) {
+
+        TOPS_INDEX(dst, win)[w] |= 1ULL << (i & 63);
+        dst[i] = q;
+        loser = NULL;
+
+      } else if (dst && dst[i] != q && top_rated_wins(afl, q, dst[i])) {
+
+        loser = dst[i];
+        dst[i] = q;
+
+      }
+
+      if (loser && !--loser->tc_ref) {
+
+        ck_free(loser->trace_mini);
+        loser->trace_mini = 0;
+
+      }
+
+    }
+
+  }
+
+  afl->div_score_changed = 1;
+
+}
+
+/* Remove the bits of `m` from `temp_w`, a run of words at a time. */
+
+static inline void trace_mini_clear(u64 *temp_w, const trace_mini_t *m) {
+
+  const u64 *p = m->data, *end = m->data + m->size;
+
+  while (p < end) {
+
+    u32 start = *p >> 32, n = (u32)*p;
+    ++p;
+
+    for (u32 j = 0; j < n; ++j)
+      temp_w[start + j] &= ~p[j];
+
+    p += n;
+
+  }
 
 }
 
@@ -816,19 +1006,9 @@ void cull_queue(afl_state_t *afl) {
 
     if (afl->top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
 
-      u32 j = len;
-
       /* Remove all bits belonging to the current entry from temp_v. */
 
-      while (j--) {
-
-        if (afl->top_rated[i]->trace_mini[j]) {
-
-          temp_v[j] &= ~afl->top_rated[i]->trace_mini[j];
-
-        }
-
-      }
+      trace_mini_clear((u64 *)temp_v, afl->top_rated[i]->trace_mini);
 
       if (!afl->top_rated[i]->favored) {
 
@@ -857,9 +1037,56 @@ void cull_queue(afl_state_t *afl) {
 
 static void clear_div_favored(afl_state_t *afl) {
 
-  for (u32 i = 0; i < afl->queued_items; i++) {
+  for (u32 k = 0; k < afl->num_active; k++) {
+
+    afl->queue_buf[afl->aflrun_active[k]]->div_favored = 0;
+
+  }
+
+}
 
-    afl->queue_buf[i]->div_favored = 0;
+struct cull_div_ctx {
+
+  afl_state_t          *afl;
+  struct queue_entry ***tops;
+  u8                   *temp_v;         /* `stride` bytes per worker        */
+  u32                   stride;         /* map_size / 8, rounded up to u64  */
+  u8                   *favored;        /* queued_items bytes per worker    */
+
+};
+
+/* Cull the `top_rated` map of cluster `k`, marking seeds to be favored in
+   buffer of given worker, since clusters can be culled in parallel. Only
+   entries marked in the index of non-null tops are visited, in ascending
+   order as before, and `trace_mini` is subtracted a run at a time. */
+
+static void cull_queue_div_one(void *arg, size_t k, size_t worker) {
+
+  struct cull_div_ctx *ctx = (struct cull_div_ctx *)arg;
+  afl_state_t         *afl = ctx->afl;
+
+  u32  len = (afl->fsrv.map_size >> 3);
+  u8  *temp_v = ctx->temp_v + worker * ctx->stride;
+  u8  *favored = ctx->favored + worker * afl->queued_items;
+
+  struct queue_entry **top_rated = ctx->tops[k];
+  u32        win = afl->edge_hi - afl->edge_lo;
+  const u64 *index = TOPS_INDEX(top_rated, win);
+  memset(temp_v, 255, len);
+
+  for (u32 w = 0; w < TOPS_INDEX_WORDS(win); ++w) {
+
+    for (u64 bits = index[w]; bits; bits &= bits - 1) {
+
+      u32 i = (w << 6) + __builtin_ctzll(bits), e = afl->edge_lo + i;
+      if (!(temp_v[e >> 3] & (1 << (e & 7)))) { continue; }
+
+      struct queue_entry *q = top_rated[i];
+      trace_mini_clear((u64 *)temp_v, q->trace_mini);
+
+      favored[q->id] = 1;
+
+    }
 
   }
 
@@ -869,8 +1096,8 @@ static void cull_queue_div(afl_state_t *afl, u8 mode) {
 
   if (likely(!afl->div_score_changed || afl->non_instrumented_mode)) { return; }
 
+  u64 t0 = aflrun_prof_begin(afl);
   u32 len = (afl->fsrv.map_size >> 3);
-  u8 *temp_v = afl->map_tmp_buf;
 
   afl->div_score_changed = 0;
 
@@ -880,31 +1107,36 @@ static void cull_queue_div(afl_state_t *afl, u8 mode) {
   afl->tops = afl_realloc((void**)&afl->tops, sizeof(struct queue_entry**) * n);
   n = aflrun_get_all_tops((void***)afl->tops, mode);
 
-  for (size_t k = 0; k < n; ++k) {
-
-    struct queue_entry** top_rated = afl->tops[k];
-    memset(temp_v, 255, len);
+  size_t num_workers = aflrun_num_workers();
+  struct cull_div_ctx ctx;
+  ctx.afl = afl;
+  ctx.tops = afl->tops;
+  ctx.stride = (len + 7) & ~7U;
+  ctx.temp_v = ck_alloc_nozero(num_workers * ctx.stride);
+  ctx.favored = ck_alloc(num_workers * afl->queued_items);
 
-    for (u32 i = 0; i < afl->fsrv.map_size; ++i) {
+  aflrun_parallel_for(n, cull_queue_div_one, &ctx);
 
-      if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
+  /* Merge seeds favored by each worker, which does not depend on order. */
 
-        u32 j = len;
-        while (j--) {
+  for (size_t w = 0; w < num_workers; ++w) {
 
-          if (top_rated[i]->trace_mini[j]) {
+    u8 *favored = ctx.favored + w * afl->queued_items;
+    for (u32 k = 0; k < afl->num_active; ++k) {
 
-            temp_v[j] &= ~top_rated[i]->trace_mini[j];
+      u32 i = afl->aflrun_active[k];
+      if (favored[i]) { afl->queue_buf[i]->div_favored = 1; }
 
-          }
+    }
 
-        }
+  }
 
-        top_rated[i]->div_favored = 1;
+  ck_free(ctx.temp_v);
+  ck_free(ctx.favored);
 
-      }
+  if (unlikely(t0)) {
 
-    }
+    aflrun_add_phase(AFLRUN_PHASE_CULL_DIV, aflrun_ticks() - t0);
 
   }
 
@@ -1203,11 +1435,139 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
 
 }
 
+/* Read the whole testcase of `q` into `buf`. */
+
+static inline void queue_testcase_load(afl_state_t *afl,
+                                       struct queue_entry *q, u8 *buf) {
+
+  if (q->seg_stored == 1) {
+
+    segments_get(afl, q, buf, q->len);
+    return;
+
+  }
+
+  asyncw_wait(afl, q->write_seq);
+  int fd = open(q->fname, O_RDONLY);
+
+  if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
+
+  ck_read(fd, buf, q->len, q->fname);
+  close(fd);
+
+}
+
+/* With AFL_TESTCACHE_MMAP, testcases of large entries are private mappings
+   of their files, so the page cache holds them instead of the testcase
+   cache. Trimming writes a new file, so the mapping of the old one is
+   dropped then, and the new one is mapped when next needed. Mapped entries
+   are listed by last use, and beyond TESTCASE_MMAP_MAX of them the least
+   recently used one that is not being fuzzed is unmapped, as the testcase
+   cache evicts entries, so mappings never pile up toward vm.max_map_count. */
+
+static inline u8 queue_testcase_mmapped(afl_state_t *afl,
+                                        struct queue_entry *q) {
+
+  return afl->q_testcase_mmap_min && q->len >= afl->q_testcase_mmap_min &&
+         q->seg_stored != 1;
+
+}
+
+static void queue_testcase_mmap_unlink(afl_state_t *afl,
+                                       struct queue_entry *q) {
+
+  if (q->mmap_prev) {
+
+    q->mmap_prev->mmap_next = q->mmap_next;
+
+  } else {
+
+    afl->q_testcase_mmap_lru = q->mmap_next;
+
+  }
+
+  if (q->mmap_next) {
+
+    q->mmap_next->mmap_prev = q->mmap_prev;
+
+  } else {
+
+    afl->q_testcase_mmap_mru = q->mmap_prev;
+
+  }
+
+  q->mmap_prev = q->mmap_next = NULL;
+
+}
+
+static void queue_testcase_mmap_push(afl_state_t *afl,
+                                     struct queue_entry *q) {
+
+  q->mmap_prev = afl->q_testcase_mmap_mru;
+  q->mmap_next = NULL;
+  if (q->mmap_prev) {
+
+    q->mmap_prev->mmap_next = q;
+
+  } else {
+
+    afl->q_testcase_mmap_lru = q;
+
+  }
+
+  afl->q_testcase_mmap_mru = q;
+
+}
+
+static void queue_testcase_unmap(afl_state_t *afl, struct queue_entry *q) {
+
+  munmap(q->testcase_buf, q->testcase_mmap_len);
+  q->testcase_buf = NULL;
+  q->testcase_mmap_len = 0;
+  --afl->q_testcase_mmap_count;
+  queue_testcase_mmap_unlink(afl, q);
+
+}
+
+static void queue_testcase_map(afl_state_t *afl, struct queue_entry *q) {
+
+  struct queue_entry *old = afl->q_testcase_mmap_lru;
+  while (afl->q_testcase_mmap_count >= TESTCASE_MMAP_MAX && old) {
+
+    struct queue_entry *next = old->mmap_next;
+    if (old != afl->queue_cur) { queue_testcase_unmap(afl, old); }
+    old = next;
+
+  }
+
+  asyncw_wait(afl, q->write_seq);
+  int fd = open(q->fname, O_RDONLY);
+  if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
+
+  /* Writable, as trimming edits the testcase in place before rewriting */
+  u8 *buf = mmap(NULL, q->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (unlikely(buf == MAP_FAILED)) { PFATAL("Unable to mmap '%s'", q->fname); }
+
+  q->testcase_buf = buf;
+  q->testcase_mmap_len = q->len;
+  ++afl->q_testcase_mmap_count;
+  queue_testcase_mmap_push(afl, q);
+
+}
+
 /* after a custom trim we need to reload the testcase from disk */
 
 inline void queue_testcase_retake(afl_state_t *afl, struct queue_entry *q,
                                   u32 old_len) {
 
+  if (unlikely(q->testcase_mmap_len)) {
+
+    queue_testcase_unmap(afl, q);
+    return;
+
+  }
+
   if (likely(q->testcase_buf)) {
 
     u32 len = q->len;
@@ -1225,12 +1585,7 @@ inline void queue_testcase_retake(afl_state_t *afl, struct queue_entry *q,
 
     }
 
-    int fd = open(q->fname, O_RDONLY);
-
-    if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
-
-    ck_read(fd, q->testcase_buf, len, q->fname);
-    close(fd);
+    queue_testcase_load(afl, q, q->testcase_buf);
 
   }
 
@@ -1241,6 +1596,13 @@ inline void queue_testcase_retake(afl_state_t *afl, struct queue_entry *q,
 inline void queue_testcase_retake_mem(afl_state_t *afl, struct queue_entry *q,
                                       u8 *in, u32 len, u32 old_len) {
 
+  if (unlikely(q->testcase_mmap_len)) {
+
+    queue_testcase_unmap(afl, q);
+    return;
+
+  }
+
   if (likely(q->testcase_buf)) {
 
     u32 is_same = in == q->testcase_buf;
@@ -1264,42 +1626,114 @@ inline void queue_testcase_retake_mem(afl_state_t *afl, struct queue_entry *q,
 
 }
 
-/* Returns the testcase buf from the file behind this queue entry.
-  Increases the refcount. */
+/* Energy of `q` left in the current AFLRun cycle, used to tell which cached
+   testcases will be needed again soon. */
 
-inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
+static inline double aflrun_cache_energy(struct queue_entry *q) {
 
-  u32 len = q->len;
+  return q->aflrun_fuzzed ? 0 : q->quant_score;
 
-  /* first handle if no testcase cache is configured */
+}
 
-  if (unlikely(!afl->q_testcase_max_cache_size)) {
+/* Pick the cached testcase to evict for `q` in AFLRun mode: the one with
+   least energy left among AFLRUN_CACHE_PROBES random ones. Returns
+   `q_testcase_max_cache_count` if all of them have more energy left than
+   `q`, which is then better not cached at all. */
 
-    u8 *buf;
+static u32 aflrun_cache_victim(afl_state_t *afl, struct queue_entry *q) {
 
-    if (unlikely(q == afl->queue_cur)) {
+  u32    victim = afl->q_testcase_max_cache_count;
+  double min_energy = 0;
 
-      buf = afl_realloc((void **)&afl->testcase_buf, len);
+  for (u32 i = 0; i < AFLRUN_CACHE_PROBES; ++i) {
 
-    } else {
+    u32 tid;
+    do {
+
+      tid = rand_below(afl, afl->q_testcase_max_cache_count);
+
+    } while (afl->q_testcase_cache[tid] == NULL ||
 
-      buf = afl_realloc((void **)&afl->splicecase_buf, len);
+             afl->q_testcase_cache[tid] == afl->queue_cur);
+
+    double energy = aflrun_cache_energy(afl->q_testcase_cache[tid]);
+    if (victim == afl->q_testcase_max_cache_count || energy < min_energy) {
+
+      victim = tid;
+      min_energy = energy;
+      if (energy == 0) { break; }
 
     }
 
-    if (unlikely(!buf)) {
+  }
 
-      PFATAL("Unable to malloc '%s' with len %u", q->fname, len);
+  if (q != afl->queue_cur && min_energy > aflrun_cache_energy(q)) {
+
+    return afl->q_testcase_max_cache_count;
+
+  }
+
+  return victim;
+
+}
+
+/* Read the testcase of `q` into a scratch buffer, bypassing the cache. */
+
+static u8 *queue_testcase_read(afl_state_t *afl, struct queue_entry *q) {
+
+  u32 len = q->len;
+  u8 *buf;
+
+  if (unlikely(q == afl->queue_cur)) {
+
+    buf = afl_realloc((void **)&afl->testcase_buf, len);
+
+  } else {
+
+    buf = afl_realloc((void **)&afl->splicecase_buf, len);
+
+  }
+
+  if (unlikely(!buf)) {
+
+    PFATAL("Unable to malloc '%s' with len %u", q->fname, len);
+
+  }
+
+  queue_testcase_load(afl, q, buf);
+  return buf;
+
+}
+
+/* Returns the testcase buf from the file behind this queue entry.
+  Increases the refcount. */
+
+inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
+
+  u32 len = q->len;
+
+  if (unlikely(queue_testcase_mmapped(afl, q))) {
+
+    if (!q->testcase_buf) {
+
+      queue_testcase_map(afl, q);
+
+    } else if (q != afl->q_testcase_mmap_mru) {
+
+      queue_testcase_mmap_unlink(afl, q);
+      queue_testcase_mmap_push(afl, q);
 
     }
 
-    int fd = open(q->fname, O_RDONLY);
+    return q->testcase_buf;
 
-    if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
+  }
 
-    ck_read(fd, buf, len, q->fname);
-    close(fd);
-    return buf;
+  /* first handle if no testcase cache is configured */
+
+  if (unlikely(!afl->q_testcase_max_cache_size)) {
+
+    return queue_testcase_read(afl, q);
 
   }
 
@@ -1348,17 +1782,33 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
       /* Cache full. We neet to evict one or more to map one.
          Get a random one which is not in use */
 
-      do {
+      if (afl->is_aflrun) {
 
-        // if the cache (MB) is not enough for the queue then this gets
-        // undesirable because q_testcase_max_cache_count grows sometimes
-        // although the number of items in the cache will not change hence
-        // more and more loops
-        tid = rand_below(afl, afl->q_testcase_max_cache_count);
+        /* Evict seeds done with or not in the cycle, keeping the ones
+           with most energy left in memory until they are fuzzed. */
 
-      } while (afl->q_testcase_cache[tid] == NULL ||
+        tid = aflrun_cache_victim(afl, q);
+        if (tid == afl->q_testcase_max_cache_count) {
 
-               afl->q_testcase_cache[tid] == afl->queue_cur);
+          return queue_testcase_read(afl, q);
+
+        }
+
+      } else {
+
+        do {
+
+          // if the cache (MB) is not enough for the queue then this gets
+          // undesirable because q_testcase_max_cache_count grows sometimes
+          // although the number of items in the cache will not change hence
+          // more and more loops
+          tid = rand_below(afl, afl->q_testcase_max_cache_count);
+
+        } while (afl->q_testcase_cache[tid] == NULL ||
+
+                 afl->q_testcase_cache[tid] == afl->queue_cur);
+
+      }
 
       struct queue_entry *old_cached = afl->q_testcase_cache[tid];
       free(old_cached->testcase_buf);
@@ -1386,10 +1836,6 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
     /* Map the test case into memory. */
 
-    int fd = open(q->fname, O_RDONLY);
-
-    if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
-
     q->testcase_buf = malloc(len);
 
     if (unlikely(!q->testcase_buf)) {
@@ -1398,8 +1844,7 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
     }
 
-    ck_read(fd, q->testcase_buf, len, q->fname);
-    close(fd);
+    queue_testcase_load(afl, q, q->testcase_buf);
 
     /* Register testcase as cached */
     afl->q_testcase_cache[tid] = q;
@@ -1421,6 +1866,55 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
 }
 
+/* The seeds of an AFLRun cycle are fuzzed in `aflrun_queue` order, so the
+   next ones that are not cached are read ahead by the kernel while the
+   current one is fuzzed. Pages of a mapped testcase are also marked cold
+   once its seed is done with in the cycle. */
+
+void queue_testcase_prefetch(afl_state_t *afl) {
+
+  struct queue_entry **qs = afl->aflrun_queue + afl->aflrun_idx;
+  if (!qs[0]) { return; }
+
+#ifdef MADV_COLD
+  if (afl->aflrun_idx && qs[-1]->testcase_mmap_len) {
+
+    madvise(qs[-1]->testcase_buf, qs[-1]->testcase_mmap_len, MADV_COLD);
+
+  }
+
+#endif
+
+  for (u32 i = 1; i <= AFLRUN_CACHE_PREFETCH && qs[i]; ++i) {
+
+    if (unlikely(queue_testcase_mmapped(afl, qs[i]))) {
+
+      if (!qs[i]->testcase_buf) { queue_testcase_map(afl, qs[i]); }
+      madvise(qs[i]->testcase_buf, qs[i]->len, MADV_WILLNEED);
+      continue;
+
+    }
+
+    if (qs[i]->testcase_buf) { continue; }
+
+    if (qs[i]->seg_stored == 1) {
+
+      segments_prefetch(afl, qs[i]);
+      continue;
+
+    }
+
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(qs[i]->fname, O_RDONLY);
+    if (unlikely(fd < 0)) { continue; }
+    posix_fadvise(fd, 0, qs[i]->len, POSIX_FADV_WILLNEED);
+    close(fd);
+#endif
+
+  }
+
+}
+
 /* Adds the new queue entry to the cache. */
 
 inline void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q,
@@ -1431,7 +1925,8 @@ inline void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q,
   if (unlikely(afl->q_testcase_cache_size + len >=
                    afl->q_testcase_max_cache_size ||
                afl->q_testcase_cache_count >=
-                   afl->q_testcase_max_cache_entries - 1)) {
+                   afl->q_testcase_max_cache_entries - 1 ||
+               queue_testcase_mmapped(afl, q))) {
 
     // no space? will be loaded regularly later.
     return;
@@ -1484,17 +1979,64 @@ inline void queue_testcase_store_mem(afl_state_t *afl, struct queue_entry *q,
 
 }
 
+/* With `retire_extra`, drop disabled seeds from `aflrun_active` once they
+   hold no top-rated slot, and extra ones only if AFLRun can do without them,
+   which also forgets them there. Their files stay in the queue. `retired` is
+   scratch space for `num_active` ids. */
+
+static void retire_aflrun_seeds(afl_state_t *afl, u32 *retired) {
+
+  u32 kept = 0, num_retired = 0;
+
+  for (u32 k = 0; k < afl->num_active; k++) {
+
+    u32                 id = afl->aflrun_active[k];
+    struct queue_entry *q = afl->queue_buf[id];
+
+    if (!q->disabled || q->tc_ref ||
+        (q->aflrun_extra && !aflrun_can_retire(id))) {
+
+      afl->aflrun_active[kept++] = id;
+      continue;
+
+    }
+
+    q->quant_score = 0;
+    q->aflrun_fuzzed = 0;
+    q->div_favored = 0;
+    ck_free(q->infl_regions);
+    q->infl_regions = NULL;
+    q->infl_cnt = 0;
+    if (q->aflrun_extra) { retired[num_retired++] = id; }
+
+  }
+
+  afl->num_active = kept;
+  afl->queued_retired += num_retired;
+  aflrun_remove_seeds(retired, num_retired);
+
+}
+
 /* select seeds for aflrun to fuzz in this cycle */
 
 u32 select_aflrun_seeds(afl_state_t *afl) {
 
   afl->aflrun_seeds = afl_realloc(
     (void**)&afl->aflrun_seeds, afl->queued_items * sizeof(u32));
+  afl->aflrun_active = afl_realloc(
+    (void**)&afl->aflrun_active, afl->queued_items * sizeof(u32));
+
+  // Seeds added since the last cycle join the active ones
+  for (u32 i = afl->active_upto; i < afl->queued_items; i++)
+    afl->aflrun_active[afl->num_active++] = i;
+  afl->active_upto = afl->queued_items;
+
+  if (afl->retire_extra) { retire_aflrun_seeds(afl, afl->aflrun_seeds); }
 
   u32 idx = 0;
-  for (u32 i = 0; i < afl->queued_items; i++) {
+  for (u32 k = 0; k < afl->num_active; k++) {
 
-    struct queue_entry *q = afl->queue_buf[i];
+    struct queue_entry *q = afl->queue_buf[afl->aflrun_active[k]];
 
     if (!q->disabled) {
       afl->aflrun_seeds[idx++] = q->id;
@@ -1504,9 +2046,14 @@ u32 select_aflrun_seeds(afl_state_t *afl) {
     }
 
     q->quant_score = 0;
+    q->aflrun_fuzzed = 0;
+    // Others get their factors right after
+    if (unlikely(afl->journal) && q->disabled)
+      aflrun_journal_seed(q->id, 0);
 
   }
 
+  u64 t0 = aflrun_prof_begin(afl);
   if (aflrun_is_uni()) {
 
     // For unite mode, we select favored seeds for each of 3 modes
@@ -1521,7 +2068,9 @@ u32 select_aflrun_seeds(afl_state_t *afl) {
 
   }
 
-  return aflrun_cull_queue(afl->aflrun_seeds, idx);
+  u32 ret = aflrun_cull_queue(afl->aflrun_seeds, idx);
+  aflrun_prof_end(afl, AFLRUN_PROF_CULL, t0);
+  return ret;
 
 }
 
@@ -1540,6 +2089,177 @@ int cmp_quant_score(const void* a, const void* b) {
 
 }
 
+/* Replace the `n` seeds of the AFLRun cycle in `aflrun_queue` by the seeds
+   of as many draws of `aflrun_slice` quanta as their energy adds up to, each
+   drawn from an alias table weighted by energy. So each seed is expected to
+   be fuzzed for its energy, spread over the cycle, and the queue needs no
+   sorting. Drawing ahead keeps queue_testcase_prefetch() working. Returns
+   the number of draws. */
+
+u32 aflrun_alias_queue(afl_state_t *afl, u32 n) {
+
+  if (!n) { return 0; }
+
+  struct queue_entry **seeds = (struct queue_entry **)afl_realloc(
+      AFL_BUF_PARAM(ex), n * sizeof(struct queue_entry *));
+  afl->alias_table =
+      (u32 *)afl_realloc((void **)&afl->alias_table, n * sizeof(u32));
+  afl->alias_probability = (double *)afl_realloc(
+      (void **)&afl->alias_probability, n * sizeof(double));
+  double *P = (double *)afl_realloc(AFL_BUF_PARAM(out), n * sizeof(double));
+  int    *S = (int *)afl_realloc(AFL_BUF_PARAM(out_scratch), n * sizeof(u32));
+  int    *L = (int *)afl_realloc(AFL_BUF_PARAM(in_scratch), n * sizeof(u32));
+
+  if (!seeds || !P || !S || !L || !afl->alias_table ||
+      !afl->alias_probability) {
+
+    FATAL("could not acquire memory for alias table");
+
+  }
+
+  double sum = 0;
+  for (u32 i = 0; i < n; ++i) {
+
+    seeds[i] = afl->aflrun_queue[i];
+    sum += seeds[i]->quant_score;
+
+  }
+
+  for (u32 i = 0; i < n; ++i)
+    P[i] = seeds[i]->quant_score * n / sum;
+
+  build_alias_table(afl, P, S, L, n);
+
+  u32 draws = MAX((u32)ceil(sum / afl->aflrun_slice), 1U);
+  afl->aflrun_queue = afl_realloc((void **)&afl->aflrun_queue,
+                                  (draws + 1) * sizeof(struct queue_entry *));
+  if (!afl->aflrun_queue) { PFATAL("alloc"); }
+
+  for (u32 i = 0; i < draws; ++i) {
+
+    u32 s = rand_below(afl, n);
+    afl->aflrun_queue[i] = seeds[rand_next_percent(afl) <
+                                         afl->alias_probability[s]
+                                     ? s
+                                     : afl->alias_table[s]];
+
+  }
+
+  afl->aflrun_queue[draws] = NULL;
+  return draws;
+
+}
+
+/* Slot of `q` in the shared seed scheduler, inserted if it is not there yet.
+   Returns NULL when the table is full. */
+
+static aflrun_sched_slot_t *sched_slot(afl_state_t *afl,
+                                       struct queue_entry *q) {
+
+  aflrun_sched_slot_t *slots = AFLRUN_SCHED_SLOTS_OF(afl->aflrun_sched);
+  u64 key = (q->exec_cksum ^ q->path_cksum) | 1;
+
+  for (u32 i = 0; i < AFLRUN_SCHED_SLOTS; ++i) {
+
+    aflrun_sched_slot_t *s =
+        slots + (((key >> 1) + i) & (AFLRUN_SCHED_SLOTS - 1));
+    unsigned long long cur = atomic_load(&s->key);
+
+    if (cur == key) { return s; }
+    if (!cur && (atomic_compare_exchange_strong(&s->key, &cur, key) ||
+                 cur == key)) {
+
+      return s;
+
+    }
+
+  }
+
+  return NULL;
+
+}
+
+/* Remember the quanta spent on each seed of the new cycle so far, so the
+   ones spent by other instances during the cycle can be told. */
+
+void aflrun_sched_begin_cycle(afl_state_t *afl) {
+
+  for (u32 i = 0; afl->aflrun_queue[i]; ++i) {
+
+    struct queue_entry  *q = afl->aflrun_queue[i];
+    aflrun_sched_slot_t *s = sched_slot(afl, q);
+    q->sched_spent = s ? atomic_load(&s->spent) : 0;
+
+  }
+
+}
+
+/* Claim the next seed to fuzz from `aflrun_queue[aflrun_idx]` on with the
+   shared scheduler, and move it to `aflrun_idx`. Seeds whose energy was
+   spent by other instances are dropped from the cycle, and seeds being
+   fuzzed by other instances are postponed; if only those are left, the
+   first one is stolen. The energy of the claimed seed is reduced by what
+   others spent on it. Returns NULL at the end of the cycle. */
+
+struct queue_entry *aflrun_sched_next(afl_state_t *afl) {
+
+  struct queue_entry **qs = afl->aflrun_queue;
+  u32                  cur = afl->aflrun_idx, end = cur;
+  s32                  me = getpid();
+
+  while (qs[end]) { ++end; }
+
+  for (u32 i = cur; i < end;) {
+
+    struct queue_entry  *q = qs[i];
+    aflrun_sched_slot_t *s = sched_slot(afl, q);
+    if (!s) { return qs[i] = qs[cur], qs[cur] = q; }
+
+    double others = (atomic_load(&s->spent) - q->sched_spent) / 1000.0;
+    if (others >= q->quant_score) {
+
+      memmove(qs + i, qs + i + 1, (end - i) * sizeof(struct queue_entry *));
+      --end;
+      continue;
+
+    }
+
+    int owner = 0;
+    if (!atomic_compare_exchange_strong(&s->owner, &owner, me) &&
+        owner != me &&
+        !(kill(owner, 0) && errno == ESRCH &&
+          atomic_compare_exchange_strong(&s->owner, &owner, me))) {
+
+      ++i;                                   /* busy in another instance */
+      continue;
+
+    }
+
+    q->quant_score -= others;
+    memmove(qs + cur + 1, qs + cur, (i - cur) * sizeof(struct queue_entry *));
+    qs[cur] = q;
+    return q;
+
+  }
+
+  return qs[cur];
+
+}
+
+/* Account `quant` quanta spent on `q` to the shared scheduler, and release
+   it if we claimed it. */
+
+void aflrun_sched_done(afl_state_t *afl, struct queue_entry *q, double quant) {
+
+  aflrun_sched_slot_t *s = sched_slot(afl, q);
+  if (!s) { return; }
+
+  int me = getpid();
+  atomic_fetch_add(&s->spent, (unsigned long long)(quant * 1000));
+  atomic_compare_exchange_strong(&s->owner, &me, 0);
+
+}
+
 void disable_aflrun_extra(void* afl_void, u32 seed) {
 
   afl_state_t* afl = (afl_state_t *)afl_void;
@@ -27,6 +27,7 @@
 #include <limits.h>
 #include "afl-fuzz.h"
 #include "cmplog.h"
+#include "aflrun.h"
 
 //#define _DEBUG
 //#define CMPLOG_INTROSPECTION
@@ -2618,6 +2619,36 @@ static u8 rtn_fuzz(afl_state_t *afl, u32 key, u8 *orig_buf, u8 *buf, u8 *cbuf,
 
 }
 
+/* If compare `k` was logged from one of the `num` sorted reachable `blocks`,
+   as told by `cmp_map->blocks`. */
+
+static u8 cmp_in_blocks(afl_state_t *afl, u32 k, const reach_t *blocks,
+                        size_t num) {
+
+  u32 tag = afl->shm.cmp_map->blocks[k];
+  if (tag == CMP_BLOCK_UNKNOWN || tag == CMP_BLOCK_UNREACHABLE) { return 0; }
+
+  reach_t block = tag - 1;
+  size_t  lo = 0, hi = num;
+  while (lo < hi) {
+
+    size_t mid = lo + (hi - lo) / 2;
+    if (blocks[mid] < block) {
+
+      lo = mid + 1;
+
+    } else {
+
+      hi = mid;
+
+    }
+
+  }
+
+  return lo < num && blocks[lo] == block;
+
+}
+
 ///// Input to State stage
 
 // afl->queue_cur->exec_cksum
@@ -2766,11 +2797,33 @@ u8 input_to_state_stage(afl_state_t *afl, u8 *orig_buf, u8 *buf, u32 len) {
   u8 *cbuf = NULL;
 #endif
 
+  /* With `--config directed_cmplog=1`, compares of blocks that aflrun-pass
+     found to reach no target are ignored, and those of fringe and decisive
+     blocks of the seed are solved first, before the rest of the executions
+     it has under `budget_stages` run out. */
+
+  u8             directed = afl->is_aflrun && afl->directed_cmplog;
+  const reach_t *prio = NULL;
+  size_t         prio_cnt = 0;
+  if (unlikely(directed)) {
+
+    prio_cnt = aflrun_get_seed_decisives(afl->queue_cur->id, &prio);
+
+  }
+
   u32 k;
   for (k = 0; k < CMP_MAP_W; ++k) {
 
     if (!afl->shm.cmp_map->headers[k].hits) { continue; }
 
+    if (unlikely(directed) &&
+        afl->shm.cmp_map->blocks[k] == CMP_BLOCK_UNREACHABLE) {
+
+      afl->shm.cmp_map->headers[k].hits = 0;  // ignore this cmp
+      continue;
+
+    }
+
     if (afl->pass_stats[k].faileds >= CMPLOG_FAIL_MAX ||
         afl->pass_stats[k].total >= CMPLOG_FAIL_MAX) {
 
@@ -2798,32 +2851,52 @@ u8 input_to_state_stage(afl_state_t *afl, u8 *orig_buf, u8 *buf, u32 len) {
 
   }
 
-  for (k = 0; k < CMP_MAP_W; ++k) {
+  // Without `directed`, only the second pass is done, over all compares
+  for (u32 pass = directed ? 0 : 1; pass < 2; ++pass) {
 
-    if (!afl->shm.cmp_map->headers[k].hits) { continue; }
+    for (k = 0; k < CMP_MAP_W; ++k) {
+
+      if (!afl->shm.cmp_map->headers[k].hits) { continue; }
+
+      if (unlikely(directed)) {
+
+        if (cmp_in_blocks(afl, k, prio, prio_cnt) == pass) { continue; }
+        if (afl->cmplog_exec_limit &&
+            afl->fsrv.total_execs >= afl->cmplog_exec_limit) {
+
+          pass = 2;
+          break;
+
+        }
+
+      }
 
 #if defined(_DEBUG) || defined(CMPLOG_INTROSPECTION)
-    ++cmp_locations;
+      ++cmp_locations;
 #endif
 
-    if (afl->shm.cmp_map->headers[k].type == CMP_TYPE_INS) {
+      if (afl->shm.cmp_map->headers[k].type == CMP_TYPE_INS) {
 
-      if (unlikely(cmp_fuzz(afl, k, orig_buf, buf, cbuf, len, lvl, taint))) {
+        if (unlikely(
+                cmp_fuzz(afl, k, orig_buf, buf, cbuf, len, lvl, taint))) {
 
-        goto exit_its;
+          goto exit_its;
 
-      }
+        }
 
-    } else if ((lvl & LVL1)
+      } else if ((lvl & LVL1)
 
-               //#ifdef CMPLOG_SOLVE_TRANSFORM
-               || ((lvl & LVL3) && afl->cmplog_enable_transform)
-               //#endif
-    ) {
+                 //#ifdef CMPLOG_SOLVE_TRANSFORM
+                 || ((lvl & LVL3) && afl->cmplog_enable_transform)
+                 //#endif
+      ) {
 
-      if (unlikely(rtn_fuzz(afl, k, orig_buf, buf, cbuf, len, lvl, taint))) {
+        if (unlikely(
+                rtn_fuzz(afl, k, orig_buf, buf, cbuf, len, lvl, taint))) {
 
-        goto exit_its;
+          goto exit_its;
+
+        }
 
       }
 
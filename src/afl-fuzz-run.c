@@ -26,9 +26,17 @@
 
 #include "afl-fuzz.h"
 #include "aflrun.h"
+#include "aflrun-registry.h"
+#include "aflrun-record.h"
+#include "afl-probes.h"
+#include "afl-segments.h"
 #include <sys/time.h>
+#include <sys/ioctl.h>
 #include <signal.h>
 #include <limits.h>
+#ifdef __linux__
+  #include <sys/inotify.h>
+#endif
 #if !defined NAME_MAX
   #define NAME_MAX _XOPEN_NAME_MAX
 #endif
@@ -39,6 +47,123 @@
 u64 time_spent_working = 0;
 #endif
 
+/* Collect virgin context-sensitive paths reached in the last run. They are
+   logged by the runtime, but if the log is full, remaining ones are left
+   virgin, so we find them from context bits of blocks reached in this run,
+   and clear their virgin bits as what the runtime does. If `scan` is set,
+   the run did not log any of them (i.e. it ran in the forkserver pool, or
+   at a lowered level, see `aflrun_collect_deferred_paths`). */
+
+static void aflrun_collect_new_paths(afl_state_t *afl, u8 scan) {
+
+  afl_forkserver_t *fsrv = &afl->fsrv;
+  trace_t          *log = fsrv->trace_virgin;
+  size_t            num = log->num, cap = MAP_VTR_CAP(fsrv->num_reachables);
+
+  afl->paths_deferred = 0;
+  afl->new_paths = log->trace;
+  afl->num_new_paths = num;
+  if (likely(num <= cap && !scan)) { return; }
+
+  if (scan) { cap = 0; }
+  size_t  size = MAX(cap, (size_t)64);
+  ctx_t  *paths = afl_realloc(&afl->new_paths_buf, size * sizeof(ctx_t));
+  if (unlikely(!paths)) { PFATAL("alloc"); }
+  memcpy(paths, log->trace, cap * sizeof(ctx_t));
+  num = cap;
+
+  trace_t *dirty = fsrv->trace_dirty;
+  u8       all_blocks = dirty->num > fsrv->num_reachables;
+  size_t   n = all_blocks ? fsrv->num_reachables : dirty->num;
+  for (size_t i = 0; i < n; ++i) {
+
+    reach_t block = all_blocks ? (reach_t)i : dirty->trace[i].block;
+    /* Runtime sets bits of all contexts of muted blocks */
+    if (IS_SET(afl->shm_run.map_mute, block)) { continue; }
+    u8     *cur = fsrv->trace_ctx + CTX_NUM_BYTES * block;
+    u8     *vir = afl->virgin_ctx + CTX_NUM_BYTES * block;
+    for (u32 j = 0; j < CTX_NUM_BYTES; ++j) {
+
+      u8 bits = cur[j] & vir[j];
+      if (likely(!bits)) { continue; }
+      vir[j] &= ~bits;
+
+      for (u32 k = 0; k < 8; ++k) {
+
+        if (!(bits & (1 << k))) { continue; }
+        if (num == size) {
+
+          size *= 2;
+          paths = afl_realloc(&afl->new_paths_buf, size * sizeof(ctx_t));
+          if (unlikely(!paths)) { PFATAL("alloc"); }
+
+        }
+
+        paths[num].block = block;
+        paths[num].call_ctx = j * 8 + k;
+        ++num;
+
+      }
+
+    }
+
+  }
+
+  afl->new_paths = paths;
+  afl->num_new_paths = num;
+
+}
+
+/* Checksum of context-sensitive path of the last run, i.e. of `trace_ctx`.
+   It is a XOR of hashes of context bits of each reached block, so only
+   blocks in the dirty log are hashed instead of the whole map, unless the
+   runtime does not support the log. Callers comparing runs take it only
+   once the cheaper `exec_cksum` matches. */
+
+u64 aflrun_path_cksum(afl_forkserver_t *fsrv) {
+
+  trace_t *dirty = fsrv->trace_dirty;
+  u8       all_blocks = dirty->num > fsrv->num_reachables;
+  size_t   n = all_blocks ? fsrv->num_reachables : dirty->num;
+  u64      cksum = 0;
+  for (size_t i = 0; i < n; ++i) {
+
+    reach_t block = all_blocks ? (reach_t)i : dirty->trace[i].block;
+    u8     *cur = fsrv->trace_ctx + CTX_NUM_BYTES * block;
+
+    // Zero blocks are skipped, so both ways give the same checksum
+    u32 j = 0;
+    while (j < CTX_NUM_BYTES && !cur[j])
+      ++j;
+    if (j < CTX_NUM_BYTES)
+      cksum ^= hash64(cur, CTX_NUM_BYTES, HASH_CONST ^ block);
+
+  }
+
+  return cksum;
+
+}
+
+/* Account a run that was waited for from `t1` to `t2`, the time since the
+   end of last run counts as fuzzing time. */
+
+static inline void account_exec_time(afl_state_t *afl, u64 t1, u64 t2) {
+
+  u64 fuzz_time_cur = t1 - afl->last_exec_time;
+  u64 exec_time_cur = t2 - t1;
+  afl->last_exec_time = t2;
+
+  afl->exec_time += exec_time_cur;
+  afl->fuzz_time += fuzz_time_cur;
+  if (unlikely(afl->exec_time_short + afl->fuzz_time_short >
+      5 * 1000 * 1000)) {
+      afl->exec_time_short = afl->fuzz_time_short = 0;
+  }
+  afl->exec_time_short += exec_time_cur;
+  afl->fuzz_time_short += fuzz_time_cur;
+
+}
+
 /* Execute target application, monitoring for timeouts. Return status
    information. The called program will update afl->fsrv->trace_bits. */
 
@@ -60,22 +185,16 @@ fuzz_run_target(afl_state_t *afl, afl_forkserver_t *fsrv, u32 timeout) {
 #endif
 
   u64 t1 = get_cur_time_us();
-  u64 fuzz_time_cur = t1 - afl->last_exec_time;
 
   fsrv_run_result_t res = afl_fsrv_run_target(fsrv, timeout, &afl->stop_soon);
+  if (fsrv == &afl->fsrv && fsrv->num_reachables) {
 
-  u64 t2 = get_cur_time_us();
-  u64 exec_time_cur = t2 - t1;
-  afl->last_exec_time = t2;
+    aflrun_collect_new_paths(afl, 0);
+    afl->paths_deferred = fsrv->aflrun_level != AFLRUN_LEVEL_FULL;
 
-  afl->exec_time += exec_time_cur;
-  afl->fuzz_time += fuzz_time_cur;
-  if (unlikely(afl->exec_time_short + afl->fuzz_time_short >
-      5 * 1000 * 1000)) {
-      afl->exec_time_short = afl->fuzz_time_short = 0;
   }
-  afl->exec_time_short += exec_time_cur;
-  afl->fuzz_time_short += fuzz_time_cur;
+
+  account_exec_time(afl, t1, get_cur_time_us());
 
 #ifdef PROFILING
   clock_gettime(CLOCK_REALTIME, &spec);
@@ -86,14 +205,19 @@ fuzz_run_target(afl_state_t *afl, afl_forkserver_t *fsrv, u32 timeout) {
 
 }
 
-/* Write modified data to file for testing. If afl->fsrv.out_file is set, the
-   old file is unlinked and a new one is created. Otherwise, afl->fsrv.out_fd is
-   rewound and truncated. */
+/* Write modified data to file for testing. If fsrv->out_file is set, the
+   old file is unlinked and a new one is created. Otherwise, fsrv->out_fd is
+   rewound and truncated. If havoc set `delta_gen` for this write, only the
+   span it changed is copied to shared memory when possible. */
 
-u32 __attribute__((hot))
-write_to_testcase(afl_state_t *afl, void **mem, u32 len, u32 fix) {
+static u32 __attribute__((hot))
+write_to_fsrv(afl_state_t *afl, afl_forkserver_t *fsrv, void **mem, u32 len,
+              u32 fix) {
 
-  u8 sent = 0;
+  u8  sent = 0;
+  u32 in_len = len;
+  u64 gen = afl->delta_gen;
+  afl->delta_gen = 0;
 
   if (unlikely(afl->custom_mutators_count)) {
 
@@ -170,7 +294,7 @@ write_to_testcase(afl_state_t *afl, void **mem, u32 len, u32 fix) {
     if (likely(!sent)) {
 
       /* everything as planned. use the potentially new data. */
-      afl_fsrv_write_to_testcase(&afl->fsrv, *mem, new_size);
+      afl_fsrv_write_to_testcase(fsrv, *mem, new_size);
       len = new_size;
 
     }
@@ -205,7 +329,16 @@ write_to_testcase(afl_state_t *afl, void **mem, u32 len, u32 fix) {
     if (likely(!sent)) {
 
       /* boring uncustom. */
-      afl_fsrv_write_to_testcase(&afl->fsrv, *mem, len);
+      if (gen && len == in_len) {
+
+        afl_fsrv_write_delta(fsrv, *mem, len, gen, afl->havoc_lo,
+                             afl->havoc_hi);
+
+      } else {
+
+        afl_fsrv_write_to_testcase(fsrv, *mem, len);
+
+      }
 
     }
 
@@ -233,6 +366,13 @@ write_to_testcase(afl_state_t *afl, void **mem, u32 len, u32 fix) {
 
 }
 
+u32 __attribute__((hot))
+write_to_testcase(afl_state_t *afl, void **mem, u32 len, u32 fix) {
+
+  return write_to_fsrv(afl, &afl->fsrv, mem, len, fix);
+
+}
+
 /* The same, but with an adjustable gap. Used for trimming. */
 
 static void write_with_gap(afl_state_t *afl, u8 *mem, u32 len, u32 skip_at,
@@ -320,6 +460,7 @@ static void write_with_gap(afl_state_t *afl, u8 *mem, u32 len, u32 skip_at,
     }
 
     *afl->fsrv.shmem_fuzz_len = new_size;
+    afl->fsrv.shmem_fuzz_gen = 0;
 
 #ifdef _DEBUG
     if (afl->debug) {
@@ -390,6 +531,133 @@ static void write_with_gap(afl_state_t *afl, u8 *mem, u32 len, u32 skip_at,
 
 }
 
+static inline u64 summary_get(const u8 **p, const u8 *end) {
+
+  u64 v;
+  *p = aflrun_get_varint(*p, end, &v);
+  if (unlikely(!*p)) { FATAL("Truncated AFLRun summary"); }
+  return v;
+
+}
+
+/* Set the maps of afl->fsrv from the loaded summary as if the target just
+   ran, the same way afl_fsrv_copy_result() does for runs of the pool, and
+   return the fault of the run. */
+
+static u8 aflrun_replay_summary(afl_state_t *afl) {
+
+  afl_forkserver_t *fsrv = &afl->fsrv;
+  reach_t           nr = fsrv->num_reachables, nf = fsrv->num_freachables;
+  const u8         *p = afl->summary_buf, *end = p + afl->summary_len;
+  u64               idx;
+
+  if (unlikely(afl->summary_len < 3)) { FATAL("Truncated AFLRun summary"); }
+  u8 fault = p[1];
+  p += 3;  // kind, fault and inc, followed by seed and len
+  summary_get(&p, end);
+  summary_get(&p, end);
+
+  memset(fsrv->trace_bits, 0, fsrv->map_size);
+  idx = 0;
+  for (u64 n = summary_get(&p, end); n > 0; --n) {
+
+    idx += summary_get(&p, end);
+    if (unlikely(idx >= fsrv->map_size || p == end)) {
+
+      FATAL("Invalid edge in AFLRun summary");
+
+    }
+
+    fsrv->trace_bits[idx] = *p++;
+
+  }
+
+  if (!nr) { return fault; }
+
+  trace_t *dirty = fsrv->trace_dirty;
+  u8       log_dirty = dirty->num <= nr;
+  if (log_dirty) {
+
+    for (size_t i = 0; i < dirty->num; ++i)
+      memset(fsrv->trace_ctx + CTX_NUM_BYTES * dirty->trace[i].block, 0,
+             CTX_NUM_BYTES);
+    dirty->num = 0;
+
+  } else {
+
+    memset(fsrv->trace_ctx, 0, MAP_TR_SIZE(nr));
+
+  }
+
+  memset(fsrv->trace_reachables, 0, MAP_RBB_SIZE(nr));
+  memset(fsrv->trace_freachables, 0, MAP_RF_SIZE(nf));
+
+  u8 *maps[2] = {fsrv->trace_reachables, fsrv->trace_freachables};
+  u64 sizes[2] = {nr, nf};
+  for (u32 m = 0; m < 2; ++m) {
+
+    idx = 0;
+    for (u64 n = summary_get(&p, end); n > 0; --n) {
+
+      idx += summary_get(&p, end);
+      if (unlikely(idx >= sizes[m])) { FATAL("Invalid AFLRun summary"); }
+      maps[m][idx / 8] |= 1 << (idx % 8);
+
+    }
+
+  }
+
+  idx = 0;
+  for (u64 n = summary_get(&p, end); n > 0; --n) {
+
+    idx += summary_get(&p, end);
+    if (unlikely(idx >= (u64)nr * CTX_SIZE)) {
+
+      FATAL("Invalid context in AFLRun summary");
+
+    }
+
+    fsrv->trace_ctx[idx / 8] |= 1 << (idx % 8);
+
+    // Indexes are sorted, so each block is logged once
+    reach_t block = idx / CTX_SIZE;
+    if (log_dirty &&
+        (!dirty->num || dirty->trace[dirty->num - 1].block != block)) {
+
+      dirty->trace[dirty->num].block = block;
+      dirty->trace[dirty->num++].call_ctx = 0;
+
+    }
+
+  }
+
+  // Virgin paths of the summary are found again against our virgin bits
+  for (u64 n = summary_get(&p, end); n > 0; --n) {
+
+    summary_get(&p, end);
+    summary_get(&p, end);
+
+  }
+
+  trace_t *targets = fsrv->trace_targets;
+  targets->num = 0;
+  for (u64 n = summary_get(&p, end); n > 0; --n) {
+
+    ctx_t c;
+    c.block = summary_get(&p, end);
+    c.call_ctx = summary_get(&p, end);
+    if (targets->num < MAP_VTR_CAP(nr)) { targets->trace[targets->num] = c; }
+    ++targets->num;
+
+  }
+
+  fsrv->trace_virgin->num = 0;
+  aflrun_collect_new_paths(afl, 1);
+
+  return fault;
+
+}
+
 static void aflrun_new_bits(afl_state_t* afl, struct queue_entry* q) {
 
   // Skip for following calibration of a new seed
@@ -397,39 +665,87 @@ static void aflrun_new_bits(afl_state_t* afl, struct queue_entry* q) {
     return;
 
   if (q->tested == 0) {
+    if (unlikely(afl->afl_env.afl_record_traces))
+      aflrun_record_exec(afl, AFLRUN_RECORD_IMPORT, q->id, q->len,
+        FSRV_RUN_OK, 0);
     // For imported case, we need to get its path for first calibration
+    aflrun_collect_deferred_paths(afl);
+    u64 t0 = aflrun_prof_begin(afl);
     aflrun_has_new_path(afl->fsrv.trace_freachables,
       afl->fsrv.trace_reachables, afl->fsrv.trace_ctx,
-      afl->fsrv.trace_virgin->trace, afl->fsrv.trace_virgin->num,
+      afl->new_paths, afl->num_new_paths,
       0, q->id, NULL, NULL, 0); // For imported case, we don't do seed isolation.
-    q->path_cksum = hash64(afl->fsrv.trace_ctx,
-      MAP_TR_SIZE(afl->fsrv.num_reachables), HASH_CONST);
+    aflrun_prof_end(afl, AFLRUN_PROF_NEW_PATH, t0);
+    q->path_cksum = aflrun_path_cksum(&afl->fsrv);
     // xargs -I{} cp -u {} /tmp/in/
+    // Dump fringes right after each imported seed, written directly to the
+    // per-seed files instead of copying the latest dumps with `cp`.
     if (getenv("AFLRUN_TRACE_CORPUS")) {
-      u8* fn; int r;
-      aflrun_write_to_log(afl);
-
-      fn = alloc_printf("cp '%s/aflrun_fringe.txt' '%s/aflrun_fringe_%u.txt'",
-        afl->out_dir, afl->out_dir, q->id);
-      r = system(fn);
-      if (r) FATAL("cp failed");
-      ck_free(fn);
-      fn = alloc_printf("cp %s/aflrun_pro_fringe.txt %s/aflrun_pro_fringe_%u.txt",
-        afl->out_dir, afl->out_dir, q->id);
-      r = system(fn);
-      if (r) FATAL("cp failed");
-      ck_free(fn);
-      fn = alloc_printf("cp %s/aflrun_targets.txt %s/aflrun_targets_%u.txt",
-        afl->out_dir, afl->out_dir, q->id);
-      r = system(fn);
-      if (r) FATAL("cp failed");
-      ck_free(fn);
+      static const char* names[] = {"fringe", "pro_fringe", "targets"};
+      for (u8 i = 0; i < 3; ++i) {
+        u8* fn = alloc_printf("%s/aflrun_%s_%u.txt",
+          afl->out_dir, names[i], q->id);
+        aflrun_log_fringes(fn, i);
+        ck_free(fn);
+      }
     }
   }
 
   q->tested = 2;
 }
 
+static void pool_discard(afl_state_t *afl);
+
+/* Start the next calibration run of `mem` on the forkserver pool, so that
+   calibration runs of a test case overlap while calibrate_case() processes
+   their results one by one and in order, as if they had run on afl->fsrv. */
+
+static void pool_start_cal(afl_state_t *afl, u8 *mem, u32 len) {
+
+  struct fsrv_pool_entry *e = afl->fsrv_pool + afl->fsrv_pool_next;
+
+  (void)write_to_fsrv(afl, &e->fsrv, (void **)&mem, len, 1);
+
+  if (afl->fsrv.num_reachables) {
+
+    memcpy(e->shm_run.div_switch, afl->shm_run.div_switch,
+           MAP_RBB_SIZE(afl->fsrv.num_reachables));
+
+  }
+
+  e->start_us = get_cur_time_us();
+  afl_fsrv_start_run(&e->fsrv, &afl->stop_soon);
+  afl->fsrv_pool_next = (afl->fsrv_pool_next + 1) % afl->fsrv_pool_cnt;
+  ++afl->fsrv_pool_busy;
+
+}
+
+/* Wait for the oldest calibration run in the pool and copy its maps to those
+   of afl->fsrv, adding the time from its start to `*exec_us`. */
+
+static fsrv_run_result_t pool_finish_cal(afl_state_t *afl, u32 timeout,
+                                         u64 *exec_us) {
+
+  struct fsrv_pool_entry *e =
+      afl->fsrv_pool +
+      (afl->fsrv_pool_next + afl->fsrv_pool_cnt - afl->fsrv_pool_busy) %
+          afl->fsrv_pool_cnt;
+  --afl->fsrv_pool_busy;
+
+  u64 t1 = get_cur_time_us();
+  fsrv_run_result_t fault =
+      afl_fsrv_finish_run(&e->fsrv, timeout, &afl->stop_soon);
+  u64 t2 = get_cur_time_us();
+  account_exec_time(afl, t1, t2);
+  *exec_us += t2 - e->start_us;
+
+  afl_fsrv_copy_result(&afl->fsrv, &e->fsrv);
+  if (afl->fsrv.num_reachables) { aflrun_collect_new_paths(afl, 1); }
+
+  return fault;
+
+}
+
 /* Calibrate a new test case. This is done when processing the input directory
    to warn about flaky or otherwise problematic test cases early on; and when
    new paths are discovered to detect variable behavior and so on. */
@@ -442,7 +758,16 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
   u64 start_us, stop_us, diff_us;
   s32 old_sc = afl->stage_cur, old_sm = afl->stage_max;
   u32 use_tmout = afl->fsrv.exec_tmout;
-  u8 *old_sn = afl->stage_name;
+  u8 *old_sn = afl->stage_name, *orig_mem = use_mem;
+
+  /* A summary loaded by the dry run stands for the runs of the target. */
+  u8 replay = afl->summary_len != 0;
+
+  /* The run that found the entry counts as the first one, unless the target
+     has shown variable behavior; cmplog forgets its checksum below. */
+  u8  adaptive = afl->afl_env.afl_cal_adaptive && !first_run && !replay &&
+                !afl->queued_variable && !afl->shm.cmplog_mode;
+  u32 stable = 0;
 
   if (unlikely(afl->shm.cmplog_mode)) { q->exec_cksum = 0; }
 
@@ -459,8 +784,12 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
   ++q->cal_failed;
 
+  /* Calibration sees whole runs, so it measures and crashes as usual. */
+  if (afl->aflrun_num_goals) { aflrun_arm_goals(afl, 0); }
+
   afl->stage_name = "calibration";
   afl->stage_max = afl->afl_env.afl_cal_fast ? CAL_CYCLES_FAST : CAL_CYCLES;
+  if (unlikely(replay)) { afl->stage_max = 1; }
 
   /* Make sure the forkserver is up before we do anything, and let's not
      count its spin-up time toward binary calibration. */
@@ -489,8 +818,19 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
   }
 
+  if (afl->fsrv_pool_cnt && !afl->fsrv_pool) { setup_fsrv_pool(afl); }
+
+  /* With AFL_FSRV_POOL, the runs overlap on the pool when it is idle, i.e.
+     in the dry run or when calibrating outside of havoc; their time is
+     summed up instead of the wall time of the stage. */
+
+  u8  pool = afl->fsrv_pool_cnt && !afl->fsrv_pool_busy && !replay &&
+            !afl->shm.cmplog_mode;
+  u32 started = 0;
+  u64 pool_us = 0;
+
   /* we need a dummy run if this is LTO + cmplog */
-  if (unlikely(afl->shm.cmplog_mode)) {
+  if (unlikely(afl->shm.cmplog_mode) && !replay) {
 
     (void)write_to_testcase(afl, (void **)&use_mem, q->len, 1);
 
@@ -547,12 +887,32 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
     u64 cksum;
 
-    (void)write_to_testcase(afl, (void **)&use_mem, q->len, 1);
+    if (unlikely(replay)) {
 
-    if (q->tested == 0)
-      afl->fsrv.testing = 1;
-    fault = fuzz_run_target(afl, &afl->fsrv, use_tmout);
-    afl->fsrv.testing = 0;
+      fault = aflrun_replay_summary(afl);
+
+    } else if (pool) {
+
+      while (started < afl->stage_max &&
+             afl->fsrv_pool_busy < afl->fsrv_pool_cnt) {
+
+        pool_start_cal(afl, use_mem, q->len);
+        ++started;
+
+      }
+
+      fault = pool_finish_cal(afl, use_tmout, &pool_us);
+
+    } else {
+
+      (void)write_to_testcase(afl, (void **)&use_mem, q->len, 1);
+
+      if (q->tested == 0)
+        afl->fsrv.testing = 1;
+      fault = fuzz_run_target(afl, &afl->fsrv, use_tmout);
+      afl->fsrv.testing = 0;
+
+    }
 
     /* afl->stop_soon is set by the handler for Ctrl+C. When it's pressed,
        we want to bail out quickly. */
@@ -575,7 +935,8 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
     if (unlikely(!q->bitsmap_size)) q->bitsmap_size = afl->bitsmap_size;
 #endif
 
-    classify_counts(&afl->fsrv);
+    // Hit counts of summaries are classified already
+    if (likely(!replay)) { classify_counts(&afl->fsrv); }
     cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
 
     aflrun_new_bits(afl, q);
@@ -617,8 +978,14 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
             afl->var_bytes[i] = 1;
             // ignore the variable edge by setting it to fully discovered
-            for (size_t j = 0; j < afl->num_maps; ++j)
-              afl->virgins[j][i] = 0;
+            afl->virgins[0][i] = 0;
+            if (i - afl->edge_lo < afl->edge_hi - afl->edge_lo) {
+
+              for (size_t j = 1; j < afl->num_maps; ++j)
+                VIRGIN_BYTE(afl->virgins[j], i - afl->edge_lo,
+                            afl->virgin_stride) = 0;
+
+            }
 
           }
 
@@ -652,12 +1019,29 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
     }
 
+    if (unlikely(adaptive) && !var_detected && cksum == q->exec_cksum &&
+        aflrun_path_cksum(&afl->fsrv) == q->path_cksum &&
+        ++stable >= CAL_CYCLES_ADAPTIVE) {
+
+      afl->stage_max = afl->stage_cur + 1;
+      break;
+
+    }
+
   }
 
   if (unlikely(afl->fixed_seed)) {
 
     diff_us = (u64)(afl->fsrv.exec_tmout - 1) * (u64)afl->stage_max;
 
+  } else if (unlikely(replay)) {
+
+    diff_us = MAX(afl->summary_exec_us, 1ULL) * afl->stage_max;
+
+  } else if (pool) {
+
+    diff_us = MAX(pool_us, 1ULL);
+
   } else {
 
     stop_us = get_cur_time_us();
@@ -687,6 +1071,14 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
   afl->total_bitmap_size += q->bitmap_size;
   ++afl->total_bitmap_entries;
 
+  if (unlikely(aflrun_seed_summary()) && !replay) {
+
+    aflrun_write_summary(afl, q, orig_mem);
+
+  }
+
+  if (unlikely(replay)) { ++afl->summary_replayed; }
+
   update_bitmap_score(afl, q);
   aflrun_update_fringe_score(q->id);
 
@@ -702,6 +1094,11 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
 abort_calibration:
 
+  /* Runs started ahead of an early end of the stage are not needed. */
+  if (pool) { pool_discard(afl); }
+
+  afl->summary_len = 0;
+
   if (new_bits == 2 && !q->has_new_cov) {
 
     q->has_new_cov = 1;
@@ -728,6 +1125,8 @@ abort_calibration:
   afl->stage_cur = old_sc;
   afl->stage_max = old_sm;
 
+  if (afl->aflrun_num_goals) { aflrun_arm_goals(afl, afl->aflrun_num_goals); }
+
   if (!first_run) { show_stats(afl); }
 
   // This commit can commit sequences from both `save_if_interesting` and
@@ -746,207 +1145,1101 @@ abort_calibration:
 
 }
 
-/* Grab interesting test cases from other fuzzers. */
+/* Postpone calibrate_case() of a new queue entry found by
+   save_if_interesting() to calibrate_deferred(), keeping the classified
+   trace it was found with. */
 
-void sync_fuzzers(afl_state_t *afl) {
+void defer_calibration(afl_state_t *afl, struct queue_entry *q, u32 handicap) {
 
-  DIR           *sd;
-  struct dirent *sd_ent;
-  u32            sync_cnt = 0, synced = 0, entries = 0;
-  u8             path[PATH_MAX + 1 + NAME_MAX];
+  afl->cal_pending = afl_realloc((void **)&afl->cal_pending,
+                                 (afl->cal_pending_cnt + 1) *
+                                     sizeof(struct cal_pending_entry));
+  if (unlikely(!afl->cal_pending)) { PFATAL("alloc"); }
 
-  sd = opendir(afl->sync_dir);
-  if (!sd) { PFATAL("Unable to open '%s'", afl->sync_dir); }
+  if (afl->cal_pending_cnt == afl->cal_pending_alloc) {
 
-  afl->stage_max = afl->stage_cur = 0;
-  afl->cur_depth = 0;
+    afl->cal_pending[afl->cal_pending_alloc++].trace =
+        ck_alloc(afl->fsrv.map_size);
 
-  /* Look at the entries created for every other fuzzer in the sync directory.
-   */
+  }
 
-  while ((sd_ent = readdir(sd))) {
+  struct cal_pending_entry *e = afl->cal_pending + afl->cal_pending_cnt++;
+  e->q = q;
+  e->handicap = handicap;
+  memcpy(e->trace, afl->fsrv.trace_bits, afl->fsrv.map_size);
 
-    u8  qd_synced_path[PATH_MAX], qd_path[PATH_MAX];
-    u32 min_accept = 0, next_min_accept = 0;
+}
 
-    s32 id_fd;
+/* Calibrate the queue entries postponed by defer_calibration(), in the order
+   they were found. Their virgin maps are taken again, as fringes may have
+   changed since. */
 
-    /* Skip dot files and our own output directory. */
+void calibrate_deferred(afl_state_t *afl) {
 
-    if (sd_ent->d_name[0] == '.' || !strcmp(afl->sync_id, sd_ent->d_name)) {
+  for (u32 i = 0; i < afl->cal_pending_cnt && !afl->stop_soon; ++i) {
 
-      continue;
+    struct cal_pending_entry *e = afl->cal_pending + i;
+    struct queue_entry       *q = e->q;
 
-    }
+    size_t n = aflrun_max_clusters(q->id);
+    afl->virgins = afl_realloc((void **)&afl->virgins, sizeof(u8 *) * n);
+    afl->clusters = afl_realloc((void **)&afl->clusters, sizeof(size_t) * n);
+    afl->virgins[0] = afl->virgin_bits;
+    afl->clusters[0] = 0;
+    afl->num_maps =
+        aflrun_get_seed_virgins(q->id, afl->virgins + 1, afl->clusters + 1) +
+        1;
 
-    entries++;
+    /* calibrate_case() starts from the trace the entry was queued with. */
 
-    // secondary nodes only syncs from main, the main node syncs from everyone
-    if (likely(afl->is_secondary_node)) {
+    memcpy(afl->fsrv.trace_bits, e->trace, afl->fsrv.map_size);
 
-      sprintf(qd_path, "%s/%s/is_main_node", afl->sync_dir, sd_ent->d_name);
-      int res = access(qd_path, F_OK);
-      if (unlikely(afl->is_main_node)) {  // an elected temporary main node
+    u8 res = calibrate_case(afl, q, queue_testcase_get(afl, q), e->handicap, 0);
 
-        if (likely(res == 0)) {  // there is another main node? downgrade.
+    if (unlikely(res == FSRV_RUN_ERROR)) {
 
-          afl->is_main_node = 0;
-          sprintf(qd_path, "%s/is_main_node", afl->out_dir);
-          unlink(qd_path);
+      FATAL("Unable to execute target application");
 
-        }
+    }
 
-      } else {
+  }
 
-        if (likely(res != 0)) { continue; }
+  afl->cal_pending_cnt = 0;
 
-      }
+}
 
-    }
+/* Store indexes of bits set in first `bits` bits of `map` to `*buf` and
+   return the number of them. */
 
-    synced++;
+static u64 aflrun_set_bits(const u8 *map, u64 bits, u64 **buf) {
 
-    /* document the attempt to sync to this instance */
+  u64 num = 0;
+  for (u64 i = 0; i < bits; i += 64) {
 
-    sprintf(qd_synced_path, "%s/.synced/%s.last", afl->out_dir, sd_ent->d_name);
-    id_fd =
-        open(qd_synced_path, O_RDWR | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
-    if (id_fd >= 0) close(id_fd);
+    u64 w = 0;
+    if (bits - i >= 64) {
 
-    /* Skip anything that doesn't have a queue/ subdirectory. */
+      memcpy(&w, map + i / 8, sizeof(u64));
 
-    sprintf(qd_path, "%s/%s/queue", afl->sync_dir, sd_ent->d_name);
+    } else {
 
-    struct dirent **namelist = NULL;
-    int             m = 0, n, o;
+      memcpy(&w, map + i / 8, (bits - i + 7) / 8);
+      w &= (1ULL << (bits - i)) - 1;
 
-    n = scandir(qd_path, &namelist, NULL, alphasort);
+    }
 
-    if (n < 1) {
+    for (; w; w &= w - 1) {
 
-      if (namelist) free(namelist);
-      continue;
+      *buf = afl_realloc((void **)buf, (num + 1) * sizeof(u64));
+      if (unlikely(!*buf)) { PFATAL("alloc"); }
+      (*buf)[num++] = i + __builtin_ctzll(w);
 
     }
 
-    /* Retrieve the ID of the last seen test case. */
+  }
 
-    sprintf(qd_synced_path, "%s/.synced/%s", afl->out_dir, sd_ent->d_name);
+  return num;
 
-    id_fd = open(qd_synced_path, O_RDWR | O_CREAT, DEFAULT_PERMISSION);
+}
 
-    if (id_fd < 0) { PFATAL("Unable to create '%s'", qd_synced_path); }
+/* Write AFLRun coverage of the queue entry just saved to queue/.aflrun/,
+   so other instances can skip executing it when syncing. */
 
-    if (read(id_fd, &min_accept, sizeof(u32)) == sizeof(u32)) {
+void aflrun_write_sync_meta(afl_state_t *afl, struct queue_entry *q) {
 
-      next_min_accept = min_accept;
-      lseek(id_fd, 0, SEEK_SET);
+  static u64 *ctx_buf, *block_buf;
+  static u8   dir_created;
+  reach_t     nr = afl->fsrv.num_reachables;
 
-    }
+  aflrun_sync_meta_t meta = {.magic = AFLRUN_SYNC_META_MAGIC,
+                             .path_cksum = q->path_cksum,
+                             .num_reachables = nr};
+  meta.num_ctx =
+      aflrun_set_bits(afl->fsrv.trace_ctx, (u64)nr * CTX_SIZE, &ctx_buf);
+  meta.num_blocks = aflrun_set_bits(afl->fsrv.trace_reachables, nr, &block_buf);
 
-    /* Show stats */
+  // Blocks are stored as `reach_t`, narrow them in place
+  reach_t *blocks = (reach_t *)block_buf;
+  for (reach_t i = 0; i < meta.num_blocks; ++i)
+    blocks[i] = block_buf[i];
 
-    snprintf(afl->stage_name_buf, STAGE_BUF_SIZE, "sync %u", ++sync_cnt);
+  u8 *dir = alloc_printf("%s/queue/" AFLRUN_SYNC_META_DIR, afl->out_dir);
+  if (unlikely(!dir_created)) {
 
-    afl->stage_name = afl->stage_name_buf;
-    afl->stage_cur = 0;
-    afl->stage_max = 0;
+    if (mkdir(dir, 0700) && errno != EEXIST) {
 
-    /* For every file queued by this fuzzer, parse ID and see if we have
-       looked at it before; exec a test case if not. */
+      PFATAL("Unable to create '%s'", dir);
 
-    u8 entry[12];
-    sprintf(entry, "id:%06u", next_min_accept);
+    }
 
-    while (m < n) {
+    dir_created = 1;
 
-      if (strncmp(namelist[m]->d_name, entry, 9)) {
+  }
 
-        m++;
+  u8 *fn = strrchr(q->fname, '/');
+  u8 *path = alloc_printf("%s/%s", dir, fn ? fn + 1 : q->fname);
 
-      } else {
+  s32 fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", path); }
+  ck_write(fd, &meta, sizeof(meta), path);
+  if (meta.num_ctx) ck_write(fd, ctx_buf, meta.num_ctx * sizeof(u64), path);
+  if (meta.num_blocks)
+    ck_write(fd, blocks, meta.num_blocks * sizeof(reach_t), path);
+  close(fd);
 
-        break;
+  ck_free(path);
+  ck_free(dir);
 
-      }
+}
 
-    }
+/* Make room for `n` more bytes at `pos` of the record buffer. */
 
-    if (m >= n) { goto close_sync; }  // nothing new
+static inline u8 *record_reserve(afl_state_t *afl, size_t pos, size_t n) {
 
-    for (o = m; o < n; o++) {
+  afl->record_buf = afl_realloc((void **)&afl->record_buf, pos + n);
+  if (unlikely(!afl->record_buf)) { PFATAL("alloc"); }
+  return afl->record_buf + pos;
 
-      s32         fd;
-      struct stat st;
+}
 
-      snprintf(path, sizeof(path), "%s/%s", qd_path, namelist[o]->d_name);
-      afl->syncing_case = next_min_accept;
-      next_min_accept++;
+/* Append count and deltas of indexes of bits set in the `bits` bits at bit
+   `base` of `map`, return the new end of the record buffer. */
 
-      /* Allow this to fail in case the other fuzzer is resuming or so... */
+static size_t record_bits(afl_state_t *afl, size_t pos, const u8 *map,
+                          u64 bits, u64 base, u64 *prev, u8 with_count) {
 
-      fd = open(path, O_RDONLY);
+  u64 num = 0;
+  for (u64 i = 0; i < (bits + 7) / 8; ++i)
+    num += __builtin_popcount(map[i]);
+  if (bits % 8 && (map[bits / 8] >> (bits % 8))) {
 
-      if (fd < 0) { continue; }
+    num -= __builtin_popcount(map[bits / 8] >> (bits % 8));
 
-      if (fstat(fd, &st)) { WARNF("fstat() failed"); }
+  }
 
-      /* Ignore zero-sized or oversized files. */
+  if (with_count) {
 
-      if (st.st_size && st.st_size <= MAX_FILE) {
+    u8 *p = record_reserve(afl, pos, 10);
+    pos = aflrun_put_varint(p, num) - afl->record_buf;
 
-        u8  fault;
-        u8 *mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
 
-        if (mem == MAP_FAILED) { PFATAL("Unable to mmap '%s'", path); }
+  if (!num) { return pos; }
+  u8 *p = record_reserve(afl, pos, num * 10);
+  for (u64 i = 0; i < bits; ++i) {
 
-        /* See what happens. We rely on save_if_interesting() to catch major
-           errors and save the test case. */
+    if (!map[i / 8]) {
 
-        (void)write_to_testcase(afl, (void **)&mem, st.st_size, 1);
+      i |= 7;
+      continue;
 
-        afl->fsrv.testing = 1;
-        fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
-        afl->fsrv.testing = 0;
+    }
 
-        if (afl->stop_soon) {
-          aflrun_recover_virgin(afl);
-          goto close_sync;
-        }
+    if (!(map[i / 8] & (1 << (i % 8)))) { continue; }
+    p = aflrun_put_varint(p, base + i - *prev);
+    *prev = base + i;
 
-        afl->syncing_party = sd_ent->d_name;
-        afl->queued_imported +=
-            save_if_interesting(afl, mem, st.st_size, fault, 0);
-        afl->syncing_party = 0;
+  }
 
-        munmap(mem, st.st_size);
+  return p - afl->record_buf;
 
-      }
+}
 
-      close(fd);
+/* Append the body of a record of the AFLRun maps of the last run at `pos`
+   of the record buffer, return its new end. */
 
-    }
+static size_t record_maps(afl_state_t *afl, size_t pos, u8 kind, u32 seed,
+                          u32 len, u8 fault, u8 inc) {
 
-    ck_write(id_fd, &next_min_accept, sizeof(u32), qd_synced_path);
+  afl_forkserver_t *fsrv = &afl->fsrv;
+  reach_t           nr = fsrv->num_reachables, nf = fsrv->num_freachables;
+
+  u8 *p = record_reserve(afl, pos, 32);
+  *p++ = kind;
+  *p++ = fault;
+  *p++ = inc;
+  p = aflrun_put_varint(p, seed);
+  p = aflrun_put_varint(p, len);
+  pos = p - afl->record_buf;
 
-  close_sync:
-    close(id_fd);
-    if (n > 0)
-      for (m = 0; m < n; m++)
-        free(namelist[m]);
-    free(namelist);
+  u64 *words = (u64 *)fsrv->trace_bits, num = 0, prev = 0;
+  for (u32 i = 0; i < (fsrv->map_size >> 3); ++i) {
+
+    if (!words[i]) { continue; }
+    for (u32 j = 0; j < 8; ++j)
+      num += fsrv->trace_bits[i * 8 + j] != 0;
 
   }
 
-  closedir(sd);
+  p = record_reserve(afl, pos, 10 + num * 11);
+  p = aflrun_put_varint(p, num);
+  for (u32 i = 0; num && i < (fsrv->map_size >> 3); ++i) {
 
-  // If we are a secondary and no main was found to sync then become the main
-  if (unlikely(synced == 0) && likely(entries) &&
-      likely(afl->is_secondary_node)) {
+    if (!words[i]) { continue; }
+    for (u32 j = i * 8; j < i * 8 + 8; ++j) {
 
-    // there is a small race condition here that another secondary runs at the
-    // same time. If so, the first temporary main node running again will demote
-    // themselves so this is not an issue
+      if (!fsrv->trace_bits[j]) { continue; }
+      p = aflrun_put_varint(p, j - prev);
+      *p++ = fsrv->trace_bits[j];
+      prev = j;
+
+    }
+
+  }
+
+  pos = p - afl->record_buf;
+  prev = 0;
+  pos = record_bits(afl, pos, fsrv->trace_reachables, nr, 0, &prev, 1);
+  prev = 0;
+  pos = record_bits(afl, pos, fsrv->trace_freachables, nf, 0, &prev, 1);
+
+  // Only blocks reached in this run have context bits set
+  num = 0;
+  for (reach_t b = 0; b < nr; ++b) {
+
+    if (!IS_SET(fsrv->trace_reachables, b)) { continue; }
+    u8 *ctx = fsrv->trace_ctx + CTX_NUM_BYTES * b;
+    for (u32 j = 0; j < CTX_NUM_BYTES; ++j)
+      num += __builtin_popcount(ctx[j]);
+
+  }
+
+  p = record_reserve(afl, pos, 10);
+  pos = aflrun_put_varint(p, num) - afl->record_buf;
+  prev = 0;
+  for (reach_t b = 0; num && b < nr; ++b) {
+
+    if (!IS_SET(fsrv->trace_reachables, b)) { continue; }
+    pos = record_bits(afl, pos, fsrv->trace_ctx + CTX_NUM_BYTES * b, CTX_SIZE,
+                      CTX_IDX(b, 0), &prev, 0);
+
+  }
+
+  const ctx_t *lists[2] = {afl->new_paths, fsrv->trace_targets->trace};
+  size_t       lens[2] = {afl->num_new_paths, fsrv->trace_targets->num};
+  for (u32 l = 0; l < 2; ++l) {
+
+    p = record_reserve(afl, pos, 10 + lens[l] * 10);
+    p = aflrun_put_varint(p, lens[l]);
+    for (size_t i = 0; i < lens[l]; ++i) {
+
+      p = aflrun_put_varint(p, lists[l][i].block);
+      p = aflrun_put_varint(p, lists[l][i].call_ctx);
+
+    }
+
+    pos = p - afl->record_buf;
+
+  }
+
+  return pos;
+
+}
+
+static inline aflrun_record_hdr_t record_hdr(afl_state_t *afl) {
+
+  aflrun_record_hdr_t hdr = {.magic = AFLRUN_RECORD_MAGIC,
+                             .map_size = afl->fsrv.map_size,
+                             .num_reachables = afl->fsrv.num_reachables,
+                             .num_freachables = afl->fsrv.num_freachables,
+                             .ctx_size_pow2 = CTX_SIZE_POW2};
+  return hdr;
+
+}
+
+/* Append the AFLRun maps of the last run to AFL_RECORD_TRACES, see
+   "aflrun-record.h" for the format. */
+
+void aflrun_record_exec(afl_state_t *afl, u8 kind, u32 seed, u32 len,
+                        u8 fault, u8 inc) {
+
+  if (unlikely(!afl->record_file)) {
+
+    aflrun_record_hdr_t hdr = record_hdr(afl);
+    u8                 *fn = afl->afl_env.afl_record_traces;
+    afl->record_file = fopen(fn, "w");
+    if (!afl->record_file) { PFATAL("Unable to create '%s'", fn); }
+    setvbuf(afl->record_file, NULL, _IOFBF, 1 << 20);
+    fwrite(&hdr, sizeof(hdr), 1, afl->record_file);
+
+  }
+
+  // The body starts after room for its size
+  size_t pos = record_maps(afl, 10, kind, seed, len, fault, inc);
+
+  u8  size[10];
+  u8 *end = aflrun_put_varint(size, pos - 10);
+  fwrite(size, end - size, 1, afl->record_file);
+  fwrite(afl->record_buf + 10, pos - 10, 1, afl->record_file);
+
+}
+
+/* Take note of the target binary, summaries taken with another build of it
+   are stale. */
+
+static void summary_target(afl_state_t *afl) {
+
+  struct stat st;
+
+  if (afl->target_mtime || !afl->fsrv.target_path ||
+      stat(afl->fsrv.target_path, &st)) {
+
+    return;
+
+  }
+
+  afl->target_mtime = st.st_mtime;
+  afl->target_size = st.st_size;
+
+}
+
+/* Write the AFLRun maps of the calibration of `q` just done, with input
+   `mem`, to queue/.aflrun_summary/, see "aflrun-record.h". */
+
+void aflrun_write_summary(afl_state_t *afl, struct queue_entry *q, u8 *mem) {
+
+  static u8 dir_created;
+
+  summary_target(afl);
+
+  size_t pos = record_maps(afl, 0, AFLRUN_RECORD_IMPORT, q->id, q->len,
+                           afl->crash_mode, 0);
+
+  aflrun_summary_hdr_t hdr = {.magic = AFLRUN_SUMMARY_MAGIC,
+                              .rec = record_hdr(afl),
+                              .target_mtime = afl->target_mtime,
+                              .target_size = afl->target_size,
+                              .input_cksum = hash64(mem, q->len, HASH_CONST),
+                              .exec_us = q->exec_us,
+                              .len = q->len,
+                              .body_len = pos};
+
+  u8 *dir = alloc_printf("%s/queue/" AFLRUN_SUMMARY_DIR, afl->out_dir);
+  if (unlikely(!dir_created)) {
+
+    if (mkdir(dir, 0700) && errno != EEXIST) {
+
+      PFATAL("Unable to create '%s'", dir);
+
+    }
+
+    dir_created = 1;
+
+  }
+
+  u8 *fn = strrchr(q->fname, '/');
+  u8 *path = alloc_printf("%s/%s", dir, fn ? fn + 1 : q->fname);
+
+  s32 fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", path); }
+  ck_write(fd, &hdr, sizeof(hdr), path);
+  ck_write(fd, afl->record_buf, pos, path);
+  close(fd);
+
+  ck_free(path);
+  ck_free(dir);
+
+}
+
+/* Load the summary of queue entry `q` with input `mem`, return 1 if it is
+   still valid, in which case the next calibrate_case() replays it instead
+   of executing the target. */
+
+u8 aflrun_load_summary(afl_state_t *afl, struct queue_entry *q, u8 *mem) {
+
+  aflrun_summary_hdr_t hdr;
+  aflrun_record_hdr_t  rec = record_hdr(afl);
+  u8                   path[PATH_MAX];
+  u8                  *fn = strrchr(q->fname, '/');
+
+  afl->summary_len = 0;
+
+  snprintf(path, sizeof(path), "%s/queue/" AFLRUN_SUMMARY_DIR "/%s",
+           afl->out_dir, fn ? fn + 1 : q->fname);
+  s32 fd = open(path, O_RDONLY);
+  if (fd < 0) { return 0; }
+
+  summary_target(afl);
+
+  if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      hdr.magic != AFLRUN_SUMMARY_MAGIC || memcmp(&hdr.rec, &rec, sizeof(rec)) ||
+      hdr.target_mtime != afl->target_mtime ||
+      hdr.target_size != afl->target_size || hdr.len != q->len ||
+      hdr.input_cksum != hash64(mem, q->len, HASH_CONST)) {
+
+    close(fd);
+    return 0;
+
+  }
+
+  afl->summary_buf = afl_realloc((void **)&afl->summary_buf, hdr.body_len);
+  if (unlikely(!afl->summary_buf)) { PFATAL("alloc"); }
+
+  ssize_t len = read(fd, afl->summary_buf, hdr.body_len);
+  close(fd);
+  if (len != (ssize_t)hdr.body_len) { return 0; }
+
+  afl->summary_len = hdr.body_len;
+  afl->summary_exec_us = hdr.exec_us;
+  return 1;
+
+}
+
+/* Return 1 if queue entry `fn` in queue directory `qd_path` of another
+   instance comes with AFLRun metadata, and all reachable blocks and contexts
+   it covers are already covered by us, so executing it is not needed. */
+
+static u8 aflrun_sync_known(afl_state_t *afl, u8 *qd_path, u8 *fn) {
+
+  u8 path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" AFLRUN_SYNC_META_DIR "/%s", qd_path, fn);
+
+  s32 fd = open(path, O_RDONLY);
+  if (fd < 0) { return 0; }
+
+  aflrun_sync_meta_t meta;
+  u8                 ret = 0;
+  if (read(fd, &meta, sizeof(meta)) != sizeof(meta) ||
+      meta.magic != AFLRUN_SYNC_META_MAGIC ||
+      meta.num_reachables != afl->fsrv.num_reachables) {
+
+    goto out;
+
+  }
+
+  u64 idx[256];
+  for (u64 i = 0; i < meta.num_ctx;) {
+
+    u64     n = MIN(meta.num_ctx - i, sizeof(idx) / sizeof(u64));
+    ssize_t len = n * sizeof(u64);
+    if (read(fd, idx, len) != len) { goto out; }
+    for (u64 j = 0; j < n; ++j) {
+
+      if (idx[j] >= (u64)meta.num_reachables * CTX_SIZE ||
+          IS_SET(afl->virgin_ctx, idx[j])) {
+
+        goto out;
+
+      }
+
+    }
+
+    i += n;
+
+  }
+
+  reach_t blocks[512];
+  for (reach_t i = 0; i < meta.num_blocks;) {
+
+    reach_t n = MIN(meta.num_blocks - i, sizeof(blocks) / sizeof(reach_t));
+    ssize_t len = n * sizeof(reach_t);
+    if (read(fd, blocks, len) != len) { goto out; }
+    for (reach_t j = 0; j < n; ++j) {
+
+      if (blocks[j] >= meta.num_reachables ||
+          IS_SET(afl->virgin_reachables, blocks[j])) {
+
+        goto out;
+
+      }
+
+    }
+
+    i += n;
+
+  }
+
+  ret = 1;
+
+out:
+  close(fd);
+  return ret;
+
+}
+
+/* Import `len` bytes of `mem` as queue entry `name` in queue directory
+   `qd_path` of fuzzer `party`, return 1 if we are asked to stop. */
+
+static u8 sync_case_mem(afl_state_t *afl, u8 *qd_path, u8 *name, u8 *party,
+                        u8 *mem, u32 len) {
+
+  u8 fault;
+
+  /* Don't execute entries with no new AFLRun coverage for us. Note this
+     also skips entries the other instance saved for edge coverage only. */
+
+  if (aflrun_sync_meta() && aflrun_sync_known(afl, qd_path, name)) {
+
+    ++afl->queued_sync_skipped;
+    return 0;
+
+  }
+
+  /* See what happens. We rely on save_if_interesting() to catch major
+     errors and save the test case. */
+
+  (void)write_to_testcase(afl, (void **)&mem, len, 1);
+
+  afl->fsrv.testing = 1;
+  fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+  afl->fsrv.testing = 0;
+
+  if (afl->stop_soon) {
+
+    aflrun_recover_virgin(afl);
+    return 1;
+
+  }
+
+  afl->syncing_party = party;
+  afl->queued_imported += save_if_interesting(afl, mem, len, fault, 0);
+  afl->syncing_party = 0;
+
+  return 0;
+
+}
+
+/* Import queue entry `name` in queue directory `qd_path` of fuzzer `party`,
+   return 1 if we are asked to stop. */
+
+static u8 sync_case(afl_state_t *afl, u8 *qd_path, u8 *name, u8 *party) {
+
+  u8          path[PATH_MAX + 1 + NAME_MAX];
+  s32         fd;
+  struct stat st;
+  u8          ret = 0;
+
+  snprintf(path, sizeof(path), "%s/%s", qd_path, name);
+
+  /* Allow this to fail in case the other fuzzer is resuming or so... */
+
+  fd = open(path, O_RDONLY);
+
+  if (fd < 0) { return 0; }
+
+  if (fstat(fd, &st)) { WARNF("fstat() failed"); }
+
+  /* Ignore zero-sized or oversized files. */
+
+  if (st.st_size && st.st_size <= MAX_FILE) {
+
+    u8 *mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (mem == MAP_FAILED) { PFATAL("Unable to mmap '%s'", path); }
+
+    ret = sync_case_mem(afl, qd_path, name, party, mem, st.st_size);
+
+    munmap(mem, st.st_size);
+
+  }
+
+  close(fd);
+  return ret;
+
+}
+
+/* Import the entries of the segment store `v` of queue directory `qd_path`
+   of fuzzer `party` with ids from `*next_min_accept` on, and advance it.
+   Return 1 if we are asked to stop. */
+
+static u8 sync_segments(afl_state_t *afl, segments_view_t *v, u8 *qd_path,
+                        u8 *party, u32 *next_min_accept) {
+
+  for (u32 i = 0; i < v->num; i++) {
+
+    const segment_rec_t *r = v->recs + i;
+
+    /* Trimmed versions of entries we have seen already. */
+    if ((r->flags & SEGMENT_REC_UPDATE) || r->id < *next_min_accept) {
+
+      continue;
+
+    }
+
+    afl->syncing_case = r->id;
+    *next_min_accept = r->id + 1;
+
+    if (!r->len || r->len > MAX_FILE) { continue; }
+
+    u8 *mem = (u8 *)segments_read(v, r);
+    if (!mem) { continue; }
+
+    if (sync_case_mem(afl, qd_path, (u8 *)r->name, party, mem, r->len)) {
+
+      return 1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+/* Return 1 if we should sync from fuzzer `party`: secondary nodes only sync
+   from main, the main node syncs from everyone. */
+
+static u8 sync_from(afl_state_t *afl, u8 *party) {
+
+  u8 path[PATH_MAX];
+
+  if (likely(!afl->is_secondary_node)) { return 1; }
+
+  sprintf(path, "%s/%s/is_main_node", afl->sync_dir, party);
+  int res = access(path, F_OK);
+  if (unlikely(afl->is_main_node)) {  // an elected temporary main node
+
+    if (likely(res == 0)) {  // there is another main node? downgrade.
+
+      afl->is_main_node = 0;
+      sprintf(path, "%s/is_main_node", afl->out_dir);
+      unlink(path);
+
+    }
+
+  } else {
+
+    if (likely(res != 0)) { return 0; }
+
+  }
+
+  return 1;
+
+}
+
+/* Import new queue entries of fuzzer `party`. If `names` is NULL, its queue
+   directory is scanned for entries after the last one seen; otherwise only
+   the `cnt` entries in `names`, sorted by name, are considered. */
+
+static void sync_peer(afl_state_t *afl, u8 *party, u8 **names, u32 cnt,
+                      u32 *sync_cnt) {
+
+  u8  qd_synced_path[PATH_MAX], qd_path[PATH_MAX];
+  u32 min_accept = 0, next_min_accept = 0;
+
+  s32 id_fd;
+
+  /* document the attempt to sync to this instance */
+
+  sprintf(qd_synced_path, "%s/.synced/%s.last", afl->out_dir, party);
+  id_fd = open(qd_synced_path, O_RDWR | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (id_fd >= 0) close(id_fd);
+
+  /* Skip anything that doesn't have a queue/ subdirectory. */
+
+  sprintf(qd_path, "%s/%s/queue", afl->sync_dir, party);
+
+  struct dirent **namelist = NULL;
+  int             m = 0, n = 0, o;
+
+  /* Peers with AFL_QUEUE_SEGMENTS have their entries in the store only. */
+
+  segments_view_t segs;
+  u8              segmented = !segments_open(&segs, qd_path);
+
+  if (!names && !segmented) {
+
+    n = scandir(qd_path, &namelist, NULL, alphasort);
+
+    if (n < 1) {
+
+      if (namelist) free(namelist);
+      return;
+
+    }
+
+  }
+
+  /* Retrieve the ID of the last seen test case. */
+
+  sprintf(qd_synced_path, "%s/.synced/%s", afl->out_dir, party);
+
+  id_fd = open(qd_synced_path, O_RDWR | O_CREAT, DEFAULT_PERMISSION);
+
+  if (id_fd < 0) { PFATAL("Unable to create '%s'", qd_synced_path); }
+
+  if (read(id_fd, &min_accept, sizeof(u32)) == sizeof(u32)) {
+
+    next_min_accept = min_accept;
+    lseek(id_fd, 0, SEEK_SET);
+
+  }
+
+  /* Show stats */
+
+  snprintf(afl->stage_name_buf, STAGE_BUF_SIZE, "sync %u", ++*sync_cnt);
+
+  afl->stage_name = afl->stage_name_buf;
+  afl->stage_cur = 0;
+  afl->stage_max = 0;
+
+  if (segmented) {
+
+    u8 stop = sync_segments(afl, &segs, qd_path, party, &next_min_accept);
+    segments_close(&segs);
+    if (stop) { goto close_sync; }
+
+    ck_write(id_fd, &next_min_accept, sizeof(u32), qd_synced_path);
+    goto close_sync;
+
+  }
+
+  if (names) {
+
+    /* Entries reported by events, skipping ones seen by an earlier scan. */
+
+    for (u32 i = 0; i < cnt; i++) {
+
+      u32 id = strtoul(names[i] + strlen(CASE_PREFIX), NULL, 10);
+      if (id < next_min_accept) { continue; }
+
+      afl->syncing_case = id;
+      next_min_accept = id + 1;
+
+      if (sync_case(afl, qd_path, names[i], party)) { goto close_sync; }
+
+    }
+
+    ck_write(id_fd, &next_min_accept, sizeof(u32), qd_synced_path);
+    goto close_sync;
+
+  }
+
+  /* For every file queued by this fuzzer, parse ID and see if we have
+     looked at it before; exec a test case if not. */
+
+  u8 entry[12];
+  sprintf(entry, "id:%06u", next_min_accept);
+
+  while (m < n) {
+
+    if (strncmp(namelist[m]->d_name, entry, 9)) {
+
+      m++;
+
+    } else {
+
+      break;
+
+    }
+
+  }
+
+  if (m >= n) { goto close_sync; }  // nothing new
+
+  for (o = m; o < n; o++) {
+
+    afl->syncing_case = next_min_accept;
+    next_min_accept++;
+
+    if (sync_case(afl, qd_path, namelist[o]->d_name, party)) {
+
+      goto close_sync;
+
+    }
+
+  }
+
+  ck_write(id_fd, &next_min_accept, sizeof(u32), qd_synced_path);
+
+close_sync:
+  close(id_fd);
+  for (m = 0; m < n; m++)
+    free(namelist[m]);
+  free(namelist);
+
+}
+
+#ifdef __linux__
+
+/* Event-driven sync (AFL_SYNC_INOTIFY): the sync directory and the queue/
+   of each other fuzzer are watched, and names of new queue entries are
+   collected from events, so only they are opened at each sync. A peer is
+   scanned once when its queue/ starts being watched, or when events were
+   lost, to pick up entries written before that. */
+
+static struct sync_peer *sync_find_peer(afl_state_t *afl,
+                                        const u8 *name) {
+
+  for (u32 i = 0; i < afl->sync_peers_cnt; i++) {
+
+    if (!strcmp(afl->sync_peers[i].name, name)) { return afl->sync_peers + i; }
+
+  }
+
+  afl->sync_peers = ck_realloc(
+      afl->sync_peers, (afl->sync_peers_cnt + 1) * sizeof(struct sync_peer));
+  struct sync_peer *p = afl->sync_peers + afl->sync_peers_cnt++;
+  memset(p, 0, sizeof(struct sync_peer));
+  p->name = ck_strdup((u8 *)name);
+  p->wd = -1;
+  return p;
+
+}
+
+static void sync_scan_peers(afl_state_t *afl) {
+
+  DIR           *sd;
+  struct dirent *sd_ent;
+
+  sd = opendir(afl->sync_dir);
+  if (!sd) { PFATAL("Unable to open '%s'", afl->sync_dir); }
+
+  while ((sd_ent = readdir(sd))) {
+
+    if (sd_ent->d_name[0] == '.' || !strcmp(afl->sync_id, sd_ent->d_name)) {
+
+      continue;
+
+    }
+
+    sync_find_peer(afl, sd_ent->d_name)->full = 1;
+
+  }
+
+  closedir(sd);
+
+}
+
+static void sync_add_pending(struct sync_peer *p, const u8 *name) {
+
+  p->pending = ck_realloc(p->pending, (p->pending_cnt + 1) * sizeof(u8 *));
+  p->pending[p->pending_cnt++] = ck_strdup((u8 *)name);
+
+}
+
+static void sync_clear_pending(struct sync_peer *p) {
+
+  for (u32 i = 0; i < p->pending_cnt; i++)
+    ck_free(p->pending[i]);
+  p->pending_cnt = 0;
+
+}
+
+static u8 sync_segmented(afl_state_t *afl, u8 *party) {
+
+  u8 path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s/queue/" SEGMENTS_DIR "/index",
+           afl->sync_dir, party);
+  return !access(path, F_OK);
+
+}
+
+static int sync_cmp_names(const void *a, const void *b) {
+
+  return strcmp(*(const char **)a, *(const char **)b);
+
+}
+
+/* Update peers from pending inotify events, return 0 if inotify cannot be
+   used, in which case we fall back to scanning directories. */
+
+static u8 sync_inotify_events(afl_state_t *afl) {
+
+  u8 buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  if (unlikely(afl->sync_inotify_fd < 0)) {
+
+    afl->sync_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (afl->sync_inotify_fd >= 0) {
+
+      afl->sync_dir_wd =
+          inotify_add_watch(afl->sync_inotify_fd, afl->sync_dir,
+                            IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+
+    }
+
+    if (afl->sync_inotify_fd < 0 || afl->sync_dir_wd < 0) {
+
+      WARNF("Unable to watch '%s' with inotify, scanning it instead",
+            afl->sync_dir);
+      if (afl->sync_inotify_fd >= 0) { close(afl->sync_inotify_fd); }
+      afl->sync_inotify_fd = -1;
+      afl->afl_env.afl_sync_inotify = 0;
+      return 0;
+
+    }
+
+    sync_scan_peers(afl);
+
+  }
+
+  ssize_t len;
+  while ((len = read(afl->sync_inotify_fd, buf, sizeof(buf))) > 0) {
+
+    const struct inotify_event *e;
+    for (u8 *ptr = buf; ptr < buf + len;
+         ptr += sizeof(struct inotify_event) + e->len) {
+
+      e = (const struct inotify_event *)ptr;
+
+      if (unlikely(e->mask & IN_Q_OVERFLOW)) {
+
+        // Events are lost, so we have to scan everything once
+        sync_scan_peers(afl);
+        continue;
+
+      }
+
+      if (e->wd == afl->sync_dir_wd) {
+
+        if ((e->mask & IN_ISDIR) && e->len && e->name[0] != '.' &&
+            strcmp(afl->sync_id, e->name)) {
+
+          sync_find_peer(afl, e->name)->full = 1;
+
+        }
+
+        continue;
+
+      }
+
+      for (u32 i = 0; i < afl->sync_peers_cnt; i++) {
+
+        struct sync_peer *p = afl->sync_peers + i;
+        if (p->wd != e->wd) { continue; }
+
+        if (e->mask & IN_IGNORED) {
+
+          p->wd = -1;  // queue/ is removed, watch it again when it comes back
+
+        } else if (e->len && !strncmp(e->name, CASE_PREFIX,
+
+                                      strlen(CASE_PREFIX))) {
+
+          sync_add_pending(p, e->name);
+
+        }
+
+        break;
+
+      }
+
+    }
+
+  }
+
+  /* Watch queue/ of new peers, it may not exist yet right after the peer
+     directory is created. */
+
+  for (u32 i = 0; i < afl->sync_peers_cnt; i++) {
+
+    struct sync_peer *p = afl->sync_peers + i;
+    if (p->wd >= 0) { continue; }
+
+    u8 qd_path[PATH_MAX];
+    sprintf(qd_path, "%s/%s/queue", afl->sync_dir, p->name);
+    p->wd = inotify_add_watch(afl->sync_inotify_fd, qd_path,
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+    if (p->wd >= 0) { p->full = 1; }
+
+  }
+
+  return 1;
+
+}
+
+#endif                                                        /* __linux__ */
+
+/* Grab interesting test cases from other fuzzers. */
+
+void sync_fuzzers(afl_state_t *afl) {
+
+  u32 sync_cnt = 0, synced = 0, entries = 0;
+  u8  path[PATH_MAX + 1 + NAME_MAX];
+
+  AFL_PROBE(afl, sync_begin);
+
+  // React to what other instances have reached before importing their seeds
+  aflrun_registry_poll();
+  aflrun_partition_targets(afl->is_main_node);
+
+  afl->stage_max = afl->stage_cur = 0;
+  afl->cur_depth = 0;
+
+#ifdef __linux__
+  if (afl->afl_env.afl_sync_inotify && sync_inotify_events(afl)) {
+
+    for (u32 i = 0; i < afl->sync_peers_cnt; i++) {
+
+      struct sync_peer *p = afl->sync_peers + i;
+
+      entries++;
+
+      if (!sync_from(afl, p->name)) {
+
+        // Not synced now, so scan it if it becomes main node later
+        if (p->pending_cnt) { p->full = 1; }
+        sync_clear_pending(p);
+        continue;
+
+      }
+
+      synced++;
+
+      /* Appending to segment files of a peer raises no events on its
+         queue/, so such peers are always looked at. */
+
+      if (p->full || sync_segmented(afl, p->name)) {
+
+        p->full = 0;
+        sync_peer(afl, p->name, NULL, 0, &sync_cnt);
+
+      } else if (p->pending_cnt) {
+
+        qsort(p->pending, p->pending_cnt, sizeof(u8 *), sync_cmp_names);
+        sync_peer(afl, p->name, p->pending, p->pending_cnt, &sync_cnt);
+
+      }
+
+      sync_clear_pending(p);
+
+    }
+
+  } else
+#endif
+  {
+
+    DIR           *sd;
+    struct dirent *sd_ent;
+
+    sd = opendir(afl->sync_dir);
+    if (!sd) { PFATAL("Unable to open '%s'", afl->sync_dir); }
+
+    /* Look at the entries created for every other fuzzer in the sync
+       directory. */
+
+    while ((sd_ent = readdir(sd))) {
+
+      /* Skip dot files and our own output directory. */
+
+      if (sd_ent->d_name[0] == '.' || !strcmp(afl->sync_id, sd_ent->d_name)) {
+
+        continue;
+
+      }
+
+      entries++;
+
+      if (!sync_from(afl, sd_ent->d_name)) { continue; }
+
+      synced++;
+
+      sync_peer(afl, sd_ent->d_name, NULL, 0, &sync_cnt);
+
+    }
+
+    closedir(sd);
+
+  }
+
+  // If we are a secondary and no main was found to sync then become the main
+  if (unlikely(synced == 0) && likely(entries) &&
+      likely(afl->is_secondary_node)) {
+
+    // there is a small race condition here that another secondary runs at the
+    // same time. If so, the first temporary main node running again will demote
+    // themselves so this is not an issue
 
     //    u8 path2[PATH_MAX];
     afl->is_main_node = 1;
@@ -961,6 +2254,8 @@ void sync_fuzzers(afl_state_t *afl) {
   afl->last_sync_time = get_cur_time();
   afl->last_sync_cycle = afl->queue_cycle;
 
+  AFL_PROBE(afl, sync_end, synced, entries);
+
 }
 
 /* Trim all new test cases to save cycles when doing deterministic checks. The
@@ -1037,7 +2332,7 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
     while (remove_pos < q->len) {
 
       u32 trim_avail = MIN(remove_len, q->len - remove_pos);
-      u64 cksum, pcksum;
+      u64 cksum;
 
       write_with_gap(afl, in_buf, q->len, remove_pos, trim_avail);
 
@@ -1051,15 +2346,15 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
       ++afl->trim_execs;
       classify_counts(&afl->fsrv);
       cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
-      pcksum = hash64(
-        afl->fsrv.trace_ctx, MAP_TR_SIZE(afl->fsrv.num_reachables), HASH_CONST);
 
       /* If the deletion had no impact on the trace, make it permanent. This
          isn't perfect for variable-path inputs, but we're just making a
          best-effort pass, so it's not a big deal if we end up with false
-         negatives every now and then. */
+         negatives every now and then. The path checksum is only taken if
+         the edges are the same, as most deletions change them. */
 
-      if (cksum == q->exec_cksum && pcksum == q->path_cksum) {
+      if (cksum == q->exec_cksum &&
+          aflrun_path_cksum(&afl->fsrv) == q->path_cksum) {
 
         u32 move_tail = q->len - remove_pos - trim_avail;
 
@@ -1101,10 +2396,15 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
   if (needs_write) {
 
-    s32 fd;
+    s32 fd = -1;
 
-    if (unlikely(afl->no_unlink)) {
+    if (unlikely(afl->segments)) {
+
+      segments_add(afl, q, in_buf, q->len);
 
+    } else if (unlikely(afl->no_unlink)) {
+
+      asyncw_wait(afl, q->write_seq);
       fd = open(q->fname, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
 
       if (fd < 0) { PFATAL("Unable to create '%s'", q->fname); }
@@ -1119,16 +2419,11 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
     } else {
 
-      unlink(q->fname);                                    /* ignore errors */
-      fd = open(q->fname, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
-
-      if (fd < 0) { PFATAL("Unable to create '%s'", q->fname); }
-
-      ck_write(fd, in_buf, q->len, q->fname);
+      q->write_seq = asyncw_write(afl, q->fname, in_buf, q->len, 1);
 
     }
 
-    close(fd);
+    if (fd >= 0) { close(fd); }
 
     queue_testcase_retake_mem(afl, q, in_buf, q->len, orig_len);
 
@@ -1145,28 +2440,21 @@ abort_trimming:
 
 }
 
-/* Write a modified test case, run program, process results. Handle
-   error conditions, returning 1 if it's time to bail out. This is
-   a helper function for fuzz_one(). */
+/* Process results of a run of `out_buf`, returning 1 if it's time to bail
+   out. */
 
-u8 __attribute__((hot))
-common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
+static u8 __attribute__((hot))
+fuzz_result(afl_state_t *afl, u8 *out_buf, u32 len, u8 fault) {
 
-  u8 fault;
+  ++afl->total_perf_score;
 
-  if (unlikely(len = write_to_testcase(afl, (void **)&out_buf, len, 0)) == 0) {
+  if (unlikely(afl->rare_fringes) &&
+      ++afl->freq_execs >= AFLRUN_FREQ_SAMPLE_EXECS) {
 
-    return 0;
+    aflrun_sample_hits(afl);
 
   }
 
-  ++afl->fuzzed_times;
-  ++afl->queue_cur->fuzzed_times;
-  afl->fsrv.testing = 1;
-  fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
-  afl->fsrv.testing = 0;
-  ++afl->total_perf_score;
-
   if (afl->stop_soon) {
     aflrun_recover_virgin(afl);
     return 1;
@@ -1200,6 +2488,8 @@ common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
 
   }
 
+  if (afl->san) { san_fsrv_queue(afl, out_buf, len, fault); }
+
   /* This handles FAULT_ERROR for us: */
 
   afl->queued_discovered += save_if_interesting(afl, out_buf, len, fault, 1);
@@ -1215,10 +2505,390 @@ common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
 
 }
 
+/* Write a modified test case, run program, process results. Handle
+   error conditions, returning 1 if it's time to bail out. This is
+   a helper function for fuzz_one(). */
+
+u8 __attribute__((hot))
+common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
+
+  u8 fault, ret;
+
+  AFL_PROBE(afl, common_fuzz_stuff_begin, len);
+
+  if (unlikely(len = write_to_testcase(afl, (void **)&out_buf, len, 0)) == 0) {
+
+    AFL_PROBE(afl, common_fuzz_stuff_end, (u8)0);
+    return 0;
+
+  }
+
+  ++afl->fuzzed_times;
+  ++afl->queue_cur->fuzzed_times;
+  afl->fsrv.testing = 1;
+  fault = fuzz_run_target(afl, &afl->fsrv, fuzz_tmout(afl));
+  afl->fsrv.testing = 0;
+
+  ret = fuzz_result(afl, out_buf, len, fault);
+  AFL_PROBE(afl, common_fuzz_stuff_end, ret);
+  return ret;
+
+}
+
+/* Entry of the forkserver pool running the oldest testcase. */
+
+static inline struct fsrv_pool_entry *pool_oldest(afl_state_t *afl) {
+
+  return afl->fsrv_pool +
+         (afl->fsrv_pool_next + afl->fsrv_pool_cnt - afl->fsrv_pool_busy) %
+             afl->fsrv_pool_cnt;
+
+}
+
+/* Timeout of testcases run in the pool: foreign testcases being triaged get
+   the same timeout as when they are imported one by one. */
+
+static inline u32 pool_tmout(afl_state_t *afl) {
+
+  return unlikely(afl->import_triage) ? afl->fsrv.exec_tmout : fuzz_tmout(afl);
+
+}
+
+/* Wait for the oldest testcase running in the pool and process its results
+   with the maps of afl->fsrv, returning 1 if it's time to bail out. Virgin
+   context bits are only updated here, so they change in starting order. */
+
+static u8 pool_finish_one(afl_state_t *afl) {
+
+  struct fsrv_pool_entry *e = pool_oldest(afl);
+  --afl->fsrv_pool_busy;
+
+  u64 t1 = get_cur_time_us();
+  u8  fault = afl_fsrv_finish_run(&e->fsrv, pool_tmout(afl), &afl->stop_soon);
+  account_exec_time(afl, t1, get_cur_time_us());
+
+  afl_fsrv_copy_result(&afl->fsrv, &e->fsrv);
+  if (afl->fsrv.num_reachables) { aflrun_collect_new_paths(afl, 1); }
+
+  if (unlikely(afl->import_triage)) {
+
+    afl->queued_imported += save_if_interesting(afl, e->buf, e->len, fault, 0);
+    return afl->stop_soon;
+
+  }
+
+  return fuzz_result(afl, e->buf, e->len, fault);
+
+}
+
+/* Wait for testcases still running in the pool, ignoring their results. */
+
+static void pool_discard(afl_state_t *afl) {
+
+  while (afl->fsrv_pool_busy) {
+
+    struct fsrv_pool_entry *e = pool_oldest(afl);
+    --afl->fsrv_pool_busy;
+    afl_fsrv_finish_run(&e->fsrv, pool_tmout(afl), &afl->stop_soon);
+
+  }
+
+}
+
+/* Like common_fuzz_stuff(), but when AFL_FSRV_POOL is set, only start the
+   test case on an idle forkserver of the pool and go on mutating the next
+   one meanwhile. Results are processed in starting order, once all
+   forkservers are busy or in pool_flush(), which must be called before
+   leaving the stage. While afl->import_triage is set, test cases are foreign
+   ones and are imported rather than counted as finds of the current entry.
+   Returns 1 if it's time to bail out. */
+
+u8 __attribute__((hot))
+pool_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
+
+  if (likely(!afl->fsrv_pool_cnt)) {
+
+    return common_fuzz_stuff(afl, out_buf, len);
+
+  }
+
+  if (afl->fsrv_pool_busy == afl->fsrv_pool_cnt && pool_finish_one(afl)) {
+
+    pool_discard(afl);
+    return 1;
+
+  }
+
+  struct fsrv_pool_entry *e = afl->fsrv_pool + afl->fsrv_pool_next;
+
+  if (unlikely(len = write_to_fsrv(afl, &e->fsrv, (void **)&out_buf, len,
+                                   0)) == 0) {
+
+    return 0;
+
+  }
+
+  /* Keep the test case for save_if_interesting(), out_buf is reused. */
+
+  e->buf = afl_realloc((void **)&e->buf, len);
+  if (unlikely(!e->buf)) { PFATAL("alloc"); }
+  memcpy(e->buf, out_buf, len);
+  e->len = len;
+
+  /* The diversity switch is changed by AFLRun in the maps of afl->fsrv. */
+
+  if (afl->fsrv.num_reachables) {
+
+    memcpy(e->shm_run.div_switch, afl->shm_run.div_switch,
+           MAP_RBB_SIZE(afl->fsrv.num_reachables));
+
+  }
+
+  if (likely(!afl->import_triage)) {
+
+    ++afl->fuzzed_times;
+    ++afl->queue_cur->fuzzed_times;
+
+  }
+
+  afl_fsrv_start_run(&e->fsrv, &afl->stop_soon);
+  afl->fsrv_pool_next = (afl->fsrv_pool_next + 1) % afl->fsrv_pool_cnt;
+  ++afl->fsrv_pool_busy;
+
+  return 0;
+
+}
+
+/* Process all test cases still running in the pool, returning 1 if it's time
+   to bail out. */
+
+u8 pool_flush(afl_state_t *afl) {
+
+  while (afl->fsrv_pool_busy) {
+
+    if (pool_finish_one(afl)) {
+
+      pool_discard(afl);
+      return 1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+/* Keep a crash of the sanitizer build if it hit an edge of that build that
+   no crash of it hit before, like crashes of the fast build are kept. Its
+   edges are not those of the fast build, so it has its own virgin map. */
+
+static void san_save_crash(afl_state_t *afl, struct san_input *in) {
+
+  struct san_fsrv *s = afl->san;
+  u8              *bits = s->fsrv.trace_bits, *virgin = s->virgin_crash;
+  u8               is_new = 0;
+
+  ++afl->total_crashes;
+  if (afl->saved_crashes >= KEEP_UNIQUE_CRASH) { return; }
+
+  for (u32 i = 0; i < s->fsrv.map_size; ++i) {
+
+    if (unlikely(bits[i] && virgin[i])) {
+
+      virgin[i] = 0;
+      is_new = 1;
+
+    }
+
+  }
+
+  if (!is_new) { return; }
+
+  if (unlikely(!afl->saved_crashes) &&
+      (afl->afl_env.afl_no_crash_readme != 1)) {
+
+    write_crash_readme(afl);
+
+  }
+
+  u8 fn[PATH_MAX];
+#ifndef SIMPLE_FILES
+  snprintf(fn, PATH_MAX, "%s/crashes/id:%06llu,sig:%02u,san,src:%06u,time:%llu",
+           afl->out_dir, afl->saved_crashes, s->fsrv.last_kill_signal, in->src,
+           get_cur_time() + afl->prev_run_time - afl->start_time);
+#else
+  snprintf(fn, PATH_MAX, "%s/crashes/id_%06llu_%02u_san", afl->out_dir,
+           afl->saved_crashes, s->fsrv.last_kill_signal);
+#endif                                                    /* ^!SIMPLE_FILES */
+
+  s32 fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
+  if (unlikely(fd < 0)) { PFATAL("Unable to create '%s'", fn); }
+  ck_write(fd, in->buf, in->len, fn);
+  close(fd);
+
+  ++afl->saved_crashes;
+  ++afl->san_crashes;
+  afl->last_crash_time = get_cur_time();
+  afl->last_crash_execs = afl->fsrv.total_execs;
+
+}
+
+/* Collect the run of the oldest queued input on the sanitizer build, once
+   the forkserver has sent its status or its timeout has passed, so the
+   fuzzing loop never waits for the slower build. */
+
+static void san_collect(afl_state_t *afl) {
+
+  struct san_fsrv *s = afl->san;
+  s32              avail = 0;
+
+  if (ioctl(s->fsrv.fsrv_st_fd, FIONREAD, &avail) < 0) { avail = 0; }
+  if (avail < 8 && get_cur_time() - s->start_ms < s->tmout) { return; }
+
+  /* With the status there, this returns at once, else it kills the run. */
+  u8 fault = afl_fsrv_finish_run(&s->fsrv, avail < 8 ? 1 : s->tmout,
+                                 &afl->stop_soon);
+  if (afl->stop_soon) { return; }
+
+  ++afl->san_execs;
+  if (fault == FSRV_RUN_CRASH) { san_save_crash(afl, s->queue + s->head); }
+
+  s->busy = 0;
+  s->head = (s->head + 1) % SAN_QUEUE_MAX;
+  --s->cnt;
+
+}
+
+/* Called with each input run by the fast build: queue it for the sanitizer
+   build if it reached a target or a fringe being diversified, i.e. if its
+   `trace_targets` log is not empty, and did not crash the fast build
+   already. Inputs are dropped while the queue is full. */
+
+void san_fsrv_queue(afl_state_t *afl, u8 *buf, u32 len, u8 fault) {
+
+  struct san_fsrv *s = afl->san;
+
+  if (s->busy) { san_collect(afl); }
+
+  if (fault == FSRV_RUN_OK && afl->fsrv.trace_targets->num) {
+
+    if (s->cnt == SAN_QUEUE_MAX) {
+
+      ++afl->san_dropped;
+
+    } else {
+
+      struct san_input *in = s->queue + (s->head + s->cnt) % SAN_QUEUE_MAX;
+      in->buf = afl_realloc((void **)&in->buf, len);
+      if (unlikely(!in->buf)) { PFATAL("alloc"); }
+      memcpy(in->buf, buf, len);
+      in->len = len;
+      in->src = afl->queue_cur ? afl->queue_cur->id : 0;
+      ++s->cnt;
+
+    }
+
+  }
+
+  if (!s->busy && s->cnt && !afl->stop_soon) {
+
+    struct san_input *in = s->queue + s->head;
+    afl_fsrv_write_to_testcase(&s->fsrv, in->buf, in->len);
+    afl_fsrv_start_run(&s->fsrv, &afl->stop_soon);
+    s->start_ms = get_cur_time();
+    s->busy = 1;
+
+  }
+
+}
+
+/* Publish the first `num` of `afl->aflrun_goals` to the runtime of every
+   fork server, see `early_exit`; 0 disarms them. */
+
+void aflrun_arm_goals(afl_state_t *afl, u32 num) {
+
+  aflrun_shm_hdr_t *hdr = (aflrun_shm_hdr_t *)afl->shm_run.map;
+  memcpy(hdr->goals, afl->aflrun_goals, num * sizeof(reach_t));
+  hdr->num_goals = num;
+
+  for (u32 i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    hdr = (aflrun_shm_hdr_t *)afl->fsrv_pool[i].shm_run.map;
+    memcpy(hdr->goals, afl->aflrun_goals, num * sizeof(reach_t));
+    hdr->num_goals = num;
+
+  }
+
+}
+
+/* Add the runs reaching each fringe, counted by the runtime of every fork
+   server, to the frequencies of AFLRun, see `rare_fringes`. */
+
+void aflrun_sample_hits(afl_state_t *afl) {
+
+  afl->freq_execs = 0;
+  aflrun_sample_freq(afl->shm_run.map_hits);
+  for (u32 i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    aflrun_sample_freq(afl->fsrv_pool[i].shm_run.map_hits);
+
+  }
+
+}
+
+/* Set the instrumentation level of every fork server to `level`, see
+   `lean_cov`; runs started afterwards pick it up. Virgin paths reached at
+   AFLRUN_LEVEL_BLOCKS stay virgin unless the run is kept, so they are found
+   again by later runs at AFLRUN_LEVEL_FULL, and cluster maps of seeds kept
+   meanwhile are still built from their blocks: only diversity blocks other
+   than targets miss their logs and counts of these runs. */
+
+void aflrun_set_level(afl_state_t *afl, u8 level) {
+
+  if (afl->fsrv.aflrun_level == level) { return; }
+
+  afl->fsrv.aflrun_level = level;
+  ((aflrun_shm_hdr_t *)afl->shm_run.map)->level = level;
+  for (u32 i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    afl->fsrv_pool[i].fsrv.aflrun_level = level;
+    ((aflrun_shm_hdr_t *)afl->fsrv_pool[i].shm_run.map)->level = level;
+
+  }
+
+}
+
+/* Mute blocks of no more use to AFLRun in the runtime of every fork server,
+   see `mute_blocks`; it is recomputed from scratch at each cycle end, so
+   blocks get unmuted as soon as they may matter again. */
+
+void aflrun_update_mute(afl_state_t *afl) {
+
+  afl->aflrun_muted = aflrun_mute_blocks(afl->shm_run.map_mute);
+  for (u32 i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    memcpy(afl->fsrv_pool[i].shm_run.map_mute, afl->shm_run.map_mute,
+           MAP_RBB_SIZE(afl->fsrv.num_reachables));
+
+  }
+
+}
+
+/* Runs of the main fork server at a lowered level log no virgin paths, so
+   those of the last one are only found, by scanning its context bits, once
+   it is worth it, e.g. when it is kept for new coverage bits. */
+
+void aflrun_collect_deferred_paths(afl_state_t *afl) {
+
+  if (afl->paths_deferred) { aflrun_collect_new_paths(afl, 1); }
+
+}
+
 void aflrun_recover_virgin(afl_state_t* afl) {
   u8* virgin_ctx = afl->virgin_ctx;
-  const ctx_t* new_paths = afl->fsrv.trace_virgin->trace;
-  size_t len = afl->fsrv.trace_virgin->num;
+  const ctx_t* new_paths = afl->new_paths;
+  size_t len = afl->num_new_paths;
   // Reset the virgin bits
   for (size_t i = 0; i < len; ++i) {
     size_t idx = CTX_IDX(new_paths[i].block, new_paths[i].call_ctx);
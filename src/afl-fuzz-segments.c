@@ -0,0 +1,192 @@
+/*
+ * This implements the segment store of the queue, see include/afl-segments.h
+ *
+ */
+
+#include "afl-fuzz.h"
+#include "afl-segments.h"
+
+struct afl_segments {
+
+  u8 *dir;                              /* <out_dir>/queue/.segments        */
+  s32 index_fd;
+  s32 data_fd;                          /* Data file being appended to      */
+  u32 seg;                              /* ... and its number               */
+  u64 size;                             /* ... and its size                 */
+  s32 *fds;                             /* Read-only fds of data files      */
+  u32  fds_cnt;
+
+};
+
+static void segments_grow_fds(struct afl_segments *s, u32 seg) {
+
+  if (seg < s->fds_cnt) { return; }
+
+  s->fds = ck_realloc(s->fds, (seg + 1) * sizeof(s32));
+  for (u32 i = s->fds_cnt; i <= seg; ++i) {
+
+    s->fds[i] = -1;
+
+  }
+
+  s->fds_cnt = seg + 1;
+
+}
+
+static s32 segments_data_fd(struct afl_segments *s, u32 seg) {
+
+  if (seg == s->seg) { return s->data_fd; }
+
+  segments_grow_fds(s, seg);
+
+  if (s->fds[seg] < 0) {
+
+    u8 path[PATH_MAX];
+    segments_data_path(path, sizeof(path), s->dir, seg);
+    s->fds[seg] = open(path, O_RDONLY | O_CLOEXEC);
+    if (s->fds[seg] < 0) { PFATAL("Unable to open '%s'", path); }
+
+  }
+
+  return s->fds[seg];
+
+}
+
+static void segments_next_data(struct afl_segments *s) {
+
+  u8 path[PATH_MAX];
+
+  if (s->data_fd >= 0) {
+
+    /* Keep the finished one open for reading. */
+    segments_grow_fds(s, s->seg);
+    s->fds[s->seg] = s->data_fd;
+    ++s->seg;
+
+  }
+
+  segments_data_path(path, sizeof(path), s->dir, s->seg);
+  s->data_fd =
+      open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, DEFAULT_PERMISSION);
+  if (s->data_fd < 0) { PFATAL("Unable to create '%s'", path); }
+
+  struct stat st;
+  if (fstat(s->data_fd, &st)) { PFATAL("fstat() failed"); }
+  s->size = st.st_size;
+
+}
+
+/* Create the segment store of our queue/, called before seeds are added. */
+
+void segments_init(afl_state_t *afl) {
+
+  struct afl_segments *s = ck_alloc(sizeof(struct afl_segments));
+  s->dir = alloc_printf("%s/queue/" SEGMENTS_DIR, afl->out_dir);
+  s->data_fd = -1;
+
+  if (mkdir(s->dir, 0700) && errno != EEXIST) {
+
+    PFATAL("Unable to create '%s'", s->dir);
+
+  }
+
+  u8 *fn = alloc_printf("%s/index", s->dir);
+  s->index_fd = open(fn, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                     DEFAULT_PERMISSION);
+  if (s->index_fd < 0) { PFATAL("Unable to create '%s'", fn); }
+
+  segments_hdr_t hdr = {.magic = SEGMENTS_MAGIC,
+                        .rec_size = sizeof(segment_rec_t)};
+  ck_write(s->index_fd, &hdr, sizeof(hdr), fn);
+  ck_free(fn);
+
+  segments_next_data(s);
+  afl->segments = s;
+
+  OKF("Storing queue entries in '%s'.", s->dir);
+
+}
+
+/* Append `len` bytes of `mem` as data of `q`, which replace earlier data of
+   `q` if it is already stored. */
+
+void segments_add(afl_state_t *afl, struct queue_entry *q, const u8 *mem,
+                  u32 len) {
+
+  struct afl_segments *s = afl->segments;
+
+  if (s->size && s->size + len > SEGMENT_MAX_SIZE) { segments_next_data(s); }
+
+  segment_rec_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.off = s->size;
+  rec.seg = s->seg;
+  rec.len = len;
+  rec.id = q->id;
+  rec.flags = q->seg_stored ? SEGMENT_REC_UPDATE : 0;
+
+  u8 *name = strrchr(q->fname, '/');
+  strncpy(rec.name, name ? name + 1 : q->fname, sizeof(rec.name) - 1);
+
+  /* Data goes first, so readers never see records of missing data. */
+  ck_write(s->data_fd, mem, len, s->dir);
+  ck_write(s->index_fd, &rec, sizeof(rec), s->dir);
+  s->size += len;
+
+  q->seg_stored = 1;
+  q->seg = rec.seg;
+  q->seg_off = rec.off;
+
+}
+
+/* Read `len` bytes of data of stored `q` into `buf`. */
+
+void segments_get(afl_state_t *afl, struct queue_entry *q, u8 *buf, u32 len) {
+
+  s32 fd = segments_data_fd(afl->segments, q->seg);
+  if (unlikely(pread(fd, buf, len, q->seg_off) != (ssize_t)len)) {
+
+    PFATAL("Short read of '%s' from segment %u", q->fname, q->seg);
+
+  }
+
+}
+
+/* Ask the kernel to read the data of stored `q` ahead. */
+
+void segments_prefetch(afl_state_t *afl, struct queue_entry *q) {
+
+#ifdef POSIX_FADV_WILLNEED
+  s32 fd = segments_data_fd(afl->segments, q->seg);
+  posix_fadvise(fd, q->seg_off, q->len, POSIX_FADV_WILLNEED);
+#else
+  (void)afl;
+  (void)q;
+#endif
+
+}
+
+/* Read the data of `q` wherever it is stored into `buf`, `len` bytes at most.
+   Returns the number of bytes read, or -1 if its file cannot be opened. */
+
+ssize_t queue_read_case(afl_state_t *afl, struct queue_entry *q, u8 *buf,
+                        u32 len) {
+
+  if (len > q->len) { len = q->len; }
+
+  if (q->seg_stored == 1) {
+
+    segments_get(afl, q, buf, len);
+    return len;
+
+  }
+
+  asyncw_wait(afl, q->write_seq);
+  s32 fd = open(q->fname, O_RDONLY);
+  if (fd < 0) { return -1; }
+  ssize_t ret = read(fd, buf, len);
+  close(fd);
+  return ret;
+
+}
+
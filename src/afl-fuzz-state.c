@@ -103,6 +103,7 @@ void afl_state_init(afl_state_t *afl, uint32_t map_size) {
   afl->stats_avg_exec = 0;
   afl->skip_deterministic = 1;
   afl->sync_time = SYNC_TIME;
+  afl->sync_inotify_fd = -1;
   afl->cmplog_lvl = 2;
   afl->min_length = 1;
   afl->max_length = MAX_FILE;
@@ -257,6 +258,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_import_first =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_IMPORT_TRIAGE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_import_triage =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_CUSTOM_MUTATOR_ONLY",
 
                               afl_environment_variable_len)) {
@@ -283,6 +291,20 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_no_ui =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_NO_UI_LOG_INTERVAL",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_no_ui_log_interval =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_NO_UI_LOG_JSON",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_no_ui_log_json =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_FORCE_UI",
 
                               afl_environment_variable_len)) {
@@ -369,6 +391,20 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_cal_fast =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_CAL_DEFER",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_cal_defer =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_CAL_ADAPTIVE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_cal_adaptive =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_FAST_CAL",
 
                               afl_environment_variable_len)) {
@@ -430,6 +466,55 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_forksrv_init_tmout =
                 (u8 *)get_afl_env(afl_environment_variables[i]);
 
+          } else if (!strncmp(env, "AFL_RECORD_TRACES",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_record_traces =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_PROMETHEUS_PORT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_prometheus_port =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_QUEUE_SEGMENTS",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_queue_segments =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_SHMEM_DELTA",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_shmem_delta =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_SAN_BINARY",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_san_binary =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_SEED_TMOUT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_seed_tmout =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_FSRV_POOL",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_fsrv_pool =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
           } else if (!strncmp(env, "AFL_TESTCACHE_SIZE",
 
                               afl_environment_variable_len)) {
@@ -444,6 +529,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_testcache_entries =
                 (u8 *)get_afl_env(afl_environment_variables[i]);
 
+          } else if (!strncmp(env, "AFL_TESTCACHE_MMAP",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_testcache_mmap =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
           } else if (!strncmp(env, "AFL_STATSD_HOST",
 
                               afl_environment_variable_len)) {
@@ -538,6 +630,20 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_no_crash_readme =
                 atoi((u8 *)get_afl_env(afl_environment_variables[i]));
 
+          } else if (!strncmp(env, "AFL_ASYNC_WRITE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_async_write =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_SYNC_INOTIFY",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_sync_inotify =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_SYNC_TIME",
 
                               afl_environment_variable_len)) {
@@ -633,6 +739,18 @@ void afl_state_deinit(afl_state_t *afl) {
   if (afl->orig_cmp_map) { ck_free(afl->orig_cmp_map); }
   if (afl->cmplog_binary) { ck_free(afl->cmplog_binary); }
 
+  if (afl->sync_inotify_fd >= 0) { close(afl->sync_inotify_fd); }
+  for (u32 i = 0; i < afl->sync_peers_cnt; i++) {
+
+    for (u32 j = 0; j < afl->sync_peers[i].pending_cnt; j++)
+      ck_free(afl->sync_peers[i].pending[j]);
+    ck_free(afl->sync_peers[i].pending);
+    ck_free(afl->sync_peers[i].name);
+
+  }
+
+  ck_free(afl->sync_peers);
+
   afl_free(afl->queue_buf);
   afl_free(afl->out_buf);
   afl_free(afl->out_scratch_buf);
@@ -640,6 +758,22 @@ void afl_state_deinit(afl_state_t *afl) {
   afl_free(afl->in_buf);
   afl_free(afl->in_scratch_buf);
   afl_free(afl->ex_buf);
+  afl_free(afl->touched_words);
+  afl_free(afl->score_edges);
+  afl_free(afl->aflrun_active);
+  afl_free(afl->new_paths_buf);
+  afl_free(afl->summary_buf);
+
+  for (u32 i = 0; i < afl->cal_pending_alloc; ++i) {
+
+    ck_free(afl->cal_pending[i].trace);
+
+  }
+
+  afl_free(afl->cal_pending);
+
+  if (afl->record_file) { fclose(afl->record_file); }
+  afl_free(afl->record_buf);
 
   ck_free(afl->virgin_bits);
   ck_free(afl->virgin_tmout);
@@ -653,6 +787,8 @@ void afl_state_deinit(afl_state_t *afl) {
 
   list_remove(&afl_states, afl);
   hashmap_free(afl->value_map);
+  if (afl->crash_bucket_map) { hashmap_free(afl->crash_bucket_map); }
+  if (afl->crash_index) { fclose(afl->crash_index); }
 
 }
 
@@ -696,3 +832,9 @@ void afl_states_request_skip(void) {
 
 }
 
+void afl_states_request_mem_report(void) {
+
+  LIST_FOREACH(&afl_states, afl_state_t, { el->mem_report_requested = 1; });
+
+}
+
@@ -199,6 +199,184 @@ void load_stats_file(afl_state_t *afl) {
 
 /* Update stats file for unattended monitoring. */
 
+/* Convert `aflrun_ticks` of AFLRUN_PROFILE to microseconds, by the rate of
+   ticks to wall clock since profiling started. */
+
+u64 aflrun_prof_us(afl_state_t *afl, u64 ticks) {
+
+  u64 us = get_cur_time_us() - afl->aflrun_prof_us0;
+  u64 elapsed = aflrun_ticks() - afl->aflrun_prof_ticks0;
+  return elapsed ? (double)ticks * us / elapsed : 0;
+
+}
+
+/* Ticks spent in AFLRun runtime by all forkservers. */
+
+static u64 aflrun_runtime_ticks(afl_state_t *afl) {
+
+  if (!afl->fsrv.num_reachables) { return 0; }
+
+  u64 ret = afl->fsrv.trace_virgin->overhead;
+  for (u32 i = 0; i < afl->fsrv_pool_cnt && afl->fsrv_pool; ++i)
+    ret += afl->fsrv_pool[i].fsrv.trace_virgin->overhead;
+  return ret;
+
+}
+
+/* Percentage of fuzzing time spent in AFLRun runtime of the target. */
+
+double aflrun_runtime_ratio(afl_state_t *afl) {
+
+  u64 total = afl->exec_time + afl->fuzz_time;
+  return total ? (double)aflrun_prof_us(afl, aflrun_runtime_ticks(afl)) * 100 /
+                     total
+               : 0;
+
+}
+
+/* CPU ticks of process `pid` from /proc, including its waited-for children
+   if `children` is set, or 0 if it is not running. */
+
+static u64 aflrun_proc_ticks(s32 pid, u8 children) {
+
+#ifdef __linux__
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  s32 fd = open(path, O_RDONLY);
+  if (fd < 0) { return 0; }
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) { return 0; }
+  buf[n] = 0;
+
+  /* Fields after `(comm)`, which can contain anything, start at state. */
+  char *p = strrchr(buf, ')');
+  unsigned long long utime, stime, cutime, cstime;
+  if (!p || sscanf(p + 2,
+                   "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+                   "%llu %llu",
+                   &utime, &stime, &cutime, &cstime) != 4) {
+
+    return 0;
+
+  }
+
+  return utime + stime + (children ? cutime + cstime : 0);
+#else
+  (void)pid;
+  (void)children;
+  return 0;
+#endif
+
+}
+
+static u64 aflrun_fsrv_ticks(afl_forkserver_t *fsrv) {
+
+  if (fsrv->fsrv_pid <= 0) { return 0; }
+
+  /* Children reaped by the forkserver, and a persistent one still alive */
+  u64 ret = aflrun_proc_ticks(fsrv->fsrv_pid, 1);
+  if (fsrv->persistent_mode && fsrv->child_pid > 0) {
+
+    ret += aflrun_proc_ticks(fsrv->child_pid, 0);
+
+  }
+
+  return ret;
+
+}
+
+/* CPU time in microseconds used so far by the fuzzing thread and by targets
+   of all forkservers, for `--config cpu_quantum=1`. It is only read between
+   executions, when no target is running but a stopped persistent one. */
+
+u64 aflrun_cpu_us(afl_state_t *afl) {
+
+  static long ticks_per_sec;
+  if (unlikely(!ticks_per_sec)) { ticks_per_sec = sysconf(_SC_CLK_TCK); }
+
+  u64 ticks = aflrun_fsrv_ticks(&afl->fsrv);
+  for (u32 i = 0; i < afl->fsrv_pool_cnt && afl->fsrv_pool; ++i)
+    ticks += aflrun_fsrv_ticks(&afl->fsrv_pool[i].fsrv);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ticks * 1000000 / ticks_per_sec + ts.tv_sec * 1000000ULL +
+         ts.tv_nsec / 1000;
+
+}
+
+/* Names of `AFLRUN_PHASE_*` in fuzzer_stats, plot_data and statsd. */
+
+const char *aflrun_phase_names[AFLRUN_PHASE_NUM] = {
+
+    "new_path", "fringe", "fringe_cov", "energy", "cull_div", "merge"};
+
+/* Names of `AFLRUN_MEM_*` in fuzzer_stats and aflrun_memory. */
+
+static const char *aflrun_mem_names[AFLRUN_MEM_NUM] = {
+
+    "virgins", "tops", "clusters", "fringes", "seed_fringes", "decisives",
+    "div"};
+
+/* Write estimated memory of AFLRun structures and their peaks so far to
+   `aflrun_memory` of the output directory, on request by SIGUSR2. */
+
+void write_aflrun_memory(afl_state_t *afl) {
+
+  size_t cur[AFLRUN_MEM_NUM], peak[AFLRUN_MEM_NUM], total = 0;
+  aflrun_get_memory(cur, peak);
+
+  u8   *fn = alloc_printf("%s/aflrun_memory", afl->out_dir);
+  FILE *f = fopen(fn, "w");
+  if (!f) { PFATAL("Unable to create '%s'", fn); }
+  ck_free(fn);
+
+  fprintf(f, "# %llu s, %u seeds, %zu clusters\n%-14s %12s %12s\n",
+          (afl->prev_run_time + get_cur_time() - afl->start_time) / 1000,
+          afl->queued_items, aflrun_get_num_clusters(), "# structure",
+          "cur_kb", "peak_kb");
+  for (u32 i = 0; i < AFLRUN_MEM_NUM; ++i) {
+
+    fprintf(f, "%-14s %12zu %12zu\n", aflrun_mem_names[i], cur[i] >> 10,
+            peak[i] >> 10);
+    total += cur[i];
+
+  }
+
+  fprintf(f, "%-14s %12zu\n", "total", total >> 10);
+  fclose(f);
+
+  if (afl->not_on_tty) {
+
+    ACTF("Wrote AFLRun memory report, %zu kB in total.", total >> 10);
+
+  }
+
+}
+
+/* Nanoseconds within which a fraction `q` of calls of an AFLRun phase
+   ended, taking the upper bound of the histogram bucket. */
+
+u64 aflrun_phase_quantile_ns(afl_state_t *afl, const aflrun_phase_t *p,
+                             double q) {
+
+  if (!p->calls) { return 0; }
+
+  u64 seen = 0, want = (u64)(p->calls * q);
+  if (want < p->calls * q || !want) { ++want; }
+
+  for (u32 i = 0; i < AFLRUN_PHASE_HIST; ++i) {
+
+    seen += p->hist[i];
+    if (seen >= want) { return aflrun_prof_us(afl, (2ULL << i) * 1000); }
+
+  }
+
+  return aflrun_prof_us(afl, (2ULL << (AFLRUN_PHASE_HIST - 1)) * 1000);
+
+}
+
 void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
                       double stability, double eps) {
 
@@ -284,6 +462,9 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
       "testcache_size    : %llu\n"
       "testcache_count   : %u\n"
       "testcache_evict   : %u\n"
+      "testcache_mmaps   : %u\n"
+      "aflrun_shm_pages  : %s\n"
+      "sync_skipped      : %u\n"
       "afl_banner        : %s\n"
       "afl_version       : " VERSION
       "\n"
@@ -319,7 +500,13 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
 #endif
       t_bytes, afl->fsrv.real_map_size, afl->var_byte_count, afl->expand_havoc,
       afl->a_extras_cnt, afl->q_testcase_cache_size,
-      afl->q_testcase_cache_count, afl->q_testcase_evictions, afl->use_banner,
+      afl->q_testcase_cache_count, afl->q_testcase_evictions,
+      afl->q_testcase_mmap_count,
+      afl->shm_run.pages == AFLRUN_SHM_PAGES_HUGETLB ? "hugetlb"
+      : afl->shm_run.pages == AFLRUN_SHM_PAGES_THP   ? "thp"
+      : afl->shm_run.pages == AFLRUN_SHM_PAGES_BORROWED ? "nyx"
+                                                     : "normal",
+      afl->queued_sync_skipped, afl->use_banner,
       afl->unicorn_mode ? "unicorn" : "", afl->fsrv.qemu_mode ? "qemu " : "",
       afl->fsrv.cs_mode ? "coresight" : "",
       afl->non_instrumented_mode ? " non_instrumented " : "",
@@ -334,6 +521,111 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
           : "default",
       afl->orig_cmdline);
 
+  if (afl->san) {
+
+    fprintf(f,
+            "san_execs         : %llu\n"
+            "san_crashes       : %llu\n"
+            "san_dropped       : %llu\n",
+            afl->san_execs, afl->san_crashes, afl->san_dropped);
+
+  }
+
+  if (afl->aflrun_profile) {
+
+    fprintf(f,
+            "prof_exec_ms      : %llu\n"
+            "prof_runtime_ms   : %llu\n"
+            "prof_new_path_ms  : %llu\n"
+            "prof_energy_ms    : %llu\n"
+            "prof_cull_ms      : %llu\n",
+            afl->exec_time / 1000,
+            aflrun_prof_us(afl, aflrun_runtime_ticks(afl)) / 1000,
+            aflrun_prof_us(afl, afl->aflrun_prof[AFLRUN_PROF_NEW_PATH]) / 1000,
+            aflrun_prof_us(afl, afl->aflrun_prof[AFLRUN_PROF_ENERGY]) / 1000,
+            aflrun_prof_us(afl, afl->aflrun_prof[AFLRUN_PROF_CULL]) / 1000);
+
+    u64                   num_maps;
+    const aflrun_phase_t *phases = aflrun_get_phases(&num_maps);
+    for (u32 i = 0; i < AFLRUN_PHASE_NUM; ++i) {
+
+      const aflrun_phase_t *p = phases + i;
+      fprintf(f,
+              "phase_%s_calls : %llu\n"
+              "phase_%s_ms : %llu\n"
+              "phase_%s_p50_ns : %llu\n"
+              "phase_%s_p99_ns : %llu\n",
+              aflrun_phase_names[i], p->calls, aflrun_phase_names[i],
+              aflrun_prof_us(afl, p->ticks) / 1000, aflrun_phase_names[i],
+              aflrun_phase_quantile_ns(afl, p, 0.5), aflrun_phase_names[i],
+              aflrun_phase_quantile_ns(afl, p, 0.99));
+
+    }
+
+    u64 calls = phases[AFLRUN_PHASE_NEW_PATH].calls;
+    fprintf(f,
+            "virgin_maps       : %zu\n"
+            "virgin_maps_exec  : %0.02f\n",
+            aflrun_get_num_clusters(),
+            calls ? (double)num_maps / calls : 0.0);
+
+  }
+
+  /* Estimated heap usage of AFLRun structures, see aflrun_get_memory(). */
+
+  size_t mem_cur[AFLRUN_MEM_NUM], mem_peak[AFLRUN_MEM_NUM], mem_total = 0;
+  aflrun_get_memory(mem_cur, mem_peak);
+  for (u32 i = 0; i < AFLRUN_MEM_NUM; ++i) {
+
+    fprintf(f, "mem_%s_kb : %zu\nmem_%s_peak_kb : %zu\n",
+            aflrun_mem_names[i], mem_cur[i] >> 10, aflrun_mem_names[i],
+            mem_peak[i] >> 10);
+    mem_total += mem_cur[i];
+
+  }
+
+  size_t pool_mapped, pool_used;
+  aflrun_get_pool(&pool_mapped, &pool_used);
+  fprintf(f,
+          "mem_aflrun_kb     : %zu\n"
+          "mem_pool_kb       : %zu\n"
+          "mem_pool_used_kb  : %zu\n"
+          "clusters_evicted  : %zu\n",
+          mem_total >> 10, pool_mapped >> 10, pool_used >> 10,
+          aflrun_get_evicted_clusters());
+
+  /* Progress of AFLRun, summed over instances by aflrun-whatsup. */
+
+  if (afl->fsrv.num_reachables) {
+
+    reach_t num_reached, num_freached, num_reached_targets,
+        num_freached_targets;
+    size_t num_fringes, num_pro_fringes, num_target_fringes;
+    aflrun_get_reached(&num_reached, &num_freached, &num_reached_targets,
+                       &num_freached_targets);
+    aflrun_get_fringes(&num_fringes, &num_pro_fringes, &num_target_fringes);
+    fprintf(f,
+            "aflrun_mode       : %u\n"
+            "aflrun_targets    : %u\n"
+            "aflrun_reached_targets : %u\n"
+            "aflrun_reachables : %u\n"
+            "aflrun_reached    : %u\n"
+            "aflrun_fringes    : %zu\n"
+            "aflrun_pro_fringes : %zu\n"
+            "aflrun_clusters   : %zu\n"
+            "aflrun_import_dropped : %u\n"
+            "aflrun_cmp_closer : %u\n"
+            "aflrun_retired    : %u\n"
+            "aflrun_crash_bucket_full : %llu\n"
+            "aflrun_muted      : %zu\n",
+            aflrun_get_mode(), afl->fsrv.num_targets, num_reached_targets,
+            afl->fsrv.num_reachables, num_reached, num_fringes,
+            num_pro_fringes, aflrun_get_num_clusters(), afl->import_dropped,
+            afl->cmp_closer, afl->queued_retired, afl->crash_bucket_full,
+            afl->aflrun_muted);
+
+  }
+
   /* ignore errors */
 
   if (afl->debug) {
@@ -440,13 +732,29 @@ void maybe_update_plot_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
 
   fprintf(afl->fsrv.plot_file,
           "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f, %llu, "
-          "%u\n",
+          "%u",
           ((afl->prev_run_time + get_cur_time() - afl->start_time) / 1000),
           afl->queue_cycle - 1, afl->current_entry, afl->queued_items,
           afl->pending_not_fuzzed, afl->pending_favored, bitmap_cvg,
           afl->saved_crashes, afl->saved_hangs, afl->max_depth, eps,
           afl->plot_prev_ed, t_bytes);                     /* ignore errors */
 
+  /* With AFLRUN_PROFILE, followed by ms of each AFLRun phase and virgin maps,
+     as in the header written by setup_dirs_fds(). */
+
+  if (afl->aflrun_profile) {
+
+    u64                   num_maps;
+    const aflrun_phase_t *phases = aflrun_get_phases(&num_maps);
+    for (u32 i = 0; i < AFLRUN_PHASE_NUM; ++i)
+      fprintf(afl->fsrv.plot_file, ", %llu",
+              aflrun_prof_us(afl, phases[i].ticks) / 1000);
+    fprintf(afl->fsrv.plot_file, ", %zu", aflrun_get_num_clusters());
+
+  }
+
+  fputc('\n', afl->fsrv.plot_file);
+
   fflush(afl->fsrv.plot_file);
 
 }
@@ -485,6 +793,11 @@ void show_stats(afl_state_t *afl) {
 
 void aflrun_write_to_log(afl_state_t* afl) {
 
+  if (afl->journal) {
+    aflrun_journal_flush(0);
+    return;
+  }
+
   u8* fn = alloc_printf("%s/aflrun_log.txt", afl->out_dir);
 
   FILE* fd = fopen(fn, "w");
@@ -687,6 +1000,16 @@ void show_stats_normal(afl_state_t *afl) {
 
   }
 
+  if (unlikely(afl->prometheus)) { prometheus_update(afl); }
+
+  if (unlikely(afl->mem_report_requested)) {
+
+    afl->mem_report_requested = 0;
+    write_aflrun_memory(afl);
+    if (afl->journal) { aflrun_journal_flush(1); }
+
+  }
+
   /* Every now and then, write plot data. */
 
   if (unlikely(afl->force_ui_update ||
@@ -1205,15 +1528,10 @@ void show_stats_normal(afl_state_t *afl) {
 
   if (likely(afl->skip_deterministic)) {
 
-    sprintf(tmp,
-#ifdef AFLRUN_OVERHEAD
-      "%0.02f%%, "
-#endif // AFLRUN_OVERHEAD
-      "%0.02f%%, %0.02f%%, %0.02f%%",
-#ifdef AFLRUN_OVERHEAD
-      (double)afl->fsrv.trace_virgin->overhead * 100 /
-      (afl->exec_time + afl->fuzz_time),
-#endif // AFLRUN_OVERHEAD
+    u8 prof[32] = "";
+    if (afl->aflrun_profile)
+      snprintf(prof, sizeof(prof), "%0.02f%%, ", aflrun_runtime_ratio(afl));
+    sprintf(tmp, "%s%0.02f%%, %0.02f%%, %0.02f%%", prof,
       (double)afl->exec_time * 100 /
         (afl->exec_time + afl->fuzz_time),
       (double)afl->exec_time_short * 100 /
@@ -1588,6 +1906,16 @@ void show_stats_pizza(afl_state_t *afl) {
 
   }
 
+  if (unlikely(afl->prometheus)) { prometheus_update(afl); }
+
+  if (unlikely(afl->mem_report_requested)) {
+
+    afl->mem_report_requested = 0;
+    write_aflrun_memory(afl);
+    if (afl->journal) { aflrun_journal_flush(1); }
+
+  }
+
   /* Every now and then, write plot data. */
 
   if (unlikely(afl->force_ui_update ||
@@ -2470,3 +2798,26 @@ void show_init_stats(afl_state_t *afl) {
 
 }
 
+
+/* Start a detached thread running `func(arg)` for a stats exporter or other
+   helper, with all signals blocked in it, so they are left to the fuzzing
+   loop. `what` names the thread if it cannot be created. */
+
+void start_detached_thread(void *(*func)(void *), void *arg,
+                           const char *what) {
+
+  pthread_t thread;
+  sigset_t  all, old;
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  if (pthread_create(&thread, NULL, func, arg)) {
+
+    FATAL("Failed to create %s thread", what);
+
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_detach(thread);
+
+}
@@ -12,6 +12,7 @@
 #include <netdb.h>
 #include <unistd.h>
 #include "afl-fuzz.h"
+#include "aflrun.h"
 
 #define MAX_STATSD_PACKET_SIZE 4096
 #define MAX_TAG_LEN 200
@@ -218,6 +219,29 @@ int statsd_send_metric(afl_state_t *afl) {
 
 }
 
+/* Append a gauge of AFLRun profiling to the packet in `buff`. */
+
+static void statsd_append_gauge(afl_state_t *afl, char *buff, size_t bufflen,
+                                const char *tags, const char *name,
+                                const char *suffix, u64 value) {
+
+  size_t len = strlen(buff);
+  if (len >= bufflen) { return; }
+
+  if (afl->statsd_metric_format_type == STATSD_TAGS_TYPE_SUFFIX) {
+
+    snprintf(buff + len, bufflen - len, METRIC_PREFIX ".aflrun_%s%s:%llu|g%s\n",
+             name, suffix, value, tags);
+
+  } else {
+
+    snprintf(buff + len, bufflen - len, METRIC_PREFIX ".aflrun_%s%s%s:%llu|g\n",
+             name, suffix, tags, value);
+
+  }
+
+}
+
 int statsd_format_metric(afl_state_t *afl, char *buff, size_t bufflen) {
 
   char tags[MAX_TAG_LEN * 2] = {0};
@@ -269,6 +293,32 @@ int statsd_format_metric(afl_state_t *afl, char *buff, size_t bufflen) {
 
   }
 
+  /* Time spent in AFLRun bookkeeping with AFLRUN_PROFILE, so instances
+     bottlenecked by scheduling rather than execution can be spotted. */
+
+  if (afl->aflrun_profile) {
+
+    u64                   num_maps;
+    const aflrun_phase_t *phases = aflrun_get_phases(&num_maps);
+    for (u32 i = 0; i < AFLRUN_PHASE_NUM; ++i) {
+
+      const char *name = aflrun_phase_names[i];
+      statsd_append_gauge(afl, buff, bufflen, tags, name, "_calls",
+                          phases[i].calls);
+      statsd_append_gauge(afl, buff, bufflen, tags, name, "_ms",
+                          aflrun_prof_us(afl, phases[i].ticks) / 1000);
+      statsd_append_gauge(afl, buff, bufflen, tags, name, "_p99_ns",
+                          aflrun_phase_quantile_ns(afl, phases + i, 0.99));
+
+    }
+
+    statsd_append_gauge(afl, buff, bufflen, tags, "virgin_maps", "",
+                        aflrun_get_num_clusters());
+    statsd_append_gauge(afl, buff, bufflen, tags, "virgin_maps_checked", "",
+                        num_maps);
+
+  }
+
   return 0;
 
 }
@@ -51,8 +51,7 @@ static void at_exit() {
 
   s32   i, pid1 = 0, pid2 = 0, pgrp = -1;
   char *list[] = {SHM_ENV_VAR, SHM_FUZZ_ENV_VAR, CMPLOG_SHM_ENV_VAR,
-    SHM_RBB_ENV_VAR, SHM_RF_ENV_VAR, SHM_TR_ENV_VAR, SHM_VIR_ENV_VAR,
-    SHM_VTR_ENV_VAR, NULL};
+    SHM_AFLRUN_ENV_VAR, NULL};
   char *ptr;
 
   ptr = getenv("__AFL_TARGET_PID2");
@@ -241,6 +240,7 @@ static void usage(u8 *argv0, int more_help) {
       "              (must contain abort_on_error=1 and symbolize=0)\n"
       "MSAN_OPTIONS: custom settings for MSAN\n"
       "              (must contain exitcode="STRINGIFY(MSAN_ERROR)" and symbolize=0)\n"
+      "AFL_ASYNC_WRITE: write new queue entries, crashes and hangs from a thread\n"
       "AFL_AUTORESUME: resume fuzzing if directory specified by -o already exists\n"
       "AFL_BENCH_JUST_ONE: run the target just once\n"
       "AFL_BENCH_UNTIL_CRASH: exit soon when the first crashing input has been found\n"
@@ -258,13 +258,19 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_EXPAND_HAVOC_NOW: immediately enable expand havoc mode (default: after 60\n"
       "                      minutes and a cycle without finds)\n"
       "AFL_FAST_CAL: limit the calibration stage to three cycles for speedup\n"
+      "AFL_CAL_DEFER: calibrate new queue entries after fuzzing the current one\n"
+      "AFL_CAL_ADAPTIVE: stop calibrating new queue entries once their trace is\n"
+      "                  reproduced, as long as the target looks deterministic\n"
       "AFL_FORCE_UI: force showing the status screen (for virtual consoles)\n"
       "AFL_FORKSRV_INIT_TMOUT: time spent waiting for forkserver during startup (in ms)\n"
+      "AFL_FSRV_POOL: number of extra forkservers running havoc inputs in parallel\n"
       "AFL_HANG_TMOUT: override timeout value (in milliseconds)\n"
       "AFL_I_DONT_CARE_ABOUT_MISSING_CRASHES: don't warn about core dump handlers\n"
       "AFL_IGNORE_UNKNOWN_ENVS: don't warn on unknown env vars\n"
       "AFL_IGNORE_PROBLEMS: do not abort fuzzing if an incorrect setup is detected\n"
       "AFL_IMPORT_FIRST: sync and import test cases from other fuzzer instances first\n"
+      "AFL_IMPORT_TRIAGE: only keep -F test cases reaching new AFLRun contexts or\n"
+      "                   fringes, running them on AFL_FSRV_POOL in parallel\n"
       "AFL_INPUT_LEN_MIN/AFL_INPUT_LEN_MAX: like -g/-G set min/max fuzz length produced\n"
       "AFL_PIZZA_MODE: 1 - enforce pizza mode, 0 - disable for April 1st\n"
       "AFL_KILL_SIGNAL: Signal ID delivered to child processes on timeout, etc.\n"
@@ -286,6 +292,9 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_NO_SNAPSHOT: do not use the snapshot feature (if the snapshot lkm is loaded)\n"
       "AFL_NO_STARTUP_CALIBRATION: no initial seed calibration, start fuzzing at once\n"
       "AFL_NO_UI: switch status screen off\n"
+      "AFL_NO_UI_LOG_INTERVAL: without a tty, log one line for all seeds fuzzed\n"
+      "                        in this many milliseconds instead of each seed\n"
+      "AFL_NO_UI_LOG_JSON: same, with lines in JSON (default interval: 1000)\n"
 
       DYN_COLOR
 
@@ -296,6 +305,8 @@ static void usage(u8 *argv0, int more_help) {
       PERSISTENT_MSG
 
       "AFL_PRELOAD: LD_PRELOAD / DYLD_INSERT_LIBRARIES settings for target\n"
+      "AFL_RECORD_TRACES: file to record AFLRun maps of each execution to, for\n"
+      "                   replaying with test/benchmarks/aflrun_bench -R\n"
       "AFL_TARGET_ENV: pass extra environment variables to target\n"
       "AFL_SHUFFLE_QUEUE: reorder the input queue randomly on startup\n"
       "AFL_SKIP_BIN_CHECK: skip afl compatibility checks, also disables auto map size\n"
@@ -307,9 +318,18 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_STATSD_TAGS_FLAVOR: set statsd tags format (default: disable tags)\n"
       "                        Supported formats are: 'dogstatsd', 'librato',\n"
       "                        'signalfx' and 'influxdb'\n"
+      "AFL_PROMETHEUS_PORT: serve Prometheus metrics over HTTP on this port\n"
+      "AFL_QUEUE_SEGMENTS: store the queue in append-only segment files\n"
+      "AFL_SAN_BINARY: sanitizer build re-running inputs that reach targets\n"
+      "AFL_SEED_TMOUT: time out mutants of a seed at this many times its\n"
+      "                execution time, at most the -t timeout\n"
+      "AFL_SHMEM_DELTA: only copy bytes changed by havoc to shared memory inputs\n"
+      "AFL_SYNC_INOTIFY: find new entries of other instances with inotify\n"
       "AFL_SYNC_TIME: sync time between fuzzing instances (in minutes)\n"
       "AFL_NO_CRASH_README: do not create a README in the crashes directory\n"
       "AFL_TESTCACHE_SIZE: use a cache for testcases, improves performance (in MB)\n"
+      "AFL_TESTCACHE_MMAP: map testcases of this many KB or more from their files\n"
+      "                    instead of caching them\n"
       "AFL_TMPDIR: directory to use for input file generation (ramdisk recommended)\n"
       "AFL_EARLY_FORKSERVER: force an early forkserver in an afl-clang-fast/\n"
       "                      afl-clang-lto/afl-gcc-fast target\n"
@@ -1521,6 +1541,7 @@ int main(int argc, char **argv_orig, char **envp) {
   }
 
   if (unlikely(afl->afl_env.afl_statsd)) { statsd_setup_format(afl); }
+  if (unlikely(afl->afl_env.afl_prometheus_port)) { prometheus_init(afl); }
 
   if (!afl->use_banner) { afl->use_banner = argv[optind]; }
 
@@ -1611,6 +1632,14 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_seed_tmout) {
+
+    s32 mult = atoi(afl->afl_env.afl_seed_tmout);
+    if (mult < 2) { FATAL("Invalid value for AFL_SEED_TMOUT, must be >= 2"); }
+    afl->seed_tmout_mult = (u32)mult;
+
+  }
+
   if (afl->afl_env.afl_exit_on_time) {
 
     u64 exit_on_time = atoi(afl->afl_env.afl_exit_on_time);
@@ -1618,6 +1647,19 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_fsrv_pool) {
+
+    s32 pool = atoi(afl->afl_env.afl_fsrv_pool);
+    if (pool < 0 || (u32)pool > FSRV_POOL_MAX) {
+
+      FATAL("Invalid value for AFL_FSRV_POOL, must be 0-%u", FSRV_POOL_MAX);
+
+    }
+
+    afl->fsrv_pool_cnt = (u32)pool;
+
+  }
+
   if (afl->afl_env.afl_max_det_extras) {
 
     s32 max_det_extras = atoi(afl->afl_env.afl_max_det_extras);
@@ -1672,6 +1714,31 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_testcache_mmap) {
+
+    char *end;
+    u64   kb = strtoull(afl->afl_env.afl_testcache_mmap, &end, 10);
+    if (end == (char *)afl->afl_env.afl_testcache_mmap || *end || !kb ||
+        kb > MAX_FILE / 1024) {
+
+      FATAL("Invalid AFL_TESTCACHE_MMAP '%s'",
+            afl->afl_env.afl_testcache_mmap);
+
+    }
+
+    if (afl->no_unlink) {
+
+      WARNF("AFL_TESTCACHE_MMAP is ignored with -N.");
+
+    } else {
+
+      afl->q_testcase_mmap_min = kb * 1024;
+      OKF("Mapping testcases of %llu KB or more from their files.", kb);
+
+    }
+
+  }
+
   if (afl->afl_env.afl_forksrv_init_tmout) {
 
     afl->fsrv.init_tmout = atoi(afl->afl_env.afl_forksrv_init_tmout);
@@ -1833,6 +1900,14 @@ int main(int argc, char **argv_orig, char **envp) {
   save_cmdline(afl, argc, argv);
   check_if_tty(afl);
   if (afl->afl_env.afl_force_ui) { afl->not_on_tty = 0; }
+  if (afl->not_on_tty && (afl->afl_env.afl_no_ui_log_interval ||
+                          afl->afl_env.afl_no_ui_log_json)) {
+
+    nottylog_init(afl);
+
+  }
+
+  if (afl->afl_env.afl_async_write) { asyncw_init(afl); }
 
   if (afl->afl_env.afl_custom_mutator_only) {
 
@@ -1851,6 +1926,15 @@ int main(int argc, char **argv_orig, char **envp) {
   setup_dirs_fds(afl);
 
   #ifdef HAVE_AFFINITY
+  /* Targets of the forkserver pool and of the sanitizer build inherit our
+     affinity, don't share a core */
+  if ((afl->fsrv_pool_cnt || afl->afl_env.afl_san_binary) &&
+      afl->cpu_to_bind == -1) {
+
+    afl->afl_env.afl_no_affinity = 1;
+
+  }
+
   bind_to_free_cpu(afl);
   #endif                                                   /* HAVE_AFFINITY */
 
@@ -1894,6 +1978,18 @@ int main(int argc, char **argv_orig, char **envp) {
 
   setup_custom_mutators(afl);
 
+  if (unlikely(afl->afl_env.afl_queue_segments)) {
+
+    if (afl->custom_mutators_count) {
+
+      FATAL("AFL_QUEUE_SEGMENTS is not supported with custom mutators");
+
+    }
+
+    segments_init(afl);
+
+  }
+
   write_setup_file(afl, argc, argv);
 
   setup_cmdline_file(afl, argv + optind);
@@ -1996,16 +2092,52 @@ int main(int argc, char **argv_orig, char **envp) {
 
   check_binary(afl, argv[optind]);
 
-  aflrun_d = aflrun_d != NULL ? aflrun_d : aflrun_find_temp(afl->temp_dir);
-  if (aflrun_d == NULL)
-    FATAL("Cannot find temp dir, please provide '--dir' manually");
-  OKF("Path to AFLRun directory: %s", aflrun_d);
-  aflrun_temp_dir_init(afl, aflrun_d);
-  free(aflrun_d);
+  if (aflrun_d == NULL && afl->aflrun_image_off) {
+
+    OKF("Using AFLRun image embedded in the binary.");
+    aflrun_binary_image_init(afl);
+
+  } else {
+
+    aflrun_d = aflrun_d != NULL ? aflrun_d : aflrun_find_temp(afl->temp_dir);
+    if (aflrun_d == NULL)
+      FATAL("Cannot find temp dir, please provide '--dir' manually");
+    OKF("Path to AFLRun directory: %s", aflrun_d);
+    aflrun_temp_dir_init(afl, aflrun_d);
+    free(aflrun_d);
+
+  }
 
+  // Appended last, so it overrides any 'no_diversity' given by user
+  if (afl->aflrun_no_div)
+    config = alloc_printf("%s%sno_diversity=1", config, *config ? ":" : "");
   aflrun_load_config(config,
     &afl->check_at_begin, &afl->log_at_begin, &afl->log_check_interval,
     &afl->trim_thr, &afl->queue_quant_thr, &afl->min_num_exec);
+  afl->cpu_quantum = aflrun_cpu_quantum();
+  afl->aflrun_slice = aflrun_alias_slice();
+  afl->splice_fringe = aflrun_splice_fringe();
+  afl->op_sched = aflrun_op_sched();
+  afl->influence_execs = aflrun_influence_execs();
+  afl->focus_det = aflrun_focus_det();
+  afl->dist_stack = aflrun_dist_stack();
+  afl->retire_extra = aflrun_retire_extra();
+  afl->crash_buckets = aflrun_crash_buckets(&afl->crash_bucket_depth);
+  afl->learn_edges = aflrun_learn_edges_enabled();
+  afl->rare_fringes = aflrun_rare_fringes();
+  afl->lean_cov = aflrun_lean_cov();
+  afl->mute_blocks = aflrun_mute_enabled();
+  afl->journal = aflrun_journal_enabled();
+  afl->directed_cmplog = aflrun_directed_cmplog();
+  #ifndef __linux__
+  if (afl->cpu_quantum) {
+
+    WARNF("cpu_quantum needs /proc, counting quanta by executions instead.");
+    afl->cpu_quantum = 0;
+
+  }
+
+  #endif
   aflrun_init_fringes(
     afl->fsrv.num_reachables, afl->fsrv.num_targets);
 
@@ -2030,6 +2162,17 @@ int main(int argc, char **argv_orig, char **envp) {
 
   afl->start_time = get_cur_time();
 
+  afl->aflrun_profile = !!getenv("AFLRUN_PROFILE");
+  afl->aflrun_timed = afl->aflrun_profile || aflrun_auto_tune() > 0;
+  if (afl->aflrun_timed) {
+
+    afl->aflrun_prof_ticks0 = aflrun_ticks();
+    afl->aflrun_prof_us0 = get_cur_time_us();
+
+  }
+
+  if (afl->aflrun_profile) { aflrun_profile_phases(); }
+
   if (afl->fsrv.qemu_mode) {
 
     if (afl->use_wine) {
@@ -2076,12 +2219,15 @@ int main(int argc, char **argv_orig, char **envp) {
       afl_shm_init(&afl->shm, afl->fsrv.map_size, afl->non_instrumented_mode);
   aflrun_shm_init(&afl->shm_run, afl->fsrv.num_reachables,
     afl->fsrv.num_freachables, afl->non_instrumented_mode);
-  afl->fsrv.trace_reachables = afl->shm_run.map_reachables;
-  afl->fsrv.trace_freachables = afl->shm_run.map_freachables;
-  afl->fsrv.trace_ctx = afl->shm_run.map_ctx;
+  if (afl->shm_run.pages == AFLRUN_SHM_PAGES_HUGETLB)
+    OKF("AFLRun maps are backed by huge pages.");
+  else if (afl->shm_run.pages == AFLRUN_SHM_PAGES_THP)
+    OKF("AFLRun maps are advised to use transparent huge pages.");
+  afl_fsrv_attach_aflrun(&afl->fsrv, &afl->shm_run, 0);
   afl->virgin_ctx = afl->shm_run.map_virgin_ctx;
-  afl->fsrv.trace_virgin = afl->shm_run.map_new_blocks;
-  afl->fsrv.trace_targets = afl->shm_run.map_targets;
+  #ifdef __linux__
+  afl->fsrv.nyx_shm_run = &afl->shm_run;
+  #endif
 
   if (!afl->non_instrumented_mode && !afl->fsrv.qemu_mode &&
       !afl->unicorn_mode && !afl->fsrv.frida_mode && !afl->fsrv.cs_mode &&
@@ -2244,6 +2390,8 @@ int main(int argc, char **argv_orig, char **envp) {
   memset(afl->virgin_tmout, 255, map_size);
   memset(afl->virgin_crash, 255, map_size);
   memset(afl->virgin_reachables, 255, MAP_RBB_SIZE(afl->fsrv.num_reachables));
+  // Nyx backend may have moved AFLRun maps into its bitmap buffer
+  afl->virgin_ctx = afl->shm_run.map_virgin_ctx;
   memset(afl->virgin_freachables, 255, MAP_RF_SIZE(afl->fsrv.num_freachables));
 
   aflrun_init_globals(afl,
@@ -2253,6 +2401,32 @@ int main(int argc, char **argv_orig, char **envp) {
     afl->reachable_to_targets, afl->reachable_to_size, afl->out_dir,
     afl->target_weights, afl->fsrv.map_size, afl->shm_run.div_switch,
     getenv("AFLRUN_CYCLE_TIME"));
+  afl->virgin_stride = aflrun_virgin_stride();
+  aflrun_edge_window(&afl->edge_lo, &afl->edge_hi);
+  if (afl->sync_id && aflrun_shared_state()) aflrun_setup_registry(afl);
+  if (afl->sync_id && aflrun_shared_sched()) aflrun_setup_sched(afl);
+  if (afl->aflrun_sched && afl->aflrun_slice) {
+
+    WARNF("alias_slice does not work with shared_sched, ignoring it.");
+    afl->aflrun_slice = 0;
+
+  }
+
+  if (afl->in_place_resume) {
+
+    const char *err;
+    switch (aflrun_load_checkpoint(&err)) {
+
+      case 1:
+        OKF("Restoring AFLRun scheduler state from its last checkpoint.");
+        break;
+      case -1:
+        WARNF("Ignoring AFLRun checkpoint, it is %s.", err);
+        break;
+
+    }
+
+  }
 
   if (likely(!afl->afl_env.afl_no_startup_calibration)) {
 
@@ -2265,6 +2439,11 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  aflrun_apply_checkpoint();
+
+  if (afl->fsrv_pool_cnt && !afl->fsrv_pool) { setup_fsrv_pool(afl); }
+  if (afl->afl_env.afl_san_binary && !afl->san) { setup_san_fsrv(afl); }
+
   if (afl->q_testcase_max_cache_entries) {
 
     afl->q_testcase_cache =
@@ -2394,8 +2573,35 @@ int main(int argc, char **argv_orig, char **envp) {
 
       afl->force_cycle_end = 0;
       u8 whole_end;
+      if (afl->rare_fringes) { aflrun_sample_hits(afl); }
+      if (afl->learn_edges) {
+
+        aflrun_learn_edges(afl->shm_run.map_icalls, AFLRUN_ICALL_LOG_SIZE);
+        for (u32 i = 0; i < afl->fsrv_pool_cnt; ++i)
+          aflrun_learn_edges(afl->fsrv_pool[i].shm_run.map_icalls,
+                             AFLRUN_ICALL_LOG_SIZE);
+
+      }
+
+      if (afl->aflrun_timed) {
+
+        u64 ticks = 0;
+        for (u32 i = 0; i < AFLRUN_PROF_NUM; ++i)
+          ticks += afl->aflrun_prof[i];
+        aflrun_tune(ticks, aflrun_ticks() - afl->aflrun_prof_ticks0);
+
+      }
+
       afl->is_aflrun = aflrun_cycle_end(&whole_end);
       // afl->is_aflrun may be updated because cycle end may change the mode
+      if (afl->lean_cov) {
+
+        aflrun_set_level(afl, afl->is_aflrun ? AFLRUN_LEVEL_FULL
+                                             : AFLRUN_LEVEL_BLOCKS);
+
+      }
+
+      if (afl->mute_blocks) { aflrun_update_mute(afl); }
 
       /* Now it's the beginning of a new cycle */
 
@@ -2488,7 +2694,9 @@ int main(int argc, char **argv_orig, char **envp) {
 
         afl->perf_scores = afl_realloc(
           (void**)&afl->perf_scores, n * sizeof(double));
+        u64 t0 = aflrun_prof_begin(afl);
         aflrun_assign_energy(n, seeds, afl->perf_scores);
+        aflrun_prof_end(afl, AFLRUN_PROF_ENERGY, t0);
 
         afl->aflrun_queue = afl_realloc(
           (void**)&afl->aflrun_queue, (n+1) * sizeof(struct queue_entry *));
@@ -2502,6 +2710,8 @@ int main(int argc, char **argv_orig, char **envp) {
             FATAL("ID does not match");
 
           q->quant_score = afl->perf_scores[i];
+          if (unlikely(afl->journal))
+            aflrun_journal_seed(q->id, q->quant_score);
           if (q->quant_score > afl->queue_quant_thr)
             afl->aflrun_queue[idx++] = q;
 
@@ -2509,9 +2719,19 @@ int main(int argc, char **argv_orig, char **envp) {
         afl->aflrun_queue[idx] = NULL; // set last to NULL to detect end of cycle
         afl->queued_aflrun = idx;
 
-        qsort(afl->aflrun_queue, idx, sizeof(struct queue_entry*), cmp_quant_score);
+        if (afl->aflrun_slice) // cycle progress is then counted by draws
+          afl->queued_aflrun = aflrun_alias_queue(afl, idx);
+        else
+          qsort(afl->aflrun_queue, idx, sizeof(struct queue_entry*),
+            cmp_quant_score);
 
-        afl->queue_cur = afl->aflrun_queue[(afl->aflrun_idx = 0)];
+        afl->aflrun_idx = 0;
+        if (afl->aflrun_sched) {
+          aflrun_sched_begin_cycle(afl);
+          afl->queue_cur = aflrun_sched_next(afl);
+        } else {
+          afl->queue_cur = afl->aflrun_queue[0];
+        }
         if (afl->queue_cur == NULL)
           continue; // if no seed, we skip the cycle
         afl->current_entry = afl->queue_cur->id;
@@ -2698,8 +2918,11 @@ int main(int argc, char **argv_orig, char **envp) {
 
       }
 
+      if (afl->is_aflrun) { queue_testcase_prefetch(afl); }
+
       // count num of `common_fuzz_stuff` called in `fuzz_one`
       afl->fuzzed_times = 0;
+      u64 cpu_us = afl->cpu_quantum ? aflrun_cpu_us(afl) : 0;
       skipped_fuzz = fuzz_one(afl);
   #ifdef INTROSPECTION
       ++afl->queue_cur->stats_selected;
@@ -2737,11 +2960,17 @@ int main(int argc, char **argv_orig, char **envp) {
 
       // Commit the fuzzed quantum,
       // we need floating point here to prevent always adding zero
-      double fuzzed_quantum =
+      double fuzzed_quantum = afl->cpu_quantum ?
+        (aflrun_cpu_us(afl) - cpu_us) / (double)QUANTUM_TIME :
         afl->fuzzed_times * afl->queue_cur->exec_us / (double)QUANTUM_TIME;
       aflrun_update_fuzzed_quant(afl->queue_cur->id, fuzzed_quantum);
+      // End the cycle before the next seed if this one used up its budget
+      if (aflrun_end_cycle()) { afl->force_cycle_end = 1; }
+      if (afl->is_aflrun && afl->aflrun_sched)
+        aflrun_sched_done(afl, afl->queue_cur, fuzzed_quantum);
+      afl->queue_cur->aflrun_fuzzed = 1;
       afl->quantum_ratio = afl->is_aflrun ?
-        fuzzed_quantum / afl->queue_cur->quant_score : -1;
+        fuzzed_quantum / aflrun_visit_quant(afl, afl->queue_cur) : -1;
 
       if (unlikely(!afl->stop_soon && exit_1)) { afl->stop_soon = 2; }
 
@@ -2763,7 +2992,9 @@ int main(int argc, char **argv_orig, char **envp) {
 
       } else if (afl->is_aflrun) {
 
-        afl->queue_cur = afl->aflrun_queue[++afl->aflrun_idx];
+        ++afl->aflrun_idx;
+        afl->queue_cur = afl->aflrun_sched ?
+          aflrun_sched_next(afl) : afl->aflrun_queue[afl->aflrun_idx];
         afl->current_entry = afl->queue_cur == NULL ?
           afl->queued_items : afl->queue_cur->id;
         // TODO: skip disabled seeds just like above
@@ -2819,6 +3050,7 @@ stop_fuzzing:
   show_stats(afl);           // print the screen one last time
   write_bitmap(afl);
   save_auto(afl);
+  aflrun_write_checkpoint();
 
   if (afl->pizza_is_served) {
 
@@ -2881,16 +3113,12 @@ stop_fuzzing:
   ck_free(profile_file);
   if (fd == NULL)
     FATAL("Cannot open profiling file");
-  fprintf(fd, "%llu %llu %lu "
-  #ifdef AFLRUN_OVERHEAD
-        "%0.02f%% "
-  #endif // AFLRUN_OVERHEAD
-        "%0.02f%%\n",
+  u8 prof[32] = "";
+  if (afl->aflrun_profile)
+    snprintf(prof, sizeof(prof), "%0.02f%% ", aflrun_runtime_ratio(afl));
+  fprintf(fd, "%llu %llu %lu %s%0.02f%%\n",
         time_spent_working, afl->fsrv.total_execs, aflrun_get_num_clusters(),
-  #ifdef AFLRUN_OVERHEAD
-      (double)afl->fsrv.trace_virgin->overhead * 100 /
-      (afl->exec_time + afl->fuzz_time),
-  #endif // AFLRUN_OVERHEAD
+        prof,
       (double)afl->exec_time * 100 /
         (afl->exec_time + afl->fuzz_time));
   fclose(fd);
@@ -2915,6 +3143,7 @@ stop_fuzzing:
 
   if (frida_afl_preload) { ck_free(frida_afl_preload); }
 
+  asyncw_flush(afl);
   fclose(afl->fsrv.plot_file);
   destroy_queue(afl);
   destroy_extras(afl);
@@ -2928,6 +3157,8 @@ stop_fuzzing:
 
   }
 
+  if (afl->fsrv_pool) { destroy_fsrv_pool(afl); }
+  if (afl->san) { destroy_san_fsrv(afl); }
   afl_fsrv_deinit(&afl->fsrv);
 
   /* remove tmpfile */
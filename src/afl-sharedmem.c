@@ -365,92 +365,275 @@ u8 *afl_shm_init(sharedmem_t *shm, size_t map_size,
 
 }
 
+/* Place all AFLRun maps in one region after the header. */
+
+static size_t aflrun_shm_layout(aflrun_shm_hdr_t *hdr, reach_t num_reachables,
+                                reach_t num_freachables) {
+
+  size_t off = sizeof(aflrun_shm_hdr_t);
+  memset(hdr, 0, sizeof(*hdr));
+
+#define AFLRUN_SHM_PLACE(name, size) \
+  do { \
+\
+    off = (off + AFLRUN_SHM_ALIGN - 1) & ~(size_t)(AFLRUN_SHM_ALIGN - 1); \
+    hdr->off_##name = off; \
+    off += (size); \
+\
+  } while (0)
+
+  AFLRUN_SHM_PLACE(rbb, MAP_RBB_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(rf, MAP_RF_SIZE(num_freachables));
+  AFLRUN_SHM_PLACE(tr, MAP_TR_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(vir, MAP_TR_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(vtr, MAP_VTR_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(tt, MAP_VTR_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(div, MAP_RBB_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(db, MAP_DB_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(ic, MAP_IC_SIZE);
+  AFLRUN_SHM_PLACE(cd, MAP_CD_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(hc, MAP_HC_SIZE(num_reachables));
+  AFLRUN_SHM_PLACE(mute, MAP_RBB_SIZE(num_reachables));
+
+#undef AFLRUN_SHM_PLACE
+
+  hdr->size = off;
+  return off;
+
+}
+
+/* Ask for transparent huge pages on a large shared region; madvise succeeds
+   as long as kernel has THP, so we check if it is enabled for shared memory. */
+
+static void aflrun_shm_advise(aflrun_shm_t *shm, u8 use_huge) {
+
+#ifdef MADV_HUGEPAGE
+  if (!use_huge || shm->pages != AFLRUN_SHM_PAGES_NORMAL ||
+      madvise(shm->map, shm->map_size, MADV_HUGEPAGE))
+    return;
+
+  char buf[128];
+  int  fd = open("/sys/kernel/mm/transparent_hugepage/shmem_enabled", O_RDONLY);
+  if (fd < 0) return;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return;
+  buf[n] = 0;
+
+  if (!strstr(buf, "[never]") && !strstr(buf, "[deny]"))
+    shm->pages = AFLRUN_SHM_PAGES_THP;
+#else
+  (void)shm;
+  (void)use_huge;
+#endif
+
+}
+
+/* Write header `hdr` to zero filled region of `shm` and set up its maps. */
+
+static void aflrun_shm_place(aflrun_shm_t *shm, const aflrun_shm_hdr_t *hdr,
+  reach_t num_reachables) {
+
+  memcpy(shm->map, hdr, sizeof(*hdr));
+
+  shm->map_reachables = shm->map + hdr->off_rbb;
+  shm->map_freachables = shm->map + hdr->off_rf;
+  shm->map_ctx = shm->map + hdr->off_tr;
+  shm->map_virgin_ctx = shm->map + hdr->off_vir;
+  shm->map_new_blocks = (trace_t *)(shm->map + hdr->off_vtr);
+  shm->map_targets = (trace_t *)(shm->map + hdr->off_tt);
+  shm->div_switch = shm->map + hdr->off_div;
+  shm->map_dirty = (trace_t *)(shm->map + hdr->off_db);
+  shm->map_icalls = (aflrun_icall_t *)(shm->map + hdr->off_ic);
+  shm->map_cmp = (aflrun_cmp_map_t *)(shm->map + hdr->off_cd);
+  shm->map_hits = shm->map + hdr->off_hc;
+  shm->map_mute = shm->map + hdr->off_mute;
+
+  memset(shm->map_virgin_ctx, 255, MAP_TR_SIZE(num_reachables));
+  // Runtime resets it to 0 when attached if it supports the dirty log
+  shm->map_dirty->num = DIRTY_UNSUPPORTED;
+
+}
+
 void aflrun_shm_init(aflrun_shm_t *shm, reach_t num_reachables,
   reach_t num_freachables, unsigned char non_instrumented_mode) {
 
-  u8 *shm_rbb_str, *shm_rf_str, *shm_tr_str,
-    *shm_vir_str, *shm_vtr_str, *shm_tt_str, *shm_div_str;
-
-  shm->shm_rbb_id = shmget(IPC_PRIVATE, MAP_RBB_SIZE(num_reachables),
-    IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-  shm->shm_rf_id = shmget(IPC_PRIVATE, MAP_RF_SIZE(num_freachables),
-    IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-  shm->shm_tr_id = shmget(IPC_PRIVATE, MAP_TR_SIZE(num_reachables),
-      IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-  shm->shm_vir_id = shmget(IPC_PRIVATE, MAP_TR_SIZE(num_reachables),
-      IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-  shm->shm_vtr_id = shmget(IPC_PRIVATE, MAP_VTR_SIZE(num_reachables),
-      IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-  shm->shm_tt_id = shmget(IPC_PRIVATE, MAP_VTR_SIZE(num_reachables),
-      IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-  shm->shm_div_id = shmget(IPC_PRIVATE, MAP_RBB_SIZE(num_reachables),
-    IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
-
-  if (shm->shm_rbb_id < 0 || shm->shm_rf_id < 0 || shm->shm_tr_id < 0 ||
-    shm->shm_vir_id < 0 || shm->shm_vtr_id < 0 || shm->shm_tt_id < 0 ||
-    shm->shm_div_id < 0)
-    PFATAL("shmget() failed");
+  aflrun_shm_hdr_t hdr;
+  size_t map_size =
+    aflrun_shm_layout(&hdr, num_reachables, num_freachables);
 
-  if (!non_instrumented_mode) {
+  u8 use_huge =
+    map_size >= AFLRUN_HUGE_PAGE_SIZE && !getenv("AFLRUN_NO_HUGEPAGES");
+
+  shm->map = NULL;
+  shm->map_size = map_size;
+  shm->pages = AFLRUN_SHM_PAGES_NORMAL;
+
+#ifdef USEMMAP
+
+  snprintf(shm->g_shm_file_path, L_tmpnam, "/aflrun_%d_%ld",
+           getpid(), random());
+
+  shm->g_shm_fd = shm_open(shm->g_shm_file_path,
+                           O_RDWR | O_EXCL | O_CREAT, DEFAULT_PERMISSION);
+  if (shm->g_shm_fd == -1) {
+
+    shm->g_shm_file_path[0] = 0;
+    PFATAL("shm_open() failed");
 
-    shm_rbb_str = alloc_printf("%d", shm->shm_rbb_id);
-    shm_rf_str = alloc_printf("%d", shm->shm_rf_id);
-    shm_tr_str = alloc_printf("%d", shm->shm_tr_id);
-    shm_vir_str = alloc_printf("%d", shm->shm_vir_id);
-    shm_vtr_str = alloc_printf("%d", shm->shm_vtr_id);
-    shm_tt_str = alloc_printf("%d", shm->shm_tt_id);
-    shm_div_str = alloc_printf("%d", shm->shm_div_id);
-
-    setenv(SHM_RBB_ENV_VAR, shm_rbb_str, 1);
-    setenv(SHM_RF_ENV_VAR, shm_rf_str, 1);
-    setenv(SHM_TR_ENV_VAR, shm_tr_str, 1);
-    setenv(SHM_VIR_ENV_VAR, shm_vir_str, 1);
-    setenv(SHM_VTR_ENV_VAR, shm_vtr_str, 1);
-    setenv(SHM_TT_ENV_VAR, shm_tt_str, 1);
-    setenv(SHM_DIV_ENV_VAR, shm_div_str, 1);
-
-    ck_free(shm_rbb_str);
-    ck_free(shm_rf_str);
-    ck_free(shm_tr_str);
-    ck_free(shm_vir_str);
-    ck_free(shm_vtr_str);
-    ck_free(shm_tt_str);
-    ck_free(shm_div_str);
+  }
+
+  if (ftruncate(shm->g_shm_fd, map_size)) {
+
+    aflrun_shm_deinit(shm);
+    PFATAL("aflrun_shm_init(): ftruncate() failed");
+
+  }
+
+  shm->map = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  shm->g_shm_fd, 0);
+  if (shm->map == MAP_FAILED) {
+
+    shm->map = NULL;
+    aflrun_shm_deinit(shm);
+    PFATAL("mmap() failed");
 
   }
 
-  shm->map_reachables = shmat(shm->shm_rbb_id, NULL, 0);
-  shm->map_freachables = shmat(shm->shm_rf_id, NULL, 0);
-  shm->map_ctx = shmat(shm->shm_tr_id, NULL, 0);
-  shm->map_virgin_ctx = shmat(shm->shm_vir_id, NULL, 0);
-  shm->map_new_blocks = shmat(shm->shm_vtr_id, NULL, 0);
-  shm->map_targets = shmat(shm->shm_tt_id, NULL, 0);
-  shm->div_switch = shmat(shm->shm_div_id, NULL, 0);
+  if (!non_instrumented_mode)
+    setenv(SHM_AFLRUN_ENV_VAR, shm->g_shm_file_path, 1);
+
+#else
+
+  shm->shm_id = -1;
+
+  #ifdef SHM_HUGETLB
+  /* Fails without reserved huge pages or permission, then fall back */
+  if (use_huge) {
+
+    shm->shm_id = shmget(IPC_PRIVATE, map_size,
+                         IPC_CREAT | IPC_EXCL | SHM_HUGETLB |
+                         DEFAULT_PERMISSION);
+    if (shm->shm_id >= 0) shm->pages = AFLRUN_SHM_PAGES_HUGETLB;
+
+  }
+
+  #endif
+
+  if (shm->shm_id < 0) {
+
+    shm->shm_id = shmget(IPC_PRIVATE, map_size,
+                         IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
+
+  }
+
+  if (shm->shm_id < 0) PFATAL("shmget() failed");
+
+  if (!non_instrumented_mode) {
+
+    u8 *shm_str = alloc_printf("%d", shm->shm_id);
+    setenv(SHM_AFLRUN_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
+
+  }
 
-#define ERROR_SHM(addr) ((addr) == ((void *)-1) || !(addr))
-  if (ERROR_SHM(shm->map_reachables) || ERROR_SHM(shm->map_freachables) ||
-      ERROR_SHM(shm->map_ctx) || ERROR_SHM(shm->map_virgin_ctx) ||
-      ERROR_SHM(shm->map_new_blocks) || ERROR_SHM(shm->map_targets) ||
-      ERROR_SHM(shm->div_switch)) {
+  shm->map = shmat(shm->shm_id, NULL, 0);
+  if (shm->map == (void *)-1 || !shm->map) {
 
+    shm->map = NULL;
     aflrun_shm_deinit(shm);
     PFATAL("shmat() failed");
 
   }
-#undef ERROR_SHM
 
-  memset(shm->map_virgin_ctx, 255, MAP_TR_SIZE(num_reachables));
+#endif
+
+  aflrun_shm_advise(shm, use_huge);
+
+  /* Fresh segments are zero filled, so we only need to set the header */
+  aflrun_shm_place(shm, &hdr, num_reachables);
+
+}
+
+/* Move the AFLRun maps of `shm` into the end of `buf`, a buffer the backend
+   shares with the target instead of our SHM, i.e. the Nyx bitmap buffer. The
+   last u64 of `buf` tells the runtime where they start, see
+   __aflrun_attach_buffer(). Returns the offset of the maps, which is the size
+   left for the coverage map, or 0 if they do not fit. */
+
+size_t aflrun_shm_borrow(aflrun_shm_t *shm, u8 *buf, size_t buf_size,
+  reach_t num_reachables, reach_t num_freachables) {
+
+  aflrun_shm_hdr_t hdr;
+  size_t map_size =
+    aflrun_shm_layout(&hdr, num_reachables, num_freachables);
+
+  aflrun_shm_deinit(shm);
+  shm->map_size = map_size;
+
+  if (buf_size < map_size + sizeof(u64) + AFLRUN_NYX_ALIGN) return 0;
+
+  size_t off = (buf_size - sizeof(u64) - map_size) &
+    ~(size_t)(AFLRUN_NYX_ALIGN - 1);
+  shm->map = buf + off;
+  shm->pages = AFLRUN_SHM_PAGES_BORROWED;
+#ifdef USEMMAP
+  shm->g_shm_fd = -1;
+#else
+  shm->shm_id = -1;
+#endif
+
+  memset(shm->map, 0, map_size);
+  aflrun_shm_place(shm, &hdr, num_reachables);
+  *(u64 *)(buf + buf_size - sizeof(u64)) = off;
+
+  return off;
 
 }
 
 void aflrun_shm_deinit(aflrun_shm_t *shm) {
 
-  shmctl(shm->shm_rbb_id, IPC_RMID, NULL);
-  shmctl(shm->shm_rf_id, IPC_RMID, NULL);
-  shmctl(shm->shm_tr_id, IPC_RMID, NULL);
-  shmctl(shm->shm_vir_id, IPC_RMID, NULL);
-  shmctl(shm->shm_vtr_id, IPC_RMID, NULL);
-  shmctl(shm->shm_tt_id, IPC_RMID, NULL);
-  shmctl(shm->shm_div_id, IPC_RMID, NULL);
+  unsetenv(SHM_AFLRUN_ENV_VAR);
+
+  // The backend owns the buffer the maps were moved to
+  if (shm->pages == AFLRUN_SHM_PAGES_BORROWED) {
+
+    shm->map = NULL;
+    return;
+
+  }
+
+#ifdef USEMMAP
+  if (shm->map != NULL) {
+
+    munmap(shm->map, shm->map_size);
+    shm->map = NULL;
+
+  }
+
+  if (shm->g_shm_fd != -1) {
+
+    close(shm->g_shm_fd);
+    shm->g_shm_fd = -1;
+
+  }
+
+  if (shm->g_shm_file_path[0]) {
+
+    shm_unlink(shm->g_shm_file_path);
+    shm->g_shm_file_path[0] = 0;
+
+  }
+
+#else
+  shmctl(shm->shm_id, IPC_RMID, NULL);
+  if (shm->map != NULL) {
+
+    shmdt(shm->map);
+    shm->map = NULL;
+
+  }
+
+#endif
 
 }
\ No newline at end of file
@@ -60,6 +60,7 @@
 #endif
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 
 static char *stdin_file;               /* stdin file                        */
@@ -72,11 +73,22 @@ static u8 outfile[PATH_MAX];
 static u8 *in_data,                    /* Input data                        */
     *coverage_map;                     /* Coverage map                      */
 
-static u8 **target_coverage_maps;      /* Coverage map for each target      */
+static u64 **target_coverage_maps;     /* Bitset of covered edges for each
+target, allocated when the target is first covered                         */
 static u32* target_coverage_cnts; /* Number of covered edges of each target.
 target_coverage_cnts[t] should be number of ones of target_coverage_maps[t].*/
 static u32* target_cnts;          /* Number of seeds that cover each target */
 
+static u32 *trace_words;          /* Nonzero bitset words of current trace  */
+static u64 *trace_masks;          /* ... and their bits                     */
+static reach_t *trace_visited;    /* Targets covered by current input       */
+static u32 trace_num_visited, trace_num_words;
+static u8 *visited;               /* visited[t] is 1 if t is in trace_visited */
+
+static reach_t *trace_blocks;     /* Blocks reached, in order of first reach */
+static u32 *block_cnts;           /* Number of seeds reaching each block     */
+static u64 *block_pos;            /* Sum of their places in trace_blocks     */
+
 static u64 total;                      /* tuple content information         */
 static u32 tcnt, highest;              /* tuple content information         */
 
@@ -96,10 +108,24 @@ static bool quiet_mode,                /* Hide non-essential messages?      */
     no_classify,                       /* do not classify counts            */
     debug,                             /* debug mode                        */
     print_filenames,                   /* print the current filename        */
-    wait_for_gdb, aflrun_d;
+    wait_for_gdb, aflrun_d,
+    minimize,                          /* Minimize corpus into -o (-M)      */
+    aflrun_binary;                     /* Write target coverage in binary   */
 
 FILE* aflrun_log, *aflrun_cnt, *aflrun_tcov;
 
+static u8 *cache_dir;                  /* -k cache of traces, or NULL       */
+static u64 cache_build;                /* Key of the target build in it     */
+static u32 cache_hits;                 /* Inputs taken from the cache       */
+
+static u32 jobs = 1, job_id;           /* -j workers, and id of this one    */
+static u32 job_entry;                  /* Index of next input in dir order  */
+static FILE *job_out;                  /* Results of worker, to the parent  */
+
+/* Messages of -j workers to the parent. */
+
+enum { JOB_INPUT, JOB_SKIP, JOB_DONE };
+
 static volatile u8 stop_soon,          /* Ctrl-C pressed?                   */
     child_crashed;                     /* Child crashed?                    */
 
@@ -222,58 +248,709 @@ static void analyze_results(afl_forkserver_t *fsrv) {
 
 }
 
+/* Return bits telling which of the 8 bytes of `w` are nonzero. */
+
+static inline u64 nonzero_bytes(u64 w) {
+
+  w |= w >> 4;
+  w |= w >> 2;
+  w |= w >> 1;
+  w &= 0x0101010101010101ULL;
+  return (w * 0x0102040810204080ULL) >> 56;
+
+}
+
+/* Collect the nonzero trace words into `trace_words` and `trace_masks`,
+   where bit i of bitset word k stands for trace byte 64 * k + i. Returns
+   number of words collected. */
+
+static u32 aflrun_collect_trace(afl_forkserver_t *fsrv) {
+
+  const u64 *trace = (const u64 *)fsrv->trace_bits;
+  u32        num = 0, words = map_size >> 3;
+
+  for (u32 i = 0; i < words; i++) {
+
+    if (!trace[i]) continue;
+
+    u64 bits = nonzero_bytes(trace[i]) << ((i & 7) << 3);
+    if (num && trace_words[num - 1] == (i >> 3)) {
+
+      trace_masks[num - 1] |= bits;
+
+    } else {
+
+      trace_words[num] = i >> 3;
+      trace_masks[num++] = bits;
+
+    }
+
+  }
+
+  for (u32 i = words << 3; i < map_size; i++) {
+
+    if (!fsrv->trace_bits[i]) continue;
+
+    u64 bits = 1ULL << (i & 63);
+    if (num && trace_words[num - 1] == (i >> 6)) {
+
+      trace_masks[num - 1] |= bits;
+
+    } else {
+
+      trace_words[num] = i >> 6;
+      trace_masks[num++] = bits;
+
+    }
+
+  }
+
+  return num;
+
+}
+
+static void aflrun_write_name(FILE *f, u8 *fn) {
+
+  u32 len = strlen(fn);
+  fwrite(&len, sizeof(len), 1, f);
+  fwrite(fn, 1, len, f);
+
+}
+
+/* Merge the trace collected in `trace_visited`, `trace_words` and
+   `trace_masks` into coverage of each target, and log it if `fn` is given. */
+
+static void aflrun_merge_results(u8* fn, u32 num_visited, u32 num_words) {
+
+  for (u32 v = 0; v < num_visited; v++) {
+
+    reach_t t = trace_visited[v];
+    visited[t] = 1;
+
+    u64* map = target_coverage_maps[t];
+    if (map == NULL) {
+      map = calloc((map_size + 63) >> 6, sizeof(u64));
+      if (map == NULL)
+        FATAL("coult not grab memory");
+      target_coverage_maps[t] = map;
+    }
+
+    // Merge nonzero words of trace into bitset of each covered target
+    for (u32 i = 0; i < num_words; i++) {
+
+      u64 new_bits = trace_masks[i] & ~map[trace_words[i]];
+      if (new_bits) {
+
+        map[trace_words[i]] |= new_bits;
+        target_coverage_cnts[t] += __builtin_popcountll(new_bits);
+
+      }
+
+    }
+
+    // If a target is covered by this seed, increment its count.
+    target_cnts[t]++;
+
+  }
+
+  // If called from executing one input, we don't log
+  if (fn != NULL) {
+
+    // Record current state about number of edges for each target
+    if (aflrun_binary) {
+
+      aflrun_write_name(aflrun_tcov, fn);
+      fwrite(&num_visited, sizeof(num_visited), 1, aflrun_tcov);
+      fwrite(trace_visited, sizeof(reach_t), num_visited, aflrun_tcov);
+
+      aflrun_write_name(aflrun_log, fn);
+      fwrite(target_coverage_cnts, sizeof(u32), fsrv->num_targets,
+        aflrun_log);
+
+    } else {
+
+      fprintf(aflrun_tcov, "%s\n", fn);
+      for (reach_t t = 0; t < fsrv->num_targets; t++)
+        fprintf(aflrun_tcov, "%u ", visited[t]);
+      fprintf(aflrun_tcov, "\n");
+
+      fprintf(aflrun_log, "%s\n", fn);
+      for (reach_t t = 0; t < fsrv->num_targets; t++) {
+        fprintf(aflrun_log, "%u", target_coverage_cnts[t]);
+        if (t != fsrv->num_targets - 1)
+          fprintf(aflrun_log, ",");
+      }
+      fprintf(aflrun_log, "\n");
+
+    }
+
+  }
+
+  // Only reset what this input has set
+  for (u32 i = 0; i < num_visited; i++)
+    visited[trace_visited[i]] = 0;
+
+}
+
+/* Put the reachable blocks of the last run into trace_blocks, in order of
+   first reach if the runtime logs it, and return their number. */
+
+static u32 aflrun_collect_blocks(afl_forkserver_t *fsrv) {
+
+  const trace_t *dirty = fsrv->trace_dirty;
+  u32            n = 0;
+
+  if (dirty->num <= fsrv->num_reachables) {
+
+    for (; n < dirty->num; n++)
+      trace_blocks[n] = dirty->trace[n].block;
+
+  } else {
+
+    for (reach_t b = 0; b < fsrv->num_reachables; b++)
+      if (IS_SET(fsrv->trace_reachables, b)) trace_blocks[n++] = b;
+
+  }
+
+  return n;
+
+}
+
 static void aflrun_analyze_results(afl_forkserver_t *fsrv, u8* fn) {
 
+  // Seeds reaching each block for the order of aflrun_write_order()
+  u32 num_blocks = aflrun_collect_blocks(fsrv);
+  for (u32 i = 0; i < num_blocks; i++) {
+
+    block_cnts[trace_blocks[i]]++;
+    block_pos[trace_blocks[i]] += i;
+
+  }
+
   const ctx_t* beg = fsrv->trace_targets->trace;
   const ctx_t* end = beg + fsrv->trace_targets->num;
-  u8* visited = calloc(fsrv->num_targets, sizeof(u8));
+  u32 num_visited = 0, num_words = 0;
 
-  // Iterate each target it covers
+  // Collect each target it covers
   for (const ctx_t* it = beg; it < end; it++) {
 
     reach_t t = it->block;
 
     if (visited[t]) continue;
     visited[t] = 1;
+    trace_visited[num_visited++] = t;
+
+  }
+
+  for (u32 i = 0; i < num_visited; i++)
+    visited[trace_visited[i]] = 0;
+
+  // Trace is only scanned if some target is covered
+  if (num_visited) num_words = aflrun_collect_trace(fsrv);
+
+  trace_num_visited = num_visited;
+  trace_num_words = num_words;
+
+  // Workers of -j leave merging to the parent, see job_send_input()
+  if (job_out == NULL) aflrun_merge_results(fn, num_visited, num_words);
+
+}
+
+static void aflrun_write_cnt(afl_forkserver_t *fsrv) {
+
+  if (aflrun_binary) {
+    fwrite(target_cnts, sizeof(u32), fsrv->num_targets, aflrun_cnt);
+    return;
+  }
+
+  for (reach_t t = 0; t < fsrv->num_targets; ++t) {
+    fprintf(aflrun_cnt, "%u ", target_cnts[t]);
+  }
+  fprintf(aflrun_cnt, "\n");
+
+}
+
+/* Write names of the non-target reachable blocks that seeds reached into
+   order.txt, those reached by most seeds first, and of these, those reached
+   earliest in their runs first, so that blocks that run together are next to
+   each other. Given to the pass as AFLRUN_BB_ORDER, it gives them close
+   indices, and so close bits and bytes in the AFLRun maps. */
+
+static const u32 *order_cnts;
+static const u64 *order_pos;
+
+static int aflrun_cmp_order(const void *a, const void *b) {
+
+  reach_t x = *(const reach_t *)a, y = *(const reach_t *)b;
+  if (order_cnts[x] != order_cnts[y])
+    return order_cnts[x] > order_cnts[y] ? -1 : 1;
+
+  // Compare mean places without division
+  u64 px = order_pos[x] * order_cnts[y], py = order_pos[y] * order_cnts[x];
+  if (px != py) return px < py ? -1 : 1;
+  return x < y ? -1 : x > y;
+
+}
+
+static void aflrun_write_order(const char *dir, const char *prefix) {
+
+  u8 *in_file = alloc_printf("%s/BBreachable.txt", dir);
+  u8 *out_file = prefix ? alloc_printf("%s/%s.order.txt", dir, prefix)
+                        : alloc_printf("%s/order.txt", dir);
+  FILE *in = fopen(in_file, "r");
+  if (in == NULL) FATAL("Open %s failed", in_file);
+  FILE *out = fopen(out_file, "w");
+  if (out == NULL) FATAL("Open %s failed", out_file);
+
+  // Names are the lines of BBreachable.txt after the header, up to ','
+  char   **names = calloc(fsrv->num_reachables, sizeof(char *));
+  char    *line = NULL;
+  size_t   line_size = 0;
+  reach_t  n = 0, num_reached = 0;
+  if (names == NULL || getline(&line, &line_size, in) < 0)
+    FATAL("Read %s failed", in_file);
+  while (n < fsrv->num_reachables && getline(&line, &line_size, in) > 0) {
+
+    line[strcspn(line, ",|\n")] = 0;
+    names[n++] = strdup(line);
 
-    u8* map = target_coverage_maps[t];
+  }
+
+  for (reach_t b = fsrv->num_targets; b < n; b++)
+    if (block_cnts[b]) trace_blocks[num_reached++] = b;
+
+  order_cnts = block_cnts;
+  order_pos = block_pos;
+  qsort(trace_blocks, num_reached, sizeof(reach_t), aflrun_cmp_order);
+  for (reach_t i = 0; i < num_reached; i++)
+    fprintf(out, "%s\n", names[trace_blocks[i]]);
+
+  for (reach_t b = 0; b < n; b++)
+    free(names[b]);
+  free(names);
+  free(line);
+  fclose(in);
+  if (fclose(out)) PFATAL("Write %s failed", out_file);
+  ck_free(in_file);
+  ck_free(out_file);
+
+}
+
+static void aflrun_open_results(const char* dir, const char* prefix) {
+
+  const char* ext = aflrun_binary ? "bin" : "txt";
+  u8* log_file; u8* cnt_file; u8* tcov_file;
+  if (prefix) {
+    log_file = alloc_printf("%s/%s.log.%s", dir, prefix, ext);
+    cnt_file = alloc_printf("%s/%s.cnt.%s", dir, prefix, ext);
+    tcov_file = alloc_printf("%s/%s.tcov.%s", dir, prefix, ext);
+  } else {
+    log_file = alloc_printf("%s/log.%s", dir, ext);
+    cnt_file = alloc_printf("%s/cnt.%s", dir, ext);
+    tcov_file = alloc_printf("%s/tcov.%s", dir, ext);
+  }
+  aflrun_log = fopen(log_file, "w");
+  if (aflrun_log == NULL)
+    FATAL("Open %s failed", log_file);
+  aflrun_cnt = fopen(cnt_file, "w");
+  if (aflrun_cnt == NULL)
+    FATAL("Open %s failed", cnt_file);
+  aflrun_tcov = fopen(tcov_file, "w");
+  if (aflrun_tcov == NULL)
+    FATAL("Open %s failed", tcov_file);
+  ck_free(tcov_file);
+  ck_free(log_file);
+  ck_free(cnt_file);
+
+  if (aflrun_binary) {
+    u32 num_targets = fsrv->num_targets;
+    fwrite(&num_targets, sizeof(u32), 1, aflrun_log);
+    fwrite(&num_targets, sizeof(u32), 1, aflrun_cnt);
+    fwrite(&num_targets, sizeof(u32), 1, aflrun_tcov);
+  }
+
+}
+
+static void aflrun_alloc(void) {
+
+  // Coverage bitset of each target is allocated when it is first covered
+  target_coverage_maps = (u64**)calloc(fsrv->num_targets, sizeof(u64*));
+  target_coverage_cnts = calloc(fsrv->num_targets, sizeof(u32));
+  target_cnts = calloc(fsrv->num_targets, sizeof(u32));
+  visited = calloc(fsrv->num_targets, sizeof(u8));
+  trace_visited = calloc(fsrv->num_targets, sizeof(reach_t));
+  trace_words = calloc((map_size + 63) >> 6, sizeof(u32));
+  trace_masks = calloc((map_size + 63) >> 6, sizeof(u64));
+  trace_blocks = calloc(fsrv->num_reachables, sizeof(reach_t));
+  block_cnts = calloc(fsrv->num_reachables, sizeof(u32));
+  block_pos = calloc(fsrv->num_reachables, sizeof(u64));
+  if (!target_coverage_maps || !target_coverage_cnts || !target_cnts ||
+      !visited || !trace_visited || !trace_words || !trace_masks ||
+      !trace_blocks || !block_cnts || !block_pos)
+    FATAL("coult not grab memory");
+
+}
+
+/* Corpus minimization of -M, the way afl-cmin does it: the smallest input
+   having a key is the best one of the key, and going from rare keys to
+   frequent ones, the best input of each key not yet kept is kept along with
+   all its keys. Keys are edge tuples and, with -d, reached (block, ctx)
+   pairs and edges seen together with each covered target.
+
+   Inputs are added one by one, and keys of an input are only kept while it
+   is the best one of some key, so memory grows with the minimized corpus
+   rather than with the whole one. */
+
+#define CMIN_NONE 0xffffffffU
+#define CMIN_KEY_EDGE(i, v) (((u64)(i) << 8) | (v))
+#define CMIN_KEY_CTX(idx) ((1ULL << 62) | (u64)(idx))
+#define CMIN_KEY_TARGET(t, i) ((2ULL << 62) | ((u64)(t) * map_size + (i)))
+
+typedef struct cmin_input {
+
+  u8  *name;                           /* Path, while it is best of a key   */
+  u64  size;
+  u32  refs;                           /* Number of keys it is best of      */
+  u32  num_keys;
+  u32 *keys;                           /* Slots of its keys, while refs > 0 */
+
+} cmin_input_t;
+
+static cmin_input_t *cmin_inputs;
+static u32           cmin_num_inputs, cmin_inputs_size;
+
+static u64 *cmin_table;                /* Hash table of key + 1, 0 if empty */
+static u32 *cmin_table_slots;          /* ... and slots of its keys         */
+static u32  cmin_table_bits;
+
+static u32 *cmin_counts;               /* Inputs having key of each slot    */
+static u32 *cmin_best;                 /* Best input of each slot           */
+static u32  cmin_num_slots, cmin_counts_size, cmin_best_size;
+
+static u64 *cmin_keys;                 /* Keys of current input             */
+static u32  cmin_num_keys, cmin_keys_size;
+static u32 *cmin_edges;                /* Nonzero edges of current input    */
+
+/* Grow `*ptr` of `*size` elements of `elem` bytes to hold `need` ones. */
+
+static void cmin_grow(void **ptr, u32 *size, u32 need, size_t elem) {
+
+  if (need <= *size) return;
+
+  u32 new_size = *size ? *size : 1024;
+  while (new_size < need)
+    new_size *= 2;
+
+  void *p = realloc(*ptr, (size_t)new_size * elem);
+  if (p == NULL) FATAL("coult not grab memory");
+  *ptr = p;
+  *size = new_size;
+
+}
+
+static inline u32 cmin_hash(u64 key, u32 bits) {
+
+  return (key * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+
+}
+
+static void cmin_rehash(void) {
+
+  u64 *old_table = cmin_table;
+  u32 *old_slots = cmin_table_slots;
+  u32  old_size = cmin_table_bits ? 1U << cmin_table_bits : 0;
+
+  cmin_table_bits = cmin_table_bits ? cmin_table_bits + 1 : 16;
+  cmin_table = calloc(1U << cmin_table_bits, sizeof(u64));
+  cmin_table_slots = malloc((1U << cmin_table_bits) * sizeof(u32));
+  if (cmin_table == NULL || cmin_table_slots == NULL)
+    FATAL("coult not grab memory");
+
+  u32 mask = (1U << cmin_table_bits) - 1;
+  for (u32 i = 0; i < old_size; i++) {
+
+    if (!old_table[i]) continue;
+
+    u32 h = cmin_hash(old_table[i] - 1, cmin_table_bits);
+    while (cmin_table[h])
+      h = (h + 1) & mask;
+    cmin_table[h] = old_table[i];
+    cmin_table_slots[h] = old_slots[i];
+
+  }
+
+  free(old_table);
+  free(old_slots);
+
+}
+
+/* Return slot of `key`, adding it if it is new. */
+
+static u32 cmin_slot(u64 key) {
+
+  // Keep the table at most half full
+  if (2 * (cmin_num_slots + 1) > (cmin_table_bits ? 1U << cmin_table_bits : 0))
+    cmin_rehash();
+
+  u32 mask = (1U << cmin_table_bits) - 1;
+  u32 h = cmin_hash(key, cmin_table_bits);
+  while (cmin_table[h]) {
+
+    if (cmin_table[h] == key + 1) return cmin_table_slots[h];
+    h = (h + 1) & mask;
+
+  }
+
+  u32 slot = cmin_num_slots++;
+  cmin_grow((void **)&cmin_counts, &cmin_counts_size, cmin_num_slots,
+            sizeof(u32));
+  cmin_grow((void **)&cmin_best, &cmin_best_size, cmin_num_slots,
+            sizeof(u32));
+  cmin_counts[slot] = 0;
+  cmin_best[slot] = CMIN_NONE;
+
+  cmin_table[h] = key + 1;
+  cmin_table_slots[h] = slot;
+  return slot;
+
+}
+
+static void cmin_drop(u32 idx) {
+
+  cmin_input_t *in = &cmin_inputs[idx];
+  free(in->keys);
+  free(in->name);
+  in->keys = NULL;
+  in->name = NULL;
+
+}
+
+/* Add input `fn` of `size` bytes having `num_keys` distinct `keys`. */
+
+static void cmin_add_input(u8 *fn, u64 size, const u64 *keys, u32 num_keys) {
+
+  u32 idx = cmin_num_inputs++;
+  cmin_grow((void **)&cmin_inputs, &cmin_inputs_size, cmin_num_inputs,
+            sizeof(cmin_input_t));
+
+  cmin_input_t *in = &cmin_inputs[idx];
+  memset(in, 0, sizeof(*in));
+  in->size = size;
+  if (!num_keys) return;
+
+  u32 *slots = malloc(num_keys * sizeof(u32));
+  if (slots == NULL) FATAL("coult not grab memory");
+
+  for (u32 i = 0; i < num_keys; i++) {
+
+    u32 slot = cmin_slot(keys[i]);
+    u32 best = cmin_best[slot];
+    slots[i] = slot;
+    cmin_counts[slot]++;
+
+    // Like afl-cmin, the last one in order of names wins a tie
+    if (best == CMIN_NONE || size <= cmin_inputs[best].size) {
+
+      if (best != CMIN_NONE && !--cmin_inputs[best].refs) cmin_drop(best);
+      cmin_best[slot] = idx;
+      in->refs++;
+
+    }
+
+  }
+
+  if (in->refs) {
+
+    in->keys = slots;
+    in->num_keys = num_keys;
+    in->name = strdup(fn);
+    if (in->name == NULL) FATAL("coult not grab memory");
+
+  } else {
+
+    free(slots);
+
+  }
+
+}
+
+/* True if the last run does not count for afl-cmin, see afl-cmin -A, -C. */
+
+static u8 cmin_rejects_run(afl_forkserver_t *fsrv) {
+
+  u8 cco = !!getenv("AFL_CMIN_CRASHES_ONLY"),
+     caa = !!getenv("AFL_CMIN_ALLOW_ANY");
+
+  return fsrv->last_run_timed_out || (!caa && child_crashed != cco);
+
+}
+
+static void cmin_push_key(u64 key) {
+
+  cmin_grow((void **)&cmin_keys, &cmin_keys_size, cmin_num_keys + 1,
+            sizeof(u64));
+  cmin_keys[cmin_num_keys++] = key;
+
+}
+
+/* Collect keys of the last run into `cmin_keys`, after
+   aflrun_analyze_results() if -d is given. */
+
+static void cmin_analyze_results(afl_forkserver_t *fsrv, u8 *fn, u64 size) {
+
+  u32 num_edges = 0;
+  cmin_num_keys = 0;
+
+  if (!cmin_rejects_run(fsrv)) {
 
-    // Iterate each map corresponding to each covered target
     for (u32 i = 0; i < map_size; i++) {
 
-      if (fsrv->trace_bits[i] && !map[i]) {
+      if (!fsrv->trace_bits[i]) continue;
+      cmin_edges[num_edges++] = i;
+      cmin_push_key(CMIN_KEY_EDGE(i, fsrv->trace_bits[i]));
+
+    }
+
+  }
+
+  if (aflrun_d && num_edges) {
+
+    // Blocks reached in context, from the dirty log if the runtime has one
+    trace_t *dirty = fsrv->trace_dirty;
+    u8       all_blocks = dirty->num > fsrv->num_reachables;
+    size_t   n = all_blocks ? fsrv->num_reachables : dirty->num;
+    for (size_t i = 0; i < n; i++) {
+
+      reach_t block = all_blocks ? (reach_t)i : dirty->trace[i].block;
+      const u8 *cur = fsrv->trace_ctx + CTX_NUM_BYTES * block;
+      for (u32 j = 0; j < CTX_NUM_BYTES; j++) {
 
-        map[i] = 1;
-        target_coverage_cnts[t]++;
+        for (u8 b = cur[j]; b; b &= b - 1)
+          cmin_push_key(CMIN_KEY_CTX(CTX_IDX(block, j * 8 + __builtin_ctz(b))));
 
       }
 
     }
 
-    // If a target is covered by this seed, increment its count.
-    target_cnts[t]++;
+    for (u32 v = 0; v < trace_num_visited; v++) {
+
+      for (u32 i = 0; i < num_edges; i++)
+        cmin_push_key(CMIN_KEY_TARGET(trace_visited[v], cmin_edges[i]));
+
+    }
 
   }
 
-  // If called from executing one input, we don't log
-  if (fn == NULL)
-    return;
-  // Record current state about number of edges for each target
+  if (job_out == NULL) cmin_add_input(fn, size, cmin_keys, cmin_num_keys);
+
+}
+
+static int cmin_cmp_slots(const void *a, const void *b) {
+
+  u32 x = *(const u32 *)a, y = *(const u32 *)b;
+  if (cmin_counts[x] != cmin_counts[y])
+    return cmin_counts[x] < cmin_counts[y] ? -1 : 1;
+  return x < y ? -1 : x > y;
+
+}
+
+static void cmin_link_or_copy(u8 *old_path, u8 *new_path) {
+
+  s32 i = link(old_path, new_path);
+  s32 sfd, dfd;
+  u8 *tmp;
 
-  fprintf(aflrun_tcov, "%s\n", fn);
-  for (reach_t t = 0; t < fsrv->num_targets; t++)
-    fprintf(aflrun_tcov, "%u ", visited[t]);
-  fprintf(aflrun_tcov, "\n");
+  if (!i) { return; }
 
-  free(visited);
+  sfd = open(old_path, O_RDONLY);
+  if (sfd < 0) { PFATAL("Unable to open '%s'", old_path); }
+
+  dfd = open(new_path, O_WRONLY | O_CREAT | O_EXCL, DEFAULT_PERMISSION);
+  if (dfd < 0) { PFATAL("Unable to create '%s'", new_path); }
+
+  tmp = ck_alloc(64 * 1024);
+
+  while ((i = read(sfd, tmp, 64 * 1024)) > 0) {
+
+    ck_write(dfd, tmp, i, new_path);
+
+  }
+
+  if (i < 0) { PFATAL("read() failed"); }
+
+  ck_free(tmp);
+  close(sfd);
+  close(dfd);
+
+}
+
+/* Keep the best inputs of keys from rare to frequent, into -o. */
+
+static void cmin_finish(void) {
+
+  u32 *order = malloc((cmin_num_slots + 1) * sizeof(u32));
+  u8  *known = calloc(cmin_num_slots + 1, 1);
+  u32  num_kept = 0;
+  if (order == NULL || known == NULL) FATAL("coult not grab memory");
+
+  for (u32 i = 0; i < cmin_num_slots; i++)
+    order[i] = i;
+  qsort(order, cmin_num_slots, sizeof(u32), cmin_cmp_slots);
+
+  for (u32 i = 0; i < cmin_num_slots; i++) {
+
+    if (known[order[i]]) continue;
+
+    cmin_input_t *in = &cmin_inputs[cmin_best[order[i]]];
+    for (u32 k = 0; k < in->num_keys; k++)
+      known[in->keys[k]] = 1;
+
+    u8 *name = strrchr(in->name, '/');
+    u8 *dst = alloc_printf("%s/%s", out_file, name ? name + 1 : in->name);
+    cmin_link_or_copy(in->name, dst);
+    ck_free(dst);
+    num_kept++;
+
+  }
+
+  if (!quiet_mode)
+    OKF("Narrowed down %u inputs with %u keys to %u, saved in '%s'.",
+        cmin_num_inputs, cmin_num_slots, num_kept, out_file);
+
+  free(order);
+  free(known);
+
+}
+
+/* Send the results of an input of a -j worker, which the parent merges in
+   order of inputs. */
+
+static void job_send_input(u8 *fn, u64 size) {
+
+  u32 tag = JOB_INPUT, len = strlen(fn);
+  job_send(job_out, job_id, &tag, sizeof(u32), 1);
+  job_send(job_out, job_id, &len, sizeof(u32), 1);
+  job_send(job_out, job_id, fn, 1, len);
+
+  if (aflrun_d) {
+
+    job_send(job_out, job_id, &trace_num_visited, sizeof(u32), 1);
+    job_send(job_out, job_id, trace_visited, sizeof(reach_t),
+             trace_num_visited);
+    job_send(job_out, job_id, &trace_num_words, sizeof(u32), 1);
+    job_send(job_out, job_id, trace_words, sizeof(u32), trace_num_words);
+    job_send(job_out, job_id, trace_masks, sizeof(u64), trace_num_words);
+
+  }
+
+  if (minimize) {
+
+    job_send(job_out, job_id, &size, sizeof(u64), 1);
+    job_send(job_out, job_id, &cmin_num_keys, sizeof(u32), 1);
+    job_send(job_out, job_id, cmin_keys, sizeof(u64), cmin_num_keys);
 
-  fprintf(aflrun_log, "%s\n", fn);
-  for (reach_t t = 0; t < fsrv->num_targets; t++) {
-    fprintf(aflrun_log, "%u", target_coverage_cnts[t]);
-    if (t != fsrv->num_targets - 1)
-      fprintf(aflrun_log, ",");
   }
-  fprintf(aflrun_log, "\n");
+
 }
 
 /* Write results. */
@@ -283,17 +960,13 @@ static u32 write_results_to_file(afl_forkserver_t *fsrv, u8 *outfile) {
   s32 fd;
   u32 i, ret = 0;
 
-  u8 cco = !!getenv("AFL_CMIN_CRASHES_ONLY"),
-     caa = !!getenv("AFL_CMIN_ALLOW_ANY");
-
   if (!outfile || !*outfile) {
 
     FATAL("Output filename not set (Bug in AFL++?)");
 
   }
 
-  if (cmin_mode &&
-      (fsrv->last_run_timed_out || (!caa && child_crashed != cco))) {
+  if (cmin_mode && cmin_rejects_run(fsrv)) {
 
     if (strcmp(outfile, "-")) {
 
@@ -371,6 +1044,181 @@ static u32 write_results_to_file(afl_forkserver_t *fsrv, u8 *outfile) {
 
 }
 
+/* With -k, the trace of each input is kept in the cache directory under the
+   key of the target build and a hash of the input, so that later runs over
+   the same corpus only execute inputs that are new or whose target changed.
+   An entry holds the run status, the targets and blocks reached with -d,
+   and the nonzero bytes of the classified trace, which is all afl-showmap
+   looks at after a run outside of -M. */
+
+#define CACHE_MAGIC 0x4b43534eU
+
+enum { CACHE_COVERAGE = 1, CACHE_CRASHED = 2, CACHE_TIMED_OUT = 4 };
+
+/* Key of the target build: a hash of the binary, and of the options that
+   change what its trace looks like. */
+
+static void cache_init(afl_forkserver_t *fsrv) {
+
+  struct stat st;
+  s32         fd = open(fsrv->target_path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st)) {
+
+    PFATAL("Unable to open '%s'", fsrv->target_path);
+
+  }
+
+  u8 *bin = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (bin == MAP_FAILED) { PFATAL("Unable to mmap '%s'", fsrv->target_path); }
+  close(fd);
+
+  u64 opts = (u64)edges_only | (u64)raw_instr_output << 1 |
+             (u64)no_classify << 2 | (u64)collect_coverage << 3 |
+             (u64)aflrun_d << 4 | (u64)fsrv->num_targets << 32;
+  cache_build = hash64(bin, st.st_size, HASH_CONST ^ opts);
+  munmap(bin, st.st_size);
+
+  if (mkdir(cache_dir, 0700) && errno != EEXIST) {
+
+    PFATAL("Unable to create '%s'", cache_dir);
+
+  }
+
+  u8 *dn = alloc_printf("%s/%016llx", cache_dir, cache_build);
+  if (mkdir(dn, 0700) && errno != EEXIST) { PFATAL("Unable to create '%s'", dn); }
+  ck_free(dn);
+
+}
+
+static u8 *cache_path(u8 *mem, u32 len) {
+
+  return alloc_printf("%s/%016llx/%016llx", cache_dir, cache_build,
+                      hash64(mem, len, cache_build));
+
+}
+
+/* Restore the trace of `mem` from the cache as if the target had just run
+   it. Returns 0 if it is not there, or if the entry is unusable. */
+
+static u8 cache_load(afl_forkserver_t *fsrv, u8 *mem, u32 len) {
+
+  u8   *fn = cache_path(mem, len);
+  FILE *f = fopen(fn, "r");
+  ck_free(fn);
+  if (!f) { return 0; }
+
+  u32 magic, num_targets, num_blocks, num_bytes, idx;
+  u8  flags, val, ok = 0;
+
+  memset(fsrv->trace_bits, 0, map_size);
+  if (fread(&magic, sizeof(u32), 1, f) != 1 || magic != CACHE_MAGIC ||
+      fread(&flags, 1, 1, f) != 1 ||
+      fread(&num_targets, sizeof(u32), 1, f) != 1 ||
+      (num_targets &&
+       (!aflrun_d || num_targets > MAP_VTR_CAP(fsrv->num_reachables))))
+    goto done;
+
+  for (u32 i = 0; i < num_targets; i++) {
+
+    ctx_t *e = fsrv->trace_targets->trace + i;
+    if (fread(e, sizeof(ctx_t), 1, f) != 1 || e->block >= fsrv->num_targets)
+      goto done;
+
+  }
+
+  if (fread(&num_blocks, sizeof(u32), 1, f) != 1 ||
+      (num_blocks && (!aflrun_d || num_blocks > fsrv->num_reachables)))
+    goto done;
+
+  // Blocks go to the dirty log, as if the runtime had logged them
+  for (u32 i = 0; i < num_blocks; i++) {
+
+    reach_t *b = &fsrv->trace_dirty->trace[i].block;
+    if (fread(b, sizeof(reach_t), 1, f) != 1 || *b >= fsrv->num_reachables)
+      goto done;
+
+  }
+
+  if (fread(&num_bytes, sizeof(u32), 1, f) != 1 || num_bytes > map_size)
+    goto done;
+
+  for (u32 i = 0; i < num_bytes; i++) {
+
+    if (fread(&idx, sizeof(u32), 1, f) != 1 || fread(&val, 1, 1, f) != 1 ||
+        idx >= map_size)
+      goto done;
+    fsrv->trace_bits[idx] = val;
+
+  }
+
+  if (aflrun_d) {
+
+    fsrv->trace_targets->num = num_targets;
+    fsrv->trace_dirty->num = num_blocks;
+
+  }
+
+  have_coverage = !!(flags & CACHE_COVERAGE);
+  child_crashed = !!(flags & CACHE_CRASHED);
+  fsrv->last_run_timed_out = !!(flags & CACHE_TIMED_OUT);
+  ++fsrv->total_execs;
+  ++cache_hits;
+  ok = 1;
+
+done:
+  fclose(f);
+  return ok;
+
+}
+
+/* Store the trace of the run of `mem`, through a temporary file so that -j
+   workers and concurrent runs never see a partial entry. */
+
+static void cache_store(afl_forkserver_t *fsrv, u8 *mem, u32 len) {
+
+  u8   *fn = cache_path(mem, len);
+  u8   *tmp = alloc_printf("%s.%d", fn, (int)getpid());
+  FILE *f = fopen(tmp, "w");
+  if (!f) { PFATAL("Unable to create '%s'", tmp); }
+
+  u32 magic = CACHE_MAGIC, num_targets = 0, num_blocks = 0, num_bytes = 0;
+  u8  flags = (have_coverage ? CACHE_COVERAGE : 0) |
+             (child_crashed ? CACHE_CRASHED : 0) |
+             (fsrv->last_run_timed_out ? CACHE_TIMED_OUT : 0);
+
+  if (aflrun_d) {
+
+    num_targets =
+        MIN(fsrv->trace_targets->num, MAP_VTR_CAP(fsrv->num_reachables));
+    num_blocks = aflrun_collect_blocks(fsrv);
+
+  }
+
+  for (u32 i = 0; i < map_size; i++)
+    num_bytes += !!fsrv->trace_bits[i];
+
+  fwrite(&magic, sizeof(u32), 1, f);
+  fwrite(&flags, 1, 1, f);
+  fwrite(&num_targets, sizeof(u32), 1, f);
+  if (num_targets)
+    fwrite(fsrv->trace_targets->trace, sizeof(ctx_t), num_targets, f);
+  fwrite(&num_blocks, sizeof(u32), 1, f);
+  if (num_blocks) fwrite(trace_blocks, sizeof(reach_t), num_blocks, f);
+  fwrite(&num_bytes, sizeof(u32), 1, f);
+  for (u32 i = 0; i < map_size; i++) {
+
+    if (!fsrv->trace_bits[i]) continue;
+    fwrite(&i, sizeof(u32), 1, f);
+    fwrite(&fsrv->trace_bits[i], 1, 1, f);
+
+  }
+
+  if (fclose(f) || rename(tmp, fn)) { PFATAL("Unable to write '%s'", fn); }
+  ck_free(tmp);
+  ck_free(fn);
+
+}
+
 /* Execute target application. */
 
 static void showmap_run_target_forkserver(afl_forkserver_t *fsrv, u8 *mem,
@@ -828,6 +1676,15 @@ u32 execute_testcases(u8 *dir) {
     if (aflrun_d && strncmp(nl[i]->d_name, "id:", 3))
       continue;
 
+    // With -j, worker k takes every k-th input in directory order
+    if (job_out && job_entry++ % jobs != job_id) {
+
+      free(nl[i]);
+      ck_free(fn2);
+      continue;
+
+    }
+
     if (st.st_size > MAX_FILE && !be_quiet && !quiet_mode) {
 
       WARNF("Test case '%s' is too big (%s, limit is %s), partial reading", fn2,
@@ -851,7 +1708,13 @@ u32 execute_testcases(u8 *dir) {
 
       }
 
-      showmap_run_target_forkserver(fsrv, in_data, in_len);
+      if (!cache_dir || !cache_load(fsrv, in_data, in_len)) {
+
+        showmap_run_target_forkserver(fsrv, in_data, in_len);
+        if (cache_dir) { cache_store(fsrv, in_data, in_len); }
+
+      }
+
       ck_free(in_data);
       ++done;
 
@@ -859,12 +1722,23 @@ u32 execute_testcases(u8 *dir) {
 
       if (collect_coverage)
         analyze_results(fsrv);
-      else
+      else if (!minimize)
         tcnt = write_results_to_file(fsrv, outfile);
 
       if (aflrun_d)
         aflrun_analyze_results(fsrv, fn2);
 
+      if (minimize)
+        cmin_analyze_results(fsrv, fn2, st.st_size);
+
+      if (job_out && (aflrun_d || minimize))
+        job_send_input(fn2, st.st_size);
+
+    } else if (job_out && (aflrun_d || minimize)) {
+
+      u32 tag = JOB_SKIP;
+      job_send(job_out, job_id, &tag, sizeof(u32), 1);
+
     }
 
   }
@@ -923,7 +1797,14 @@ static void usage(u8 *argv0) {
       "  -r         - show real tuple values instead of AFL filter values\n"
       "  -s         - do not classify the map\n"
       "  -c         - allow core dumps\n"
-      "  -d         - get target coverage, may need AFL_DRIVER_DONT_DEFER=1\n\n"
+      "  -d         - get target coverage, may need AFL_DRIVER_DONT_DEFER=1\n"
+      "  -B         - with -d, write target coverage in binary format\n"
+      "  -j num     - with -i, run inputs on num forkservers in parallel\n"
+      "  -M         - with -i, copy a minimal set of inputs to the -o directory,\n"
+      "               keeping edge tuples and, with -d, reached (block, ctx)\n"
+      "               pairs and edges of each covered target like afl-cmin\n"
+      "  -k dir     - with -i, keep the trace of each input in dir, keyed by\n"
+      "               target binary and input, and only run inputs not there\n\n"
 
       "This tool displays raw tuple data captured by AFL instrumentation.\n"
       "For additional help, consult %s/README.md.\n\n"
@@ -960,28 +1841,215 @@ static void usage(u8 *argv0) {
 
 }
 
-static void load_aflrun_header(
-  u8* file, reach_t* num_targets, reach_t* num_reachables) {
-  FILE* fd = fopen(file, "r");
-  if (fd == NULL)
-    FATAL("Failed to open %s", file);
-  char* line = NULL; size_t len = 0;
-  ssize_t res = getline(&line, &len, fd);
-  if (res == -1 || line == NULL)
-    FATAL("Failed to read %s", file);
-
-  char* endptr;
-  *num_targets = strtoul(line, &endptr, 10);
-  if (*endptr != ',')
-    FATAL("Wrong format for %s", file);
-  *endptr = 0;
-  *num_reachables = strtoul(endptr + 1, &endptr, 10);
-  if (*endptr != 0 && *endptr != '\n')
-    FATAL("Wrong format for %s", file);
-  if (*num_targets == 0 || *num_targets > *num_reachables)
-    FATAL("Wrong number of targets and reachables");
-  ck_free(file);
-  free(line);
+/* Send what the parent needs of a -j worker once it is done with its
+   inputs, and exit. */
+
+static void showmap_job_done(u32 done) {
+
+  u32 tag = JOB_DONE;
+  u8  cov = have_coverage;
+  job_send(job_out, job_id, &tag, sizeof(u32), 1);
+  job_send(job_out, job_id, &done, sizeof(u32), 1);
+  job_send(job_out, job_id, &fsrv->total_execs, sizeof(u64), 1);
+  job_send(job_out, job_id, &total, sizeof(u64), 1);
+  job_send(job_out, job_id, &highest, sizeof(u32), 1);
+  job_send(job_out, job_id, &cov, sizeof(u8), 1);
+  job_send(job_out, job_id, &cache_hits, sizeof(u32), 1);
+  if (aflrun_d) {
+
+    job_send(job_out, job_id, block_cnts, sizeof(u32), fsrv->num_reachables);
+    job_send(job_out, job_id, block_pos, sizeof(u64), fsrv->num_reachables);
+
+  }
+
+  if (collect_coverage) job_send(job_out, job_id, coverage_map, 1, map_size);
+  if (fclose(job_out)) { PFATAL("Unable to send results of worker %u", job_id); }
+  exit(0);
+
+}
+
+/* Fork -j workers, each of which returns from here to run every jobs-th
+   input of the directory with its own forkserver and shared memory. The
+   parent merges their results in order of inputs, so they are the same as
+   without -j, and exits. */
+
+static void showmap_run_jobs(const char* aflrun_dir, const char* prefix) {
+
+  pid_t *pids;
+  FILE **in = fork_jobs(jobs, &job_id, &job_out, &pids);
+  if (!in) {
+
+    if (job_id) { be_quiet = true; }
+    return;
+
+  }
+
+  u32 *sizes = ck_alloc(jobs * sizeof(u32));
+  u32  w, tag, len, num_visited, num_words, done = 0;
+
+  // Workers first tell the map size of the target
+  map_size = 0;
+  for (w = 0; w < jobs; w++) {
+
+    job_recv(in[w], w, &sizes[w], sizeof(u32), 1);
+    if (sizes[w] > map_size) map_size = sizes[w];
+
+  }
+
+  if (aflrun_d) {
+    aflrun_open_results(aflrun_dir, prefix);
+    aflrun_alloc();
+  }
+
+  u8  *cov = NULL;
+  u32 *w_cnts = NULL;
+  u64 *w_pos = NULL;
+  u32  fn_size = PATH_MAX;
+  u8  *fn = ck_alloc(fn_size + 1);
+  if (aflrun_d) {
+    w_cnts = ck_alloc(fsrv->num_reachables * sizeof(u32));
+    w_pos = ck_alloc(fsrv->num_reachables * sizeof(u64));
+  }
+  if (collect_coverage) {
+    coverage_map = calloc(map_size + 64, 1);
+    cov = ck_alloc(map_size);
+    if (coverage_map == NULL)
+      FATAL("coult not grab memory");
+  }
+
+  // Inputs are dealt round robin, so the first worker done marks the end
+  for (u32 k = 0;; k++) {
+
+    w = k % jobs;
+    job_recv(in[w], w, &tag, sizeof(u32), 1);
+    if (tag == JOB_DONE) break;
+    if (tag == JOB_SKIP) continue;
+
+    job_recv(in[w], w, &len, sizeof(u32), 1);
+    if (len > fn_size) {
+      fn_size = len;
+      fn = ck_realloc(fn, fn_size + 1);
+    }
+    job_recv(in[w], w, fn, 1, len);
+    fn[len] = 0;
+
+    if (aflrun_d) {
+
+      job_recv(in[w], w, &num_visited, sizeof(u32), 1);
+      if (num_visited > fsrv->num_targets)
+        FATAL("Bad results of worker %u of -j", w);
+      job_recv(in[w], w, trace_visited, sizeof(reach_t), num_visited);
+
+      job_recv(in[w], w, &num_words, sizeof(u32), 1);
+      if (num_words > (map_size + 63) >> 6)
+        FATAL("Bad results of worker %u of -j", w);
+      job_recv(in[w], w, trace_words, sizeof(u32), num_words);
+      job_recv(in[w], w, trace_masks, sizeof(u64), num_words);
+
+      aflrun_merge_results(fn, num_visited, num_words);
+
+    }
+
+    if (minimize) {
+
+      u64 size;
+      job_recv(in[w], w, &size, sizeof(u64), 1);
+      job_recv(in[w], w, &cmin_num_keys, sizeof(u32), 1);
+      cmin_grow((void **)&cmin_keys, &cmin_keys_size, cmin_num_keys,
+                sizeof(u64));
+      job_recv(in[w], w, cmin_keys, sizeof(u64), cmin_num_keys);
+      cmin_add_input(fn, size, cmin_keys, cmin_num_keys);
+
+    }
+
+  }
+
+  for (u32 i = 0; i < jobs; i++) {
+
+    u32 v = (w + i) % jobs, w_done;
+    u64 w_execs, w_total;
+    u32 w_highest, w_hits;
+    u8  w_cov;
+
+    if (i) {
+
+      job_recv(in[v], v, &tag, sizeof(u32), 1);
+      if (tag != JOB_DONE) FATAL("Results of workers of -j out of order");
+
+    }
+
+    job_recv(in[v], v, &w_done, sizeof(u32), 1);
+    job_recv(in[v], v, &w_execs, sizeof(u64), 1);
+    job_recv(in[v], v, &w_total, sizeof(u64), 1);
+    job_recv(in[v], v, &w_highest, sizeof(u32), 1);
+    job_recv(in[v], v, &w_cov, sizeof(u8), 1);
+    job_recv(in[v], v, &w_hits, sizeof(u32), 1);
+    done += w_done;
+    cache_hits += w_hits;
+
+    if (aflrun_d) {
+
+      job_recv(in[v], v, w_cnts, sizeof(u32), fsrv->num_reachables);
+      job_recv(in[v], v, w_pos, sizeof(u64), fsrv->num_reachables);
+      for (reach_t b = 0; b < fsrv->num_reachables; b++) {
+
+        block_cnts[b] += w_cnts[b];
+        block_pos[b] += w_pos[b];
+
+      }
+
+    }
+    fsrv->total_execs += w_execs;
+    total += w_total;
+    if (w_highest > highest) highest = w_highest;
+    if (w_cov) have_coverage = true;
+
+    if (collect_coverage) {
+
+      job_recv(in[v], v, cov, 1, sizes[v]);
+      for (u32 j = 0; j < sizes[v]; j++)
+        coverage_map[j] |= cov[j];
+
+    }
+
+  }
+
+  reap_jobs(in, pids, jobs);
+
+  if (!done) { FATAL("could not read input testcases from %s", in_dir); }
+
+  if (aflrun_d) {
+    aflrun_write_cnt(fsrv);
+    aflrun_write_order(aflrun_dir, prefix);
+    fclose(aflrun_log); fclose(aflrun_cnt); fclose(aflrun_tcov);
+  }
+
+  if (!quiet_mode) { OKF("Processed %llu input files.", fsrv->total_execs); }
+  if (cache_dir && !quiet_mode) {
+
+    OKF("Took %u of them from cache.", cache_hits);
+
+  }
+
+  if (minimize) cmin_finish();
+
+  if (collect_coverage) {
+
+    fsrv->trace_bits = coverage_map;
+    tcnt = write_results_to_file(fsrv, out_file);
+    if (!tcnt && !have_coverage) { FATAL("No instrumentation detected" cRST); }
+    OKF("Captured %u tuples (map size %u, highest value %u, total values %llu) "
+        "in '%s'." cRST,
+        tcnt, map_size, highest, total, out_file);
+    OKF("A coverage of %u edges were achieved out of %u existing (%.02f%%) "
+        "with %llu input files.",
+        tcnt, map_size, ((float)tcnt * 100) / (float)map_size,
+        fsrv->total_execs);
+
+  }
+
+  exit(0);
+
 }
 
 /* Main entry point */
@@ -995,6 +2063,7 @@ int main(int argc, char **argv_orig, char **envp) {
        use_wine = false;
   char **use_argv;
   const char* prefix = NULL;
+  const char* aflrun_dir = NULL;
 
   char **argv = argv_cpy_dup(argc, argv_orig);
 
@@ -1011,7 +2080,7 @@ int main(int argc, char **argv_orig, char **envp) {
 
   if (getenv("AFL_QUIET") != NULL) { be_quiet = true; }
 
-  while ((opt = getopt(argc, argv, "+i:o:f:m:t:AeqCZOH:QUWbcrshd:p:")) > 0) {
+  while ((opt = getopt(argc, argv, "+i:o:f:m:t:AeqCZOH:QUWbcrshd:p:Bj:Mk:")) > 0) {
 
     switch (opt) {
 
@@ -1231,36 +2300,30 @@ int main(int argc, char **argv_orig, char **envp) {
           &fsrv->num_targets, &fsrv->num_reachables);
         load_aflrun_header(alloc_printf("%s/Freachable.txt", optarg),
           &fsrv->num_ftargets, &fsrv->num_freachables);
-        u8* log_file; u8* cnt_file; u8* tcov_file;
-        if (prefix) {
-          log_file = alloc_printf("%s/%s.log.txt", optarg, prefix);
-          cnt_file = alloc_printf("%s/%s.cnt.txt", optarg, prefix);
-          tcov_file = alloc_printf("%s/%s.tcov.txt", optarg, prefix);
-        } else {
-          log_file = alloc_printf("%s/log.txt", optarg);
-          cnt_file = alloc_printf("%s/cnt.txt", optarg);
-          tcov_file = alloc_printf("%s/tcov.txt", optarg);
-        }
-        aflrun_log = fopen(log_file, "w");
-        if (aflrun_log == NULL)
-          FATAL("Open log.txt failed");
-        aflrun_cnt = fopen(cnt_file, "w");
-        if (aflrun_cnt == NULL)
-          FATAL("Open cnt.txt failed");
-        aflrun_tcov = fopen(tcov_file, "w");
-        if (aflrun_tcov == NULL)
-          FATAL("Open tcov.txt failed");
-        ck_free(tcov_file);
-        ck_free(log_file);
-        ck_free(cnt_file);
+        aflrun_dir = optarg;
         break;
 
       case 'p':
-        if (aflrun_log)
-          FATAL("Please put -p before -d");
         prefix = strdup(optarg);
         break;
 
+      case 'B':
+        aflrun_binary = true;
+        break;
+
+      case 'M':
+        minimize = true;
+        break;
+
+      case 'j':
+        jobs = atoi(optarg);
+        if (jobs < 1 || optarg[0] == '-') FATAL("Bad value of -j");
+        break;
+
+      case 'k':
+        cache_dir = optarg;
+        break;
+
       default:
         usage(argv[0]);
 
@@ -1277,6 +2340,28 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (minimize) {
+
+    if (!in_dir) FATAL("-M needs -i");
+    if (collect_coverage) FATAL("-M and -C are mutually exclusive");
+
+  }
+
+  if (cache_dir) {
+
+    if (!in_dir) FATAL("-k needs -i");
+    if (minimize) FATAL("-k and -M are mutually exclusive");
+
+  }
+
+  if (jobs > 1) {
+
+    if (!in_dir) FATAL("-j needs -i");
+    if (at_file) FATAL("-j cannot be used with -f");
+    showmap_run_jobs(aflrun_dir, prefix);
+
+  }
+
   if (fsrv->qemu_mode && !mem_limit_given) { fsrv->mem_limit = MEM_LIMIT_QEMU; }
   if (unicorn_mode && !mem_limit_given) { fsrv->mem_limit = MEM_LIMIT_UNICORN; }
 
@@ -1310,15 +2395,11 @@ int main(int argc, char **argv_orig, char **envp) {
   fsrv->trace_bits = afl_shm_init(&shm, map_size, 0);
   if (aflrun_d) {
     aflrun_shm_init(&shm_run, fsrv->num_reachables, fsrv->num_freachables, 0);
-    fsrv->trace_reachables = shm_run.map_reachables;
-    fsrv->trace_freachables = shm_run.map_freachables;
-    fsrv->trace_ctx = shm_run.map_ctx;
-    fsrv->trace_virgin = shm_run.map_new_blocks;
-    fsrv->trace_targets = shm_run.map_targets;
-    for (reach_t t = 0; t < fsrv->num_targets; ++t)
-      shm_run.div_switch[t / 8] |= 1 << (t % 8);
+    afl_fsrv_attach_aflrun(fsrv, &shm_run, 1);
   }
 
+  if (cache_dir) cache_init(fsrv);
+
   if (!quiet_mode) {
 
     show_banner();
@@ -1478,20 +2559,14 @@ int main(int argc, char **argv_orig, char **envp) {
   }
 
   if (aflrun_d) {
-    // Initialize coverage map for each target
-    target_coverage_maps = (u8**)malloc(fsrv->num_targets * sizeof(u8*));
-    if (target_coverage_maps == NULL)
-      FATAL("coult not grab memory");
-    for (reach_t i = 0; i < fsrv->num_targets; ++i) {
-      target_coverage_maps[i] = malloc(map_size + 64);
-      if (target_coverage_maps[i] == NULL)
-        FATAL("coult not grab memory");
-      memset(target_coverage_maps[i], 0, map_size + 64);
-    }
-    target_coverage_cnts = calloc(fsrv->num_targets, sizeof(u32));
-    target_cnts = calloc(fsrv->num_targets, sizeof(u32));
+    // Results of workers are written by the parent
+    if (job_out == NULL) aflrun_open_results(aflrun_dir, prefix);
+    aflrun_alloc();
   }
 
+  if (minimize && (cmin_edges = calloc(map_size, sizeof(u32))) == NULL)
+    FATAL("coult not grab memory");
+
   if (in_dir) {
 
     DIR *dir_in, *dir_out = NULL;
@@ -1561,22 +2636,36 @@ int main(int argc, char **argv_orig, char **envp) {
                        : 0);
 
     map_size = fsrv->map_size;
+    if (job_out) job_send(job_out, job_id, &map_size, sizeof(u32), 1);
 
     if (fsrv->support_shmem_fuzz && !fsrv->use_shmem_fuzz)
       shm_fuzz = deinit_shmem(fsrv, shm_fuzz);
 
-    if (execute_testcases(in_dir) == 0) {
+    u32 done = execute_testcases(in_dir);
+    if (job_out) showmap_job_done(done);
+
+    if (done == 0) {
 
       FATAL("could not read input testcases from %s", in_dir);
 
     }
 
-    for (reach_t t = 0; t < fsrv->num_targets; ++t) {
-      fprintf(aflrun_cnt, "%u ", target_cnts[t]);
+    if (minimize) cmin_finish();
+
+    if (aflrun_d) {
+
+      aflrun_write_cnt(fsrv);
+      aflrun_write_order(aflrun_dir, prefix);
+
     }
-    fprintf(aflrun_cnt, "\n");
 
     if (!quiet_mode) { OKF("Processed %llu input files.", fsrv->total_execs); }
+    if (cache_dir && !quiet_mode) {
+
+      OKF("Took %u of them from cache.", cache_hits);
+
+    }
+
 
     if (dir_out) { closedir(dir_out); }
 
@@ -1597,10 +2686,7 @@ int main(int argc, char **argv_orig, char **envp) {
     if (aflrun_d) {
 
       aflrun_analyze_results(fsrv, NULL);
-      for (reach_t t = 0; t < fsrv->num_targets; ++t) {
-        fprintf(aflrun_cnt, "%u ", target_cnts[t]);
-      }
-      fprintf(aflrun_cnt, "\n");
+      aflrun_write_cnt(fsrv);
 
     }
     if (!quiet_mode) {
@@ -1612,7 +2698,7 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
-  if (!quiet_mode || collect_coverage) {
+  if ((!quiet_mode || collect_coverage) && !minimize) {
 
     if (!tcnt && !have_coverage) { FATAL("No instrumentation detected" cRST); }
     OKF("Captured %u tuples (map size %u, highest value %u, total values %llu) "
@@ -88,6 +88,19 @@ static afl_forkserver_t *fsrv;
 static sharedmem_t       shm;
 static sharedmem_t      *shm_fuzz;
 
+/* AFLRun (-d): the input must keep reaching the targets it reaches at first,
+   or only the target (and call context) given by -r. */
+
+static aflrun_shm_t shm_run;
+static u8          *orig_targets,      /* Targets reached by the input      */
+    *cur_targets;                      /* Targets reached by the last run   */
+static u32     orig_num_targets;
+static reach_t goal_target;
+static u32     goal_ctx;
+static u8      aflrun_d,               /* AFLRun maps set up (-d)?          */
+    goal_given,                        /* -r given?                         */
+    goal_ctx_given;                    /* ... with a call context?          */
+
 /*
  * forkserver section
  */
@@ -200,6 +213,7 @@ static void at_exit_handler(void) {
 
     if (shm.map) afl_shm_deinit(&shm);
     if (fsrv->use_shmem_fuzz) deinit_shmem(fsrv, shm_fuzz);
+    if (aflrun_d) aflrun_shm_deinit(&shm_run);
 
   }
 
@@ -256,6 +270,54 @@ static s32 write_to_file(u8 *path, u8 *mem, u32 len) {
 
 }
 
+/* Check the targets reached by the last run against the ones we must keep
+   reaching, remembering them as these on the first run. */
+
+static u8 aflrun_keeps_targets(afl_forkserver_t *fsrv, u8 first_run) {
+
+  const ctx_t *beg = fsrv->trace_targets->trace;
+  const ctx_t *end = beg + fsrv->trace_targets->num;
+  u32          num = 0;
+
+  if (goal_given) {
+
+    for (const ctx_t *it = beg; it < end; it++) {
+
+      if (it->block == goal_target &&
+          (!goal_ctx_given || it->call_ctx == goal_ctx)) {
+
+        return 1;
+
+      }
+
+    }
+
+    return 0;
+
+  }
+
+  memset(cur_targets, 0, MAP_RBB_SIZE(fsrv->num_targets));
+
+  for (const ctx_t *it = beg; it < end; it++) {
+
+    reach_t t = it->block;
+    if (t >= fsrv->num_targets || IS_SET(cur_targets, t)) { continue; }
+    cur_targets[t / 8] |= 1 << (t % 8);
+    if (first_run || IS_SET(orig_targets, t)) { num++; }
+
+  }
+
+  if (first_run) {
+
+    memcpy(orig_targets, cur_targets, MAP_RBB_SIZE(fsrv->num_targets));
+    orig_num_targets = num;
+
+  }
+
+  return num == orig_num_targets;
+
+}
+
 /* Execute target application. Returns 0 if the changes are a dud, or
    1 if they should be kept. */
 
@@ -314,6 +376,13 @@ static u8 tmin_run_target(afl_forkserver_t *fsrv, u8 *mem, u32 len,
 
     if (crash_mode) {
 
+      if (aflrun_d && !aflrun_keeps_targets(fsrv, first_run)) {
+
+        missed_paths++;
+        return 0;
+
+      }
+
       if (!exact_mode) { return 1; }
 
     } else {
@@ -338,6 +407,17 @@ static u8 tmin_run_target(afl_forkserver_t *fsrv, u8 *mem, u32 len,
 
   if (ret == FSRV_RUN_NOINST) { FATAL("Binary not instrumented?"); }
 
+  /* With -d, reaching the targets is what counts, not the path taken. */
+
+  if (aflrun_d && !crash_mode) {
+
+    if (aflrun_keeps_targets(fsrv, first_run)) { return 1; }
+
+    missed_paths++;
+    return 0;
+
+  }
+
   u64 cksum = hash64(fsrv->trace_bits, fsrv->map_size, HASH_CONST);
 
   if (first_run) { orig_cksum = cksum; }
@@ -349,6 +429,70 @@ static u8 tmin_run_target(afl_forkserver_t *fsrv, u8 *mem, u32 len,
 
 }
 
+/* Block deletion of -d: delete each of `chunks` blocks the input is split
+   into while the targets are kept, then try again with one block less if
+   anything was deleted, or with twice as many blocks if not. Once reaching a
+   target depends on a few bytes, large blocks around them go with a few
+   runs instead of each of the halving steps walking the whole input. Returns
+   1 if anything was deleted. */
+
+static u8 bisect_blocks(afl_forkserver_t *fsrv, u8 *tmp_buf) {
+
+  u32 chunks = 2, del_len, del_pos, tail_len;
+  u8  changed_any = 0, removed;
+
+  while (in_len) {
+
+    if (chunks > in_len) { chunks = in_len; }
+    del_len = (in_len + chunks - 1) / chunks;
+    del_pos = 0;
+    removed = 0;
+
+    SAYF(cGRA "    Block length = %u, remaining size = %u\n" cRST, del_len,
+         in_len);
+
+    while (del_pos < in_len) {
+
+      tail_len = in_len - del_pos > del_len ? in_len - del_pos - del_len : 0;
+
+      memcpy(tmp_buf, in_data, del_pos);
+      memcpy(tmp_buf + del_pos, in_data + del_pos + del_len, tail_len);
+
+      if (tmin_run_target(fsrv, tmp_buf, del_pos + tail_len, 0)) {
+
+        memcpy(in_data, tmp_buf, del_pos + tail_len);
+        in_len = del_pos + tail_len;
+        removed = 1;
+
+      } else {
+
+        del_pos += del_len;
+
+      }
+
+    }
+
+    if (removed) {
+
+      changed_any = 1;
+      chunks = chunks > 3 ? chunks - 1 : 2;
+
+    } else if (del_len == 1) {
+
+      break;
+
+    } else {
+
+      chunks *= 2;
+
+    }
+
+  }
+
+  return changed_any;
+
+}
+
 /* Actually minimize! */
 
 static void minimize(afl_forkserver_t *fsrv) {
@@ -422,6 +566,14 @@ next_pass:
   del_len = next_pow2(in_len / TRIM_START_STEPS);
   stage_o_len = in_len;
 
+  if (aflrun_d) {
+
+    ACTF(cBRI "Stage #1: " cRST "Bisecting blocks of data...");
+    changed_any = bisect_blocks(fsrv, tmp_buf);
+    goto block_removal_done;
+
+  }
+
   ACTF(cBRI "Stage #1: " cRST "Removing blocks of data...");
 
 next_del_blksize:
@@ -487,6 +639,8 @@ next_del_blksize:
 
   }
 
+block_removal_done:
+
   OKF("Block removal complete, %u bytes deleted.", stage_o_len - in_len);
 
   if (!in_len && changed_any) {
@@ -874,6 +1028,10 @@ static void usage(u8 *argv0) {
       "  -e            - solve for edge coverage only, ignore hit counts\n"
       "  -x            - treat non-zero exit codes as crashes\n\n"
       "  -H            - minimize a hang (hang mode)\n"
+      "  -d dir        - AFLRun temporary directory of the target, keep reaching\n"
+      "                  the targets the input reaches instead of its path\n"
+      "  -r t[:ctx]    - with -d, only keep reaching target t (in call context\n"
+      "                  ctx)\n\n"
 
       "For additional tips, please consult %s/README.md.\n\n"
 
@@ -922,7 +1080,7 @@ int main(int argc, char **argv_orig, char **envp) {
 
   SAYF(cCYA "afl-tmin" VERSION cRST " by Michal Zalewski\n");
 
-  while ((opt = getopt(argc, argv, "+i:o:f:m:t:B:xeAOQUWHh")) > 0) {
+  while ((opt = getopt(argc, argv, "+i:o:f:m:t:B:d:r:xeAOQUWHh")) > 0) {
 
     switch (opt) {
 
@@ -1114,6 +1272,36 @@ int main(int argc, char **argv_orig, char **envp) {
         read_bitmap(optarg, mask_bitmap, map_size);
         break;
 
+      case 'd':
+
+        if (aflrun_d) { FATAL("Multiple -d options not supported"); }
+        aflrun_d = 1;
+        load_aflrun_header(alloc_printf("%s/BBreachable.txt", optarg),
+                           &fsrv->num_targets, &fsrv->num_reachables);
+        load_aflrun_header(alloc_printf("%s/Freachable.txt", optarg),
+                           &fsrv->num_ftargets, &fsrv->num_freachables);
+        break;
+
+      case 'r': {
+
+        char *endptr;
+
+        if (goal_given) { FATAL("Multiple -r options not supported"); }
+        goal_given = 1;
+        goal_target = strtoul(optarg, &endptr, 10);
+        if (endptr == optarg) { FATAL("Bad syntax used for -r"); }
+        if (*endptr == ':') {
+
+          goal_ctx_given = 1;
+          goal_ctx = strtoul(endptr + 1, &endptr, 0);
+
+        }
+
+        if (*endptr) { FATAL("Bad syntax used for -r"); }
+        break;
+
+      }
+
       case 'h':
         usage(argv[0]);
         return -1;
@@ -1128,6 +1316,20 @@ int main(int argc, char **argv_orig, char **envp) {
 
   if (optind == argc || !in_file || !output_file) { usage(argv[0]); }
 
+  if (goal_given && !aflrun_d) { FATAL("-r requires -d"); }
+  if (aflrun_d && hang_mode) {
+
+    FATAL("-d and hang mode are mutually exclusive.");
+
+  }
+
+  if (goal_given && goal_target >= fsrv->num_targets) {
+
+    FATAL("Target %u out of range, the binary has %u targets", goal_target,
+          fsrv->num_targets);
+
+  }
+
   check_environment_vars(envp);
 
   if (getenv("AFL_NO_FORKSRV")) {             /* if set, use the fauxserver */
@@ -1147,6 +1349,14 @@ int main(int argc, char **argv_orig, char **envp) {
 
   fsrv->target_path = find_binary(argv[optind]);
   fsrv->trace_bits = afl_shm_init(&shm, map_size, 0);
+  if (aflrun_d) {
+
+    aflrun_shm_init(&shm_run, fsrv->num_reachables, fsrv->num_freachables, 0);
+    afl_fsrv_attach_aflrun(fsrv, &shm_run, 1);
+    orig_targets = ck_alloc(MAP_RBB_SIZE(fsrv->num_targets));
+    cur_targets = ck_alloc(MAP_RBB_SIZE(fsrv->num_targets));
+
+  }
   detect_file_args(argv + optind, out_file, &fsrv->use_stdin);
   signal(SIGALRM, kill_child);
 
@@ -1330,6 +1540,34 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (aflrun_d) {
+
+    if (goal_given && !aflrun_keeps_targets(fsrv, 0)) {
+
+      FATAL("Input does not reach target %u%s", goal_target,
+            goal_ctx_given ? " in the given call context" : "");
+
+    }
+
+    if (!goal_given && !orig_num_targets) {
+
+      FATAL("Input reaches no AFLRun target, nothing to keep with -d");
+
+    }
+
+    if (goal_given) {
+
+      OKF("Input reaches target %u, keeping it reached.", goal_target);
+
+    } else {
+
+      OKF("Input reaches %u target%s, keeping them reached.", orig_num_targets,
+          orig_num_targets == 1 ? "" : "s");
+
+    }
+
+  }
+
   minimize(fsrv);
 
   ACTF("Writing output to '%s'...", output_file);
@@ -1,4 +1,5 @@
 #include <fstream>
+#include <sstream>
 #include <memory>
 #include <vector>
 #include <queue>
@@ -13,6 +14,15 @@
 #include <iostream>
 #include <tuple>
 #include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <boost/functional/hash.hpp>
 #include <boost/make_shared.hpp>
@@ -20,9 +30,37 @@
 #include <boost/algorithm/string.hpp>
 #include "robin_hood.h"
 namespace bo = boost;
+#ifdef AFLRUN_POOL
+// robin_hood containers take no allocator, so with `AFLRUN_POOL` they are
+// replaced by std ones whose nodes come from slabs of aflrun-pool.h, which
+// are compacted at each cycle end.
+#include "aflrun-pool.h"
+namespace rh
+{
+template <class K, class V, class H = std::hash<K>, class E = std::equal_to<K>>
+using unordered_map = std::unordered_map<K, V, H, E,
+	aflrun_pool::Allocator<std::pair<const K, V>>>;
+template <class K, class V, class H = std::hash<K>, class E = std::equal_to<K>>
+using unordered_flat_map = unordered_map<K, V, H, E>;
+template <class K, class H = std::hash<K>, class E = std::equal_to<K>>
+using unordered_set = std::unordered_set<K, H, E, aflrun_pool::Allocator<K>>;
+template <class K, class H = std::hash<K>, class E = std::equal_to<K>>
+using unordered_flat_set = unordered_set<K, H, E>;
+}
+#else
 namespace rh = robin_hood;
+#endif
 
 #include "aflrun.h"
+#include "aflrun-image.h"
+#include "aflrun-record.h"
+#include "aflrun-registry.h"
+#include "trace.h"
+#include "afl-probes.h"
+
+#if (defined(__AVX512F__) && defined(__AVX512BW__)) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 namespace { struct Fringe; struct SeedFringes; struct ClusterPair; }
 template<> struct std::hash<Fringe>
@@ -63,7 +101,36 @@ struct AFLRunUpdateTime
 		last_ctx_pro_fringe(0), last_ctx_target(0) {}
 };
 
-AFLRunUpdateTime update_time;
+// State of an instance of AFLRun is kept in its `aflrun_ctx`, defined at the
+// end of this file; each part of it is reached through an accessor like this
+// one, which returns that of `current_ctx`.
+extern thread_local aflrun_ctx* current_ctx;
+AFLRunUpdateTime& update_time();
+
+// Phases timed after `aflrun_profile_phases`, see `aflrun_phase_t`
+bool& profile_phases();
+aflrun_phase_t* phases();
+u64& num_virgin_maps();
+
+void add_phase(u32 phase, u64 ticks)
+{
+	aflrun_phase_t& p = phases()[phase];
+	++p.calls; p.ticks += ticks;
+	u32 b = ticks ? 63 - __builtin_clzll(ticks) : 0;
+	++p.hist[std::min<u32>(b, AFLRUN_PHASE_HIST - 1)];
+}
+
+// Add ticks from construction to destruction to the phase, if profiling
+struct PhaseTimer
+{
+	u32 phase; u64 t0;
+	explicit PhaseTimer(u32 phase) :
+		phase(phase), t0(profile_phases() ? aflrun_ticks() : 0) {}
+	~PhaseTimer()
+	{
+		if (t0) add_phase(phase, aflrun_ticks() - t0);
+	}
+};
 
 struct AFLRunConfig
 {
@@ -83,6 +150,18 @@ struct AFLRunConfig
 	bool unite_assign; double unite_ratio[4]; bool single_supp_thr;
 	double dist_k; double queue_quant_thr; u32 min_num_exec;
 	bool uniform_targets; bool extra_cov; bool no_critical;
+	bool interleave_virgins; u64 seeds_log_interval; bool seeds_log_bin;
+	u8 diag_level; u32 num_workers; bool shared_state; bool sync_meta;
+	bool seed_summary; bool shared_sched; u64 rand_seed; u64 cluster_mem_budget;
+	bool partition_targets; double partition_ratio; u64 partition_interval;
+	u64 checkpoint_interval; bool budget_stages; bool cpu_quantum;
+	double alias_slice; bool splice_fringe; bool learn_edges;
+	bool directed_cmplog; bool preempt_cycle; bool state_timeline;
+	bool op_sched; u32 influence_execs; bool early_exit; bool focus_det;
+	bool dist_stack; bool target_ctl; double tw_half_life; bool retire_extra;
+	u32 crash_buckets; u32 crash_bucket_depth; bool batch_bfs;
+	bool lazy_dists; bool rare_fringes; double exec_cost; double auto_tune;
+	bool lean_cov; bool mute_blocks; bool journal;
 	/*
 	This callback function takes in information about seeds and fringes,
 	and allocate given `total_energy` to `ret` array by adding to it.
@@ -102,7 +181,21 @@ struct AFLRunConfig
 	init_cov_reset(0), seed_based_energy(true), assign_ctx(false),
 	unite_assign(true), unite_ratio{1, 1, 1, 3}, single_supp_thr(false),
 	dist_k(1), queue_quant_thr(0), min_num_exec(1), uniform_targets(false),
-	extra_cov(false), no_critical(false) {}
+	extra_cov(false), no_critical(false), interleave_virgins(false),
+	seeds_log_interval(60), seeds_log_bin(false), diag_level(1),
+	num_workers(1), shared_state(false), sync_meta(false),
+	seed_summary(false), shared_sched(false),
+	rand_seed(0), cluster_mem_budget(0), partition_targets(false),
+	partition_ratio(0.1), partition_interval(30 * 60),
+	checkpoint_interval(0), budget_stages(false), cpu_quantum(false),
+	alias_slice(0), splice_fringe(false), learn_edges(false),
+	directed_cmplog(false), preempt_cycle(false), state_timeline(false),
+	op_sched(false), influence_execs(0), early_exit(false),
+	focus_det(false), dist_stack(false), target_ctl(false),
+	tw_half_life(0), retire_extra(false), crash_buckets(0),
+	crash_bucket_depth(8), batch_bfs(false), lazy_dists(false),
+	rare_fringes(false), exec_cost(0), auto_tune(0), lean_cov(false),
+	mute_blocks(false), journal(false) {}
 
 	static const rh::unordered_map<string,
 		function<void(AFLRunConfig*, const string&)>> loaders;
@@ -394,10 +487,508 @@ AFLRunConfig::loaders(
 	{
 		BOOL_AFLRUN_ARG(no_critical)
 	}},
+	{"interleave_virgins", [](AFLRunConfig* config, const string& val)
+	{ // Store cluster virgin maps as [map_words][lanes] blocks
+		BOOL_AFLRUN_ARG(interleave_virgins)
+	}},
+	{"shared_state", [](AFLRunConfig* config, const string& val)
+	{ // Share reached blocks with other instances syncing to the same directory
+		BOOL_AFLRUN_ARG(shared_state)
+	}},
+	{"shared_sched", [](AFLRunConfig* config, const string& val)
+	{ // Spend seed energy once among instances on this host syncing together
+		BOOL_AFLRUN_ARG(shared_sched)
+	}},
+	{"sync_meta", [](AFLRunConfig* config, const string& val)
+	{ // Write AFLRun metadata beside queue entries, and use it when syncing
+		BOOL_AFLRUN_ARG(sync_meta)
+	}},
+	{"seed_summary", [](AFLRunConfig* config, const string& val)
+	{ // Write maps of calibration beside queue entries, replay them on resume
+		BOOL_AFLRUN_ARG(seed_summary)
+	}},
+	{"partition_targets", [](AFLRunConfig* config, const string& val)
+	{ // Main node splits targets among secondary nodes
+		BOOL_AFLRUN_ARG(partition_targets)
+	}},
+	{"partition_ratio", [](AFLRunConfig* config, const string& val)
+	{ // Weight ratio of targets not assigned to this secondary node
+		config->partition_ratio = stod(val);
+		if (config->partition_ratio < 0 || config->partition_ratio > 1 ||
+			isnan(config->partition_ratio))
+			throw string("Invalid 'partition_ratio'");
+	}},
+	{"partition_interval", [](AFLRunConfig* config, const string& val)
+	{ // Minimum seconds between two rebalances done by main node
+		config->partition_interval = stoull(val);
+	}},
+	{"seeds_log_interval", [](AFLRunConfig* config, const string& val)
+	{ // Seconds between flushes of seeds log, 0 for flushing every record
+		config->seeds_log_interval = stoull(val);
+	}},
+	{"seeds_log_bin", [](AFLRunConfig* config, const string& val)
+	{ // Write seeds log as binary records to `seeds.bin` instead of text
+		BOOL_AFLRUN_ARG(seeds_log_bin)
+	}},
+	{"diag_level", [](AFLRunConfig* config, const string& val)
+	{
+		// 0: no diagnostic dumps (i.e. `cvx/opt.py` and fringe files);
+		// 1: write `cvx/opt.py` from background thread;
+		// 2: write everything synchronously.
+		config->diag_level = stoi(val);
+		if (config->diag_level > 2)
+			throw string("Invalid 'diag_level'");
+	}},
+	{"num_workers", [](AFLRunConfig* config, const string& val)
+	{ // Number of threads used at cycle boundary, 1 for no extra thread
+		config->num_workers = stoul(val);
+		if (config->num_workers < 1 || config->num_workers > 256)
+			throw string("Invalid 'num_workers'");
+	}},
+	{"rand_seed", [](AFLRunConfig* config, const string& val)
+	{ // Seed of random choices made by scheduler, 0 for a random one
+		config->rand_seed = stoull(val);
+	}},
+	{"cluster_mem_budget", [](AFLRunConfig* config, const string& val)
+	{ // MB of virgin and top-rated maps of non-primary clusters, 0 for no
+		// limit; clusters without new bits for longest are merged into primary
+		// cluster to stay within it.
+		config->cluster_mem_budget = stoull(val);
+	}},
+	{"checkpoint_interval", [](AFLRunConfig* config, const string& val)
+	{ // Seconds between checkpoints of scheduler state to `aflrun_state`,
+		// written at end of a cycle and at exit; 0 for no checkpoint.
+		config->checkpoint_interval = stoull(val);
+	}},
+	{"budget_stages", [](AFLRunConfig* config, const string& val)
+	{ // Charge executions of trimming, colorization and deterministic stages
+		// against the executions given to a seed by its quant.
+		BOOL_AFLRUN_ARG(budget_stages)
+	}},
+	{"cpu_quantum", [](AFLRunConfig* config, const string& val)
+	{ // Count quanta fuzzed on a seed by CPU time of fuzzer and targets,
+		// instead of by its executions times its calibrated `exec_us`.
+		BOOL_AFLRUN_ARG(cpu_quantum)
+	}},
+	{"alias_slice", [](AFLRunConfig* config, const string& val)
+	{ // If non-zero, seeds of a cycle are drawn from an alias table weighted
+		// by their energy, each draw fuzzing for this many quanta; 0 for
+		// fuzzing each seed once in descending order of energy.
+		config->alias_slice = stod(val);
+		if (isnan(config->alias_slice) || isinf(config->alias_slice) ||
+			config->alias_slice < 0)
+			throw string("Invalid 'alias_slice'");
+	}},
+	{"splice_fringe", [](AFLRunConfig* config, const string& val)
+	{ // Splice seeds with top rated seeds of fringes that lead to the same
+		// target groups as their own fringes but that they do not cover.
+		BOOL_AFLRUN_ARG(splice_fringe)
+	}},
+	{"learn_edges", [](AFLRunConfig* config, const string& val)
+	{ // At each cycle end, add call edges taken by indirect calls but missing
+		// in BBedges.txt to the graph, and repair distances accordingly.
+		BOOL_AFLRUN_ARG(learn_edges)
+	}},
+	{"directed_cmplog", [](AFLRunConfig* config, const string& val)
+	{ // Skip compares of blocks that reach no target in input-to-state, and
+		// solve those of fringe and decisive blocks of the seed first.
+		BOOL_AFLRUN_ARG(directed_cmplog)
+	}},
+	{"preempt_cycle", [](AFLRunConfig* config, const string& val)
+	{ // End a cycle of exploitation as soon as it has used its share of energy
+		// given by `exp_ratio`, in the middle of the queue if necessary.
+		BOOL_AFLRUN_ARG(preempt_cycle)
+	}},
+	{"state_timeline", [](AFLRunConfig* config, const string& val)
+	{ // Log transitions of the state machine to `aflrun_timeline.bin`
+		BOOL_AFLRUN_ARG(state_timeline)
+	}},
+	{"op_sched", [](AFLRunConfig* config, const string& val)
+	{ // Draw havoc operators from weights learned for the target groups of
+		// the seed, rewarding those whose executions advance fringes.
+		BOOL_AFLRUN_ARG(op_sched)
+	}},
+	{"influence_execs", [](AFLRunConfig* config, const string& val)
+	{ // Executions spent once per seed of high energy to find the regions of
+		// the input changing its path, which havoc then mutates more; 0 is off.
+		config->influence_execs = stoul(val);
+	}},
+	{"early_exit", [](AFLRunConfig* config, const string& val)
+	{ // In exploitation mode, let runs of a seed exit once they have reached
+		// all targets it reached and gone on to another reachable block.
+		BOOL_AFLRUN_ARG(early_exit)
+	}},
+	{"focus_det", [](AFLRunConfig* config, const string& val)
+	{ // Run deterministic stages only for seeds covering a progressive fringe
+		// or a target, and only on their influential regions if there are any.
+		BOOL_AFLRUN_ARG(focus_det)
+	}},
+	{"dist_stack", [](AFLRunConfig* config, const string& val)
+	{ // Bound havoc stacking of a seed by the distance from its fringes to the
+		// nearest target, so seeds close to a target get small mutations.
+		BOOL_AFLRUN_ARG(dist_stack)
+	}},
+	{"target_ctl", [](AFLRunConfig* config, const string& val)
+	{ // Reload weights of targets from "aflrun_targets" in output directory
+		// at each cycle end if it is modified, where weight 0 disables one.
+		BOOL_AFLRUN_ARG(target_ctl)
+	}},
+	{"tw_half_life", [](AFLRunConfig* config, const string& val)
+	{ // If non-zero, weight of a reached target halves every this many
+		// seconds without a new context of it, so energy moves to others.
+		config->tw_half_life = stod(val);
+		if (isnan(config->tw_half_life) || config->tw_half_life < 0)
+			throw string("Invalid 'tw_half_life'");
+	}},
+	{"retire_extra", [](AFLRunConfig* config, const string& val)
+	{ // Drop extra seeds covering no fringe from AFLRun and from the seeds
+		// walked each cycle, once other seeds cover their diversity blocks.
+		BOOL_AFLRUN_ARG(retire_extra)
+	}},
+	{"crash_buckets", [](AFLRunConfig* config, const string& val)
+	{ // Keep at most this many crashes for each bucket of target, context
+		// and last reachable blocks, instead of those with new crash bits.
+		config->crash_buckets = stoul(val);
+	}},
+	{"crash_bucket_depth", [](AFLRunConfig* config, const string& val)
+	{ // Number of last reachable blocks of a crash in its bucket
+		config->crash_bucket_depth = stoul(val);
+	}},
+	{"batch_bfs", [](AFLRunConfig* config, const string& val)
+	{ // Search paths of new blocks of an execution with one multi-source BFS
+		BOOL_AFLRUN_ARG(batch_bfs)
+	}},
+	{"lazy_dists", [](AFLRunConfig* config, const string& val)
+	{ // Load distances to each target when first used
+		BOOL_AFLRUN_ARG(lazy_dists)
+	}},
+	{"rare_fringes", [](AFLRunConfig* config, const string& val)
+	{ // Favor fringes hit by fewer executions in energy assignment
+		BOOL_AFLRUN_ARG(rare_fringes)
+	}},
+	{"exec_cost", [](AFLRunConfig* config, const string& val)
+	{ // If non-zero, weight of each seed is multiplied by its speed relative
+		// to other seeds to the power of this, 1 for progress per CPU second.
+		config->exec_cost = stod(val);
+		if (isnan(config->exec_cost) || isinf(config->exec_cost) ||
+			config->exec_cost < 0)
+			throw string("Invalid 'exec_cost'");
+	}},
+	{"auto_tune", [](AFLRunConfig* config, const string& val)
+	{ // If non-zero, share of fuzzer time AFLRun bookkeeping should take;
+		// clustering and diversity thresholds, `cycle_energy` and
+		// `init_cov_quant` are then adjusted online to keep within it.
+		config->auto_tune = stod(val);
+		if (isnan(config->auto_tune) ||
+			config->auto_tune < 0 || config->auto_tune >= 1)
+			throw string("Invalid 'auto_tune'");
+	}},
+	{"lean_cov", [](AFLRunConfig* config, const string& val)
+	{ // Lower instrumentation level of runtime to block bits in coverage mode
+		BOOL_AFLRUN_ARG(lean_cov)
+	}},
+	{"mute_blocks", [](AFLRunConfig* config, const string& val)
+	{ // Mute reached blocks that can no longer lead to unreached targets
+		BOOL_AFLRUN_ARG(mute_blocks)
+	}},
+	{"journal", [](AFLRunConfig* config, const string& val)
+	{ // Append changes of logs to `aflrun_journal.bin` instead of rewriting them
+		BOOL_AFLRUN_ARG(journal)
+	}},
 	#undef BOOL_AFLRUN_ARG
 });
 
-AFLRunConfig config;
+AFLRunConfig& config();
+
+// Options checked for each execution, given as constants to `has_new_path`,
+// which is instantiated for all their valid values, so branches on them fold
+// away; the instance used is selected once the config is loaded.
+template <bool NoDiversity, u8 DivLevel>
+struct Profile
+{
+	static constexpr bool no_diversity = NoDiversity;
+	static constexpr u8 div_level = DivLevel;
+};
+
+template <typename P>
+u8 has_new_path(const u8* freached, const u8* reached, const u8* path,
+	const ctx_t* new_paths, size_t len, u8 inc, u32 seed,
+	const u8* new_bits, const size_t* cur_clusters, size_t num_clusters);
+
+using has_new_path_t = decltype(&has_new_path<Profile<false, 1>>);
+
+// Indexed by `no_diversity` and `div_level`
+constexpr has_new_path_t has_new_path_profiles[2][2] =
+{
+	{has_new_path<Profile<false, 0>>, has_new_path<Profile<false, 1>>},
+	{has_new_path<Profile<true, 0>>, has_new_path<Profile<true, 1>>}
+};
+has_new_path_t& has_new_path_fn();
+
+// Log of fringes covered by each seed. Records are buffered and appended to
+// `seeds.txt` every `seeds_log_interval` seconds, at end of each cycle and at
+// exit. If `seeds_log_bin` is set, `seeds.bin` is written instead, where each
+// record is `u32 seed, u32 num` followed by `num` pairs of `u32 block, ctx`.
+class SeedsLog
+{
+	string path;
+	ofstream out;
+	ostringstream buf;
+	u64 last_flush = 0;
+	static constexpr size_t kMaxBuffered = 1 << 20;
+
+	template <typename T>
+	inline void write_bin(const T& v)
+	{
+		buf.write(reinterpret_cast<const char*>(&v), sizeof(T));
+	}
+
+public:
+	void open(const string& out_dir)
+	{
+		path = out_dir + (config().seeds_log_bin ? "seeds.bin" : "seeds.txt");
+		last_flush = get_cur_time();
+	}
+
+	template <typename F>
+	void log(u32 seed, const rh::unordered_set<F>& fringes);
+
+	void flush()
+	{
+		if (buf.tellp() <= 0)
+			return;
+		if (!out.is_open())
+			out.open(path, ios::app | ios::binary);
+		const string data = buf.str();
+		out.write(data.data(), data.size());
+		out.flush();
+		buf.str(string());
+		last_flush = get_cur_time();
+	}
+
+	~SeedsLog() { flush(); }
+};
+
+// Background writer of diagnostic files. Each job owns a snapshot of what it
+// outputs, so it never touches fuzzer state; if a file is submitted again
+// before being written, only the latest job is kept, since it is overwritten.
+class DiagWriter
+{
+	using Job = function<void(ostream&)>;
+	mutex m;
+	condition_variable cv;
+	vector<pair<string, Job>> pending;
+	bool stop = false;
+	thread worker;
+
+	// Write into a temporary file renamed to `path`, so that a reader or an
+	// interrupted write never leaves a partial file behind.
+	static void write_file(const string& path, const Job& job)
+	{
+		const string tmp = path + ".tmp";
+		ofstream out(tmp);
+		if (!out.is_open())
+			return;
+		job(out);
+		out.close();
+		if (out.fail())
+			unlink(tmp.c_str());
+		else
+			rename(tmp.c_str(), path.c_str());
+	}
+
+	void run()
+	{
+		unique_lock<mutex> lock(m);
+		while (true)
+		{
+			cv.wait(lock, [this]() { return stop || !pending.empty(); });
+			if (pending.empty())
+				return;
+			vector<pair<string, Job>> jobs;
+			jobs.swap(pending);
+			lock.unlock();
+			for (const auto& job : jobs)
+				write_file(job.first, job.second);
+			lock.lock();
+		}
+	}
+
+public:
+	void submit(string path, Job job)
+	{
+		if (config().diag_level >= 2)
+		{
+			write_file(path, job);
+			return;
+		}
+		lock_guard<mutex> lock(m);
+		if (!worker.joinable())
+			worker = thread(&DiagWriter::run, this);
+		auto it = find_if(pending.begin(), pending.end(),
+			[&path](const pair<string, Job>& p) { return p.first == path; });
+		if (it == pending.end())
+			pending.emplace_back(std::move(path), std::move(job));
+		else
+			it->second = std::move(job);
+		cv.notify_one();
+	}
+
+	~DiagWriter()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			stop = true;
+		}
+		cv.notify_one();
+		if (worker.joinable())
+			worker.join();
+	}
+};
+
+DiagWriter diag_writer;
+
+// Pool of `num_workers - 1` threads plus the calling thread, used to
+// parallelize work at cycle boundary when fuzzer is idle. `run(n, fn)` calls
+// `fn(i, worker)` for each task `i < n`, where `worker < size()`; tasks are
+// claimed dynamically, so to be deterministic each task should write its
+// result into its own slot, which are then merged by caller in task order.
+class WorkerPool
+{
+public:
+	using Task = function<void(size_t, size_t)>;
+
+private:
+	vector<thread> threads;
+	mutex m;
+	condition_variable start_cv, done_cv;
+	const Task* task = nullptr;
+	aflrun_ctx* owner = nullptr; // instance of `task`, current in its threads
+	size_t num_tasks = 0;
+	atomic<size_t> next_task{0};
+	size_t generation = 0, running = 0;
+	bool stop = false;
+	static thread_local bool in_pool;
+
+	void work(size_t worker)
+	{
+		in_pool = true;
+		for (size_t i; (i = next_task.fetch_add(1)) < num_tasks;)
+			(*task)(i, worker);
+		in_pool = false;
+	}
+
+	void loop(size_t worker)
+	{
+		size_t seen = 0;
+		unique_lock<mutex> lock(m);
+		while (true)
+		{
+			start_cv.wait(lock, [&]() { return stop || generation != seen; });
+			if (stop)
+				return;
+			seen = generation;
+			current_ctx = owner;
+			lock.unlock();
+			work(worker);
+			lock.lock();
+			if (--running == 0)
+				done_cv.notify_one();
+		}
+	}
+
+public:
+	size_t size() const
+	{
+		return config().num_workers;
+	}
+
+	void run(size_t n, const Task& fn)
+	{
+		// Run inline if pool is disabled or if called from a task
+		if (config().num_workers <= 1 || n <= 1 || in_pool)
+		{
+			for (size_t i = 0; i < n; ++i)
+				fn(i, 0);
+			return;
+		}
+		unique_lock<mutex> lock(m);
+		while (threads.size() + 1 < config().num_workers)
+			threads.emplace_back(&WorkerPool::loop, this, threads.size() + 1);
+		task = &fn; owner = current_ctx; num_tasks = n; next_task = 0;
+		running = threads.size(); ++generation;
+		lock.unlock();
+		start_cv.notify_all();
+
+		work(0);
+
+		lock.lock();
+		done_cv.wait(lock, [this]() { return running == 0; });
+		task = nullptr;
+	}
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			stop = true;
+		}
+		start_cv.notify_all();
+		for (auto& t : threads)
+			t.join();
+	}
+};
+
+thread_local bool WorkerPool::in_pool = false;
+WorkerPool& workers();
+
+// Partition of targets among instances syncing to the same directory.
+// Each node records targets it has reached in `.aflrun_reached` of its output
+// directory; the main node assigns targets not reached by anyone to secondary
+// nodes in `.aflrun_partition` of sync directory, where each line is
+// `<sync_id> <target>...`. Weights of targets not assigned to a secondary node
+// are multiplied by `partition_ratio`; the main node still fuzzes all targets.
+class TargetPartition
+{
+	vector<double> scales; // Empty if this node has no share
+	rh::unordered_set<string> nodes;
+	bo::dynamic_bitset<> reached;
+	reach_t num_written = numeric_limits<reach_t>::max();
+	u64 last_balance = 0;
+	time_t mtime = 0;
+
+	void write_reached(const string& out_dir) const;
+	void rebalance(const string& sync_dir, const vector<string>& secondaries);
+	void load(const string& sync_dir, const string& id);
+
+public:
+	inline double scale(reach_t t) const
+	{
+		return scales.empty() ? 1 : scales[t];
+	}
+	void update(bool is_main);
+};
+
+TargetPartition& target_partition();
+
+// Weights of targets set at runtime by `target_ctl`; each line of the file
+// is `<target> <weight>`, where target is its index or its name as in
+// "reached_targets.txt", and other targets keep their compiled weights.
+class TargetControl
+{
+	vector<double> weights; // Empty if no weight is set
+	rh::unordered_map<string, reach_t> name_to_target;
+	time_t mtime = 0;
+
+public:
+	inline double weight(reach_t t, double base) const
+	{
+		return weights.empty() || weights[t] < 0 ? base : weights[t];
+	}
+	void update();
+};
+
+TargetControl& target_control();
 
 struct AFLRunGlobals
 {
@@ -416,6 +1007,22 @@ struct AFLRunGlobals
 	u32 map_size;
 	void* afl;
 	u64 init_time, cycle_time;
+	SeedsLog seeds_log;
+	ofstream timeline;
+	// Each line is `<ms since start> <seed> <target>` for first reach of target
+	ofstream reached_targets;
+	// Each target and context reached, see `aflrun_reach_rec_t`
+	ofstream reach_log;
+	// Changes of logs with `journal`, see `AFLRUN_JOURNAL`; blocks reached
+	// since last flush, and factor of each seed last journaled
+	ofstream journal;
+	vector<reach_t> journal_blocks;
+	vector<double> journal_factors;
+	// Time of last new context of each target, 0 if it is not reached yet;
+	// weight of each target decays since then, see `tw_half_life`
+	vector<u64> target_progress;
+	vector<double> tw_decay; // Empty if weights do not decay
+	size_t mem_peaks[AFLRUN_MEM_NUM] = {}; // Peaks of `aflrun_get_memory`
 
 	explicit AFLRunGlobals(reach_t num_targets, reach_t num_reachables,
 		reach_t num_ftargets, reach_t num_freachables,
@@ -437,15 +1044,63 @@ struct AFLRunGlobals
 	{
 		if (this->out_dir.back() != '/')
 			this->out_dir.push_back('/');
+		seeds_log.open(this->out_dir);
+		if (config().state_timeline)
+		{
+			timeline.open(this->out_dir + "aflrun_timeline.bin",
+				ios::app | ios::binary);
+		}
+		reached_targets.open(this->out_dir + "reached_targets.txt", ios::app);
+		reach_log.open(this->out_dir + AFLRUN_REACH_LOG,
+			ios::app | ios::binary);
+		if (config().journal)
+		{
+			journal.open(this->out_dir + AFLRUN_JOURNAL,
+				ios::trunc | ios::binary);
+			const u64 magic = AFLRUN_JOURNAL_MAGIC;
+			journal.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+		}
+		target_progress.assign(num_targets, 0);
+	}
+
+	// Append a journal record of `kind` with `body`
+	void journal_write(u8 kind, const string& body)
+	{
+		u8 size[10];
+		u8* end = aflrun_put_varint(size, body.size() + 1);
+		journal.write(reinterpret_cast<const char*>(size), end - size);
+		journal.put(static_cast<char>(kind));
+		journal.write(body.data(), body.size());
 	}
 
 	inline double get_tw(reach_t t) const
 	{
-		return config.uniform_targets ? 1 : target_weights[t];
+		return get_base_tw(t) * target_partition().scale(t) *
+			(tw_decay.empty() ? 1 : tw_decay[t]);
+	}
+
+	// Decay factor of each target at time `now`, which is at least
+	// `kMinDecay` so weights of old targets never vanish all at once
+	void update_tw_decay(u64 now)
+	{
+		static constexpr double kMinDecay = 1.0 / 1024;
+		tw_decay.resize(num_targets);
+		for (reach_t t = 0; t < num_targets; ++t)
+		{
+			double age = target_progress[t] == 0 ? 0 :
+				(now - target_progress[t]) / (config().tw_half_life * 1000);
+			tw_decay[t] = max(exp2(-age), kMinDecay);
+		}
+	}
+
+	inline double get_base_tw(reach_t t) const
+	{
+		return target_control().weight(t,
+			config().uniform_targets ? 1 : target_weights[t]);
 	}
 };
 
-unique_ptr<AFLRunGlobals> g = nullptr;
+unique_ptr<AFLRunGlobals>& g();
 
 struct AFLRunGraph
 {
@@ -469,11 +1124,27 @@ struct BasicBlockGraph : public AFLRunGraph
 			reach_t src = strtoul(l, &endptr, 10); assert(*endptr == ',');
 			reach_t dst = strtoul(endptr+1, &endptr, 10); assert(*endptr == 0);
 			assert(src < num_reachables && dst < num_reachables);
-			src_to_dst[src].insert(dst);
-			dst_to_src[dst].push_back(src);
+			if (src_to_dst[src].insert(dst).second)
+				dst_to_src[dst].push_back(src);
 		}
 		in.close();
 	}
+
+	explicit BasicBlockGraph(const aflrun_image_t* img)
+		: AFLRunGraph(img->num_reachables)
+	{
+		const u64* index = AFLRUN_IMAGE_AT(img, off_edges_index, const u64);
+		const reach_t* edges = AFLRUN_IMAGE_AT(img, off_edges, const reach_t);
+		for (reach_t src = 0; src < img->num_reachables; ++src)
+		{
+			src_to_dst[src].reserve(index[src + 1] - index[src]);
+			for (u64 i = index[src]; i < index[src + 1]; ++i)
+			{
+				if (src_to_dst[src].insert(edges[i]).second)
+					dst_to_src[edges[i]].push_back(src);
+			}
+		}
+	}
 };
 
 struct Fringe
@@ -482,98 +1153,492 @@ struct Fringe
 	u32 context;
 	explicit Fringe(reach_t block, u32 context) :
 		block(block), context(context) {}
+	// Both fields packed into one integer, used for comparison and hashing
+	inline u64 key() const
+	{
+		return (static_cast<u64>(context) << 32) | block;
+	}
 	bool operator==(const Fringe& rhs) const
 	{
-		return this->block == rhs.block && this->context == rhs.context;
+		return this->key() == rhs.key();
 	}
 };
 
-class TargetGrouper;
-
-struct SeedFringes
+// Compressed set of seed ids in the style of Roaring bitmaps: ids are grouped
+// by their high 16 bits, and each group is stored either as a sorted array of
+// low 16 bits if it is sparse, or as a bitmap of 65536 bits if it is dense.
+// Seed ids are dense queue indexes, so bitmap groups are common and unions or
+// cardinality can be computed word by word.
+// Rough heap bytes of containers for `aflrun_get_memory`; an entry of hash
+// containers is taken as its value plus two pointers of node and bucket.
+template <typename C>
+inline size_t hash_mem(const C& c)
 {
-	bo::shared_ptr<u8[]> bitmap;
-	size_t bitmap_size;
-	size_t num_ones;
-	explicit SeedFringes(size_t num_fringes)
-		: bitmap_size((num_fringes + 7) / 8), num_ones(0)
-	{
-		bitmap = bo::make_shared<u8[]>(bitmap_size);
-		fill(bitmap.get(), bitmap.get() + bitmap_size, 0);
-	}
-	bool operator==(const SeedFringes& rhs) const
-	{
-		size_t size = this->bitmap_size;
-		const u8* ptr = this->bitmap.get();
-		return size == rhs.bitmap_size &&
-			equal(ptr, ptr + size, rhs.bitmap.get());
-	}
-	inline void set(size_t idx)
-	{
-		if (!get(idx)) ++num_ones;
-		bitmap[idx / 8] |= 1 << (idx % 8);
-	}
-	inline bool get(size_t idx)
-	{
-		return ((bitmap[idx / 8]) & (1 << (idx % 8))) != 0;
-	}
-};
+	return c.size() * (sizeof(typename C::value_type) + 2 * sizeof(void*));
+}
+template <typename T>
+inline size_t vec_mem(const vector<T>& v)
+{
+	return v.capacity() * sizeof(T);
+}
 
-template <typename F, typename D>
-struct FringeBlocks
+class SeedSet
 {
-	struct Info
+	static constexpr size_t kBitmapWords = (1 << 16) / 64;
+	// An array with more elements than this is larger than a bitmap
+	static constexpr size_t kMaxArray = kBitmapWords * sizeof(u64) / sizeof(u16);
+
+	struct Container
 	{
-		rh::unordered_set<u32> seeds; // Set of all seeds that cover the fringe
-		rh::unordered_map<reach_t, rh::unordered_set<D>> decisives;
-		// decisives for each target of this fringe
-		double fuzzed_quant;
+		u16 key;
+		u32 card;
+		vector<u16> array; // Used if `bits` is empty
+		vector<u64> bits;
 
-		// We can only access these 2 variables when `has_top_rated == true`
-		u64 top_rated_factor;
-		u32 top_rated_seed; bool has_top_rated;
-		Info() : fuzzed_quant(0), has_top_rated(false) {}
-	};
+		explicit Container(u16 key) : key(key), card(0) {}
 
-	vector<rh::unordered_set<F>> target_to_fringes;
-	// maps each target to a set of fringe blocks
-	rh::unordered_map<reach_t, rh::unordered_set<F>> block_to_fringes;
-	// maps each block of fringe to fringes with that block
+		inline bool is_bitmap() const { return !bits.empty(); }
 
-	rh::unordered_map<F, Info> fringes;
-	// Maps each fringe block to set of targets that contain such block as fringe,
-	// this information should be consistent with `target_to_fringes`;
-	// for each target a set of neighbor virgin blocks are recorded,
-	// which are the blocks that make this fringe block a fringe.
-	// Note that when set of neighbors are emptied, we need to delete target;
-	// similarly when set of targets are emptied, we need to delete fringe.
+		bool contains(u16 low) const
+		{
+			if (is_bitmap())
+				return (bits[low / 64] >> (low % 64)) & 1;
+			return binary_search(array.begin(), array.end(), low);
+		}
 
-	rh::unordered_map<D, rh::unordered_set<F>> decisive_to_fringes;
-	// Map decisive blocks to corresponding fringes,
-	// works for both normal and progressive fringes.
+		bool insert(u16 low)
+		{
+			if (is_bitmap())
+			{
+				u64& w = bits[low / 64]; u64 b = 1ull << (low % 64);
+				if (w & b)
+					return false;
+				w |= b; ++card;
+				return true;
+			}
+			auto it = lower_bound(array.begin(), array.end(), low);
+			if (it != array.end() && *it == low)
+				return false;
+			array.insert(it, low); ++card;
+			if (card > kMaxArray)
+				to_bitmap();
+			return true;
+		}
 
-	rh::unordered_map<F, size_t> freq_idx;
-	vector<pair<size_t, u64>> freq; // frequency for each current fringe
-	// first element is index to bitmap and second is frequency
-	rh::unordered_map<u32, rh::unordered_set<F>> seed_fringes;
-	// map seed to all fringes covered by it, must be consistent as above
+		bool erase(u16 low)
+		{
+			if (is_bitmap())
+			{
+				u64& w = bits[low / 64]; u64 b = 1ull << (low % 64);
+				if (!(w & b))
+					return false;
+				w &= ~b; --card;
+				// Convert back only at half, so we don't convert back and forth
+				if (card <= kMaxArray / 2)
+					to_array();
+				return true;
+			}
+			auto it = lower_bound(array.begin(), array.end(), low);
+			if (it == array.end() || *it != low)
+				return false;
+			array.erase(it); --card;
+			return true;
+		}
 
-	rh::unordered_set<u32> favored_seeds;
+		void to_bitmap()
+		{
+			bits.assign(kBitmapWords, 0);
+			for (u16 low : array)
+				bits[low / 64] |= 1ull << (low % 64);
+			vector<u16>().swap(array);
+		}
 
-	explicit FringeBlocks(reach_t num_targets) : target_to_fringes(num_targets) {}
+		void to_array()
+		{
+			array.reserve(card);
+			for (size_t i = 0; i < kBitmapWords; ++i)
+			{
+				for (u64 w = bits[i]; w; w &= w - 1)
+					array.push_back(i * 64 + __builtin_ctzll(w));
+			}
+			vector<u64>().swap(bits);
+		}
 
-	void add_fringe(
-		const F& f, reach_t t, rh::unordered_set<D>&& decisives);
-	bool del_fringe(const F& f, const vector<reach_t>& ts);
+		void subtract(const Container& rhs)
+		{
+			if (is_bitmap())
+			{
+				card = 0;
+				for (size_t i = 0; i < kBitmapWords; ++i)
+				{
+					bits[i] &= rhs.is_bitmap() ? ~rhs.bits[i] : ~0ull;
+					card += __builtin_popcountll(bits[i]);
+				}
+				if (!rhs.is_bitmap())
+				{
+					for (u16 low : rhs.array)
+					{
+						u64& w = bits[low / 64]; u64 b = 1ull << (low % 64);
+						card -= (w & b) != 0;
+						w &= ~b;
+					}
+				}
+				if (card <= kMaxArray / 2)
+					to_array();
+				return;
+			}
+			auto out = array.begin();
+			for (u16 low : array)
+			{
+				if (!rhs.contains(low))
+					*out++ = low;
+			}
+			array.erase(out, array.end());
+			card = array.size();
+		}
+
+		void unite(const Container& rhs)
+		{
+			if (!is_bitmap() && !rhs.is_bitmap())
+			{
+				vector<u16> merged;
+				merged.reserve(array.size() + rhs.array.size());
+				set_union(array.begin(), array.end(),
+					rhs.array.begin(), rhs.array.end(), back_inserter(merged));
+				array = std::move(merged);
+				card = array.size();
+				if (card > kMaxArray)
+					to_bitmap();
+				return;
+			}
+			if (!is_bitmap())
+				to_bitmap();
+			if (rhs.is_bitmap())
+			{
+				card = 0;
+				for (size_t i = 0; i < kBitmapWords; ++i)
+				{
+					bits[i] |= rhs.bits[i];
+					card += __builtin_popcountll(bits[i]);
+				}
+			}
+			else
+			{
+				for (u16 low : rhs.array)
+				{
+					u64& w = bits[low / 64]; u64 b = 1ull << (low % 64);
+					card += (w & b) == 0;
+					w |= b;
+				}
+			}
+		}
+	};
+
+	vector<Container> containers; // Sorted by key
+	size_t num;
+
+	vector<Container>::iterator find_container(u16 key)
+	{
+		return lower_bound(containers.begin(), containers.end(), key,
+			[](const Container& c, u16 key) { return c.key < key; });
+	}
+	vector<Container>::const_iterator find_container(u16 key) const
+	{
+		return lower_bound(containers.begin(), containers.end(), key,
+			[](const Container& c, u16 key) { return c.key < key; });
+	}
+
+public:
+	SeedSet() : num(0) {}
+
+	class const_iterator
+	{
+		const vector<Container>* cs;
+		size_t ci, pos; u64 word;
+		// For array container, `pos` is index to array; for bitmap container,
+		// `pos` is index to word, and `word` has its bits not visited yet.
+
+		void load(size_t idx)
+		{
+			ci = idx; pos = 0;
+			word = ci < cs->size() && (*cs)[ci].is_bitmap() ?
+				(*cs)[ci].bits[0] : 0;
+		}
+
+		// Move forward until an element is pointed to, or the end is reached
+		void settle()
+		{
+			for (; ci < cs->size(); load(ci + 1))
+			{
+				const Container& c = (*cs)[ci];
+				if (!c.is_bitmap())
+				{
+					if (pos < c.array.size())
+						return;
+					continue;
+				}
+				while (word == 0 && pos + 1 < kBitmapWords)
+					word = c.bits[++pos];
+				if (word)
+					return;
+			}
+		}
+
+	public:
+		using iterator_category = forward_iterator_tag;
+		using value_type = u32;
+		using difference_type = ptrdiff_t;
+		using pointer = const u32*;
+		using reference = u32;
+
+		const_iterator(const vector<Container>* cs, size_t ci) : cs(cs)
+		{
+			load(ci); settle();
+		}
+
+		u32 operator*() const
+		{
+			const Container& c = (*cs)[ci];
+			u32 low = c.is_bitmap() ?
+				pos * 64 + __builtin_ctzll(word) : c.array[pos];
+			return (static_cast<u32>(c.key) << 16) | low;
+		}
+
+		const_iterator& operator++()
+		{
+			if ((*cs)[ci].is_bitmap())
+				word &= word - 1;
+			else
+				++pos;
+			settle();
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator ret = *this; ++*this;
+			return ret;
+		}
+
+		bool operator==(const const_iterator& rhs) const
+		{
+			return ci == rhs.ci && pos == rhs.pos && word == rhs.word;
+		}
+		bool operator!=(const const_iterator& rhs) const
+		{
+			return !(*this == rhs);
+		}
+	};
+
+	const_iterator begin() const { return const_iterator(&containers, 0); }
+	const_iterator end() const
+	{
+		return const_iterator(&containers, containers.size());
+	}
+
+	inline size_t size() const { return num; }
+	inline bool empty() const { return num == 0; }
+	void clear() { containers.clear(); num = 0; }
+
+	size_t count(u32 seed) const
+	{
+		auto it = find_container(seed >> 16);
+		return it != containers.end() && it->key == (seed >> 16) &&
+			it->contains(seed & 0xffff);
+	}
+
+	bool insert(u32 seed)
+	{
+		auto it = find_container(seed >> 16);
+		if (it == containers.end() || it->key != (seed >> 16))
+			it = containers.emplace(it, seed >> 16);
+		bool ret = it->insert(seed & 0xffff);
+		num += ret;
+		return ret;
+	}
+
+	size_t erase(u32 seed)
+	{
+		auto it = find_container(seed >> 16);
+		if (it == containers.end() || it->key != (seed >> 16) ||
+			!it->erase(seed & 0xffff))
+			return 0;
+		if (it->card == 0)
+			containers.erase(it);
+		--num;
+		return 1;
+	}
+
+	size_t mem() const
+	{
+		size_t ret = vec_mem(containers);
+		for (const Container& c : containers)
+			ret += vec_mem(c.array) + vec_mem(c.bits);
+		return ret;
+	}
+
+	SeedSet& operator-=(const SeedSet& rhs)
+	{
+		auto it = containers.begin();
+		for (const Container& rc : rhs.containers)
+		{
+			it = lower_bound(it, containers.end(), rc.key,
+				[](const Container& c, u16 key) { return c.key < key; });
+			if (it == containers.end())
+				break;
+			if (it->key != rc.key)
+				continue;
+			num -= it->card;
+			it->subtract(rc);
+			num += it->card;
+			if (it->card == 0)
+				it = containers.erase(it);
+			else
+				++it;
+		}
+		return *this;
+	}
+
+	SeedSet& operator|=(const SeedSet& rhs)
+	{
+		auto it = containers.begin();
+		for (const Container& rc : rhs.containers)
+		{
+			it = lower_bound(it, containers.end(), rc.key,
+				[](const Container& c, u16 key) { return c.key < key; });
+			if (it == containers.end() || it->key != rc.key)
+			{
+				it = containers.insert(it, rc);
+				num += rc.card;
+			}
+			else
+			{
+				num -= it->card;
+				it->unite(rc);
+				num += it->card;
+			}
+			++it;
+		}
+		return *this;
+	}
+};
+
+class TargetGrouper;
+
+struct SeedFringes
+{
+	bo::shared_ptr<u8[]> bitmap;
+	size_t bitmap_size;
+	size_t num_ones;
+	explicit SeedFringes(size_t num_fringes)
+		: bitmap_size((num_fringes + 7) / 8), num_ones(0)
+	{
+		bitmap = bo::make_shared<u8[]>(bitmap_size);
+		fill(bitmap.get(), bitmap.get() + bitmap_size, 0);
+	}
+	bool operator==(const SeedFringes& rhs) const
+	{
+		size_t size = this->bitmap_size;
+		const u8* ptr = this->bitmap.get();
+		return size == rhs.bitmap_size &&
+			equal(ptr, ptr + size, rhs.bitmap.get());
+	}
+	inline void set(size_t idx)
+	{
+		if (!get(idx)) ++num_ones;
+		bitmap[idx / 8] |= 1 << (idx % 8);
+	}
+	inline bool get(size_t idx)
+	{
+		return ((bitmap[idx / 8]) & (1 << (idx % 8))) != 0;
+	}
+};
+
+// Number of fringes at each block, and its `dist_weight` to the target
+using BlockWeights = rh::unordered_map<reach_t, pair<u32, double>>;
+
+// Decisive blocks of a path to a target, as traced by a virgin BFS. A path is
+// immutable and shared by all targets reached through it, e.g. all targets
+// behind a call entry with virgin context, and by the fringe sets that take
+// the same memoized BFS result, so it is stored once as a flat array.
+template <typename D>
+using DecisivePath = shared_ptr<const vector<D>>;
+template <typename D>
+using TargetPaths = rh::unordered_map<reach_t, DecisivePath<D>>;
+
+template <typename F, typename D>
+struct FringeBlocks
+{
+	struct Info
+	{
+		SeedSet seeds; // Set of all seeds that cover the fringe
+		TargetPaths<D> decisives;
+		// decisives for each target of this fringe
+		double fuzzed_quant;
+
+		// We can only access these 2 variables when `has_top_rated == true`
+		u64 top_rated_factor;
+		u32 top_rated_seed; bool has_top_rated;
+		Info() : fuzzed_quant(0), has_top_rated(false) {}
+	};
+
+	// Fringes are packed into 8 bytes, so all containers below are flat;
+	// note that references into them are invalidated by insertion and erasure.
+
+	vector<rh::unordered_flat_set<F>> target_to_fringes;
+	// maps each target to a set of fringe blocks
+	rh::unordered_flat_map<reach_t, rh::unordered_flat_set<F>> block_to_fringes;
+	// maps each block of fringe to fringes with that block
+
+	rh::unordered_flat_map<F, Info> fringes;
+	// Maps each fringe block to set of targets that contain such block as fringe,
+	// this information should be consistent with `target_to_fringes`;
+	// for each target a set of neighbor virgin blocks are recorded,
+	// which are the blocks that make this fringe block a fringe.
+	// Note that when set of neighbors are emptied, we need to delete target;
+	// similarly when set of targets are emptied, we need to delete fringe.
+
+	rh::unordered_flat_map<D, rh::unordered_flat_set<F>> decisive_to_fringes;
+	// Map decisive blocks to corresponding fringes,
+	// works for both normal and progressive fringes.
+
+	rh::unordered_flat_map<F, size_t> freq_idx;
+	vector<pair<size_t, u64>> freq; // frequency for each current fringe
+	// first element is index to bitmap and second is frequency
+	rh::unordered_flat_map<u32, rh::unordered_flat_set<F>> seed_fringes;
+	// map seed to all fringes covered by it, must be consistent as above
+
+	SeedSet favored_seeds;
+
+	// Maps each 64-bit word index of `trace_ctx` to fringes whose bit is inside,
+	// so coverage can be tested word by word instead of fringe by fringe.
+	rh::unordered_flat_map<size_t, vector<F>> word_to_fringes;
+
+	rh::unordered_flat_set<F> journal_dirty;
+	// Fringes whose lines in the log may have changed since last journal flush
+	inline void journal_touch(const F& f)
+	{
+		if (config().journal)
+			journal_dirty.insert(f);
+	}
+
+	explicit FringeBlocks(reach_t num_targets) : target_to_fringes(num_targets),
+		target_block_weights(num_targets), target_block_ratios(num_targets),
+		block_ratios_dirty(num_targets, 1) {}
+
+	void add_fringe(
+		const F& f, reach_t t, DecisivePath<D> decisives);
+	bool del_fringe(const F& f, const vector<reach_t>& ts);
 	bool del_fringe(const F& f);
-	bool fringe_coverage(const u8* bitmap, u32 seed,
+	bool fringe_coverage(
+		const u8* bitmap, const vector<size_t>& words, u32 seed,
 		const rh::unordered_set<Fringe>* new_criticals = nullptr,
 		const rh::unordered_set<reach_t>* new_bits_targets = nullptr);
 	void inc_freq(const u8* bitmap);
 	void update_fuzzed_quant(u32 seed, double fuzzed_quant);
 	void update_fringe_score(u32 seed);
 	u32 cull_queue(u32* seeds, u32 num);
-	rh::unordered_set<u32> select_favored_seeds() const;
+	SeedSet select_favored_seeds() const;
 	void set_favored_seeds(const u32* seeds, u32 num);
 
 	unique_ptr<TargetGrouper> grouper;
@@ -583,15 +1648,21 @@ struct FringeBlocks
 	u8 try_add_fringe(const Fringe& cand);
 	vector<reach_t> try_del_fringe(const Fringe& cand);
 
-	void remove_seed(u32 seed);
+	void remove_seeds(const SeedSet& seeds);
+
+	// Add estimated bytes to `AFLRUN_MEM_*` entries of `ret`
+	void mem(size_t* ret) const;
 
 	friend void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret);
 
+	// Distances to target `t` have been changed by `aflrun_learn_edges`
+	void dists_changed(reach_t t);
+
 private:
 	struct FringeInfo
 	{
 		double quant;
-		rh::unordered_set<u32> seeds;
+		SeedSet seeds;
 		size_t idx;
 		FringeInfo() : quant(0), idx(0) {}
 	};
@@ -606,95 +1677,516 @@ private:
 		const rh::unordered_map<reach_t, double>& block_weight,
 		const rh::unordered_map<u32, u32>& seed_to_idx) const;
 	void assign_seeds_covered(
-		const rh::unordered_set<u32>& seeds, double total_weight,
+		const SeedSet& seeds, double total_weight,
 		const rh::unordered_map<u32, u32>& seed_to_idx,
-		rh::unordered_map<u32, double>& seed_weight, double& all_sum) const;
+		vector<pair<u32, double>>& seed_weight) const;
 	void record_new_cvx_opt(
-		const vector<pair<reach_t, rh::unordered_set<reach_t>>>& target_fringes,
+		const vector<reach_t>& active_targets,
 		const rh::unordered_map<reach_t, double>& block_weight,
 		const rh::unordered_map<u32, double>& seed_ratio,
 		const vector<pair<u32, double>>& sol) const;
 
+	// Weights of fringe blocks of each target, updated as each fringe is added
+	// to or removed from `target_to_fringes`, so distances are looked up once
+	// per block instead of at each change of the target.
+	vector<BlockWeights> target_block_weights;
+	mutable vector<vector<pair<reach_t, double>>> target_block_ratios;
+	mutable vector<u8> block_ratios_dirty;
+	// Cached distance ratios of fringe blocks for each target, so energy
+	// assignment only recomputes targets whose fringes have changed.
+	const vector<pair<reach_t, double>>& block_ratios(reach_t t) const;
+	inline void target_changed(reach_t t) { block_ratios_dirty[t] = 1; }
+	void fringe_added(const F& f, reach_t t);
+	void fringe_removed(const F& f, reach_t t);
+
 	void remove_freq(const F& f);
+	void remove_word(const F& f);
 	bool remove_block(const F& f);
 	pair<unique_ptr<double[]>, unique_ptr<double[]>> allocate_ratio(
 		const rh::unordered_map<reach_t, FringeInfo>& fringe_info,
 		const vector<reach_t>& vec_fringes) const;
 };
 
-unique_ptr<FringeBlocks<Fringe, Fringe>> path_fringes = nullptr;
-unique_ptr<FringeBlocks<Fringe, reach_t>> path_pro_fringes = nullptr;
-unique_ptr<FringeBlocks<Fringe, u8/*not used*/>> reached_targets = nullptr;
+template <typename F, typename D>
+void FringeBlocks<F, D>::mem(size_t* ret) const
+{
+	size_t& fm = ret[AFLRUN_MEM_FRINGES];
+	fm += hash_mem(fringes) + vec_mem(target_to_fringes) +
+		hash_mem(block_to_fringes) + hash_mem(freq_idx) + vec_mem(freq) +
+		hash_mem(word_to_fringes) + vec_mem(target_block_weights) +
+		vec_mem(target_block_ratios);
+	for (const auto& tf : target_to_fringes)
+		fm += hash_mem(tf);
+	for (const auto& bw : target_block_weights)
+		fm += hash_mem(bw);
+	for (const auto& bf : block_to_fringes)
+		fm += hash_mem(bf.second);
+	for (const auto& wf : word_to_fringes)
+		fm += vec_mem(wf.second);
+	for (const auto& r : target_block_ratios)
+		fm += vec_mem(r);
+
+	size_t& dm = ret[AFLRUN_MEM_DECISIVES];
+	dm += hash_mem(decisive_to_fringes);
+	for (const auto& df : decisive_to_fringes)
+		dm += hash_mem(df.second);
+	for (const auto& fi : fringes)
+	{
+		fm += fi.second.seeds.mem();
+		dm += hash_mem(fi.second.decisives);
+		for (const auto& td : fi.second.decisives)
+		{ // Shared paths are split among their owners
+			dm += (sizeof(vector<D>) + vec_mem(*td.second)) /
+				td.second.use_count();
+		}
+	}
 
-// Convert block index into distance for each target
-vector<rh::unordered_map<reach_t, double>> bb_to_dists;
+	size_t& sm = ret[AFLRUN_MEM_SEED_FRINGES];
+	sm += hash_mem(seed_fringes) + favored_seeds.mem();
+	for (const auto& sf : seed_fringes)
+		sm += hash_mem(sf.second);
+}
 
-// Given set of blocks, we distribute target weight `total` to basic blocks,
-// using distance to target `t`, returned by adding each weight value to `dst`.
-void dist_block_ratio(
-	const rh::unordered_set<reach_t>& blocks, reach_t t, double total,
-	rh::unordered_map<reach_t, double>& dst)
+unique_ptr<FringeBlocks<Fringe, Fringe>>& path_fringes();
+unique_ptr<FringeBlocks<Fringe, reach_t>>& path_pro_fringes();
+unique_ptr<FringeBlocks<Fringe, u8/*not used*/>>& reached_targets();
+
+// Call `f(block, dist)` for each line of `distance.cfg/<t>.txt` in `dir`
+void read_target_dists(const string& dir, reach_t t,
+	const function<void(reach_t, float)>& f);
+
+// Convert block index into distance for each target
+class BlockDists
 {
-	if (isinf(config.dist_k))
-	{ // If `k` is infinity, we just uniformly distribute.
-		for (reach_t b : blocks)
+	reach_t num_reachables = 0, num_targets = 0;
+
+	// Rows of (target, distance) sorted by target, in CSR form; they point
+	// into `own_index` and `own_rows`, or into the image if it is not copied
+	const u64* index = nullptr;
+	aflrun_dist_t* rows = nullptr;
+	vector<u64> own_index;
+	vector<aflrun_dist_t> own_rows;
+
+	// Used instead of the rows if a full matrix is not larger than them;
+	// distance to unreachable target is infinity
+	vector<float> dense;
+
+	// Distances not in the rows, because their targets are only reachable
+	// through edges learned at runtime; keyed by `block << 32 | target`
+	rh::unordered_flat_map<u64, float> learned;
+
+	// Where distances are loaded from by `load`: the image, or else `dir`
+	aflrun_image_t* image = nullptr;
+	string dir;
+
+	// Distances of each target read from its file when first asked for,
+	// if text files are loaded lazily; keyed by block
+	typedef rh::unordered_flat_map<reach_t, float> TargetRow;
+	mutable vector<unique_ptr<TargetRow>> lazy;
+	bool is_lazy = false;
+
+	TargetRow& target_row(reach_t t) const
+	{
+		if (unlikely(lazy[t] == nullptr))
 		{
-			dst[b] += total / blocks.size();
+			lazy[t] = make_unique<TargetRow>();
+			TargetRow& row = *lazy[t];
+			read_target_dists(dir, t, [&row](reach_t b, float d)
+			{
+				auto p = row.emplace(b, d);
+				if (!p.second && p.first->second > d)
+					p.first->second = d; // we get minimum of all distances
+			});
 		}
-		return;
+		return *lazy[t];
 	}
-	vector<pair<reach_t, double>> block_ratios; double sum = 0;
-	for (reach_t b : blocks)
+
+	void build(vector<u64>&& index, vector<aflrun_dist_t>&& rows)
 	{
-		double w = 1.0 / (bb_to_dists[b].find(t)->second + config.dist_k);
-		sum += w;
-		block_ratios.emplace_back(b, w);
+		assert(index.size() == num_reachables + 1ull);
+		if (static_cast<u64>(num_reachables) * num_targets * sizeof(float) <=
+			rows.size() * sizeof(aflrun_dist_t))
+		{
+			dense.assign(static_cast<u64>(num_reachables) * num_targets,
+				numeric_limits<float>::infinity());
+			for (reach_t b = 0; b < num_reachables; ++b)
+			{
+				for (u64 i = index[b]; i < index[b + 1]; ++i)
+					dense[b * static_cast<u64>(num_targets) + rows[i].target] =
+						rows[i].dist;
+			}
+		}
+		else
+		{
+			own_index = std::move(index);
+			own_rows = std::move(rows);
+			this->index = own_index.data();
+			this->rows = own_rows.data();
+		}
 	}
-	for (const auto& p : block_ratios)
+
+public:
+	// Distances are loaded by `load` only, after the config is known
+	void set_image(aflrun_image_t* image)
 	{
-		dst[p.first] += total * p.second / sum;
+		this->image = image;
+		num_reachables = image->num_reachables;
+		num_targets = image->num_targets;
 	}
-}
 
-class AFLRunState
-{
-public:
-	enum Mode : u8
+	void set_dir(const string& dir,
+		reach_t num_reachables, reach_t num_targets)
 	{
-		kCoverage = 0, kFringe, kProFringe, kTarget, kUnite
-	};
-private:
-	Mode mode;
-	bool reset_exploit, init_cov;
-	int cycle_count;
-	u64 whole_count;
-	double cov_quant, exploration_quant, exploitation_quant;
-	void reset(Mode new_mode)
+		this->dir = dir;
+		this->num_reachables = num_reachables;
+		this->num_targets = num_targets;
+	}
+
+	// Rows of the image are used in place if `lazy`, so that only their pages
+	// in use are resident, and those of text files are read target by target.
+	// Otherwise all distances are copied or read at once, and their average
+	// for each block is calculated into `avg_dists`.
+	void load(bool lazy, vector<double>& avg_dists)
 	{
-		if (mode == kUnite)
-		{ // Unite mode always resets to it self when there is any fringe update
-			cycle_count = -1;
-			assert(cov_quant == 0);
+		if (lazy && image != nullptr)
+		{
+			index = AFLRUN_IMAGE_AT(image, off_dists_index, u64);
+			rows = AFLRUN_IMAGE_AT(image, off_dists, aflrun_dist_t);
 			return;
 		}
-		// we don't want to reset to a more explorative state;
-		// we also don't want to reset to exploration mode in exploitation mode,
-		// exploitation goes back to exploration only if certain amount of energy
-		// is totally executed. e.i. see `cycle_end` when `mode == kTarget`.
-		if (new_mode < mode)
+		if (lazy)
+		{
+			is_lazy = true;
+			this->lazy.resize(num_targets);
 			return;
-		mode = new_mode;
-		// set to -1 because we don't want to count current cycle
-		cycle_count = -1;
-		cov_quant = 0;
-	}
-	// 4. Solve favor high column(e.i. linear to number of seeds)
-	// 5. Better Splice
-	// 6. Better design for fringe? Keep some deleted fringe. (Might take time)
+		}
 
-public:
-	AFLRunState() : mode(kCoverage), reset_exploit(false), init_cov(true),
-		cycle_count(-1), whole_count(0), cov_quant(0),
+		vector<u64> index;
+		vector<aflrun_dist_t> rows;
+		if (image != nullptr)
+		{ // Rows are already reduced to minimum distance and sorted by target
+			const u64* idx = AFLRUN_IMAGE_AT(image, off_dists_index, const u64);
+			const aflrun_dist_t* dists =
+				AFLRUN_IMAGE_AT(image, off_dists, const aflrun_dist_t);
+			index.assign(idx, idx + num_reachables + 1);
+			rows.assign(dists, dists + idx[num_reachables]);
+		}
+		else
+		{ // Targets are visited in order, so each row is sorted by target
+			vector<vector<aflrun_dist_t>> block_rows(num_reachables);
+			for (reach_t t = 0; t < num_targets; ++t)
+			{
+				read_target_dists(dir, t, [&](reach_t block, float d)
+				{
+					auto& row = block_rows[block];
+					if (row.empty() || row.back().target != t)
+						row.push_back({t, d});
+					else if (row.back().dist > d)
+						row.back().dist = d; // we get minimum of all distances
+				});
+			}
+			index.assign(num_reachables + 1, 0);
+			for (reach_t bb = 0; bb < num_reachables; ++bb)
+			{
+				rows.insert(rows.end(),
+					block_rows[bb].begin(), block_rows[bb].end());
+				index[bb + 1] = rows.size();
+				vector<aflrun_dist_t>().swap(block_rows[bb]);
+			}
+		}
+
+		// Calculate the average distance among targets
+		avg_dists.assign(num_reachables, 0.0);
+		for (reach_t bb = 0; bb < num_reachables; ++bb)
+		{
+			double sum = 0.0;
+			assert(index[bb] < index[bb + 1]);
+			for (u64 i = index[bb]; i < index[bb + 1]; ++i)
+				sum += rows[i].dist;
+			avg_dists[bb] = sum / (index[bb + 1] - index[bb]);
+		}
+		build(std::move(index), std::move(rows));
+	}
+
+	// Distance from block `b` to target `t`, infinity if it is unreachable
+	inline double find(reach_t b, reach_t t) const
+	{
+		if (!dense.empty())
+			return dense[b * static_cast<u64>(num_targets) + t];
+		if (is_lazy)
+		{
+			const TargetRow& row = target_row(t);
+			auto it = row.find(b);
+			return it == row.end() ?
+				numeric_limits<double>::infinity() : it->second;
+		}
+		aflrun_dist_t* end = rows + index[b + 1];
+		aflrun_dist_t* it = lower_bound(rows + index[b], end, t,
+			[](const aflrun_dist_t& d, reach_t t) { return d.target < t; });
+		if (likely(it != end && it->target == t))
+			return it->dist;
+		auto l = learned.find((static_cast<u64>(b) << 32) | t);
+		return l == learned.end() ?
+			numeric_limits<double>::infinity() : l->second;
+	}
+
+	// Distance from block `b` to target `t`, which must be reachable from `b`
+	inline double get(reach_t b, reach_t t) const
+	{
+		double d = find(b, t);
+		assert(!isinf(d));
+		return d;
+	}
+
+	void set(reach_t b, reach_t t, double d)
+	{
+		if (!dense.empty())
+		{
+			dense[b * static_cast<u64>(num_targets) + t] = d;
+			return;
+		}
+		if (is_lazy)
+		{
+			target_row(t)[b] = d;
+			return;
+		}
+		aflrun_dist_t* end = rows + index[b + 1];
+		aflrun_dist_t* it = lower_bound(rows + index[b], end, t,
+			[](const aflrun_dist_t& d, reach_t t) { return d.target < t; });
+		if (it != end && it->target == t)
+			it->dist = d;
+		else
+			learned[(static_cast<u64>(b) << 32) | t] = d;
+	}
+};
+
+BlockDists& bb_to_dists();
+
+// Weight of block `b` in distributing weight of target `t` to blocks
+inline double dist_weight(reach_t b, reach_t t)
+{
+	if (isinf(config().dist_k))
+		return 1; // If `k` is infinity, we just uniformly distribute.
+	return 1.0 / (bb_to_dists().get(b, t) + config().dist_k);
+}
+
+// Given weights of blocks, we calculate ratio of target weight to distribute
+// to each basic block; the ratios sum up to 1.
+void dist_block_ratio(
+	const BlockWeights& blocks, vector<pair<reach_t, double>>& ratios)
+{
+	ratios.clear();
+	ratios.reserve(blocks.size());
+	double sum = 0;
+	for (const auto& bw : blocks)
+	{
+		sum += bw.second.second;
+		ratios.emplace_back(bw.first, bw.second.second);
+	}
+	for (auto& p : ratios)
+	{
+		p.second /= sum;
+	}
+}
+
+// Distribute target weight `total` to basic blocks according to `ratios`,
+// returned by adding each weight value to `dst`.
+inline void dist_block_weight(const vector<pair<reach_t, double>>& ratios,
+	double total, rh::unordered_map<reach_t, double>& dst)
+{
+	for (const auto& p : ratios)
+	{
+		dst[p.first] += total * p.second;
+	}
+}
+
+// Count-min sketch of how many executions have reached each block switched on
+// for diversity, i.e. a fringe or a target. The runtime counts them in
+// saturating per-block counters, which `aflrun_sample_freq` adds here and
+// clears every AFLRUN_FREQ_SAMPLE_EXECS executions, so no execution scans the
+// fringes. Counts are overestimated only when blocks collide in every row.
+class FringeHits
+{
+	static constexpr size_t kWidth = 1 << AFLRUN_FREQ_SKETCH_POW2;
+	static constexpr u64 kMuls[AFLRUN_FREQ_SKETCH_DEPTH] = {
+		0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+		0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+
+	vector<u64> rows;
+	const u8* counted = nullptr; // Diversity switch, in shared memory
+
+	static size_t slot(size_t row, reach_t b)
+	{
+		return row * kWidth +
+			((b * kMuls[row]) >> (64 - AFLRUN_FREQ_SKETCH_POW2));
+	}
+
+public:
+	void init(const u8* div_switch)
+	{
+		counted = div_switch;
+		rows.assign(AFLRUN_FREQ_SKETCH_DEPTH * kWidth, 0);
+	}
+
+	bool is_counted(reach_t b) const
+	{
+		return counted != nullptr && IS_SET(counted, b);
+	}
+
+	// Conservative update: only raise rows below the new estimate
+	void add(reach_t b, u64 n)
+	{
+		u64 est = get(b) + n;
+		for (size_t i = 0; i < AFLRUN_FREQ_SKETCH_DEPTH; ++i)
+		{
+			u64& c = rows[slot(i, b)];
+			c = max(c, est);
+		}
+	}
+
+	u64 get(reach_t b) const
+	{
+		u64 ret = numeric_limits<u64>::max();
+		for (size_t i = 0; i < AFLRUN_FREQ_SKETCH_DEPTH; ++i)
+			ret = min(ret, rows[slot(i, b)]);
+		return ret;
+	}
+
+	// Factor in (0, 1] by which a block hit `get(b)` times is favored
+	double rarity(reach_t b) const
+	{
+		return 1.0 / log2(2.0 + get(b));
+	}
+
+	size_t mem() const
+	{
+		return vec_mem(rows);
+	}
+};
+constexpr u64 FringeHits::kMuls[];
+
+FringeHits& fringe_hits();
+
+// Like `dist_block_weight`, but with `rare_fringes`, ratios of counted blocks
+// are scaled by their rarity and normalized back to their original sum, so
+// uncounted blocks and the total of each target keep their share.
+void dist_rare_block_weight(const vector<pair<reach_t, double>>& ratios,
+	double total, rh::unordered_map<reach_t, double>& dst)
+{
+	if (!config().rare_fringes)
+	{
+		dist_block_weight(ratios, total, dst);
+		return;
+	}
+	vector<double> scales(ratios.size(), 1.0);
+	double counted = 0, scaled = 0;
+	for (size_t i = 0; i < ratios.size(); ++i)
+	{
+		if (!fringe_hits().is_counted(ratios[i].first))
+			continue;
+		scales[i] = fringe_hits().rarity(ratios[i].first);
+		counted += ratios[i].second;
+		scaled += ratios[i].second * scales[i];
+	}
+	double k = scaled > 0 ? counted / scaled : 1;
+	for (size_t i = 0; i < ratios.size(); ++i)
+	{
+		double r = ratios[i].second;
+		if (fringe_hits().is_counted(ratios[i].first))
+			r *= scales[i] * k;
+		dst[ratios[i].first] += total * r;
+	}
+}
+
+// Scheduler state that cannot be derived from seeds, which is checkpointed by
+// `Checkpoint` below; elements of fringes and clusters are stored as keys.
+struct SchedulerCheckpoint
+{
+	struct FringeStat
+	{
+		u64 key; double fuzzed_quant; u64 freq;
+	};
+	struct PairCount
+	{
+		u64 fst, snd; double cnt;
+	};
+
+	u8 mode; u8 reset_exploit, init_cov; s32 cycle_count; u64 whole_count;
+	double cov_quant, exploration_quant, exploitation_quant;
+	vector<double> seed_quant;
+	vector<FringeStat> fringe_stats[3]; // Path, progressive and target fringes
+	vector<u8> cluster_valid;
+	vector<vector<u64>> cluster_members;
+	vector<double> supp_cnt;
+	vector<PairCount> pair_supp_cnt;
+	u64 num_evicted;
+};
+
+inline u64 checkpoint_key(reach_t b)
+{
+	return b;
+}
+inline u64 checkpoint_key(const Fringe& f)
+{
+	return f.key();
+}
+template <typename F>
+F from_checkpoint_key(u64 key);
+template <>
+inline reach_t from_checkpoint_key<reach_t>(u64 key)
+{
+	return static_cast<reach_t>(key);
+}
+template <>
+inline Fringe from_checkpoint_key<Fringe>(u64 key)
+{
+	return Fringe(static_cast<reach_t>(key), static_cast<u32>(key >> 32));
+}
+
+class AFLRunState
+{
+public:
+	enum Mode : u8
+	{
+		kCoverage = 0, kFringe, kProFringe, kTarget, kUnite
+	};
+	// Events logged to the timeline, see `log_state`
+	enum Event : u8
+	{
+		kCycleEnd = 0, kPreempted, kReset, kExploit
+	};
+private:
+	Mode mode;
+	bool reset_exploit, init_cov;
+	int cycle_count;
+	u64 whole_count;
+	double cov_quant, exploration_quant, exploitation_quant;
+	void reset(Mode new_mode)
+	{
+		if (mode == kUnite)
+		{ // Unite mode always resets to it self when there is any fringe update
+			cycle_count = -1;
+			assert(cov_quant == 0);
+			return;
+		}
+		// we don't want to reset to a more explorative state;
+		// we also don't want to reset to exploration mode in exploitation mode,
+		// exploitation goes back to exploration only if certain amount of energy
+		// is totally executed. e.i. see `cycle_end` when `mode == kTarget`.
+		if (new_mode < mode)
+			return;
+		mode = new_mode;
+		// set to -1 because we don't want to count current cycle
+		cycle_count = -1;
+		cov_quant = 0;
+	}
+	// 4. Solve favor high column(e.i. linear to number of seeds)
+	// 5. Better Splice
+	// 6. Better design for fringe? Keep some deleted fringe. (Might take time)
+
+public:
+	AFLRunState() : mode(kCoverage), reset_exploit(false), init_cov(true),
+		cycle_count(-1), whole_count(0), cov_quant(0),
 		exploration_quant(0), exploitation_quant(0) {}
 	// Initialize cycle_count to -1 since cycle_end is called at start of cycle
 
@@ -711,11 +2203,11 @@ public:
 		{
 			assert(mode == kCoverage);
 			++cycle_count;
-			if (cov_quant >= config.init_cov_quant)
+			if (cov_quant >= config().init_cov_quant)
 			{
 				// After initial coverage fuzzing,
 				// we switch to either state machine or unite assignment.
-				if (config.unite_assign)
+				if (config().unite_assign)
 					mode = kUnite; // Start unite energy assignment mode
 				else
 					mode = kProFringe; // Start directed fuzzing
@@ -733,8 +2225,8 @@ public:
 		{
 			// we still need to count cycle to precent cycle to be always -1
 			++cycle_count;
-			if (cov_quant >= config.max_cycle_count * config.cycle_energy ||
-				config.disable_mode[kCoverage])
+			if (cov_quant >= config().max_cycle_count * config().cycle_energy ||
+				config().disable_mode[kCoverage])
 			{ // When we cannot find anything new, start exploitation
 				mode = kTarget;
 				cov_quant = 0;
@@ -749,13 +2241,13 @@ public:
 			++cycle_count;
 			// If we have already done more exploitation than exploration,
 			// switch back to exploration again.
-			if (exploitation_quant >= exploration_quant * config.exp_ratio ||
-				reached_targets->fringes.empty() || // If no reached target, skip
-				config.disable_mode[kTarget])
+			if (exploitation_quant >= exploration_quant * config().exp_ratio ||
+				reached_targets()->fringes.empty() || // If no reached target, skip
+				config().disable_mode[kTarget])
 			{
 				mode = kProFringe;
 				cycle_count = 0;
-				if (reset_exploit || config.uni_whole_cycle)
+				if (reset_exploit || config().uni_whole_cycle)
 				{
 					reset_exploit = false;
 				}
@@ -767,12 +2259,12 @@ public:
 			}
 			return ret;
 		}
-		assert(cycle_count < config.max_cycle_count);
+		assert(cycle_count < config().max_cycle_count);
 		if (mode == kProFringe)
 		{
-			if (++cycle_count == config.max_cycle_count ||
-				path_pro_fringes->fringes.empty() || // If no pro fringe, skip
-				config.disable_mode[kProFringe])
+			if (++cycle_count == config().max_cycle_count ||
+				path_pro_fringes()->fringes.empty() || // If no pro fringe, skip
+				config().disable_mode[kProFringe])
 			{
 				mode = kFringe;
 				cycle_count = 0;
@@ -781,9 +2273,9 @@ public:
 		else
 		{
 			assert(mode == kFringe);
-			if (++cycle_count == config.max_cycle_count ||
-				path_fringes->fringes.empty() || // If no fringe, skip
-				config.disable_mode[kFringe])
+			if (++cycle_count == config().max_cycle_count ||
+				path_fringes()->fringes.empty() || // If no fringe, skip
+				config().disable_mode[kFringe])
 			{
 				mode = kCoverage;
 				cycle_count = 0;
@@ -850,13 +2342,19 @@ public:
 	inline bool is_reset() const { return cycle_count == -1; }
 	inline bool is_init_cov() const { return init_cov; }
 	inline void reset_cov_quant() { cov_quant = 0; }
+	// Whether exploitation has used its share of energy before cycle end
+	inline bool is_preempted() const
+	{
+		return config().preempt_cycle && !init_cov && mode == kTarget &&
+			exploitation_quant >= exploration_quant * config().exp_ratio;
+	}
 	inline bool is_end_cov() const
 	{
 		if (init_cov)
-			return cov_quant >= config.init_cov_quant;
+			return cov_quant >= config().init_cov_quant;
 		if (mode == kCoverage)
-			return config.disable_mode[kCoverage] ||
-				cov_quant >= config.max_cycle_count * config.cycle_energy;
+			return config().disable_mode[kCoverage] ||
+				cov_quant >= config().max_cycle_count * config().cycle_energy;
 		return false;
 	}
 	inline void get_counts(int& cycle, u32& cov) const
@@ -864,9 +2362,53 @@ public:
 		cycle = cycle_count;
 		cov = cov_quant;
 	}
+	void save(SchedulerCheckpoint& ckpt) const
+	{
+		ckpt.mode = mode; ckpt.reset_exploit = reset_exploit;
+		ckpt.init_cov = init_cov; ckpt.cycle_count = cycle_count;
+		ckpt.whole_count = whole_count; ckpt.cov_quant = cov_quant;
+		ckpt.exploration_quant = exploration_quant;
+		ckpt.exploitation_quant = exploitation_quant;
+	}
+	void restore(const SchedulerCheckpoint& ckpt)
+	{
+		mode = static_cast<Mode>(ckpt.mode);
+		reset_exploit = ckpt.reset_exploit; init_cov = ckpt.init_cov;
+		cycle_count = ckpt.cycle_count; whole_count = ckpt.whole_count;
+		cov_quant = ckpt.cov_quant;
+		exploration_quant = ckpt.exploration_quant;
+		exploitation_quant = ckpt.exploitation_quant;
+	}
 };
 
-AFLRunState state;
+AFLRunState& state();
+
+// Append a record of `state` leaving `old_mode` to `aflrun_timeline.bin`;
+// each record takes 12 bytes: `u64` milliseconds since start, then `u8`
+// event (`AFLRunState::Event`), old mode, new mode and whether a whole cycle
+// has ended, in host byte order.
+void log_state(AFLRunState::Event event, u8 old_mode, u8 whole_end)
+{
+	if (!g()->timeline.is_open())
+		return;
+	u8 rec[12];
+	u64 ms = get_cur_time() - g()->init_time;
+	memcpy(rec, &ms, sizeof(ms));
+	rec[8] = event; rec[9] = old_mode;
+	rec[10] = state().get_mode(); rec[11] = whole_end;
+	g()->timeline.write(reinterpret_cast<const char*>(rec), sizeof(rec));
+}
+
+// Apply `change` to `state`, logging it as `event` if it resets the cycle
+template <typename Change>
+void change_state(AFLRunState::Event event, Change change)
+{
+	u8 old_mode = state().get_mode();
+	bool was_reset = state().is_reset();
+	change();
+	if (state().is_reset() && (!was_reset || old_mode != state().get_mode()))
+		log_state(event, old_mode, 0);
+}
 
 template <typename F>
 inline size_t to_bitmap_idx(const F& f);
@@ -901,14 +2443,56 @@ inline reach_t to_fringe_block<reach_t>(const reach_t& f)
 	return f;
 }
 
+template <typename F, typename D>
+const vector<pair<reach_t, double>>& FringeBlocks<F, D>::block_ratios(
+	reach_t t) const
+{
+	auto& ratios = target_block_ratios[t];
+	if (block_ratios_dirty[t])
+	{
+		dist_block_ratio(target_block_weights[t], ratios);
+		block_ratios_dirty[t] = 0;
+	}
+	return ratios;
+}
+
+template <typename F, typename D>
+void FringeBlocks<F, D>::fringe_added(const F& f, reach_t t)
+{
+	reach_t b = to_fringe_block<F>(f);
+	auto p = target_block_weights[t].emplace(b, make_pair(0u, 0.0));
+	if (p.second)
+		p.first->second.second = dist_weight(b, t);
+	++p.first->second.first;
+	target_changed(t);
+}
+
+template <typename F, typename D>
+void FringeBlocks<F, D>::fringe_removed(const F& f, reach_t t)
+{
+	auto it = target_block_weights[t].find(to_fringe_block<F>(f));
+	if (--it->second.first == 0)
+		target_block_weights[t].erase(it);
+	target_changed(t);
+}
+
+template <typename F, typename D>
+void FringeBlocks<F, D>::dists_changed(reach_t t)
+{
+	for (auto& bw : target_block_weights[t])
+		bw.second.second = dist_weight(bw.first, t);
+	target_changed(t);
+}
+
 // Add new fringe to the given target
 template <typename F, typename D>
 void FringeBlocks<F, D>::add_fringe(
-	const F& f, reach_t t, rh::unordered_set<D>&& decisives)
+	const F& f, reach_t t, DecisivePath<D> decisives)
 {
-	target_to_fringes[t].insert(f);
+	if (target_to_fringes[t].insert(f).second)
+		fringe_added(f, t);
 	block_to_fringes[to_fringe_block<F>(f)].insert(f);
-	for (const D& dec : decisives)
+	for (const D& dec : *decisives)
 		decisive_to_fringes[dec].insert(f);
 	auto p = fringes.emplace(f, Info());
 	p.first->second.decisives.emplace(t, std::move(decisives));
@@ -916,7 +2500,9 @@ void FringeBlocks<F, D>::add_fringe(
 	{
 		freq_idx.emplace(f, freq.size());
 		freq.emplace_back(to_bitmap_idx<F>(f), 0);
+		word_to_fringes[to_bitmap_idx<F>(f) / 64].push_back(f);
 	}
+	journal_touch(f);
 }
 
 // Return true if the block is removed
@@ -962,13 +2548,28 @@ void FringeBlocks<F, D>::remove_freq(const F& f)
 	}
 }
 
+// Remove the fringe from the word index used by `fringe_coverage`
+template <typename F, typename D>
+void FringeBlocks<F, D>::remove_word(const F& f)
+{
+	auto it = word_to_fringes.find(to_bitmap_idx<F>(f) / 64);
+	assert(it != word_to_fringes.end());
+	auto& fs = it->second;
+	auto i = find(fs.begin(), fs.end(), f);
+	assert(i != fs.end());
+	*i = fs.back();
+	fs.pop_back();
+	if (fs.empty())
+		word_to_fringes.erase(it);
+}
+
 void try_disable_seed(u32 s)
 {
-	if (reached_targets->seed_fringes.count(s) == 0 &&
-		path_pro_fringes->seed_fringes.count(s) == 0 &&
-		path_fringes->seed_fringes.count(s) == 0)
+	if (reached_targets()->seed_fringes.count(s) == 0 &&
+		path_pro_fringes()->seed_fringes.count(s) == 0 &&
+		path_fringes()->seed_fringes.count(s) == 0)
 	{ // If the seed is not used by aflrun now, try to disable it
-		disable_aflrun_extra(g->afl, s);
+		disable_aflrun_extra(g()->afl, s);
 	}
 }
 
@@ -978,12 +2579,14 @@ bool FringeBlocks<F, D>::del_fringe(const F& f, const vector<reach_t>& ts)
 {
 	auto it = fringes.find(f);
 	assert(it != fringes.end());
+	journal_touch(f);
 
 	// Remove the fringe in given set of targets
 	for (reach_t t : ts)
 	{
 		it->second.decisives.erase(t);
-		target_to_fringes[t].erase(f);
+		if (target_to_fringes[t].erase(f))
+			fringe_removed(f, t);
 	}
 
 	// If given fringe in all targets is removed, remove the fringe itself
@@ -1003,6 +2606,7 @@ bool FringeBlocks<F, D>::del_fringe(const F& f, const vector<reach_t>& ts)
 			}
 		}
 		remove_freq(f);
+		remove_word(f);
 		return remove_block(f);
 	}
 	return false;
@@ -1013,10 +2617,12 @@ template <typename F, typename D>
 bool FringeBlocks<F, D>::del_fringe(const F& f)
 {
 	auto it = fringes.find(f);
+	journal_touch(f);
 
 	for (const auto& td : it->second.decisives)
 	{
-		target_to_fringes[td.first].erase(f);
+		if (target_to_fringes[td.first].erase(f))
+			fringe_removed(f, td.first);
 	}
 	it->second.decisives.clear();
 
@@ -1034,6 +2640,7 @@ bool FringeBlocks<F, D>::del_fringe(const F& f)
 		}
 	}
 	remove_freq(f);
+	remove_word(f);
 	return remove_block(f);
 }
 
@@ -1042,44 +2649,55 @@ inline void log_fringe(ostream& out, const F& f);
 
 // Given `trace_ctx` of a `seed`, check its coverage of fringe and add if necessary
 template <typename F, typename D>
-bool FringeBlocks<F, D>::fringe_coverage(const u8* bitmap, u32 seed,
+bool FringeBlocks<F, D>::fringe_coverage(
+	const u8* bitmap, const vector<size_t>& words, u32 seed,
 	const rh::unordered_set<Fringe>* new_criticals,
 	const rh::unordered_set<reach_t>* new_bits_targets)
 {
 	// fringe_coverage for each seed should only be called once
 	assert(seed_fringes.find(seed) == seed_fringes.end());
+	PhaseTimer timer(AFLRUN_PHASE_FRINGE_COV);
 	rh::unordered_set<F> sf;
-	for (auto& p : fringes)
+	auto cover_word = [&](u64 word, const vector<F>& fs)
 	{
-		const F& f = p.first;
-
-		// If new_criticals is NULL, we think no new critical is found;
-		// otherwise, we consider coverage only if `f` is new critical.
-		bool is_new_critical = new_criticals ?
-			(new_criticals->count(f) != 0) : false;
-		// If new_bits_targets is NULL, we consider coverage of every critical,
-		// so in other word, there is no seed isolation, used for non-extra seeds;
-		// otherwise, we consider coverage only if `f` is target with new bits.
-		bool is_new_bits_targets = new_bits_targets ?
-			(new_bits_targets->count(f.block) != 0) : true;
+		for (const F& f : fs)
+		{
+			if ((word & (1uLL << (to_bitmap_idx<F>(f) % 64))) == 0)
+				continue;
 
-		// We try coverage if at least one of them is true.
-		if ((is_new_critical || is_new_bits_targets) &&
-			IS_SET(bitmap, to_bitmap_idx<F>(f)))
-		{ // If covered, add the seed
-			p.second.seeds.insert(seed);
-			sf.insert(f);
+			// If new_criticals is NULL, we think no new critical is found;
+			// otherwise, we consider coverage only if `f` is new critical.
+			bool is_new_critical = new_criticals ?
+				(new_criticals->count(f) != 0) : false;
+			// If new_bits_targets is NULL, we consider coverage of every critical,
+			// so in other word, there is no seed isolation, used for non-extra seeds;
+			// otherwise, we consider coverage only if `f` is target with new bits.
+			bool is_new_bits_targets = new_bits_targets ?
+				(new_bits_targets->count(f.block) != 0) : true;
+
+			// We try coverage if at least one of them is true.
+			if (is_new_critical || is_new_bits_targets)
+			{ // If covered, add the seed
+				fringes.find(f)->second.seeds.insert(seed);
+				sf.insert(f);
+			}
 		}
+	};
+
+	// Only the non-zero words of the trace are looked up, so the cost depends
+	// on the blocks the seed reaches instead of the number of all fringes.
+	const u64* trace = reinterpret_cast<const u64*>(bitmap);
+	for (size_t i : words)
+	{
+		auto it = word_to_fringes.find(i);
+		if (it != word_to_fringes.end())
+			cover_word(trace[i], it->second);
 	}
 	if (!sf.empty())
 	{
-		ofstream out(g->out_dir + "seeds.txt", ios::app);
-		out << seed << " | ";
-		for (const auto& f : sf)
-		{
-			log_fringe<F>(out, f); out << ' ';
-		}
-		out << endl;
+		for (const F& f : sf)
+			journal_touch(f);
+		g()->seeds_log.log<F>(seed, sf);
 		seed_fringes.emplace(seed, std::move(sf));
 		return true;
 	}
@@ -1113,6 +2731,7 @@ void FringeBlocks<F, D>::update_fuzzed_quant(u32 seed, double fuzzed_quant)
 	for (const F& f : fs)
 	{ // For each of its fringe, add `fuzzed_quant`
 		fringes.find(f)->second.fuzzed_quant += fuzzed_quant;
+		journal_touch(f);
 	}
 }
 
@@ -1123,7 +2742,7 @@ void FringeBlocks<F, D>::update_fringe_score(u32 seed)
 	auto it = seed_fringes.find(seed);
 	if (it == seed_fringes.end())
 		return;
-	u64 fav_factor = get_seed_fav_factor(g->afl, seed);
+	u64 fav_factor = get_seed_fav_factor(g()->afl, seed);
 	for (const F& f : it->second)
 	{
 		Info& info = fringes.find(f)->second;
@@ -1131,24 +2750,25 @@ void FringeBlocks<F, D>::update_fringe_score(u32 seed)
 			continue;
 
 		// Update top-rated seed and factor when possible
-		assert(info.seeds.find(seed) != info.seeds.end());
+		assert(info.seeds.count(seed) != 0);
 		info.top_rated_seed = seed;
 		info.top_rated_factor = fav_factor;
 		info.has_top_rated = true;
+		journal_touch(f);
 	}
 }
 
-vector<double> seed_quant;
+vector<double>& seed_quant();
 
 random_device rd;
-mt19937 gen(rd());
-uniform_int_distribution<> distrib(0, 99);
+mt19937& gen();
+uniform_int_distribution<>& distrib();
 
 template <typename F, typename D>
-rh::unordered_set<u32> FringeBlocks<F, D>::select_favored_seeds() const
+SeedSet FringeBlocks<F, D>::select_favored_seeds() const
 {
 	// Seeds that are considered favored
-	rh::unordered_set<u32> favored;
+	SeedSet favored;
 
 	// Record all visited fringes
 	rh::unordered_set<F> temp_v;
@@ -1181,7 +2801,7 @@ void FringeBlocks<F, D>::set_favored_seeds(const u32* seeds, u32 num)
 	favored_seeds.clear();
 	for (u32 i = 0; i < num; ++i)
 	{
-		if (favored.count(seeds[i]) > 0 || get_seed_div_favored(g->afl, seeds[i]))
+		if (favored.count(seeds[i]) > 0 || get_seed_div_favored(g()->afl, seeds[i]))
 			favored_seeds.insert(seeds[i]);
 	}
 }
@@ -1201,8 +2821,8 @@ u32 FringeBlocks<F, D>::cull_queue(u32* seeds, u32 num)
 	favored_seeds.clear();
 	for (u32 seed : seed_set)
 	{
-		if (favored.find(seed) != favored.end() ||
-			get_seed_div_favored(g->afl, seed))
+		if (favored.count(seed) != 0 ||
+			get_seed_div_favored(g()->afl, seed))
 			// `cull_queue_div` should be called first
 		{
 			seeds[idx++] = seed;
@@ -1210,12 +2830,12 @@ u32 FringeBlocks<F, D>::cull_queue(u32* seeds, u32 num)
 		}
 		else if (aflrun_get_seed_quant(seed) > 0)
 		{ // If the unfavored seed is fuzzed before
-			if (distrib(gen) >= SKIP_NFAV_OLD_PROB)
+			if (distrib()(gen()) >= SKIP_NFAV_OLD_PROB)
 				seeds[idx++] = seed;
 		}
 		else
 		{
-			if (distrib(gen) >= SKIP_NFAV_NEW_PROB)
+			if (distrib()(gen()) >= SKIP_NFAV_NEW_PROB)
 				seeds[idx++] = seed;
 		}
 	}
@@ -1230,21 +2850,21 @@ u32 cull_queue_unite(u32* seeds, u32 num)
 	u32 idx = 0;
 	for (u32 seed : seed_set)
 	{ // Similar to `cull_queue` above
-		if (path_fringes->favored_seeds.count(seed) > 0 ||
-			path_pro_fringes->favored_seeds.count(seed) > 0 ||
-			reached_targets->favored_seeds.count(seed) > 0 ||
-			get_seed_cov_favored(g->afl, seed) == 2)
+		if (path_fringes()->favored_seeds.count(seed) > 0 ||
+			path_pro_fringes()->favored_seeds.count(seed) > 0 ||
+			reached_targets()->favored_seeds.count(seed) > 0 ||
+			get_seed_cov_favored(g()->afl, seed) == 2)
 		{
 			seeds[idx++] = seed;
 		}
 		else if (aflrun_get_seed_quant(seed) > 0)
 		{
-			if (distrib(gen) >= SKIP_NFAV_OLD_PROB)
+			if (distrib()(gen()) >= SKIP_NFAV_OLD_PROB)
 				seeds[idx++] = seed;
 		}
 		else
 		{
-			if (distrib(gen) >= SKIP_NFAV_NEW_PROB)
+			if (distrib()(gen()) >= SKIP_NFAV_NEW_PROB)
 				seeds[idx++] = seed;
 		}
 	}
@@ -1282,42 +2902,20 @@ pair<unique_ptr<double[]>, unique_ptr<double[]>>
 {
 	assert(fringe_info.size() == vec_fringes.size());
 	size_t num_fringes = vec_fringes.size();
-	struct Elem
-	{
-		reach_t target;
-		rh::unordered_set<reach_t> fringes;
-		Elem(reach_t target, rh::unordered_set<reach_t>&& fringes) :
-			target(target), fringes(std::move(fringes)) {}
-	};
-
-	// We firstly get fringes of each active target
-	vector<Elem> targets_info;
+	// Allocate weight of each active target to its fringes
+	auto static_weights = make_unique<double[]>(num_fringes);
+	auto ret = make_unique<double[]>(num_fringes);
 	for (reach_t t = 0; t < target_to_fringes.size(); ++t)
 	{
-		const auto& tf = target_to_fringes[t];
-
 		// Skip targets without fringe
-		if (tf.empty())
+		if (target_to_fringes[t].empty())
 			continue;
 
-		rh::unordered_set<reach_t> fringes;
-		for (const F& f : tf)
+		double tw = g()->get_tw(t);
+		for (const auto& fr : block_ratios(t))
 		{
-			fringes.insert(f.block);
-		}
-		targets_info.emplace_back(t, std::move(fringes));
-	}
-
-	// Allocate weight of each target to its fringes
-	auto static_weights = make_unique<double[]>(num_fringes);
-	auto ret = make_unique<double[]>(num_fringes);
-	for (const Elem& e : targets_info)
-	{
-		rh::unordered_map<reach_t, double> res;
-		dist_block_ratio(e.fringes, e.target, g->get_tw(e.target), res);
-		for (const auto& fw : res)
-		{
-			static_weights[fringe_info.find(fw.first)->second.idx] += fw.second;
+			static_weights[fringe_info.find(fr.first)->second.idx] +=
+				tw * fr.second;
 		}
 	}
 
@@ -1335,67 +2933,50 @@ pair<unique_ptr<double[]>, unique_ptr<double[]>>
 	return make_pair<>(std::move(ret), std::move(static_weights));
 }
 
-u32 num_active_seeds = 0;
-void trim_new_cvx(
-	rh::unordered_map<u32, double>& seed_weight, double& all_sum, double total)
-{
-	bool trimed;
-	do
-	{
-		double total_after = total;
-		vector<tuple<u32, double, double>> seed_weight_prev;
-		seed_weight_prev.reserve(seed_weight.size());
-
-		// Flatten the unordered map, also add `prev`,
-		// and calculate total energy after the allocation.
-		for (const auto& sw : seed_weight)
-		{
-			double prev = aflrun_get_seed_quant(sw.first);
-			total_after += prev;
-			seed_weight_prev.emplace_back(sw.first, sw.second, prev);
-		}
-
-		double sum = all_sum;
-		trimed = false;
-		for (const auto& swp : seed_weight_prev)
-		{
-			// If previous energy is already >= than desired energy calculated
-			// from desired ratio, we will not allocate energy to it, so it can
-			// be removed for optimization.
-			if (get<2>(swp) >= total_after * get<1>(swp) / sum)
-			{
-				seed_weight.erase(get<0>(swp));
-				all_sum -= get<1>(swp);
-				trimed = true;
-			}
-		}
-
-	// We recursively trim, until there is no trimming happens
-	} while (trimed);
-}
-
+u32& num_active_seeds();
+// Allocate energy `total` to seeds, so that energy of each seed after the
+// allocation (i.e. `prev` plus allocated energy) is proportional to its
+// weight, except that seeds already having more energy than that are not
+// allocated any energy. This is water filling: we sort seeds by `prev`/weight
+// and the allocated ones must be a prefix, so the cutoff is found in one sweep.
 vector<pair<u32, double>> solve_new_cvx(
-	const rh::unordered_map<u32, double>& seed_weight, double sum, double total)
+	const rh::unordered_map<u32, double>& seed_weight, double total)
 {
-	// Same as above
-	double total_after = total;
-	vector<tuple<u32, double, double>> seed_weight_prev;
-	seed_weight_prev.reserve(seed_weight.size());
+	struct SeedPrev
+	{
+		u32 seed; double weight, prev;
+	};
+	vector<SeedPrev> seeds;
+	seeds.reserve(seed_weight.size());
 	for (const auto& sw : seed_weight)
+		seeds.push_back({sw.first, sw.second, aflrun_get_seed_quant(sw.first)});
+	sort(seeds.begin(), seeds.end(), [](const SeedPrev& a, const SeedPrev& b)
+	{
+		return a.prev * b.weight < b.prev * a.weight;
+	});
+
+	// A seed is allocated if `prev / weight` is smaller than the energy per
+	// weight of the seeds before it, which only holds for a prefix.
+	double total_after = total, sum = 0; size_t num = 0;
+	for (; num < seeds.size(); ++num)
 	{
-		double prev = aflrun_get_seed_quant(sw.first);
-		total_after += prev;
-		seed_weight_prev.emplace_back(sw.first, sw.second, prev);
+		const SeedPrev& sp = seeds[num];
+		if (num > 0 && sp.prev * sum >= total_after * sp.weight)
+			break;
+		total_after += sp.prev;
+		sum += sp.weight;
 	}
 
 	vector<pair<u32, double>> ret;
-	for (const auto& swp : seed_weight_prev)
+	ret.reserve(num);
+	for (size_t i = 0; i < num; ++i)
 	{ // After trimming, desired energy must be larger than previous energy
-		double seed_energy = total_after * get<1>(swp) / sum - get<2>(swp);
+		double seed_energy =
+			total_after * seeds[i].weight / sum - seeds[i].prev;
 		assert(seed_energy > 0);
 
 		// TODO: potential precision problem?
-		ret.emplace_back(get<0>(swp), seed_energy);
+		ret.emplace_back(seeds[i].seed, seed_energy);
 	}
 
 	return ret;
@@ -1403,59 +2984,72 @@ vector<pair<u32, double>> solve_new_cvx(
 
 template <typename F, typename D>
 void FringeBlocks<F, D>::record_new_cvx_opt(
-	const vector<pair<reach_t, rh::unordered_set<reach_t>>>& target_fringes,
+	const vector<reach_t>& active_targets,
 	const rh::unordered_map<reach_t, double>& block_weight,
 	const rh::unordered_map<u32, double>& seed_ratio,
 	const vector<pair<u32, double>>& sol) const
 {
-	ofstream out(g->out_dir + "cvx/opt.py");
-	if (!out.is_open())
+	if (config().diag_level == 0)
 		return;
 
-	out << "import numpy as np" << endl;
-
-	// Output normalized weights of targets
+	// Take snapshot of normalized weights of targets and blocks, and seeds;
+	// names are not changed after initialization so pointers can be used.
 	double sum = 0;
-	for (const auto& t : target_fringes)
-		sum += g->get_tw(t.first);
-	out << "target_weight = np.array([" << endl;
-	out << "# target, ratio" << endl;
-	for (const auto& t : target_fringes)
-		out << "[\"" << g->reachable_names[t.first] <<
-			"\", " << g->get_tw(t.first) / sum << "]," << endl;
-	out << "])" << endl;
-
-	// Output normalized weights of blocks
+	for (reach_t t : active_targets)
+		sum += g()->get_tw(t);
+	vector<pair<const char*, double>> targets;
+	for (reach_t t : active_targets)
+		targets.emplace_back(g()->reachable_names[t], g()->get_tw(t) / sum);
+
 	sum = 0;
 	for (const auto& bw : block_weight)
 		sum += bw.second;
-	out << "block_weight = np.array([" << endl;
-	out << "# block, ctx_count, ratio" << endl;
+	vector<tuple<const char*, size_t, double>> blocks;
 	for (const auto& bw : block_weight)
-		out << "[\"" << g->reachable_names[bw.first] <<
-			"\", " << block_to_fringes.find(bw.first)->second.size() <<
-			", " << bw.second / sum << "]," << endl;
-	out << "])" << endl;
-
-	out << "opt = np.array([" << endl;
-	out << "# seed, prev, ratio, solution" << endl;
+		blocks.emplace_back(g()->reachable_names[bw.first],
+			block_to_fringes.find(bw.first)->second.size(), bw.second / sum);
 
+	vector<tuple<u32, double, double, double>> seeds;
 	rh::unordered_set<u32> non_zero_seeds;
 	for (const auto& se : sol)
 	{
-		out << '[' << se.first << ", " << aflrun_get_seed_quant(se.first) <<
-			", " << seed_ratio.find(se.first)->second << ", " <<
-			se.second << "]," << endl;
+		seeds.emplace_back(se.first, aflrun_get_seed_quant(se.first),
+			seed_ratio.find(se.first)->second, se.second);
 		non_zero_seeds.insert(se.first);
 	}
 	for (const auto& sr : seed_ratio)
 	{
 		if (non_zero_seeds.count(sr.first) > 0)
 			continue;
-		out << '[' << sr.first << ", " << aflrun_get_seed_quant(sr.first) <<
-			", " << sr.second << ", " << 0.0 << "]," << endl;
+		seeds.emplace_back(sr.first, aflrun_get_seed_quant(sr.first),
+			sr.second, 0.0);
 	}
-	out << "])" << endl;
+
+	diag_writer.submit(g()->out_dir + "cvx/opt.py",
+		[targets, blocks, seeds](ostream& out)
+	{
+		out << "import numpy as np\n";
+
+		out << "target_weight = np.array([\n";
+		out << "# target, ratio\n";
+		for (const auto& t : targets)
+			out << "[\"" << t.first << "\", " << t.second << "],\n";
+		out << "])\n";
+
+		out << "block_weight = np.array([\n";
+		out << "# block, ctx_count, ratio\n";
+		for (const auto& b : blocks)
+			out << "[\"" << get<0>(b) << "\", " << get<1>(b) <<
+				", " << get<2>(b) << "],\n";
+		out << "])\n";
+
+		out << "opt = np.array([\n";
+		out << "# seed, prev, ratio, solution\n";
+		for (const auto& se : seeds)
+			out << '[' << get<0>(se) << ", " << get<1>(se) << ", " <<
+				get<2>(se) << ", " << get<3>(se) << "],\n";
+		out << "])" << endl;
+	});
 }
 
 void record_new_cvx_opt_uni(
@@ -1465,118 +3059,143 @@ void record_new_cvx_opt_uni(
 	const double* seed_sums, const rh::unordered_map<u32, double>& seed_ratio,
 	const vector<pair<u32, double>>& sol)
 {
-	ofstream out(g->out_dir + "cvx/opt.py");
-	if (!out.is_open())
+	if (config().diag_level == 0)
 		return;
-	out << "import numpy as np" << endl;
 
-	// Output normalized weights of targets for each type
+	// Normalized weights of targets for each type
 	double sum = 0;
 	for (const auto& ttw : target_type_weights)
 		for (size_t i = 0; i < 3; ++i)
 			sum += ttw.second[i];
-	out << "target_weights = np.array([" << endl;
-	out << "# target, N ratio, P ratio, T ratio" << endl;
+	vector<pair<const char*, array<double, 3>>> targets;
 	for (const auto& ttw : target_type_weights)
 	{
-		out << "[\"" << g->reachable_names[ttw.first] << "\"";
+		array<double, 3> ratios;
 		for (size_t i = 0; i < 3; ++i)
-			out << ", " << ttw.second[i] / sum;
-		out << "]," << endl;
+			ratios[i] = ttw.second[i] / sum;
+		targets.emplace_back(g()->reachable_names[ttw.first], ratios);
 	}
-	out << "])" << endl;
 
-	// Output normalized weights of blocks for each mode
+	// Normalized weights of blocks for each mode
 	function<size_t(u32)> ctx_count[3] = {
 		[](u32 s) -> size_t
 		{
-			return path_fringes->block_to_fringes.find(s)->second.size();
+			return path_fringes()->block_to_fringes.find(s)->second.size();
 		},
 		[](u32 s) -> size_t
 		{
-			return path_pro_fringes->block_to_fringes.find(s)->second.size();
+			return path_pro_fringes()->block_to_fringes.find(s)->second.size();
 		},
 		[](u32 s) -> size_t
 		{
-			return reached_targets->block_to_fringes.find(s)->second.size();
+			return reached_targets()->block_to_fringes.find(s)->second.size();
 		},
 	};
-	const char* names = "NPT";
+	array<vector<tuple<const char*, size_t, double>>, 3> blocks;
 	for (size_t i = 0; i < 3; ++i)
 	{
 		sum = 0;
 		for (const auto& btw : block_weights[i])
 			sum += btw.second;
-		out << "block_weight_" << names[i] << " = np.array([" << endl;
-		out << "# block, ctx_count, ratio" << endl;
 		for (const auto& btw : block_weights[i])
-			out << "[\"" << g->reachable_names[btw.first] <<
-				"\", " << ctx_count[i](btw.first) <<
-				", " << btw.second / sum << "]," << endl;
-		out << "])" << endl;
+			blocks[i].emplace_back(g()->reachable_names[btw.first],
+				ctx_count[i](btw.first), btw.second / sum);
 	}
 
-	out << "opt = np.array([" << endl;
-	out << "# seed, prev, ratio, solution, N, P, T, C" << endl;
+	// Each row is: seed, prev, ratio, solution, N, P, T, C
+	vector<pair<u32, array<double, 7>>> seeds;
 	rh::unordered_set<u32> non_zero_seeds;
 	double weight_sums[4] = {0,0,0,0}; double ratio_sum = 0;
-	auto log_seed_weights =
-	[&seed_weights, &out, &weight_sums](u32 seed)
+	auto add_seed = [&](u32 seed, double ratio, double solution)
 	{
+		array<double, 7> row;
+		row[0] = aflrun_get_seed_quant(seed); row[1] = ratio; row[2] = solution;
 		for (size_t i = 0; i < 4; ++i)
 		{
 			auto it = seed_weights[i].find(seed);
-			double val = it == seed_weights[i].end() ? 0.0 : it->second;
-			out << ", " << val;
-			weight_sums[i] += val;
+			row[3 + i] = it == seed_weights[i].end() ? 0.0 : it->second;
+			weight_sums[i] += row[3 + i];
 		}
+		ratio_sum += ratio;
+		seeds.emplace_back(seed, row);
 	};
 	for (const auto& se : sol)
 	{
-		double ratio = seed_ratio.find(se.first)->second;
-		ratio_sum += ratio;
-		out << '[' << se.first << ", " << aflrun_get_seed_quant(se.first) <<
-			", " << ratio << ", " << se.second;
-		log_seed_weights(se.first);
-		out << "]," << endl;
+		add_seed(se.first, seed_ratio.find(se.first)->second, se.second);
 		non_zero_seeds.insert(se.first);
 	}
 	for (const auto& sr : seed_ratio)
 	{
 		if (non_zero_seeds.count(sr.first) > 0)
 			continue;
-		ratio_sum += sr.second;
-		out << '[' << sr.first << ", " << aflrun_get_seed_quant(sr.first) <<
-			", " << sr.second << ", " << 0.0;
-		log_seed_weights(sr.first);
-		out << "]," << endl;
-	}
-	out << "])" << endl;
-	out << "# " << ratio_sum;
+		add_seed(sr.first, sr.second, 0.0);
+	}
+	array<pair<double, double>, 4> sums;
 	for (size_t i = 0; i < 4; ++i)
+		sums[i] = make_pair(seed_sums[i], weight_sums[i]);
+
+	diag_writer.submit(g()->out_dir + "cvx/opt.py",
+		[targets, blocks, seeds, ratio_sum, sums](ostream& out)
 	{
-		out << ' ' << seed_sums[i] << "==" << weight_sums[i];
-	}
-	out << endl;
-}
+		out << "import numpy as np\n";
 
-template <typename F, typename D>
-void FringeBlocks<F, D>::assign_seeds_covered(
-	const rh::unordered_set<u32>& seeds, double total_weight,
-	const rh::unordered_map<u32, u32>& seed_to_idx,
-	rh::unordered_map<u32, double>& seed_weight, double& all_sum) const
+		out << "target_weights = np.array([\n";
+		out << "# target, N ratio, P ratio, T ratio\n";
+		for (const auto& t : targets)
+		{
+			out << "[\"" << t.first << "\"";
+			for (size_t i = 0; i < 3; ++i)
+				out << ", " << t.second[i];
+			out << "],\n";
+		}
+		out << "])\n";
+
+		const char* names = "NPT";
+		for (size_t i = 0; i < 3; ++i)
+		{
+			out << "block_weight_" << names[i] << " = np.array([\n";
+			out << "# block, ctx_count, ratio\n";
+			for (const auto& b : blocks[i])
+				out << "[\"" << get<0>(b) << "\", " << get<1>(b) <<
+					", " << get<2>(b) << "],\n";
+			out << "])\n";
+		}
+
+		out << "opt = np.array([\n";
+		out << "# seed, prev, ratio, solution, N, P, T, C\n";
+		for (const auto& se : seeds)
+		{
+			out << '[' << se.first;
+			for (double v : se.second)
+				out << ", " << v;
+			out << "],\n";
+		}
+		out << "])\n";
+		out << "# " << ratio_sum;
+		for (const auto& ss : sums)
+			out << ' ' << ss.first << "==" << ss.second;
+		out << endl;
+	});
+}
+
+template <typename F, typename D>
+void FringeBlocks<F, D>::assign_seeds_covered(
+	const SeedSet& seeds, double total_weight,
+	const rh::unordered_map<u32, u32>& seed_to_idx,
+	vector<pair<u32, double>>& seed_weight) const
 {
 	// For all seeds that cover this context block,
 	// we get their expected performance scores, and calculate their sum.
-	vector<pair<u32, double>> seed_perf_score;
+	vector<pair<u32, double>>& seed_perf_score = seed_weight;
+	seed_perf_score.clear();
 	double sum = 0;
 	for (u32 s : seeds)
 	{
 		// Skip seeds not selected for fuzzing
 		if (seed_to_idx.count(s) == 0)
 			continue;
-		double e_perf_score = get_seed_perf_score(g->afl, s) *
-			(favored_seeds.find(s) == favored_seeds.end() ?
+		double e_perf_score = get_seed_perf_score(g()->afl, s) *
+			(favored_seeds.count(s) == 0 ?
 				(100 - SKIP_NFAV_OLD_PROB) / 100.0 : 1.0);
 		// Skip non-positive seeds,
 		// which is not quite possible but we do it anyway
@@ -1586,11 +3205,24 @@ void FringeBlocks<F, D>::assign_seeds_covered(
 		sum += e_perf_score;
 	}
 
-	for (const auto& sps : seed_perf_score)
+	for (auto& sps : seed_perf_score)
 	{ // Allocate weight of seeds according to ratio of performance scores
-		double w = total_weight * sps.second / sum;
-		seed_weight[sps.first] += w;
-		all_sum += w;
+		sps.second = total_weight * sps.second / sum;
+	}
+}
+
+// Sum weights of seeds assigned from each block in order of blocks,
+// so the result does not depend on how blocks are distributed to workers.
+void merge_seed_weights(const vector<vector<pair<u32, double>>>& parts,
+	rh::unordered_map<u32, double>& seed_weight, double& all_sum)
+{
+	for (const auto& part : parts)
+	{
+		for (const auto& sw : part)
+		{
+			seed_weight[sw.first] += sw.second;
+			all_sum += sw.second;
+		}
 	}
 }
 
@@ -1601,10 +3233,10 @@ rh::unordered_map<u32, double> assign_seeds_coverage(
 	double sum = 0;
 	for (u32 i = 0; i < num; ++i)
 	{
-		u8 level = get_seed_cov_favored(g->afl, seeds[i]);
-		if (!config.extra_cov && level == 0) // Skip aflrun extra seeds
+		u8 level = get_seed_cov_favored(g()->afl, seeds[i]);
+		if (!config().extra_cov && level == 0) // Skip aflrun extra seeds
 			continue;
-		double e_perf_score = get_seed_perf_score(g->afl, seeds[i]) *
+		double e_perf_score = get_seed_perf_score(g()->afl, seeds[i]) *
 			(level == 2 ? 1.0 : (100 - SKIP_NFAV_OLD_PROB) / 100.0);
 		if (e_perf_score <= 0)
 			continue;
@@ -1625,24 +3257,28 @@ pair<rh::unordered_map<u32, double>, double>
 	const rh::unordered_map<u32, u32>& seed_to_idx) const
 {
 	// Here we assign energy from fringe to seed directly, without context pass.
-	rh::unordered_map<u32, double> seed_weight;
-	double all_sum = 0;
-	for (const auto& bw : block_weight)
+	const vector<pair<reach_t, double>> blocks(
+		block_weight.begin(), block_weight.end());
+	vector<vector<pair<u32, double>>> parts(blocks.size());
+	workers().run(blocks.size(), [&](size_t i, size_t)
 	{
+		const auto& bw = blocks[i];
 		const auto& ctx_blocks = block_to_fringes.find(bw.first)->second;
 		assert(!ctx_blocks.empty());
-		rh::unordered_set<u32> seeds;
+		SeedSet seeds;
 		for (const F& cb : ctx_blocks)
 		{ // Collect all seeds that cover this fringe
 			assert(cb.block == bw.first);
 			const Info& info = fringes.find(cb)->second;
-			seeds.insert(info.seeds.begin(), info.seeds.end());
+			seeds |= info.seeds;
 		}
 
-		assign_seeds_covered(
-			seeds, bw.second, seed_to_idx, seed_weight, all_sum);
-	}
+		assign_seeds_covered(seeds, bw.second, seed_to_idx, parts[i]);
+	});
 
+	rh::unordered_map<u32, double> seed_weight;
+	double all_sum = 0;
+	merge_seed_weights(parts, seed_weight, all_sum);
 	return make_pair(seed_weight, all_sum);
 }
 
@@ -1665,15 +3301,19 @@ pair<rh::unordered_map<u32, double>, double> FringeBlocks<F, D>::assign_seed_ctx
 	}
 
 	// Map seed to weight being allocated from context blocks it covers
-	rh::unordered_map<u32, double> seed_weight;
-	double all_sum = 0;
-	for (const auto& cbw : ctx_block_weight)
+	const vector<pair<Fringe, double>> ctx_blocks(
+		ctx_block_weight.begin(), ctx_block_weight.end());
+	vector<vector<pair<u32, double>>> parts(ctx_blocks.size());
+	workers().run(ctx_blocks.size(), [&](size_t i, size_t)
 	{
-		const Info& info = fringes.find(cbw.first)->second;
+		const Info& info = fringes.find(ctx_blocks[i].first)->second;
 		assign_seeds_covered(
-			info.seeds, cbw.second, seed_to_idx, seed_weight, all_sum);
-	}
+			info.seeds, ctx_blocks[i].second, seed_to_idx, parts[i]);
+	});
 
+	rh::unordered_map<u32, double> seed_weight;
+	double all_sum = 0;
+	merge_seed_weights(parts, seed_weight, all_sum);
 	return make_pair(seed_weight, all_sum);
 }
 
@@ -1682,12 +3322,45 @@ pair<rh::unordered_map<u32, double>, double> FringeBlocks<F, D>::assign_seed(
 	const rh::unordered_map<reach_t, double>& block_weight,
 	const rh::unordered_map<u32, u32>& seed_to_idx) const
 {
-	if (config.assign_ctx)
+	if (config().assign_ctx)
 		return assign_seed_ctx(block_weight, seed_to_idx);
 	else
 		return assign_seed_no_ctx(block_weight, seed_to_idx);
 }
 
+// With `exec_cost`, seeds are weighted by progress per CPU second instead of
+// per quantum: a quantum of a seed twice as fast runs twice as many inputs,
+// so its weight is scaled by `(mean / exec_us) ^ exec_cost`, where `mean` is
+// the geometric mean of `exec_us` of seeds with a known one.
+void weight_exec_cost(
+	rh::unordered_map<u32, double>& seed_weight, double& all_sum)
+{
+	if (config().exec_cost == 0)
+		return;
+
+	vector<pair<double*, double>> costs;
+	costs.reserve(seed_weight.size());
+	double log_sum = 0;
+	for (auto& sw : seed_weight)
+	{
+		u64 exec_us = get_seed_exec_us(g()->afl, sw.first);
+		if (exec_us == 0)
+			continue;
+		costs.emplace_back(&sw.second, log((double)exec_us));
+		log_sum += costs.back().second;
+	}
+	if (costs.empty())
+		return;
+
+	const double log_mean = log_sum / costs.size();
+	for (const auto& c : costs)
+	{
+		double w = *c.first * exp((log_mean - c.second) * config().exec_cost);
+		all_sum += w - *c.first;
+		*c.first = w;
+	}
+}
+
 template <typename F, typename D>
 void FringeBlocks<F, D>::assign_energy(
 	u32 num_seeds, const u32* ss, double* ret) const
@@ -1698,31 +3371,26 @@ void FringeBlocks<F, D>::assign_energy(
 		seed_to_idx.emplace(ss[i], i);
 	assert(seed_to_idx.size() == num_seeds);
 
-	vector<pair<reach_t, rh::unordered_set<reach_t>>> target_fringes;
-
-	for (reach_t t = 0; t < target_to_fringes.size(); ++t)
-	{ // Iterate all targets with any fringes
-		const auto& tf = target_to_fringes[t];
-		if (tf.empty())
-			continue;
-
-		// Record all fringes a target has
-		rh::unordered_set<reach_t> fringes;
-		for (const F& f : tf)
-			fringes.insert(f.block);
-		target_fringes.emplace_back(t, std::move(fringes));
-	}
-
 	// Map fringe block to weight being allocated from targets
-	rh::unordered_map<reach_t, double> block_weight;
-	for (const auto& e : target_fringes)
+	// with any fringes
+	vector<reach_t> active_targets;
+	for (reach_t t = 0; t < target_to_fringes.size(); ++t)
 	{
-		dist_block_ratio(
-			e.second, e.first, g->get_tw(e.first), block_weight);
+		if (!target_to_fringes[t].empty())
+			active_targets.push_back(t);
 	}
+	// Update cached ratios of each target in parallel, they are independent
+	workers().run(active_targets.size(), [&](size_t i, size_t)
+	{
+		block_ratios(active_targets[i]);
+	});
+	rh::unordered_map<reach_t, double> block_weight;
+	for (reach_t t : active_targets)
+		dist_rare_block_weight(block_ratios(t), g()->get_tw(t), block_weight);
 
 	rh::unordered_map<u32, double> seed_weight; double all_sum;
 	tie(seed_weight, all_sum) = assign_seed(block_weight, seed_to_idx);
+	weight_exec_cost(seed_weight, all_sum);
 
 	// Original seed ratio, used for output only
 	rh::unordered_map<u32, double> seed_ratio;
@@ -1730,24 +3398,15 @@ void FringeBlocks<F, D>::assign_energy(
 		seed_ratio.emplace(sw.first, sw.second / all_sum);
 
 	const double total = max<double>(
-		num_active_seeds * config.linear_cycle_energy, config.cycle_energy);
-	trim_new_cvx(seed_weight, all_sum, total);
-	auto sol = solve_new_cvx(seed_weight, all_sum, total);
+		num_active_seeds() * config().linear_cycle_energy,
+		config().cycle_energy);
+	auto sol = solve_new_cvx(seed_weight, total);
 
 	fill(ret, ret + num_seeds, 0.0);
 	for (const auto& se : sol)
 		ret[seed_to_idx.find(se.first)->second] = se.second;
 
-	record_new_cvx_opt(target_fringes, block_weight, seed_ratio, sol);
-}
-
-rh::unordered_set<reach_t> strip_ctx(const rh::unordered_set<Fringe>& from)
-{
-	// Record all blocks a target has
-	rh::unordered_set<reach_t> blocks;
-	for (const Fringe& f : from)
-		blocks.insert(f.block);
-	return blocks;
+	record_new_cvx_opt(active_targets, block_weight, seed_ratio, sol);
 }
 
 void sum_seed_weight(
@@ -1761,6 +3420,7 @@ void sum_seed_weight(
 
 void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 {
+	PhaseTimer timer(AFLRUN_PHASE_ENERGY);
 	// Map seed to index to the return array
 	rh::unordered_map<u32, u32> seed_to_idx;
 	for (u32 i = 0; i < num_seeds; ++i)
@@ -1769,20 +3429,46 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 
 	constexpr size_t kNumTypes = 3;
 	// [0]: ctx_fringes; [1]: pro_fringes; [2]: targets
-	using FringeEach = array<rh::unordered_set<reach_t>, kNumTypes>;
+	using FringeEach = array<const vector<pair<reach_t, double>>*, kNumTypes>;
 	vector<pair<reach_t, FringeEach>> target_fringes;
-	for (reach_t t = 0; t < g->num_targets; ++t)
-	{ // For each target, we get its fringes from all 3 types, if any
-		FringeEach tf;
-		if (config.unite_ratio[1] > 0)
-			tf[0] = strip_ctx(path_fringes->target_to_fringes[t]);
-		if (config.unite_ratio[2] > 0)
-			tf[1] = strip_ctx(path_pro_fringes->target_to_fringes[t]);
-		if (config.unite_ratio[3] > 0)
-			tf[2] = strip_ctx(reached_targets->target_to_fringes[t]);
+	// Update cached ratios used below in parallel, for all types and targets
+	workers().run(kNumTypes * g()->num_targets, [](size_t i, size_t)
+	{
+		reach_t t = i % g()->num_targets;
+		switch (i / g()->num_targets)
+		{
+		case 0:
+			if (config().unite_ratio[1] > 0 &&
+				!path_fringes()->target_to_fringes[t].empty())
+				path_fringes()->block_ratios(t);
+			break;
+		case 1:
+			if (config().unite_ratio[2] > 0 &&
+				!path_pro_fringes()->target_to_fringes[t].empty())
+				path_pro_fringes()->block_ratios(t);
+			break;
+		default:
+			if (config().unite_ratio[3] > 0 &&
+				!reached_targets()->target_to_fringes[t].empty())
+				reached_targets()->block_ratios(t);
+			break;
+		}
+	});
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+	{ // For each target, we get its fringe ratios from all 3 types, if any
+		FringeEach tf = {nullptr, nullptr, nullptr};
+		if (config().unite_ratio[1] > 0 &&
+			!path_fringes()->target_to_fringes[t].empty())
+			tf[0] = &path_fringes()->block_ratios(t);
+		if (config().unite_ratio[2] > 0 &&
+			!path_pro_fringes()->target_to_fringes[t].empty())
+			tf[1] = &path_pro_fringes()->block_ratios(t);
+		if (config().unite_ratio[3] > 0 &&
+			!reached_targets()->target_to_fringes[t].empty())
+			tf[2] = &reached_targets()->block_ratios(t);
 
 		// If the target has no block in any of these, skip it
-		if (tf[0].empty() && tf[1].empty() && tf[2].empty())
+		if (tf[0] == nullptr && tf[1] == nullptr && tf[2] == nullptr)
 			continue;
 
 		target_fringes.emplace_back(t, std::move(tf));
@@ -1795,8 +3481,8 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 		array<double, kNumTypes> type_weights; double sum = 0;
 		for (size_t i = 0; i < kNumTypes; ++i)
 		{
-			double ratio = config.unite_ratio[i + 1];
-			if (e.second[i].empty() || ratio == 0)
+			double ratio = config().unite_ratio[i + 1];
+			if (e.second[i] == nullptr || ratio == 0)
 			{ // For each non-active type, we skip it by setting weight to zero.
 				type_weights[i] = 0;
 			}
@@ -1809,7 +3495,7 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 		assert(sum > 0);
 
 		// Assign `type_weights` from `tw` according to the ratio
-		double tw = g->get_tw(e.first);
+		double tw = g()->get_tw(e.first);
 		for (size_t i = 0; i < kNumTypes; ++i)
 		{
 			type_weights[i] = tw * type_weights[i] / sum;
@@ -1835,8 +3521,7 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 			double ttw = ttw_it->second[i];
 			if (ttw == 0) // Skip non-active targets
 				continue;
-			dist_block_ratio(
-				tf_it->second[i], tf_it->first, ttw, block_weights[i]);
+			dist_rare_block_weight(*tf_it->second[i], ttw, block_weights[i]);
 		}
 	}
 
@@ -1845,13 +3530,13 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 	array<rh::unordered_map<u32, double>, kNumTypes + 1> type_seed_weight;
 	double type_sum[kNumTypes + 1];
 	tie(type_seed_weight[0], type_sum[0]) =
-		path_fringes->assign_seed(block_weights[0], seed_to_idx);
+		path_fringes()->assign_seed(block_weights[0], seed_to_idx);
 	sum_seed_weight(seed_weight, all_sum, type_seed_weight[0], type_sum[0]);
 	tie(type_seed_weight[1], type_sum[1]) =
-		path_pro_fringes->assign_seed(block_weights[1], seed_to_idx);
+		path_pro_fringes()->assign_seed(block_weights[1], seed_to_idx);
 	sum_seed_weight(seed_weight, all_sum, type_seed_weight[1], type_sum[1]);
 	tie(type_seed_weight[2], type_sum[2]) =
-		reached_targets->assign_seed(block_weights[2], seed_to_idx);
+		reached_targets()->assign_seed(block_weights[2], seed_to_idx);
 	sum_seed_weight(seed_weight, all_sum, type_seed_weight[2], type_sum[2]);
 
 	// Calculate total weight for coverage background according to ratios
@@ -1860,8 +3545,8 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 	{
 		if (type_sum[i] > 0)
 		{
-			double ratio = config.unite_ratio[i + 1]; assert(ratio > 0);
-			type_sum[3] += type_sum[i] * config.unite_ratio[0] / ratio;
+			double ratio = config().unite_ratio[i + 1]; assert(ratio > 0);
+			type_sum[3] += type_sum[i] * config().unite_ratio[0] / ratio;
 			++count;
 		}
 	}
@@ -1885,6 +3570,8 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 		}
 	}
 
+	weight_exec_cost(seed_weight, all_sum);
+
 	// Original seed ratio, used for output only
 	rh::unordered_map<u32, double> seed_ratio;
 	for (const auto& sw : seed_weight)
@@ -1893,9 +3580,9 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 	// Finally we get the correct `seed_weight` just like before,
 	// we solve it as the final energy assignment.
 	const double total = max<double>(
-		num_active_seeds * config.linear_cycle_energy, config.cycle_energy);
-	trim_new_cvx(seed_weight, all_sum, total);
-	auto sol = solve_new_cvx(seed_weight, all_sum, total);
+		num_active_seeds() * config().linear_cycle_energy,
+		config().cycle_energy);
+	auto sol = solve_new_cvx(seed_weight, total);
 
 	fill(ret, ret + num_seeds, 0.0);
 	for (const auto& se : sol)
@@ -1905,21 +3592,23 @@ void assign_energy_unite(u32 num_seeds, const u32* ss, double* ret)
 		type_seed_weight, type_sum, seed_ratio, sol);
 }
 
-unique_ptr<AFLRunGraph> graph = nullptr;
+unique_ptr<AFLRunGraph>& graph();
 
-rh::unordered_map<reach_t, double> bb_to_avg_dists;
+// Average distance of each block among all targets it reaches
+vector<double>& bb_to_avg_dists();
 
-rh::unordered_map<string, reach_t> name_to_id, fname_to_id;
-vector<string> id_to_fname;
+// Blocks farther than `AFLRUN_CTX_RADIUS` from all targets, which aflrun-pass
+// instruments with context 0; empty if all blocks have contexts.
+vector<bool>& no_ctx_blocks();
 
-// Array of traces for each target
-// e.g. (*all_exec_paths[id])[target].data()
-vector<unique_ptr<reach_t[]>> all_exec_paths;
+rh::unordered_map<string, reach_t>& name_to_id();
+rh::unordered_map<string, reach_t>& fname_to_id();
+vector<string>& id_to_fname();
 
 template <>
 inline void log_fringe<Fringe>(ostream& out, const Fringe& f)
 {
-	if (f.block == g->num_reachables)
+	if (f.block == g()->num_reachables)
 	{ // For printing cluster only
 		assert(f.context == 0);
 		out << "primary";
@@ -1928,14 +3617,41 @@ inline void log_fringe<Fringe>(ostream& out, const Fringe& f)
 	{
 		char hex_buf[4];
 		snprintf(hex_buf, sizeof(hex_buf), "%.2X", f.context);
-		out << g->reachable_names[f.block] << ',' << hex_buf;
+		out << g()->reachable_names[f.block] << ',' << hex_buf;
 	}
 }
 
 template <>
 inline void log_fringe<reach_t>(ostream& out, const reach_t& f)
 {
-	out << g->reachable_names[f];
+	out << g()->reachable_names[f];
+}
+
+template <typename F>
+void SeedsLog::log(u32 seed, const rh::unordered_set<F>& fringes)
+{
+	if (config().seeds_log_bin)
+	{
+		write_bin<u32>(seed);
+		write_bin<u32>(fringes.size());
+		for (const Fringe& f : fringes)
+		{
+			write_bin<u32>(f.block);
+			write_bin<u32>(f.context);
+		}
+	}
+	else
+	{
+		buf << seed << " | ";
+		for (const auto& f : fringes)
+		{
+			log_fringe<F>(buf, f); buf << ' ';
+		}
+		buf << '\n';
+	}
+	if (static_cast<size_t>(buf.tellp()) >= kMaxBuffered ||
+		get_cur_time() - last_flush >= config().seeds_log_interval * 1000)
+		flush();
 }
 
 // template<typename F>
@@ -1995,27 +3711,342 @@ public:
 	}
 };
 
+// Maps of clusters are mostly never written, so their pages are only
+// allocated on first write: a map reading as 0 is private anonymous memory,
+// and a map reading as 0xff is a private view of one shared file of 0xff,
+// whose pages are copied on write. Only pages that were written count in
+// `lazy_resident`, which falls back to the whole map where this is unknown.
+void* lazy_alloc(size_t bytes, bool ones)
+{
+	void* ret = MAP_FAILED;
+#ifdef __linux__
+	// The file is shared by all instances, which may allocate at once
+	static mutex m; static int fd = -1; static size_t fd_size = 0;
+	lock_guard<mutex> lock(m);
+	if (ones && fd < 0)
+	{
+#ifdef MFD_CLOEXEC
+		fd = memfd_create("aflrun_virgin", MFD_CLOEXEC);
+#else
+		char path[] = "/tmp/aflrun_virgin.XXXXXX";
+		fd = mkstemp(path);
+		if (fd >= 0) { unlink(path); fcntl(fd, F_SETFD, FD_CLOEXEC); }
+#endif
+	}
+	if (ones && fd >= 0 && fd_size < bytes)
+	{
+		vector<u8> buf(bytes - fd_size, 0xff);
+		if (pwrite(fd, buf.data(), buf.size(), fd_size) == (ssize_t)buf.size())
+			fd_size = bytes;
+	}
+	if (ones && fd >= 0 && fd_size >= bytes)
+		ret = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+#endif
+	if (ret == MAP_FAILED)
+	{
+		ret = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ret == MAP_FAILED)
+			throw bad_alloc();
+		if (ones)
+			memset(ret, 0xff, bytes);
+	}
+	return ret;
+}
+
+struct LazyFree
+{
+	size_t bytes = 0;
+	void operator()(void* p) const
+	{
+		if (p) munmap(p, bytes);
+	}
+};
+
+template <typename T>
+using lazy_ptr = unique_ptr<T[], LazyFree>;
+
+template <typename T>
+lazy_ptr<T> lazy_new(size_t num, bool ones)
+{
+	size_t bytes = num * sizeof(T);
+	return lazy_ptr<T>(
+		reinterpret_cast<T*>(lazy_alloc(bytes, ones)), LazyFree{bytes});
+}
+
+template <typename T>
+size_t lazy_resident(const lazy_ptr<T>& p)
+{
+	if (p == nullptr)
+		return 0;
+	size_t bytes = p.get_deleter().bytes;
+#ifdef __linux__
+	// Count pages present or swapped, exclusively mapped and not file pages,
+	// i.e. the ones written, see Documentation/admin-guide/mm/pagemap.rst
+	static int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	static const size_t page = sysconf(_SC_PAGESIZE);
+	size_t first = reinterpret_cast<size_t>(p.get()) / page;
+	size_t num = (bytes + page - 1) / page;
+	vector<u64> entries(num);
+	if (fd >= 0 && pread(fd, entries.data(), num * sizeof(u64),
+		first * sizeof(u64)) == (ssize_t)(num * sizeof(u64)))
+	{
+		size_t ret = 0;
+		for (u64 e : entries)
+		{
+			bool present = (e >> 63) & 1, swapped = (e >> 62) & 1;
+			bool file = (e >> 61) & 1, exclusive = (e >> 56) & 1;
+			ret += swapped || (present && exclusive && !file);
+		}
+		return min(ret * page, bytes);
+	}
+#endif
+	return bytes;
+}
+
+// Bytes of the primary map covered by cluster maps, see `ClusterVirgins`
+u32& window_lo();
+u32& window_hi();
+
+// Storage of virgin maps for all clusters, where index 0 is the primary map
+// that is not stored here. In normal mode each cluster owns a separate map;
+// in interleaved mode every `kLanes` clusters share a block laid out as
+// [map_words][kLanes], so word `idx` of these clusters is in one cache line.
+// Cluster maps only cover bytes [window_lo, window_hi) of the primary map,
+// which is all of it unless the binary numbers edges of reachable functions
+// contiguously (AFLRUN_EDGE_WINDOW); edges out of it are never new to them.
+class ClusterVirgins
+{
+public:
+	static constexpr size_t kLanes = 8;
+private:
+	vector<lazy_ptr<u64>> maps; // separate map or interleaved block
+	vector<bool> valid_maps;
+	vector<u8> num_lanes; // number of valid lanes for each block
+	size_t num_maps;
+
+public:
+	ClusterVirgins() : valid_maps(1, true), num_maps(1) {}
+
+	// Align the window loaded by `aflrun_load_window` to 64 bytes, which keeps
+	// words of maps and of `TOPS_INDEX` whole, or cover whole map if unset
+	static void set_window(u32 map_size)
+	{
+		if (window_lo() >= window_hi() || window_hi() > map_size)
+		{
+			window_lo() = 0; window_hi() = map_size;
+			return;
+		}
+		window_lo() &= ~63u;
+		window_hi() = min<u32>(map_size, (window_hi() + 63) & ~63u);
+	}
+
+	static inline size_t window_size()
+	{
+		return window_hi() - window_lo();
+	}
+
+	// First word of the primary map in the window, and number of words
+	static inline size_t lo_word()
+	{
+		return window_lo() / sizeof(u64);
+	}
+	static inline size_t num_words()
+	{
+		return (window_size() + sizeof(u64) - 1) / sizeof(u64);
+	}
+
+	// Stride between consecutive words of a cluster map, in number of `u64`
+	static inline size_t stride()
+	{
+		return config().interleave_virgins ? kLanes : 1;
+	}
+
+	size_t size() const
+	{
+		return num_maps;
+	}
+
+	bool valid(size_t cluster) const
+	{
+		return valid_maps[cluster];
+	}
+
+	// Append a new cluster map filled with 0xff
+	void add()
+	{
+		size_t c = num_maps++;
+		valid_maps.push_back(true);
+		if (!config().interleave_virgins)
+		{
+			maps.resize(c);
+			maps.push_back(lazy_new<u64>(num_words(), true));
+			return;
+		}
+		size_t b = c / kLanes;
+		if (b >= maps.size())
+		{
+			maps.resize(b + 1);
+			num_lanes.resize(b + 1, 0);
+		}
+		if (maps[b] == nullptr)
+		{ // Grow storage in blocks of `kLanes` clusters
+			maps[b] = lazy_new<u64>(num_words() * kLanes, true);
+		}
+		++num_lanes[b];
+	}
+
+	// Invalidate the cluster map; interleaved block is freed with its last lane.
+	void remove(size_t cluster)
+	{
+		if (cluster == 0 || !valid_maps[cluster])
+			return;
+		valid_maps[cluster] = false;
+		if (!config().interleave_virgins)
+		{
+			maps[cluster] = nullptr;
+			return;
+		}
+		size_t b = cluster / kLanes;
+		if (--num_lanes[b] == 0)
+			maps[b] = nullptr;
+	}
+
+	size_t mem() const
+	{
+		size_t ret = vec_mem(maps) + vec_mem(num_lanes);
+		for (const auto& m : maps)
+			ret += lazy_resident(m);
+		return ret;
+	}
+
+	// And the map of `src` into the map of `dst`, so that `dst` has seen what
+	// any of both has seen; only words that change are written, which keeps
+	// pages of `dst` that `src` does not add anything to unallocated.
+	void merge(size_t src, size_t dst)
+	{
+		assert(src != 0 && dst != 0 && valid(src) && valid(dst));
+		const u64* s = reinterpret_cast<const u64*>(get(src));
+		u64* d = reinterpret_cast<u64*>(get(dst));
+		size_t n = num_words(), i = 0;
+		if (!config().interleave_virgins)
+		{
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+			for (; i + 8 <= n; i += 8)
+			{
+				__m512i vd = _mm512_loadu_si512(d + i);
+				__m512i vm = _mm512_and_si512(_mm512_loadu_si512(s + i), vd);
+				__mmask8 diff = _mm512_cmpneq_epi64_mask(vm, vd);
+				if (unlikely(diff))
+					_mm512_mask_storeu_epi64(d + i, diff, vm);
+			}
+#elif defined(__AVX2__)
+			for (; i + 4 <= n; i += 4)
+			{
+				__m256i vs = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(s + i));
+				__m256i vd = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(d + i));
+				if (unlikely(!_mm256_testc_si256(vs, vd)))
+				{
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i),
+						_mm256_and_si256(vs, vd));
+				}
+			}
+#endif
+		}
+		const size_t st = stride();
+		for (; i < n; ++i)
+		{
+			u64 w = d[i * st] & s[i * st];
+			if (w != d[i * st])
+				d[i * st] = w;
+		}
+	}
+
+	// Written bytes of the cluster map, sharing interleaved block among lanes
+	size_t mem(size_t cluster) const
+	{
+		if (!config().interleave_virgins)
+			return lazy_resident(maps[cluster]);
+		size_t b = cluster / kLanes;
+		return lazy_resident(maps[b]) / num_lanes[b];
+	}
+
+	// Return view of the cluster map, whose word `i` is at `i * stride()`,
+	// for word `i + lo_word()` of the primary map.
+	u8* get(size_t cluster) const
+	{
+		if (!config().interleave_virgins)
+			return reinterpret_cast<u8*>(maps[cluster].get());
+		return reinterpret_cast<u8*>(
+			maps[cluster / kLanes].get() + cluster % kLanes);
+	}
+};
+
+
 template<typename F>
 class Clusters
 {
 private:
+	// Each target maps to the cluster it was put in, which is a node of a
+	// union-find forest whose root tells in `uf_cluster` the valid cluster
+	// it now belongs to, so merging never rewrites `target_to_idx`.
 	rh::unordered_map<F, size_t> target_to_idx;
 	vector<rh::unordered_set<F>> clusters; // Reverse of `target_to_idx`
-	vector<unique_ptr<u8[]>> cluster_maps;
-	vector<unique_ptr<void*[]>> cluster_tops;
+	mutable vector<size_t> uf_parent;
+	vector<size_t> uf_size, uf_cluster;
+	ClusterVirgins cluster_maps;
+	vector<lazy_ptr<void*>> cluster_tops;
 
 	// Each pair of the vector stores 64 `and` bit sequences corresponding to
 	// each virgin map including the primary map, and first `u64` is a `or`
-	// value of all values in the `vector`, so we don't need to consider 0 seqs.
-	vector<pair<u64, unique_ptr<vector<u64>>>> and_bit_seqs;
+	// value of all values in the sequence, so we don't need to consider 0 seqs.
+	// Second element is offset of the sequence in `bit_seq_arena`, which is a
+	// bump arena reset at each `commit_bit_seqs` to avoid allocation per word.
+	vector<pair<u64, size_t>> and_bit_seqs;
+	vector<u64> bit_seq_arena;
+	vector<u64> bit_seq_counts; // Sequences each cluster is in, at commit
 
 	// Support count for single target or a pair of targets
 	rh::unordered_map<ClusterPair, double> pair_supp_cnt;
 	vector<double> supp_cnt;
 
+	// Time of last new bits of each cluster, or of its creation, and whether
+	// any cluster is created since `cluster_mem_budget` was last enforced.
+	vector<u64> last_new;
+	bool budget_dirty = false;
+	size_t num_evicted = 0;
+
 	bool cluster_valid(size_t cluster) const
 	{
-		return cluster == 0 || cluster_maps[cluster] != nullptr;
+		return cluster == 0 || cluster_maps.valid(cluster);
+	}
+
+	// Root of union-find node `node`, halving the path on the way
+	size_t uf_find(size_t node) const
+	{
+		while (uf_parent[node] != node)
+		{
+			uf_parent[node] = uf_parent[uf_parent[node]];
+			node = uf_parent[node];
+		}
+		return node;
+	}
+
+	// Valid cluster that cluster `cluster` has been merged into, or itself
+	size_t resolve(size_t cluster) const
+	{
+		return uf_cluster[uf_find(cluster)];
+	}
+
+	// Add a new cluster to the forest, `cluster` must be its index
+	void uf_add(size_t cluster)
+	{
+		assert(cluster == uf_parent.size());
+		uf_parent.push_back(cluster);
+		uf_size.push_back(1);
+		uf_cluster.push_back(cluster);
 	}
 
 	// Merge cluster `src` to cluster `dst`;
@@ -2023,25 +4054,43 @@ private:
 	void merge_cluster(size_t src, size_t dst)
 	{
 		// `src` cannot be primary cluster, and cannot be invalid cluster
-		assert(src != dst && cluster_maps[src] != nullptr && cluster_valid(dst));
-		rh::unordered_set<F> src_cluster(std::move(clusters[src]));
-		for (F t : src_cluster)
-			target_to_idx.find(t)->second = dst;
-		clusters[dst].insert(src_cluster.begin(), src_cluster.end());
-		cluster_maps[src] = nullptr; cluster_tops[src] = nullptr;
+		assert(src != dst && src != 0 && cluster_valid(src) && cluster_valid(dst));
+
+		// Link the smaller tree under the larger one and label it with `dst`
+		size_t rs = uf_find(src), rd = uf_find(dst);
+		if (uf_size[rs] > uf_size[rd])
+			swap(rs, rd);
+		uf_parent[rs] = rd;
+		uf_size[rd] += uf_size[rs];
+		uf_cluster[rd] = dst;
+
+		// Insert the smaller member set into the larger one
+		if (clusters[src].size() > clusters[dst].size())
+			clusters[src].swap(clusters[dst]);
+		clusters[dst].insert(clusters[src].begin(), clusters[src].end());
+		rh::unordered_set<F>().swap(clusters[src]);
+
+		// Keep coverage and best seeds of `src` in `dst`, so seeds are not
+		// new again to the merged cluster; primary cluster has them already.
+		if (dst != 0)
+			cluster_maps.merge(src, dst);
+		merge_seed_tops(g()->afl,
+			dst != 0 ? cluster_tops[dst].get() : nullptr, cluster_tops[src].get());
+		cluster_maps.remove(src); cluster_tops[src] = nullptr;
 		// We don't clean support counts with `src` here,
 		// because they cannot be used again.
 	}
 
 	inline static bool supp_cnt_enough(double lhs, double both)
 	{
-		return config.single_supp_thr ?
-			lhs >= config.supp_cnt_thr : both >= config.supp_cnt_thr;
+		return config().single_supp_thr ?
+			lhs >= config().supp_cnt_thr : both >= config().supp_cnt_thr;
 	}
 
 	// Try to merge clusters, if any; return true iff merge happens
 	bool try_merge()
 	{
+		PhaseTimer timer(AFLRUN_PHASE_MERGE);
 		// Store each LHS->RHS to be merged and corresponding confidence value
 		rh::unordered_map<size_t, pair<size_t, double>> to_merge;
 
@@ -2055,7 +4104,7 @@ private:
 			if (supp_cnt_enough(snd_supp_cnt, p.second))
 			{
 				double conf = p.second / snd_supp_cnt;
-				if (conf >= config.conf_thr)
+				if (conf >= config().conf_thr)
 				{ // If snd->fst reach merge threshold, merge snd into fst
 					auto p2 = make_pair(fst, conf);
 					auto p3 = to_merge.emplace(snd, p2);
@@ -2073,7 +4122,7 @@ private:
 			if (supp_cnt_enough(fst_supp_cnt, p.second))
 			{
 				double conf = p.second / fst_supp_cnt;
-				if (conf >= config.conf_thr)
+				if (conf >= config().conf_thr)
 				{
 					auto p2 = make_pair(snd, conf);
 					auto p3 = to_merge.emplace(fst, p2);
@@ -2085,17 +4134,12 @@ private:
 
 		if (to_merge.empty()) return false;
 
-		// Todo: Merge may be optimized using Kosaraju's algorithm.
 		for (const auto& p : to_merge)
 		{
 			size_t src = p.first;
-			size_t dst = p.second.first;
-			// We are going to merge src to dst, but dst can already be invalid,
-			// so we need to walk to find a valid cluster to merge
-			while (!cluster_valid(dst))
-			{ // Walk through the graph until `dst` is valid
-				dst = to_merge.find(dst)->second.first;
-			}
+			// We are going to merge src to dst, but dst can already be merged
+			// into another cluster, which is the valid one to merge into
+			size_t dst = resolve(p.second.first);
 			// If they finally become same cluster, we don't merge
 			if (src != dst)
 				merge_cluster(src, dst);
@@ -2109,7 +4153,23 @@ private:
 public:
 
 	// Index 0 prepresent primary map, which is not stored here.
-	Clusters() : clusters(1), cluster_maps(1), cluster_tops(1), supp_cnt(1) {}
+	Clusters() : clusters(1), cluster_tops(1), supp_cnt(1), last_new(1)
+	{
+		uf_add(0);
+	}
+
+	// Top-rated map of a new cluster, covering the window of cluster maps
+	static lazy_ptr<void*> new_tops()
+	{
+		size_t win = ClusterVirgins::window_size();
+		return lazy_new<void*>(win + TOPS_INDEX_WORDS(win), false);
+	}
+
+	// Merge clusters whose counts reach thresholds lowered by `auto_tune`
+	void retry_merge()
+	{
+		while (try_merge()) {}
+	}
 
 	void clean_supp_cnts()
 	{
@@ -2138,23 +4198,24 @@ public:
 		auto res = target_to_idx.emplace(target, num_clusters);
 		if (res.second)
 		{
-			auto v = make_unique<u8[]>(g->map_size);
-			fill(v.get(), v.get() + g->map_size, 255);
-			cluster_maps.push_back(std::move(v));
-			cluster_tops.push_back(make_unique<void*[]>(g->map_size));
+			cluster_maps.add();
+			cluster_tops.push_back(new_tops());
 			clusters.emplace_back(initializer_list<F>{target});
+			uf_add(num_clusters);
 			supp_cnt.push_back(0);
+			last_new.push_back(get_cur_time());
+			budget_dirty = config().cluster_mem_budget != 0;
 			return num_clusters;
 		}
 		else
 		{
-			return res.first->second;
+			return resolve(res.first->second);
 		}
 	}
 	// Return virgin map of given cluster, cluster id must < num of clusters
 	u8* get_virgin_map(size_t cluster) const
 	{
-		return cluster_maps[cluster].get();
+		return cluster_maps.get(cluster);
 	}
 	void** get_top_rated(size_t cluster) const
 	{
@@ -2172,17 +4233,18 @@ public:
 	{
 		// Instead of get all top_rated maps,
 		// we only get ones corresponding to fringe blocks of current state.
-		const rh::unordered_map<reach_t, rh::unordered_set<Fringe>>* blocks;
+		const rh::unordered_flat_map<reach_t,
+			rh::unordered_flat_set<Fringe>>* blocks;
 		switch (mode)
 		{
 		case AFLRunState::kFringe:
-			blocks = &path_fringes->block_to_fringes;
+			blocks = &path_fringes()->block_to_fringes;
 			break;
 		case AFLRunState::kProFringe:
-			blocks = &path_pro_fringes->block_to_fringes;
+			blocks = &path_pro_fringes()->block_to_fringes;
 			break;
 		case AFLRunState::kTarget:
-			blocks = &reached_targets->block_to_fringes;
+			blocks = &reached_targets()->block_to_fringes;
 			break;
 		default:
 			abort();
@@ -2192,65 +4254,93 @@ public:
 		for (const auto& b : *blocks)
 		{
 			auto it = target_to_idx.find(b.first);
-			if (it == target_to_idx.end() || visited_clusters[it->second] ||
-				cluster_tops[it->second] == nullptr)
+			if (it == target_to_idx.end())
+				continue;
+			size_t c = resolve(it->second);
+			if (visited_clusters[c] || cluster_tops[c] == nullptr)
 				continue;
 
-			visited_clusters[it->second] = true;
-			ret_tops[idx++] = cluster_tops[it->second].get();
+			visited_clusters[c] = true;
+			ret_tops[idx++] = cluster_tops[c].get();
 		}
 		return idx;
 	}
-	void add_bit_seq(u64 or_all, unique_ptr<vector<u64>>&& seq)
+	// Allocate a zero sequence of `num` values at the end of the arena,
+	// the pointer is only valid until next allocation.
+	u64* alloc_bit_seq(size_t num)
+	{
+		size_t off = bit_seq_arena.size();
+		bit_seq_arena.resize(off + num, 0);
+		return bit_seq_arena.data() + off;
+	}
+	// Keep the last allocated sequence of `num` values
+	void add_bit_seq(u64 or_all, size_t num)
+	{
+		assert(bit_seq_arena.size() >= num);
+		and_bit_seqs.emplace_back(or_all, bit_seq_arena.size() - num);
+	}
+	// Discard the last allocated sequence of `num` values
+	void drop_bit_seq(size_t num)
 	{
-		and_bit_seqs.emplace_back(or_all, std::move(seq));
+		assert(bit_seq_arena.size() >= num);
+		bit_seq_arena.resize(bit_seq_arena.size() - num);
 	}
 	void commit_bit_seqs(const size_t* clusters, size_t num)
 	{
 		if (and_bit_seqs.empty()) return;
 
-		// Sequences representing all ones in bit arrays
-		vector<vector<size_t>> sequences;
-
+		// Bit `i` of word `j` of a sequence is set iff cluster `clusters[j]`
+		// is in its `i`th `and` sequence, so support counts are popcounts of
+		// words, and pair support counts popcounts of `and` of two words.
+		const u64* arena = bit_seq_arena.data();
+		size_t num_seqs = 0;
 		for (const auto& seq : and_bit_seqs)
 		{
-			u64 or_all = seq.first;
-			assert(seq.second->size() == num);
-			for (size_t i = 0; or_all != 0; ++i, or_all >>= 1)
-			{ // Iterate each bit of `or_all`, and process these `1` bits
-				if ((or_all & 1) == 0)
-					continue;
-
-				vector<size_t> sequence;
-				size_t j = 0; auto it = seq.second->begin();
-				for (; it != seq.second->end(); ++it, ++j)
-				{ // Iterate bit sequence `i`
-					if (((*it) & (1uLL << i)) != 0uLL)
-					{
-						sequence.push_back(clusters[j]);
-					}
-				}
-				assert(!sequence.empty()); // Sequence must have at least one `1`
-				sequences.push_back(std::move(sequence));
-			}
+			assert(seq.second + num <= bit_seq_arena.size());
+			num_seqs += __builtin_popcountll(seq.first);
 		}
-		and_bit_seqs.clear();
 		// If count using seed, we should deem each sequence as a factor count.
-		double w_each = config.count_seed ? 1.0 / sequences.size() : 1.0;
+		double w_each = config().count_seed ? 1.0 / num_seqs : 1.0;
 
 		bool if_try = false;
-		for (const auto& seq : sequences)
-		{
-			for (auto i = seq.begin(); i != seq.end(); ++i)
-			{ // For each cluster, increment support count
-				double cnt_after = (supp_cnt[*i] += w_each);
-				if_try = if_try || cnt_after >= config.supp_cnt_thr;
-				for (auto j = i + 1; j != seq.end(); ++j)
-				{ // For each cluster pair, increment pair support count
-					pair_supp_cnt[ClusterPair(*i, *j)] += w_each;
+		u64 now = get_cur_time();
+		bit_seq_counts.assign(num, 0);
+		for (size_t j = 0; j < num; ++j)
+		{ // For each cluster, increment support count
+			u64 cnt = 0;
+			for (const auto& seq : and_bit_seqs)
+				cnt += __builtin_popcountll(arena[seq.second + j]);
+			bit_seq_counts[j] = cnt;
+			if (cnt == 0)
+				continue;
+			last_new[clusters[j]] = now;
+			double cnt_after = (supp_cnt[clusters[j]] += w_each * cnt);
+			if_try = if_try || cnt_after >= config().supp_cnt_thr;
+		}
+		for (size_t j1 = 0; j1 < num; ++j1)
+		{ // For each cluster pair, increment pair support count once
+			if (bit_seq_counts[j1] == 0)
+				continue;
+			for (size_t j2 = j1 + 1; j2 < num; ++j2)
+			{
+				if (bit_seq_counts[j2] == 0)
+					continue;
+				u64 cnt = 0;
+				for (const auto& seq : and_bit_seqs)
+				{
+					cnt += __builtin_popcountll(
+						arena[seq.second + j1] & arena[seq.second + j2]);
+				}
+				if (cnt != 0)
+				{
+					pair_supp_cnt[ClusterPair(clusters[j1], clusters[j2])] +=
+						w_each * cnt;
 				}
 			}
 		}
+		// Reset the arena but keep its capacity for next execution
+		and_bit_seqs.clear();
+		bit_seq_arena.clear();
 
 		if (if_try)
 		{ // Only try to merge if there is any support count >= threshold
@@ -2258,43 +4348,181 @@ public:
 		}
 
 	}
-	// Move `b` from its cluster to primary cluster,
-	// if original cluster becomes empty, remove the cluster.
-	void invalidate_div_block(F b)
+	// Written bytes of virgin and top-rated maps of the cluster
+	size_t cluster_mem(size_t cluster) const
 	{
-		// Find corresponding cluster
-		auto it = target_to_idx.find(b);
-		auto& cluster = clusters[it->second];
-		assert(cluster.find(b) != cluster.end());
-
-		// Move `b` to primary map
-		cluster.erase(b);
-		clusters.front().insert(b);
+		return cluster_maps.mem(cluster) + lazy_resident(cluster_tops[cluster]);
+	}
+	// Merge clusters into primary cluster, ones without new bits for longest
+	// and then ones with least support count first, until written pages of
+	// maps of the rest fit in `cluster_mem_budget`; this must only be called
+	// where maps can be freed, as with `try_merge`.
+	void enforce_budget()
+	{
+		if (!budget_dirty)
+			return;
+		budget_dirty = false;
+		size_t budget = config().cluster_mem_budget << 20;
+		size_t win = ClusterVirgins::window_size();
+		size_t per_cluster = ClusterVirgins::num_words() * sizeof(u64) +
+			sizeof(void*) * (win + TOPS_INDEX_WORDS(win));
+
+		vector<size_t> valid;
+		for (size_t c = 1; c < clusters.size(); ++c)
+		{
+			if (cluster_valid(c))
+				valid.push_back(c);
+		}
+		if (valid.size() * per_cluster <= budget)
+			return; // Fits even if all pages were written
+		size_t total = 0;
+		for (size_t c : valid)
+			total += cluster_mem(c);
+		if (total <= budget)
+			return;
 
-		if (cluster.empty())
-		{ // If it is the last seed in the corpus, we remove the cluster
-			cluster_maps[it->second] = nullptr;
-			cluster_tops[it->second] = nullptr;
+		sort(valid.begin(), valid.end(), [this](size_t lhs, size_t rhs)
+		{
+			return last_new[lhs] != last_new[rhs] ?
+				last_new[lhs] < last_new[rhs] : supp_cnt[lhs] < supp_cnt[rhs];
+		});
+		for (size_t i = 0; i < valid.size() && total > budget; ++i)
+		{
+			total -= min(total, cluster_mem(valid[i]));
+			merge_cluster(valid[i], 0);
+			++num_evicted;
 		}
-		it->second = 0;
+		clean_supp_cnts();
 	}
-	void remove_div_block(F b)
-	{ // To remove a div block, we need delete corresponding `target_to_idx`.
-		// If final cluster is also empty, we delete the cluster.
-
+	size_t get_num_evicted() const
+	{
+		return num_evicted;
+	}
+	void save(SchedulerCheckpoint& ckpt) const
+	{
+		ckpt.cluster_valid.clear(); ckpt.cluster_members.clear();
+		for (size_t c = 0; c < clusters.size(); ++c)
+		{
+			ckpt.cluster_valid.push_back(cluster_valid(c));
+			ckpt.cluster_members.emplace_back();
+			for (const F& t : clusters[c])
+				ckpt.cluster_members.back().push_back(checkpoint_key(t));
+		}
+		ckpt.supp_cnt = supp_cnt;
+		ckpt.pair_supp_cnt.clear();
+		for (const auto& p : pair_supp_cnt)
+		{
+			ckpt.pair_supp_cnt.push_back(
+				{p.first.get_fst(), p.first.get_snd(), p.second});
+		}
+		ckpt.num_evicted = num_evicted;
+	}
+	// Recreate clusters of the checkpoint with empty virgin maps, before any
+	// cluster is created, so that seeds of dry run meet merged clusters.
+	void restore_members(const SchedulerCheckpoint& ckpt)
+	{
+		assert(clusters.size() == 1 && target_to_idx.empty());
+		for (size_t c = 0; c < ckpt.cluster_members.size(); ++c)
+		{
+			if (c > 0)
+			{
+				cluster_maps.add();
+				cluster_tops.push_back(new_tops());
+				clusters.emplace_back();
+				uf_add(c);
+				supp_cnt.push_back(0);
+				last_new.push_back(get_cur_time());
+				if (!ckpt.cluster_valid[c])
+				{
+					cluster_maps.remove(c); cluster_tops[c] = nullptr;
+				}
+			}
+			for (u64 k : ckpt.cluster_members[c])
+			{
+				F t = from_checkpoint_key<F>(k);
+				clusters[c].insert(t);
+				target_to_idx[t] = c;
+			}
+		}
+		budget_dirty = config().cluster_mem_budget != 0;
+	}
+	// Replace support counts of restored clusters, which dry run has counted
+	// again, by those of the checkpoint.
+	void restore_counts(const SchedulerCheckpoint& ckpt)
+	{
+		size_t n = min(ckpt.supp_cnt.size(), supp_cnt.size());
+		copy(ckpt.supp_cnt.begin(), ckpt.supp_cnt.begin() + n, supp_cnt.begin());
+		vector<ClusterPair> to_remove;
+		for (const auto& p : pair_supp_cnt)
+		{
+			if (p.first.get_snd() < n)
+				to_remove.push_back(p.first);
+		}
+		for (const auto& p : to_remove)
+			pair_supp_cnt.erase(p);
+		for (const auto& p : ckpt.pair_supp_cnt)
+		{
+			if (p.snd < n)
+				pair_supp_cnt[ClusterPair(p.fst, p.snd)] = p.cnt;
+		}
+		clean_supp_cnts();
+		num_evicted += ckpt.num_evicted;
+	}
+	// Move `b` from its cluster to primary cluster,
+	// if original cluster becomes empty, remove the cluster.
+	void invalidate_div_block(F b)
+	{
+		// Find corresponding cluster
+		auto it = target_to_idx.find(b);
+		size_t c = resolve(it->second);
+		auto& cluster = clusters[c];
+		assert(cluster.find(b) != cluster.end());
+
+		// Move `b` to primary map
+		cluster.erase(b);
+		clusters.front().insert(b);
+
+		if (cluster.empty())
+		{ // If it is the last seed in the corpus, we remove the cluster
+			cluster_maps.remove(c);
+			cluster_tops[c] = nullptr;
+		}
+		it->second = 0;
+	}
+	void remove_div_block(F b)
+	{ // To remove a div block, we need delete corresponding `target_to_idx`.
+		// If final cluster is also empty, we delete the cluster.
+
 		// Find corresponding cluster
 		auto it = target_to_idx.find(b);
-		auto& cluster = clusters[it->second];
+		size_t c = resolve(it->second);
+		auto& cluster = clusters[c];
 		assert(cluster.find(b) != cluster.end());
 
 		cluster.erase(b);
 		if (cluster.empty())
 		{
-			cluster_maps[it->second] = nullptr;
-			cluster_tops[it->second] = nullptr;
+			cluster_maps.remove(c);
+			cluster_tops[c] = nullptr;
 		}
 		target_to_idx.erase(it);
 	}
+	void mem(size_t* ret) const
+	{
+		ret[AFLRUN_MEM_VIRGINS] += cluster_maps.mem();
+		size_t& tm = ret[AFLRUN_MEM_TOPS];
+		tm += vec_mem(cluster_tops);
+		for (const auto& t : cluster_tops)
+			tm += lazy_resident(t);
+		size_t& cm = ret[AFLRUN_MEM_CLUSTERS];
+		cm += hash_mem(target_to_idx) + vec_mem(clusters) +
+			vec_mem(uf_parent) + vec_mem(uf_size) + vec_mem(uf_cluster) +
+			hash_mem(pair_supp_cnt) + vec_mem(supp_cnt) +
+			vec_mem(and_bit_seqs) + vec_mem(bit_seq_arena) +
+			vec_mem(bit_seq_counts);
+		for (const auto& c : clusters)
+			cm += hash_mem(c);
+	}
 	void print(ostream& out) const
 	{
 		out << "Clusters" << endl;
@@ -2331,7 +4559,7 @@ public:
 };
 
 #ifdef AFLRUN_CTX_DIV
-Clusters<Fringe> clusters;
+Clusters<Fringe>& clusters();
 inline Fringe to_cluster_target(const ctx_t* t)
 {
 	return Fringe(t->block, t->call_ctx);
@@ -2341,7 +4569,7 @@ inline Fringe to_cluster_target(const Fringe& t)
 	return t;
 }
 #else
-Clusters<reach_t> clusters;
+Clusters<reach_t>& clusters();
 inline reach_t to_cluster_target(const ctx_t* t)
 {
 	return t->block;
@@ -2360,7 +4588,7 @@ struct DiversityBlocks
 	rh::unordered_map<u32, rh::unordered_set<F>> seed_blocks;
 
 	// Map diversity block to seeds that cover it
-	rh::unordered_map<F, rh::unordered_set<u32>> block_seeds;
+	rh::unordered_map<F, SeedSet> block_seeds;
 
 	// Both unordered maps above must not contain any empty value
 
@@ -2382,7 +4610,18 @@ struct DiversityBlocks
 	// TODO: add and delete diversity blocks when new fringe is added or deleted
 	void switch_on(F f);
 	void switch_off(F f);
-	void remove_seed(u32 seed);
+	void remove_seeds(const SeedSet& seeds);
+	void lower_seed_thr(u32 thr);
+
+	size_t mem() const
+	{
+		size_t ret = hash_mem(seed_blocks) + hash_mem(block_seeds);
+		for (const auto& sb : seed_blocks)
+			ret += hash_mem(sb.second);
+		for (const auto& bs : block_seeds)
+			ret += bs.second.mem();
+		return ret;
+	}
 
 	void print(ostream& out) const;
 };
@@ -2391,9 +4630,8 @@ template <>
 void DiversityBlocks<reach_t>::div_coverage(const u8 *bitmap, u32 seed,
 	const rh::unordered_set<reach_t>* new_criticals,
 	const rh::unordered_set<reach_t>* new_bits_targets)
-{ // Similar to `fringe_coverage`
-	if (config.no_diversity)
-		return;
+{ // Similar to `fringe_coverage`, not called if `no_diversity`
+	assert(!config().no_diversity);
 	assert(seed_blocks.find(seed) == seed_blocks.end());
 	rh::unordered_set<reach_t> blocks;
 	vector<reach_t> to_invalidate;
@@ -2409,8 +4647,8 @@ void DiversityBlocks<reach_t>::div_coverage(const u8 *bitmap, u32 seed,
 		{
 			b.second.insert(seed);
 			// We don't use `>=` to not invalidate already invalid blocks
-			if (b.second.size() == config.div_seed_thr &&
-				b.first >= g->num_targets)
+			if (b.second.size() == config().div_seed_thr &&
+				b.first >= g()->num_targets)
 			{ // If number of seeds reach threshold for fringe, invalidate it
 				to_invalidate.push_back(b.first);
 				++num_invalid;
@@ -2427,8 +4665,8 @@ void DiversityBlocks<reach_t>::div_coverage(const u8 *bitmap, u32 seed,
 	if (!to_invalidate.empty())
 	{
 		for (reach_t b : to_invalidate)
-			clusters.invalidate_div_block(b);
-		clusters.clean_supp_cnts();
+			clusters().invalidate_div_block(b);
+		clusters().clean_supp_cnts();
 	}
 }
 
@@ -2436,12 +4674,12 @@ template <>
 void DiversityBlocks<reach_t>::switch_on(reach_t f)
 {
 	// If already switched on, this function does nothing
-	if (!block_seeds.emplace(f, rh::unordered_set<u32>()).second)
+	if (!block_seeds.emplace(f, SeedSet()).second)
 		return;
 	div_switch[f / 8] |= 1 << (f % 8);
 
 	// This will be added very soon, so empty value does not matter
-	if (f >= g->num_targets)
+	if (f >= g()->num_targets)
 		++num_fringes;
 }
 
@@ -2449,7 +4687,7 @@ template <>
 void DiversityBlocks<reach_t>::switch_off(reach_t f)
 {
 	auto it = block_seeds.find(f);
-	assert(f >= g->num_targets && IS_SET(div_switch, f));
+	assert(f >= g()->num_targets && IS_SET(div_switch, f));
 	div_switch[f / 8] &= ~(1 << (f % 8));
 
 	for (u32 s : it->second)
@@ -2459,26 +4697,55 @@ void DiversityBlocks<reach_t>::switch_off(reach_t f)
 		if (it2->second.empty())
 			seed_blocks.erase(it2);
 	}
-	if (it->second.size() >= config.div_seed_thr)
+	if (it->second.size() >= config().div_seed_thr)
 		--num_invalid;
 	--num_fringes;
 	block_seeds.erase(it);
-	clusters.remove_div_block(f);
+	clusters().remove_div_block(f);
 }
 
+// Lower `div_seed_thr` to `thr`, invalidating fringe blocks that have
+// reached it as `div_coverage` does; it is never raised, since invalid blocks
+// are merged into primary cluster for good.
 template <>
-void DiversityBlocks<reach_t>::remove_seed(u32 seed)
+void DiversityBlocks<reach_t>::lower_seed_thr(u32 thr)
 {
-	auto it = seed_blocks.find(seed);
-	if (it == seed_blocks.end())
-		return;
-	assert(!it->second.empty());
-	for (reach_t b : it->second)
+	assert(thr < config().div_seed_thr);
+	bool any = false;
+	for (const auto& b : block_seeds)
+	{
+		size_t s = b.second.size();
+		if (b.first >= g()->num_targets && s >= thr &&
+			s < config().div_seed_thr)
+		{
+			clusters().invalidate_div_block(b.first);
+			++num_invalid;
+			any = true;
+		}
+	}
+	config().div_seed_thr = thr;
+	if (any)
+		clusters().clean_supp_cnts();
+}
+
+template <>
+void DiversityBlocks<reach_t>::remove_seeds(const SeedSet& seeds)
+{
+	rh::unordered_set<reach_t> touched;
+	for (u32 seed : seeds)
+	{
+		auto it = seed_blocks.find(seed);
+		if (it == seed_blocks.end())
+			continue;
+		assert(!it->second.empty());
+		touched.insert(it->second.begin(), it->second.end());
+		seed_blocks.erase(it);
+	}
+	for (reach_t b : touched)
 	{
-		auto& seeds = block_seeds.find(b)->second;
-		seeds.erase(seed); assert(!seeds.empty());
+		auto& bs = block_seeds.find(b)->second;
+		bs -= seeds; assert(!bs.empty());
 	}
-	seed_blocks.erase(it);
 }
 
 template<>
@@ -2488,103 +4755,131 @@ void DiversityBlocks<reach_t>::print(ostream& out) const
 	size_t num_reached = 0, num_non_targets = 0;
 	for (const auto& b : block_seeds)
 	{
-		bool target = b.first < g->num_targets;
+		bool target = b.first < g()->num_targets;
 		size_t s = b.second.size();
-		bool reached = s >= config.div_seed_thr;
+		bool reached = s >= config().div_seed_thr;
 		if (!target)
 		{
 			++num_non_targets;
 			if (reached) ++num_reached;
 		}
-		out << g->reachable_names[b.first] << " | " << s <<
+		out << g()->reachable_names[b.first] << " | " << s <<
 			(target ? " T" : (reached ? " R" : "")) << endl;
 	}
 	assert(num_reached == num_invalid && num_fringes == num_non_targets);
 }
 
-unique_ptr<DiversityBlocks<reach_t>> div_blocks = nullptr;
+unique_ptr<DiversityBlocks<reach_t>>& div_blocks();
 
 using group_t = reach_t;
+
+reach_t& num_all_targets();
+// Groups of `Tgroups.txt` to start from, numbered by first target
+vector<group_t>& static_groups();
+group_t& num_static_groups();
+
+// Partition of targets refined by the targets of each fringe, as in DFA
+// minimization: `elems` is a permutation of targets where each group is a
+// contiguous range, so a refinement moves the targets it touches to the
+// front of their groups and splits them off, in time of their number.
 class TargetGrouper
 {
 public:
-	friend void ::aflrun_init_groups(reach_t num_targets);
+	// Targets of a group, valid until the next `add_reachable`
+	struct Targets
+	{
+		const reach_t* first; const reach_t* last;
+		inline const reach_t* begin() const { return first; }
+		inline const reach_t* end() const { return last; }
+		inline size_t size() const { return last - first; }
+	};
 private:
-	static rh::unordered_set<reach_t> all_targets;
+	vector<reach_t> elems;            // targets, ordered by group
+	vector<reach_t> pos;              // index of each target in `elems`
+	vector<group_t> target_to_group;
+	vector<reach_t> group_begin;      // `elems` range of each group,
+	vector<reach_t> group_end;        // one past the last
+	mutable vector<reach_t> marked;   // targets moved to front of group
+	vector<group_t> touched;
+public:
+	explicit TargetGrouper() :
+		elems(num_all_targets()), pos(num_all_targets()),
+		target_to_group(num_all_targets(), 0),
+		group_begin(1, 0), group_end(1, num_all_targets()), marked(1, 0)
+	{
+		if (num_static_groups() == 0)
+		{
+			for (reach_t t = 0; t < num_all_targets(); ++t)
+				elems[t] = pos[t] = t;
+			return;
+		}
 
-	unique_ptr<group_t[]> target_to_group;
-	vector<rh::unordered_set<reach_t>> groups;
+		// Counting sort of targets by static group
+		group_begin.assign(num_static_groups(), 0);
+		for (group_t g : static_groups())
+			++group_begin[g];
+		reach_t sum = 0;
+		for (reach_t& b : group_begin)
+		{
+			reach_t n = b;
+			b = sum; sum += n;
+		}
+		group_end = group_begin;
+		for (reach_t t = 0; t < num_all_targets(); ++t)
+		{
+			reach_t i = group_end[static_groups()[t]]++;
+			elems[i] = t; pos[t] = i;
+		}
+		target_to_group = static_groups();
+		marked.assign(num_static_groups(), 0);
+	}
 
-	// some memory pool to save allocation time
-	vector<reach_t> subgroups_;
-	vector<reach_t> sizes_;
-	vector<u8> covered_groups_;
-	vector<group_t> covered_groups_arr_;
-public:
-	explicit TargetGrouper()
+	// Set static groups of targets from `groups`, renumbering them densely
+	static void set_static(const reach_t* groups, reach_t num)
 	{
-		target_to_group = make_unique<group_t[]>(g->num_targets);
-		fill(target_to_group.get(), target_to_group.get() + g->num_targets, 0);
-		groups.emplace_back(all_targets);
-		subgroups_.resize(g->num_targets);
-		sizes_.resize(1);
-		covered_groups_.resize(1);
-		covered_groups_arr_.resize(1);
+		rh::unordered_flat_map<reach_t, group_t> ids;
+		static_groups().resize(num);
+		for (reach_t t = 0; t < num; ++t)
+		{
+			group_t next = ids.size();
+			static_groups()[t] = ids.emplace(groups[t], next).first->second;
+		}
+		num_static_groups() = ids.size();
 	}
 
 	// Pre: targets must be unique
 	template<typename D>
-	void add_reachable(
-		const rh::unordered_map<reach_t, rh::unordered_set<D>>& decs)
-	{
-		reach_t* subgroups = subgroups_.data();
-		reach_t* sizes = sizes_.data();
-		u8* covered_groups = covered_groups_.data();
-		group_t* covered_groups_arr = covered_groups_arr_.data();
-		const reach_t num_targets = g->num_targets;
-
-		size_t group_size = groups.size();
-		// Map each group index into all elements in `targets` belonging to it
-		fill(sizes, sizes + group_size, 0);
-		fill(covered_groups, covered_groups + group_size, 0);
-		size_t num_covered_groups = 0;
-		for (const auto& t : decs)
-		{
-			// Get group idx that the target belongs to
-			group_t g = target_to_group[t.first];
-			// Append the target to the corresponding subgroup
-			subgroups[g * num_targets + sizes[g]++] = t.first;
-			if (!covered_groups[g])
-			{
-				covered_groups[g] = 1;
-				covered_groups_arr[num_covered_groups++] = g;
-			}
+	void add_reachable(const TargetPaths<D>& decs)
+	{
+		touched.clear();
+		for (const auto& td : decs)
+		{
+			reach_t t = td.first;
+			group_t g = target_to_group[t];
+			if (marked[g] == 0)
+				touched.push_back(g);
+			// Swap the target with first unmarked one of its group
+			reach_t i = group_begin[g] + marked[g]++;
+			reach_t o = elems[i];
+			elems[pos[t]] = o; pos[o] = pos[t];
+			elems[i] = t; pos[t] = i;
 		}
 
-		// For subgroup that can cut any of existing group, we need to cut
-		for (size_t i = 0; i < num_covered_groups; ++i)
+		// Marked front of a group becomes a new group, unless it is all
+		for (group_t g : touched)
 		{
-			group_t g = covered_groups_arr[i];
-			size_t size = sizes[g];
-			assert(0 < size);
-			if (size < groups[g].size())
-			{
-				const reach_t* subgroup = subgroups + g * num_targets;
-				group_t new_idx = groups.size();
-				groups.emplace_back(subgroup, subgroup + size);
-				for (size_t j = 0; j < size; ++j)
-				{
-					groups[g].erase(subgroup[j]);
-					target_to_group[subgroup[j]] = new_idx;
-				}
-			}
+			reach_t mid = group_begin[g] + marked[g];
+			marked[g] = 0;
+			if (mid == group_end[g])
+				continue;
+			group_t new_idx = group_begin.size();
+			group_begin.push_back(group_begin[g]);
+			group_end.push_back(mid);
+			marked.push_back(0);
+			for (reach_t i = group_begin[g]; i < mid; ++i)
+				target_to_group[elems[i]] = new_idx;
+			group_begin[g] = mid;
 		}
-
-		group_size = groups.size();
-		subgroups_.resize(group_size * num_targets);
-		sizes_.resize(group_size);
-		covered_groups_.resize(group_size);
-		covered_groups_arr_.resize(group_size);
 	}
 
 	inline group_t to_group(reach_t target) const
@@ -2592,56 +4887,47 @@ public:
 		return target_to_group[target];
 	}
 
-	inline const rh::unordered_set<reach_t>& to_targets(group_t group) const
+	inline Targets to_targets(group_t group) const
 	{
-		return groups[group];
+		const reach_t* e = elems.data();
+		return Targets{e + group_begin[group], e + group_end[group]};
 	}
 
 	inline size_t size() const
 	{
-		return groups.size();
+		return group_begin.size();
 	}
 
-	// Separate given set of targets according to current group
+	// Separate given set of targets according to current group, which must
+	// have been refined by it, so it is a union of groups
 	template<typename D>
-	vector<rh::unordered_set<reach_t>> separate(
-		const rh::unordered_map<reach_t, rh::unordered_set<D>>& decs) const
+	vector<Targets> separate(const TargetPaths<D>& decs) const
 	{
-		rh::unordered_set<reach_t> targets;
+		vector<Targets> ret;
 		for (const auto& td : decs)
 		{
-			targets.insert(td.first);
+			group_t g = target_to_group[td.first];
+			if (marked[g]++ == 0)
+				ret.push_back(to_targets(g));
 		}
-		vector<rh::unordered_set<reach_t>> ret;
-		while (!targets.empty())
-		{
-			reach_t t = *targets.begin();
-			rh::unordered_set<reach_t> group = to_targets(to_group(t));
+		for (const auto& td : decs)
+			marked[target_to_group[td.first]] = 0;
 #ifndef NDEBUG
-			size_t prev_size = targets.size();
+		size_t num = 0;
+		for (const Targets& group : ret)
+			num += group.size();
+		assert(num == decs.size());
 #endif
-			for (reach_t e : group)
-				targets.erase(e);
-			// Check that all group elements removed are indeed in `targets`
-			assert(targets.size() + group.size() == prev_size);
-
-			ret.push_back(std::move(group));
-		}
 		return ret;
 	}
 
 	void slow_check() const
 	{
-		for (reach_t t = 0; t < g->num_targets; ++t)
+		for (reach_t t = 0; t < num_all_targets(); ++t)
 		{
+			assert(elems[pos[t]] == t);
 			group_t g = target_to_group[t];
-			assert(groups.at(g).find(t) != groups.at(g).end());
-			for (size_t i = 0; i < groups.size(); ++i)
-			{
-				if (i == g)
-					continue;
-				assert(groups[i].find(t) == groups[i].end());
-			}
+			assert(group_begin[g] <= pos[t] && pos[t] < group_end[g]);
 		}
 	}
 };
@@ -2657,16 +4943,17 @@ void FringeBlocks<F, D>::group()
 	}
 }
 
-rh::unordered_set<reach_t> TargetGrouper::all_targets;
-
 } // namespace
 
 size_t hash<Fringe>::operator()(const Fringe& p) const noexcept
-{
-	size_t seed = 0;
-	bo::hash_combine(seed, p.block);
-	bo::hash_combine(seed, p.context);
-	return seed;
+{ // Mix of the packed key, same as finalizer of MurmurHash3
+	u64 x = p.key();
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return static_cast<size_t>(x);
 }
 
 size_t hash<SeedFringes>::operator()(const SeedFringes& p) const noexcept
@@ -2697,17 +4984,21 @@ size_t hash<ClusterPair>::operator()(
 
 void aflrun_init_groups(reach_t num_targets)
 {
-	for (reach_t t = 0; t < num_targets; ++t)
+	num_all_targets() = num_targets;
+	// Groups loaded for other targets, e.g. of another instance, are dropped
+	if (static_groups().size() != num_targets)
 	{
-		TargetGrouper::all_targets.insert(t);
+		static_groups().clear();
+		num_static_groups() = 0;
 	}
 }
 
 void aflrun_init_fringes(reach_t num_reachables, reach_t num_targets)
 {
-	path_fringes = make_unique<FringeBlocks<Fringe, Fringe>>(num_targets);
-	path_pro_fringes = make_unique<FringeBlocks<Fringe, reach_t>>(num_targets);
-	reached_targets = make_unique<FringeBlocks<Fringe, u8>>(num_targets);
+	path_fringes() = make_unique<FringeBlocks<Fringe, Fringe>>(num_targets);
+	path_pro_fringes() =
+		make_unique<FringeBlocks<Fringe, reach_t>>(num_targets);
+	reached_targets() = make_unique<FringeBlocks<Fringe, u8>>(num_targets);
 }
 
 void aflrun_init_globals(void* afl, reach_t num_targets, reach_t num_reachables,
@@ -2718,14 +5009,56 @@ void aflrun_init_globals(void* afl, reach_t num_targets, reach_t num_reachables,
 		const double* target_weights, u32 map_size, u8* div_switch,
 		const char* cycle_time)
 {
-	assert(g == nullptr);
-	g = make_unique<AFLRunGlobals>(num_targets, num_reachables,
+	assert(g() == nullptr);
+	g() = make_unique<AFLRunGlobals>(num_targets, num_reachables,
 		num_ftargets, num_freachables, virgin_reachables,
 		virgin_freachables, virgin_ctx, reachable_names,
 		reachable_to_targets, reachable_to_size, out_dir,
 		target_weights, map_size, afl, get_cur_time(),
 		cycle_time == NULL ? 0 : strtoull(cycle_time, NULL, 10));
-	div_blocks = make_unique<DiversityBlocks<reach_t>>(div_switch);
+	div_blocks() = make_unique<DiversityBlocks<reach_t>>(div_switch);
+	ClusterVirgins::set_window(map_size);
+	if (config().rare_fringes)
+		fringe_hits().init(div_switch);
+	bb_to_dists().load(config().lazy_dists, bb_to_avg_dists());
+}
+
+namespace
+{
+void read_target_dists(const string& dir, reach_t t,
+	const function<void(reach_t, float)>& f)
+{
+	ifstream cf(dir + to_string(t) + ".txt"); assert(cf.is_open());
+	string line;
+	while (getline(cf, line))
+	{
+		// get name and dist
+		size_t pos = line.find(","); assert(pos != string::npos);
+		string bb_name = line.substr(0, pos);
+		float bb_dis = atof(line.substr(pos + 1, line.length()).c_str());
+
+		// update name and dist into global data structure
+		assert(name_to_id().find(bb_name) != name_to_id().end());
+		f(name_to_id().find(bb_name)->second, bb_dis);
+	}
+}
+
+void load_call_hashes(const string& temp)
+{
+	ifstream fd(temp + "Chash.txt"); assert(fd.is_open());
+	string line;
+	while (getline(fd, line))
+	{
+		size_t idx1 = line.find(','); assert(idx1 != string::npos);
+		size_t idx2 = line.find('|'); assert(idx2 != string::npos);
+		auto call_edge = make_pair<reach_t, reach_t>(
+			strtoul(line.c_str(), NULL, 10),
+			strtoul(line.c_str() + idx1 + 1, NULL, 10));
+		graph()->call_hashes[call_edge].push_back(
+			strtoul(line.c_str() + idx2 + 1, NULL, 10));
+	}
+}
+
 }
 
 void aflrun_load_freachables(const char* temp_path,
@@ -2744,11 +5077,11 @@ void aflrun_load_freachables(const char* temp_path,
 	reach_t i = 0;
 	while (getline(fd, line))
 	{
-		fname_to_id.emplace(line, i++);
-		id_to_fname.push_back(std::move(line));
+		fname_to_id().emplace(line, i++);
+		id_to_fname().push_back(std::move(line));
 	}
 
-	assert(i == *num_freachables && i == fname_to_id.size());
+	assert(i == *num_freachables && i == fname_to_id().size());
 }
 
 void aflrun_load_edges(const char* temp_path, reach_t num_reachables)
@@ -2756,82 +5089,104 @@ void aflrun_load_edges(const char* temp_path, reach_t num_reachables)
 	string temp(temp_path);
 	if (temp.back() != '/')
 		temp.push_back('/');
-	graph = make_unique<BasicBlockGraph>(
+	graph() = make_unique<BasicBlockGraph>(
 		(temp + "BBedges.txt").c_str(), num_reachables);
+	load_call_hashes(temp);
+}
 
-	ifstream fd(temp + "Chash.txt"); assert(fd.is_open());
-	string line;
-	while (getline(fd, line))
+void aflrun_load_groups(const char* temp_path)
+{
+	string temp(temp_path);
+	if (temp.back() != '/')
+		temp.push_back('/');
+	ifstream fd(temp + "Tgroups.txt");
+	if (!fd.is_open()) // Temp dir of an older pass
+		return;
+	vector<reach_t> groups;
+	reach_t g;
+	while (fd >> g)
+		groups.push_back(g);
+	TargetGrouper::set_static(groups.data(), groups.size());
+}
+
+void aflrun_load_window(const char* temp_path)
+{
+	string temp(temp_path);
+	if (temp.back() != '/')
+		temp.push_back('/');
+	ifstream fd(temp + "EdgeWindow.txt");
+	char comma;
+	u32 lo, hi;
+	if (fd >> lo >> comma >> hi && comma == ',')
 	{
-		size_t idx1 = line.find(','); assert(idx1 != string::npos);
-		size_t idx2 = line.find('|'); assert(idx2 != string::npos);
-		auto call_edge = make_pair<reach_t, reach_t>(
-			strtoul(line.c_str(), NULL, 10),
-			strtoul(line.c_str() + idx1 + 1, NULL, 10));
-		graph->call_hashes[call_edge].push_back(
-			strtoul(line.c_str() + idx2 + 1, NULL, 10));
+		window_lo() = lo;
+		window_hi() = hi;
+	}
+}
+
+void aflrun_load_image(const char* temp_path, const void* image)
+{
+	const aflrun_image_t* img = static_cast<const aflrun_image_t*>(image);
+	TargetGrouper::set_static(
+		AFLRUN_IMAGE_AT(img, off_target_groups, const reach_t),
+		img->num_targets);
+
+	const char* names = AFLRUN_IMAGE_AT(img, off_names, const char);
+	const u64* fname_offs = AFLRUN_IMAGE_AT(img, off_fnames_index, const u64);
+	id_to_fname().reserve(img->num_freachables);
+	for (reach_t i = 0; i < img->num_freachables; ++i)
+	{
+		id_to_fname().emplace_back(names + fname_offs[i]);
+		fname_to_id().emplace(id_to_fname().back(), i);
+	}
+
+	graph() = make_unique<BasicBlockGraph>(img);
+	if (img->off_call_hashes)
+	{
+		const aflrun_call_hash_t* hashes =
+			AFLRUN_IMAGE_AT(img, off_call_hashes, const aflrun_call_hash_t);
+		for (u64 i = 0; i < img->num_call_hashes; ++i)
+			graph()->call_hashes[make_pair(hashes[i].src, hashes[i].dst)]
+				.push_back(hashes[i].hash);
+	}
+	else
+	{
+		string temp(temp_path);
+		if (temp.back() != '/')
+			temp.push_back('/');
+		load_call_hashes(temp);
+	}
+
+	bb_to_dists().set_image(const_cast<aflrun_image_t*>(img));
+
+	const u64* index = AFLRUN_IMAGE_AT(img, off_dists_index, const u64);
+	const aflrun_dist_t* dists =
+		AFLRUN_IMAGE_AT(img, off_dists, const aflrun_dist_t);
+	if (img->ctx_radius == numeric_limits<double>::infinity())
+		return;
+	no_ctx_blocks().assign(img->num_reachables, false);
+	for (reach_t bb = 0; bb < img->num_reachables; ++bb)
+	{
+		float min_dist = numeric_limits<float>::infinity();
+		for (u64 i = index[bb]; i < index[bb + 1]; ++i)
+			min_dist = std::min(min_dist, dists[i].dist);
+		no_ctx_blocks()[bb] = min_dist > img->ctx_radius;
 	}
 }
 
 void aflrun_load_dists(const char* dir, reach_t num_targets,
 	reach_t num_reachables, char** reachable_names)
 {
-	bb_to_dists.resize(num_reachables);
-
 	// Convert reachable name to id in O(1)
 	for (reach_t i = 0; i < num_reachables; i++)
 	{
-		name_to_id.emplace(reachable_names[i], i);
+		name_to_id().emplace(reachable_names[i], i);
 	}
 
 	string path(dir);
 	if (path.back() != '/')
 		path.push_back('/');
-	path += "distance.cfg/";
-	for (reach_t t = 0; t < num_targets; ++t)
-	{
-		ifstream cf(path + to_string(t) + ".txt"); assert(cf.is_open());
-		string line;
-		while (getline(cf, line))
-		{
-			// get name and dist
-			size_t pos = line.find(","); assert(pos != string::npos);
-			string bb_name = line.substr(0, pos);
-			double bb_dis = atof(line.substr(pos + 1, line.length()).c_str());
-
-			// update name and dist into global data structure
-			assert(name_to_id.find(bb_name) != name_to_id.end());
-			reach_t block = name_to_id.find(bb_name)->second;
-			auto tmp = bb_to_dists[block].find(t);
-			if (tmp == bb_to_dists[block].end())
-			{
-				bb_to_dists[block].emplace(t, bb_dis);
-			}
-			else if (tmp->second > bb_dis)
-			{
-				tmp->second = bb_dis; // we get minimum of all distances
-			}
-		}
-		cf.close();
-	}
-
-	// calculate the average distance among all targets
-	// TODO: calculate the average lazily
-	rh::unordered_map<reach_t, double> dists;
-	for (reach_t bb = 0; bb < num_reachables; ++bb)
-	{
-		double sum = 0.0; size_t count = 0;
-		for (reach_t t = 0; t < num_targets; ++t)
-		{
-			auto d = bb_to_dists[bb].find(t);
-			if (d != bb_to_dists[bb].end())
-			{
-				sum += d->second; ++count;
-			}
-		}
-		assert(count > 0);
-		bb_to_avg_dists.emplace(bb, sum / count);
-	}
+	bb_to_dists().set_dir(path + "distance.cfg/", num_reachables, num_targets);
 }
 
 // The config is in form "xxx=aaa:yyy=bbb"
@@ -2847,33 +5202,60 @@ void aflrun_load_config(const char* config_str,
 			size_t idx = s.find(':');
 			if (idx == string::npos)
 			{
-				config.load(s);
+				config().load(s);
 				break;
 			}
-			config.load(s.substr(0, idx));
+			config().load(s.substr(0, idx));
 			s = s.substr(idx + 1);
 		}
-		config.check();
+		config().check();
 	}
 	catch (const string& e)
 	{
 		cerr << e << endl;
 		abort();
 	}
-	*check_at_begin = config.check_at_begin;
-	*log_at_begin = config.log_at_begin;
-	*log_check_interval = config.log_check_interval;
-	*trim_thr = config.trim_thr;
-	*queue_quant_thr = config.queue_quant_thr;
-	*min_num_exec = config.min_num_exec;
+	has_new_path_fn() = has_new_path_profiles[config().no_diversity][config().div_level];
+	if (config().rand_seed)
+		gen().seed(config().rand_seed);
+	*check_at_begin = config().check_at_begin;
+	*log_at_begin = config().log_at_begin;
+	*log_check_interval = config().log_check_interval;
+	*trim_thr = config().trim_thr;
+	*queue_quant_thr = config().queue_quant_thr;
+	*min_num_exec = config().min_num_exec;
 }
 
-void aflrun_remove_seed(u32 seed)
+void aflrun_remove_seeds(const u32* seeds, u32 num)
 {
-	path_pro_fringes->remove_seed(seed);
-	path_fringes->remove_seed(seed);
-	reached_targets->remove_seed(seed);
-	div_blocks->remove_seed(seed);
+	SeedSet to_remove;
+	for (u32 i = 0; i < num; ++i)
+		to_remove.insert(seeds[i]);
+	path_pro_fringes()->remove_seeds(to_remove);
+	path_fringes()->remove_seeds(to_remove);
+	reached_targets()->remove_seeds(to_remove);
+	div_blocks()->remove_seeds(to_remove);
+}
+
+// A seed covering no fringe can leave for good if each diversity block it
+// covers is covered by another seed, and its number of seeds stays on the
+// same side of `div_seed_thr` without it.
+bool aflrun_can_retire(u32 seed)
+{
+	if (reached_targets()->seed_fringes.count(seed) ||
+		path_pro_fringes()->seed_fringes.count(seed) ||
+		path_fringes()->seed_fringes.count(seed))
+		return false;
+	auto it = div_blocks()->seed_blocks.find(seed);
+	if (it == div_blocks()->seed_blocks.end())
+		return true;
+	for (reach_t b : it->second)
+	{
+		size_t n = div_blocks()->block_seeds.find(b)->second.size();
+		if (n < 2 || (n == config().div_seed_thr && b >= g()->num_targets))
+			return false;
+	}
+	return true;
 }
 
 /* ----- Functions called for some time interval to log and check ----- */
@@ -2915,17 +5297,17 @@ void check_state(const FringeBlocks<F, D>& fringes)
 }
 void aflrun_check_state(void)
 {
-	if (!config.check_fringe)
+	if (!config().check_fringe)
 		return;
-	check_state(*path_fringes);
-	check_state(*path_pro_fringes);
-	check_state(*reached_targets);
-	for (reach_t t = 0; t < path_pro_fringes->target_to_fringes.size(); ++t)
+	check_state(*path_fringes());
+	check_state(*path_pro_fringes());
+	check_state(*reached_targets());
+	for (reach_t t = 0; t < path_pro_fringes()->target_to_fringes.size(); ++t)
 	{
-		for (const auto& f : path_pro_fringes->target_to_fringes[t])
+		for (const auto& f : path_pro_fringes()->target_to_fringes[t])
 		{
-			assert(path_fringes->target_to_fringes[t].find(f) !=
-				path_fringes->target_to_fringes[t].end());
+			assert(path_fringes()->target_to_fringes[t].find(f) !=
+				path_fringes()->target_to_fringes[t].end());
 		}
 	}
 }
@@ -2934,7 +5316,23 @@ void aflrun_check_state(void)
 
 namespace
 {
-string targets_info;
+string& targets_info();
+
+template <typename Info>
+void log_seeds(ostream& out, const Info& info)
+{
+	if (config().show_all_seeds)
+	{
+		for (u32 s : info.seeds)
+		{
+			out << ' ' << s;
+		}
+	}
+	else if (info.has_top_rated)
+	{
+		out << ' ' << info.top_rated_seed;
+	}
+}
 
 template <typename F, typename D>
 void log_fringes(ofstream& out, const FringeBlocks<F, D>& fringes)
@@ -2943,15 +5341,15 @@ void log_fringes(ofstream& out, const FringeBlocks<F, D>& fringes)
 	for (const auto& f : fringes.fringes)
 	{
 		auto res = fringes.grouper->separate(f.second.decisives);
-		for (const rh::unordered_set<reach_t>& group : res)
+		for (const TargetGrouper::Targets& group : res)
 		{
 			log_fringe<F>(out, f.first);
 			out << " |";
 			rh::unordered_set<D> decisives;
 			for (reach_t t : group)
 			{
-				out << ' ' << g->reachable_names[t];
-				const auto& tmp = f.second.decisives.find(t)->second;
+				out << ' ' << g()->reachable_names[t];
+				const auto& tmp = *f.second.decisives.find(t)->second;
 				decisives.insert(tmp.begin(), tmp.end());
 			}
 			out << " | ";
@@ -2960,125 +5358,628 @@ void log_fringes(ofstream& out, const FringeBlocks<F, D>& fringes)
 				log_fringe<D>(out, d); out << ' ';
 			}
 			out << '|';
-			if (config.show_all_seeds)
-			{
-				for (u32 s : f.second.seeds)
-				{
-					out << ' ' << s;
-				}
-			}
-			else if (f.second.has_top_rated)
-			{
-				out << ' ' << f.second.top_rated_seed;
-			}
+			log_seeds(out, f.second);
 			out << " | " << f.second.fuzzed_quant << endl;
 		}
 	}
 }
+
+template <typename Info>
+void log_target(ostream& out, const Fringe& f, const Info& info)
+{
+	assert(f.block < g()->num_targets);
+	out << f.context << " | " << g()->reachable_names[f.block] << " |";
+	log_seeds(out, info);
+	out << endl;
+}
+
+// Lines of one fringe in the journal, where targets sharing a decisive path
+// are a group, since grouping them as `log_fringes` does takes all fringes.
+template <typename F, typename D>
+void log_fringe_lines(ostream& out, const F& f,
+	const typename FringeBlocks<F, D>::Info& info)
+{
+	rh::unordered_map<const vector<D>*, vector<reach_t>> groups;
+	for (const auto& td : info.decisives)
+		groups[td.second.get()].push_back(td.first);
+	for (const auto& gr : groups)
+	{
+		log_fringe<F>(out, f);
+		out << " |";
+		for (reach_t t : gr.second)
+			out << ' ' << g()->reachable_names[t];
+		out << " | ";
+		for (const D& d : *gr.first)
+		{
+			log_fringe<D>(out, d); out << ' ';
+		}
+		out << '|';
+		log_seeds(out, info);
+		out << " | " << info.fuzzed_quant << endl;
+	}
+}
+
+inline void put_varint(string& s, u64 v)
+{
+	u8 buf[10];
+	s.append(reinterpret_cast<const char*>(buf),
+		aflrun_put_varint(buf, v) - buf);
+}
+
+// Journal fringes of `fb` touched since last flush, with lines given by `log`
+template <typename F, typename D, typename Log>
+void journal_fringes(u8 which, FringeBlocks<F, D>& fb, Log log)
+{
+	for (const F& f : fb.journal_dirty)
+	{
+		string body(1, static_cast<char>(which));
+		put_varint(body, f.key());
+		auto it = fb.fringes.find(f);
+		if (it != fb.fringes.end())
+		{
+			ostringstream lines;
+			log(lines, f, it->second);
+			body += lines.str();
+		}
+		g()->journal_write(AFLRUN_JOURNAL_FRINGE, body);
+	}
+	fb.journal_dirty.clear();
+}
+
+void journal_seed(u32 seed, double k)
+{
+	string body;
+	put_varint(body, seed);
+	double q = aflrun_get_seed_quant(seed);
+	body.append(reinterpret_cast<const char*>(&k), sizeof(k));
+	body.append(reinterpret_cast<const char*>(&q), sizeof(q));
+	g()->journal_write(AFLRUN_JOURNAL_SEED, body);
+}
 }
 
 void aflrun_log_fringes(const char* path, u8 which)
 {
+	if (config().diag_level == 0)
+		return;
 	ofstream out(path);
 	// When critical block is disabled, we don't need log.
-	if (!out.is_open() || config.no_critical)
+	if (!out.is_open() || config().no_critical)
 		return;
 
-	path_fringes->group();
-	path_pro_fringes->group();
-	reached_targets->group();
+	path_fringes()->group();
+	path_pro_fringes()->group();
+	reached_targets()->group();
 
 	switch (which)
 	{
 	case 2: // print all paths towards all targets
 		out << "context | target | seeds" << endl;
-		for (const auto& f : reached_targets->fringes)
-		{
-			assert(f.first.block < g->num_targets);
-			out << f.first.context << " | " <<
-				g->reachable_names[f.first.block] << " |";
-			if (config.show_all_seeds)
-			{
-				for (u32 s : f.second.seeds)
-				{
-					out << ' ' << s;
-				}
-			}
-			else if (f.second.has_top_rated)
-			{
-				out << ' ' << f.second.top_rated_seed;
-			}
-			out << endl;
-		}
-		clusters.print(out);
-		div_blocks->print(out);
+		for (const auto& f : reached_targets()->fringes)
+			log_target(out, f.first, f.second);
+		clusters().print(out);
+		div_blocks()->print(out);
 		break;
 	case 1:
-		log_fringes(out, *path_pro_fringes);
+		log_fringes(out, *path_pro_fringes());
 		break;
 	case 0:
-		log_fringes(out, *path_fringes);
+		log_fringes(out, *path_fringes());
 		break;
 	default:
 		abort();
 	}
 	if (which == 2)
-		out << targets_info;
+		out << targets_info();
 	out.close();
 }
 
-u64 aflrun_queue_cycle(void)
+void aflrun_journal_flush(u8 snapshot)
 {
-	if (g->cycle_time)
-		return (get_cur_time() - g->init_time) / 1000 / g->cycle_time;
-	else
-		return state.get_whole_count();
-}
+	if (!config().journal)
+		return;
+
+	for (reach_t b : g()->journal_blocks)
+	{
+		string body;
+		put_varint(body, b);
+		body += g()->reachable_names[b];
+		g()->journal_write(AFLRUN_JOURNAL_BLOCK, body);
+	}
+	g()->journal_blocks.clear();
+
+	// Seeds are journaled as their factors change, only quants are refreshed
+	if (snapshot)
+	{
+		for (u32 s = 0; s < g()->journal_factors.size(); ++s)
+		{
+			if (g()->journal_factors[s] != 0)
+				journal_seed(s, g()->journal_factors[s]);
+		}
+	}
+
+	if (!config().no_critical)
+	{
+		journal_fringes(AFLRUN_JOURNAL_LOG_FRINGE, *path_fringes(),
+			log_fringe_lines<Fringe, Fringe>);
+		journal_fringes(AFLRUN_JOURNAL_LOG_PRO, *path_pro_fringes(),
+			log_fringe_lines<Fringe, reach_t>);
+		journal_fringes(AFLRUN_JOURNAL_LOG_TARGETS, *reached_targets(),
+			log_target<FringeBlocks<Fringe, u8>::Info>);
+		if (snapshot)
+		{ // Clusters and diversity blocks are only logged on demand
+			ostringstream tail;
+			tail << static_cast<char>(AFLRUN_JOURNAL_LOG_TARGETS);
+			clusters().print(tail);
+			div_blocks()->print(tail);
+			tail << targets_info();
+			g()->journal_write(AFLRUN_JOURNAL_TAIL, tail.str());
+		}
+	}
+
+	g()->journal.flush();
+}
+
+void aflrun_journal_seed(u32 seed, double k)
+{
+	if (!config().journal)
+		return;
+	auto& factors = g()->journal_factors;
+	if (seed >= factors.size())
+		factors.resize(seed + 1, 0);
+	if (factors[seed] == k)
+		return;
+	factors[seed] = k;
+	journal_seed(seed, k);
+}
+
+u64 aflrun_queue_cycle(void)
+{
+	if (g()->cycle_time)
+		return (get_cur_time() - g()->init_time) / 1000 / g()->cycle_time;
+	else
+		return state().get_whole_count();
+}
 
 void aflrun_get_state(int* cycle_count, u32* cov_quant,
 	size_t* div_num_invalid, size_t* div_num_fringes)
 {
-	state.get_counts(*cycle_count, *cov_quant);
-	*div_num_invalid = div_blocks->num_invalid;
-	*div_num_fringes = div_blocks->num_fringes;
+	state().get_counts(*cycle_count, *cov_quant);
+	*div_num_invalid = div_blocks()->num_invalid;
+	*div_num_fringes = div_blocks()->num_fringes;
+}
+
+void aflrun_get_memory(size_t* cur, size_t* peak)
+{
+	fill(cur, cur + AFLRUN_MEM_NUM, 0);
+	clusters().mem(cur);
+	path_fringes()->mem(cur);
+	path_pro_fringes()->mem(cur);
+	reached_targets()->mem(cur);
+	cur[AFLRUN_MEM_DIV] += div_blocks()->mem() + fringe_hits().mem();
+	for (size_t i = 0; i < AFLRUN_MEM_NUM; ++i)
+	{
+		g()->mem_peaks[i] = max(g()->mem_peaks[i], cur[i]);
+		peak[i] = g()->mem_peaks[i];
+	}
+}
+
+void aflrun_get_pool(size_t* mapped, size_t* used)
+{
+#ifdef AFLRUN_POOL
+	aflrun_pool::Pool::get().usage(mapped, used);
+#else
+	*mapped = *used = 0;
+#endif
+}
+
+void aflrun_get_fringes(size_t* num_path_fringes,
+	size_t* num_pro_fringes, size_t* num_target_fringes)
+{
+	*num_path_fringes = path_fringes()->fringes.size();
+	*num_pro_fringes = path_pro_fringes()->fringes.size();
+	*num_target_fringes = reached_targets()->fringes.size();
 }
 
 u8 aflrun_get_mode(void)
 {
-	return state.get_mode();
+	return state().get_mode();
 }
 
 bool aflrun_is_uni(void)
 {
-	return state.get_mode() == AFLRunState::kUnite;
+	return state().get_mode() == AFLRunState::kUnite;
 }
 
 double aflrun_get_seed_quant(u32 seed)
 {
-	return seed < seed_quant.size() ? seed_quant[seed] : 0;
+	return seed < seed_quant().size() ? seed_quant()[seed] : 0;
+}
+
+namespace
+{
+// Buffers returned by `aflrun_get_seed_fringes`
+vector<reach_t>& seed_info_blocks();
+vector<double>& seed_info_dists();
+}
+
+template <typename F, typename D>
+void add_seed_info(const FringeBlocks<F, D>& fb, u32 seed)
+{
+	auto it = fb.seed_fringes.find(seed);
+	if (it == fb.seed_fringes.end())
+		return;
+	for (const F& f : it->second)
+	{
+		seed_info_blocks().push_back(f.block);
+		for (const auto& td : fb.fringes.find(f)->second.decisives)
+		{
+			double& d = seed_info_dists()[td.first];
+			d = std::min(d, bb_to_dists().get(f.block, td.first));
+		}
+	}
+}
+
+size_t aflrun_get_seed_fringes(u32 seed,
+	const reach_t** ret_blocks, const double** ret_dists)
+{
+	seed_info_blocks().clear();
+	seed_info_dists().assign(
+		g()->num_targets, numeric_limits<double>::infinity());
+
+	// Coverage and unite modes have no fringes of their own, so take all
+	switch (state().get_mode())
+	{
+	case AFLRunState::kFringe:
+		add_seed_info(*path_fringes(), seed);
+		break;
+	case AFLRunState::kProFringe:
+		add_seed_info(*path_pro_fringes(), seed);
+		break;
+	case AFLRunState::kTarget:
+		add_seed_info(*reached_targets(), seed);
+		break;
+	default:
+		add_seed_info(*path_fringes(), seed);
+		add_seed_info(*path_pro_fringes(), seed);
+		add_seed_info(*reached_targets(), seed);
+		break;
+	}
+
+	// Fringes in different contexts share blocks
+	sort(seed_info_blocks().begin(), seed_info_blocks().end());
+	seed_info_blocks().erase(
+		unique(seed_info_blocks().begin(), seed_info_blocks().end()),
+		seed_info_blocks().end());
+
+	*ret_blocks = seed_info_blocks().data();
+	*ret_dists = seed_info_dists().data();
+	return seed_info_blocks().size();
+}
+
+namespace
+{
+// Buffer returned by `aflrun_get_seed_decisives`
+vector<reach_t>& seed_decisive_blocks();
+}
+
+inline void push_decisive(reach_t d)
+{
+	seed_decisive_blocks().push_back(d);
+}
+inline void push_decisive(const Fringe& d)
+{
+	seed_decisive_blocks().push_back(d.block);
+}
+inline void push_decisive(u8) {} // Reached targets have no decisives
+
+template <typename F, typename D>
+void add_seed_decisives(const FringeBlocks<F, D>& fb, u32 seed)
+{
+	auto it = fb.seed_fringes.find(seed);
+	if (it == fb.seed_fringes.end())
+		return;
+	for (const F& f : it->second)
+	{
+		seed_decisive_blocks().push_back(f.block);
+		for (const auto& td : fb.fringes.find(f)->second.decisives)
+		{
+			for (const D& d : *td.second)
+				push_decisive(d);
+		}
+	}
+}
+
+size_t aflrun_get_seed_decisives(u32 seed, const reach_t** ret)
+{
+	seed_decisive_blocks().clear();
+
+	switch (state().get_mode())
+	{
+	case AFLRunState::kFringe:
+		add_seed_decisives(*path_fringes(), seed);
+		break;
+	case AFLRunState::kProFringe:
+		add_seed_decisives(*path_pro_fringes(), seed);
+		break;
+	case AFLRunState::kTarget:
+		add_seed_decisives(*reached_targets(), seed);
+		break;
+	default:
+		add_seed_decisives(*path_fringes(), seed);
+		add_seed_decisives(*path_pro_fringes(), seed);
+		add_seed_decisives(*reached_targets(), seed);
+		break;
+	}
+
+	sort(seed_decisive_blocks().begin(), seed_decisive_blocks().end());
+	seed_decisive_blocks().erase(
+		unique(seed_decisive_blocks().begin(), seed_decisive_blocks().end()),
+		seed_decisive_blocks().end());
+
+	*ret = seed_decisive_blocks().data();
+	return seed_decisive_blocks().size();
+}
+
+size_t aflrun_get_seed_goals(u32 seed, const reach_t** ret)
+{
+	if (!config().early_exit || state().get_mode() != AFLRunState::kTarget)
+		return 0;
+
+	// Targets of the seed are its fringes in exploitation mode
+	seed_decisive_blocks().clear();
+	add_seed_decisives(*reached_targets(), seed);
+	sort(seed_decisive_blocks().begin(), seed_decisive_blocks().end());
+	seed_decisive_blocks().erase(
+		unique(seed_decisive_blocks().begin(), seed_decisive_blocks().end()),
+		seed_decisive_blocks().end());
+
+	*ret = seed_decisive_blocks().data();
+	return seed_decisive_blocks().size();
+}
+
+double aflrun_get_seed_dist(u32 seed)
+{
+	const reach_t* blocks; const double* dists;
+	aflrun_get_seed_fringes(seed, &blocks, &dists);
+	double ret = numeric_limits<double>::infinity();
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+		ret = std::min(ret, dists[t]);
+	return ret;
+}
+
+bool aflrun_seed_focus(u32 seed)
+{
+	// Seeds are erased from `seed_fringes` once they cover no fringe of it
+	return path_pro_fringes()->seed_fringes.count(seed) != 0 ||
+		reached_targets()->seed_fringes.count(seed) != 0;
+}
+
+namespace
+{
+// Buffer returned by `aflrun_get_splice_partners`
+vector<u32>& splice_partners();
+}
+
+template <typename F, typename D>
+void add_splice_partners(FringeBlocks<F, D>& fb, u32 seed)
+{
+	auto it = fb.seed_fringes.find(seed);
+	if (it == fb.seed_fringes.end())
+		return;
+	if (fb.grouper == nullptr)
+		fb.group();
+	const auto& covered = it->second;
+
+	// Targets in one group are led to by the same fringes, so one target
+	// of each group gives all fringes of the group.
+	rh::unordered_flat_set<group_t> visited;
+	for (const F& f : covered)
+	{
+		for (const auto& td : fb.fringes.find(f)->second.decisives)
+		{
+			if (!visited.insert(fb.grouper->to_group(td.first)).second)
+				continue;
+			for (const F& o : fb.target_to_fringes[td.first])
+			{
+				if (covered.find(o) != covered.end())
+					continue;
+				const auto& info = fb.fringes.find(o)->second;
+				if (info.has_top_rated && info.top_rated_seed != seed)
+					splice_partners().push_back(info.top_rated_seed);
+			}
+		}
+	}
+}
+
+size_t aflrun_get_splice_partners(u32 seed, const u32** ret)
+{
+	splice_partners().clear();
+
+	switch (state().get_mode())
+	{
+	case AFLRunState::kFringe:
+		add_splice_partners(*path_fringes(), seed);
+		break;
+	case AFLRunState::kProFringe:
+		add_splice_partners(*path_pro_fringes(), seed);
+		break;
+	case AFLRunState::kTarget:
+		add_splice_partners(*reached_targets(), seed);
+		break;
+	default:
+		add_splice_partners(*path_fringes(), seed);
+		add_splice_partners(*path_pro_fringes(), seed);
+		add_splice_partners(*reached_targets(), seed);
+		break;
+	}
+
+	// A seed can be top rated for many fringes
+	sort(splice_partners().begin(), splice_partners().end());
+	splice_partners().erase(
+		unique(splice_partners().begin(), splice_partners().end()),
+		splice_partners().end());
+
+	*ret = splice_partners().data();
+	return splice_partners().size();
+}
+
+namespace
+{
+// Executions and finds of each havoc operator, where a find is a new fringe,
+// context-sensitive target or diversity bit; older ones count less and less,
+// because what advances a target changes as it is approached.
+struct OpStats
+{
+	static constexpr double kWindow = 1 << 16;
+	double uses[AFLRUN_HAVOC_OPS] = {}, finds[AFLRUN_HAVOC_OPS] = {};
+
+	void update(const u32* u, const u32* f)
+	{
+		bool full = false;
+		for (size_t k = 0; k < AFLRUN_HAVOC_OPS; ++k)
+		{
+			uses[k] += u[k]; finds[k] += f[k];
+			full |= uses[k] > kWindow;
+		}
+		if (!full)
+			return;
+		for (size_t k = 0; k < AFLRUN_HAVOC_OPS; ++k)
+		{
+			uses[k] /= 2; finds[k] /= 2;
+		}
+	}
+};
+
+// Statistics of each target, and of all executions as the last one; targets
+// of a group are always credited together, so any of them stands for it.
+vector<OpStats>& op_stats();
+// Targets of groups led to by the seed being fuzzed, and one of each group
+vector<reach_t>& op_targets();
+vector<reach_t>& op_groups();
+
+template <typename F, typename D>
+void add_op_targets(FringeBlocks<F, D>& fb, u32 seed)
+{
+	auto it = fb.seed_fringes.find(seed);
+	if (it == fb.seed_fringes.end())
+		return;
+	if (fb.grouper == nullptr)
+		fb.group();
+	rh::unordered_flat_set<group_t> visited;
+	for (const F& f : it->second)
+	{
+		for (const auto& td : fb.fringes.find(f)->second.decisives)
+		{
+			group_t gr = fb.grouper->to_group(td.first);
+			if (!visited.insert(gr).second)
+				continue;
+			auto ts = fb.grouper->to_targets(gr);
+			op_groups().push_back(*ts.begin());
+			op_targets().insert(op_targets().end(), ts.begin(), ts.end());
+		}
+	}
+}
+
+inline void unique_sort(vector<reach_t>& v)
+{
+	sort(v.begin(), v.end());
+	v.erase(unique(v.begin(), v.end()), v.end());
+}
+}
+
+void aflrun_op_weights(u32 seed, const u32* widths, double* ret)
+{
+	op_stats().resize(g()->num_targets + 1);
+	op_targets().clear();
+	op_groups().clear();
+	switch (state().get_mode())
+	{
+	case AFLRunState::kFringe:
+		add_op_targets(*path_fringes(), seed);
+		break;
+	case AFLRunState::kProFringe:
+		add_op_targets(*path_pro_fringes(), seed);
+		break;
+	case AFLRunState::kTarget:
+		add_op_targets(*reached_targets(), seed);
+		break;
+	default:
+		add_op_targets(*path_fringes(), seed);
+		add_op_targets(*path_pro_fringes(), seed);
+		add_op_targets(*reached_targets(), seed);
+		break;
+	}
+	unique_sort(op_targets());
+	unique_sort(op_groups());
+
+	// A seed leading to no target group is scheduled for all executions
+	OpStats sum;
+	if (op_groups().empty())
+		op_groups().push_back(g()->num_targets);
+	for (reach_t t : op_groups())
+	{
+		for (size_t k = 0; k < AFLRUN_HAVOC_OPS; ++k)
+		{
+			sum.uses[k] += op_stats()[t].uses[k];
+			sum.finds[k] += op_stats()[t].finds[k];
+		}
+	}
+
+	// Thompson sampling of the find rate of each operator from its posterior
+	// Beta distribution, mixed with the default shares so none ever starves
+	constexpr double kExplore = 0.1;
+	double thetas[AFLRUN_HAVOC_OPS];
+	double total = 0, total_widths = 0;
+	for (size_t k = 0; k < AFLRUN_HAVOC_OPS; ++k)
+	{
+		gamma_distribution<double> ga(1 + sum.finds[k], 1);
+		gamma_distribution<double> gb(
+			1 + max(sum.uses[k] - sum.finds[k], 0.0), 1);
+		double a = ga(gen()), b = gb(gen());
+		thetas[k] = widths[k] * (a + b > 0 ? a / (a + b) : 0);
+		total += thetas[k];
+		total_widths += widths[k];
+	}
+	for (size_t k = 0; k < AFLRUN_HAVOC_OPS; ++k)
+	{
+		ret[k] = kExplore * widths[k] / total_widths;
+		if (total > 0)
+			ret[k] += (1 - kExplore) * thetas[k] / total;
+		else
+			ret[k] += (1 - kExplore) * widths[k] / total_widths;
+	}
+}
+
+void aflrun_op_update(const u32* uses, const u32* finds)
+{
+	if (op_stats().empty())
+		return;
+	for (reach_t t : op_targets())
+		op_stats()[t].update(uses, finds);
+	op_stats()[g()->num_targets].update(uses, finds);
 }
 
 void aflrun_get_reached(reach_t* num_reached, reach_t* num_freached,
 	reach_t* num_reached_targets, reach_t* num_freached_targets)
 {
-	*num_reached = g->num_reached;
-	*num_freached = g->num_freached;
-	*num_reached_targets = g->num_reached_targets;
-	*num_freached_targets = g->num_freached_targets;
+	*num_reached = g()->num_reached;
+	*num_freached = g()->num_freached;
+	*num_reached_targets = g()->num_reached_targets;
+	*num_freached_targets = g()->num_freached_targets;
 }
 
 void aflrun_get_time(u64* last_reachable, u64* last_fringe,
 	u64* last_pro_fringe, u64* last_target, u64* last_ctx_reachable,
 	u64* last_ctx_fringe, u64* last_ctx_pro_fringe, u64* last_ctx_target)
 {
-	*last_reachable = update_time.last_reachable;
-	*last_fringe = update_time.last_fringe;
-	*last_pro_fringe = update_time.last_pro_fringe;
-	*last_target = update_time.last_target;
-	*last_ctx_reachable = update_time.last_ctx_reachable;
-	*last_ctx_fringe = update_time.last_ctx_fringe;
-	*last_ctx_pro_fringe = update_time.last_ctx_pro_fringe;
-	*last_ctx_target = update_time.last_ctx_target;
+	*last_reachable = update_time().last_reachable;
+	*last_fringe = update_time().last_fringe;
+	*last_pro_fringe = update_time().last_pro_fringe;
+	*last_target = update_time().last_target;
+	*last_ctx_reachable = update_time().last_ctx_reachable;
+	*last_ctx_fringe = update_time().last_ctx_fringe;
+	*last_ctx_pro_fringe = update_time().last_ctx_pro_fringe;
+	*last_ctx_target = update_time().last_ctx_target;
 }
 
 /* ----- Functions called at begining of each cycle ----- */
@@ -3087,21 +5988,21 @@ namespace
 {
 void assign_energy_seed(u32 num_seeds, const u32* seeds, double* ret)
 {
-	switch (state.get_mode())
+	switch (state().get_mode())
 	{
 	case AFLRunState::kFringe:
 	{
-		path_fringes->assign_energy(num_seeds, seeds, ret);
+		path_fringes()->assign_energy(num_seeds, seeds, ret);
 		return;
 	}
 	case AFLRunState::kProFringe:
 	{
-		path_pro_fringes->assign_energy(num_seeds, seeds, ret);
+		path_pro_fringes()->assign_energy(num_seeds, seeds, ret);
 		return;
 	}
 	case AFLRunState::kTarget:
 	{
-		reached_targets->assign_energy(num_seeds, seeds, ret);
+		reached_targets()->assign_energy(num_seeds, seeds, ret);
 		return;
 	}
 	case AFLRunState::kUnite:
@@ -3117,86 +6018,567 @@ void assign_energy_seed(u32 num_seeds, const u32* seeds, double* ret)
 
 void aflrun_assign_energy(u32 num_seeds, const u32* seeds, double* ret)
 {
-	if (!config.seed_based_energy)
+	if (!config().seed_based_energy)
 	{
 		cerr << "Old energy assignment is no longer supported" << endl;
 		abort();
 	}
+	AFL_PROBE(aflrun, assign_energy_begin, num_seeds);
 	assign_energy_seed(num_seeds, seeds, ret);
+	AFL_PROBE(aflrun, assign_energy_end, num_seeds);
+	// Target groups of splice partners are rebuilt once in each cycle
+	path_fringes()->grouper.reset();
+	path_pro_fringes()->grouper.reset();
+	reached_targets()->grouper.reset();
 }
 
-// Call this function at end of all cycles,
-// including beginning of the first cycle or when state is reset
-// (pseudo cycle end where `cycle_count` increment from -1 to 0).
-// The function return the new mode
-u8 aflrun_cycle_end(u8* whole_end)
+namespace
+{
+template <typename F, typename D>
+void save_fringe_stats(const FringeBlocks<F, D>& fb,
+	vector<SchedulerCheckpoint::FringeStat>& ret)
 {
-	*whole_end = state.cycle_end();
-	return state.get_mode();
+	ret.clear();
+	for (const auto& fi : fb.fringes)
+	{
+		auto it = fb.freq_idx.find(fi.first);
+		ret.push_back({checkpoint_key(fi.first), fi.second.fuzzed_quant,
+			it == fb.freq_idx.end() ? 0 : fb.freq[it->second].second});
+	}
 }
 
-/* ----- Functions called when new reachable block becomes non-virgin ----- */
-
-namespace
+// Fringes not rebuilt by dry run, e.g. because their seeds are gone, are
+// skipped; so are fringes new to dry run, which were never fuzzed.
+template <typename F, typename D>
+void restore_fringe_stats(FringeBlocks<F, D>& fb,
+	const vector<SchedulerCheckpoint::FringeStat>& stats)
 {
+	for (const auto& s : stats)
+	{
+		F f = from_checkpoint_key<F>(s.key);
+		auto it = fb.fringes.find(f);
+		if (it == fb.fringes.end())
+			continue;
+		it->second.fuzzed_quant = s.fuzzed_quant;
+		fb.journal_touch(f);
+		auto i = fb.freq_idx.find(f);
+		if (i != fb.freq_idx.end())
+			fb.freq[i->second].second = s.freq;
+	}
+}
 
-// Perform vigin BFS from given block,
-// return map from reached target to a set of blocks containing a path to it
-
-template <typename D>
-inline rh::unordered_set<D> trace_decisives(
-	const rh::unordered_map<D, D>& parent, const D& start, const D& v)
+// Checkpoint of scheduler state to `aflrun_state` in output directory, written
+// every `checkpoint_interval` seconds at end of a cycle, before state machine
+// moves on, and at exit. When resuming, clusters are restored before dry run
+// and everything else after it: dry run rebuilds fringes and diversity blocks
+// from seeds, but not how long they were fuzzed or where the state machine is.
+class Checkpoint
 {
-	rh::unordered_set<D> decisives;
+	static constexpr u64 kMagic = 0x31504B43524C4641ULL; // "AFLRCKP1"
+#ifdef AFLRUN_CTX_DIV
+	static constexpr u64 kCtxDiv = 1;
+#else
+	static constexpr u64 kCtxDiv = 0;
+#endif
 
-	// Get all blocks consisting of path towards the target
-	D cur = v;
-	do
-	{
-		decisives.insert(cur);
-		cur = parent.find(cur)->second;
-	} while (!(cur == start));
+	SchedulerCheckpoint ckpt;
+	bool loaded = false; // `ckpt` is read from file and not applied yet
+	bool ready = false; // Nothing is left to restore, so we can write
+	u64 last_write = 0;
 
-	return decisives;
-}
+	struct Reader
+	{
+		const char* p; const char* end;
+		template <typename T>
+		T get()
+		{
+			if (static_cast<size_t>(end - p) < sizeof(T))
+				throw string("truncated");
+			T v; memcpy(&v, p, sizeof(T)); p += sizeof(T);
+			return v;
+		}
+		template <typename T>
+		void get_vec(vector<T>& v)
+		{
+			u64 n = get<u64>();
+			if (n > static_cast<size_t>(end - p) / sizeof(T))
+				throw string("truncated");
+			v.resize(n);
+			memcpy(v.data(), p, n * sizeof(T)); p += n * sizeof(T);
+		}
+	};
 
-template <typename D>
-rh::unordered_map<reach_t, rh::unordered_set<D>> get_target_paths(D);
+	template <typename T>
+	static void put(string& buf, const T& v)
+	{
+		buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+	}
+	template <typename T>
+	static void put_vec(string& buf, const vector<T>& v)
+	{
+		put<u64>(buf, v.size());
+		buf.append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+	}
 
-template <>
-rh::unordered_map<reach_t, rh::unordered_set<reach_t>>
-	get_target_paths<reach_t>(reach_t block)
-{
-	// https://en.wikipedia.org/wiki/Breadth-first_search#Pseudocode
-	rh::unordered_map<reach_t, rh::unordered_set<reach_t>> ret;
-	queue<reach_t> q; rh::unordered_map<reach_t, reach_t> parent;
-	for (reach_t dst : graph->src_to_dst[block])
+	static string path()
 	{
-		if (IS_SET(g->virgin_reachables, dst))
-		{ // add all outgoing virgin vertexes to queue as initialization
-			parent.emplace(dst, block);
-			q.push(dst);
-		}
+		return g()->out_dir + "aflrun_state";
 	}
-	while (!q.empty())
+	// Identify the target, a checkpoint is only restored if they all match
+	static vector<u64> header()
 	{
-		reach_t v = q.front(); q.pop();
+		return {kMagic, kCtxDiv, g()->num_targets, g()->num_reachables,
+			g()->num_ftargets, g()->num_freachables, g()->map_size};
+	}
 
-		if (v < g->num_targets)
+	static string encode(const SchedulerCheckpoint& c)
+	{
+		string buf;
+		for (u64 h : header())
+			put(buf, h);
+		put(buf, c.mode); put(buf, c.reset_exploit); put(buf, c.init_cov);
+		put(buf, c.cycle_count); put(buf, c.whole_count);
+		put(buf, c.cov_quant); put(buf, c.exploration_quant);
+		put(buf, c.exploitation_quant);
+		put_vec(buf, c.seed_quant);
+		for (const auto& fs : c.fringe_stats)
+			put_vec(buf, fs);
+		put_vec(buf, c.cluster_valid);
+		for (const auto& cm : c.cluster_members)
+			put_vec(buf, cm);
+		put_vec(buf, c.supp_cnt); put_vec(buf, c.pair_supp_cnt);
+		put(buf, c.num_evicted);
+		return buf;
+	}
+	static void decode(const string& data, SchedulerCheckpoint& c)
+	{
+		Reader r{data.data(), data.data() + data.size()};
+		for (u64 h : header())
 		{
-			ret.emplace(v, trace_decisives<reach_t>(parent, block, v));
+			if (r.get<u64>() != h)
+				throw string("not of this target");
 		}
-
-		for (reach_t w : graph->src_to_dst[v])
+		c.mode = r.get<u8>();
+		c.reset_exploit = r.get<u8>(); c.init_cov = r.get<u8>();
+		c.cycle_count = r.get<s32>(); c.whole_count = r.get<u64>();
+		c.cov_quant = r.get<double>();
+		c.exploration_quant = r.get<double>();
+		c.exploitation_quant = r.get<double>();
+		if (c.mode > AFLRunState::kUnite)
+			throw string("invalid mode");
+		r.get_vec(c.seed_quant);
+		for (auto& fs : c.fringe_stats)
+			r.get_vec(fs);
+		r.get_vec(c.cluster_valid);
+		if (c.cluster_valid.empty() || !c.cluster_valid[0])
+			throw string("invalid clusters");
+		c.cluster_members.resize(c.cluster_valid.size());
+		rh::unordered_set<u64> members;
+		for (size_t i = 0; i < c.cluster_members.size(); ++i)
 		{
-			if (!IS_SET(g->virgin_reachables, w))
-				continue;
-			if (parent.find(w) == parent.end())
+			r.get_vec(c.cluster_members[i]);
+			if (!c.cluster_valid[i] && !c.cluster_members[i].empty())
+				throw string("invalid clusters");
+			for (u64 k : c.cluster_members[i])
 			{
-				parent.emplace(w, v);
-				q.push(w);
+				if (!members.insert(k).second)
+					throw string("invalid clusters");
 			}
 		}
+		r.get_vec(c.supp_cnt); r.get_vec(c.pair_supp_cnt);
+		for (const auto& p : c.pair_supp_cnt)
+		{
+			if (p.fst >= p.snd)
+				throw string("invalid support counts");
+		}
+		c.num_evicted = r.get<u64>();
+		if (r.p != r.end)
+			throw string("trailing data");
+	}
+
+public:
+	string error; // Why the checkpoint cannot be used
+
+	// Return 1 if clusters are restored from the checkpoint, 0 if there is
+	// none, or -1 if it cannot be used, in which case nothing is restored.
+	int load()
+	{
+		ifstream in(path(), ios::binary);
+		if (!in.is_open())
+			return 0;
+		const string data(
+			(istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		try
+		{
+			decode(data, ckpt);
+		}
+		catch (const string& e)
+		{
+			ckpt = SchedulerCheckpoint();
+			error = e;
+			return -1;
+		}
+		clusters().restore_members(ckpt);
+		loaded = true;
+		return 1;
+	}
+
+	void apply()
+	{
+		ready = true;
+		last_write = get_cur_time();
+		if (!loaded)
+			return;
+		loaded = false;
+		state().restore(ckpt);
+		seed_quant() = ckpt.seed_quant;
+		restore_fringe_stats(*path_fringes(), ckpt.fringe_stats[0]);
+		restore_fringe_stats(*path_pro_fringes(), ckpt.fringe_stats[1]);
+		restore_fringe_stats(*reached_targets(), ckpt.fringe_stats[2]);
+		clusters().restore_counts(ckpt);
+		ckpt = SchedulerCheckpoint();
+		// A checkpoint that is not kept up to date must not be restored again
+		if (!config().checkpoint_interval)
+			unlink(path().c_str());
+	}
+
+	void write()
+	{
+		if (!ready)
+			return;
+		SchedulerCheckpoint c;
+		state().save(c);
+		c.seed_quant = seed_quant();
+		save_fringe_stats(*path_fringes(), c.fringe_stats[0]);
+		save_fringe_stats(*path_pro_fringes(), c.fringe_stats[1]);
+		save_fringe_stats(*reached_targets(), c.fringe_stats[2]);
+		clusters().save(c);
+		auto data = make_shared<const string>(encode(c));
+		diag_writer.submit(path(), [data](ostream& out)
+		{
+			out.write(data->data(), data->size());
+		});
+		last_write = get_cur_time();
+	}
+
+	void update()
+	{
+		if (config().checkpoint_interval &&
+			get_cur_time() - last_write >= config().checkpoint_interval * 1000)
+			write();
+	}
+};
+
+Checkpoint& checkpoint();
+
+// Controller of `auto_tune`: at cycle ends at least `kInterval` apart, it
+// compares the share of fuzzer time in AFLRun bookkeeping since its last
+// step with `auto_tune`, and looks at clusters evicted by `cluster_mem_budget`
+// and at the last time anything new was reached. Over budget, clusters are
+// merged more readily, fringes invalidated by fewer seeds and cycles made
+// longer; under half of it and with nothing new, thresholds move back up,
+// within bounds around the configured values. Initial coverage fuzzing is
+// cut short once it reaches nothing new, and extended while it does.
+class AutoTuner
+{
+	static constexpr u64 kInterval = 60 * 1000;
+	static constexpr double kStep = 1.5;
+
+	bool started = false;
+	double base_supp_cnt_thr = 0, base_conf_thr = 0;
+	double base_cycle_energy = 0, base_init_cov_quant = 0;
+	u64 last_time = 0, last_ticks = 0, last_total = 0;
+	size_t last_evicted = 0;
+
+	static u64 last_update()
+	{
+		const AFLRunUpdateTime& t = update_time();
+		return max({t.last_reachable, t.last_fringe, t.last_pro_fringe,
+			t.last_target, t.last_ctx_reachable, t.last_ctx_fringe,
+			t.last_ctx_pro_fringe, t.last_ctx_target});
+	}
+
+	void tune_clusters(bool over)
+	{
+		// Thresholds set to disable or force merges are left alone
+		if (config().supp_cnt_thr > 0 && !isinf(config().conf_thr) &&
+			config().conf_thr > 0)
+		{
+			if (over)
+			{
+				config().supp_cnt_thr =
+					max(config().supp_cnt_thr / kStep, base_supp_cnt_thr / 16);
+				config().conf_thr =
+					max(config().conf_thr / kStep, base_conf_thr / 2);
+				clusters().retry_merge();
+			}
+			else
+			{
+				config().supp_cnt_thr =
+					min(config().supp_cnt_thr * kStep, base_supp_cnt_thr * 4);
+				config().conf_thr =
+					min(config().conf_thr * kStep, (1 + base_conf_thr) / 2);
+			}
+		}
+		if (over && !config().no_diversity &&
+			config().div_seed_thr != numeric_limits<u32>::max() &&
+			config().div_seed_thr > 2)
+		{
+			div_blocks()->lower_seed_thr(
+				max<u32>(2, config().div_seed_thr / kStep));
+		}
+	}
+
+public:
+	void update(u64 ticks, u64 total)
+	{
+		u64 now = get_cur_time();
+		size_t evicted = clusters().get_num_evicted();
+		if (!started)
+		{
+			started = true;
+			base_supp_cnt_thr = config().supp_cnt_thr;
+			base_conf_thr = config().conf_thr;
+			base_cycle_energy = config().cycle_energy;
+			base_init_cov_quant = config().init_cov_quant;
+		}
+		else if (now - last_time < kInterval)
+		{
+			return;
+		}
+		else
+		{
+			double share = total > last_total ?
+				(double)(ticks - last_ticks) / (total - last_total) : 0;
+			bool progress = last_update() > last_time;
+			bool over = share > config().auto_tune || evicted > last_evicted;
+			bool under = !over && share < config().auto_tune / 2;
+
+			if (state().is_init_cov())
+			{
+				int cycle; u32 cov_quant;
+				state().get_counts(cycle, cov_quant);
+				if (!progress)
+					config().init_cov_quant =
+						min<double>(config().init_cov_quant, cov_quant);
+				else if (under)
+					config().init_cov_quant = min(
+						config().init_cov_quant * kStep, base_init_cov_quant * 4);
+			}
+
+			if (over)
+			{
+				tune_clusters(true);
+				config().cycle_energy =
+					min(config().cycle_energy * kStep, base_cycle_energy * 8);
+			}
+			else if (under && !progress)
+			{
+				tune_clusters(false);
+				config().cycle_energy =
+					max(config().cycle_energy / kStep, base_cycle_energy);
+			}
+		}
+		last_time = now; last_ticks = ticks; last_total = total;
+		last_evicted = evicted;
+	}
+};
+
+AutoTuner& auto_tuner();
+}
+
+int aflrun_load_checkpoint(const char** error)
+{
+	int ret = checkpoint().load();
+	*error = checkpoint().error.c_str();
+	return ret;
+}
+
+void aflrun_apply_checkpoint(void)
+{
+	checkpoint().apply();
+}
+
+void aflrun_write_checkpoint(void)
+{
+	if (config().checkpoint_interval)
+		checkpoint().write();
+}
+
+// Call this function at end of all cycles,
+// including beginning of the first cycle or when state is reset
+// (pseudo cycle end where `cycle_count` increment from -1 to 0).
+// The function return the new mode
+void aflrun_tune(u64 ticks, u64 total)
+{
+	if (config().auto_tune > 0)
+		auto_tuner().update(ticks, total);
+}
+
+u8 aflrun_cycle_end(u8* whole_end)
+{
+	checkpoint().update();
+	if (config().target_ctl)
+		target_control().update();
+	if (config().tw_half_life > 0)
+		g()->update_tw_decay(get_cur_time());
+	u8 old_mode = state().get_mode();
+	AFLRunState::Event event = state().is_preempted() ?
+		AFLRunState::kPreempted : AFLRunState::kCycleEnd;
+	*whole_end = state().cycle_end();
+	AFL_PROBE(aflrun, cycle_end, old_mode, (u8)state().get_mode(), *whole_end);
+	log_state(event, old_mode, *whole_end);
+	g()->seeds_log.flush();
+	g()->timeline.flush();
+	g()->reach_log.flush();
+#ifdef AFLRUN_POOL
+	aflrun_pool::Pool::get().compact();
+#endif
+	return state().get_mode();
+}
+
+/* ----- Functions called when new reachable block becomes non-virgin ----- */
+
+namespace
+{
+
+// Reusable state of BFS over blocks: a block is visited in current search iff
+// its stamp equals `epoch`, so nothing needs to be cleared between searches.
+struct BlockBFS
+{
+	vector<reach_t> parent;
+	vector<u32> stamp;
+	vector<reach_t> queue; // Each block is pushed at most once, so never wraps
+	u32 epoch = 0;
+
+	void begin(reach_t num_reachables)
+	{
+		if (stamp.size() < num_reachables)
+		{
+			parent.resize(num_reachables);
+			stamp.assign(num_reachables, 0);
+			epoch = 0;
+		}
+		if (++epoch == 0)
+		{ // Reset stamps when epoch overflows
+			fill(stamp.begin(), stamp.end(), 0);
+			epoch = 1;
+		}
+		queue.clear();
+	}
+
+	inline void visit(reach_t v, reach_t p)
+	{
+		if (stamp[v] == epoch)
+			return;
+		stamp[v] = epoch;
+		parent[v] = p;
+		queue.push_back(v);
+	}
+
+	// Get all blocks consisting of path from `start` towards `v`
+	DecisivePath<reach_t> trace(reach_t start, reach_t v) const
+	{
+		vector<reach_t> decisives;
+		do
+		{
+			decisives.push_back(v);
+			v = parent[v];
+		} while (v != start);
+		decisives.shrink_to_fit();
+		return make_shared<const vector<reach_t>>(std::move(decisives));
+	}
+} block_bfs;
+
+// Context of `block` recorded by the runtime when called in context `ctx`
+inline u32 recorded_ctx(reach_t block, u32 ctx)
+{
+	return !no_ctx_blocks().empty() && no_ctx_blocks()[block] ? 0 : ctx;
+}
+
+// Whether `block` is not yet covered in context `ctx`
+inline bool is_virgin_ctx(reach_t block, u32 ctx)
+{
+	return IS_SET(g()->virgin_ctx, CTX_IDX(block, recorded_ctx(block, ctx)));
+}
+
+// Same as `BlockBFS` but for BFS over (block, context) states, which are too
+// many to be indexed by an array; visited states are stored in a cleared but
+// not deallocated map, and the node array itself is used as the queue.
+struct FringeBFS
+{
+	static constexpr size_t kRoot = numeric_limits<size_t>::max();
+	struct Node
+	{
+		Fringe state;
+		size_t parent; // Index of parent node, or `kRoot`
+		bool is_call;
+	};
+	vector<Node> nodes;
+	rh::unordered_flat_set<Fringe> visited;
+
+	void begin()
+	{
+		nodes.clear();
+		visited.clear();
+	}
+
+	inline void visit(const Fringe& v, size_t p, bool is_call = false)
+	{
+		if (visited.insert(v).second)
+			nodes.push_back({v, p, is_call});
+	}
+
+	// States keep the whole context, so that contexts after blocks without
+	// one are right, but decisives are what the runtime records.
+	DecisivePath<Fringe> trace(size_t v) const
+	{
+		vector<Fringe> decisives;
+		for (; v != kRoot; v = nodes[v].parent)
+		{
+			const Fringe& s = nodes[v].state;
+			decisives.emplace_back(s.block, recorded_ctx(s.block, s.context));
+		}
+		decisives.shrink_to_fit();
+		return make_shared<const vector<Fringe>>(std::move(decisives));
+	}
+} fringe_bfs;
+
+// Perform vigin BFS from given block,
+// return map from reached target to a set of blocks containing a path to it
+
+template <typename D>
+TargetPaths<D> get_target_paths(D);
+
+template <>
+TargetPaths<reach_t> get_target_paths<reach_t>(reach_t block)
+{
+	// https://en.wikipedia.org/wiki/Breadth-first_search#Pseudocode
+	TargetPaths<reach_t> ret;
+	BlockBFS& bfs = block_bfs;
+	bfs.begin(g()->num_reachables);
+	for (reach_t dst : graph()->src_to_dst[block])
+	{
+		if (IS_SET(g()->virgin_reachables, dst))
+		{ // add all outgoing virgin vertexes to queue as initialization
+			bfs.visit(dst, block);
+		}
+	}
+	for (size_t head = 0; head < bfs.queue.size(); ++head)
+	{
+		reach_t v = bfs.queue[head];
+
+		if (v < g()->num_targets)
+		{
+			ret.emplace(v, bfs.trace(block, v));
+		}
+
+		for (reach_t w : graph()->src_to_dst[v])
+		{
+			if (!IS_SET(g()->virgin_reachables, w))
+				continue;
+			bfs.visit(w, v);
+		}
 	}
 	return ret;
 }
@@ -3206,12 +6588,12 @@ vector<u32> get_next_hashes(const Fringe& src, reach_t dst, bool& is_call)
 	u32 ctx = src.context;
 	reach_t block = src.block;
 	auto p = make_pair<reach_t, reach_t>(std::move(block), std::move(dst));
-	auto it = graph->call_hashes.find(p);
+	auto it = graph()->call_hashes.find(p);
 
 	vector<u32> next_hashes;
 	// If it is a call edge with multiple hashes, calculate new ctx.
 	// e.i. one block calls same function for multiple times
-	if (it != graph->call_hashes.end())
+	if (it != graph()->call_hashes.end())
 	{
 		for (u32 h : it->second)
 		{
@@ -3228,12 +6610,16 @@ vector<u32> get_next_hashes(const Fringe& src, reach_t dst, bool& is_call)
 	return next_hashes;
 }
 
+// Targets already in the result of `get_target_paths_slow`, as a bitset
+// cleared from the keys of the result when it returns
+vector<u64>& visited_targets();
+
 // This is a helper function for `get_target_paths<Fringe>` for optimization,
 // because going through all possible states with contexts are too expensive.
 bool all_targets_visited(reach_t block,
-	const rh::unordered_map<reach_t, rh::unordered_set<Fringe>>& cur)
+	const TargetPaths<Fringe>& cur)
 {
-	size_t num_ts = g->reachable_to_size[block];
+	size_t num_ts = g()->reachable_to_size[block];
 
 	// If number of reachable targets are larger than number of visited targets,
 	// then there must be some targets reachable by `block` not visited yet;
@@ -3241,13 +6627,13 @@ bool all_targets_visited(reach_t block,
 	if (num_ts > cur.size())
 		return false;
 
-	const reach_t* beg = g->reachable_to_targets[block];
+	const reach_t* beg = g()->reachable_to_targets[block];
 	const reach_t* end = beg + num_ts;
 
 	for (const reach_t* t = beg; t < end; ++t)
 	{ // If there is a target rechable by `block` not yet visited by `cur`,
 		// we should return false.
-		if (cur.find(*t) == cur.end())
+		if (!((visited_targets()[*t / 64] >> (*t % 64)) & 1))
 			return false;
 	}
 
@@ -3259,61 +6645,57 @@ bool all_targets_visited(reach_t block,
 // Basically same as above, except when doing BFS,
 // we consider the context and regard same `dst` node with different contexts
 // as different next possible states.
-rh::unordered_map<reach_t, rh::unordered_set<Fringe>>
-	get_target_paths_slow(const Fringe& block_ctx)
+TargetPaths<Fringe> get_target_paths_slow(const Fringe& block_ctx)
 {
-	rh::unordered_map<reach_t, rh::unordered_set<Fringe>> ret;
-	queue<Fringe> q; rh::unordered_map<Fringe, Fringe> parent;
+	TargetPaths<Fringe> ret;
+	FringeBFS& bfs = fringe_bfs;
+	bfs.begin();
 	reach_t block = block_ctx.block;
 	bool dummy;
+	if (visited_targets().empty())
+		visited_targets().assign((g()->num_targets + 63) / 64, 0);
 
 	// For given source state (e.i. block and context),
 	// we iterate all possible next states and add them into queue.
-	for (reach_t dst : graph->src_to_dst[block])
+	for (reach_t dst : graph()->src_to_dst[block])
 	{
 		auto next_hashes = get_next_hashes(block_ctx, dst, dummy);
 		for (u32 next_hash : next_hashes)
 		{
-			if (IS_SET(g->virgin_ctx, CTX_IDX(dst, next_hash)))
-			{
-				Fringe next(dst, next_hash);
-				parent.emplace(next, block_ctx);
-				q.push(next);
-			}
+			if (is_virgin_ctx(dst, next_hash))
+				bfs.visit(Fringe(dst, next_hash), FringeBFS::kRoot);
 		}
 	}
 
-	while (!q.empty())
+	for (size_t head = 0; head < bfs.nodes.size(); ++head)
 	{
-		Fringe v = q.front(); q.pop();
+		Fringe v = bfs.nodes[head].state;
 
 		// If we reached the target via BFS for the first time,
 		// we trace and record paths to it, similar to above
-		if (v.block < g->num_targets && ret.find(v.block) == ret.end())
+		if (v.block < g()->num_targets && ret.find(v.block) == ret.end())
 		{
-			ret.emplace(v.block, trace_decisives<Fringe>(parent, block_ctx, v));
+			ret.emplace(v.block, bfs.trace(head));
+			visited_targets()[v.block / 64] |= 1ULL << (v.block % 64);
 		}
 
 		// All possible next states are virgin (block, ctx) pairs
-		for (reach_t w : graph->src_to_dst[v.block])
+		for (reach_t w : graph()->src_to_dst[v.block])
 		{
 			if (all_targets_visited(w, ret))
 				continue;
 			auto next_hashes = get_next_hashes(v, w, dummy);
 			for (u32 next_hash : next_hashes)
 			{
-				if (!IS_SET(g->virgin_ctx, CTX_IDX(w, next_hash)))
+				if (!is_virgin_ctx(w, next_hash))
 					continue;
-				Fringe next(w, next_hash);
-				if (parent.find(next) == parent.end())
-				{
-					parent.emplace(next, v);
-					q.push(next);
-				}
+				bfs.visit(Fringe(w, next_hash), head);
 			}
 		}
 	}
 
+	for (const auto& p : ret)
+		visited_targets()[p.first / 64] = 0;
 	return ret;
 }
 
@@ -3330,75 +6712,68 @@ rh::unordered_map<reach_t, rh::unordered_set<Fringe>>
 // a context-sensitive path to these targets.
 // However, such fast hack has 2 problems:
 // 1. Cannot handle hash collision; 2. potentially problematic for recursion.
-rh::unordered_map<reach_t, rh::unordered_set<Fringe>>
-	get_target_paths_fast(const Fringe& block_ctx)
+TargetPaths<Fringe> get_target_paths_fast(const Fringe& block_ctx)
 {
-	rh::unordered_map<reach_t, rh::unordered_set<Fringe>> ret;
-	queue<pair<Fringe, bool>> q; rh::unordered_map<Fringe, Fringe> parent;
+	TargetPaths<Fringe> ret;
+	FringeBFS& bfs = fringe_bfs;
+	bfs.begin();
 	reach_t block = block_ctx.block;
 
 	// Similar to the slow one,
 	// except we also record whether `Fringe` is a call in the queue.
 
-	for (reach_t dst : graph->src_to_dst[block])
+	for (reach_t dst : graph()->src_to_dst[block])
 	{
 		bool is_call;
 		auto next_hashes = get_next_hashes(block_ctx, dst, is_call);
 		for (u32 next_hash : next_hashes)
 		{
-			if (IS_SET(g->virgin_ctx, CTX_IDX(dst, next_hash)))
-			{
-				Fringe next(dst, next_hash);
-				parent.emplace(next, block_ctx);
-				q.push(make_pair(std::move(next), std::move(is_call)));
-			}
+			if (is_virgin_ctx(dst, next_hash))
+				bfs.visit(Fringe(dst, next_hash), FringeBFS::kRoot, is_call);
 		}
 	}
 
-	while (!q.empty())
+	for (size_t head = 0; head < bfs.nodes.size(); ++head)
 	{
-		auto tmp = q.front(); q.pop();
-		const Fringe& v = tmp.first;
+		// Copy because `nodes` can be reallocated when visiting children
+		const Fringe v = bfs.nodes[head].state;
+		const bool is_call = bfs.nodes[head].is_call;
 
 		// We still need to check potential targets in the function
-		if (!tmp.second &&
-			v.block < g->num_targets && ret.find(v.block) == ret.end())
+		if (!is_call &&
+			v.block < g()->num_targets && ret.find(v.block) == ret.end())
 		{
-			ret.emplace(v.block, trace_decisives<Fringe>(parent, block_ctx, v));
+			ret.emplace(v.block, bfs.trace(head));
 		}
 
 		// If current virgin `Fringe` is visited from call edge,
 		// then we get a trace from it, and assign to each target it can reach;
 		// also we don't continue to visit its child blocks.
-		if (tmp.second)
+		if (is_call)
 		{
-			auto decisives = trace_decisives(parent, block_ctx, v);
+			auto decisives = bfs.trace(head);
 
-			const reach_t* beg = g->reachable_to_targets[v.block];
-			const reach_t* end = beg + g->reachable_to_size[v.block];
+			const reach_t* beg = g()->reachable_to_targets[v.block];
+			const reach_t* end = beg + g()->reachable_to_size[v.block];
 			for (const reach_t* t = beg + 1; t < end; ++t)
 			{
-				// If key `*t` already exists, `emplace` does nothing.
+				// If key `*t` already exists, `emplace` does nothing;
+				// otherwise the target shares the path.
 				ret.emplace(*t, decisives);
 			}
 			ret.emplace(*beg, std::move(decisives));
 		}
 		else
 		{
-			for (reach_t w : graph->src_to_dst[v.block])
+			for (reach_t w : graph()->src_to_dst[v.block])
 			{
-				bool is_call;
-				auto next_hashes = get_next_hashes(v, w, is_call);
+				bool next_is_call;
+				auto next_hashes = get_next_hashes(v, w, next_is_call);
 				for (u32 next_hash : next_hashes)
 				{
-					if (!IS_SET(g->virgin_ctx, CTX_IDX(w, next_hash)))
+					if (!is_virgin_ctx(w, next_hash))
 						continue;
-					Fringe next(w, next_hash);
-					if (parent.find(next) == parent.end())
-					{
-						parent.emplace(next, v);
-						q.push(make_pair(std::move(next), std::move(is_call)));
-					}
+					bfs.visit(Fringe(w, next_hash), head, next_is_call);
 				}
 			}
 		}
@@ -3408,15 +6783,216 @@ rh::unordered_map<reach_t, rh::unordered_set<Fringe>>
 }
 
 template <>
-rh::unordered_map<reach_t, rh::unordered_set<Fringe>>
-	get_target_paths<Fringe>(Fringe block_ctx)
+TargetPaths<Fringe> get_target_paths<Fringe>(Fringe block_ctx)
 {
-	if (config.slow_ctx_bfs)
+	if (config().slow_ctx_bfs)
 		return get_target_paths_slow(block_ctx);
 	else
 		return get_target_paths_fast(block_ctx);
 }
 
+// Result of virgin BFS only depends on source and virgin maps, so we memoize
+// it until `virgin_version` is bumped, which must happen whenever virgin maps
+// are changed; this saves traversing the same virgin region again and again
+// when one execution exposes many new fringes at once. BFS over blocks only
+// depends on virgin blocks, so it is kept until `virgin_block_version` is
+// bumped, i.e. across executions that only reach new contexts.
+u64& virgin_version();
+u64& virgin_block_version();
+
+template <typename D>
+inline u64 target_paths_version();
+template <>
+inline u64 target_paths_version<reach_t>()
+{
+	return virgin_block_version();
+}
+template <>
+inline u64 target_paths_version<Fringe>()
+{
+	return virgin_version();
+}
+
+// Memoized BFS results, and the version they are of
+template <typename D>
+struct TargetPathsCache
+{
+	u64 version = 0;
+	rh::unordered_map<D, TargetPaths<D>> paths;
+};
+template <typename D>
+TargetPathsCache<D>& target_paths_memo();
+template <>
+TargetPathsCache<reach_t>& target_paths_memo<reach_t>();
+template <>
+TargetPathsCache<Fringe>& target_paths_memo<Fringe>();
+
+template <typename D>
+rh::unordered_map<D, TargetPaths<D>>& target_paths_cache()
+{
+	auto& memo = target_paths_memo<D>();
+	if (memo.version != target_paths_version<D>())
+	{
+		memo.paths.clear();
+		memo.version = target_paths_version<D>();
+	}
+	return memo.paths;
+}
+
+template <typename D>
+TargetPaths<D> get_target_paths_cached(D d)
+{
+	auto& cache = target_paths_cache<D>();
+	auto it = cache.find(d);
+	if (it == cache.end())
+		it = cache.emplace(d, get_target_paths<D>(d)).first;
+	return it->second; // Copy of the map, paths themselves are shared
+}
+
+// Multi-source version of `get_target_paths<reach_t>`: up to 64 sources are
+// searched at once with a bit for each of them, so virgin blocks shared by
+// their searches are traversed once per level instead of once per source.
+// Each block keeps the blocks it was first reached from with the sources
+// coming from them, which is enough to trace a path for each source. Paths
+// are as short as those of `get_target_paths`, but when several are, the one
+// traced may be another one.
+struct MultiBlockBFS
+{
+	static constexpr u32 kNone = numeric_limits<u32>::max();
+	struct Parent
+	{
+		reach_t block;
+		u64 mask; // Sources that reached the block from `block`
+		u32 next; // Index of next parent of the block, or `kNone`
+	};
+	vector<u64> seen, mask; // Sources having reached each block, new ones
+	vector<u32> head; // First parent of each block, valid if seen
+	vector<Parent> parents;
+	vector<reach_t> touched, cur, next;
+	vector<u64> cur_mask;
+
+	void begin(reach_t num_reachables)
+	{
+		if (seen.size() < num_reachables)
+		{
+			seen.assign(num_reachables, 0);
+			mask.assign(num_reachables, 0);
+			head.resize(num_reachables);
+		}
+		parents.clear();
+		next.clear();
+	}
+
+	void end()
+	{
+		for (reach_t v : touched)
+			seen[v] = 0;
+		touched.clear();
+	}
+
+	inline void visit(reach_t w, reach_t v, u64 m)
+	{
+		u64 nb = m & ~seen[w];
+		if (nb == 0)
+			return;
+		if (seen[w] == 0)
+		{
+			touched.push_back(w);
+			head[w] = kNone;
+		}
+		seen[w] |= nb;
+		if (mask[w] == 0)
+			next.push_back(w);
+		mask[w] |= nb;
+		parents.push_back({v, nb, head[w]});
+		head[w] = parents.size() - 1;
+	}
+
+	DecisivePath<reach_t> trace(reach_t start, u64 bit, reach_t v) const
+	{
+		vector<reach_t> decisives;
+		do
+		{
+			decisives.push_back(v);
+			u32 p = head[v];
+			while (!(parents[p].mask & bit))
+				p = parents[p].next;
+			v = parents[p].block;
+		} while (v != start);
+		decisives.shrink_to_fit();
+		return make_shared<const vector<reach_t>>(std::move(decisives));
+	}
+
+	void search(const reach_t* srcs, size_t k, TargetPaths<reach_t>* ret)
+	{
+		begin(g()->num_reachables);
+		for (size_t i = 0; i < k; ++i)
+		{
+			for (reach_t dst : graph()->src_to_dst[srcs[i]])
+			{
+				if (IS_SET(g()->virgin_reachables, dst))
+					visit(dst, srcs[i], 1ULL << i);
+			}
+		}
+		while (!next.empty())
+		{
+			// Take masks of the level first, so bits found for blocks of
+			// the level while it is traversed wait for the next one
+			cur.swap(next);
+			next.clear();
+			cur_mask.resize(cur.size());
+			for (size_t j = 0; j < cur.size(); ++j)
+			{
+				cur_mask[j] = mask[cur[j]];
+				mask[cur[j]] = 0;
+			}
+			for (size_t j = 0; j < cur.size(); ++j)
+			{
+				reach_t v = cur[j];
+				u64 m = cur_mask[j];
+				if (v < g()->num_targets)
+				{
+					for (u64 b = m; b != 0; b &= b - 1)
+					{
+						size_t i = __builtin_ctzll(b);
+						ret[i].emplace(v, trace(srcs[i], 1ULL << i, v));
+					}
+				}
+				for (reach_t w : graph()->src_to_dst[v])
+				{
+					if (IS_SET(g()->virgin_reachables, w))
+						visit(w, v, m);
+				}
+			}
+		}
+		end();
+	}
+} multi_block_bfs;
+
+// Fill the cache of `get_target_paths_cached<reach_t>` for distinct `blocks`
+// of one execution, 64 at a time, before they are tried one by one.
+void prefetch_target_paths(const vector<reach_t>& blocks)
+{
+	auto& cache = target_paths_cache<reach_t>();
+	vector<reach_t> srcs;
+	for (reach_t b : blocks)
+	{
+		if (cache.find(b) == cache.end())
+			srcs.push_back(b);
+	}
+	TargetPaths<reach_t> ret[64];
+	for (size_t i = 0; i < srcs.size(); i += 64)
+	{
+		size_t k = min<size_t>(64, srcs.size() - i);
+		multi_block_bfs.search(srcs.data() + i, k, ret);
+		for (size_t j = 0; j < k; ++j)
+		{
+			cache.emplace(srcs[i + j], std::move(ret[j]));
+			ret[j].clear();
+		}
+	}
+}
+
 /* ----- Functions called for each test case mutated and executed ----- */
 
 template <typename D>
@@ -3435,7 +7011,7 @@ inline Fringe to_decisive<Fringe>(const Fringe& f)
 template <typename F, typename D>
 u8 FringeBlocks<F, D>::try_add_fringe(const Fringe& cand)
 {
-	auto target_decisives = get_target_paths<D>(to_decisive<D>(cand));
+	auto target_decisives = get_target_paths_cached<D>(to_decisive<D>(cand));
 	if (target_decisives.empty())
 		return 0;
 	for (auto& td : target_decisives)
@@ -3447,36 +7023,39 @@ u8 FringeBlocks<F, D>::try_add_fringe(const Fringe& cand)
 
 u8 try_add_fringe(const ctx_t& cand)
 {
+	PhaseTimer timer(AFLRUN_PHASE_FRINGE);
 	reach_t block = cand.block;
-	Fringe f_cand(block, cand.call_ctx);
+	Fringe f_cand(block, recorded_ctx(block, cand.call_ctx));
+	// Reached targets have no decisives
+	static const DecisivePath<u8> no_path = make_shared<const vector<u8>>();
 
 	/* For the ablation study that removes the critical blocks,
 	`path_pro_fringes` and `path_fringes` are both empty,
 	and we put all covered blocks into reached_targets.
 	Hope this hack does not cause any other problem. :) */
-	if (config.no_critical)
+	if (config().no_critical)
 	{
-		const reach_t* beg = g->reachable_to_targets[block];
-		const reach_t* end = beg + g->reachable_to_size[block];
+		const reach_t* beg = g()->reachable_to_targets[block];
+		const reach_t* end = beg + g()->reachable_to_size[block];
 		for (const reach_t* i = beg; i < end; ++i)
 		{
-			reached_targets->add_fringe(f_cand, *i, rh::unordered_set<u8>());
+			reached_targets()->add_fringe(f_cand, *i, no_path);
 		}
 		return 0;
 	}
 
-	u8 r2 = path_pro_fringes->try_add_fringe(f_cand);
+	u8 r2 = path_pro_fringes()->try_add_fringe(f_cand);
 
 #ifdef AFLRUN_CTX
 	// We add criticals to into `path_fringes` only when context is enabled.
-	u8 r1 = path_fringes->try_add_fringe(f_cand);
+	u8 r1 = path_fringes()->try_add_fringe(f_cand);
 	assert(!r2 || r1); // r2 -> r1
 #endif
 
 	// If candidate is fringe reaching a target and it is not added yet, we add it
-	if (block < g->num_targets)
+	if (block < g()->num_targets)
 	{
-		reached_targets->add_fringe(f_cand, block, rh::unordered_set<u8>());
+		reached_targets()->add_fringe(f_cand, block, no_path);
 	}
 
 #ifdef AFLRUN_CTX
@@ -3505,7 +7084,7 @@ vector<reach_t> FringeBlocks<F, D>::try_del_fringe(const Fringe& cand)
 			continue;
 
 		// Re-evaluate the fringe to see if it can still reach any target
-		auto target_decisives = get_target_paths<D>(to_decisive<D>(f));
+		auto target_decisives = get_target_paths_cached<D>(to_decisive<D>(f));
 		if (target_decisives.empty())
 		{ // If not, delete the fringe
 			if (this->del_fringe(f))
@@ -3519,45 +7098,56 @@ vector<reach_t> FringeBlocks<F, D>::try_del_fringe(const Fringe& cand)
 				// If an old target is not covered by new set of targets
 				if (target_decisives.find(td.first) == target_decisives.end())
 				{
-					this->target_to_fringes[td.first].erase(f);
+					if (this->target_to_fringes[td.first].erase(f))
+						this->fringe_removed(f, td.first);
 				}
 			}
 			for (const auto& td : target_decisives)
 			{
-				for (const D& d : td.second)
+				for (const D& d : *td.second)
 				{
 					this->decisive_to_fringes[d].insert(f);
 				}
 			}
 			it2->second.decisives = std::move(target_decisives);
+			this->journal_touch(f);
 		}
 	}
 	return ret;
 }
 
+// Remove all `seeds` at once: each fringe covered by any of them is updated
+// once, so removing many seeds covering the same fringes is not quadratic.
 template <typename F, typename D>
-void FringeBlocks<F, D>::remove_seed(u32 seed)
+void FringeBlocks<F, D>::remove_seeds(const SeedSet& seeds)
 {
-	auto it = seed_fringes.find(seed);
-	// skip if seed does not exists
-	if (it == seed_fringes.end())
-		return;
-	assert(!it->second.empty());
-	for (const auto& f : it->second)
+	rh::unordered_set<F> touched;
+	for (u32 seed : seeds)
+	{
+		auto it = seed_fringes.find(seed);
+		// skip if seed does not exists
+		if (it == seed_fringes.end())
+			continue;
+		assert(!it->second.empty());
+		touched.insert(it->second.begin(), it->second.end());
+		seed_fringes.erase(it);
+	}
+	for (const auto& f : touched)
 	{ // For all fringes, we need also to update its info about seeds
 		auto& info = fringes.find(f)->second;
+		journal_touch(f);
 
 		// Because we only remove duplicate seed,
 		// there must be another seed covering the fringe
-		info.seeds.erase(seed); assert(!info.seeds.empty());
+		info.seeds -= seeds; assert(!info.seeds.empty());
 
-		if (info.has_top_rated && info.top_rated_seed == seed)
+		if (info.has_top_rated && seeds.count(info.top_rated_seed))
 		{ // If top_rated_seed has been removed, we need to update it
 			u32 best_seed = 0xdeadbeefu;
 			u64 best_fav_factor = numeric_limits<u64>::max();
 			for (u32 seed : info.seeds)
 			{
-				u64 fav_factor = get_seed_fav_factor(g->afl, seed);
+				u64 fav_factor = get_seed_fav_factor(g()->afl, seed);
 				if (fav_factor <= best_fav_factor)
 				{
 					best_seed = seed;
@@ -3568,82 +7158,431 @@ void FringeBlocks<F, D>::remove_seed(u32 seed)
 			info.top_rated_factor = best_fav_factor;
 		}
 	}
-	seed_fringes.erase(it);
 }
 
 }
 
-u8 aflrun_has_new_path(const u8* freached, const u8* reached, const u8* path,
-	const ctx_t* new_paths, size_t len, u8 inc, u32 seed,
-	const u8* new_bits, const size_t* cur_clusters, size_t num_clusters)
+/* ----- Functions called to learn edges taken at runtime ----- */
+
+namespace
 {
-	u8 ret = 0;
-	unique_ptr<rh::unordered_set<Fringe>> new_criticals;
-	unique_ptr<rh::unordered_set<reach_t>> new_critical_blocks;
-	if (len != 0)
-	{
-		// If there are `new_paths`, we update virgin bits.
-		// Note that if there are new virgin bits, there must be `new_paths`,
-		// so any newly reached virgin bits will not be missed.
 
-		// update virgin bit for reachale functions
-		for (reach_t i = 0; i < g->num_freachables; ++i)
-		{
-			if (IS_SET(g->virgin_freachables, i) && IS_SET(freached, i))
-			{
-				g->virgin_freachables[i / 8] &= 0xffu ^ (1u << (i % 8));
-				g->num_freached++;
-				if (i < g->num_ftargets)
-					g->num_freached_targets++;
-			}
-		}
+inline u64 edge_key(reach_t src, reach_t dst)
+{
+	return (static_cast<u64>(src) << 32) | dst;
+}
 
-		rh::unordered_set<reach_t> new_blocks;
-		for (reach_t i = 0; i < g->num_reachables; ++i)
+// Weights of edges of `graph` into blocks in `in_weights_known`
+rh::unordered_flat_map<u64, double>& edge_weights();
+vector<u8>& in_weights_known();
+
+// Weights used by the pass are not kept, so we estimate them from distances,
+// which are at most the weight plus the distance of the destination: largest
+// difference over targets reachable from both ends is the weight if the edge
+// is on a shortest path to any of them, and a lower bound otherwise. This is
+// done for edges into `v` before any distance of `v` is decreased, so the
+// repaired distances are never larger than with true weights.
+void estimate_in_weights(reach_t v)
+{
+	if (in_weights_known()[v])
+		return;
+	in_weights_known()[v] = 1;
+	const reach_t* beg = g()->reachable_to_targets[v];
+	const reach_t* end = beg + g()->reachable_to_size[v];
+	for (reach_t p : graph()->dst_to_src[v])
+	{
+		double w = 0;
+		for (const reach_t* t = beg; t < end; ++t)
+		{
+			double d = bb_to_dists().find(p, *t);
+			if (!isinf(d))
+				w = max(w, d - bb_to_dists().get(v, *t));
+		}
+		edge_weights().emplace(edge_key(p, v), w);
+	}
+}
+
+// Targets of blocks that reach new targets through learned edges, whose
+// arrays replace those of `g->reachable_to_targets`
+rh::unordered_map<reach_t, vector<reach_t>>& learned_targets();
+
+void add_reachable_target(reach_t v, reach_t t)
+{
+	auto it = learned_targets().find(v);
+	if (it == learned_targets().end())
+	{
+		const reach_t* beg = g()->reachable_to_targets[v];
+		it = learned_targets().emplace(v,
+			vector<reach_t>(beg, beg + g()->reachable_to_size[v])).first;
+	}
+	it->second.push_back(t);
+	g()->reachable_to_targets[v] = it->second.data();
+	g()->reachable_to_size[v] = it->second.size();
+}
+
+// Decrease distance from `s` to target `t` to `d`, and those of blocks that
+// reach `s` accordingly, by Dijkstra over reversed edges starting at `s`.
+void repair_dists(reach_t s, reach_t t, double d)
+{
+	typedef pair<double, reach_t> Item;
+	priority_queue<Item, vector<Item>, greater<Item>> pq;
+	pq.emplace(d, s);
+	while (!pq.empty())
+	{
+		Item top = pq.top(); pq.pop();
+		reach_t v = top.second;
+		double old = bb_to_dists().find(v, t);
+		if (top.first >= old)
+			continue;
+		estimate_in_weights(v);
+		if (isinf(old))
+			add_reachable_target(v, t);
+		bb_to_dists().set(v, t, top.first);
+		for (reach_t p : graph()->dst_to_src[v])
+			pq.emplace(top.first + edge_weights().find(edge_key(p, v))->second, p);
+	}
+}
+
+}
+
+void aflrun_sample_freq(u8* counts)
+{
+	if (!config().rare_fringes)
+		return;
+	for (const auto& bs : div_blocks()->block_seeds)
+	{
+		u8& c = counts[bs.first];
+		if (c)
+		{
+			fringe_hits().add(bs.first, c);
+			c = 0;
+		}
+	}
+}
+
+void aflrun_learn_edges(aflrun_icall_t* log, size_t num)
+{
+	if (!config().learn_edges)
+		return;
+	in_weights_known().resize(g()->num_reachables, 0);
+
+	vector<u8> changed(g()->num_targets, 0);
+	size_t num_learned = 0;
+	for (size_t i = 0; i < num; ++i)
+	{
+		u64 e = log[i].edge;
+		if (e == 0)
+			continue;
+		log[i].edge = 0;
+		reach_t s = (e >> 32) - 1, x = static_cast<reach_t>(e);
+		if (s >= g()->num_reachables || x >= g()->num_reachables ||
+			!graph()->src_to_dst[s].insert(x).second)
+			continue;
+
+		// A call edge, weighted 0 as those of direct calls in the pass
+		graph()->dst_to_src[x].push_back(s);
+		edge_weights()[edge_key(s, x)] = 0;
+#ifdef AFLRUN_CTX
+		graph()->call_hashes[make_pair(s, x)].push_back(log[i].hash);
+#endif
+		++num_learned;
+
+		const reach_t* beg = g()->reachable_to_targets[x];
+		vector<reach_t> ts(beg, beg + g()->reachable_to_size[x]);
+		for (reach_t t : ts)
 		{
-			// If the bit is virgin (e.i not reached before),
-			// and this execution can reach such virgin bit
-			if (IS_SET(g->virgin_reachables, i) && IS_SET(reached, i))
+			double d = bb_to_dists().get(x, t);
+			if (d < bb_to_dists().find(s, t))
 			{
-				// we clear the virgin bit
-				g->virgin_reachables[i / 8] &= 0xffu ^ (1u << (i % 8));
-				g->num_reached++;
-				new_blocks.insert(i);
-				if (i < g->num_targets)
-					g->num_reached_targets++;
+				repair_dists(s, t, d);
+				changed[t] = 1;
 			}
 		}
+	}
+	if (num_learned == 0)
+		return;
+
+	// Virgin BFS memoized before may now find more paths to targets
+	++virgin_version();
+	++virgin_block_version();
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+	{
+		if (!changed[t])
+			continue;
+		path_fringes()->dists_changed(t);
+		path_pro_fringes()->dists_changed(t);
+		reached_targets()->dists_changed(t);
+	}
+}
+
+size_t aflrun_mute_blocks(u8* mute)
+{
+	memset(mute, 0, MAP_RBB_SIZE(g()->num_reachables));
+	if (!config().mute_blocks)
+		return 0;
+
+	// Blocks that can reach an unreached target, by BFS over reversed edges;
+	// only a context of these can be on a path of a fringe to a target.
+	BlockBFS& bfs = block_bfs;
+	bfs.begin(g()->num_reachables);
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+	{
+		if (IS_SET(g()->virgin_reachables, t))
+			bfs.visit(t, t);
+	}
+	for (size_t head = 0; head < bfs.queue.size(); ++head)
+	{
+		for (reach_t p : graph()->dst_to_src[bfs.queue[head]])
+			bfs.visit(p, p);
+	}
+
+	// Other blocks already reached are muted, unless they still are targets,
+	// fringes or diversity blocks; virgin paths of them could only be new
+	// contexts, which can no longer add or remove fringes. As unreached
+	// targets only decrease, the muted set only grows until edges are learned.
+	size_t ret = 0;
+	for (reach_t b = g()->num_targets; b < g()->num_reachables; ++b)
+	{
+		if (IS_SET(g()->virgin_reachables, b) || bfs.stamp[b] == bfs.epoch ||
+			IS_SET(div_blocks()->div_switch, b) ||
+			path_fringes()->block_to_fringes.count(b) != 0 ||
+			path_pro_fringes()->block_to_fringes.count(b) != 0)
+			continue;
+		mute[b / 8] |= 1 << (b % 8);
+		++ret;
+	}
+	return ret;
+}
+
+namespace
+{
+// For each bit `i < n` set in both `virgin` and `reached`, clear it in `virgin`
+// and call `on_new(i)`; bits are processed a 64-bit word at a time.
+template <typename Func>
+void clear_virgin_bits(u8* virgin, const u8* reached, reach_t n, Func on_new)
+{
+	const size_t full_bytes = n / 8;
+	size_t i = 0;
+	for (; i + sizeof(u64) <= full_bytes; i += sizeof(u64))
+	{
+		u64 v, r;
+		memcpy(&v, virgin + i, sizeof(u64));
+		memcpy(&r, reached + i, sizeof(u64));
+		u64 hit = v & r;
+		if (likely(hit == 0))
+			continue;
+		v &= ~hit;
+		memcpy(virgin + i, &v, sizeof(u64));
+		for (; hit != 0; hit &= hit - 1)
+			on_new(static_cast<reach_t>(i * 8 + __builtin_ctzll(hit)));
+	}
+	for (; i <= full_bytes && i * 8 < n; ++i)
+	{ // Remaining bytes, where bits not less than `n` are masked out
+		u32 hit = virgin[i] & reached[i];
+		if (i == full_bytes)
+			hit &= (1u << (n % 8)) - 1;
+		virgin[i] &= ~hit;
+		for (; hit != 0; hit &= hit - 1)
+			on_new(static_cast<reach_t>(i * 8 + __builtin_ctz(hit)));
+	}
+}
+
+// If any bit `i < n` is set in both `virgin` and `reached`
+bool has_virgin_bits(const u8* virgin, const u8* reached, reach_t n)
+{
+	const size_t full_bytes = n / 8;
+	size_t i = 0;
+	for (; i + sizeof(u64) <= full_bytes; i += sizeof(u64))
+	{
+		u64 v, r;
+		memcpy(&v, virgin + i, sizeof(u64));
+		memcpy(&r, reached + i, sizeof(u64));
+		if (v & r)
+			return true;
+	}
+	for (; i <= full_bytes && i * 8 < n; ++i)
+	{
+		u32 hit = virgin[i] & reached[i];
+		if (i == full_bytes)
+			hit &= (1u << (n % 8)) - 1;
+		if (hit)
+			return true;
+	}
+	return false;
+}
+
+// Registry shared with other instances, see "aflrun-registry.h"
+aflrun_registry_t*& registry();
+// Number of registry entries we have already processed
+size_t& registry_cursor();
+// Blocks first reached by other instances that we have reacted to,
+// so we don't react again when we reach them ourselves
+bo::dynamic_bitset<>& remote_reached();
+
+// React to new reachable blocks and targets in the state machine,
+// the arguments are same as ones in `aflrun_has_new_path`.
+void react_new_reachables(u8 cf, u8 ct, u8 f, u8 t)
+{
+	if (config().reset_level == 1)
+	{
+		if (f > 0)
+		{ // state.reset(cf - 1); TODO: config
+			change_state(AFLRunState::kReset, [f]() { state().reset(f - 1); });
+		}
+		if (config().reset_target && t)
+			change_state(AFLRunState::kExploit, []() { state().exploit(); });
+	} // TODO: reset_level == 2
+	if (state().is_init_cov())
+	{
+		if (config().init_cov_reset == 1)
+		{
+			if (f > 0 || t)
+				state().reset_cov_quant();
+		}
+		else if (config().init_cov_reset == 2)
+		{
+			if (cf > 0 || ct)
+				state().reset_cov_quant();
+		}
+	}
+}
+
+// Log a block reached for the first time by this instance into registry,
+// unless another instance has already reached it.
+void publish_reachable(reach_t block, u8 r)
+{
+	atomic_uchar* reached = AFLRUN_REGISTRY_REACHED(registry());
+	u8 bit = 1 << (block % 8);
+	if (atomic_fetch_or(reached + block / 8, bit) & bit)
+		return;
+	size_t i = registry()->num.fetch_add(1);
+	if (i >= g()->num_reachables)
+		return; // Should never happen, since each block is logged only once
+	aflrun_registry_entry_t* e = AFLRUN_REGISTRY_ENTRIES(registry()) + i;
+	e->block = block;
+	e->fringe = r;
+	e->seq.store(i + 1, memory_order_release);
+}
+
+// Indices of non-zero 64-bit words of `trace_ctx` `path` in increasing order;
+// only the context ranges of blocks set in `reached` are read,
+// since no other block can have a context bit set.
+vector<size_t> trace_words(const u8* reached, const u8* path)
+{
+	vector<size_t> ret;
+	const u64* words = reinterpret_cast<const u64*>(path);
+	const size_t n = g()->num_reachables;
+	size_t next = 0; // First word not read yet
+	for (size_t i = 0; i < MAP_RF_SIZE(n); ++i)
+	{
+		for (u8 bits = reached[i]; bits; bits &= bits - 1)
+		{
+			size_t b = i * 8 + __builtin_ctz(bits);
+			if (b >= n)
+				break;
+			size_t lo = b * CTX_NUM_BYTES / 8;
+			size_t hi = ((b + 1) * CTX_NUM_BYTES - 1) / 8;
+			for (size_t w = max(lo, next); w <= hi; ++w)
+			{
+				if (words[w])
+					ret.push_back(w);
+			}
+			next = hi + 1;
+		}
+	}
+	return ret;
+}
+
+template <typename P>
+u8 has_new_path(const u8* freached, const u8* reached, const u8* path,
+	const ctx_t* new_paths, size_t len, u8 inc, u32 seed,
+	const u8* new_bits, const size_t* cur_clusters, size_t num_clusters)
+{
+	AFL_PROBE(aflrun, has_new_path_begin, seed, (u64)len);
+	PhaseTimer timer(AFLRUN_PHASE_NEW_PATH);
+	if (profile_phases()) num_virgin_maps() += num_clusters;
+
+	// An execution without any new virgin path or new bit repeats a known path
+	// as far as fringes are concerned: with seed isolation and no new critical
+	// or target with new bits, none of fringes below can be covered by it, so
+	// we return before scanning all of them.
+	if (len == 0 && new_bits == nullptr && num_clusters != 0)
+	{
+		AFL_PROBE(aflrun, has_new_path_end, 0);
+		return 0;
+	}
+
+	u8 ret = 0;
+	unique_ptr<rh::unordered_set<Fringe>> new_criticals;
+	unique_ptr<rh::unordered_set<reach_t>> new_critical_blocks;
+	if (len != 0)
+	{
+		// If there are `new_paths`, we update virgin bits.
+		// Note that if there are new virgin bits, there must be `new_paths`,
+		// so any newly reached virgin bits will not be missed.
+		// Virgin context bits of `new_paths` have also been cleared by the
+		// target, so results of virgin BFS memoized before are now stale.
+		++virgin_version();
+
+		// update virgin bit for reachale functions
+		clear_virgin_bits(g()->virgin_freachables, freached,
+			g()->num_freachables,
+			[](reach_t i)
+		{
+			g()->num_freached++;
+			if (i < g()->num_ftargets)
+				g()->num_freached_targets++;
+		});
+
+		// If the bit is virgin (e.i not reached before),
+		// and this execution can reach such virgin bit, we clear the virgin bit
+		rh::unordered_set<reach_t> new_blocks;
+		clear_virgin_bits(g()->virgin_reachables, reached, g()->num_reachables,
+			[&new_blocks, seed](reach_t i)
+		{
+			g()->num_reached++;
+			new_blocks.insert(i);
+			if (config().journal && i >= g()->num_targets)
+				g()->journal_blocks.push_back(i);
+			if (i < g()->num_targets)
+			{
+				g()->num_reached_targets++;
+				g()->reached_targets << get_cur_time() - g()->init_time <<
+					' ' << seed << ' ' << g()->reachable_names[i] << endl;
+			}
+		});
+		if (!new_blocks.empty())
+			++virgin_block_version();
 
 		for (size_t i = 0; i < len; ++i)
 		{
 			const ctx_t& cand = new_paths[i];
 			Fringe f_cand(cand.block, cand.call_ctx);
-			auto del_norm = path_fringes->try_del_fringe(f_cand);
-			auto del_pro = path_pro_fringes->try_del_fringe(f_cand);
-			if (config.no_diversity)
+			auto del_norm = path_fringes()->try_del_fringe(f_cand);
+			auto del_pro = path_pro_fringes()->try_del_fringe(f_cand);
+			if (P::no_diversity)
 				continue;
-			if (config.div_level == 1) // Only pro-fringe
+			if (P::div_level == 1) // Only pro-fringe
 			{
 				for (reach_t b : del_pro)
 				{ // For all blocks removed from pro fringe
-					assert(path_pro_fringes->block_to_fringes.count(b) == 0);
-					if (b >= g->num_targets)
+					assert(path_pro_fringes()->block_to_fringes.count(b) == 0);
+					if (b >= g()->num_targets)
 					{ // If it is not target, we switch it off
-						div_blocks->switch_off(b);
+						div_blocks()->switch_off(b);
 					}
 				}
-				clusters.clean_supp_cnts();
 			}
-			else if (config.div_level == 2) // pro-fringe + norm-fringe
+			else if (P::div_level == 2) // pro-fringe + norm-fringe
 			{
 				rh::unordered_set<reach_t> switched_off;
 				for (reach_t b : del_pro)
 				{
-					assert(path_pro_fringes->block_to_fringes.count(b) == 0);
-					if (b >= g->num_targets &&
-						path_fringes->block_to_fringes.count(b) == 0)
+					assert(path_pro_fringes()->block_to_fringes.count(b) == 0);
+					if (b >= g()->num_targets &&
+						path_fringes()->block_to_fringes.count(b) == 0)
 					{ // If fringe is not pro, but still in norm, we still keep.
-						div_blocks->switch_off(b);
+						div_blocks()->switch_off(b);
 						switched_off.insert(b);
 					}
 				}
@@ -3651,181 +7590,627 @@ u8 aflrun_has_new_path(const u8* freached, const u8* reached, const u8* path,
 				{
 					// If a block is deleted from norm fringe,
 					// it cannot appear in pro fringe either.
-					assert(path_pro_fringes->block_to_fringes.count(b) == 0);
-					assert(path_fringes->block_to_fringes.count(b) == 0);
-					if (b >= g->num_targets && switched_off.count(b) == 0)
+					assert(path_pro_fringes()->block_to_fringes.count(b) == 0);
+					assert(path_fringes()->block_to_fringes.count(b) == 0);
+					if (b >= g()->num_targets && switched_off.count(b) == 0)
 					{
-						div_blocks->switch_off(b);
+						div_blocks()->switch_off(b);
 					}
 				}
-				clusters.clean_supp_cnts();
 			}
 			// All fringes removed by `path_pro_fringes`
 		}
+		// Support counts of clusters of blocks switched off are only read
+		// after the loop, so they are cleaned once for all new paths
+		if (!P::no_diversity && P::div_level >= 1)
+			clusters().clean_supp_cnts();
+
+		u8 cf = 0, ct = 0, f = 0, t = 0;
+		rh::unordered_map<reach_t, u8> new_block_rs;
+		new_criticals = make_unique<rh::unordered_set<Fringe>>();
+		new_critical_blocks = make_unique<rh::unordered_set<reach_t>>();
+		if (config().batch_bfs && len > 1 && !config().no_critical)
+		{
+			PhaseTimer timer(AFLRUN_PHASE_FRINGE);
+			rh::unordered_flat_set<reach_t> seen;
+			vector<reach_t> blocks;
+			for (size_t i = 0; i < len; ++i)
+			{
+				if (seen.insert(new_paths[i].block).second)
+					blocks.push_back(new_paths[i].block);
+			}
+			prefetch_target_paths(blocks);
+		}
+		for (size_t i = 0; i < len; ++i)
+		{
+			reach_t block = new_paths[i].block;
+			u8 r = try_add_fringe(new_paths[i]) + 1;
+
+			// Update context-sensitive fringe and target
+			cf = max(r, cf);
+			if (block < g()->num_targets)
+			{
+				ct = 1;
+				g()->target_progress[block] = get_cur_time();
+				aflrun_reach_rec_t rec = {g()->target_progress[block],
+					block, new_paths[i].call_ctx, seed, 0};
+				g()->reach_log.write(
+					reinterpret_cast<const char*>(&rec), sizeof(rec));
+			}
+
+			// It it is the first time a block is reached,
+			// we update context-insensitive fringe and target.
+			// Blocks other instances have reached are already reacted to.
+			if (new_blocks.find(block) != new_blocks.end())
+			{
+				if (registry() != nullptr)
+				{
+					u8& br = new_block_rs[block];
+					br = max(r, br);
+				}
+				if (registry() == nullptr || !remote_reached()[block])
+				{
+					f = max(r, f);
+					if (block < g()->num_targets)
+						t = 1;
+				}
+			}
+
+			if (r >= 2 || block < g()->num_targets)
+			{
+				new_criticals->emplace(
+					new_paths[i].block, new_paths[i].call_ctx);
+				new_critical_blocks->insert(new_paths[i].block);
+			}
+
+			// When there is a new fringe or target, we activate its switch.
+			if (block < g()->num_targets || r > 3 - P::div_level)
+			{ // Note this can happen multiple times for a block, 3 cases:
+				// 1. If first time it is activated, then switch is turned on.
+				// 2. If switch is already on, them nothing is done.
+				// 3. If switch was turned off before, then turn on again.
+					// Such case only occurs for r == 2. (e.i. context fringe)
+				div_blocks()->switch_on(block);
+			}
+		}
+		for (const auto& br : new_block_rs)
+			publish_reachable(br.first, br.second);
+		react_new_reachables(cf, ct, f, t);
+
+		/*
+		Given a execution trace exerted by a program,
+		and try to see if there is something new;
+		it returns information about if fringe is created,
+		cf:
+			1 for a new context-sensitive block is covered,
+			2 for a new context-sensitive fringe is added,
+			3 for a new context-sensitive pro fringe is added;
+		ct:
+			1 for new context-sensitive target is reached
+		f:
+			1 for a new reachable block is covered,
+			2 for a new fringe is added for the first time,
+			3 for a new pro fringe is added for the first time,
+		t bit:
+			1 for new context-insensitive target is reached
+		*/
+
+		if (f >= 1) update_time().last_reachable = get_cur_time();
+		if (f >= 2) update_time().last_fringe = get_cur_time();
+		if (f >= 3) update_time().last_pro_fringe = get_cur_time();
+
+		if (t) update_time().last_target = get_cur_time();
+
+		if (cf >= 1) update_time().last_ctx_reachable = get_cur_time();
+		if (cf >= 2) update_time().last_ctx_fringe = get_cur_time();
+		if (cf >= 3) update_time().last_ctx_pro_fringe = get_cur_time();
+
+		if (ct) update_time().last_ctx_target = get_cur_time();
+
+		ret = cf >= 2 || ct;
+	}
+
+	// TODO: Coverage for Seed Isolation
+
+	bool has_cov = false;
+	const vector<size_t> words = trace_words(reached, path);
+	if (num_clusters == 0 || (new_bits && new_bits[0]))
+	{ // If `num_clusters` is zero, or primary map has new bits,
+		// then the seed is non-extra,
+		// so we don't do seed isolation and consider all coverage.
+		has_cov |= path_fringes()->fringe_coverage(path, words, seed);
+		has_cov |= path_pro_fringes()->fringe_coverage(path, words, seed);
+		has_cov |= reached_targets()->fringe_coverage(path, words, seed);
+		if (!P::no_diversity)
+			div_blocks()->div_coverage(reached, seed);
+	}
+	else
+	{
+		rh::unordered_set<reach_t> new_bits_targets;
+		if (new_bits)
+		{ // If new_bits is not NULL, there is any virgin map update.
+			for (size_t i = 1; i < num_clusters; ++i)
+			{
+				if (new_bits[i])
+				{ // If there is any new bit, insert all blocks in the cluster.
+					const auto& ts = clusters().get_targets(cur_clusters[i]);
+					new_bits_targets.insert(ts.begin(), ts.end());
+				}
+			}
+		}
+		has_cov |= path_fringes()->fringe_coverage(
+			path, words, seed, new_criticals.get(), &new_bits_targets);
+		has_cov |= path_pro_fringes()->fringe_coverage(
+			path, words, seed, new_criticals.get(), &new_bits_targets);
+		has_cov |= reached_targets()->fringe_coverage(
+			path, words, seed, new_criticals.get(), &new_bits_targets);
+		if (!P::no_diversity)
+			div_blocks()->div_coverage(
+				reached, seed, new_critical_blocks.get(), &new_bits_targets);
+	}
+
+	// Reset `cov_quant` to 0 in initial coverage if any new fringe coverage
+	if (config().init_cov_reset == 3 && state().is_init_cov() && has_cov)
+		state().reset_cov_quant();
+
+	/*if (inc)
+	{
+		path_fringes()->inc_freq(path);
+		reached_targets()->inc_freq(path);
+	}*/
+
+	AFL_PROBE(aflrun, has_new_path_end, ret);
+	return ret;
+}
+
+}
+
+u8 aflrun_has_new_path(const u8* freached, const u8* reached, const u8* path,
+	const ctx_t* new_paths, size_t len, u8 inc, u32 seed,
+	const u8* new_bits, const size_t* cur_clusters, size_t num_clusters)
+{
+	return has_new_path_fn()(freached, reached, path, new_paths, len, inc, seed,
+		new_bits, cur_clusters, num_clusters);
+}
+
+u32 aflrun_has_new_paths(const aflrun_exec_t* execs, size_t k, u32 seed,
+	u8* ret)
+{
+	// Executions before the next one reaching new blocks leave BFS over
+	// blocks memoized, so their new paths are searched at once; each one
+	// still gets what it would get alone.
+	bool prefetch = config().batch_bfs && !config().no_critical;
+	size_t end = 0;
+	u32 num_kept = 0;
+	for (size_t i = 0; i < k; ++i)
+	{
+		if (prefetch && i >= end)
+		{
+			rh::unordered_flat_set<reach_t> seen;
+			vector<reach_t> blocks;
+			for (end = i; end < k; ++end)
+			{
+				const aflrun_exec_t& e = execs[end];
+				if (e.len == 0)
+					continue;
+				if (has_virgin_bits(
+					g()->virgin_reachables, e.reached, g()->num_reachables))
+				{ // It searches its own paths once its blocks are cleared
+					end += end == i;
+					break;
+				}
+				for (size_t j = 0; j < e.len; ++j)
+				{
+					if (seen.insert(e.virgin_trace[j].block).second)
+						blocks.push_back(e.virgin_trace[j].block);
+				}
+			}
+			if (blocks.size() > 1)
+			{
+				PhaseTimer timer(AFLRUN_PHASE_FRINGE);
+				prefetch_target_paths(blocks);
+			}
+		}
+		const aflrun_exec_t& e = execs[i];
+		ret[i] = has_new_path_fn()(e.freached, e.reached, e.path,
+			e.virgin_trace, e.len, e.inc, seed + num_kept, e.new_bits, e.clusters,
+			e.num_clusters);
+		if (ret[i] || e.new_bits)
+			++num_kept;
+	}
+	return num_kept;
+}
+
+u8 aflrun_end_cycle()
+{
+	return state().is_reset() || state().is_end_cov() || state().is_preempted();
+}
+
+namespace
+{
+void TargetPartition::write_reached(const string& out_dir) const
+{
+	string path = out_dir + ".aflrun_reached";
+	ofstream out(path + ".tmp");
+	if (!out.is_open())
+		return;
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+	{
+		if (!IS_SET(g()->virgin_reachables, t))
+			out << t << '\n';
+	}
+	out.close();
+	rename((path + ".tmp").c_str(), path.c_str());
+}
+
+void TargetPartition::rebalance(
+	const string& sync_dir, const vector<string>& secondaries)
+{
+	// Targets not reached by any node are split, or all of them if every
+	// target has been reached; larger weights are assigned first, each to
+	// the node with least total weight so far.
+	vector<reach_t> targets;
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+	{
+		if (!reached[t])
+			targets.push_back(t);
+	}
+	if (targets.empty())
+	{
+		targets.resize(g()->num_targets);
+		iota(targets.begin(), targets.end(), 0);
+	}
+	stable_sort(targets.begin(), targets.end(), [](reach_t a, reach_t b)
+	{
+		return g()->get_base_tw(a) > g()->get_base_tw(b);
+	});
+
+	using Load = pair<double, size_t>;
+	priority_queue<Load, vector<Load>, greater<Load>> loads;
+	for (size_t i = 0; i < secondaries.size(); ++i)
+		loads.emplace(0, i);
+	vector<vector<reach_t>> shares(secondaries.size());
+	for (reach_t t : targets)
+	{
+		Load l = loads.top(); loads.pop();
+		shares[l.second].push_back(t);
+		l.first += g()->get_base_tw(t);
+		loads.push(l);
+	}
+
+	string path = sync_dir + ".aflrun_partition";
+	ofstream out(path + ".tmp");
+	if (!out.is_open())
+		return;
+	for (size_t i = 0; i < secondaries.size(); ++i)
+	{
+		out << secondaries[i];
+		for (reach_t t : shares[i])
+			out << ' ' << t;
+		out << '\n';
+	}
+	out.close();
+	rename((path + ".tmp").c_str(), path.c_str());
+}
+
+void TargetPartition::load(const string& sync_dir, const string& id)
+{
+	string path = sync_dir + ".aflrun_partition";
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || st.st_mtime == mtime)
+		return;
+	ifstream in(path);
+	if (!in.is_open())
+		return;
+	mtime = st.st_mtime;
+	scales.clear();
+	string line;
+	while (getline(in, line))
+	{
+		istringstream ss(line);
+		string node; ss >> node;
+		if (node != id)
+			continue;
+		scales.assign(g()->num_targets, config().partition_ratio);
+		reach_t t;
+		while (ss >> t)
+		{
+			if (t < g()->num_targets)
+				scales[t] = 1;
+		}
+		break;
+	}
+}
+
+void TargetPartition::update(bool is_main)
+{
+	// `out_dir` of each node is `<sync_dir>/<sync_id>/`
+	string out_dir = g()->out_dir;
+	size_t slash = out_dir.find_last_of('/', out_dir.size() - 2);
+	string sync_dir = slash == string::npos ? "./" : out_dir.substr(0, slash + 1);
+	string id = out_dir.substr(slash == string::npos ? 0 : slash + 1);
+	id.pop_back();
+
+	if (!is_main)
+	{
+		if (num_written != g()->num_reached_targets)
+		{
+			write_reached(out_dir);
+			num_written = g()->num_reached_targets;
+		}
+		load(sync_dir, id);
+		return;
+	}
+
+	// Main node collects statistics of all nodes that have written them.
+	vector<string> secondaries;
+	bo::dynamic_bitset<> all_reached(g()->num_targets);
+	for (reach_t t = 0; t < g()->num_targets; ++t)
+		all_reached[t] = !IS_SET(g()->virgin_reachables, t);
+	DIR* dir = opendir(sync_dir.c_str());
+	if (dir == nullptr)
+		return;
+	while (struct dirent* ent = readdir(dir))
+	{
+		string node = ent->d_name;
+		if (node[0] == '.' || node == id)
+			continue;
+		ifstream in(sync_dir + node + "/.aflrun_reached");
+		if (!in.is_open())
+			continue;
+		secondaries.push_back(node);
+		reach_t t;
+		while (in >> t)
+		{
+			if (t < g()->num_targets)
+				all_reached[t] = true;
+		}
+	}
+	closedir(dir);
+	sort(secondaries.begin(), secondaries.end());
 
-		u8 cf = 0, ct = 0, f = 0, t = 0;
-		new_criticals = make_unique<rh::unordered_set<Fringe>>();
-		new_critical_blocks = make_unique<rh::unordered_set<reach_t>>();
-		for (size_t i = 0; i < len; ++i)
+	// Rebalance when nodes join, or periodically when more targets are reached.
+	rh::unordered_set<string> cur_nodes(secondaries.begin(), secondaries.end());
+	u64 now = get_cur_time();
+	if (secondaries.empty() || (cur_nodes == nodes &&
+		(all_reached == reached ||
+			now - last_balance < config().partition_interval * 1000)))
+		return;
+	nodes = std::move(cur_nodes);
+	reached = std::move(all_reached);
+	last_balance = now;
+	rebalance(sync_dir, secondaries);
+}
+}
+
+namespace
+{
+void TargetControl::update()
+{
+	string path = g()->out_dir + "aflrun_targets";
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+	{ // Removing the file restores compiled weights
+		weights.clear();
+		mtime = 0;
+		return;
+	}
+	if (st.st_mtime == mtime)
+		return;
+	ifstream in(path);
+	if (!in.is_open())
+		return;
+	mtime = st.st_mtime;
+	if (name_to_target.empty())
+	{
+		for (reach_t t = 0; t < g()->num_targets; ++t)
+			name_to_target.emplace(g()->reachable_names[t], t);
+	}
+
+	// -1 for a target keeping its compiled weight
+	vector<double> new_weights(g()->num_targets, -1);
+	string line;
+	while (getline(in, line))
+	{
+		istringstream ss(line);
+		string name; double w;
+		if (!(ss >> name >> w) || !(w >= 0) || isinf(w))
+			continue;
+		auto it = name_to_target.find(name);
+		if (it != name_to_target.end())
 		{
-			reach_t block = new_paths[i].block;
-			u8 r = try_add_fringe(new_paths[i]) + 1;
+			new_weights[it->second] = w;
+			continue;
+		}
+		char* end;
+		unsigned long t = strtoul(name.c_str(), &end, 10);
+		if (*end == 0 && t < g()->num_targets)
+			new_weights[t] = w;
+	}
+
+	// Energy is split in proportion to weights, so keep old ones if all are 0
+	weights.swap(new_weights);
+	bool any = false;
+	for (reach_t t = 0; t < g()->num_targets && !any; ++t)
+		any = g()->get_base_tw(t) > 0;
+	if (!any)
+		weights.swap(new_weights);
+}
+}
 
-			// Update context-sensitive fringe and target
-			cf = max(r, cf);
-			if (block < g->num_targets)
-				ct = 1;
+void aflrun_partition_targets(u8 is_main)
+{
+	if (config().partition_targets)
+		target_partition().update(is_main);
+}
 
-			// It it is the first time a block is reached,
-			// we update context-insensitive fringe and target.
-			if (new_blocks.find(block) != new_blocks.end())
-			{
-				f = max(r, f);
-				if (block < g->num_targets)
-					t = 1;
-			}
+bool aflrun_shared_state(void)
+{
+	return config().shared_state;
+}
 
-			if (r >= 2 || block < g->num_targets)
-			{
-				new_criticals->emplace(
-					new_paths[i].block, new_paths[i].call_ctx);
-				new_critical_blocks->insert(new_paths[i].block);
-			}
+bool aflrun_shared_sched(void)
+{
+	return config().shared_sched;
+}
 
-			// When there is a new fringe or target, we activate its switch.
-			if (block < g->num_targets || r > 3 - config.div_level)
-			{ // Note this can happen multiple times for a block, 3 cases:
-				// 1. If first time it is activated, then switch is turned on.
-				// 2. If switch is already on, them nothing is done.
-				// 3. If switch was turned off before, then turn on again.
-					// Such case only occurs for r == 2. (e.i. context fringe)
-				div_blocks->switch_on(block);
-			}
-		}
-		if (config.reset_level == 1)
-		{
-			if (f > 0)
-				state.reset(f - 1); // state.reset(cf - 1); TODO: config
-			if (config.reset_target && t)
-				state.exploit();
-		} // TODO: reset_level == 2
-		if (state.is_init_cov())
-		{
-			if (config.init_cov_reset == 1)
-			{
-				if (f > 0 || t)
-					state.reset_cov_quant();
-			}
-			else if (config.init_cov_reset == 2)
-			{
-				if (cf > 0 || ct)
-					state.reset_cov_quant();
-			}
-		}
+bool aflrun_sync_meta(void)
+{
+	return config().sync_meta;
+}
 
-		/*
-		Given a execution trace exerted by a program,
-		and try to see if there is something new;
-		it returns information about if fringe is created,
-		cf:
-			1 for a new context-sensitive block is covered,
-			2 for a new context-sensitive fringe is added,
-			3 for a new context-sensitive pro fringe is added;
-		ct:
-			1 for new context-sensitive target is reached
-		f:
-			1 for a new reachable block is covered,
-			2 for a new fringe is added for the first time,
-			3 for a new pro fringe is added for the first time,
-		t bit:
-			1 for new context-insensitive target is reached
-		*/
+bool aflrun_seed_summary(void)
+{
+	return config().seed_summary;
+}
 
-		if (f >= 1) update_time.last_reachable = get_cur_time();
-		if (f >= 2) update_time.last_fringe = get_cur_time();
-		if (f >= 3) update_time.last_pro_fringe = get_cur_time();
+bool aflrun_budget_stages(void)
+{
+	return config().budget_stages;
+}
 
-		if (t) update_time.last_target = get_cur_time();
+bool aflrun_cpu_quantum(void)
+{
+	return config().cpu_quantum;
+}
 
-		if (cf >= 1) update_time.last_ctx_reachable = get_cur_time();
-		if (cf >= 2) update_time.last_ctx_fringe = get_cur_time();
-		if (cf >= 3) update_time.last_ctx_pro_fringe = get_cur_time();
+double aflrun_alias_slice(void)
+{
+	return config().alias_slice;
+}
 
-		if (ct) update_time.last_ctx_target = get_cur_time();
+bool aflrun_splice_fringe(void)
+{
+	return config().splice_fringe;
+}
 
-		ret = cf >= 2 || ct;
-	}
+bool aflrun_op_sched(void)
+{
+	return config().op_sched;
+}
 
-	// TODO: Coverage for Seed Isolation
+u32 aflrun_influence_execs(void)
+{
+	return config().influence_execs;
+}
 
-	bool has_cov = false;
-	if (num_clusters == 0 || (new_bits && new_bits[0]))
-	{ // If `num_clusters` is zero, or primary map has new bits,
-		// then the seed is non-extra,
-		// so we don't do seed isolation and consider all coverage.
-		has_cov |= path_fringes->fringe_coverage(path, seed);
-		has_cov |= path_pro_fringes->fringe_coverage(path, seed);
-		has_cov |= reached_targets->fringe_coverage(path, seed);
-		div_blocks->div_coverage(reached, seed);
-	}
-	else
-	{
-		rh::unordered_set<reach_t> new_bits_targets;
-		if (new_bits)
-		{ // If new_bits is not NULL, there is any virgin map update.
-			for (size_t i = 1; i < num_clusters; ++i)
-			{
-				if (new_bits[i])
-				{ // If there is any new bit, insert all blocks in the cluster.
-					const auto& ts = clusters.get_targets(cur_clusters[i]);
-					new_bits_targets.insert(ts.begin(), ts.end());
-				}
-			}
-		}
-		has_cov |= path_fringes->fringe_coverage(
-			path, seed, new_criticals.get(), &new_bits_targets);
-		has_cov |= path_pro_fringes->fringe_coverage(
-			path, seed, new_criticals.get(), &new_bits_targets);
-		has_cov |= reached_targets->fringe_coverage(
-			path, seed, new_criticals.get(), &new_bits_targets);
-		div_blocks->div_coverage(
-			reached, seed, new_critical_blocks.get(), &new_bits_targets);
-	}
+bool aflrun_focus_det(void)
+{
+	return config().focus_det;
+}
 
-	// Reset `cov_quant` to 0 in initial coverage if any new fringe coverage
-	if (config.init_cov_reset == 3 && state.is_init_cov() && has_cov)
-		state.reset_cov_quant();
+bool aflrun_dist_stack(void)
+{
+	return config().dist_stack;
+}
 
-	/*if (inc)
-	{
-		path_fringes->inc_freq(path);
-		reached_targets->inc_freq(path);
-	}*/
+bool aflrun_retire_extra(void)
+{
+	return config().retire_extra;
+}
 
-	return ret;
+u32 aflrun_crash_buckets(u32* depth)
+{
+	*depth = config().crash_bucket_depth;
+	return config().crash_buckets;
 }
 
-u8 aflrun_end_cycle()
+bool aflrun_learn_edges_enabled(void)
+{
+	return config().learn_edges;
+}
+
+double aflrun_auto_tune(void)
+{
+	return config().auto_tune;
+}
+
+bool aflrun_lean_cov(void)
+{
+	return config().lean_cov;
+}
+
+bool aflrun_mute_enabled(void)
+{
+	return config().mute_blocks;
+}
+
+bool aflrun_journal_enabled(void)
 {
-	return state.is_reset() || state.is_end_cov();
+	return config().journal;
+}
+
+bool aflrun_rare_fringes(void)
+{
+	return config().rare_fringes && !config().no_diversity;
+}
+
+bool aflrun_directed_cmplog(void)
+{
+	return config().directed_cmplog;
+}
+
+void aflrun_init_registry(void* reg)
+{
+	registry() = reinterpret_cast<aflrun_registry_t*>(reg);
+	// Blocks reached by other instances before we start are not reacted to,
+	// because seed of initial corpus or synced seeds would cover them.
+	registry_cursor() =
+		min<size_t>(registry()->num.load(), g()->num_reachables);
+	remote_reached().resize(g()->num_reachables);
+}
+
+void aflrun_registry_poll(void)
+{
+	if (registry() == nullptr)
+		return;
+
+	// Entries are appended at most once per block, so `num` may only exceed
+	// `num_reachables` if registry is corrupted.
+	size_t n = min<size_t>(
+		registry()->num.load(memory_order_acquire), g()->num_reachables);
+	const aflrun_registry_entry_t* entries =
+		AFLRUN_REGISTRY_ENTRIES(registry());
+	u8 f = 0, t = 0;
+	for (; registry_cursor() < n; ++registry_cursor())
+	{
+		const aflrun_registry_entry_t& e = entries[registry_cursor()];
+		// Stop at entry still being written, and retry at next sync.
+		if (e.seq.load(memory_order_acquire) != registry_cursor() + 1)
+			break;
+		reach_t block = e.block;
+		if (block >= g()->num_reachables ||
+			!IS_SET(g()->virgin_reachables, block) || remote_reached()[block])
+			continue; // Ignore blocks we have already reached
+		remote_reached()[block] = true;
+		f = max(e.fringe, f);
+		if (block < g()->num_targets)
+			t = 1;
+	}
+
+	react_new_reachables(f, t, f, t);
+	if (f >= 1) update_time().last_reachable = get_cur_time();
+	if (f >= 2) update_time().last_fringe = get_cur_time();
+	if (f >= 3) update_time().last_pro_fringe = get_cur_time();
+	if (t) update_time().last_target = get_cur_time();
 }
 
 void aflrun_update_fuzzed_quant(u32 id, double fuzzed_quant)
 {
-	path_fringes->update_fuzzed_quant(id, fuzzed_quant);
-	path_pro_fringes->update_fuzzed_quant(id, fuzzed_quant);
-	reached_targets->update_fuzzed_quant(id, fuzzed_quant);
-	state.add_quant(fuzzed_quant);
-	if (id >= seed_quant.size())
-		seed_quant.resize(id + 1);
-	seed_quant[id] += fuzzed_quant;
+	path_fringes()->update_fuzzed_quant(id, fuzzed_quant);
+	path_pro_fringes()->update_fuzzed_quant(id, fuzzed_quant);
+	reached_targets()->update_fuzzed_quant(id, fuzzed_quant);
+	state().add_quant(fuzzed_quant);
+	if (id >= seed_quant().size())
+		seed_quant().resize(id + 1);
+	seed_quant()[id] += fuzzed_quant;
 }
 
 void aflrun_update_fringe_score(u32 seed)
 {
-	path_fringes->update_fringe_score(seed);
-	path_pro_fringes->update_fringe_score(seed);
-	reached_targets->update_fringe_score(seed);
+	path_fringes()->update_fringe_score(seed);
+	path_pro_fringes()->update_fringe_score(seed);
+	reached_targets()->update_fringe_score(seed);
 }
 
 void aflrun_set_favored_seeds(const u32* seeds, u32 num, u8 mode)
@@ -3833,26 +8218,37 @@ void aflrun_set_favored_seeds(const u32* seeds, u32 num, u8 mode)
 	switch (mode)
 	{
 	case AFLRunState::kFringe:
-		return path_fringes->set_favored_seeds(seeds, num);
+		return path_fringes()->set_favored_seeds(seeds, num);
 	case AFLRunState::kProFringe:
-		return path_pro_fringes->set_favored_seeds(seeds, num);
+		return path_pro_fringes()->set_favored_seeds(seeds, num);
 	case AFLRunState::kTarget:
-		return reached_targets->set_favored_seeds(seeds, num);
+		return reached_targets()->set_favored_seeds(seeds, num);
 	default:
 		abort();
 	}
 }
 
+size_t aflrun_num_workers(void)
+{
+	return workers().size();
+}
+
+void aflrun_parallel_for(size_t num,
+	void (*fn)(void* arg, size_t i, size_t worker), void* arg)
+{
+	workers().run(num, [fn, arg](size_t i, size_t worker) { fn(arg, i, worker); });
+}
+
 u32 aflrun_cull_queue(u32* seeds, u32 num)
 {
-	switch (state.get_mode())
+	switch (state().get_mode())
 	{
 	case AFLRunState::kFringe:
-		return path_fringes->cull_queue(seeds, num);
+		return path_fringes()->cull_queue(seeds, num);
 	case AFLRunState::kProFringe:
-		return path_pro_fringes->cull_queue(seeds, num);
+		return path_pro_fringes()->cull_queue(seeds, num);
 	case AFLRunState::kTarget:
-		return reached_targets->cull_queue(seeds, num);
+		return reached_targets()->cull_queue(seeds, num);
 	case AFLRunState::kUnite:
 		return cull_queue_unite(seeds, num);
 	default:
@@ -3860,6 +8256,35 @@ u32 aflrun_cull_queue(u32* seeds, u32 num)
 	}
 }
 
+namespace
+{
+// Refill results in ascending order of cluster, so that in interleaved mode
+// virgin words of adjacent clusters are visited sequentially.
+size_t sort_virgins(const bo::dynamic_bitset<>& visited_clusters,
+	u8** ret_maps, size_t* ret_clusters)
+{
+	size_t idx = 0;
+	size_t c = visited_clusters.find_next(0);
+	for (; c != bo::dynamic_bitset<>::npos; c = visited_clusters.find_next(c))
+	{
+		ret_clusters[idx] = c;
+		ret_maps[idx++] = clusters().get_virgin_map(c);
+	}
+	return idx;
+}
+}
+
+size_t aflrun_virgin_stride(void)
+{
+	return ClusterVirgins::stride();
+}
+
+void aflrun_edge_window(u32* lo, u32* hi)
+{
+	*lo = window_lo();
+	*hi = window_hi();
+}
+
 // Note that the virgin maps returned can be inaccurate,
 // which should not be used into `has_new_bits_mul`,
 // instead use ones returned by `aflrun_get_seed_virgins`.
@@ -3867,13 +8292,13 @@ size_t aflrun_get_virgins(
 	const ctx_t* targets, size_t num, u8** ret_maps, size_t* ret_clusters)
 	// `ret_maps` and `ret_clusters` must have size at least `num`
 {
-	if (config.no_diversity)
+	if (config().no_diversity)
 		return 0;
 	const ctx_t* t_end = targets + num;
 	// The maximum potential number of clusters is current number of cluster
 	// plus number of new context-sensitive targets, because each target
 	// can only increase the number of clusters by one.
-	bo::dynamic_bitset<> visited_clusters(clusters.size() + num);
+	bo::dynamic_bitset<> visited_clusters(clusters().size() + num);
 	visited_clusters[0] = true; // always skip primary cluster
 
 	size_t idx = 0;
@@ -3881,14 +8306,16 @@ size_t aflrun_get_virgins(
 	{
 		// Note that even if binary is compiled with AFLRUN_CTX_DIV,
 		// but fuzzer is not, it can still work correctly
-		size_t cluster = clusters.get_cluster(to_cluster_target(t));
+		size_t cluster = clusters().get_cluster(to_cluster_target(t));
 		if (visited_clusters[cluster])
 			continue;
 		visited_clusters[cluster] = true;
 
 		ret_clusters[idx] = cluster;
-		ret_maps[idx++] = clusters.get_virgin_map(cluster);
+		ret_maps[idx++] = clusters().get_virgin_map(cluster);
 	}
+	if (config().interleave_virgins)
+		idx = sort_virgins(visited_clusters, ret_maps, ret_clusters);
 	return idx;
 }
 
@@ -3897,142 +8324,398 @@ size_t aflrun_get_virgins(
 // including primary cluster.
 size_t aflrun_max_clusters(u32 seed)
 {
-	auto it = div_blocks->seed_blocks.find(seed);
+	auto it = div_blocks()->seed_blocks.find(seed);
 	return 1 +
-		(it == div_blocks->seed_blocks.end() ? 0 : it->second.size());
+		(it == div_blocks()->seed_blocks.end() ? 0 : it->second.size());
 }
 
 // Basically same as above, except div blocks are fetched from `div_blocks`
 size_t aflrun_get_seed_virgins(u32 seed, u8** ret_maps, size_t* ret_clusters)
 {
-	if (config.no_diversity)
+	if (config().no_diversity)
 		return 0;
-	auto it = div_blocks->seed_blocks.find(seed);
-	if (it == div_blocks->seed_blocks.end())
+	auto it = div_blocks()->seed_blocks.find(seed);
+	if (it == div_blocks()->seed_blocks.end())
 		return 0;
-	bo::dynamic_bitset<> visited_clusters(clusters.size() + it->second.size());
+	bo::dynamic_bitset<> visited_clusters(
+		clusters().size() + it->second.size());
 	visited_clusters[0] = true; // always skip primary cluster
 
 	size_t idx = 0;
 	for (auto t : it->second)
 	{
-		size_t cluster = clusters.get_cluster(t);
+		size_t cluster = clusters().get_cluster(t);
 		if (visited_clusters[cluster])
 			continue;
 		visited_clusters[cluster] = true;
 
 		ret_clusters[idx] = cluster;
-		ret_maps[idx++] = clusters.get_virgin_map(cluster);
+		ret_maps[idx++] = clusters().get_virgin_map(cluster);
 	}
+	if (config().interleave_virgins)
+		idx = sort_virgins(visited_clusters, ret_maps, ret_clusters);
 	return idx;
 }
 
 size_t aflrun_get_seed_tops(u32 seed, void*** ret_tops)
 {
-	if (config.no_diversity)
+	if (config().no_diversity)
 		return 0;
-	auto it = div_blocks->seed_blocks.find(seed);
-	if (it == div_blocks->seed_blocks.end())
+	auto it = div_blocks()->seed_blocks.find(seed);
+	if (it == div_blocks()->seed_blocks.end())
 		return 0;
-	bo::dynamic_bitset<> visited_clusters(clusters.size() + it->second.size());
+	bo::dynamic_bitset<> visited_clusters(
+		clusters().size() + it->second.size());
 	visited_clusters[0] = true; // always skip primary cluster
 
 	size_t idx = 0;
 	for (auto t : it->second)
 	{
-		size_t cluster = clusters.get_cluster(t);
+		size_t cluster = clusters().get_cluster(t);
 		if (visited_clusters[cluster])
 			continue;
 		visited_clusters[cluster] = true;
 
-		ret_tops[idx++] = clusters.get_top_rated(cluster);
+		ret_tops[idx++] = clusters().get_top_rated(cluster);
 	}
 	return idx;
 }
 
+void aflrun_profile_phases(void)
+{
+	profile_phases() = true;
+}
+
+void aflrun_add_phase(u32 phase, u64 ticks)
+{
+	add_phase(phase, ticks);
+}
+
+const aflrun_phase_t* aflrun_get_phases(u64* ret_num_virgin_maps)
+{
+	*ret_num_virgin_maps = num_virgin_maps();
+	return phases();
+}
+
 size_t aflrun_get_num_clusters(void)
 {
-	size_t size = clusters.size();
+	size_t size = clusters().size();
 	size_t ret = 0;
 	for (size_t i = 0; i < size; ++i)
 	{
-		if (clusters.get_top_rated(i)) ++ret;
+		if (clusters().get_top_rated(i)) ++ret;
 	}
 	return ret;
 }
 
 size_t aflrun_get_all_tops(void*** ret_tops, u8 mode)
 {
-	if (config.no_diversity)
+	if (config().no_diversity)
 		return 0;
-	return clusters.get_all_tops(ret_tops, mode);
+	return clusters().get_all_tops(ret_tops, mode);
 }
 
 void aflrun_set_num_active_seeds(u32 n)
 {
-	num_active_seeds = n;
+	num_active_seeds() = n;
+}
+
+namespace
+{
+// Return non-zero iff there is a byte that is non-zero in `cur` while 0xff
+// in `vir`, which means the tuple is new; this is the SWAR version of
+// comparing 8 bytes one by one.
+inline u64 new_tuple_bytes(u64 cur, u64 vir)
+{
+	const u64 low7 = 0x7f7f7f7f7f7f7f7fuLL;
+	u64 cur_nz = ((cur & low7) + low7) | cur; // high bit set iff byte != 0
+	u64 nvir = ~vir;
+	u64 vir_ff = ~(((nvir & low7) + low7) | nvir); // high bit set iff byte == 0xff
+	return cur_nz & vir_ff & ~low7;
+}
+
+// Handle virgin map `i` whose `*current & *virgin` is non-zero.
+inline void discover_virgin(u8* new_bits, u64 cur, u64* virgin, size_t i,
+	size_t num, u64 tmp, bool new_tuple, u8 modify,
+	u64& or_all, u64*& and_bit_seq)
+{
+	or_all |= tmp;
+
+	// For the first time we touched a virgin map,
+	// we create the sequence to store all `*current & *virgin` values.
+	// This is a lazy approach so that we don't create the sequence
+	// for most zero sequences; values not touched are left as zeros.
+	if (and_bit_seq == nullptr)
+		and_bit_seq = clusters().alloc_bit_seq(num);
+	and_bit_seq[i] = tmp;
+
+	u8* ret = new_bits + i;
+	if (likely(*ret < 2))
+		*ret = new_tuple ? 2 : 1;
+	if (modify)
+		*virgin &= ~cur;
+}
 }
 
 void discover_word_mul(u8 *new_bits,
 	u64 *current, u64* const *virgins, size_t num, size_t idx, u8 modify)
 {
+	const u64 cur = *current;
 	u64 or_all = 0;
-	unique_ptr<vector<u64>> and_bit_seq(nullptr);
+	u64* and_bit_seq = nullptr;
+	if (num == 0)
+		return;
 
-	for (size_t i = 0; i < num; ++i)
+	// Primary map is always a separate map, while word `idx` of cluster maps
+	// is located at `(idx - lo_word()) * stride` to support interleaved
+	// layout, and cluster maps have nothing to discover out of their window.
+	u64 tmp = cur & virgins[0][idx];
+	if (tmp)
+	{
+		discover_virgin(new_bits, cur, virgins[0] + idx, 0, num, tmp,
+			new_tuple_bytes(cur, virgins[0][idx]) != 0, modify,
+			or_all, and_bit_seq);
+	}
+	idx -= ClusterVirgins::lo_word();
+	size_t i = idx < ClusterVirgins::num_words() ? 1 : num;
+	idx *= ClusterVirgins::stride();
+
+	// Test several virgin maps at once, most of which have no new bits;
+	// new tuples are found by comparing bytes of virgin words with 0xff.
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+	const __m512i v_cur = _mm512_set1_epi64(cur);
+	const __m512i v_ff = _mm512_set1_epi8(-1);
+	const __mmask64 cur_nz = _mm512_test_epi8_mask(v_cur, v_cur);
+	for (; i + 8 <= num; i += 8)
+	{
+		u64* const* vs = virgins + i;
+		__m512i v_vir = _mm512_set_epi64(vs[7][idx], vs[6][idx], vs[5][idx],
+			vs[4][idx], vs[3][idx], vs[2][idx], vs[1][idx], vs[0][idx]);
+		__mmask8 hits = _mm512_test_epi64_mask(v_vir, v_cur);
+		if (likely(hits == 0))
+			continue;
+		u64 tuples = _mm512_mask_cmpeq_epi8_mask(cur_nz, v_vir, v_ff);
+		for (size_t j = 0; j < 8; ++j)
+		{
+			if ((hits & (1u << j)) == 0)
+				continue;
+			u64* virgin = vs[j] + idx;
+			discover_virgin(new_bits, cur, virgin, i + j, num, cur & *virgin,
+				((tuples >> (j * 8)) & 0xff) != 0, modify, or_all, and_bit_seq);
+		}
+	}
+#elif defined(__AVX2__)
+	const __m256i v_cur = _mm256_set1_epi64x(cur);
+	const __m256i v_ff = _mm256_set1_epi8(-1);
+	const __m256i v_zero = _mm256_setzero_si256();
+	const u32 cur_nz = ~(u32)_mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(v_cur, v_zero));
+	for (; i + 4 <= num; i += 4)
+	{
+		u64* const* vs = virgins + i;
+		__m256i v_vir = _mm256_set_epi64x(
+			vs[3][idx], vs[2][idx], vs[1][idx], vs[0][idx]);
+		if (likely(_mm256_testz_si256(v_vir, v_cur)))
+			continue;
+		u32 tuples = cur_nz & (u32)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(v_vir, v_ff));
+		for (size_t j = 0; j < 4; ++j)
+		{
+			u64* virgin = vs[j] + idx;
+			tmp = cur & *virgin;
+			if (tmp == 0)
+				continue;
+			discover_virgin(new_bits, cur, virgin, i + j, num, tmp,
+				((tuples >> (j * 8)) & 0xff) != 0, modify, or_all, and_bit_seq);
+		}
+	}
+#endif
+
+	for (; i < num; ++i)
 	{
 		u64* virgin = virgins[i] + idx;
-
-		u64 tmp = *current & *virgin;
-
-		if (and_bit_seq != nullptr)
-			and_bit_seq->push_back(tmp);
-
+		tmp = cur & *virgin;
 		if (tmp)
 		{
-			or_all |= tmp;
-
-			// For the first time we touched a virgin map,
-			// we create the sequence to store all `*current & *virgin` values.
-			// This is a lazy approach so that we don't create the sequence
-			// for most zero sequences.
-			if (and_bit_seq == nullptr)
-			{
-				and_bit_seq = make_unique<vector<u64>>();
-				and_bit_seq->reserve(num);
-				// Since this is the first time we touch virgin bits,
-				// all previous `*current & *virgin` values are zeros.
-				for (size_t j = 0; j < i; ++j)
-					and_bit_seq->push_back(0);
-				and_bit_seq->push_back(tmp);
-			}
-
-			u8* ret = new_bits + i;
-			if (likely(*ret < 2))
-			{
-				u8 *cur = (u8 *)current;
-				u8 *vir = (u8 *)virgin;
-
-				if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-					(cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-					(cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-					(cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff))
-					*ret = 2;
-				else
-					*ret = 1;
-			}
-			if (modify)
-				*virgin &= ~*current;
+			discover_virgin(new_bits, cur, virgin, i, num, tmp,
+				new_tuple_bytes(cur, *virgin) != 0, modify, or_all, and_bit_seq);
 		}
 	}
 
-	if (modify && or_all != 0)
+	// The sequence is allocated iff `or_all != 0`
+	if (and_bit_seq != nullptr)
 	{
-		clusters.add_bit_seq(or_all, std::move(and_bit_seq));
+		if (modify)
+			clusters().add_bit_seq(or_all, num);
+		else
+			clusters().drop_bit_seq(num);
 	}
 }
 
 void aflrun_commit_bit_seqs(const size_t* cs, size_t num)
 {
-	clusters.commit_bit_seqs(cs, num);
-}
\ No newline at end of file
+	clusters().commit_bit_seqs(cs, num);
+	clusters().enforce_budget();
+}
+
+size_t aflrun_get_evicted_clusters(void)
+{
+	return clusters().get_num_evicted();
+}
+/* ----- Instances ----- */
+// State of an instance of AFLRun, reached through the accessors declared with
+// each part above. Only `diag_writer`, `rd` and the file of 0xff behind lazy
+// maps are shared by all instances.
+struct aflrun_ctx
+{
+	AFLRunUpdateTime update_time;
+	bool profile_phases = false;
+	aflrun_phase_t phases[AFLRUN_PHASE_NUM] = {};
+	u64 num_virgin_maps = 0;
+	AFLRunConfig config;
+	has_new_path_t has_new_path_fn = has_new_path_profiles[0][1];
+	WorkerPool workers;
+	TargetPartition target_partition;
+	TargetControl target_control;
+	unique_ptr<AFLRunGlobals> g;
+	unique_ptr<FringeBlocks<Fringe, Fringe>> path_fringes;
+	unique_ptr<FringeBlocks<Fringe, reach_t>> path_pro_fringes;
+	unique_ptr<FringeBlocks<Fringe, u8/*not used*/>> reached_targets;
+	BlockDists bb_to_dists;
+	FringeHits fringe_hits;
+	AFLRunState state;
+	vector<double> seed_quant;
+	mt19937 gen{rd()};
+	uniform_int_distribution<> distrib{0, 99};
+	u32 num_active_seeds = 0;
+	unique_ptr<AFLRunGraph> graph;
+	vector<double> bb_to_avg_dists;
+	vector<bool> no_ctx_blocks;
+	rh::unordered_map<string, reach_t> name_to_id, fname_to_id;
+	vector<string> id_to_fname;
+	u32 window_lo = 0, window_hi = 0;
+#ifdef AFLRUN_CTX_DIV
+	Clusters<Fringe> clusters;
+#else
+	Clusters<reach_t> clusters;
+#endif
+	unique_ptr<DiversityBlocks<reach_t>> div_blocks;
+	reach_t num_all_targets = 0;
+	vector<group_t> static_groups;
+	group_t num_static_groups = 0;
+	string targets_info;
+	vector<reach_t> seed_info_blocks;
+	vector<double> seed_info_dists;
+	vector<reach_t> seed_decisive_blocks;
+	vector<u32> splice_partners;
+	vector<OpStats> op_stats;
+	vector<reach_t> op_targets, op_groups;
+	Checkpoint checkpoint;
+	AutoTuner auto_tuner;
+	vector<u64> visited_targets;
+	u64 virgin_version = 0, virgin_block_version = 0;
+	TargetPathsCache<reach_t> block_paths;
+	TargetPathsCache<Fringe> fringe_paths;
+	rh::unordered_flat_map<u64, double> edge_weights;
+	vector<u8> in_weights_known;
+	rh::unordered_map<reach_t, vector<reach_t>> learned_targets;
+	aflrun_registry_t* registry = nullptr;
+	size_t registry_cursor = 0;
+	bo::dynamic_bitset<> remote_reached;
+};
+
+namespace
+{
+// Instance current at startup, and in each thread until it switches
+aflrun_ctx startup_ctx;
+thread_local aflrun_ctx* current_ctx = &startup_ctx;
+
+#define AFLRUN_CTX_PART(name) \
+	auto name() -> decltype((current_ctx->name)) { return current_ctx->name; }
+AFLRUN_CTX_PART(update_time)
+AFLRUN_CTX_PART(profile_phases)
+AFLRUN_CTX_PART(num_virgin_maps)
+AFLRUN_CTX_PART(config)
+AFLRUN_CTX_PART(has_new_path_fn)
+AFLRUN_CTX_PART(workers)
+AFLRUN_CTX_PART(target_partition)
+AFLRUN_CTX_PART(target_control)
+AFLRUN_CTX_PART(g)
+AFLRUN_CTX_PART(path_fringes)
+AFLRUN_CTX_PART(path_pro_fringes)
+AFLRUN_CTX_PART(reached_targets)
+AFLRUN_CTX_PART(bb_to_dists)
+AFLRUN_CTX_PART(fringe_hits)
+AFLRUN_CTX_PART(state)
+AFLRUN_CTX_PART(seed_quant)
+AFLRUN_CTX_PART(gen)
+AFLRUN_CTX_PART(distrib)
+AFLRUN_CTX_PART(num_active_seeds)
+AFLRUN_CTX_PART(graph)
+AFLRUN_CTX_PART(bb_to_avg_dists)
+AFLRUN_CTX_PART(no_ctx_blocks)
+AFLRUN_CTX_PART(name_to_id)
+AFLRUN_CTX_PART(fname_to_id)
+AFLRUN_CTX_PART(id_to_fname)
+AFLRUN_CTX_PART(window_lo)
+AFLRUN_CTX_PART(window_hi)
+AFLRUN_CTX_PART(clusters)
+AFLRUN_CTX_PART(div_blocks)
+AFLRUN_CTX_PART(num_all_targets)
+AFLRUN_CTX_PART(static_groups)
+AFLRUN_CTX_PART(num_static_groups)
+AFLRUN_CTX_PART(targets_info)
+AFLRUN_CTX_PART(seed_info_blocks)
+AFLRUN_CTX_PART(seed_info_dists)
+AFLRUN_CTX_PART(seed_decisive_blocks)
+AFLRUN_CTX_PART(splice_partners)
+AFLRUN_CTX_PART(op_stats)
+AFLRUN_CTX_PART(op_targets)
+AFLRUN_CTX_PART(op_groups)
+AFLRUN_CTX_PART(checkpoint)
+AFLRUN_CTX_PART(auto_tuner)
+AFLRUN_CTX_PART(visited_targets)
+AFLRUN_CTX_PART(virgin_version)
+AFLRUN_CTX_PART(virgin_block_version)
+AFLRUN_CTX_PART(edge_weights)
+AFLRUN_CTX_PART(in_weights_known)
+AFLRUN_CTX_PART(learned_targets)
+AFLRUN_CTX_PART(registry)
+AFLRUN_CTX_PART(registry_cursor)
+AFLRUN_CTX_PART(remote_reached)
+#undef AFLRUN_CTX_PART
+
+aflrun_phase_t* phases()
+{
+	return current_ctx->phases;
+}
+
+template <>
+TargetPathsCache<reach_t>& target_paths_memo<reach_t>()
+{
+	return current_ctx->block_paths;
+}
+template <>
+TargetPathsCache<Fringe>& target_paths_memo<Fringe>()
+{
+	return current_ctx->fringe_paths;
+}
+}
+
+aflrun_ctx_t* aflrun_ctx_new(void)
+{
+	return new aflrun_ctx();
+}
+
+void aflrun_ctx_free(aflrun_ctx_t* ctx)
+{
+	assert(ctx != current_ctx && ctx != &startup_ctx);
+	delete ctx;
+}
+
+aflrun_ctx_t* aflrun_ctx_switch(aflrun_ctx_t* ctx)
+{
+	aflrun_ctx* ret = current_ctx;
+	current_ctx = ctx;
+	return ret;
+}
@@ -0,0 +1,83 @@
+/*
+   libaflrun - callbacks of AFLRun outside of afl-fuzz
+   ---------------------------------------------------
+
+   afl-fuzz implements the functions the scheduler calls about its seeds
+   itself. libaflrun.a and libaflrun.so implement them with this file
+   instead, forwarding to the callbacks an engine sets with
+   aflrun_set_callbacks(), see include/libaflrun.h.
+
+*/
+
+#include <sys/time.h>
+
+#include "libaflrun.h"
+
+static aflrun_callbacks_t callbacks;
+
+u32 aflrun_lib_abi(void) {
+
+  return AFLRUN_LIB_ABI;
+
+}
+
+void aflrun_set_callbacks(const aflrun_callbacks_t *cb) {
+
+  callbacks = *cb;
+
+}
+
+u64 get_seed_fav_factor(void *afl, u32 seed) {
+
+  return callbacks.seed_fav_factor ? callbacks.seed_fav_factor(afl, seed) : 1;
+
+}
+
+double get_seed_perf_score(void *afl, u32 seed) {
+
+  return callbacks.seed_perf_score ? callbacks.seed_perf_score(afl, seed)
+                                   : 100;
+
+}
+
+bool get_seed_div_favored(void *afl, u32 seed) {
+
+  return callbacks.seed_div_favored && callbacks.seed_div_favored(afl, seed);
+
+}
+
+u8 get_seed_cov_favored(void *afl, u32 seed) {
+
+  return callbacks.seed_cov_favored ? callbacks.seed_cov_favored(afl, seed)
+                                    : 1;
+
+}
+
+u64 get_seed_exec_us(void *afl, u32 seed) {
+
+  return callbacks.seed_exec_us ? callbacks.seed_exec_us(afl, seed) : 0;
+
+}
+
+void merge_seed_tops(void *afl, void **dst, void **src) {
+
+  if (callbacks.merge_seed_tops) { callbacks.merge_seed_tops(afl, dst, src); }
+
+}
+
+void disable_aflrun_extra(void *afl, u32 seed) {
+
+  if (callbacks.disable_extra) { callbacks.disable_extra(afl, seed); }
+
+}
+
+u64 get_cur_time(void) {
+
+  if (callbacks.cur_time) { return callbacks.cur_time(); }
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec * 1000ULL) + (tv.tv_usec / 1000);
+
+}
+
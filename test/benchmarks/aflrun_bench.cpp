@@ -0,0 +1,795 @@
+/*
+  Microbenchmark of the AFLRun scheduler core in src/aflrun.cpp.
+
+  A CFG is either loaded from the temp directory of an AFLRun build (`-d`,
+  i.e. BBreachable.txt, Freachable.txt, BBedges.txt, distance.cfg/ and
+  Tgroups.txt), or generated with `-r` reachable blocks, `-t` targets and
+  `-f` functions.
+  Executions are replayed as random walks over the CFG and go through the
+  same calls as `save_if_interesting` and calibration do in afl-fuzz:
+  `aflrun_get_virgins`, `discover_word_mul`, `aflrun_has_new_path`,
+  `aflrun_get_seed_virgins`, `aflrun_commit_bit_seqs` (the `Clusters` merge
+  path) and `aflrun_update_fringe_score`. Then `-c` cycles of queue culling
+  and energy assignment are run over the resulting seeds. The time spent in
+  each call is printed with the numbers of seeds, clusters and fringes, and
+  a checksum of the decisions of these cycles.
+
+  With `-R`, executions recorded by afl-fuzz with `AFL_RECORD_TRACES` are
+  replayed instead of random walks, on the CFG of the same target given
+  with `-d`, so the same campaign can be fed to different scheduler builds
+  or configs.
+
+  Build and run with `make aflrun_bench`, e.g.:
+
+    test/benchmarks/aflrun_bench -r 100000 -t 32 -n 200000 -c 20
+    test/benchmarks/aflrun_bench -d /path/to/temp -C interleave_virgins=1
+    test/benchmarks/aflrun_bench -d /path/to/temp -R traces -C rand_seed=1
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libaflrun.h"
+#include "aflrun-record.h"
+
+using namespace std;
+
+/* ----- Callbacks of libaflrun, answered from the replayed seeds ----- */
+
+namespace
+{
+
+struct BenchSeed
+{
+	u64 exec_us, len;
+	bool cov_favored;
+};
+
+vector<BenchSeed> seeds;
+int dummy_afl;
+
+u64 seed_fav_factor(void*, u32 seed)
+{
+	return seeds[seed].exec_us * seeds[seed].len;
+}
+
+bool seed_div_favored(void*, u32 seed)
+{
+	return seeds[seed].cov_favored;
+}
+
+u8 seed_cov_favored(void*, u32 seed)
+{
+	return seeds[seed].cov_favored ? 2 : 0;
+}
+
+u64 seed_exec_us(void*, u32 seed)
+{
+	return seeds[seed].exec_us;
+}
+
+u64 cur_time(void)
+{
+	return chrono::duration_cast<chrono::milliseconds>(
+		chrono::system_clock::now().time_since_epoch()).count();
+}
+
+const aflrun_callbacks_t callbacks = {
+	seed_fav_factor, NULL, seed_div_favored, seed_cov_favored, NULL, NULL,
+	cur_time, seed_exec_us
+};
+
+}
+
+namespace
+{
+
+/* ----- Timing ----- */
+
+struct Timer
+{
+	const char* name;
+	u64 calls = 0, ns = 0;
+};
+
+enum
+{
+	kGetVirgins, kDiscover, kHasNewPath, kSeedVirgins, kCommit,
+	kFringeScore, kCullQueue, kAssignEnergy, kNumTimers
+};
+
+Timer timers[kNumTimers] = {
+	{"aflrun_get_virgins"}, {"discover_word_mul (check)"},
+	{"aflrun_has_new_path"}, {"aflrun_get_seed_virgins"},
+	{"discover_word_mul + commit"}, {"aflrun_update_fringe_score"},
+	{"aflrun_cull_queue"}, {"aflrun_assign_energy"}
+};
+
+inline u64 now_ns()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Scope
+{
+	Timer& t; u64 start;
+	explicit Scope(int i) : t(timers[i]), start(now_ns()) {}
+	~Scope() { t.ns += now_ns() - start; ++t.calls; }
+};
+
+/* ----- CFG ----- */
+
+struct CFG
+{
+	reach_t num_targets, num_reachables, num_ftargets, num_freachables;
+	vector<string> names;
+	vector<vector<reach_t>> to_targets, succs;
+	vector<double> weights;
+	vector<reach_t> entries;
+};
+
+[[noreturn]] void fatal(const string& msg)
+{
+	fprintf(stderr, "aflrun_bench: %s\n", msg.c_str());
+	exit(1);
+}
+
+// Generate a CFG where each block jumps to blocks of lower index, mostly
+// nearby ones, so that every block can reach one of the targets 0..t-1.
+void gen_cfg(CFG& cfg, const string& dir, reach_t nr, reach_t nt, reach_t nf,
+	mt19937_64& rng)
+{
+	if (nt == 0 || nt > nr || nf < 2)
+		fatal("Invalid numbers of reachables, targets or functions");
+	cfg.num_targets = nt; cfg.num_reachables = nr;
+	cfg.num_freachables = nf; cfg.num_ftargets = min(nt, nf / 2);
+	cfg.succs.assign(nr, {});
+	for (reach_t b = nt; b < nr; ++b)
+	{
+		size_t deg = 1 + rng() % 3;
+		for (size_t i = 0; i < deg; ++i)
+		{
+			reach_t s = rng() % 10 ? b - 1 - rng() % min<reach_t>(b, 16) :
+				rng() % b;
+			cfg.succs[b].push_back(s);
+		}
+	}
+
+	// Distances are lengths of shortest paths, found by BFS over predecessors
+	vector<vector<reach_t>> preds(nr);
+	for (reach_t b = 0; b < nr; ++b)
+		for (reach_t s : cfg.succs[b])
+			preds[s].push_back(b);
+	if (mkdir((dir + "/distance.cfg").c_str(), 0700))
+		fatal("Unable to create " + dir + "/distance.cfg");
+	cfg.to_targets.assign(nr, {});
+	vector<u32> dist(nr);
+	for (reach_t t = 0; t < nt; ++t)
+	{
+		ofstream df(dir + "/distance.cfg/" + to_string(t) + ".txt");
+		fill(dist.begin(), dist.end(), UINT32_MAX);
+		vector<reach_t> q{t}; dist[t] = 0;
+		for (size_t i = 0; i < q.size(); ++i)
+		{
+			reach_t b = q[i];
+			cfg.to_targets[b].push_back(t);
+			df << 'b' << b << ',' << dist[b] << '\n';
+			for (reach_t p : preds[b])
+			{
+				if (dist[p] != UINT32_MAX)
+					continue;
+				dist[p] = dist[b] + 1;
+				q.push_back(p);
+			}
+		}
+	}
+
+	ofstream bf(dir + "/BBreachable.txt");
+	bf << nt << ',' << nr << '\n';
+	for (reach_t b = 0; b < nr; ++b)
+	{
+		bf << 'b' << b;
+		for (reach_t t : cfg.to_targets[b])
+			bf << ',' << t;
+		if (b < nt)
+			bf << "|1";
+		bf << '\n';
+	}
+	ofstream ef(dir + "/BBedges.txt");
+	for (reach_t b = 0; b < nr; ++b)
+		for (reach_t s : cfg.succs[b])
+			ef << b << ',' << s << '\n';
+	ofstream ff(dir + "/Freachable.txt");
+	ff << cfg.num_ftargets << ',' << nf << '\n';
+	for (reach_t f = 0; f < nf; ++f)
+		ff << 'f' << f << '\n';
+	ofstream(dir + "/Chash.txt");
+
+	// Targets grouped by the blocks reaching them, like `groupTargets`
+	vector<vector<reach_t>> target_preds(nt);
+	for (reach_t b = 0; b < nr; ++b)
+		for (reach_t t : cfg.to_targets[b])
+			target_preds[t].push_back(b);
+	map<vector<reach_t>, reach_t> groups;
+	ofstream gf(dir + "/Tgroups.txt");
+	for (reach_t t = 0; t < nt; ++t)
+	{
+		reach_t next = groups.size();
+		gf << groups.emplace(std::move(target_preds[t]), next).first->second
+			<< '\n';
+	}
+}
+
+// Load the CFG of an AFLRun temp directory, like `aflrun_temp_dir_init`
+void load_cfg(CFG& cfg, const string& dir)
+{
+	ifstream bf(dir + "/BBreachable.txt");
+	string line;
+	if (!getline(bf, line) ||
+		sscanf(line.c_str(), "%u,%u", &cfg.num_targets, &cfg.num_reachables) != 2)
+		fatal("Unable to read " + dir + "/BBreachable.txt");
+	while (getline(bf, line))
+	{
+		size_t pos = line.find(',');
+		if (pos == string::npos)
+			fatal("Wrong format for BBreachable.txt");
+		cfg.names.push_back(line.substr(0, pos));
+		cfg.to_targets.emplace_back();
+		const char* it = line.c_str() + pos;
+		char* end;
+		while (*it == ',')
+		{
+			cfg.to_targets.back().push_back(strtoul(it + 1, &end, 10));
+			it = end;
+		}
+		if (cfg.names.size() <= cfg.num_targets)
+			cfg.weights.push_back(*it == '|' ? strtod(it + 1, NULL) : 1);
+	}
+	if (cfg.names.size() != cfg.num_reachables)
+		fatal("Header and content of BBreachable.txt do not match");
+
+	ifstream ff(dir + "/Freachable.txt");
+	if (!getline(ff, line) || sscanf(line.c_str(), "%u,%u",
+		&cfg.num_ftargets, &cfg.num_freachables) != 2)
+		fatal("Unable to read " + dir + "/Freachable.txt");
+
+	cfg.succs.assign(cfg.num_reachables, {});
+	ifstream ef(dir + "/BBedges.txt");
+	reach_t src, dst;
+	while (getline(ef, line))
+	{
+		if (sscanf(line.c_str(), "%u,%u", &src, &dst) == 2 &&
+			src < cfg.num_reachables && dst < cfg.num_reachables)
+			cfg.succs[src].push_back(dst);
+	}
+}
+
+/* ----- Replay ----- */
+
+constexpr u32 kMapSize = 1 << 16;
+
+struct Maps
+{
+	reach_t nr, nf; u32 map_size;
+	vector<u8> virgin_bits, virgin_reachables, virgin_freachables, virgin_ctx,
+		div_switch;
+	// One execution
+	vector<u64> trace;
+	vector<u8> reached, freached, ctx;
+	vector<reach_t> visited;
+	vector<ctx_t> new_paths, targets;
+
+	Maps(reach_t nr, reach_t nf, u32 map_size) : nr(nr), nf(nf),
+		map_size(map_size), virgin_bits(map_size, 0xff), virgin_reachables(MAP_RBB_SIZE(nr), 0xff),
+		virgin_freachables(MAP_RF_SIZE(nf), 0xff),
+		virgin_ctx(MAP_TR_SIZE(nr), 0xff), div_switch(MAP_RBB_SIZE(nr), 0),
+		trace(map_size / 8), reached(MAP_RBB_SIZE(nr)),
+		freached(MAP_RF_SIZE(nf)), ctx(MAP_TR_SIZE(nr)) {}
+
+	void clear()
+	{
+		fill(trace.begin(), trace.end(), 0);
+		for (reach_t b : visited)
+		{
+			reached[b / 8] = 0;
+			memset(ctx.data() + CTX_NUM_BYTES * b, 0, CTX_NUM_BYTES);
+		}
+		fill(freached.begin(), freached.end(), 0);
+		visited.clear(); new_paths.clear(); targets.clear();
+	}
+};
+
+inline reach_t func_of(const CFG& cfg, reach_t b)
+{
+	reach_t nft = cfg.num_ftargets;
+	return b < cfg.num_targets ? b % nft :
+		nft + b % (cfg.num_freachables - nft);
+}
+
+// Walk the CFG from a few entries, marking what the runtime would mark.
+void execute(const CFG& cfg, Maps& m, mt19937_64& rng, u32 walks)
+{
+	m.clear();
+	for (u32 w = 0; w < walks; ++w)
+	{
+		reach_t b = cfg.entries[rng() % cfg.entries.size()], prev = 0;
+		while (true)
+		{
+			u32 c = (prev * 0x9e3779b1u >> 16) % min(CTX_SIZE, 4);
+			u8* byte = m.ctx.data() + CTX_NUM_BYTES * b + c / 8;
+			if (!(m.reached[b / 8] & (1 << (b % 8))))
+				m.visited.push_back(b);
+			m.reached[b / 8] |= 1 << (b % 8);
+			if (!(*byte & (1 << (c % 8))) &&
+				(m.div_switch[b / 8] & (1 << (b % 8))))
+				m.targets.push_back({b, c});
+			*byte |= 1 << (c % 8);
+			reach_t f = func_of(cfg, b);
+			m.freached[f / 8] |= 1 << (f % 8);
+			u32 e = ((prev >> 1) ^ b) * 0x9e3779b1u % m.map_size;
+			reinterpret_cast<u8*>(m.trace.data())[e] = 1;
+
+			const auto& s = cfg.succs[b];
+			if (s.empty() || rng() % 64 == 0)
+				break;
+			prev = b;
+			b = s[rng() % s.size()];
+		}
+	}
+
+	// New context bits, like `aflrun_collect_new_paths`
+	for (reach_t b : m.visited)
+	{
+		for (u32 j = 0; j < CTX_NUM_BYTES; ++j)
+		{
+			size_t i = CTX_NUM_BYTES * b + j;
+			u8 bits = m.ctx[i] & m.virgin_ctx[i];
+			if (!bits)
+				continue;
+			m.virgin_ctx[i] &= ~bits;
+			for (u32 k = 0; k < 8; ++k)
+				if (bits & (1 << k))
+					m.new_paths.push_back({b, j * 8 + k});
+		}
+	}
+}
+
+struct Replay
+{
+	vector<u8*> virgins;
+	vector<size_t> clusters;
+	vector<u8> new_bits;
+
+	u8 discover(Maps& m, size_t num, u8 modify)
+	{
+		new_bits.assign(num, 0);
+		u64* const* vs = reinterpret_cast<u64* const*>(virgins.data());
+		for (size_t i = 0; i < m.trace.size(); ++i)
+		{
+			if (m.trace[i])
+				discover_word_mul(new_bits.data(), &m.trace[i], vs, num, i, modify);
+		}
+		u8 ret = 0;
+		for (u8 b : new_bits)
+			ret |= b;
+		return ret;
+	}
+
+	// Return true if the execution is kept as a new seed; an imported seed
+	// is always kept, and goes through `aflrun_new_bits` of calibration.
+	bool run(Maps& m, mt19937_64& rng, bool import = false, u8 inc = 1,
+		u64 len = 0)
+	{
+		u32 seed = seeds.size();
+		if (import)
+		{
+			{
+				Scope s(kHasNewPath);
+				aflrun_has_new_path(m.freached.data(), m.reached.data(),
+					m.ctx.data(), m.new_paths.data(), m.new_paths.size(), 0,
+					seed, NULL, NULL, 0);
+			}
+			keep(m, rng, seed, len);
+			return true;
+		}
+		size_t n = m.targets.size() + 1;
+		virgins.resize(n); clusters.resize(n);
+		virgins[0] = m.virgin_bits.data(); clusters[0] = 0;
+		size_t num;
+		{
+			Scope s(kGetVirgins);
+			num = aflrun_get_virgins(m.targets.data(), m.targets.size(),
+				virgins.data() + 1, clusters.data() + 1) + 1;
+		}
+		u8 nb;
+		{
+			Scope s(kDiscover);
+			nb = discover(m, num, 0);
+		}
+		u8 np;
+		{
+			Scope s(kHasNewPath);
+			np = aflrun_has_new_path(m.freached.data(), m.reached.data(),
+				m.ctx.data(), m.new_paths.data(), m.new_paths.size(), inc, seed,
+				nb ? new_bits.data() : NULL, clusters.data(), num);
+		}
+		if (!nb && !np)
+		{
+			aflrun_commit_bit_seqs(clusters.data(), 0);
+			return false;
+		}
+
+		keep(m, rng, seed, len);
+		return true;
+	}
+
+	void keep(Maps& m, mt19937_64& rng, u32 seed, u64 len)
+	{
+		seeds.push_back(
+			{50 + rng() % 1000, len ? len : 1 + rng() % 4096, rng() % 4 == 0});
+		size_t n, num;
+		{
+			Scope s(kSeedVirgins);
+			n = aflrun_max_clusters(seed);
+			virgins.resize(n); clusters.resize(n);
+			virgins[0] = m.virgin_bits.data(); clusters[0] = 0;
+			num = aflrun_get_seed_virgins(
+				seed, virgins.data() + 1, clusters.data() + 1) + 1;
+		}
+		{
+			Scope s(kCommit);
+			discover(m, num, 1);
+			aflrun_commit_bit_seqs(clusters.data(), num);
+		}
+		{
+			Scope s(kFringeScore);
+			aflrun_update_fringe_score(seed);
+		}
+	}
+};
+
+/* ----- Recorded executions, see "aflrun-record.h" ----- */
+
+struct Record
+{
+	u8 kind, fault, inc;
+	u64 seed, len;
+};
+
+inline u8 classify(u8 v)
+{
+	// Same buckets as `count_class_lookup8` of afl-fuzz
+	static const u8 lo[8] = {0, 1, 2, 4, 8, 8, 8, 8};
+	return v < 8 ? lo[v] : v < 16 ? 16 : v < 32 ? 32 : v < 128 ? 64 : 128;
+}
+
+class Recording
+{
+	ifstream in;
+	vector<u8> buf;
+	const u8 *p, *end;
+
+	u64 get()
+	{
+		u64 v;
+		p = aflrun_get_varint(p, end, &v);
+		if (p == NULL)
+			fatal("Truncated record");
+		return v;
+	}
+
+public:
+	aflrun_record_hdr_t hdr;
+
+	explicit Recording(const string& file) : in(file, ios::binary)
+	{
+		if (!in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+			hdr.magic != AFLRUN_RECORD_MAGIC)
+			fatal("Not a recording of AFL_RECORD_TRACES: " + file);
+		if (hdr.ctx_size_pow2 != CTX_SIZE_POW2 || hdr.map_size % 64)
+			fatal("Recording does not match CTX_SIZE_POW2 of this build");
+	}
+
+	// Fill `m` with the maps of next execution, return false at the end
+	bool next(Maps& m, Record& r)
+	{
+		u64 size = 0;
+		for (u32 shift = 0;; shift += 7)
+		{
+			int c = in.get();
+			if (c == EOF && shift == 0)
+				return false;
+			if (c == EOF || shift >= 64)
+				fatal("Truncated record");
+			size |= (u64)(c & 0x7f) << shift;
+			if (!(c & 0x80))
+				break;
+		}
+		buf.resize(size);
+		if (!in.read(reinterpret_cast<char*>(buf.data()), size) || size < 3)
+			fatal("Truncated record");
+		p = buf.data(); end = p + size;
+
+		m.clear();
+		r.kind = *p++; r.fault = *p++; r.inc = *p++;
+		r.seed = get(); r.len = get();
+		u8* trace = reinterpret_cast<u8*>(m.trace.data());
+		u64 idx = 0;
+		for (u64 n = get(); n > 0; --n)
+		{
+			idx += get();
+			if (idx >= m.map_size || p == end)
+				fatal("Invalid edge in record");
+			trace[idx] = classify(*p++);
+		}
+		idx = 0;
+		for (u64 n = get(); n > 0; --n)
+		{
+			idx += get();
+			if (idx >= m.nr)
+				fatal("Invalid block in record");
+			m.reached[idx / 8] |= 1 << (idx % 8);
+			m.visited.push_back(idx);
+		}
+		idx = 0;
+		for (u64 n = get(); n > 0; --n)
+		{
+			idx += get();
+			if (idx >= m.nf)
+				fatal("Invalid function in record");
+			m.freached[idx / 8] |= 1 << (idx % 8);
+		}
+		idx = 0;
+		for (u64 n = get(); n > 0; --n)
+		{
+			idx += get();
+			if (idx >= (u64)m.nr * CTX_SIZE)
+				fatal("Invalid context in record");
+			m.ctx[idx / 8] |= 1 << (idx % 8);
+		}
+		for (auto* list : {&m.new_paths, &m.targets})
+		{
+			for (u64 n = get(); n > 0; --n)
+			{
+				ctx_t c;
+				c.block = get(); c.call_ctx = get();
+				if (c.block >= m.nr || c.call_ctx >= CTX_SIZE)
+					fatal("Invalid path in record");
+				list->push_back(c);
+			}
+		}
+
+		// The runtime clears virgin bits of paths it logs
+		for (const ctx_t& c : m.new_paths)
+		{
+			m.virgin_ctx[CTX_NUM_BYTES * c.block + c.call_ctx / 8] &=
+				~(1 << (c.call_ctx % 8));
+		}
+		return true;
+	}
+};
+
+void usage(const char* argv0)
+{
+	fprintf(stderr,
+		"%s [ options ]\n\n"
+		"  -d dir    - AFLRun temp directory to load the CFG from\n"
+		"  -R file   - replay executions recorded with AFL_RECORD_TRACES\n"
+		"              (needs -d of the recorded target)\n"
+		"  -r num    - reachable blocks of a generated CFG (default: 20000)\n"
+		"  -t num    - targets of a generated CFG (default: 16)\n"
+		"  -f num    - functions of a generated CFG (default: blocks / 16)\n"
+		"  -n num    - executions to replay (default: 100000)\n"
+		"  -w num    - walks per execution (default: 4)\n"
+		"  -c num    - cycles of culling and energy assignment (default: 10)\n"
+		"  -C config - AFLRun config, as given to afl-fuzz --config\n"
+		"  -s seed   - random seed (default: 0)\n", argv0);
+	exit(1);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	string dir, config, record;
+	reach_t nr = 20000, nt = 16, nf = 0;
+	u64 execs = 100000, cycles = 10, rseed = 0;
+	u32 walks = 4;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:R:r:t:f:n:w:c:C:s:")) > 0)
+	{
+		switch (opt)
+		{
+		case 'd': dir = optarg; break;
+		case 'R': record = optarg; break;
+		case 'r': nr = strtoul(optarg, NULL, 10); break;
+		case 't': nt = strtoul(optarg, NULL, 10); break;
+		case 'f': nf = strtoul(optarg, NULL, 10); break;
+		case 'n': execs = strtoull(optarg, NULL, 10); break;
+		case 'w': walks = strtoul(optarg, NULL, 10); break;
+		case 'c': cycles = strtoull(optarg, NULL, 10); break;
+		case 'C': config = optarg; break;
+		case 's': rseed = strtoull(optarg, NULL, 10); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || walks == 0 || (!record.empty() && dir.empty()))
+		usage(argv[0]);
+
+	mt19937_64 rng(rseed);
+	CFG cfg;
+	char tmp[] = "/tmp/aflrun_bench.XXXXXX";
+	if (mkdtemp(tmp) == NULL)
+		fatal("mkdtemp() failed");
+	bool generated = dir.empty();
+	if (generated)
+	{
+		dir = tmp;
+		gen_cfg(cfg, dir, nr, nt, nf ? nf : max<reach_t>(nr / 16, 2), rng);
+		for (reach_t b = 0; b < cfg.num_reachables; ++b)
+			cfg.names.push_back("b" + to_string(b));
+		cfg.weights.assign(cfg.num_targets, 1);
+	}
+	else
+	{
+		load_cfg(cfg, dir);
+	}
+	unique_ptr<Recording> rec;
+	if (!record.empty())
+	{
+		rec = make_unique<Recording>(record);
+		if (rec->hdr.num_reachables != cfg.num_reachables ||
+			rec->hdr.num_freachables != cfg.num_freachables)
+			fatal("Recording is not of the target in " + dir);
+	}
+	u32 map_size = rec ? rec->hdr.map_size : kMapSize;
+
+	// Entries are blocks without predecessors, or the last blocks if none
+	vector<bool> has_pred(cfg.num_reachables);
+	for (const auto& s : cfg.succs)
+		for (reach_t b : s)
+			has_pred[b] = true;
+	for (reach_t b = 0; b < cfg.num_reachables; ++b)
+		if (!has_pred[b] && !cfg.succs[b].empty())
+			cfg.entries.push_back(b);
+	if (cfg.entries.empty())
+		cfg.entries.push_back(cfg.num_reachables - 1);
+
+	u8 check_at_begin, log_at_begin;
+	u64 log_check_interval;
+	double trim_thr, queue_quant_thr;
+	u32 min_num_exec;
+	reach_t nft, nfr;
+	// Skip the initial coverage mode, it does not use the scheduler
+	config = "init_cov_quant=0" + (config.empty() ? "" : ":" + config);
+	aflrun_set_callbacks(&callbacks);
+	aflrun_load_config(config.c_str(), &check_at_begin, &log_at_begin,
+		&log_check_interval, &trim_thr, &queue_quant_thr, &min_num_exec);
+	aflrun_load_freachables(dir.c_str(), &nft, &nfr);
+	aflrun_load_edges(dir.c_str(), cfg.num_reachables);
+
+	vector<char*> names;
+	vector<reach_t*> to_targets;
+	vector<reach_t> to_size;
+	for (reach_t b = 0; b < cfg.num_reachables; ++b)
+	{
+		names.push_back(&cfg.names[b][0]);
+		to_targets.push_back(cfg.to_targets[b].data());
+		to_size.push_back(cfg.to_targets[b].size());
+	}
+	aflrun_load_dists(dir.c_str(), cfg.num_targets, cfg.num_reachables,
+		names.data());
+	aflrun_load_groups(dir.c_str());
+	aflrun_init_groups(cfg.num_targets);
+	aflrun_init_fringes(cfg.num_reachables, cfg.num_targets);
+
+	Maps m(cfg.num_reachables, cfg.num_freachables, map_size);
+	aflrun_init_globals(&dummy_afl, cfg.num_targets, cfg.num_reachables,
+		cfg.num_ftargets, cfg.num_freachables, m.virgin_reachables.data(),
+		m.virgin_freachables.data(), m.virgin_ctx.data(), names.data(),
+		to_targets.data(), to_size.data(), tmp, cfg.weights.data(), map_size,
+		m.div_switch.data(), NULL);
+	u8 whole_end;
+	aflrun_cycle_end(&whole_end);
+
+	printf("CFG: %u reachables, %u targets, %u functions, %zu entries\n",
+		cfg.num_reachables, cfg.num_targets, cfg.num_freachables,
+		cfg.entries.size());
+
+	Replay replay;
+	u64 kept = 0, diverged = 0;
+	if (rec)
+	{
+		// Seeds are numbered by the order they are kept, so a seed number
+		// differing from the recorded one means a different decision.
+		Record r;
+		for (execs = 0; rec->next(m, r); ++execs)
+		{
+			diverged += r.seed != seeds.size();
+			kept += replay.run(m, rng, r.kind == AFLRUN_RECORD_IMPORT, r.inc,
+				r.len);
+		}
+	}
+	else
+	{
+		for (u64 i = 0; i < execs; ++i)
+		{
+			execute(cfg, m, rng, walks);
+			kept += replay.run(m, rng);
+		}
+	}
+
+	// FNV-1a of seeds kept by culling and their energy, to compare decisions
+	u64 decisions = 0xcbf29ce484222325ULL;
+	auto mix = [&decisions](u64 v)
+	{
+		decisions = (decisions ^ v) * 0x100000001b3ULL;
+	};
+	vector<u32> ids;
+	vector<double> energy;
+	for (u64 c = 0; c < cycles && !seeds.empty(); ++c)
+	{
+		ids.resize(seeds.size());
+		iota(ids.begin(), ids.end(), 0);
+		for (u8 mode = 1; mode <= 3 && aflrun_is_uni(); ++mode)
+			aflrun_set_favored_seeds(ids.data(), ids.size(), mode);
+		u32 n;
+		{
+			Scope s(kCullQueue);
+			n = aflrun_cull_queue(ids.data(), ids.size());
+		}
+		energy.assign(n, 0);
+		{
+			Scope s(kAssignEnergy);
+			aflrun_assign_energy(n, ids.data(), energy.data());
+		}
+		for (u32 j = 0; j < n; ++j)
+		{
+			mix(ids[j]); mix(llround(energy[j] * 1000));
+			aflrun_update_fuzzed_quant(ids[j], energy[j]);
+		}
+		aflrun_cycle_end(&whole_end);
+	}
+
+	reach_t reached, freached, reached_targets, freached_targets;
+	aflrun_get_reached(&reached, &freached, &reached_targets, &freached_targets);
+	int cycle_count; u32 cov_quant; size_t div_invalid, div_fringes;
+	aflrun_get_state(&cycle_count, &cov_quant, &div_invalid, &div_fringes);
+	printf("Replayed %llu executions: %llu seeds, %u blocks and %u targets "
+		"reached, %zu diversity fringes, %zu clusters\n",
+		(unsigned long long)execs, (unsigned long long)kept, reached,
+		reached_targets, div_fringes, aflrun_get_num_clusters());
+	if (rec)
+	{
+		printf("%llu executions with a recorded seed number different from "
+			"replay\n", (unsigned long long)diverged);
+	}
+	printf("Decisions: %016llx\n\n", (unsigned long long)decisions);
+
+	printf("%-30s %12s %12s %12s\n", "function", "calls", "total ms", "ns/call");
+	for (const Timer& t : timers)
+	{
+		printf("%-30s %12llu %12.1f %12.0f\n", t.name,
+			(unsigned long long)t.calls, t.ns / 1e6,
+			t.calls ? (double)t.ns / t.calls : 0.0);
+	}
+
+	// Generated CFG and logs written by AFLRun to its output directory
+	string cmd = string("rm -rf '") + tmp + "'";
+	if (system(cmd.c_str()))
+		fprintf(stderr, "Unable to remove %s\n", tmp);
+	return 0;
+}
@@ -0,0 +1,42 @@
+/* Input must pass a chain of magic-byte checks; each stage is a target. */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+static volatile int sink;
+
+int main(void) {
+
+  uint8_t buf[128];
+  ssize_t n = read(0, buf, sizeof(buf));
+  if (n < 16) return 0;
+
+  if (memcmp(buf, "RUN!", 4)) return 0;
+
+  uint32_t ver;
+  memcpy(&ver, buf + 4, sizeof(ver));
+  if (ver == 0x20231018) {
+
+    sink = 1;
+
+    uint16_t len;
+    memcpy(&len, buf + 8, sizeof(len));
+    if (len == n - 10) {
+
+      sink = 2;
+      if (buf[10] == 'T' && buf[11] == 'G' && buf[12] == 'T') {
+
+        sink = 3;
+
+      }
+
+    }
+
+  }
+
+  if (buf[15] == 0xff && buf[14] == 0xee) sink = 4;
+
+  return 0;
+
+}
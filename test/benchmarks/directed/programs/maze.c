@@ -0,0 +1,52 @@
+/* Walk a small maze with "wasd" moves; two exits are the targets. */
+
+#include <stdio.h>
+#include <unistd.h>
+
+static const char maze[7][12] = {
+
+    "+-+-------+", "|  |     #|", "| +|+ +-+ |", "|  |      |",
+    "| ++-+ | +|", "|      |  #", "+--------+-"};
+
+static void reach_exit(int id) {
+
+  printf("exit %d\n", id);
+
+}
+
+int main(void) {
+
+  char   buf[64];
+  ssize_t n = read(0, buf, sizeof(buf));
+  int    x = 1, y = 1;
+
+  for (ssize_t i = 0; i < n; ++i) {
+
+    int nx = x, ny = y;
+    switch (buf[i]) {
+
+      case 'w': --ny; break;
+      case 's': ++ny; break;
+      case 'a': --nx; break;
+      case 'd': ++nx; break;
+      default: return 0;
+
+    }
+
+    if (maze[ny][nx] == '#') {
+
+      if (ny == 1) reach_exit(0);
+      else reach_exit(1);
+      return 0;
+
+    }
+
+    if (maze[ny][nx] != ' ') return 0;
+    x = nx;
+    y = ny;
+
+  }
+
+  return 0;
+
+}
@@ -0,0 +1,53 @@
+/* Tiny key=value parser with targets deep in two of its handlers. */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static int depth;
+
+static void handle_num(const char *v) {
+
+  long x = 0;
+  while (*v >= '0' && *v <= '9')
+    x = x * 10 + *v++ - '0';
+  if (x > 100000 && x % 7 == 3) { depth = 1; }
+
+}
+
+static void handle_list(const char *v) {
+
+  int items = 0, nested = 0;
+  for (; *v; ++v) {
+
+    if (*v == '[') ++nested;
+    if (*v == ']') --nested;
+    if (*v == ',') ++items;
+
+  }
+
+  if (nested == 0 && items >= 3) { depth = 2; }
+  if (nested < 0) { depth = 3; }
+
+}
+
+int main(void) {
+
+  char    buf[256];
+  ssize_t n = read(0, buf, sizeof(buf) - 1);
+  if (n <= 0) return 0;
+  buf[n] = 0;
+
+  for (char *line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+
+    char *eq = strchr(line, '=');
+    if (!eq) continue;
+    *eq = 0;
+    if (!strcmp(line, "num")) handle_num(eq + 1);
+    else if (!strcmp(line, "list")) handle_list(eq + 1);
+
+  }
+
+  return depth;
+
+}
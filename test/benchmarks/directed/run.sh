@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+# Time-to-target suite of AFLRun: builds the programs in programs/ with
+# afl-clang-lto and their AFLGo-style `<file>:<line>` targets in
+# programs/<name>.targets, runs a fixed-duration campaign of afl-fuzz for
+# each program and each config in configs.txt, and appends one JSON object
+# per campaign to <out>/results.jsonl, e.g.
+#
+#   {"commit":"eca5b16","program":"maze","config":"default",
+#    "aflrun_config":"init_cov_quant=60","rep":0,"duration_s":600,
+#    "execs":4120511,"execs_per_sec":6867.52,"sched_frac":0.0312,
+#    "targets":2,"reached":1,"execs_per_target":4120511,
+#    "time_to_target_ms":{"0:maze.c:38":81213}}
+#
+# where `time_to_target_ms` comes from reached_targets.txt of the campaign,
+# `execs_per_target` is `execs` divided by the reached targets (0 if none)
+# and `sched_frac` is the fraction of run time spent in the AFLRun
+# scheduler (prof_new_path_ms + prof_energy_ms + prof_cull_ms). Results of
+# different commits go to the same file and can be compared with e.g.
+#
+#   jq -s 'group_by(.program, .config)[] | map({commit, execs_per_sec,
+#          reached, time_to_target_ms})' results.jsonl
+#
+
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+AFL_PATH=${AFL_PATH:-$(cd "$DIR/../../.." && pwd)}
+
+DURATION=600
+REPS=1
+OUT=$PWD/directed-results
+CONFIGS=$DIR/configs.txt
+PROGRAMS="maze magic parse"
+
+usage() {
+
+  echo "Usage: $0 [-t seconds] [-r reps] [-o out_dir] [-c configs] [-p \"programs\"]"
+  exit 1
+
+}
+
+while getopts "t:r:o:c:p:h" opt; do
+  case $opt in
+    t) DURATION=$OPTARG ;;
+    r) REPS=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    c) CONFIGS=$OPTARG ;;
+    p) PROGRAMS=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+
+test -x "$AFL_PATH/afl-clang-lto" -a -x "$AFL_PATH/afl-fuzz" || {
+  echo "[-] Error: afl-clang-lto and afl-fuzz must be built in $AFL_PATH"
+  exit 1
+}
+
+COMMIT=$(git -C "$AFL_PATH" rev-parse --short HEAD 2>/dev/null || echo unknown)
+mkdir -p "$OUT"
+OUT=$(cd "$OUT" && pwd)
+
+# Print value of `key` in fuzzer_stats, or 0 if it is missing.
+stat_of() {
+
+  awk -v k="$1" '$1 == k { print $3; f = 1 } END { if (!f) print 0 }' "$2"
+
+}
+
+for prog in $PROGRAMS; do
+
+  build=$OUT/build/$prog
+  rm -rf "$build"
+  mkdir -p "$build/tmp" "$build/in"
+  echo "[*] Building $prog"
+  (
+    cd "$build"
+    AFLRUN_BB_TARGETS="$DIR/programs/$prog.targets" AFLRUN_TARGETS="$prog" \
+      AFLRUN_TMP="$build/tmp" AFL_QUIET=1 \
+      "$AFL_PATH/afl-clang-lto" -g -O1 "$DIR/programs/$prog.c" -o "$prog"
+  ) > "$build/build.log" 2>&1 || {
+    echo "[-] Error: building $prog failed, see $build/build.log"
+    exit 1
+  }
+  echo seed > "$build/in/seed"
+  num_targets=$(grep -c . "$DIR/programs/$prog.targets")
+
+  grep -v '^#' "$CONFIGS" | while read -r name config; do
+
+    test -n "$name" || continue
+    for ((rep = 0; rep < REPS; ++rep)); do
+
+      run=$OUT/runs/$COMMIT/$prog/$name/$rep
+      rm -rf "$run"
+      mkdir -p "$run"
+      echo "[*] $prog / $name / $rep: fuzzing for $DURATION seconds"
+      AFL_NO_UI=1 AFL_SKIP_CPUFREQ=1 AFL_I_DONT_CARE_ABOUT_MISSING_CRASHES=1 \
+        AFLRUN_PROFILE=1 timeout -k 10 -s INT $((DURATION + 60)) \
+        "$AFL_PATH/afl-fuzz" -i "$build/in" -o "$run/out" -V "$DURATION" \
+        ${config:+--config "$config"} -- "$build/$prog" \
+        < /dev/null > "$run/log.txt" 2>&1 || true
+
+      stats=$run/out/default/fuzzer_stats
+      reached=$run/out/default/reached_targets.txt
+      test -f "$stats" || {
+        echo "[-] Error: no fuzzer_stats, see $run/log.txt"
+        continue
+      }
+      touch "$reached"
+
+      num_reached=$(grep -c . "$reached" || true)
+      run_ms=$(($(stat_of run_time "$stats") * 1000))
+      sched_ms=$(($(stat_of prof_new_path_ms "$stats") + \
+        $(stat_of prof_energy_ms "$stats") + $(stat_of prof_cull_ms "$stats")))
+
+      {
+        printf '{"commit":"%s","program":"%s","config":"%s",' \
+          "$COMMIT" "$prog" "$name"
+        printf '"aflrun_config":"%s","rep":%d,"duration_s":%d,' \
+          "$config" "$rep" "$DURATION"
+        printf '"execs":%s,"execs_per_sec":%s,"sched_frac":%s,' \
+          "$(stat_of execs_done "$stats")" "$(stat_of execs_per_sec "$stats")" \
+          "$(awk -v s="$sched_ms" -v r="$run_ms" \
+            'BEGIN { printf "%.4f", r ? s / r : 0 }')"
+        printf '"targets":%d,"reached":%d,"execs_per_target":%d,' \
+          "$num_targets" "$num_reached" \
+          "$((num_reached ? $(stat_of execs_done "$stats") / num_reached : 0))"
+        printf '"time_to_target_ms":{%s}}\n' \
+          "$(awk '{ printf "%s\"%s\":%s", (NR > 1 ? "," : ""), $3, $1 }' \
+            "$reached")"
+      } >> "$OUT/results.jsonl"
+
+    done
+
+  done
+
+done
+
+echo "[+] Results are in $OUT/results.jsonl"
@@ -0,0 +1,52 @@
+/* Helpers of the runtime overhead programs: the number of iterations, taken
+   from RUNTIME_BENCH_ITERS if set, the input steering their branches, and
+   the report of the work they timed. */
+
+#ifndef _RUNTIME_BENCH_H
+#define _RUNTIME_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned long long bench_iters(unsigned long long def) {
+
+  const char *s = getenv("RUNTIME_BENCH_ITERS");
+  return s ? strtoull(s, NULL, 10) : def;
+
+}
+
+static unsigned long long bench_ns(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+}
+
+/* Branches depend on input bytes, so the compiler cannot fold them. */
+static size_t bench_input(unsigned char *buf, size_t size) {
+
+  ssize_t n = read(0, buf, size);
+  if (n <= 0) {
+
+    buf[0] = 0;
+    n = 1;
+
+  }
+
+  return n;
+
+}
+
+/* Blocks are those the program counts as taken; the compiler may still
+   merge some of them, so ns per block is an estimate. */
+static void bench_report(unsigned long long blocks, unsigned long long ns) {
+
+  fprintf(stderr, "blocks %llu ns %llu\n", blocks, ns);
+
+}
+
+#endif
+
@@ -0,0 +1,66 @@
+/* Deep call chains in reachable code: each iteration goes DEPTH calls deep
+   through three functions calling each other, so the call context of the
+   context-sensitive build changes on every call and return. */
+
+#include "bench.h"
+
+#define DEPTH 32
+
+static volatile unsigned sink;
+
+static void target(unsigned x) {
+
+  sink = x;
+
+}
+
+static unsigned f1(unsigned d, unsigned x);
+static unsigned f2(unsigned d, unsigned x);
+
+/* Not tail calls, so each level keeps its frame and context. */
+__attribute__((noinline)) static unsigned f0(unsigned d, unsigned x) {
+
+  if (d == 0) {
+
+    if (x == 0xdeadbeef) target(x);
+    return x;
+
+  }
+
+  return f1(d - 1, x * 3 + 1) + 1;
+
+}
+
+__attribute__((noinline)) static unsigned f1(unsigned d, unsigned x) {
+
+  if (d == 0) return x;
+  return f2(d - 1, x ^ (x >> 3)) + 2;
+
+}
+
+__attribute__((noinline)) static unsigned f2(unsigned d, unsigned x) {
+
+  if (d == 0) return x;
+  return f0(d - 1, x + 7) + 3;
+
+}
+
+int main(void) {
+
+  unsigned char      buf[64];
+  size_t             len = bench_input(buf, sizeof(buf));
+  unsigned long long iters = bench_iters(1000000), blocks = 0;
+  unsigned long long start = bench_ns();
+
+  for (unsigned long long i = 0; i < iters; ++i) {
+
+    sink = f0(DEPTH, buf[i % len] + (unsigned)i);
+    blocks += 2 * (DEPTH + 1) + 1;  /* entry and exit of each level, latch */
+
+  }
+
+  bench_report(blocks, bench_ns() - start);
+  return 0;
+
+}
+
@@ -0,0 +1,37 @@
+/* Tight loops in reachable code: each iteration takes four branches, whose
+   arms store to volatile sinks so they stay blocks of their own. */
+
+#include "bench.h"
+
+static volatile unsigned long long sink0, sink1;
+
+static void target(unsigned long long i) {
+
+  sink0 = i;
+
+}
+
+int main(void) {
+
+  unsigned char      buf[64];
+  size_t             len = bench_input(buf, sizeof(buf));
+  unsigned long long iters = bench_iters(20000000), blocks = 0;
+  unsigned long long start = bench_ns();
+
+  for (unsigned long long i = 0; i < iters; ++i) {
+
+    unsigned s = buf[i % len] ^ (unsigned)i;
+    if (s & 1) sink0 = i; else sink1 = i;
+    if (s & 2) sink0 = s; else sink1 = s;
+    if (s & 4) sink1 = i; else sink0 = i;
+    if (s & 8) sink1 = s; else sink0 = s;
+    if (s == 0xdeadbeef) target(i);
+    blocks += 9;                 /* four arms, four joins and the latch */
+
+  }
+
+  bench_report(blocks, bench_ns() - start);
+  return 0;
+
+}
+
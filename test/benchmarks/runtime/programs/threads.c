@@ -0,0 +1,56 @@
+/* The loops of loops.c in NTHREADS threads at once, which share the AFLRun
+   maps; the variant without atomics is only measured here, as it may lose
+   updates of concurrent threads. */
+
+#include <pthread.h>
+#include "bench.h"
+
+#define NTHREADS 4
+
+static volatile unsigned long long sink0, sink1;
+static unsigned char               buf[64];
+static size_t                      len;
+static unsigned long long          iters;
+
+static void target(unsigned long long i) {
+
+  sink0 = i;
+
+}
+
+static void *worker(void *arg) {
+
+  unsigned long long first = (unsigned long long)(size_t)arg;
+
+  for (unsigned long long i = first; i < iters; i += NTHREADS) {
+
+    unsigned s = buf[i % len] ^ (unsigned)i;
+    if (s & 1) sink0 = i; else sink1 = i;
+    if (s & 2) sink0 = s; else sink1 = s;
+    if (s & 4) sink1 = i; else sink0 = i;
+    if (s & 8) sink1 = s; else sink0 = s;
+    if (s == 0xdeadbeef) target(i);
+
+  }
+
+  return NULL;
+
+}
+
+int main(void) {
+
+  pthread_t t[NTHREADS];
+  len = bench_input(buf, sizeof(buf));
+  iters = bench_iters(20000000);
+  unsigned long long start = bench_ns();
+
+  for (size_t i = 0; i < NTHREADS; ++i)
+    pthread_create(&t[i], NULL, worker, (void *)i);
+  for (size_t i = 0; i < NTHREADS; ++i)
+    pthread_join(t[i], NULL);
+
+  bench_report(iters * 9, bench_ns() - start);
+  return 0;
+
+}
+
@@ -0,0 +1,127 @@
+#!/bin/bash
+#
+# Runtime overhead suite of AFLRun: builds the programs in programs/ with
+# each instrumentation variant of variants.txt, their targets being in
+# programs/<name>.targets, and measures for each build
+#
+#  - the time of the work each program times itself, over `-r` runs outside
+#    afl-fuzz, from which ns per block taken is derived, and
+#  - executions per second through the fork server of afl-showmap, over
+#    `-n` copies of one input with RUNTIME_BENCH_ITERS set to `-i`.
+#
+# One JSON object per program and variant is appended to
+# <out>/results.jsonl, e.g.
+#
+#   {"commit":"eca5b16","program":"loops","variant":"fused",
+#    "blocks":180000000,"ns":412003911,"ns_per_block":2.289,
+#    "delta_ns_per_block":0.512,"execs_per_sec":2310.40,
+#    "execs_delta":-0.0842}
+#
+# where the deltas are against the first variant of variants.txt, plain
+# PCGUARD by default, as a difference of ns per block and as a fraction of
+# its executions per second. afl-showmap runs the AFLRun builds with the
+# private maps of their runtime, like a fuzzer that logs no virgin paths,
+# which is the common case of a campaign once most blocks are reached.
+#
+
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+AFL_PATH=${AFL_PATH:-$(cd "$DIR/../../.." && pwd)}
+
+RUNS=5
+EXECS=2000
+EXEC_ITERS=10000
+OUT=$PWD/runtime-results
+VARIANTS=$DIR/variants.txt
+PROGRAMS="loops calls threads"
+
+usage() {
+
+  echo "Usage: $0 [-r runs] [-n execs] [-i iters] [-o out_dir] [-v variants] [-p \"programs\"]"
+  exit 1
+
+}
+
+while getopts "r:n:i:o:v:p:h" opt; do
+  case $opt in
+    r) RUNS=$OPTARG ;;
+    n) EXECS=$OPTARG ;;
+    i) EXEC_ITERS=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    v) VARIANTS=$OPTARG ;;
+    p) PROGRAMS=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+
+test -x "$AFL_PATH/afl-clang-lto" -a -x "$AFL_PATH/afl-clang-fast" -a \
+  -x "$AFL_PATH/afl-showmap" || {
+  echo "[-] Error: afl-clang-lto, afl-clang-fast and afl-showmap must be built in $AFL_PATH"
+  exit 1
+}
+
+COMMIT=$(git -C "$AFL_PATH" rev-parse --short HEAD 2>/dev/null || echo unknown)
+mkdir -p "$OUT"
+OUT=$(cd "$OUT" && pwd)
+
+# Inputs of afl-showmap, all the same so each execution does the same work
+mkdir -p "$OUT/execs"
+for ((i = 0; i < EXECS; ++i)); do
+  echo seed > "$OUT/execs/$i"
+done
+
+for prog in $PROGRAMS; do
+
+  base_npb=
+  base_eps=
+  grep -v '^#' "$VARIANTS" | while read -r name cc vars; do
+
+    test -n "$name" || continue
+    build=$OUT/build/$prog/$name
+    rm -rf "$build"
+    mkdir -p "$build/tmp"
+    echo "[*] Building $prog / $name"
+    (
+      cd "$build"
+      env $vars AFLRUN_BB_TARGETS="$DIR/programs/$prog.targets" \
+        AFLRUN_TARGETS="$prog" AFLRUN_TMP="$build/tmp" AFL_QUIET=1 \
+        "$AFL_PATH/$cc" -g -O1 -pthread "$DIR/programs/$prog.c" -o "$prog"
+    ) > "$build/build.log" 2>&1 || {
+      echo "[-] Error: building $prog / $name failed, see $build/build.log"
+      exit 1
+    }
+
+    # Sum of blocks and ns reported by the runs
+    read -r blocks ns < <(
+      for ((r = 0; r < RUNS; ++r)); do
+        "$build/$prog" < /dev/null 2>&1 >/dev/null
+      done | awk '$1 == "blocks" { b += $2; n += $4 } END { print b, n }')
+    npb=$(awk -v b="$blocks" -v n="$ns" 'BEGIN { printf "%.3f", b ? n / b : 0 }')
+
+    start=$(date +%s%N)
+    RUNTIME_BENCH_ITERS=$EXEC_ITERS AFL_QUIET=1 "$AFL_PATH/afl-showmap" -q \
+      -i "$OUT/execs" -o "$build/maps" -- "$build/$prog" \
+      > "$build/showmap.log" 2>&1 || true
+    end=$(date +%s%N)
+    eps=$(awk -v e="$EXECS" -v t=$((end - start)) \
+      'BEGIN { printf "%.2f", t ? e * 1e9 / t : 0 }')
+
+    test -n "$base_npb" || { base_npb=$npb; base_eps=$eps; }
+
+    printf '{"commit":"%s","program":"%s","variant":"%s",' \
+      "$COMMIT" "$prog" "$name" >> "$OUT/results.jsonl"
+    printf '"blocks":%s,"ns":%s,"ns_per_block":%s,"delta_ns_per_block":%s,' \
+      "$blocks" "$ns" "$npb" \
+      "$(awk -v a="$npb" -v b="$base_npb" 'BEGIN { printf "%.3f", a - b }')" \
+      >> "$OUT/results.jsonl"
+    printf '"execs_per_sec":%s,"execs_delta":%s}\n' "$eps" \
+      "$(awk -v a="$eps" -v b="$base_eps" \
+        'BEGIN { printf "%.4f", b ? a / b - 1 : 0 }')" >> "$OUT/results.jsonl"
+    echo "[+] $prog / $name: $npb ns/block, $eps execs/s"
+
+  done
+
+done
+
+echo "[+] Results are in $OUT/results.jsonl"
@@ -20,6 +20,8 @@
 #include "config.h"
 #include "types.h"
 #include "debug.h"
+#include "trace.h"
+#include "afl-network-proxy.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +34,7 @@
 
 #include <netinet/in.h>
 #include <netinet/ip6.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/mman.h>
 #ifndef USEMMAP
@@ -55,6 +58,19 @@ u32 __afl_map_size = MAP_SIZE;
 __thread u32 __afl_map_size = MAP_SIZE;
 #endif
 
+/* AFLRun afl-fuzz only accepts binaries built by its compiler, which embed
+   this signature followed by their temporary directory. We have none, so
+   the temporary directory of the remote target must be given with --dir. */
+
+__attribute__((used)) static const char __aflrun_temp_sig[] = AFLRUN_TEMP_SIG;
+
+/* AFLRun maps of afl-fuzz, if both afl-fuzz and the server use AFLRun. */
+
+static reach_t  num_reachables, num_freachables;
+static u8      *__afl_rbb_ptr, *__afl_rf_ptr, *__afl_tr_ptr, *__afl_vir_ptr,
+               *__afl_div_ptr;
+static trace_t *__afl_vtr_ptr, *__afl_tt_ptr, *__afl_db_ptr;
+
 /* Error reporting to forkserver controller */
 
 void send_forkserver_error(int error) {
@@ -161,6 +177,175 @@ static void __afl_map_shm(void) {
 
 }
 
+/* Attach to AFLRun maps of afl-fuzz, return 0 if afl-fuzz does not use them. */
+
+static u8 __aflrun_map_shm(void) {
+
+  char *id_str = getenv(SHM_AFLRUN_ENV_VAR);
+  u8   *base;
+
+  if (!id_str) return 0;
+
+#ifdef USEMMAP
+  int         fd = shm_open(id_str, O_RDWR, 0600);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st)) {
+
+    send_forkserver_error(FS_ERROR_SHM_OPEN);
+    PFATAL("shm_open for aflrun maps");
+
+  }
+
+  base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) base = (void *)-1;
+#else
+  base = shmat(atoi(id_str), NULL, 0);
+#endif
+
+  if (base == (void *)-1) {
+
+    send_forkserver_error(FS_ERROR_SHMAT);
+    PFATAL("shmat for aflrun maps");
+
+  }
+
+  aflrun_shm_hdr_t *hdr = (aflrun_shm_hdr_t *)base;
+  if (hdr->off_rf - hdr->off_rbb < MAP_RBB_SIZE(num_reachables) ||
+      hdr->off_db >= hdr->size ||
+      hdr->size - hdr->off_db < MAP_DB_SIZE(num_reachables))
+    FATAL("AFLRun maps of afl-fuzz do not match the server");
+
+  __afl_rbb_ptr = base + hdr->off_rbb;
+  __afl_rf_ptr = base + hdr->off_rf;
+  __afl_tr_ptr = base + hdr->off_tr;
+  __afl_vir_ptr = base + hdr->off_vir;
+  __afl_vtr_ptr = (trace_t *)(base + hdr->off_vtr);
+  __afl_tt_ptr = (trace_t *)(base + hdr->off_tt);
+  __afl_div_ptr = base + hdr->off_div;
+  __afl_db_ptr = (trace_t *)(base + hdr->off_db);
+
+  // __aflrun_reach logs each block it reaches first, so claim the log
+  __afl_db_ptr->num = 0;
+  return 1;
+
+}
+
+static inline void __aflrun_append(trace_t *t, size_t cap, reach_t block,
+                                   u32 ctx) {
+
+  size_t n = t->num++;
+  if (n < cap) {
+
+    t->trace[n].block = block;
+    t->trace[n].call_ctx = ctx;
+
+  }
+
+}
+
+/* Update AFLRun maps the way the runtime does when `block` is reached in
+   context `ctx`. */
+
+static void __aflrun_reach(reach_t block, u32 ctx, u8 testing) {
+
+  size_t off = CTX_NUM_BYTES * (size_t)block + ctx / 8;
+  u8     bit = 1 << (ctx % 8), bit2 = 1 << (block % 8);
+
+  if (!(__afl_rbb_ptr[block / 8] & bit2)) {
+
+    __afl_rbb_ptr[block / 8] |= bit2;
+    __aflrun_append(__afl_db_ptr, num_reachables, block, 0);
+    if (IS_SET(__afl_div_ptr, block))
+      __aflrun_append(__afl_tt_ptr, MAP_VTR_CAP(num_reachables), block, 0);
+
+  }
+
+  __afl_tr_ptr[off] |= bit;
+
+  // The runtime only updates virgin bits of afl-fuzz when it is testing
+  if (testing && (__afl_vir_ptr[off] & bit)) {
+
+    if (__afl_vtr_ptr->num < MAP_VTR_CAP(num_reachables))
+      __afl_vir_ptr[off] &= ~bit;
+    __aflrun_append(__afl_vtr_ptr, MAP_VTR_CAP(num_reachables), block, ctx);
+
+  }
+
+}
+
+/* Receive exactly `len` bytes, return 0 on success. */
+
+static int recv_all(int s, void *buf, u32 len) {
+
+  u32 received = 0;
+  s32 ret;
+
+  while (received < len &&
+         (ret = recv(s, (u8 *)buf + received, len - received, 0)) > 0)
+    received += ret;
+
+  return received != len;
+
+}
+
+/* Write sparse result (see afl-network-proxy.h) into the maps of afl-fuzz,
+   which cleared them before running us. */
+
+static void apply_sparse(u8 *p, u32 len, u8 use_aflrun) {
+
+  u8 *end = p + len;
+  u32 n;
+
+#define TAKE(dst, size)                                      \
+  do {                                                       \
+                                                             \
+    if ((u32)(end - p) < (size)) FATAL("malformed result");  \
+    memcpy((dst), p, (size));                                \
+    p += (size);                                             \
+                                                             \
+  } while (0)
+
+  TAKE(&n, 4);
+  if ((u32)(end - p) / 5 < n) FATAL("malformed result");
+  u8 *vals = p + (size_t)n * 4;
+  for (u32 i = 0; i < n; i++) {
+
+    u32 idx;
+    memcpy(&idx, p + i * 4, 4);
+    if (idx < __afl_map_size) __afl_area_ptr[idx] = vals[i];
+
+  }
+
+  p = vals + n;
+  if (!num_reachables) return;
+
+  u8 testing = IS_SET(__afl_rbb_ptr, num_reachables);
+
+  TAKE(&n, 4);
+  for (u32 i = 0; i < n; i++) {
+
+    u64 idx;
+    TAKE(&idx, 8);
+    if (use_aflrun && idx / CTX_SIZE < num_reachables)
+      __aflrun_reach(idx / CTX_SIZE, idx % CTX_SIZE, testing);
+
+  }
+
+  TAKE(&n, 4);
+  for (u32 i = 0; i < n; i++) {
+
+    u32 f;
+    TAKE(&f, 4);
+    if (use_aflrun && f < num_freachables)
+      __afl_rf_ptr[f / 8] |= 1 << (f % 8);
+
+  }
+
+#undef TAKE
+
+}
+
 /* Fork server logic. */
 
 static void __afl_start_forkserver(void) {
@@ -212,11 +397,12 @@ int main(int argc, char *argv[]) {
   u8             *interface, *buf, *ptr;
   s32             s = -1;
   struct addrinfo hints, *hres, *aip;
-  u32            *lenptr, max_len = 65536;
+  u32            *lenptr, max_len = 65536, res_len, res_max = 0;
+  u8             *res = NULL, use_aflrun = 0;
+  net_hello_t     hello;
 #ifdef USE_DEFLATE
-  u8    *buf2;
-  u32   *lenptr1, *lenptr2, buf2_len, compress_len;
-  size_t decompress_len;
+  u8  *buf2;
+  u32 *lenptr1, *lenptr2, buf2_len;
 #endif
 
   if (argc < 3 || argc > 4) {
@@ -302,8 +488,6 @@ int main(int argc, char *argv[]) {
 #ifdef USE_DEFLATE
   struct libdeflate_compressor *compressor;
   compressor = libdeflate_alloc_compressor(1);
-  struct libdeflate_decompressor *decompressor;
-  decompressor = libdeflate_alloc_decompressor();
   fprintf(stderr, "Compiled with compression support\n");
 #endif
 
@@ -312,11 +496,38 @@ int main(int argc, char *argv[]) {
   else
     fprintf(stderr, "Connected to target tcp://%s:%s\n", argv[1], argv[2]);
 
+  /* every testcase is a single send(), do not wait for the ACK of the last */
+  int one = 1;
+  if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+    WARNF("could not set TCP_NODELAY on socket");
+
+  /* ask for sparse results, and learn if AFLRun maps come with them */
+  hello.hello = NET_HELLO;
+  if (send(s, &hello.hello, 4, 0) != 4) PFATAL("sending hello failed");
+  if (recv_all(s, &hello, sizeof(hello)) || hello.hello != NET_HELLO)
+    FATAL("server does not speak protocol version %u", NET_VERSION);
+  if (hello.map_size > __afl_map_size)
+    WARNF("server map size %u is larger than %u, set AFL_MAP_SIZE",
+          hello.map_size, __afl_map_size);
+  num_reachables = hello.num_reachables;
+  num_freachables = hello.num_freachables;
+
   /* we initialize the shared memory map and start the forkserver */
   __afl_map_shm();
+  if (num_reachables) {
+
+    if (!(use_aflrun = __aflrun_map_shm()))
+      fprintf(stderr, "afl-fuzz does not use AFLRun maps, ignoring them\n");
+
+  } else if (getenv(SHM_AFLRUN_ENV_VAR)) {
+
+    WARNF("server does not send AFLRun maps, run it with -d");
+
+  }
+
   __afl_start_forkserver();
 
-  int i = 1, j, status, ret, received;
+  int status;
 
   // fprintf(stderr, "Waiting for first testcase\n");
   while ((*lenptr = __afl_next_testcase(buf + 4, max_len)) > 0) {
@@ -356,46 +567,20 @@ int main(int argc, char *argv[]) {
   #endif
 #endif
 
-    received = 0;
-    while (received < 4 &&
-           (ret = recv(s, &status + received, 4 - received, 0)) > 0)
-      received += ret;
-    if (received != 4)
-      FATAL("did not receive waitpid data (%d, %d)", received, ret);
+    if (recv_all(s, &status, 4) || recv_all(s, &res_len, 4))
+      FATAL("did not receive waitpid data");
     // fprintf(stderr, "Received status\n");
 
-    received = 0;
-#ifdef USE_DEFLATE
-    while (received < 4 &&
-           (ret = recv(s, &compress_len + received, 4 - received, 0)) > 0)
-      received += ret;
-    if (received != 4)
-      FATAL("did not receive compress_len (%d, %d)", received, ret);
-    // fprintf(stderr, "Received status\n");
+    if (res_len > res_max) {
 
-    received = 0;
-    while (received < compress_len &&
-           (ret = recv(s, buf2 + received, buf2_len - received, 0)) > 0)
-      received += ret;
-    if (received != compress_len)
-      FATAL("did not receive coverage data (%d, %d)", received, ret);
-
-    if (libdeflate_deflate_decompress(decompressor, buf2, compress_len,
-                                      __afl_area_ptr, __afl_map_size,
-                                      &decompress_len) != LIBDEFLATE_SUCCESS ||
-        decompress_len != __afl_map_size)
-      FATAL("decompression failed");
-      // fprintf(stderr, "DECOMPRESS (%u->%u): ", compress_len, decompress_len);
-      // for (u32 i = 0; i < __afl_map_size; i++) fprintf(stderr, "%02x",
-      // __afl_area_ptr[i]); fprintf(stderr, "\n");
-#else
-    while (received < __afl_map_size &&
-           (ret = recv(s, __afl_area_ptr + received, __afl_map_size - received,
-                       0)) > 0)
-      received += ret;
-    if (received != __afl_map_size)
-      FATAL("did not receive coverage data (%d, %d)", received, ret);
-#endif
+      if ((res = realloc(res, res_len)) == NULL)
+        PFATAL("can not allocate %u memory", res_len);
+      res_max = res_len;
+
+    }
+
+    if (recv_all(s, res, res_len)) FATAL("did not receive coverage data");
+    apply_sparse(res, res_len, use_aflrun);
     // fprintf(stderr, "Received coverage\n");
 
     /* report the test case is done and wait for the next */
@@ -406,9 +591,9 @@ int main(int argc, char *argv[]) {
 
 #ifdef USE_DEFLATE
   libdeflate_free_compressor(compressor);
-  libdeflate_free_decompressor(decompressor);
   free(buf2);
 #endif
+  free(res);
   free(buf);
 
   return 0;
@@ -0,0 +1,57 @@
+/*
+   american fuzzy lop++ - network proxy protocol
+   ---------------------------------------------
+
+   Copyright 2019-2023 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Protocol between afl-network-client and afl-network-server, all values
+   are in host byte order of the two (identical) machines:
+
+   Testcases are sent by the client as u32 length + data, where a length
+   with the highest byte 0xff means the data is deflated and is followed by
+   u32 compressed length + compressed data.
+
+   A client that speaks the sparse protocol sends NET_HELLO first and the
+   server answers with net_hello_t. Results are then sent as u32 status,
+   u32 payload length and the payload:
+
+     u32 n_edges, u32 index[n_edges], u8 value[n_edges]
+     if num_reachables: u32 n_ctx, u64 ctx[n_ctx]   (i.e. CTX_IDX(block, ctx))
+                        u32 n_funcs, u32 func[n_funcs]
+
+   i.e. only non-zero bytes of the coverage map and bits set in the AFLRun
+   context-sensitive and function maps. The client rebuilds the AFLRun maps
+   of afl-fuzz from them the way the instrumentation runtime would.
+
+   Without NET_HELLO the server answers with u32 status + whole coverage map
+   (or u32 status + u32 compressed length + deflated map with libdeflate),
+   as older clients expect.
+
+*/
+
+#ifndef _HAVE_AFL_NETWORK_PROXY_H
+#define _HAVE_AFL_NETWORK_PROXY_H
+
+#include "types.h"
+
+#define NET_VERSION 1
+#define NET_HELLO_MAGIC 0xfe000000
+#define NET_HELLO (NET_HELLO_MAGIC | NET_VERSION)
+
+typedef struct net_hello {
+
+  u32 hello;                           /* NET_HELLO of the server           */
+  u32 map_size;
+  u32 num_reachables;                  /* 0 if no AFLRun maps are sent      */
+  u32 num_freachables;
+
+} net_hello_t;
+
+#endif                                       /* !_HAVE_AFL_NETWORK_PROXY_H */
+
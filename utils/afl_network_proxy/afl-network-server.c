@@ -32,6 +32,7 @@
 #include "forkserver.h"
 #include "sharedmem.h"
 #include "common.h"
+#include "afl-network-proxy.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -50,6 +51,7 @@
 #include <sys/resource.h>
 #include <netinet/in.h>
 #include <netinet/ip6.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/mman.h>
 #ifndef USEMMAP
@@ -76,6 +78,9 @@ static u32 map_size = MAP_SIZE;
 
 static volatile u8 stop_soon;          /* Ctrl-C pressed?                   */
 
+static aflrun_shm_t shm_run;           /* AFLRun maps, if -d is given       */
+static u8          *sparse_buf;        /* Sparse result to send             */
+
 /* See if any bytes are set in the bitmap. */
 
 static inline u8 anything_set(afl_forkserver_t *fsrv) {
@@ -93,6 +98,96 @@ static inline u8 anything_set(afl_forkserver_t *fsrv) {
 
 }
 
+/* Append `len` bytes to sparse_buf at `*off`. */
+
+static inline void sparse_put(u32 *off, void *data, u32 len) {
+
+  sparse_buf = afl_realloc((void **)&sparse_buf, *off + len);
+  if (unlikely(!sparse_buf)) { PFATAL("Alloc"); }
+  memcpy(sparse_buf + *off, data, len);
+  *off += len;
+
+}
+
+/* Encode result of last run into sparse_buf as u32 status, u32 payload
+   length and payload (see afl-network-proxy.h), return the total length. */
+
+static u32 encode_sparse(afl_forkserver_t *fsrv) {
+
+  u32 off = 12, n = 0, i;
+  u8 *bits = fsrv->trace_bits;
+
+  /* Indexes of non-zero bytes first, then their values. */
+
+  for (i = 0; i < fsrv->map_size; i += 8) {
+
+    if (likely(!*(u64 *)(bits + i))) { continue; }
+    for (u32 j = i; j < i + 8; j++)
+      if (bits[j]) {
+
+        sparse_put(&off, &j, 4);
+        ++n;
+
+      }
+
+  }
+
+  for (i = 0; i < n; i++)
+    sparse_put(&off, bits + *(u32 *)(sparse_buf + 12 + i * 4), 1);
+  memcpy(sparse_buf + 8, &n, 4);
+
+  if (fsrv->num_reachables) {
+
+    /* Only blocks logged as dirty can have context bits set, unless the
+       runtime does not maintain the log. */
+
+    trace_t *dirty = fsrv->trace_dirty;
+    u8       use_dirty = dirty->num <= fsrv->num_reachables;
+    u32      n_off = off, cnt = use_dirty ? dirty->num : fsrv->num_reachables;
+
+    n = 0;
+    sparse_put(&off, &n, 4);
+    for (i = 0; i < cnt; i++) {
+
+      reach_t b = use_dirty ? dirty->trace[i].block : i;
+      u8     *tr = fsrv->trace_ctx + (size_t)b * CTX_NUM_BYTES;
+      if (!use_dirty && !IS_SET(fsrv->trace_reachables, b)) { continue; }
+
+      for (u32 c = 0; c < CTX_SIZE; c++)
+        if (IS_SET(tr, c)) {
+
+          u64 idx = CTX_IDX(b, c);
+          sparse_put(&off, &idx, 8);
+          ++n;
+
+        }
+
+    }
+
+    memcpy(sparse_buf + n_off, &n, 4);
+
+    n_off = off;
+    n = 0;
+    sparse_put(&off, &n, 4);
+    for (i = 0; i < fsrv->num_freachables; i++)
+      if (IS_SET(fsrv->trace_freachables, i)) {
+
+        sparse_put(&off, &i, 4);
+        ++n;
+
+      }
+
+    memcpy(sparse_buf + n_off, &n, 4);
+
+  }
+
+  memcpy(sparse_buf, &fsrv->child_status, 4);
+  n = off - 8;
+  memcpy(sparse_buf + 4, &n, 4);
+  return off;
+
+}
+
 static void at_exit_handler(void) {
 
   afl_fsrv_killall();
@@ -283,6 +378,11 @@ static void usage(u8 *argv0) {
 
       "  -i port       - the port to listen for the client to connect to\n\n"
 
+      "AFLRun settings:\n"
+
+      "  -d dir        - AFLRun temporary directory of the target, to send\n"
+      "                  AFLRun coverage to clients\n\n"
+
       "Execution control settings:\n"
 
       "  -f file       - input file read by the tested program (stdin)\n"
@@ -382,7 +482,8 @@ int recv_testcase(int s, void **buf) {
 int main(int argc, char **argv_orig, char **envp) {
 
   s32    opt, s, sock, on = 1, port = -1;
-  u8     mem_limit_given = 0, timeout_given = 0, unicorn_mode = 0, use_wine = 0;
+  u8     mem_limit_given = 0, timeout_given = 0, unicorn_mode = 0, use_wine = 0,
+     sparse = 0;
   char **use_argv;
   struct sockaddr_in6 serveraddr, clientaddr;
   int                 addrlen = sizeof(clientaddr);
@@ -401,7 +502,7 @@ int main(int argc, char **argv_orig, char **envp) {
 
   if ((send_buf = malloc(map_size + 4)) == NULL) PFATAL("malloc");
 
-  while ((opt = getopt(argc, argv, "+i:f:m:t:QUWh")) > 0) {
+  while ((opt = getopt(argc, argv, "+i:f:m:t:d:QUWh")) > 0) {
 
     switch (opt) {
 
@@ -413,6 +514,15 @@ int main(int argc, char **argv_orig, char **envp) {
           FATAL("invalid port definition, must be between 1-65535: %s", optarg);
         break;
 
+      case 'd':
+
+        if (fsrv->num_reachables) { FATAL("Multiple -d options not supported"); }
+        load_aflrun_header(alloc_printf("%s/BBreachable.txt", optarg),
+                           &fsrv->num_targets, &fsrv->num_reachables);
+        load_aflrun_header(alloc_printf("%s/Freachable.txt", optarg),
+                           &fsrv->num_ftargets, &fsrv->num_freachables);
+        break;
+
       case 'f':
 
         if (out_file) { FATAL("Multiple -f options not supported"); }
@@ -536,6 +646,16 @@ int main(int argc, char **argv_orig, char **envp) {
   sharedmem_t shm = {0};
   fsrv->trace_bits = afl_shm_init(&shm, map_size, 0);
 
+  if (fsrv->num_reachables) {
+
+    aflrun_shm_init(&shm_run, fsrv->num_reachables, fsrv->num_freachables, 0);
+
+    // Diversity of targets is tracked by the client with the switch of
+    // afl-fuzz, so here it only decides what the runtime returns for laf
+    afl_fsrv_attach_aflrun(fsrv, &shm_run, 1);
+
+  }
+
   in_data = afl_realloc((void **)&in_data, 65536);
   if (unlikely(!in_data)) { PFATAL("Alloc"); }
 
@@ -626,6 +746,45 @@ int main(int argc, char **argv_orig, char **envp) {
   if ((s = accept(sock, NULL, NULL)) < 0) { PFATAL("accept() failed"); }
   fprintf(stderr, "Received connection, starting ...\n");
 
+  /* Each result is written with a single send(), so do not let Nagle's
+     algorithm wait for the ACK of the previous one. */
+
+  if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+
+    WARNF("setsockopt(TCP_NODELAY) failed");
+
+  }
+
+  u32 hello = 0;
+  if (recv(s, &hello, 4, MSG_PEEK | MSG_WAITALL) == 4 &&
+      (hello & 0xff000000) == NET_HELLO_MAGIC) {
+
+    net_hello_t reply = {NET_HELLO, fsrv->map_size, fsrv->num_reachables,
+                         fsrv->num_freachables};
+    if (recv(s, &hello, 4, 0) != 4) { FATAL("did not receive hello"); }
+    if (hello != NET_HELLO) {
+
+      FATAL("client uses protocol version %u, expected %u", hello & 0xffffff,
+            NET_VERSION);
+
+    }
+
+    if (send(s, &reply, sizeof(reply), 0) != sizeof(reply)) {
+
+      FATAL("could not send hello");
+
+    }
+
+    sparse = 1;
+    fprintf(stderr, "Client uses sparse coverage%s\n",
+            fsrv->num_reachables ? " with AFLRun maps" : "");
+
+  } else if (fsrv->num_reachables) {
+
+    WARNF("Client does not support AFLRun maps, sending coverage map only");
+
+  }
+
 #ifdef SO_PRIORITY
   priority = 7;
   if (setsockopt(s, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) < 0) {
@@ -643,6 +802,14 @@ int main(int argc, char **argv_orig, char **envp) {
     // fprintf(stderr, "received %u\n", in_len);
     (void)run_target(fsrv, use_argv, in_data, in_len, 1);
 
+    if (sparse) {
+
+      u32 len = encode_sparse(fsrv);
+      if (send(s, sparse_buf, len, 0) != len) FATAL("could not send data");
+      continue;
+
+    }
+
     memcpy(send_buf + 4, fsrv->trace_bits, fsrv->map_size);
 
 #ifdef USE_DEFLATE
@@ -669,9 +836,11 @@ int main(int argc, char **argv_orig, char **envp) {
   out_file = NULL;
 
   afl_shm_deinit(&shm);
+  if (fsrv->num_reachables) { aflrun_shm_deinit(&shm_run); }
   afl_fsrv_deinit(fsrv);
   if (fsrv->target_path) { ck_free(fsrv->target_path); }
   afl_free(in_data);
+  afl_free(sparse_buf);
 #if USE_DEFLATE
   afl_free(buf2);
   libdeflate_free_compressor(compressor);
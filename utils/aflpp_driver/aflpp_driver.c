@@ -246,6 +246,47 @@ static int ExecuteFilesOnyByOne(int argc, char **argv,
 
 }
 
+// Run the persistent loop on testcases from stdin, for tools running us in
+// their forkserver without shared-memory testcases, e.g. afl-tmin. AFLRun
+// maps are still reset by the runtime between iterations.
+static int ExecuteStdinPersistent(int N, int (*callback)(const uint8_t *data,
+                                                         size_t size)) {
+
+  unsigned char *buf = (unsigned char *)malloc(MAX_FILE);
+
+  __asan_poison_memory_region(buf, MAX_FILE);
+  ssize_t prev_length = 0;
+
+  while (__afl_persistent_loop(N)) {
+
+#ifndef __HAIKU__
+    ssize_t length = syscall(SYS_read, 0, buf, MAX_FILE);
+#else
+    ssize_t length = _kern_read(0, buf, MAX_FILE);
+#endif  // HAIKU
+
+    if (length < 0) { length = 0; }
+
+    if (length < prev_length) {
+
+      __asan_poison_memory_region(buf + length, prev_length - length);
+
+    } else {
+
+      __asan_unpoison_memory_region(buf + prev_length, length - prev_length);
+
+    }
+
+    prev_length = length;
+    (void)callback(buf, length);
+
+  }
+
+  free(buf);
+  return 0;
+
+}
+
 __attribute__((weak)) int main(int argc, char **argv) {
 
   if (argc < 2 || strncmp(argv[1], "-h", 2) == 0)
@@ -286,9 +327,9 @@ int LLVMFuzzerRunDriver(int *argcp, char ***argvp,
 
   }
 
-  bool in_afl = !(!getenv(SHM_FUZZ_ENV_VAR) || !getenv(SHM_ENV_VAR) ||
-                  fcntl(FORKSRV_FD, F_GETFD) == -1 ||
-                  fcntl(FORKSRV_FD + 1, F_GETFD) == -1);
+  bool in_fsrv = fcntl(FORKSRV_FD, F_GETFD) != -1 &&
+                 fcntl(FORKSRV_FD + 1, F_GETFD) != -1;
+  bool in_afl = in_fsrv && getenv(SHM_FUZZ_ENV_VAR) && getenv(SHM_ENV_VAR);
 
   if (!in_afl) { __afl_sharedmem_fuzzing = 0; }
 
@@ -312,7 +353,7 @@ int LLVMFuzzerRunDriver(int *argcp, char ***argvp,
 
   int N = INT_MAX;
 
-  if (!in_afl && argc == 2 && !strcmp(argv[1], "-")) {
+  if (!in_fsrv && argc == 2 && !strcmp(argv[1], "-")) {
 
     __afl_manual_init();
     return ExecuteFilesOnyByOne(argc, argv, callback);
@@ -345,6 +386,9 @@ int LLVMFuzzerRunDriver(int *argcp, char ***argvp,
   // on the first execution of LLVMFuzzerTestOneInput is ignored.
   callback(dummy_input, 4);
 
+  // The runtime turns shared-memory testcases off if they are not offered
+  if (!__afl_fuzz_ptr) { return ExecuteStdinPersistent(N, callback); }
+
   __asan_poison_memory_region(__afl_fuzz_ptr, MAX_FILE);
   size_t prev_length = 0;
 
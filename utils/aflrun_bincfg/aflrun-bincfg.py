@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+#
+# aflrun-bincfg - AFLRun temporary directory of a binary-only target
+# -------------------------------------------------------------------
+#
+# Computes from the CFG of a disassembled binary what aflrun-pass computes
+# from the LLVM IR of a source target: the blocks reaching each target and
+# their distances to it, written as BBreachable.txt, Freachable.txt,
+# BBedges.txt, Chash.txt and distance.cfg/ into an AFLRun temporary
+# directory, plus BBaddrs.txt mapping the reachable blocks and functions back
+# to their addresses for the binary-only instrumentation (see
+# AFL_FRIDA_AFLRUN_DIR in frida_mode/README.md).
+#
+# The CFG is read in the format written by ida_export_cfg.py, one line each:
+#
+#   F <module> 0x<entry> <function name>     starts a function
+#   B <module> 0x<block> [0x<succ> ...]      block of the last function
+#   C <module> 0x<block> <function name>     call from block to a function
+#
+# with addresses relative to the module base. Targets are given one per
+# line as `<module>:0x<block>`, optionally followed by `|<weight>` like the
+# targets of aflrun-pass.
+#
+# Usage: aflrun-bincfg.py cfg.txt targets.txt tmp_dir
+#        afl-fuzz -O --dir tmp_dir ... (with AFL_FRIDA_AFLRUN_DIR=tmp_dir)
+#
+
+import heapq
+import math
+import os
+import sys
+
+
+def block_name(module, addr):
+    return "%s:0x%x" % (module, addr)
+
+
+def read_cfg(path):
+
+    funcs = []  # (name, entry vertex), in file order
+    names = []  # vertex -> block name
+    addrs = []  # vertex -> (module, addr)
+    vertex = {}
+    succs = {}  # vertex -> list of successor names
+    calls = {}  # vertex -> list of callee function names
+    func_of = []  # vertex -> index in funcs
+
+    def add_block(module, addr):
+        name = block_name(module, addr)
+        if name not in vertex:
+            vertex[name] = len(names)
+            names.append(name)
+            addrs.append((module, addr))
+            func_of.append(len(funcs) - 1)
+        return vertex[name]
+
+    with open(path) as f:
+        for num, line in enumerate(f, 1):
+            fields = line.split()
+            if not fields or fields[0].startswith("#"):
+                continue
+            if len(fields) < 3 or fields[0] not in "FBC":
+                sys.exit("%s:%d: invalid line" % (path, num))
+            module, addr = fields[1], int(fields[2], 16)
+            if fields[0] == "F":
+                funcs.append((" ".join(fields[3:]), None))
+                funcs[-1] = (funcs[-1][0], add_block(module, addr))
+            elif not funcs:
+                sys.exit("%s:%d: block before any function" % (path, num))
+            elif fields[0] == "B":
+                v = add_block(module, addr)
+                succs.setdefault(v, []).extend(
+                    block_name(module, int(s, 16)) for s in fields[3:])
+            else:
+                v = add_block(module, addr)
+                calls.setdefault(v, []).append(" ".join(fields[3:]))
+
+    return funcs, names, addrs, vertex, succs, calls, func_of
+
+
+def read_targets(path):
+
+    targets = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            name, _, w = line.rpartition("|")
+            if not name:
+                name, w = w, "1"
+            module, _, addr = name.rpartition(":")
+            targets[block_name(module, int(addr, 16))] = float(w)
+    return targets
+
+
+def main():
+
+    if len(sys.argv) != 4:
+        sys.exit("Usage: %s cfg.txt targets.txt tmp_dir" % sys.argv[0])
+
+    funcs, names, addrs, vertex, succs, calls, func_of = read_cfg(sys.argv[1])
+    targets = read_targets(sys.argv[2])
+    out = sys.argv[3]
+    entry_of = {name: v for name, v in funcs}
+
+    # Inverse CFG as aflrun-pass builds it: a block reaches its successors
+    # with weight log2 of their number, and the callees it calls with 0.
+    preds = [[] for _ in names]
+    for u in range(len(names)):
+        s = [vertex[n] for n in succs.get(u, []) if n in vertex]
+        w = math.log2(len(s)) if s else 0
+        for v in s:
+            preds[v].append((u, w))
+        for c in calls.get(u, []):
+            if c in entry_of:
+                preds[entry_of[c]].append((u, 0.0))
+
+    # Targets are numbered in order of their functions, then of the blocks
+    missing = set(targets) - set(vertex)
+    if missing:
+        sys.exit("Targets not in CFG: " + ", ".join(sorted(missing)))
+    bb_reachable = sorted((vertex[t] for t in targets),
+                          key=lambda v: (func_of[v], v))
+    if not bb_reachable:
+        sys.exit("No targets given")
+    num_targets = len(bb_reachable)
+    reach_of = {v: {i} for i, v in enumerate(bb_reachable)}
+    f_reachable = sorted({funcs[func_of[v]][1] for v in bb_reachable},
+                         key=lambda v: func_of[v])
+    num_ftargets = len(f_reachable)
+    f_entries = set(entry_of.values())
+
+    os.makedirs(os.path.join(out, "distance.cfg"), exist_ok=True)
+    edges = set()
+    for t in range(num_targets):
+
+        dist = {bb_reachable[t]: 0.0}
+        heap = [(0.0, bb_reachable[t])]
+        while heap:
+            d, v = heapq.heappop(heap)
+            if d > dist[v]:
+                continue
+            for u, w in preds[v]:
+                if d + w < dist.get(u, math.inf):
+                    dist[u] = d + w
+                    heapq.heappush(heap, (d + w, u))
+
+        with open(os.path.join(out, "distance.cfg", "%d.txt" % t), "w") as f:
+            for v in sorted(dist):
+                f.write("%s,%g\n" % (names[v], dist[v]))
+                if v not in reach_of:
+                    reach_of[v] = set()
+                    bb_reachable.append(v)
+                reach_of[v].add(t)
+                if v in f_entries and v not in f_reachable:
+                    f_reachable.append(v)
+                for u, _ in preds[v]:
+                    edges.add((u, v))
+
+    index = {v: i for i, v in enumerate(bb_reachable)}
+    with open(os.path.join(out, "BBreachable.txt"), "w") as f:
+        f.write("%d,%d\n" % (num_targets, len(bb_reachable)))
+        for i, v in enumerate(bb_reachable):
+            f.write(names[v] + "".join(",%d" % t for t in sorted(reach_of[v])))
+            if i < num_targets:
+                f.write("|%r" % targets[names[v]])
+            f.write("\n")
+
+    func_name = {v: name for name, v in funcs}
+    with open(os.path.join(out, "Freachable.txt"), "w") as f:
+        f.write("%d,%d\n" % (num_ftargets, len(f_reachable)))
+        for v in f_reachable:
+            f.write(func_name[v] + "\n")
+
+    with open(os.path.join(out, "BBedges.txt"), "w") as f:
+        for u, v in sorted(edges):
+            if u in index:
+                f.write("%d,%d\n" % (index[u], index[v]))
+
+    # There are no call contexts for binary-only targets
+    open(os.path.join(out, "Chash.txt"), "w").close()
+
+    with open(os.path.join(out, "BBaddrs.txt"), "w") as f:
+        for i, v in enumerate(bb_reachable):
+            f.write("b %d %s 0x%x\n" % ((i,) + addrs[v]))
+        for i, v in enumerate(f_reachable):
+            f.write("f %d %s 0x%x\n" % ((i,) + addrs[v]))
+
+    print("%d targets, %d reachable blocks, %d reachable functions" %
+          (num_targets, len(bb_reachable), len(f_reachable)))
+
+
+if __name__ == "__main__":
+    main()
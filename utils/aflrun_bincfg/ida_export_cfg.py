@@ -0,0 +1,59 @@
+#
+# IDAPython script for IDA Pro
+# Writes the CFG of the database in the input format of aflrun-bincfg.py
+#
+
+import idautils
+import idaapi
+import ida_nalt
+import idc
+
+from os.path import expanduser
+
+home = expanduser("~")
+module = ida_nalt.get_root_filename()
+base = idaapi.get_imagebase()
+
+functions = 0
+lines = []
+
+for seg_ea in idautils.Segments():
+    name = idc.get_segm_name(seg_ea)
+    if name != "__text" and name != ".text":
+        continue
+
+    start = idc.get_segm_start(seg_ea)
+    end = idc.get_segm_end(seg_ea)
+    for func_ea in idautils.Functions(start, end):
+        f = idaapi.get_func(func_ea)
+        if not f:
+            continue
+
+        functions += 1
+        lines.append("F %s 0x%x %s" % (module, f.start_ea - base,
+                                       idc.get_func_name(f.start_ea)))
+
+        for block in idaapi.FlowChart(f):
+            succs = " ".join("0x%x" % (s.start_ea - base) for s in block.succs())
+            lines.append("B %s 0x%x %s" % (module, block.start_ea - base, succs))
+
+            for insn in idautils.Heads(block.start_ea, block.end_ea):
+                if not idaapi.is_call_insn(insn):
+                    continue
+                for ref in idautils.CodeRefsFrom(insn, 0):
+                    callee = idaapi.get_func(ref)
+                    if callee and callee.start_ea == ref:
+                        lines.append("C %s 0x%x %s" % (module,
+                                                       block.start_ea - base,
+                                                       idc.get_func_name(ref)))
+
+print("Writing to " + home + "/Desktop/cfg.txt")
+
+with open(home + "/Desktop/cfg.txt", "w") as f:
+    f.write("\n".join(lines))
+    f.write("\n")
+
+print("Done, exported {} functions".format(functions))
+
+# For headless script running remove the comment from the next line
+# ida_pro.qexit()
@@ -0,0 +1,641 @@
+/*
+   american fuzzy lop++ - aflrun-coordinator-client
+   ------------------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Runs beside the afl-fuzz instances of one machine and connects them to
+   aflrun-coordinator. New queue entries of local instances are streamed to
+   the coordinator, together with their AFLRun sync metadata if instances
+   use `--config sync_meta=1`; seeds from other machines are written to the
+   queue of a pseudo instance `coordinator` in the sync directory, where the
+   main node (-M) imports them. If instances use `--config shared_state=1`,
+   blocks logged in `.aflrun_registry` are streamed as well, and blocks
+   reached on other machines are logged into it for local instances.
+
+*/
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "aflrun-registry.h"
+#include "aflrun-coordinator.h"
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+#undef XXH_INLINE_ALL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define COORD_DIR "coordinator"
+
+typedef struct peer {
+
+  u8             *name;
+  u32             next_id;
+  struct timespec mtime;
+
+} peer_t;
+
+static u8 *sync_dir, *node_name;
+
+static peer_t *peers;
+static u32     num_peers;
+
+static coord_conn_t conn = {.fd = -1};
+static coord_set_t  seen;     /* seeds sent or received by this client */
+static coord_set_t  sent;     /* seeds sent in current connection      */
+static u32          next_out_id;
+
+static aflrun_registry_t *registry;
+static size_t             registry_cursor;
+static u8                *received;  /* blocks reached on other machines */
+static coord_reached_t   *unpublished;
+static u32                num_unpublished;
+
+static u64 seeds_sent, seeds_received, blocks_sent, blocks_received;
+
+/* Read whole file `path` of at most `max` bytes into a malloc-ed buffer. */
+
+static u8 *read_file(u8 *path, u32 max, u32 *len) {
+
+  struct stat st;
+  s32         fd = open(path, O_RDONLY);
+  u8         *buf = NULL;
+
+  if (fd < 0) { return NULL; }
+  if (!fstat(fd, &st) && st.st_size > 0 && st.st_size <= max) {
+
+    buf = malloc(st.st_size);
+    if (buf && read(fd, buf, st.st_size) != st.st_size) {
+
+      free(buf);
+      buf = NULL;
+
+    }
+
+    *len = st.st_size;
+
+  }
+
+  close(fd);
+  return buf;
+
+}
+
+/* Write `len` bytes to `path` through a temporary file, so that afl-fuzz
+   never sees partial files. */
+
+static void write_file(u8 *path, struct iovec *parts, int cnt) {
+
+  u8  tmp[PATH_MAX];
+  s32 fd;
+
+  snprintf(tmp, sizeof(tmp), "%s/" COORD_DIR "/.tmp", sync_dir);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (fd < 0) { PFATAL("Unable to create '%s'", tmp); }
+  for (int i = 0; i < cnt; i++)
+    if (write(fd, parts[i].iov_base, parts[i].iov_len) !=
+        (ssize_t)parts[i].iov_len) {
+
+      PFATAL("Short write to '%s'", tmp);
+
+    }
+
+  close(fd);
+  if (rename(tmp, path)) { PFATAL("Unable to create '%s'", path); }
+
+}
+
+/* Map `.aflrun_registry` once an instance with shared_state=1 created it. */
+
+static void map_registry(void) {
+
+  u8                path[PATH_MAX];
+  aflrun_registry_t hdr;
+  struct stat       st;
+
+  snprintf(path, sizeof(path), "%s/" AFLRUN_REGISTRY_NAME, sync_dir);
+  s32 fd = open(path, O_RDWR);
+  if (fd < 0) { return; }
+
+  if (fstat(fd, &st) || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      hdr.magic != AFLRUN_REGISTRY_MAGIC ||
+      (size_t)st.st_size != AFLRUN_REGISTRY_SIZE(hdr.num_reachables)) {
+
+    close(fd);  // Not initialized yet, or not a registry
+    return;
+
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) { PFATAL("Unable to mmap '%s'", path); }
+
+  registry = p;
+  registry_cursor = 0;
+  received = calloc((hdr.num_reachables + 7) / 8, 1);
+  if (!received) { PFATAL("calloc"); }
+  OKF("Sharing reached blocks through '%s'.", path);
+
+}
+
+/* Log a block reached on another machine, same as `publish_reachable` of
+   afl-fuzz; instances react to it at their next sync. */
+
+static void publish_block(coord_reached_t *r) {
+
+  reach_t block = le32toh(r->block);
+  if (block >= registry->num_reachables) { return; }
+
+  received[block / 8] |= 1 << (block % 8);
+
+  u8 bit = 1 << (block % 8);
+  if (atomic_fetch_or(AFLRUN_REGISTRY_REACHED(registry) + block / 8, bit) &
+      bit) {
+
+    return;
+
+  }
+
+  size_t i = atomic_fetch_add(&registry->num, 1);
+  if (i >= registry->num_reachables) { return; }
+  aflrun_registry_entry_t *e = AFLRUN_REGISTRY_ENTRIES(registry) + i;
+  e->block = block;
+  e->fringe = le32toh(r->fringe);
+  atomic_store_explicit(&e->seq, i + 1, memory_order_release);
+
+}
+
+static void handle_msg(coord_msg_t *msg) {
+
+  u8 *payload = (u8 *)(msg + 1);
+  u32 len = le32toh(msg->len);
+
+  switch (le32toh(msg->type)) {
+
+    case COORD_SEED: {
+
+      coord_seed_t seed;
+      u8           path[PATH_MAX];
+      if (len < sizeof(seed)) { return; }
+      memcpy(&seed, payload, sizeof(seed));
+      u32 meta_len = le32toh(seed.meta_len);
+      if (meta_len > len - sizeof(seed) ||
+          !coord_set_insert(&seen, le64toh(seed.path_cksum))) {
+
+        return;
+
+      }
+
+      ++seeds_received;
+
+      // Metadata goes first, so it is there when the entry is synced
+      u8 *meta = payload + sizeof(seed), *data = meta + meta_len;
+      u32 data_len = len - sizeof(seed) - meta_len;
+      if (meta_len) {
+
+        struct iovec part = {meta, meta_len};
+        snprintf(path, sizeof(path),
+                 "%s/" COORD_DIR "/queue/" AFLRUN_SYNC_META_DIR
+                 "/id:%06u,coord",
+                 sync_dir, next_out_id);
+        write_file(path, &part, 1);
+
+      }
+
+      struct iovec part = {data, data_len};
+      snprintf(path, sizeof(path), "%s/" COORD_DIR "/queue/id:%06u,coord",
+               sync_dir, next_out_id++);
+      write_file(path, &part, 1);
+      break;
+
+    }
+
+    case COORD_REACHED: {
+
+      coord_reached_t *rs = (coord_reached_t *)payload;
+      u32              n = len / sizeof(coord_reached_t);
+      blocks_received += n;
+      for (u32 i = 0; i < n; i++) {
+
+        if (registry) {
+
+          publish_block(rs + i);
+
+        } else {
+
+          unpublished =
+              realloc(unpublished, (num_unpublished + 1) * sizeof(*rs));
+          if (!unpublished) { PFATAL("realloc"); }
+          unpublished[num_unpublished++] = rs[i];
+
+        }
+
+      }
+
+      break;
+
+    }
+
+    default:
+      break;
+
+  }
+
+}
+
+static void send_or_drop(u32 type, struct iovec *parts, int cnt) {
+
+  if (conn.fd >= 0 && coord_send(conn.fd, type, parts, cnt)) {
+
+    WARNF("Lost connection to coordinator");
+    close(conn.fd);
+    conn.fd = -1;
+
+  }
+
+}
+
+/* Send queue entries of local instance `p` not sent yet. */
+
+static void scan_peer(peer_t *p) {
+
+  u8              path[PATH_MAX];
+  struct stat     st;
+  struct dirent **names;
+
+  snprintf(path, sizeof(path), "%s/%s/queue", sync_dir, p->name);
+  if (stat(path, &st) || (st.st_mtim.tv_sec == p->mtime.tv_sec &&
+                          st.st_mtim.tv_nsec == p->mtime.tv_nsec)) {
+
+    return;
+
+  }
+
+  p->mtime = st.st_mtim;
+
+  int n = scandir(path, &names, NULL, alphasort);
+  for (int i = 0; i < n; i++) {
+
+    u8 *fn = names[i]->d_name;
+    u32 id, len, meta_len = 0;
+
+    if (strncmp(fn, "id:", 3) || (id = strtoul(fn + 3, NULL, 10)) < p->next_id)
+      goto next;
+    p->next_id = id + 1;
+
+    // Entries imported from other instances are sent by their owners
+    if (strstr(fn, ",sync:")) { goto next; }
+
+    snprintf(path, sizeof(path), "%s/%s/queue/%s", sync_dir, p->name, fn);
+    u8 *data = read_file(path, MAX_FILE, &len);
+    if (!data) { goto next; }
+
+    snprintf(path, sizeof(path), "%s/%s/queue/" AFLRUN_SYNC_META_DIR "/%s",
+             sync_dir, p->name, fn);
+    u8 *meta = read_file(path, COORD_MAX_LEN - MAX_FILE - sizeof(coord_seed_t),
+                         &meta_len);
+
+    coord_seed_t seed;
+    aflrun_sync_meta_t *m = (aflrun_sync_meta_t *)meta;
+    if (meta && meta_len >= sizeof(*m) && m->magic == AFLRUN_SYNC_META_MAGIC) {
+
+      seed.path_cksum = m->path_cksum;
+
+    } else {
+
+      free(meta);
+      meta = NULL;
+      meta_len = 0;
+      seed.path_cksum = XXH3_64bits(data, len);
+
+    }
+
+    if (coord_set_insert(&sent, seed.path_cksum)) {
+
+      coord_set_insert(&seen, seed.path_cksum);
+      seed.path_cksum = htole64(seed.path_cksum);
+      seed.meta_len = htole32(meta_len);
+      struct iovec parts[3] = {
+          {&seed, sizeof(seed)}, {meta, meta_len}, {data, len}};
+      send_or_drop(COORD_SEED, parts, 3);
+      ++seeds_sent;
+
+    }
+
+    free(meta);
+    free(data);
+
+  next:
+    free(names[i]);
+
+  }
+
+  if (n >= 0) { free(names); }
+
+}
+
+static void scan_local(void) {
+
+  DIR           *sd;
+  struct dirent *sd_ent;
+
+  sd = opendir(sync_dir);
+  if (!sd) { PFATAL("Unable to open '%s'", sync_dir); }
+
+  while ((sd_ent = readdir(sd))) {
+
+    if (sd_ent->d_name[0] == '.' || !strcmp(sd_ent->d_name, COORD_DIR)) {
+
+      continue;
+
+    }
+
+    u32 i;
+    for (i = 0; i < num_peers; i++)
+      if (!strcmp(peers[i].name, sd_ent->d_name)) { break; }
+
+    if (i == num_peers) {
+
+      peers = realloc(peers, (num_peers + 1) * sizeof(peer_t));
+      if (!peers) { PFATAL("realloc"); }
+      memset(peers + num_peers, 0, sizeof(peer_t));
+      peers[num_peers++].name = strdup(sd_ent->d_name);
+
+    }
+
+    scan_peer(peers + i);
+
+  }
+
+  closedir(sd);
+
+  if (!registry) { map_registry(); }
+  if (!registry) { return; }
+
+  for (u32 i = 0; i < num_unpublished; i++)
+    publish_block(unpublished + i);
+  num_unpublished = 0;
+
+  /* Stream blocks logged by local instances, except those we logged. */
+
+  coord_reached_t batch[1024];
+  u32             n = 0;
+  size_t          num = atomic_load_explicit(&registry->num, memory_order_acquire);
+  aflrun_registry_entry_t *entries = AFLRUN_REGISTRY_ENTRIES(registry);
+  if (num > registry->num_reachables) { num = registry->num_reachables; }
+
+  for (; registry_cursor < num; ++registry_cursor) {
+
+    aflrun_registry_entry_t *e = entries + registry_cursor;
+    if (atomic_load_explicit(&e->seq, memory_order_acquire) !=
+        registry_cursor + 1) {
+
+      break;
+
+    }
+
+    if (received[e->block / 8] & (1 << (e->block % 8))) { continue; }
+    batch[n].block = htole32(e->block);
+    batch[n].fringe = htole32(e->fringe);
+    if (++n == sizeof(batch) / sizeof(batch[0])) {
+
+      struct iovec part = {batch, sizeof(batch)};
+      send_or_drop(COORD_REACHED, &part, 1);
+      blocks_sent += n;
+      n = 0;
+
+    }
+
+  }
+
+  if (n) {
+
+    struct iovec part = {batch, n * sizeof(coord_reached_t)};
+    send_or_drop(COORD_REACHED, &part, 1);
+    blocks_sent += n;
+
+  }
+
+}
+
+static int connect_to(u8 *host, u8 *port) {
+
+  struct addrinfo hints = {0}, *res, *ai;
+  int             fd = -1, one = 1;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res)) { return -1; }
+
+  for (ai = res; ai; ai = ai->ai_next) {
+
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) { continue; }
+    if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) { break; }
+    close(fd);
+    fd = -1;
+
+  }
+
+  freeaddrinfo(res);
+  if (fd >= 0) { setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); }
+  return fd;
+
+}
+
+static void usage(u8 *argv0) {
+
+  printf(
+      "%s [ options ]\n\n"
+
+      "  -s dir      - sync directory of local afl-fuzz instances (-o)\n"
+      "  -H host     - host of aflrun-coordinator\n"
+      "  -p port     - port of aflrun-coordinator\n"
+      "  -n name     - name of this machine (default: host name)\n"
+      "  -i seconds  - interval between scans of sync directory (default: "
+      "10)\n\n",
+      argv0);
+
+  exit(1);
+
+}
+
+int main(int argc, char **argv) {
+
+  s32 opt;
+  u8 *host = NULL, *port = NULL, path[PATH_MAX], hostname[256];
+  u32 interval = 10;
+  u64 last_scan = 0, last_report = 0;
+
+  while ((opt = getopt(argc, argv, "s:H:p:n:i:")) > 0) {
+
+    switch (opt) {
+
+      case 's':
+        sync_dir = optarg;
+        break;
+      case 'H':
+        host = optarg;
+        break;
+      case 'p':
+        port = optarg;
+        break;
+      case 'n':
+        node_name = optarg;
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        if (!interval) { FATAL("Bad value specified for -i"); }
+        break;
+      default:
+        usage(argv[0]);
+
+    }
+
+  }
+
+  if (!sync_dir || !host || !port || optind != argc) { usage(argv[0]); }
+
+  if (!node_name) {
+
+    if (gethostname(hostname, sizeof(hostname))) { PFATAL("gethostname"); }
+    hostname[sizeof(hostname) - 1] = 0;
+    node_name = hostname;
+
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  /* Queue of the pseudo instance, continuing after existing entries. */
+
+  snprintf(path, sizeof(path), "%s/" COORD_DIR, sync_dir);
+  mkdir(path, 0700);
+  snprintf(path, sizeof(path), "%s/" COORD_DIR "/queue", sync_dir);
+  mkdir(path, 0700);
+  snprintf(path, sizeof(path),
+           "%s/" COORD_DIR "/queue/" AFLRUN_SYNC_META_DIR, sync_dir);
+  if (mkdir(path, 0700) && errno != EEXIST) {
+
+    PFATAL("Unable to create '%s'", path);
+
+  }
+
+  snprintf(path, sizeof(path), "%s/" COORD_DIR "/queue", sync_dir);
+  DIR *qd = opendir(path);
+  if (!qd) { PFATAL("Unable to open '%s'", path); }
+  for (struct dirent *e; (e = readdir(qd));)
+    if (!strncmp(e->d_name, "id:", 3)) {
+
+      u32 id = strtoul(e->d_name + 3, NULL, 10);
+      if (id >= next_out_id) { next_out_id = id + 1; }
+
+    }
+
+  closedir(qd);
+
+  while (1) {
+
+    u64 now = time(NULL);
+
+    if (conn.fd < 0) {
+
+      // Map registry first, so coordinator knows the number of blocks
+      if (!registry) { map_registry(); }
+
+      conn.fd = connect_to(host, port);
+      if (conn.fd < 0) {
+
+        WARNF("Unable to connect to %s:%s, retrying", host, port);
+        sleep(interval);
+        continue;
+
+      }
+
+      OKF("Connected to %s:%s as '%s'.", host, port, node_name);
+      conn.len = 0;
+
+      coord_hello_t hello = {
+          .version = htole32(COORD_VERSION),
+          .num_reachables = htole32(registry ? registry->num_reachables : 0)};
+      struct iovec parts[2] = {{&hello, sizeof(hello)},
+                               {node_name, strlen(node_name)}};
+      send_or_drop(COORD_HELLO, parts, 2);
+
+      // Coordinator may have restarted, so send everything again
+      for (u32 i = 0; i < num_peers; i++) {
+
+        peers[i].next_id = 0;
+        memset(&peers[i].mtime, 0, sizeof(peers[i].mtime));
+
+      }
+
+      free(sent.slots);
+      memset(&sent, 0, sizeof(sent));
+      registry_cursor = 0;
+      last_scan = 0;
+
+    }
+
+    if (now - last_scan >= interval) {
+
+      scan_local();
+      last_scan = now;
+
+    }
+
+    if (now - last_report >= 60) {
+
+      OKF("Seeds sent %llu, received %llu; blocks sent %llu, received %llu",
+          seeds_sent, seeds_received, blocks_sent, blocks_received);
+      last_report = now;
+
+    }
+
+    if (conn.fd < 0) { continue; }
+
+    struct pollfd pfd = {.fd = conn.fd, .events = POLLIN};
+    if (poll(&pfd, 1, 1000) <= 0) { continue; }
+
+    u32          off = 0;
+    u8           bad = coord_recv(&conn) < 0;
+    coord_msg_t *msg;
+    while (!bad && (msg = coord_next(&conn, &off, &bad)))
+      handle_msg(msg);
+    coord_consume(&conn, off);
+
+    if (bad) {
+
+      WARNF("Lost connection to coordinator");
+      close(conn.fd);
+      conn.fd = -1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
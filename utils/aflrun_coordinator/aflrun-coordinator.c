@@ -0,0 +1,379 @@
+/*
+   american fuzzy lop++ - aflrun-coordinator
+   -----------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Central service for AFLRun campaigns spread over several machines. One
+   aflrun-coordinator-client per machine connects to it and streams new
+   queue entries and blocks reached for the first time. Seeds are
+   deduplicated by path checksum and reached blocks by block index, and
+   everything new is pushed to all other clients; clients connecting later
+   get everything seen so far.
+
+*/
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "aflrun-coordinator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_CLIENTS 1024
+
+typedef struct client {
+
+  coord_conn_t conn;
+  u8          *name;
+  u8           hello, dead;
+
+} client_t;
+
+static client_t clients[MAX_CLIENTS];
+static u32      num_clients;
+
+/* Seeds seen so far, kept as payloads of COORD_SEED messages for replay. */
+
+static u8 **seeds;
+static u32 *seed_lens;
+static u32  num_seeds;
+
+/* Path checksums of seeds seen so far. */
+
+static coord_set_t cksums;
+
+/* Reached blocks, in the order they were first reported. */
+
+static u32              num_reachables;
+static u8              *reached;
+static coord_reached_t *reached_log;
+static u32              reached_num;
+
+static u64 total_seeds, total_dups;
+
+static void drop_client(u32 i) {
+
+  if (clients[i].name) { OKF("Client '%s' disconnected.", clients[i].name); }
+  close(clients[i].conn.fd);
+  free(clients[i].conn.buf);
+  free(clients[i].name);
+  clients[i] = clients[--num_clients];
+
+}
+
+/* Send a message to all clients that said hello, except `from`. Clients that
+   cannot keep up are dropped; they get everything again when reconnecting. */
+
+static void broadcast(u32 from, u32 type, struct iovec *parts, int cnt) {
+
+  for (u32 i = 0; i < num_clients; i++) {
+
+    if (i == from || !clients[i].hello || clients[i].dead) { continue; }
+    if (coord_send(clients[i].conn.fd, type, parts, cnt)) {
+
+      WARNF("Unable to send to '%s', dropping it", clients[i].name);
+      clients[i].dead = 1;  // dropped after this round of messages
+
+    }
+
+  }
+
+}
+
+/* Handle a message of client `i`, return -1 if the client must be dropped. */
+
+static int handle_msg(u32 i, coord_msg_t *msg) {
+
+  client_t *c = clients + i;
+  u8       *payload = (u8 *)(msg + 1);
+  u32       len = le32toh(msg->len);
+
+  switch (le32toh(msg->type)) {
+
+    case COORD_HELLO: {
+
+      coord_hello_t hello;
+      if (c->hello || len < sizeof(hello)) { return -1; }
+      memcpy(&hello, payload, sizeof(hello));
+      u32 nr = le32toh(hello.num_reachables);
+      if (le32toh(hello.version) != COORD_VERSION) {
+
+        WARNF("Client with protocol version %u rejected",
+              le32toh(hello.version));
+        return -1;
+
+      }
+
+      if (nr && num_reachables && nr != num_reachables) {
+
+        WARNF("Client with %u reachable blocks rejected, expected %u", nr,
+              num_reachables);
+        return -1;
+
+      }
+
+      if (nr && !num_reachables) {
+
+        num_reachables = nr;
+        reached = calloc((nr + 7) / 8, 1);
+        reached_log = calloc(nr, sizeof(coord_reached_t));
+        if (!reached || !reached_log) { PFATAL("calloc"); }
+
+      }
+
+      c->name = strndup((char *)payload + sizeof(hello), len - sizeof(hello));
+      c->hello = 1;
+      OKF("Client '%s' connected, sending %u seeds and %u blocks.", c->name,
+          num_seeds, reached_num);
+
+      for (u32 j = 0; j < num_seeds; j++) {
+
+        struct iovec part = {seeds[j], seed_lens[j]};
+        if (coord_send(c->conn.fd, COORD_SEED, &part, 1)) { return -1; }
+
+      }
+
+      struct iovec part = {reached_log, reached_num * sizeof(coord_reached_t)};
+      if (reached_num && coord_send(c->conn.fd, COORD_REACHED, &part, 1)) {
+
+        return -1;
+
+      }
+
+      return 0;
+
+    }
+
+    case COORD_SEED: {
+
+      coord_seed_t seed;
+      if (!c->hello || len < sizeof(seed)) { return -1; }
+      memcpy(&seed, payload, sizeof(seed));
+      if (le32toh(seed.meta_len) > len - sizeof(seed)) { return -1; }
+
+      ++total_seeds;
+      if (!coord_set_insert(&cksums, le64toh(seed.path_cksum))) {
+
+        ++total_dups;
+        return 0;
+
+      }
+
+      seeds = realloc(seeds, (num_seeds + 1) * sizeof(u8 *));
+      seed_lens = realloc(seed_lens, (num_seeds + 1) * sizeof(u32));
+      if (!seeds || !seed_lens || !(seeds[num_seeds] = malloc(len))) {
+
+        PFATAL("realloc");
+
+      }
+
+      memcpy(seeds[num_seeds], payload, len);
+      seed_lens[num_seeds++] = len;
+
+      struct iovec part = {payload, len};
+      broadcast(i, COORD_SEED, &part, 1);
+      return 0;
+
+    }
+
+    case COORD_REACHED: {
+
+      if (!c->hello) { return -1; }
+      if (!num_reachables) { return 0; }
+
+      coord_reached_t *rs = (coord_reached_t *)payload;
+      u32              n = len / sizeof(coord_reached_t), fresh = 0;
+      for (u32 j = 0; j < n; j++) {
+
+        u32 b = le32toh(rs[j].block);
+        if (b >= num_reachables || (reached[b / 8] & (1 << (b % 8)))) {
+
+          continue;
+
+        }
+
+        reached[b / 8] |= 1 << (b % 8);
+        reached_log[reached_num++] = rs[j];
+        ++fresh;
+
+      }
+
+      // New blocks are at the end of the log
+      if (fresh) {
+
+        struct iovec part = {reached_log + reached_num - fresh,
+                             fresh * sizeof(coord_reached_t)};
+        broadcast(i, COORD_REACHED, &part, 1);
+
+      }
+
+      return 0;
+
+    }
+
+    default:
+      return -1;
+
+  }
+
+}
+
+static void usage(u8 *argv0) {
+
+  printf(
+      "%s [ options ]\n\n"
+
+      "  -p port    - TCP port to listen on\n"
+      "  -l address - address to listen on (default: any)\n\n",
+      argv0);
+
+  exit(1);
+
+}
+
+int main(int argc, char **argv) {
+
+  s32              opt;
+  u8              *port = NULL, *addr = NULL;
+  struct addrinfo  hints = {0}, *res;
+  struct pollfd    fds[MAX_CLIENTS + 1];
+  u64              last_report = 0;
+  int              one = 1, lfd;
+  struct timeval   tv = {.tv_sec = 10};
+
+  while ((opt = getopt(argc, argv, "p:l:")) > 0) {
+
+    switch (opt) {
+
+      case 'p':
+        port = optarg;
+        break;
+      case 'l':
+        addr = optarg;
+        break;
+      default:
+        usage(argv[0]);
+
+    }
+
+  }
+
+  if (!port || optind != argc) { usage(argv[0]); }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(addr, port, &hints, &res)) {
+
+    FATAL("Unable to resolve '%s'", addr ? addr : (u8 *)"any");
+
+  }
+
+  lfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (lfd < 0) { PFATAL("socket() failed"); }
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(lfd, res->ai_addr, res->ai_addrlen) || listen(lfd, 64)) {
+
+    PFATAL("Unable to listen on port %s", port);
+
+  }
+
+  freeaddrinfo(res);
+  OKF("Listening on port %s.", port);
+
+  while (1) {
+
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+    for (u32 i = 0; i < num_clients; i++) {
+
+      fds[i + 1].fd = clients[i].conn.fd;
+      fds[i + 1].events = POLLIN;
+      fds[i + 1].revents = 0;
+
+    }
+
+    if (poll(fds, num_clients + 1, 60 * 1000) < 0) {
+
+      if (errno == EINTR) { continue; }
+      PFATAL("poll() failed");
+
+    }
+
+    /* Handle clients first, `fds` is stale once clients are dropped. */
+
+    u32 polled = num_clients;
+    for (u32 i = 0; i < polled; i++) {
+
+      if (!fds[i + 1].revents) { continue; }
+
+      client_t *c = clients + i;
+      u32       off = 0;
+      u8        bad = coord_recv(&c->conn) < 0;
+      coord_msg_t *msg;
+
+      while (!bad && (msg = coord_next(&c->conn, &off, &bad)))
+        if (handle_msg(i, msg)) { bad = 1; }
+      coord_consume(&c->conn, off);
+      if (bad) { c->dead = 1; }
+
+    }
+
+    /* Drop clients that were closed, misbehaved or could not keep up. */
+
+    for (u32 i = num_clients; i-- > 0;)
+      if (clients[i].dead) { drop_client(i); }
+
+    if (fds[0].revents & POLLIN) {
+
+      int fd = accept(lfd, NULL, NULL);
+      if (fd >= 0 && num_clients < MAX_CLIENTS) {
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        memset(clients + num_clients, 0, sizeof(client_t));
+        clients[num_clients++].conn.fd = fd;
+
+      } else if (fd >= 0) {
+
+        close(fd);
+
+      }
+
+    }
+
+    u64 now = time(NULL);
+    if (now - last_report >= 60) {
+
+      OKF("%u clients, %llu seeds received, %u unique, %llu duplicates, "
+          "%u reached blocks",
+          num_clients, total_seeds, num_seeds, total_dups, reached_num);
+      last_report = now;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
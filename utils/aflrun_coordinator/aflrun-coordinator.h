@@ -0,0 +1,232 @@
+/*
+   american fuzzy lop++ - aflrun-coordinator protocol
+   --------------------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Messages exchanged between aflrun-coordinator and each machine's
+   aflrun-coordinator-client over TCP. Every message is a `coord_msg_t`
+   header followed by `len` bytes of payload; all integers are little-endian.
+
+   COORD_HELLO   client -> server, `coord_hello_t` followed by node name.
+   COORD_SEED    both ways, `coord_seed_t`, `meta_len` bytes of AFLRun sync
+                 metadata (`aflrun_sync_meta_t` and its arrays, may be empty),
+                 then the test case itself.
+   COORD_REACHED both ways, array of `coord_reached_t`, blocks reached for
+                 the first time, as logged in `.aflrun_registry`.
+
+*/
+
+#ifndef _HAVE_AFLRUN_COORDINATOR_H
+#define _HAVE_AFLRUN_COORDINATOR_H
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "types.h"
+
+#define COORD_VERSION 1
+#define COORD_MAX_LEN (64U << 20)           /* max payload of one message */
+
+enum { COORD_HELLO = 1, COORD_SEED = 2, COORD_REACHED = 3 };
+
+typedef struct coord_msg {
+
+  u32 type;
+  u32 len;
+
+} __attribute__((packed)) coord_msg_t;
+
+typedef struct coord_hello {
+
+  u32 version;
+  u32 num_reachables;                   /* 0 if not known by the client    */
+
+} __attribute__((packed)) coord_hello_t;
+
+typedef struct coord_seed {
+
+  u64 path_cksum;                       /* or hash of content without meta */
+  u32 meta_len;
+
+} __attribute__((packed)) coord_seed_t;
+
+typedef struct coord_reached {
+
+  u32 block;
+  u32 fringe;
+
+} __attribute__((packed)) coord_reached_t;
+
+/* A connection with buffered input, messages are parsed from `buf`. */
+
+typedef struct coord_conn {
+
+  int fd;
+  u8 *buf;
+  u32 len, cap;
+
+} coord_conn_t;
+
+/* Send a message with payload made of `cnt` parts, return 0 on success. */
+
+static int coord_send(int fd, u32 type, struct iovec *parts, int cnt) {
+
+  struct iovec iov[8];
+  coord_msg_t  msg = {.type = htole32(type), .len = 0};
+  u32          len = 0;
+
+  if (cnt > 7) { return -1; }
+  for (int i = 0; i < cnt; i++) {
+
+    len += parts[i].iov_len;
+    iov[i + 1] = parts[i];
+
+  }
+
+  if (len > COORD_MAX_LEN) { return -1; }
+  msg.len = htole32(len);
+  iov[0].iov_base = &msg;
+  iov[0].iov_len = sizeof(msg);
+  ++cnt;
+
+  struct iovec *cur = iov;
+  while (cnt) {
+
+    ssize_t n = writev(fd, cur, cnt);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return -1; }
+    while (cnt && (size_t)n >= cur->iov_len) {
+
+      n -= cur->iov_len;
+      ++cur;
+      --cnt;
+
+    }
+
+    if (cnt) {
+
+      cur->iov_base = (u8 *)cur->iov_base + n;
+      cur->iov_len -= n;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+/* Read what is available from `c`, return -1 on EOF or error. */
+
+static int coord_recv(coord_conn_t *c) {
+
+  if (c->cap - c->len < 65536) {
+
+    u32 cap = c->cap ? c->cap * 2 : 65536 * 2;
+    u8 *buf = realloc(c->buf, cap);
+    if (!buf) {
+
+      free(c->buf);
+      c->buf = NULL;
+      c->cap = c->len = 0;
+      return -1;
+
+    }
+
+    c->buf = buf;
+    c->cap = cap;
+
+  }
+
+  ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN)) { return 0; }
+  if (n <= 0) { return -1; }
+  c->len += n;
+  return 0;
+
+}
+
+/* Return next complete message at `*off` of the buffer and advance `*off`,
+   or NULL if there is none; `*bad` is set if the message is too large. */
+
+static coord_msg_t *coord_next(coord_conn_t *c, u32 *off, u8 *bad) {
+
+  coord_msg_t *msg = (coord_msg_t *)(c->buf + *off);
+  if (c->len - *off < sizeof(coord_msg_t)) { return NULL; }
+
+  u32 len = le32toh(msg->len);
+  if (len > COORD_MAX_LEN) {
+
+    *bad = 1;
+    return NULL;
+
+  }
+
+  if (c->len - *off - sizeof(coord_msg_t) < len) { return NULL; }
+  *off += sizeof(coord_msg_t) + len;
+  return msg;
+
+}
+
+/* Open addressing set of 64-bit checksums, 0 marks an empty slot. */
+
+typedef struct coord_set {
+
+  u64 *slots;
+  u64  cap, num;
+
+} coord_set_t;
+
+/* Insert `v`, return 1 if it was not in the set. */
+
+static u8 coord_set_insert(coord_set_t *s, u64 v) {
+
+  if (!v) { v = 1; }
+
+  if ((s->num + 1) * 2 > s->cap) {
+
+    coord_set_t old = *s;
+    s->cap = old.cap ? old.cap * 2 : 1024;
+    s->slots = calloc(s->cap, sizeof(u64));
+    s->num = 0;
+    if (!s->slots) { return 0; }
+    for (u64 i = 0; i < old.cap; i++)
+      if (old.slots[i]) { coord_set_insert(s, old.slots[i]); }
+    free(old.slots);
+
+  }
+
+  for (u64 i = v & (s->cap - 1);; i = (i + 1) & (s->cap - 1)) {
+
+    if (s->slots[i] == v) { return 0; }
+    if (!s->slots[i]) {
+
+      s->slots[i] = v;
+      ++s->num;
+      return 1;
+
+    }
+
+  }
+
+}
+
+/* Drop the first `off` bytes of parsed messages. */
+
+static void coord_consume(coord_conn_t *c, u32 off) {
+
+  memmove(c->buf, c->buf + off, c->len - off);
+  c->len -= off;
+
+}
+
+#endif                                        /* !_HAVE_AFLRUN_COORDINATOR_H */
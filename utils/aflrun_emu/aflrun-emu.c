@@ -0,0 +1,377 @@
+/*
+   american fuzzy lop++ - AFLRun maps for emulator harnesses
+   ----------------------------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   See aflrun-emu.h. Maps are written like aflrun_inst_impl() of
+   afl-compiler-rt.o.c without atomics, and with context 0.
+
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "types.h"
+#include "trace.h"
+#include "aflrun-emu.h"
+
+typedef struct {
+
+  u64     addr;
+  reach_t index;
+
+} emu_entry_t;
+
+typedef struct {
+
+  emu_entry_t *e;
+  size_t       num, cap;
+  u8           sorted;
+
+} emu_table_t;
+
+/* Cache of aflrun_emu_trace(): an address with its block index, or -1 */
+#define EMU_CACHE_POW2 12
+
+typedef struct {
+
+  u64 addr;
+  s64 index;
+
+} emu_cache_t;
+
+static reach_t num_targets, num_reachables, num_freachables;
+static emu_cache_t cache[1 << EMU_CACHE_POW2];
+static u8     *rbb, *rf, *tr, *vir, *div_sw, *hc, *mute;
+static trace_t *vtr, *tt, *db;
+static aflrun_shm_hdr_t *hdr;
+static emu_table_t blocks, funcs;
+
+static int read_header(const char *dir, const char *name, reach_t *nt,
+                       reach_t *nr) {
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+
+    fprintf(stderr, "[aflrun-emu] cannot open %s\n", path);
+    return -1;
+
+  }
+
+  int ok = fscanf(f, "%u,%u", nt, nr) == 2 && *nt != 0 && *nt <= *nr;
+  fclose(f);
+  if (!ok) {
+
+    fprintf(stderr, "[aflrun-emu] wrong format of %s\n", path);
+    return -1;
+
+  }
+
+  return 0;
+
+}
+
+/* Attach the region of afl-fuzz, see aflrun_attach() of the runtime. */
+
+static u8 *attach_shm(void) {
+
+  char *id_str = getenv(SHM_AFLRUN_ENV_VAR);
+  u8   *base;
+  if (id_str == NULL) { return NULL; }
+
+#ifdef USEMMAP
+  int         fd = shm_open(id_str, O_RDWR, DEFAULT_PERMISSION);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st)) { return (u8 *)-1; }
+  base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) { return (u8 *)-1; }
+#else
+  base = shmat(atoi(id_str), NULL, 0);
+#endif
+
+  return base;
+
+}
+
+int aflrun_emu_init(const char *dir) {
+
+  reach_t num_ftargets;
+  if (read_header(dir, "BBreachable.txt", &num_targets, &num_reachables) ||
+      read_header(dir, "Freachable.txt", &num_ftargets, &num_freachables)) {
+
+    num_reachables = 0;
+    return -1;
+
+  }
+
+  u8 *base = attach_shm();
+  if (base == (u8 *)-1) {
+
+    perror("[aflrun-emu] cannot attach AFLRun maps");
+    num_reachables = 0;
+    return -1;
+
+  }
+
+  if (base != NULL) {
+
+    hdr = (aflrun_shm_hdr_t *)base;
+    rbb = base + hdr->off_rbb;
+    rf = base + hdr->off_rf;
+    tr = base + hdr->off_tr;
+    vir = base + hdr->off_vir;
+    vtr = (trace_t *)(base + hdr->off_vtr);
+    tt = (trace_t *)(base + hdr->off_tt);
+    div_sw = base + hdr->off_div;
+    db = (trace_t *)(base + hdr->off_db);
+    hc = base + hdr->off_hc;
+    mute = base + hdr->off_mute;
+    // aflrun_emu_block() appends blocks to it, so clear DIRTY_UNSUPPORTED
+    db->num = 0;
+
+  } else {
+
+    // No fuzzer: private maps, with no virgin bits to log
+    rbb = calloc(1, MAP_RBB_SIZE(num_reachables));
+    rf = calloc(1, MAP_RF_SIZE(num_freachables));
+    tr = calloc(1, MAP_TR_SIZE(num_reachables));
+    vir = calloc(1, MAP_TR_SIZE(num_reachables));
+    vtr = calloc(1, MAP_VTR_SIZE(num_reachables));
+    tt = calloc(1, MAP_VTR_SIZE(num_reachables));
+    div_sw = calloc(1, MAP_RBB_SIZE(num_reachables));
+    db = calloc(1, MAP_DB_SIZE(num_reachables));
+    hc = calloc(1, MAP_HC_SIZE(num_reachables));
+    mute = calloc(1, MAP_RBB_SIZE(num_reachables));
+    if (!rbb || !rf || !tr || !vir || !vtr || !tt || !div_sw || !db || !hc ||
+        !mute) {
+
+      fprintf(stderr, "[aflrun-emu] out of memory\n");
+      num_reachables = 0;
+      return -1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+static int add_entry(emu_table_t *t, u64 addr, reach_t index) {
+
+  if (t->num == t->cap) {
+
+    size_t       cap = t->cap ? t->cap * 2 : 1024;
+    emu_entry_t *e = realloc(t->e, cap * sizeof(emu_entry_t));
+    if (e == NULL) { return -1; }
+    t->e = e;
+    t->cap = cap;
+
+  }
+
+  t->e[t->num].addr = addr;
+  t->e[t->num].index = index;
+  ++t->num;
+  t->sorted = 0;
+  memset(cache, 0, sizeof(cache));
+  return 0;
+
+}
+
+s32 aflrun_emu_load(const char *dir, const char *module, u64 base) {
+
+  if (num_reachables == 0) { return -1; }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/BBaddrs.txt", dir);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+
+    fprintf(stderr, "[aflrun-emu] cannot open %s\n", path);
+    return -1;
+
+  }
+
+  char line[PATH_MAX + 64], mod[PATH_MAX];
+  u32  lineno = 0;
+  s32  ret = 0;
+  while (fgets(line, sizeof(line), f)) {
+
+    char               kind;
+    unsigned int       index;
+    unsigned long long offset;
+
+    ++lineno;
+    if (line[0] == '\n' || line[0] == '#') { continue; }
+    if (sscanf(line, "%c %u %4095s 0x%llx", &kind, &index, mod, &offset) !=
+            4 ||
+        (kind != 'b' && kind != 'f') ||
+        index >= (kind == 'b' ? num_reachables : num_freachables)) {
+
+      fprintf(stderr, "[aflrun-emu] invalid line %u of %s\n", lineno, path);
+      ret = -1;
+      break;
+
+    }
+
+    if (strcmp(mod, module)) { continue; }
+    if (add_entry(kind == 'b' ? &blocks : &funcs, base + offset, index)) {
+
+      fprintf(stderr, "[aflrun-emu] out of memory\n");
+      ret = -1;
+      break;
+
+    }
+
+    ++ret;
+
+  }
+
+  fclose(f);
+  return ret;
+
+}
+
+static int cmp_entry(const void *a, const void *b) {
+
+  u64 x = ((const emu_entry_t *)a)->addr, y = ((const emu_entry_t *)b)->addr;
+  return x < y ? -1 : x > y;
+
+}
+
+static s64 lookup(emu_table_t *t, u64 addr) {
+
+  if (!t->sorted) {
+
+    qsort(t->e, t->num, sizeof(emu_entry_t), cmp_entry);
+    t->sorted = 1;
+
+  }
+
+  size_t lo = 0, hi = t->num;
+  while (lo < hi) {
+
+    size_t mid = lo + (hi - lo) / 2;
+    if (t->e[mid].addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+
+  }
+
+  return lo < t->num && t->e[lo].addr == addr ? (s64)t->e[lo].index : -1;
+
+}
+
+s64 aflrun_emu_block_index(u64 addr) {
+
+  return lookup(&blocks, addr);
+
+}
+
+s64 aflrun_emu_func_index(u64 addr) {
+
+  return lookup(&funcs, addr);
+
+}
+
+static ctx_t *append(trace_t *t, size_t cap) {
+
+  size_t n = atomic_load_explicit(&t->num, memory_order_relaxed);
+  atomic_store_explicit(&t->num, n + 1, memory_order_relaxed);
+  return likely(n < cap) ? t->trace + n : NULL;
+
+}
+
+void aflrun_emu_block(reach_t block) {
+
+  if (unlikely(block >= num_reachables)) { return; }
+
+  // Same test as the one aflrun-pass inlines: done already in this run
+  size_t off = (size_t)CTX_NUM_BYTES * block;
+  if (likely(tr[off] & 1)) { return; }
+
+  u8 bit = 1 << (block % 8), first = !(rbb[block / 8] & bit);
+  if (first) {
+
+    rbb[block / 8] |= bit;
+    ctx_t *e = append(db, num_reachables);
+    if (likely(e)) { e->block = block; }
+
+  }
+
+  // Muted blocks only need to be reached, with bits of all contexts set
+  if (IS_SET(mute, block)) {
+
+    memset(tr + off, 255, CTX_NUM_BYTES);
+    return;
+
+  }
+
+  tr[off] |= 1;
+
+  // For the first time a diversity block is reached, append it and count,
+  // only for targets at a lowered level
+  if (first && IS_SET(div_sw, block) &&
+      (!hdr || hdr->level == AFLRUN_LEVEL_FULL || block < num_targets)) {
+
+    ctx_t *e = append(tt, MAP_VTR_CAP(num_reachables));
+    if (likely(e)) { e->block = block; }
+    if (hc[block] != 255) { ++hc[block]; }
+
+  }
+
+  // Virgin paths are only logged when the fuzzer sets the last bit of the
+  // block map, like the runtime switching to its private virgin map
+  if (IS_SET(rbb, num_reachables) && (vir[off] & 1)) {
+
+    ctx_t *e = append(vtr, MAP_VTR_CAP(num_reachables));
+    if (likely(e)) {
+
+      vir[off] &= ~1;
+      e->block = block;
+      e->call_ctx = 0;
+
+    }
+
+  }
+
+}
+
+void aflrun_emu_func(reach_t func) {
+
+  if (unlikely(func >= num_freachables)) { return; }
+  rf[func / 8] |= 1 << (func % 8);
+
+}
+
+void aflrun_emu_trace(u64 addr) {
+
+  emu_cache_t *c =
+      cache + ((addr * 0x9E3779B97F4A7C15ULL) >> (64 - EMU_CACHE_POW2));
+  if (unlikely(c->addr != addr || (addr == 0 && c->index == 0))) {
+
+    c->addr = addr;
+    c->index = aflrun_emu_block_index(addr);
+
+  }
+
+  if (c->index >= 0) { aflrun_emu_block(c->index); }
+
+}
@@ -0,0 +1,69 @@
+/*
+   american fuzzy lop++ - AFLRun maps for emulator harnesses
+   ----------------------------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Harnesses running the target in an emulator, like those of Unicorn mode
+   or QBDI mode, have no afl-compiler-rt to write the AFLRun maps. This is a
+   small replacement for them: the harness loads the AFLRun directory written
+   by aflrun-bincfg.py, looks up the reachable index of each block when it
+   translates or hooks it, and then calls aflrun_emu_block() each time the
+   block runs, which writes the maps the way aflrun_inst() does.
+
+   All functions are for single-threaded emulation, and do nothing until
+   aflrun_emu_init() succeeded.
+
+*/
+
+#ifndef _HAVE_AFLRUN_EMU_H
+#define _HAVE_AFLRUN_EMU_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+
+#endif
+
+/* Read the numbers of targets and reachables from BBreachable.txt and
+   Freachable.txt of the AFLRun directory `dir`, as given to afl-fuzz with
+   --dir, and attach the maps of afl-fuzz, or private ones if it is not
+   running. Call it before the fork server starts, so every run inherits
+   them. Returns 0, or -1 with a message on stderr. */
+int aflrun_emu_init(const char *dir);
+
+/* Load the blocks and functions of `module` from BBaddrs.txt of `dir`, with
+   the module mapped at `base`, or at 0 for absolute addresses. Call it once
+   for each module of interest. Returns the number of entries loaded, or -1
+   with a message on stderr. */
+s32 aflrun_emu_load(const char *dir, const char *module, u64 base);
+
+/* Reachable index of the block or function starting at `addr`, or -1 if it
+   is not reachable. A binary search, so harnesses should call it when they
+   translate a block, not each time it runs. */
+s64 aflrun_emu_block_index(u64 addr);
+s64 aflrun_emu_func_index(u64 addr);
+
+/* A reachable block or function, by its index, has run. Blocks are logged
+   with context 0, as binaries have no calling contexts. */
+void aflrun_emu_block(reach_t block);
+void aflrun_emu_func(reach_t func);
+
+/* A block starting at `addr` has run, reachable or not: for trace decoders,
+   which see addresses and cannot keep the index with a translated block.
+   Lookups go through a small direct-mapped cache before the binary search,
+   as most blocks of a trace run again and again. */
+void aflrun_emu_trace(u64 addr);
+
+#ifdef __cplusplus
+
+}
+
+#endif
+
+#endif                                           /* !_HAVE_AFLRUN_EMU_H */
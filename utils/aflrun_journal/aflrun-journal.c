@@ -0,0 +1,339 @@
+/*
+   american fuzzy lop++ - aflrun-journal
+   -------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Turns `aflrun_journal.bin`, written by afl-fuzz with `--config journal=1`,
+   back into aflrun_log.txt and the fringe logs afl-fuzz writes without it,
+   see AFLRUN_JOURNAL in aflrun-record.h. The last record of each seed and
+   fringe wins; fringes are written in the order of their identifiers.
+
+*/
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "aflrun-record.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct text {
+
+  const u8 *buf;
+  size_t    len;
+
+} text_t;
+
+typedef struct block_rec {
+
+  u64    block;
+  text_t name;
+
+} block_rec_t;
+
+typedef struct fringe_rec {
+
+  u8     log;
+  u64    fringe;
+  u64    seq;                           /* Index of the record, for order  */
+  text_t lines;
+
+} fringe_rec_t;
+
+static const char *log_files[AFLRUN_JOURNAL_LOG_NUM] = {
+    "aflrun_fringe.txt", "aflrun_pro_fringe.txt", "aflrun_targets.txt"};
+
+static const char *log_headers[AFLRUN_JOURNAL_LOG_NUM] = {
+    "fringe | target group | decisives | seeds | freq\n",
+    "fringe | target group | decisives | seeds | freq\n",
+    "context | target | seeds\n"};
+
+static block_rec_t  *blocks;
+static fringe_rec_t *fringes;
+static double       *factors, *quants;
+static size_t        num_blocks, num_fringes, num_seeds;
+static text_t        tails[AFLRUN_JOURNAL_LOG_NUM];
+
+static void *grow(void *p, size_t num, size_t size) {
+
+  /* Capacities are powers of 2 */
+  if (num & (num - 1)) { return p; }
+  p = realloc(p, (num ? num * 2 : 1024) * size);
+  if (!p) { PFATAL("realloc"); }
+  return p;
+
+}
+
+static void add_seed(u64 seed, double k, double q) {
+
+  if (seed >= num_seeds) {
+
+    size_t n = seed + 1024;
+    factors = realloc(factors, n * sizeof(double));
+    quants = realloc(quants, n * sizeof(double));
+    if (!factors || !quants) { PFATAL("realloc"); }
+    memset(factors + num_seeds, 0, (n - num_seeds) * sizeof(double));
+    memset(quants + num_seeds, 0, (n - num_seeds) * sizeof(double));
+    num_seeds = n;
+
+  }
+
+  factors[seed] = k;
+  quants[seed] = q;
+
+}
+
+/* Parse the records of `buf`, stopping at a truncated one, which afl-fuzz
+   may be writing. Return the number of records. */
+
+static u64 parse(const u8 *buf, size_t size) {
+
+  const u8 *p = buf + sizeof(u64), *end = buf + size;
+  u64       seq = 0, v;
+
+  for (; p < end; p += v, ++seq) {
+
+    p = aflrun_get_varint(p, end, &v);
+    if (!p || !v || v > (u64)(end - p)) { break; }
+
+    const u8 *body = p + 1, *body_end = p + v;
+    u8        kind = p[0];
+
+    switch (kind) {
+
+      case AFLRUN_JOURNAL_BLOCK: {
+
+        blocks = grow(blocks, num_blocks, sizeof(block_rec_t));
+        block_rec_t *b = blocks + num_blocks;
+        body = aflrun_get_varint(body, body_end, &b->block);
+        if (!body) { FATAL("Corrupted block record %llu", seq); }
+        b->name.buf = body;
+        b->name.len = body_end - body;
+        ++num_blocks;
+        break;
+
+      }
+
+      case AFLRUN_JOURNAL_SEED: {
+
+        u64    seed;
+        double kq[2];
+        body = aflrun_get_varint(body, body_end, &seed);
+        if (!body || body_end - body != sizeof(kq)) {
+
+          FATAL("Corrupted seed record %llu", seq);
+
+        }
+
+        memcpy(kq, body, sizeof(kq));
+        add_seed(seed, kq[0], kq[1]);
+        break;
+
+      }
+
+      case AFLRUN_JOURNAL_FRINGE: {
+
+        fringes = grow(fringes, num_fringes, sizeof(fringe_rec_t));
+        fringe_rec_t *f = fringes + num_fringes;
+        if (body == body_end || *body >= AFLRUN_JOURNAL_LOG_NUM) {
+
+          FATAL("Corrupted fringe record %llu", seq);
+
+        }
+
+        f->log = *body;
+        body = aflrun_get_varint(body + 1, body_end, &f->fringe);
+        if (!body) { FATAL("Corrupted fringe record %llu", seq); }
+        f->seq = seq;
+        f->lines.buf = body;
+        f->lines.len = body_end - body;
+        ++num_fringes;
+        break;
+
+      }
+
+      case AFLRUN_JOURNAL_TAIL:
+        if (body == body_end || *body >= AFLRUN_JOURNAL_LOG_NUM) {
+
+          FATAL("Corrupted tail record %llu", seq);
+
+        }
+
+        tails[*body].buf = body + 1;
+        tails[*body].len = body_end - body - 1;
+        break;
+
+      default:
+        FATAL("Unknown kind %u of record %llu", kind, seq);
+
+    }
+
+  }
+
+  if (p < end) { WARNF("Ignoring a truncated record at the end"); }
+  return seq;
+
+}
+
+static int cmp_block(const void *a, const void *b) {
+
+  u64 x = ((const block_rec_t *)a)->block, y = ((const block_rec_t *)b)->block;
+  return x < y ? -1 : x > y;
+
+}
+
+static int cmp_fringe(const void *a, const void *b) {
+
+  const fringe_rec_t *x = a, *y = b;
+  if (x->log != y->log) { return x->log < y->log ? -1 : 1; }
+  if (x->fringe != y->fringe) { return x->fringe < y->fringe ? -1 : 1; }
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+
+}
+
+static FILE *create(const char *dir, const char *name) {
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  if (!f) { PFATAL("Unable to create '%s'", path); }
+  return f;
+
+}
+
+static void write_log(const char *dir) {
+
+  FILE *f = create(dir, "aflrun_log.txt");
+
+  fprintf(f, "Reached Blocks\n");
+  qsort(blocks, num_blocks, sizeof(block_rec_t), cmp_block);
+  for (size_t i = 0; i < num_blocks; ++i) {
+
+    if (i && blocks[i].block == blocks[i - 1].block) { continue; }
+    fwrite(blocks[i].name.buf, 1, blocks[i].name.len, f);
+    fputc('\n', f);
+
+  }
+
+  fprintf(f, "\nSeed Factor and Quant\n");
+  double sum = 0;
+  for (size_t s = 0; s < num_seeds; ++s) {
+
+    if (factors[s] == 0) { continue; }
+    fprintf(f, "%zu: k=%lf q=%lf\n", s, factors[s], quants[s]);
+    sum += factors[s];
+
+  }
+
+  fprintf(f, "sum = %lf", sum);
+  fclose(f);
+
+}
+
+static void write_fringes(const char *dir) {
+
+  qsort(fringes, num_fringes, sizeof(fringe_rec_t), cmp_fringe);
+
+  size_t i = 0;
+  for (u8 log = 0; log < AFLRUN_JOURNAL_LOG_NUM; ++log) {
+
+    FILE *f = create(dir, log_files[log]);
+    fputs(log_headers[log], f);
+
+    for (; i < num_fringes && fringes[i].log == log; ++i) {
+
+      /* Only the last record of a fringe counts */
+      if (i + 1 < num_fringes && fringes[i + 1].log == log &&
+          fringes[i + 1].fringe == fringes[i].fringe) {
+
+        continue;
+
+      }
+
+      fwrite(fringes[i].lines.buf, 1, fringes[i].lines.len, f);
+
+    }
+
+    fwrite(tails[log].buf, 1, tails[log].len, f);
+    fclose(f);
+
+  }
+
+}
+
+static void usage(const char *argv0) {
+
+  SAYF(
+      "Usage: %s [-o dir] <out dir>\n\n"
+      "Writes aflrun_log.txt and the fringe logs of the afl-fuzz instance of\n"
+      "<out dir> from its " AFLRUN_JOURNAL ".\n\n"
+      "  -o dir - directory to write them to (default: <out dir>)\n",
+      argv0);
+  exit(1);
+
+}
+
+int main(int argc, char **argv) {
+
+  const char *out = NULL;
+  int         opt;
+
+  while ((opt = getopt(argc, argv, "o:")) > 0) {
+
+    switch (opt) {
+
+      case 'o':
+        out = optarg;
+        break;
+      default:
+        usage(argv[0]);
+
+    }
+
+  }
+
+  if (optind + 1 != argc) { usage(argv[0]); }
+  const char *dir = argv[optind];
+  if (!out) { out = dir; }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" AFLRUN_JOURNAL, dir);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { PFATAL("Unable to open '%s'", path); }
+
+  struct stat st;
+  if (fstat(fd, &st)) { PFATAL("fstat"); }
+  u64 magic = 0;
+  if (st.st_size < (off_t)sizeof(magic) ||
+      pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+      magic != AFLRUN_JOURNAL_MAGIC) {
+
+    FATAL("'%s' is not a journal", path);
+
+  }
+
+  const u8 *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (buf == MAP_FAILED) { PFATAL("mmap"); }
+  close(fd);
+
+  u64 num = parse(buf, st.st_size);
+  write_log(out);
+  write_fringes(out);
+
+  OKF("%llu records, %zu blocks, %zu fringe records", num, num_blocks,
+      num_fringes);
+  return 0;
+
+}
@@ -0,0 +1,86 @@
+/*
+   american fuzzy lop++ - afl-segments-export
+   ------------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Writes the entries of the segment store of a queue directory, as written
+   by afl-fuzz with AFL_QUEUE_SEGMENTS, as one file per entry with the names
+   of the classic queue layout, for afl-cmin, afl-tmin, afl-showmap or any
+   other tool that wants files.
+
+*/
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "afl-segments.h"
+
+#include <errno.h>
+
+int main(int argc, char **argv) {
+
+  segments_view_t v;
+  u32             num_ids = 0, num = 0;
+
+  if (argc != 3) {
+
+    SAYF("Usage: %s <queue dir> <out dir>\n\n"
+         "Writes the latest data of every entry in the segment store of "
+         "<queue dir>\nto a file with its queue name in <out dir>.\n",
+         argv[0]);
+    return 1;
+
+  }
+
+  if (segments_open(&v, argv[1])) {
+
+    FATAL("No valid segment store in '%s'", argv[1]);
+
+  }
+
+  if (mkdir(argv[2], 0700) && errno != EEXIST) {
+
+    PFATAL("Unable to create '%s'", argv[2]);
+
+  }
+
+  u32 *latest = segments_latest(&v, &num_ids);
+  if (!latest) { PFATAL("calloc"); }
+
+  for (u32 id = 0; id < num_ids; ++id) {
+
+    if (!latest[id]) { continue; }
+
+    const segment_rec_t *r = v.recs + latest[id] - 1;
+    const u8            *mem = segments_read(&v, r);
+    u8                   path[PATH_MAX];
+
+    if (!mem) { FATAL("Unable to read data of '%s'", r->name); }
+
+    snprintf(path, sizeof(path), "%s/%s", argv[2], r->name);
+    s32 fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+    if (fd < 0) { PFATAL("Unable to create '%s'", path); }
+    if (write(fd, mem, r->len) != (ssize_t)r->len) {
+
+      PFATAL("Short write to '%s'", path);
+
+    }
+
+    close(fd);
+    ++num;
+
+  }
+
+  free(latest);
+  segments_close(&v);
+
+  OKF("Exported %u entries to '%s'.", num, argv[2]);
+  return 0;
+
+}
+
@@ -0,0 +1,625 @@
+/*
+   american fuzzy lop++ - aflrun-whatsup
+   -------------------------------------
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+   Summarizes the AFLRun progress of all instances of a sync directory, as
+   afl-whatsup does for afl-fuzz: the targets reached by any instance with
+   the first time each was reached, the modes of instances and the share of
+   CPU spent in the scheduler. fuzzer_stats and reached_targets.txt of the
+   instances are read by a pool of threads, since with hundreds of instances
+   on a network file system the time goes to waiting for each file.
+
+*/
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "aflrun-record.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* An instance is alive if its stats were updated this recently. */
+
+#define ALIVE_SEC (STATS_UPDATE_SEC * 3)
+
+/* Names of AFLRun modes, numbered as in `aflrun_get_mode`. */
+
+#define NUM_MODES 5
+static const char *mode_names[NUM_MODES] = {"coverage", "ctx fringe",
+                                            "fringe", "target", "unite"};
+
+typedef struct hit {
+
+  char *target;                         /* Name as in reached_targets.txt  */
+  u64   ms;                             /* Wall clock of first reach       */
+  u32   inst;                           /* Index of instance reaching it   */
+
+} hit_t;
+
+typedef struct instance {
+
+  char name[NAME_MAX + 1];
+
+  u8 has_stats, has_aflrun, profiled;
+
+  u64 start_time, last_update, run_time, execs_done, corpus_count,
+      saved_crashes;
+  double execs_per_sec;
+
+  u32 mode, targets, reached_targets, reachables, reached;
+  u64 fringes, clusters, sched_ms;
+
+  hit_t *hits;
+  u32    num_hits;
+
+  aflrun_reach_rec_t *reaches;          /* Records of the reach log        */
+  u32                 num_reaches;
+
+} instance_t;
+
+/* Record of a reach log, tagged with the instance that logged it. */
+
+typedef struct reach_entry {
+
+  aflrun_reach_rec_t rec;
+  u32                inst;
+
+} reach_entry_t;
+
+static char       *sync_dir;
+static instance_t *insts;
+static u32         num_insts, next_inst;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Read a whole small file, NULL if it cannot be read; its size goes to
+   `ret_size` if not NULL. */
+
+static char *read_file(const char *path, size_t *ret_size) {
+
+  FILE *f = fopen(path, "r");
+  if (!f) { return NULL; }
+
+  size_t size = 0, cap = 4096;
+  char  *buf = malloc(cap);
+  if (!buf) { PFATAL("malloc"); }
+
+  size_t n;
+  while ((n = fread(buf + size, 1, cap - size - 1, f)) > 0) {
+
+    size += n;
+    if (size + 1 == cap) {
+
+      cap *= 2;
+      buf = realloc(buf, cap);
+      if (!buf) { PFATAL("realloc"); }
+
+    }
+
+  }
+
+  fclose(f);
+  buf[size] = 0;
+  if (ret_size) { *ret_size = size; }
+  return buf;
+
+}
+
+static void parse_stats(instance_t *in, char *buf) {
+
+  u64 new_path_ms = 0, energy_ms = 0, cull_ms = 0;
+
+  char *save;
+  for (char *line = strtok_r(buf, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save)) {
+
+    char *sep = strstr(line, " : ");
+    if (!sep) { continue; }
+    char *end = sep;
+    while (end > line && end[-1] == ' ')
+      --end;
+    *end = 0;
+    const char *key = line, *val = sep + 3;
+
+#define STAT(name, field, conv)               \
+  if (!strcmp(key, name)) {                   \
+                                              \
+    in->field = conv(val, NULL, 10);          \
+    continue;                                 \
+                                              \
+  }
+
+    STAT("start_time", start_time, strtoull);
+    STAT("last_update", last_update, strtoull);
+    STAT("run_time", run_time, strtoull);
+    STAT("execs_done", execs_done, strtoull);
+    STAT("corpus_count", corpus_count, strtoull);
+    STAT("saved_crashes", saved_crashes, strtoull);
+    STAT("aflrun_mode", mode, strtoul);
+    STAT("aflrun_reached_targets", reached_targets, strtoul);
+    STAT("aflrun_reachables", reachables, strtoul);
+    STAT("aflrun_reached", reached, strtoul);
+    STAT("aflrun_fringes", fringes, strtoull);
+    STAT("aflrun_clusters", clusters, strtoull);
+
+#undef STAT
+
+    if (!strcmp(key, "execs_per_sec")) {
+
+      in->execs_per_sec = strtod(val, NULL);
+
+    } else if (!strcmp(key, "aflrun_targets")) {
+
+      in->targets = strtoul(val, NULL, 10);
+      in->has_aflrun = 1;
+
+    } else if (!strcmp(key, "prof_new_path_ms")) {
+
+      new_path_ms = strtoull(val, NULL, 10);
+      in->profiled = 1;
+
+    } else if (!strcmp(key, "prof_energy_ms")) {
+
+      energy_ms = strtoull(val, NULL, 10);
+
+    } else if (!strcmp(key, "prof_cull_ms")) {
+
+      cull_ms = strtoull(val, NULL, 10);
+
+    }
+
+  }
+
+  in->sched_ms = new_path_ms + energy_ms + cull_ms;
+  in->has_stats = 1;
+
+}
+
+/* Each line is `<ms since start> <seed> <target>`; targets are appended
+   once per session, so only the first line of each target is kept. */
+
+static void parse_hits(instance_t *in, u32 idx, char *buf) {
+
+  u32 cap = 0;
+
+  char *save;
+  for (char *line = strtok_r(buf, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save)) {
+
+    char *p;
+    u64   ms = strtoull(line, &p, 10);
+    if (p == line || *p != ' ') { continue; }
+    strtoul(p + 1, &p, 10);
+    if (*p != ' ' || !p[1]) { continue; }
+
+    if (in->num_hits == cap) {
+
+      cap = cap ? cap * 2 : 64;
+      in->hits = realloc(in->hits, cap * sizeof(hit_t));
+      if (!in->hits) { PFATAL("realloc"); }
+
+    }
+
+    hit_t *h = in->hits + in->num_hits++;
+    h->target = strdup(p + 1);
+    h->ms = in->start_time * 1000 + ms;
+    h->inst = idx;
+
+  }
+
+}
+
+static void *worker(void *arg) {
+
+  (void)arg;
+  char path[PATH_MAX];
+
+  while (1) {
+
+    pthread_mutex_lock(&next_lock);
+    u32 i = next_inst++;
+    pthread_mutex_unlock(&next_lock);
+    if (i >= num_insts) { break; }
+
+    instance_t *in = insts + i;
+    snprintf(path, sizeof(path), "%s/%s/fuzzer_stats", sync_dir, in->name);
+    char *buf = read_file(path, NULL);
+    if (!buf) { continue; }
+    parse_stats(in, buf);
+    free(buf);
+
+    if (!in->has_aflrun) { continue; }
+    snprintf(path, sizeof(path), "%s/%s/reached_targets.txt", sync_dir,
+             in->name);
+    buf = read_file(path, NULL);
+    if (buf) {
+
+      parse_hits(in, i, buf);
+      free(buf);
+
+    }
+
+    /* A record being appended may be cut short, so it is left out. */
+
+    size_t size;
+    snprintf(path, sizeof(path), "%s/%s/" AFLRUN_REACH_LOG, sync_dir,
+             in->name);
+    buf = read_file(path, &size);
+    if (!buf) { continue; }
+    in->reaches = (aflrun_reach_rec_t *)buf;
+    in->num_reaches = size / sizeof(aflrun_reach_rec_t);
+
+  }
+
+  return NULL;
+
+}
+
+/* Instances are subdirectories; a single output directory is one itself. */
+
+static void list_instances(void) {
+
+  char        path[PATH_MAX];
+  struct stat st;
+
+  snprintf(path, sizeof(path), "%s/fuzzer_stats", sync_dir);
+  if (!stat(path, &st)) {
+
+    insts = calloc(1, sizeof(instance_t));
+    if (!insts) { PFATAL("calloc"); }
+    strcpy(insts->name, ".");
+    num_insts = 1;
+    return;
+
+  }
+
+  DIR *d = opendir(sync_dir);
+  if (!d) { PFATAL("Unable to open '%s'", sync_dir); }
+
+  u32            cap = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d))) {
+
+    if (ent->d_name[0] == '.') { continue; }
+    if (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN) { continue; }
+
+    if (num_insts == cap) {
+
+      cap = cap ? cap * 2 : 64;
+      insts = realloc(insts, cap * sizeof(instance_t));
+      if (!insts) { PFATAL("realloc"); }
+
+    }
+
+    instance_t *in = insts + num_insts++;
+    memset(in, 0, sizeof(*in));
+    snprintf(in->name, sizeof(in->name), "%s", ent->d_name);
+
+  }
+
+  closedir(d);
+
+}
+
+static int cmp_hit_target(const void *a, const void *b) {
+
+  const hit_t *x = a, *y = b;
+  int          c = strcmp(x->target, y->target);
+  if (c) { return c; }
+  return x->ms < y->ms ? -1 : x->ms > y->ms;
+
+}
+
+static int cmp_hit_time(const void *a, const void *b) {
+
+  const hit_t *x = a, *y = b;
+  if (x->ms != y->ms) { return x->ms < y->ms ? -1 : 1; }
+  return strcmp(x->target, y->target);
+
+}
+
+static int cmp_reach_key(const void *a, const void *b) {
+
+  const aflrun_reach_rec_t *x = a, *y = b;
+  if (x->target != y->target) { return x->target < y->target ? -1 : 1; }
+  if (x->ctx != y->ctx) { return x->ctx < y->ctx ? -1 : 1; }
+  return x->time_ms < y->time_ms ? -1 : x->time_ms > y->time_ms;
+
+}
+
+static int cmp_reach_time(const void *a, const void *b) {
+
+  const aflrun_reach_rec_t *x = a, *y = b;
+  if (x->time_ms != y->time_ms) { return x->time_ms < y->time_ms ? -1 : 1; }
+  return cmp_reach_key(a, b);
+
+}
+
+static void usage(const char *argv0) {
+
+  SAYF(
+      "Usage: %s [-d] [-t] [-c] [-j threads] <sync dir>\n\n"
+      "Summarizes the AFLRun progress of the afl-fuzz instances of <sync dir>"
+      "\n(or of a single output directory).\n\n"
+      "  -d         - include dead instances\n"
+      "  -t         - list reached targets with their first reach\n"
+      "  -c         - list reached targets and contexts with their first "
+      "reach\n"
+      "  -j threads - threads reading the instances (default: 32)\n",
+      argv0);
+  exit(1);
+
+}
+
+int main(int argc, char **argv) {
+
+  u8  show_dead = 0, show_targets = 0, show_ctx = 0;
+  u32 num_threads = 32;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "dtcj:")) > 0) {
+
+    switch (opt) {
+
+      case 'd':
+        show_dead = 1;
+        break;
+      case 't':
+        show_targets = 1;
+        break;
+      case 'c':
+        show_ctx = 1;
+        break;
+      case 'j':
+        num_threads = strtoul(optarg, NULL, 10);
+        if (!num_threads) { usage(argv[0]); }
+        break;
+      default:
+        usage(argv[0]);
+
+    }
+
+  }
+
+  if (optind + 1 != argc) { usage(argv[0]); }
+  sync_dir = argv[optind];
+
+  list_instances();
+  if (num_threads > num_insts) { num_threads = num_insts ? num_insts : 1; }
+
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  if (!threads) { PFATAL("calloc"); }
+  for (u32 i = 1; i < num_threads; ++i) {
+
+    if (pthread_create(threads + i, NULL, worker, NULL)) {
+
+      PFATAL("pthread_create");
+
+    }
+
+  }
+
+  worker(NULL);
+  for (u32 i = 1; i < num_threads; ++i)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  /* Aggregate instances, and collect hits of all of them. */
+
+  u64 now = time(NULL), fleet_start = 0, run_time = 0, execs = 0,
+      crashes = 0, corpus = 0, fringes = 0, clusters = 0, sched_ms = 0, prof_ms = 0;
+  u32 alive = 0, dead = 0, aflrun = 0, profiled = 0, targets = 0,
+      max_reached_targets = 0, max_reached = 0, reachables = 0,
+      modes[NUM_MODES] = {0}, num_hits = 0, num_reaches = 0;
+  double speed = 0;
+
+  for (u32 i = 0; i < num_insts; ++i) {
+
+    instance_t *in = insts + i;
+    if (!in->has_stats) { continue; }
+
+    if (in->last_update + ALIVE_SEC >= now) {
+
+      ++alive;
+
+    } else {
+
+      ++dead;
+      if (!show_dead) { continue; }
+
+    }
+
+    if (!fleet_start || in->start_time < fleet_start) {
+
+      fleet_start = in->start_time;
+
+    }
+
+    run_time += in->run_time;
+    execs += in->execs_done;
+    crashes += in->saved_crashes;
+    if (in->corpus_count > corpus) { corpus = in->corpus_count; }
+    if (in->last_update + ALIVE_SEC >= now) { speed += in->execs_per_sec; }
+
+    if (!in->has_aflrun) { continue; }
+    ++aflrun;
+    if (in->targets > targets) { targets = in->targets; }
+    if (in->reachables > reachables) { reachables = in->reachables; }
+    if (in->reached_targets > max_reached_targets) {
+
+      max_reached_targets = in->reached_targets;
+
+    }
+
+    if (in->reached > max_reached) { max_reached = in->reached; }
+    fringes += in->fringes;
+    clusters += in->clusters;
+    if (in->mode < NUM_MODES) { ++modes[in->mode]; }
+    if (in->profiled) {
+
+      ++profiled;
+      sched_ms += in->sched_ms;
+      prof_ms += in->run_time * 1000;
+
+    }
+
+    num_hits += in->num_hits;
+    num_reaches += in->num_reaches;
+
+  }
+
+  hit_t   *hits = malloc((num_hits ? num_hits : 1) * sizeof(hit_t));
+  reach_entry_t *reaches = malloc((num_reaches ? num_reaches : 1) * sizeof(reach_entry_t));
+  if (!hits || !reaches) { PFATAL("malloc"); }
+  num_hits = num_reaches = 0;
+  for (u32 i = 0; i < num_insts; ++i) {
+
+    instance_t *in = insts + i;
+    if (!in->has_aflrun ||
+        (!show_dead && in->last_update + ALIVE_SEC < now)) {
+
+      continue;
+
+    }
+
+    memcpy(hits + num_hits, in->hits, in->num_hits * sizeof(hit_t));
+    num_hits += in->num_hits;
+    for (u32 j = 0; j < in->num_reaches; ++j) {
+
+      reaches[num_reaches].rec = in->reaches[j];
+      reaches[num_reaches++].inst = i;
+
+    }
+
+  }
+
+  /* Keep the earliest record of each target and context. */
+
+  qsort(reaches, num_reaches, sizeof(reach_entry_t), cmp_reach_key);
+  u32 num_ctx = 0;
+  for (u32 i = 0; i < num_reaches; ++i) {
+
+    if (num_ctx && reaches[num_ctx - 1].rec.target == reaches[i].rec.target &&
+        reaches[num_ctx - 1].rec.ctx == reaches[i].rec.ctx) {
+
+      continue;
+
+    }
+
+    reaches[num_ctx++] = reaches[i];
+
+  }
+
+  /* Keep the first reach of each target. */
+
+  qsort(hits, num_hits, sizeof(hit_t), cmp_hit_target);
+  u32 num_reached = 0;
+  for (u32 i = 0; i < num_hits; ++i) {
+
+    if (num_reached && !strcmp(hits[num_reached - 1].target, hits[i].target)) {
+
+      continue;
+
+    }
+
+    hits[num_reached++] = hits[i];
+
+  }
+
+  SAYF("Summary of AFLRun instances in %s\n\n", sync_dir);
+  SAYF("       Instances : %u alive, %u dead\n", alive, dead);
+  SAYF("  Total run time : %llu hours\n", run_time / 3600);
+  SAYF("     Total execs : %llu\n", execs);
+  SAYF("Cumulative speed : %0.02f execs/sec\n", speed);
+  SAYF("   Largest queue : %llu\n", corpus);
+  SAYF("   Crashes saved : %llu\n", crashes);
+
+  if (!aflrun) {
+
+    SAYF("\nNo instance has AFLRun stats.\n");
+    return 0;
+
+  }
+
+  SAYF("\n Reached targets : %u/%u by any instance, at most %u by one\n",
+       num_reached, targets, max_reached_targets);
+  SAYF("Reached contexts : %u targets in contexts by any instance\n",
+       num_ctx);
+  SAYF("  Reached blocks : at most %u/%u by one instance\n", max_reached,
+       reachables);
+  SAYF("         Fringes : %0.01f per instance\n", (double)fringes / aflrun);
+  SAYF("        Clusters : %0.01f per instance\n", (double)clusters / aflrun);
+  SAYF("           Modes :");
+  const char *sep = " ";
+  for (u32 m = 0; m < NUM_MODES; ++m) {
+
+    if (!modes[m]) { continue; }
+    SAYF("%s%u in %s", sep, modes[m], mode_names[m]);
+    sep = ", ";
+
+  }
+
+  SAYF("\n");
+  if (profiled) {
+
+    SAYF("   Scheduler CPU : %0.02f%% of run time of %u profiled instances\n",
+         prof_ms ? (double)sched_ms * 100 / prof_ms : 0.0, profiled);
+
+  } else {
+
+    SAYF("   Scheduler CPU : unknown, run afl-fuzz with AFLRUN_PROFILE=1\n");
+
+  }
+
+  if (show_targets && num_reached) {
+
+    qsort(hits, num_reached, sizeof(hit_t), cmp_hit_time);
+    SAYF("\nFirst reach of each target, in seconds since the first start:\n");
+    for (u32 i = 0; i < num_reached; ++i) {
+
+      SAYF("%10llu %s %s\n",
+           hits[i].ms > fleet_start * 1000
+               ? (hits[i].ms - fleet_start * 1000) / 1000
+               : 0,
+           insts[hits[i].inst].name, hits[i].target);
+
+    }
+
+  }
+
+  if (show_ctx && num_ctx) {
+
+    qsort(reaches, num_ctx, sizeof(reach_entry_t), cmp_reach_time);
+    SAYF("\nFirst reach of each target and context, in seconds since the "
+         "first start:\n");
+    for (u32 i = 0; i < num_ctx; ++i) {
+
+      const aflrun_reach_rec_t *r = &reaches[i].rec;
+      SAYF("%10llu %s id:%06u target %u ctx %u\n",
+           r->time_ms > fleet_start * 1000
+               ? (r->time_ms - fleet_start * 1000) / 1000
+               : 0,
+           insts[reaches[i].inst].name, r->seed, r->target, r->ctx);
+
+    }
+
+  }
+
+  return 0;
+
+}
+
@@ -76,11 +76,28 @@ if [ "$CCOUNT" = "0" ]; then
   exit 0
 fi
 
+# With --config crash_buckets, only look at the first crash of each bucket,
+# unless AFL_TRIAGE_ALL is set
+
+INDEX="$DIR/crashes/index.csv"
+
+if [ -f "$INDEX" -a "$AFL_TRIAGE_ALL" = "" ]; then
+  echo "Triaging the first crash of each bucket of $INDEX."
+else
+  INDEX=""
+fi
+
 echo
 
 for crash in $DIR/crashes/id:*; do
 
   id=`basename -- "$crash" | cut -d, -f1 | cut -d: -f2`
+
+  if [ -n "$INDEX" ] && ! awk -F, -v id="$id" \
+      'NR > 1 && $1 == id && $3 == 1 { found = 1 } END { exit !found }' \
+      "$INDEX"; then
+    continue
+  fi
   sig=`basename -- "$crash" | cut -d, -f2 | cut -d: -f2`
 
   # Grab the args, converting @@ to $crash
@@ -76,6 +76,20 @@
 #include "config.h"
 #include "types.h"
 
+/* With AFL_LD_NEAR_TARGETS, only allocations made while the target runs a
+   function near AFLRun targets are guarded, as counted by the target in
+   `__afl_near_target` (see AFLRUN_NEAR_DIST), and others go to glibc. */
+
+#ifdef __GLIBC__
+  #include <dlfcn.h>
+  #define NEAR_TARGETS
+void *__libc_malloc(size_t len);
+void *__libc_calloc(size_t elem_len, size_t elem_cnt);
+void *__libc_realloc(void *ptr, size_t len);
+void *__libc_memalign(size_t align, size_t len);
+void  __libc_free(void *ptr);
+#endif
+
 #if __STDC_VERSION__ < 201112L || \
     (defined(__FreeBSD__) && __FreeBSD_version < 1200000)
 // use this hack if not C11
@@ -164,6 +178,53 @@ static _Atomic size_t total_mem;        /* Currently allocated mem          */
 static __thread u32 call_depth;         /* To avoid recursion via fprintf() */
 static u32          alloc_canary;
 
+#ifdef NEAR_TARGETS
+static u8            near_targets;      /* Only guard near AFLRun targets?  */
+static __thread u32 *near_ptr;          /* `__afl_near_target` of thread    */
+static __thread u8   near_state;        /* 0 unknown, 1 looking up, 2 known */
+
+/* Whether to guard an allocation now: always, unless AFL_LD_NEAR_TARGETS is
+   set and the target is not in a function near targets. The counter is
+   thread-local, so each thread looks up its own, with allocations of the
+   lookup itself left to glibc; a target without it gets everything guarded. */
+
+static inline u8 __dislocator_guard(void) {
+
+  if (likely(!near_targets)) return 1;
+
+  if (unlikely(near_state != 2)) {
+
+    if (near_state == 1) return 0;
+    near_state = 1;
+    near_ptr = dlsym(RTLD_DEFAULT, "__afl_near_target");
+    near_state = 2;
+
+  }
+
+  return near_ptr == NULL || *near_ptr != 0;
+
+}
+
+/* Whether `ptr` is a guarded allocation: it has our canary and ends right at
+   its guard page, which an allocation of glibc is very unlikely to do. */
+
+static inline u8 __dislocator_owns(void *ptr) {
+
+  if (likely(!near_targets)) return 1;
+
+  size_t len = PTR_L(ptr);
+  if (align_allocations && (len & (ALLOC_ALIGN_SIZE - 1)))
+    len = (len & ~(ALLOC_ALIGN_SIZE - 1)) + ALLOC_ALIGN_SIZE;
+
+  return PTR_C(ptr) == alloc_canary && ((uintptr_t)ptr + len) % PAGE_SIZE == 0;
+
+}
+
+#else
+  #define __dislocator_guard() 1
+  #define __dislocator_owns(_p) 1
+#endif
+
 /* This is the main alloc function. It allocates one page more than necessary,
    sets that tailing page to PROT_NONE, and then increments the return address
    so that it is right-aligned to that boundary. Since it always uses mmap(),
@@ -327,6 +388,10 @@ __attribute__((malloc)) __attribute__((alloc_size(1, 2))) void *calloc(
 
   }
 
+#ifdef NEAR_TARGETS
+  if (!__dislocator_guard()) return __libc_calloc(elem_len, elem_cnt);
+#endif
+
   ret = __dislocator_alloc(len);
 
   DEBUGF("calloc(%zu, %zu) = %p [%zu total]", elem_len, elem_cnt, ret,
@@ -345,6 +410,10 @@ __attribute__((malloc)) __attribute__((alloc_size(1))) void *malloc(
 
   void *ret;
 
+#ifdef NEAR_TARGETS
+  if (!__dislocator_guard()) return __libc_malloc(len);
+#endif
+
   ret = __dislocator_alloc(len);
 
   DEBUGF("malloc(%zu) = %p [%zu total]", len, ret, total_mem);
@@ -367,6 +436,16 @@ void free(void *ptr) {
 
   if (!ptr) return;
 
+#ifdef NEAR_TARGETS
+  if (!__dislocator_owns(ptr)) {
+
+    __libc_free(ptr);
+    return;
+
+  }
+
+#endif
+
   if (PTR_C(ptr) != alloc_canary) FATAL("bad allocator canary on free()");
 
   len = PTR_L(ptr);
@@ -404,6 +483,11 @@ __attribute__((alloc_size(2))) void *realloc(void *ptr, size_t len) {
 
   void *ret;
 
+  /* Allocations of glibc stay there, as we cannot tell their length */
+#ifdef NEAR_TARGETS
+  if (ptr && !__dislocator_owns(ptr)) return __libc_realloc(ptr, len);
+#endif
+
   ret = malloc(len);
 
   if (ret && ptr) {
@@ -437,6 +521,16 @@ int posix_memalign(void **ptr, size_t align, size_t len) {
 
   }
 
+#ifdef NEAR_TARGETS
+  if (!__dislocator_guard()) {
+
+    *ptr = __libc_memalign(align, len);
+    return *ptr ? 0 : ENOMEM;
+
+  }
+
+#endif
+
   size_t rem = len % align;
   if (rem) len += align - rem;
 
@@ -537,6 +631,18 @@ size_t malloc_usable_size(void *ptr) {
 #else
 size_t malloc_usable_size(const void *ptr) {
 
+#endif
+
+#ifdef NEAR_TARGETS
+  if (ptr && !__dislocator_owns((void *)ptr)) {
+
+    static size_t (*libc_usable_size)(void *);
+    if (!libc_usable_size)
+      libc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    return libc_usable_size ? libc_usable_size((void *)ptr) : 0;
+
+  }
+
 #endif
 
   return ptr ? PTR_L(ptr) : 0;
@@ -575,6 +681,9 @@ __attribute__((constructor)) void __dislocator_init(void) {
   hard_fail = !!getenv("AFL_LD_HARD_FAIL");
   no_calloc_over = !!getenv("AFL_LD_NO_CALLOC_OVER");
   align_allocations = !!getenv("AFL_ALIGNED_ALLOC");
+#ifdef NEAR_TARGETS
+  near_targets = !!getenv("AFL_LD_NEAR_TARGETS");
+#endif
 
 }
 